@@ -0,0 +1,139 @@
+/* archbloom_bench.c -- throughput and latency of every structure.
+ *
+ * Results are written to stdout as CSV (default) or JSON, one record
+ * per structure, variant, operation, capacity and key size, so runs
+ * from different releases can be compared. Progress and errors go to
+ * stderr.
+ *
+ * Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "bench.h"
+
+static void usage(const char *progname) {
+	fprintf(stderr, "usage: %s [-f csv|json] [-c capacities] [-k key sizes] [-n max ops] [-p pages] [-s structure]\n\n", progname);
+	fprintf(stderr, "  -f  output format. default: csv\n");
+	fprintf(stderr, "  -c  comma separated filter capacities (expected elements).\n");
+	fprintf(stderr, "      default: 1000,100000,10000000 (L1 resident to DRAM)\n");
+	fprintf(stderr, "  -k  comma separated key sizes in bytes. default: 8,64\n");
+	fprintf(stderr, "  -n  operations per measurement. default: 1000000\n");
+	fprintf(stderr, "  -p  pages to place filters on: default, thp, 2mb or 1gb.\n");
+	fprintf(stderr, "      huge pages fall back to smaller ones when unavailable\n");
+	fprintf(stderr, "  -s  only run one structure:\n");
+	fprintf(stderr, "      bloom, sbloom, shbloom, bbloom, cbloom, tdbloom, tdcbloom, swbloom, cuckoo, mmh3, hash\n");
+}
+
+// parse a page mode. returns false on garbage
+static bool parse_pages(const char *arg, archbloom_pages *mode) {
+	const char *names[] = { "default", "thp", "2mb", "1gb" };
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (strcmp(arg, names[i]) == 0) {
+			*mode = (archbloom_pages)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// parse a comma separated list of sizes. returns false on garbage
+static bool parse_list(const char *arg, size_t *list, size_t *count) {
+	char *copy = strdup(arg);
+	char *save = NULL;
+
+	*count = 0;
+	for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		char *end;
+		unsigned long long value = strtoull(tok, &end, 10);
+
+		if (*end != '\0' || value == 0 || *count == BENCH_MAX_LIST) {
+			free(copy);
+			return false;
+		}
+
+		list[(*count)++] = value;
+	}
+
+	free(copy);
+	return *count > 0;
+}
+
+int main(int argc, char *argv[]) {
+	bench_config config = {
+		.format         = BENCH_CSV,
+		.capacities     = { 1000, 100000, 10000000 },
+		.capacity_count = 3,
+		.key_sizes      = { 8, 64 },
+		.key_size_count = 2,
+		.max_ops        = 1000000,
+		.only           = NULL
+	};
+	archbloom_pages pages = ARCHBLOOM_PAGES_DEFAULT;
+	int             opt;
+
+	while ((opt = getopt(argc, argv, "f:c:k:n:p:s:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (strcmp(optarg, "csv") == 0) {
+				config.format = BENCH_CSV;
+			} else if (strcmp(optarg, "json") == 0) {
+				config.format = BENCH_JSON;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			if (!parse_list(optarg, config.capacities, &config.capacity_count)) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'k':
+			if (!parse_list(optarg, config.key_sizes, &config.key_size_count)) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'n':
+			config.max_ops = strtoull(optarg, NULL, 10);
+			if (config.max_ops < 2) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			if (!parse_pages(optarg, &pages)) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			config.only = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	archbloom_set_pages(pages);
+
+	bench_begin(&config);
+	bench_mmh3(&config);
+	bench_bloom(&config);
+	bench_cbloom(&config);
+	bench_tdbloom(&config);
+	bench_tdcbloom(&config);
+	bench_swbloom(&config);
+	bench_cuckoo(&config);
+	bench_end(&config);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+/* bench.h -- shared harness for archbloom_bench.
+ *
+ * Each structure lives in its own bench_*.c file, since some of the
+ * library headers can't be included together (cbloom.h and
+ * tdcbloom.h both define counter_size).
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BENCH_MAX_LIST 16
+
+/* bench_format -- output formats.
+ */
+typedef enum {
+	BENCH_CSV,
+	BENCH_JSON
+} bench_format;
+
+/* bench_config -- command line settings shared by every benchmark.
+ */
+typedef struct {
+	bench_format format;
+	size_t       capacities[BENCH_MAX_LIST]; /* expected elements per filter */
+	size_t       capacity_count;
+	size_t       key_sizes[BENCH_MAX_LIST];  /* bytes */
+	size_t       key_size_count;
+	size_t       max_ops;                    /* operations per measurement */
+	const char  *only;                       /* only run this structure, or NULL */
+} bench_config;
+
+/* bench_target -- a structure and variant to benchmark. `param` is
+ * passed to create() to select a variant, such as a counter size.
+ * remove is NULL for structures that don't support removal.
+ */
+typedef struct {
+	const char *structure;
+	const char *variant;
+	int         param;
+	bool      (*create)(void **, const size_t, const int);
+	void      (*destroy)(void *);
+	size_t    (*memory)(const void *);
+	void      (*add)(void *, const void *, const size_t);
+	bool      (*lookup)(const void *, const void *, const size_t);
+	void      (*remove)(void *, const void *, const size_t);
+} bench_target;
+
+/* bench_op -- a single operation on `key`, for bench_measure().
+ */
+typedef void (*bench_op)(void *, const uint8_t *, const size_t);
+
+/* function declarations
+ */
+void bench_begin(const bench_config *);
+void bench_end(const bench_config *);
+bool bench_selected(const bench_config *, const char *);
+void bench_measure(const bench_config *,
+                   const char *,
+                   const char *,
+                   const char *,
+                   const size_t,
+                   const size_t,
+                   const size_t,
+                   const size_t,
+                   const size_t,
+                   bench_op,
+                   void *);
+void bench_run_target(const bench_config *, const bench_target *);
+
+void bench_bloom(const bench_config *);
+void bench_cbloom(const bench_config *);
+void bench_tdbloom(const bench_config *);
+void bench_tdcbloom(const bench_config *);
+void bench_swbloom(const bench_config *);
+void bench_cuckoo(const bench_config *);
+void bench_mmh3(const bench_config *);
+
+#endif /* BENCH_H */
@@ -0,0 +1,248 @@
+/* bench_bloom.c -- classic, scalable, sharded and blocked Bloom filters.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bloom.h"
+#include "sbloom.h"
+#include "shbloom.h"
+#include "bbloom.h"
+
+#define ACCURACY 0.01
+#define SAVES    20
+
+static bool bloom_create(void **state, const size_t capacity, const int flags) {
+	bloomfilter *bf = malloc(sizeof(bloomfilter));
+
+	if (bf == NULL || bloom_init_flags(bf, capacity, ACCURACY, flags) != BF_SUCCESS) {
+		free(bf);
+		return false;
+	}
+
+	*state = bf;
+	return true;
+}
+
+static void bloom_free(void *state) {
+	bloom_destroy(state);
+	free(state);
+}
+
+static size_t bloom_memory(const void *state) {
+	return ((const bloomfilter *)state)->bitmap_size;
+}
+
+static void bloom_add_op(void *state, const void *key, const size_t len) {
+	bloom_add(state, key, len);
+}
+
+static bool bloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return bloom_lookup(state, key, len);
+}
+
+/* scalable filters start at a sixteenth of the capacity and add slices
+ * as they fill.
+ */
+static bool sbloom_create(void **state, const size_t capacity, const int param) {
+	sbloomfilter *sbf = malloc(sizeof(sbloomfilter));
+
+	if (sbf == NULL ||
+		sbloom_init_flags(sbf, capacity / 16 + 1, ACCURACY, SBLOOM_GROWTH,
+						  SBLOOM_TIGHTENING, param) != BF_SUCCESS) {
+		free(sbf);
+		return false;
+	}
+
+	*state = sbf;
+	return true;
+}
+
+static void sbloom_free(void *state) {
+	sbloom_destroy(state);
+	free(state);
+}
+
+static size_t sbloom_memory_op(const void *state) {
+	return sbloom_memory(state);
+}
+
+static void sbloom_add_op(void *state, const void *key, const size_t len) {
+	sbloom_add(state, key, len);
+}
+
+static bool sbloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return sbloom_lookup(state, key, len);
+}
+
+static bool shbloom_create(void **state, const size_t capacity, const int flags) {
+	shbloomfilter *sf = malloc(sizeof(shbloomfilter));
+
+	if (sf == NULL || shbloom_init_flags(sf, capacity, ACCURACY, 8, flags, NULL) != BF_SUCCESS) {
+		free(sf);
+		return false;
+	}
+
+	*state = sf;
+	return true;
+}
+
+static void shbloom_free(void *state) {
+	shbloom_destroy(state);
+	free(state);
+}
+
+static size_t shbloom_memory_op(const void *state) {
+	return shbloom_memory(state);
+}
+
+static void shbloom_add_op(void *state, const void *key, const size_t len) {
+	shbloom_add(state, key, len);
+}
+
+static bool shbloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return shbloom_lookup(state, key, len);
+}
+
+static bool bbloom_create(void **state, const size_t capacity, const int param) {
+	bbloomfilter *bf = malloc(sizeof(bbloomfilter));
+
+	(void)param;
+	if (bf == NULL || bbloom_init(bf, capacity, ACCURACY) != BBF_SUCCESS) {
+		free(bf);
+		return false;
+	}
+
+	*state = bf;
+	return true;
+}
+
+static void bbloom_free(void *state) {
+	bbloom_destroy(state);
+	free(state);
+}
+
+static size_t bbloom_memory(const void *state) {
+	return ((const bbloomfilter *)state)->bitmap_size;
+}
+
+static void bbloom_add_op(void *state, const void *key, const size_t len) {
+	bbloom_add(state, key, len);
+}
+
+static bool bbloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return bbloom_lookup(state, key, len);
+}
+
+/* compressed save and load. The key is unused; one operation saves or
+ * loads the whole filter through a temporary file.
+ */
+typedef struct {
+	bloomfilter *bf;
+	int          fd;
+} file_ctx;
+
+static void save_compressed_op(void *state, const uint8_t *key, const size_t len) {
+	file_ctx *ctx = state;
+
+	(void)key;
+	(void)len;
+	if (ftruncate(ctx->fd, 0) != 0 || lseek(ctx->fd, 0, SEEK_SET) != 0 ||
+		bloom_save_compressed_fd(ctx->bf, ctx->fd) != BF_SUCCESS) {
+		fprintf(stderr, "bloom: bloom_save_compressed_fd() failed\n");
+	}
+}
+
+static void load_compressed_op(void *state, const uint8_t *key, const size_t len) {
+	file_ctx    *ctx = state;
+	bloomfilter  loaded;
+
+	(void)key;
+	(void)len;
+	if (lseek(ctx->fd, 0, SEEK_SET) != 0 || bloom_load_fd(&loaded, ctx->fd) != BF_SUCCESS) {
+		fprintf(stderr, "bloom: bloom_load_fd() failed\n");
+		return;
+	}
+	bloom_destroy(&loaded);
+}
+
+/* bench_compression() -- bytes on the wire and save/load time of
+ * bloom_save_compressed() for filters loaded to a few percentages of
+ * their capacity, and for a full bloom_init_compressible() filter.
+ * The memory column is the size of the saved file; compare it to the
+ * memory of bloom/modulo.
+ */
+static void bench_compression(const bench_config *config) {
+	const struct {
+		const char *variant;
+		int         percent;
+		float       growth;
+	} loads[] = {
+		{ "compressed_2pct",  2,   1.0 },
+		{ "compressed_25pct", 25,  1.0 },
+		{ "compressed_full",  100, 1.0 },
+		{ "compressible_4x",  100, 4.0 },
+	};
+
+	for (size_t c = 0; c < config->capacity_count; c++) {
+		size_t capacity = config->capacities[c];
+
+		for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+			bloomfilter bf;
+			FILE       *fp = tmpfile();
+
+			if (fp == NULL || bloom_init_compressible(&bf, capacity, ACCURACY, loads[l].growth) != BF_SUCCESS) {
+				fprintf(stderr, "bloom/%s: unable to create with capacity %zu\n", loads[l].variant, capacity);
+				if (fp != NULL) {
+					fclose(fp);
+				}
+				continue;
+			}
+
+			for (uint64_t i = 0; i < capacity * loads[l].percent / 100; i++) {
+				bloom_add(&bf, &i, sizeof(i));
+			}
+
+			file_ctx ctx    = { &bf, fileno(fp) };
+			size_t   memory = bloom_compressed_size(&bf);
+
+			bench_measure(config, "bloom", loads[l].variant, "save_compressed", capacity, memory,
+						  sizeof(uint64_t), 0, SAVES, save_compressed_op, &ctx);
+			bench_measure(config, "bloom", loads[l].variant, "load_compressed", capacity, memory,
+						  sizeof(uint64_t), 0, SAVES, load_compressed_op, &ctx);
+
+			bloom_destroy(&bf);
+			fclose(fp);
+		}
+	}
+}
+
+void bench_bloom(const bench_config *config) {
+	const bench_target targets[] = {
+		{ "bloom", "modulo", 0, bloom_create, bloom_free, bloom_memory,
+		  bloom_add_op, bloom_lookup_op, NULL },
+		{ "bloom", "fastrange", BLOOM_FLAG_FASTRANGE, bloom_create, bloom_free, bloom_memory,
+		  bloom_add_op, bloom_lookup_op, NULL },
+		{ "bloom", "pow2", BLOOM_FLAG_POW2, bloom_create, bloom_free, bloom_memory,
+		  bloom_add_op, bloom_lookup_op, NULL },
+		{ "bloom", "concurrent", BLOOM_FLAG_CONCURRENT, bloom_create, bloom_free, bloom_memory,
+		  bloom_add_op, bloom_lookup_op, NULL },
+		{ "sbloom", "scalable", BLOOM_FLAG_FASTRANGE, sbloom_create, sbloom_free, sbloom_memory_op,
+		  sbloom_add_op, sbloom_lookup_op, NULL },
+		{ "shbloom", "8_shards", BLOOM_FLAG_FASTRANGE, shbloom_create, shbloom_free, shbloom_memory_op,
+		  shbloom_add_op, shbloom_lookup_op, NULL },
+		{ "shbloom", "8_shards_locked", BLOOM_FLAG_FASTRANGE | SHBLOOM_FLAG_LOCKED, shbloom_create,
+		  shbloom_free, shbloom_memory_op, shbloom_add_op, shbloom_lookup_op, NULL },
+		{ "bbloom", "blocked", 0, bbloom_create, bbloom_free, bbloom_memory,
+		  bbloom_add_op, bbloom_lookup_op, NULL },
+	};
+
+	for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+		bench_run_target(config, &targets[i]);
+	}
+
+	if (bench_selected(config, "bloom")) {
+		bench_compression(config);
+	}
+}
@@ -0,0 +1,64 @@
+/* bench_cbloom.c -- counting Bloom filters, for every counter size.
+ */
+#include <stdlib.h>
+
+#include "bench.h"
+#include "cbloom.h"
+
+#define ACCURACY 0.01
+
+static bool cbloom_create(void **state, const size_t capacity, const int csize) {
+	cbloomfilter *cbf = malloc(sizeof(cbloomfilter));
+
+	if (cbf == NULL || cbloom_init(cbf, capacity, ACCURACY, csize) != CBF_SUCCESS) {
+		free(cbf);
+		return false;
+	}
+
+	*state = cbf;
+	return true;
+}
+
+static void cbloom_free(void *state) {
+	cbloom_destroy(state);
+	free(state);
+}
+
+static size_t cbloom_memory(const void *state) {
+	return ((const cbloomfilter *)state)->countermap_size;
+}
+
+static void cbloom_add_op(void *state, const void *key, const size_t len) {
+	cbloom_add(state, (void *)key, len);
+}
+
+static bool cbloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return cbloom_lookup(state, (void *)key, len);
+}
+
+static void cbloom_remove_op(void *state, const void *key, const size_t len) {
+	cbloom_remove(state, (void *)key, len);
+}
+
+void bench_cbloom(const bench_config *config) {
+	const struct {
+		const char   *name;
+		counter_size  csize;
+	} variants[] = {
+		{ "4bit",  COUNTER_4BIT },
+		{ "8bit",  COUNTER_8BIT },
+		{ "16bit", COUNTER_16BIT },
+		{ "32bit", COUNTER_32BIT },
+		{ "64bit", COUNTER_64BIT },
+	};
+
+	for (size_t i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+		bench_target target = {
+			"cbloom", variants[i].name, variants[i].csize,
+			cbloom_create, cbloom_free, cbloom_memory,
+			cbloom_add_op, cbloom_lookup_op, cbloom_remove_op
+		};
+
+		bench_run_target(config, &target);
+	}
+}
@@ -0,0 +1,78 @@
+/* bench_cuckoo.c -- cuckoo filters.
+ */
+#include <stdlib.h>
+
+#include "bench.h"
+#include "cuckoo.h"
+
+#define BUCKET_SIZE 4
+#define MAX_KICKS   500
+
+/* size for a 90% load factor at capacity. param packs the fingerprint
+ * size in the low byte and the CUCKOO_FLAG_* options above it. Growing
+ * filters start at an eighth of that and double three times.
+ */
+static bool cuckoo_create(void **state, const size_t capacity, const int param) {
+	cuckoofilter *cf          = malloc(sizeof(cuckoofilter));
+	size_t        num_buckets = (capacity / BUCKET_SIZE) * 10 / 9 + 1;
+
+	if ((param >> 8) & CUCKOO_FLAG_GROW) {
+		num_buckets = num_buckets / 8 + 1;
+	}
+
+	if (cf == NULL || !cuckoo_init_flags(cf, num_buckets, BUCKET_SIZE, MAX_KICKS,
+										 param & 0xff, param >> 8)) {
+		free(cf);
+		return false;
+	}
+
+	*state = cf;
+	return true;
+}
+
+static void cuckoo_free(void *state) {
+	cuckoo_destroy(state);
+	free(state);
+}
+
+static size_t cuckoo_memory(const void *state) {
+	size_t memory = 0;
+
+	for (const cuckoofilter *cf = state; cf != NULL; cf = cf->next) {
+		memory += (cf->num_buckets * cf->bucket_bytes) +
+			(cf->num_buckets * sizeof(size_t));
+	}
+
+	return memory;
+}
+
+static void cuckoo_add_op(void *state, const void *key, const size_t len) {
+	cuckoo_add(state, key, len);
+}
+
+static bool cuckoo_lookup_op(const void *state, const void *key, const size_t len) {
+	return cuckoo_lookup(state, key, len);
+}
+
+static void cuckoo_remove_op(void *state, const void *key, const size_t len) {
+	cuckoo_remove(state, key, len);
+}
+
+void bench_cuckoo(const bench_config *config) {
+	const bench_target targets[] = {
+		{ "cuckoo", "b4_fp8", 8, cuckoo_create, cuckoo_free, cuckoo_memory,
+		  cuckoo_add_op, cuckoo_lookup_op, cuckoo_remove_op },
+		{ "cuckoo", "b4_fp12", 12, cuckoo_create, cuckoo_free, cuckoo_memory,
+		  cuckoo_add_op, cuckoo_lookup_op, cuckoo_remove_op },
+		{ "cuckoo", "b4", 16, cuckoo_create, cuckoo_free, cuckoo_memory,
+		  cuckoo_add_op, cuckoo_lookup_op, cuckoo_remove_op },
+		{ "cuckoo", "b4_concurrent", 16 | (CUCKOO_FLAG_CONCURRENT << 8), cuckoo_create, cuckoo_free,
+		  cuckoo_memory, cuckoo_add_op, cuckoo_lookup_op, cuckoo_remove_op },
+		{ "cuckoo", "b4_grow", 16 | (CUCKOO_FLAG_GROW << 8), cuckoo_create, cuckoo_free,
+		  cuckoo_memory, cuckoo_add_op, cuckoo_lookup_op, cuckoo_remove_op },
+	};
+
+	for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+		bench_run_target(config, &targets[i]);
+	}
+}
@@ -0,0 +1,74 @@
+/* bench_mmh3.c -- MurmurHash3 variants used by the filters, and the
+ * hash strategies filters can select with *_set_hash().
+ */
+#include "bench.h"
+#include "mmh3.h"
+#include "hash.h"
+
+// filters at 1% accuracy use 6 or 7 hashes
+#define HASHCOUNT 7
+
+static volatile uint64_t sink;
+
+static void mmh3_32_op(void *ctx, const uint8_t *key, const size_t len) {
+	(void)ctx;
+	sink += mmh3_32(key, len, 0);
+}
+
+static void mmh3_64_op(void *ctx, const uint8_t *key, const size_t len) {
+	(void)ctx;
+	sink += mmh3_64(key, len, 0);
+}
+
+static void mmh3_128_op(void *ctx, const uint8_t *key, const size_t len) {
+	uint64_t out[2];
+
+	(void)ctx;
+	mmh3_128(key, len, 0, out);
+	sink += out[0];
+}
+
+static void make_hashes_op(void *ctx, const uint8_t *key, const size_t len) {
+	uint64_t hashes[HASHCOUNT];
+
+	(void)ctx;
+	mmh3_64_make_hashes(key, len, HASHCOUNT, hashes);
+	sink += hashes[HASHCOUNT - 1];
+}
+
+static void hash_make_hashes_op(void *ctx, const uint8_t *key, const size_t len) {
+	uint64_t hashes[HASHCOUNT];
+
+	hash_make_hashes(*(const hash_strategy *)ctx, key, len, HASHCOUNT, hashes);
+	sink += hashes[HASHCOUNT - 1];
+}
+
+void bench_mmh3(const bench_config *config) {
+	const struct {
+		const char *operation;
+		bench_op    op;
+	} ops[] = {
+		{ "mmh3_32",        mmh3_32_op },
+		{ "mmh3_64",        mmh3_64_op },
+		{ "mmh3_128",       mmh3_128_op },
+		{ "make_hashes_k7", make_hashes_op },
+	};
+
+	if (bench_selected(config, "mmh3")) {
+		for (size_t k = 0; k < config->key_size_count; k++) {
+			for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+				bench_measure(config, "mmh3", "seed0", ops[i].operation, 0, 0,
+							  config->key_sizes[k], 0, config->max_ops, ops[i].op, NULL);
+			}
+		}
+	}
+
+	if (bench_selected(config, "hash")) {
+		for (size_t k = 0; k < config->key_size_count; k++) {
+			for (hash_strategy s = 0; s < HASH_STRATEGYCOUNT; s++) {
+				bench_measure(config, "hash", hash_strategy_name(s), "make_hashes_k7", 0, 0,
+							  config->key_sizes[k], 0, config->max_ops, hash_make_hashes_op, &s);
+			}
+		}
+	}
+}
@@ -0,0 +1,56 @@
+/* bench_swbloom.c -- sliding window Bloom filters.
+ *
+ * Uses the window of bench_tdbloom.c, so the two can be compared
+ * directly. The variant is the number of generations.
+ */
+#include <stdlib.h>
+
+#include "bench.h"
+#include "swbloom.h"
+
+#define ACCURACY 0.01
+#define TIMEOUT  3600
+
+static bool swbloom_create(void **state, const size_t capacity, const int param) {
+	swbloom *swbf = malloc(sizeof(swbloom));
+
+	if (swbf == NULL || swbloom_init(swbf, capacity, ACCURACY, TIMEOUT, param) != SWBF_SUCCESS) {
+		free(swbf);
+		return false;
+	}
+
+	*state = swbf;
+	return true;
+}
+
+static void swbloom_free(void *state) {
+	swbloom_destroy(state);
+	free(state);
+}
+
+static size_t swbloom_memory_op(const void *state) {
+	return swbloom_memory(state);
+}
+
+static void swbloom_add_op(void *state, const void *key, const size_t len) {
+	swbloom_add(state, key, len);
+}
+
+static bool swbloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return swbloom_lookup(state, key, len);
+}
+
+void bench_swbloom(const bench_config *config) {
+	const bench_target targets[] = {
+		{ "swbloom", "timeout3600_gen4", 4,
+		  swbloom_create, swbloom_free, swbloom_memory_op,
+		  swbloom_add_op, swbloom_lookup_op, NULL },
+		{ "swbloom", "timeout3600_gen8", 8,
+		  swbloom_create, swbloom_free, swbloom_memory_op,
+		  swbloom_add_op, swbloom_lookup_op, NULL },
+	};
+
+	for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+		bench_run_target(config, &targets[i]);
+	}
+}
@@ -0,0 +1,51 @@
+/* bench_tdbloom.c -- time-decaying Bloom filters.
+ */
+#include <stdlib.h>
+
+#include "bench.h"
+#include "tdbloom.h"
+
+#define ACCURACY 0.01
+#define TIMEOUT  3600
+
+static bool tdbloom_create(void **state, const size_t capacity, const int param) {
+	tdbloom *tdbf = malloc(sizeof(tdbloom));
+
+	(void)param;
+	if (tdbf == NULL || tdbloom_init(tdbf, capacity, ACCURACY, TIMEOUT) != TDBF_SUCCESS) {
+		free(tdbf);
+		return false;
+	}
+
+	*state = tdbf;
+	return true;
+}
+
+static void tdbloom_free(void *state) {
+	tdbloom_destroy(state);
+	free(state);
+}
+
+static size_t tdbloom_memory(const void *state) {
+	const tdbloom *tdbf = state;
+
+	return tdbf->filter_size * tdbf->bytes;
+}
+
+static void tdbloom_add_op(void *state, const void *key, const size_t len) {
+	tdbloom_add(state, key, len);
+}
+
+static bool tdbloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return tdbloom_lookup(state, key, len);
+}
+
+void bench_tdbloom(const bench_config *config) {
+	bench_target target = {
+		"tdbloom", "timeout3600", 0,
+		tdbloom_create, tdbloom_free, tdbloom_memory,
+		tdbloom_add_op, tdbloom_lookup_op, NULL
+	};
+
+	bench_run_target(config, &target);
+}
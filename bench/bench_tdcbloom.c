@@ -0,0 +1,126 @@
+/* bench_tdcbloom.c -- time-decaying counting Bloom filters, for every
+ * counter and timer size combination.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "tdcbloom.h"
+
+#define ACCURACY 0.01
+#define TIMEOUT  60
+#define SWEEPS   20
+
+/* param packs the counter size in the low byte, the timer size in the
+ * next byte and the TDCBLOOM_FLAG_* options above them.
+ */
+static bool tdcbloom_create(void **state, const size_t capacity, const int param) {
+	tdcbloom *tdcbf = malloc(sizeof(tdcbloom));
+
+	if (tdcbf == NULL ||
+		tdcbloom_init_flags(tdcbf, capacity, ACCURACY, TIMEOUT,
+							param & 0xff, (param >> 8) & 0xff, param >> 16) != TDCBF_SUCCESS) {
+		free(tdcbf);
+		return false;
+	}
+
+	*state = tdcbf;
+	return true;
+}
+
+static void tdcbloom_free(void *state) {
+	tdcbloom_destroy(state);
+	free(state);
+}
+
+static size_t tdcbloom_memory(const void *state) {
+	const tdcbloom *tdcbf = state;
+
+	return tdcbf->entrymap_size;
+}
+
+static void tdcbloom_add_op(void *state, const void *key, const size_t len) {
+	tdcbloom_add(state, key, len);
+}
+
+static bool tdcbloom_lookup_op(const void *state, const void *key, const size_t len) {
+	return tdcbloom_lookup(state, key, len);
+}
+
+static void tdcbloom_remove_op(void *state, const void *key, const size_t len) {
+	tdcbloom_remove(state, key, len);
+}
+
+// whole filter sweeps. The key is unused; one operation is one sweep.
+static void tdcbloom_clear_expired_op(void *state, const uint8_t *key, const size_t len) {
+	(void)key;
+	(void)len;
+	tdcbloom_clear_expired(state);
+}
+
+static void tdcbloom_count_expired_op(void *state, const uint8_t *key, const size_t len) {
+	(void)key;
+	(void)len;
+	tdcbloom_count_expired(state);
+}
+
+/* bench_sweeps() -- time expiry sweeps over a filter holding `capacity`
+ * elements. Divide the reported memory by the time per operation for
+ * the sweep bandwidth.
+ */
+static void bench_sweeps(const bench_config *config, const char *variant, const int param) {
+	for (size_t c = 0; c < config->capacity_count; c++) {
+		size_t capacity = config->capacities[c];
+		void  *state;
+
+		if (!tdcbloom_create(&state, capacity, param)) {
+			fprintf(stderr, "tdcbloom/%s: unable to create with capacity %zu\n", variant, capacity);
+			continue;
+		}
+
+		for (uint64_t i = 0; i < capacity; i++) {
+			tdcbloom_add(state, &i, sizeof(i));
+		}
+
+		size_t memory = tdcbloom_memory(state);
+
+		bench_measure(config, "tdcbloom", variant, "clear_expired", capacity, memory,
+					  sizeof(uint64_t), 0, SWEEPS, tdcbloom_clear_expired_op, state);
+		bench_measure(config, "tdcbloom", variant, "count_expired", capacity, memory,
+					  sizeof(uint64_t), 0, SWEEPS, tdcbloom_count_expired_op, state);
+
+		tdcbloom_free(state);
+	}
+}
+
+void bench_tdcbloom(const bench_config *config) {
+	const counter_size counters[] = { COUNTER_8BIT, COUNTER_16BIT, COUNTER_32BIT, COUNTER_64BIT };
+	const timer_size   timers[]   = { TIMER_8BIT, TIMER_16BIT, TIMER_32BIT, TIMER_64BIT };
+	const int          bits[]     = { 8, 16, 32, 64 };
+
+	const uint32_t     layouts[]  = { 0, TDCBLOOM_FLAG_SOA };
+
+	for (size_t c = 0; c < 4; c++) {
+		for (size_t t = 0; t < 4; t++) {
+			for (size_t l = 0; l < 2; l++) {
+				char variant[32];
+				int  param = counters[c] | (timers[t] << 8) | (layouts[l] << 16);
+
+				snprintf(variant, sizeof(variant), "c%d_t%d%s", bits[c], bits[t],
+						 (layouts[l] & TDCBLOOM_FLAG_SOA) ? "_soa" : "");
+
+				bench_target target = {
+					"tdcbloom", variant, param,
+					tdcbloom_create, tdcbloom_free, tdcbloom_memory,
+					tdcbloom_add_op, tdcbloom_lookup_op, tdcbloom_remove_op
+				};
+
+				bench_run_target(config, &target);
+
+				if (bench_selected(config, "tdcbloom")) {
+					bench_sweeps(config, variant, param);
+				}
+			}
+		}
+	}
+}
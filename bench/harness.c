@@ -0,0 +1,258 @@
+/* harness.c -- timing, key generation and output for archbloom_bench.
+ *
+ * Every measurement runs `count` operations. The first half is timed
+ * as a whole for throughput (ns_per_op). The second half is timed one
+ * operation at a time for latency percentiles, with the cost of
+ * reading the clock subtracted. Both include writing the key, which is
+ * a single 8 byte store.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+static bool   first_record = true;
+static double clock_overhead = -1;
+
+static inline double now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+// cheapest observed back to back clock read
+static double measure_clock_overhead() {
+	double best = 1e9;
+
+	for (int i = 0; i < 1000; i++) {
+		double start   = now_ns();
+		double elapsed = now_ns() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+
+	return best;
+}
+
+/* make_key() -- write the i-th key. Keys are a fixed random buffer
+ * with a bijective mix of `i` in the first 8 bytes, so they are
+ * distinct and don't share hash structure.
+ */
+static inline void make_key(uint8_t *key, const size_t key_size, const uint64_t i) {
+	uint64_t x = i * 0x9e3779b97f4a7c15ULL;
+
+	memcpy(key, &x, key_size < sizeof(x) ? key_size : sizeof(x));
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, const size_t count, const double p) {
+	if (count == 0) {
+		return 0;
+	}
+
+	return sorted[(size_t)(p * (count - 1))];
+}
+
+/* bench_begin() -- print anything that comes before the first result.
+ */
+void bench_begin(const bench_config *config) {
+	if (config->format == BENCH_CSV) {
+		printf("structure,variant,operation,capacity,memory_bytes,key_size,ops,"
+			   "ns_per_op,mops,p50_ns,p90_ns,p99_ns,p999_ns\n");
+	} else {
+		printf("[");
+	}
+
+	first_record = true;
+}
+
+/* bench_end() -- print anything that comes after the last result.
+ */
+void bench_end(const bench_config *config) {
+	if (config->format == BENCH_JSON) {
+		printf("\n]\n");
+	}
+}
+
+/* bench_selected() -- true if `structure` was selected on the command
+ * line.
+ */
+bool bench_selected(const bench_config *config, const char *structure) {
+	return config->only == NULL || strcmp(structure, config->only) == 0;
+}
+
+static void emit(const bench_config *config,
+                 const char *structure,
+                 const char *variant,
+                 const char *operation,
+                 const size_t capacity,
+                 const size_t memory,
+                 const size_t key_size,
+                 const size_t ops,
+                 const double ns_per_op,
+                 const double *latencies) {
+	double mops = (ns_per_op > 0) ? 1e3 / ns_per_op : 0;
+
+	if (config->format == BENCH_CSV) {
+		printf("%s,%s,%s,%zu,%zu,%zu,%zu,%.2f,%.2f,%.0f,%.0f,%.0f,%.0f\n",
+			   structure, variant, operation, capacity, memory, key_size, ops,
+			   ns_per_op, mops, latencies[0], latencies[1], latencies[2], latencies[3]);
+	} else {
+		printf("%s\n  {\"structure\": \"%s\", \"variant\": \"%s\", \"operation\": \"%s\", "
+			   "\"capacity\": %zu, \"memory_bytes\": %zu, \"key_size\": %zu, \"ops\": %zu, "
+			   "\"ns_per_op\": %.2f, \"mops\": %.2f, "
+			   "\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f}",
+			   first_record ? "" : ",",
+			   structure, variant, operation, capacity, memory, key_size, ops,
+			   ns_per_op, mops, latencies[0], latencies[1], latencies[2], latencies[3]);
+	}
+
+	first_record = false;
+	fflush(stdout);
+}
+
+/* bench_measure() -- run `op` on keys [first_key, first_key + count)
+ * and print the result.
+ */
+void bench_measure(const bench_config *config,
+                   const char *structure,
+                   const char *variant,
+                   const char *operation,
+                   const size_t capacity,
+                   const size_t memory,
+                   const size_t key_size,
+                   const size_t first_key,
+                   const size_t count,
+                   bench_op op,
+                   void *ctx) {
+	uint8_t *key;
+	double  *samples;
+	size_t   half = count / 2;
+	double   latencies[4];
+
+	if (clock_overhead < 0) {
+		clock_overhead = measure_clock_overhead();
+	}
+
+	key     = malloc(key_size);
+	samples = malloc((count - half + 1) * sizeof(double));
+	if (key == NULL || samples == NULL) {
+		fprintf(stderr, "%s/%s: out of memory\n", structure, variant);
+		free(key);
+		free(samples);
+		return;
+	}
+
+	srand(1);
+	for (size_t i = 0; i < key_size; i++) {
+		key[i] = (uint8_t)rand();
+	}
+
+	// throughput
+	double start = now_ns();
+	for (size_t i = 0; i < half; i++) {
+		make_key(key, key_size, first_key + i);
+		op(ctx, key, key_size);
+	}
+	double elapsed = now_ns() - start;
+
+	// latency
+	for (size_t i = half; i < count; i++) {
+		double op_start = now_ns();
+		make_key(key, key_size, first_key + i);
+		op(ctx, key, key_size);
+		double op_time = now_ns() - op_start - clock_overhead;
+
+		samples[i - half] = (op_time > 0) ? op_time : 0;
+	}
+
+	qsort(samples, count - half, sizeof(double), compare_doubles);
+	latencies[0] = percentile(samples, count - half, 0.50);
+	latencies[1] = percentile(samples, count - half, 0.90);
+	latencies[2] = percentile(samples, count - half, 0.99);
+	latencies[3] = percentile(samples, count - half, 0.999);
+
+	emit(config, structure, variant, operation, capacity, memory, key_size, count,
+		 (half > 0) ? elapsed / half : 0, latencies);
+
+	free(samples);
+	free(key);
+}
+
+/* target_ctx, target_* -- adapt a bench_target to bench_op.
+ */
+typedef struct {
+	const bench_target *target;
+	void               *state;
+	size_t              found;
+} target_ctx;
+
+static void target_add(void *ctx, const uint8_t *key, const size_t len) {
+	target_ctx *t = ctx;
+	t->target->add(t->state, key, len);
+}
+
+static void target_lookup(void *ctx, const uint8_t *key, const size_t len) {
+	target_ctx *t = ctx;
+	t->found += t->target->lookup(t->state, key, len);
+}
+
+static void target_remove(void *ctx, const uint8_t *key, const size_t len) {
+	target_ctx *t = ctx;
+	t->target->remove(t->state, key, len);
+}
+
+/* bench_run_target() -- benchmark add, lookup of present and absent
+ * keys, and remove on `target` for every capacity and key size.
+ *
+ * At most max_ops keys are added, so filters with a larger capacity
+ * are only partly filled. Lookup costs are still representative since
+ * every probe lands at random within the full filter.
+ */
+void bench_run_target(const bench_config *config, const bench_target *target) {
+	if (!bench_selected(config, target->structure)) {
+		return;
+	}
+
+	for (size_t c = 0; c < config->capacity_count; c++) {
+		size_t capacity = config->capacities[c];
+		size_t count    = (capacity < config->max_ops) ? capacity : config->max_ops;
+
+		for (size_t k = 0; k < config->key_size_count; k++) {
+			size_t     key_size = config->key_sizes[k];
+			target_ctx ctx      = { .target = target };
+
+			if (!target->create(&ctx.state, capacity, target->param)) {
+				fprintf(stderr, "%s/%s: unable to create with capacity %zu\n",
+						target->structure, target->variant, capacity);
+				continue;
+			}
+
+			size_t memory = target->memory(ctx.state);
+
+			bench_measure(config, target->structure, target->variant, "add",
+						  capacity, memory, key_size, 0, count, target_add, &ctx);
+			bench_measure(config, target->structure, target->variant, "lookup_hit",
+						  capacity, memory, key_size, 0, count, target_lookup, &ctx);
+			bench_measure(config, target->structure, target->variant, "lookup_miss",
+						  capacity, memory, key_size, count, count, target_lookup, &ctx);
+			if (target->remove) {
+				bench_measure(config, target->structure, target->variant, "remove",
+							  capacity, memory, key_size, 0, count, target_remove, &ctx);
+			}
+
+			target->destroy(ctx.state);
+		}
+	}
+}
@@ -1,32 +1,322 @@
+#define _GNU_SOURCE // memrchr()
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 //#include <archbloom/bloom.h>
 #include "../src/bloom.h"
 
+// input is split into chunks of whole lines, about this size, for workers
+#define CHUNK_SIZE  (4 * 1024 * 1024)
+// chunks waiting for a worker, per worker
+#define QUEUE_DEPTH 2
+#define MAX_THREADS 256
+
 size_t         verbosity   = 0;
 
-static void strip(char *line) {
-	size_t len = strlen(line);
-	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-		line[--len] = '\0';
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a run of whole lines. owned is the buffer to free once the lines are
+ * added, or NULL if the chunk is part of a mapped file.
+ */
+typedef struct {
+	const char *data;
+	size_t      len;
+	char       *owned;
+} chunk;
+
+/* handles the lines of one chunk, returning how many there were. ctx
+ * is the filter for add_lines() and a query_ctx for query_lines().
+ */
+typedef uint64_t (*line_handler)(void *ctx, const char *data, const size_t len);
+
+/* bulk loader shared by the reading thread and the workers. with no
+ * workers, the reading thread handles each chunk itself, in order.
+ */
+typedef struct {
+	line_handler     handle;
+	void            *ctx;
+	size_t           threads;
+	pthread_mutex_t  lock;
+	pthread_cond_t   changed;
+	chunk            queue[MAX_THREADS * QUEUE_DEPTH];
+	size_t           head;
+	size_t           queued;
+	bool             done;
+	uint64_t         elements;     // handled so far, updated once per chunk
+	uint64_t         bytes;        // read so far
+	double           started;
+	double           reported;
+} loader;
+
+// find the line starting at data, returning its length without the line ending
+static size_t next_line(const char *data, const char *end, const char **next) {
+	const char *newline = memchr(data, '\n', end - data);
+	const char *eol     = (newline != NULL) ? newline : end;
+	size_t      length  = eol - data;
+
+	while (length > 0 && data[length - 1] == '\r') {
+		length--;
+	}
+
+	*next = eol + 1;
+	return length;
+}
+
+// add every line of a chunk to the filter in ctx
+static uint64_t add_lines(void *ctx, const char *data, const size_t len) {
+	const char *end   = data + len;
+	uint64_t    count = 0;
+
+	while (data < end) {
+		const char *line   = data;
+		size_t      length = next_line(line, end, &data);
+
+		bloom_add(ctx, line, length);
+		count++;
+	}
+
+	return count;
+}
+
+static void process(loader *ld, const chunk *c) {
+	uint64_t count = ld->handle(ld->ctx, c->data, c->len);
+
+	__atomic_fetch_add(&ld->elements, count, __ATOMIC_RELAXED);
+	free(c->owned);
+}
+
+static void *worker(void *arg) {
+	loader *ld = arg;
+	chunk   c;
+
+	for (;;) {
+		pthread_mutex_lock(&ld->lock);
+		while (ld->queued == 0 && !ld->done) {
+			pthread_cond_wait(&ld->changed, &ld->lock);
+		}
+
+		if (ld->queued == 0) { // done, and nothing left
+			pthread_mutex_unlock(&ld->lock);
+			return NULL;
+		}
+
+		c = ld->queue[ld->head];
+		ld->head = (ld->head + 1) % (ld->threads * QUEUE_DEPTH);
+		ld->queued--;
+		pthread_cond_broadcast(&ld->changed);
+		pthread_mutex_unlock(&ld->lock);
+
+		process(ld, &c);
 	}
 }
 
+// progress report on stderr, at most once a second
+static void report_progress(loader *ld, const size_t total) {
+	double t = now();
+
+	if (verbosity == 0 || t - ld->reported < 1.0) {
+		return;
+	}
+	ld->reported = t;
+
+	uint64_t elements = __atomic_load_n(&ld->elements, __ATOMIC_RELAXED);
+	if (total > 0) {
+		fprintf(stderr, "%5.1f%% ", (double)ld->bytes / total * 100);
+	}
+	fprintf(stderr,
+			"%llu elements, %.1f MB, %.0f elements/sec\n",
+			(unsigned long long)elements,
+			ld->bytes / 1e6,
+			elements / (t - ld->started));
+}
+
+// hand a chunk to the workers, waiting for room in the queue
+static void submit(loader *ld, const chunk *c, const size_t total) {
+	ld->bytes += c->len;
+
+	if (ld->threads == 0) {
+		process(ld, c);
+	} else {
+		size_t slots = ld->threads * QUEUE_DEPTH;
+
+		pthread_mutex_lock(&ld->lock);
+		while (ld->queued == slots) {
+			pthread_cond_wait(&ld->changed, &ld->lock);
+		}
+		ld->queue[(ld->head + ld->queued) % slots] = *c;
+		ld->queued++;
+		pthread_cond_broadcast(&ld->changed);
+		pthread_mutex_unlock(&ld->lock);
+	}
+
+	report_progress(ld, total);
+}
+
+// split a mapped file into chunks ending on line boundaries
+static void submit_mapped(loader *ld, const char *map, const size_t size) {
+	size_t offset = 0;
+
+	while (offset < size) {
+		size_t end = offset + CHUNK_SIZE;
+
+		if (end >= size) {
+			end = size;
+		} else {
+			const char *newline = memchr(map + end, '\n', size - end);
+			end = (newline != NULL) ? (size_t)(newline - map) + 1 : size;
+		}
+
+		chunk c = { map + offset, end - offset, NULL };
+		submit(ld, &c, size);
+		offset = end;
+	}
+}
+
+/* read a stream into chunks ending on line boundaries. the partial line
+ * at the end of a buffer starts the next one; a line longer than the
+ * buffer grows it.
+ */
+static bool submit_stream(loader *ld, int fd) {
+	size_t  capacity = CHUNK_SIZE;
+	size_t  used     = 0;
+	char   *buf      = malloc(capacity);
+
+	if (buf == NULL) {
+		return false;
+	}
+
+	for (;;) {
+		ssize_t got = read(fd, buf + used, capacity - used);
+
+		if (got < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			free(buf);
+			return false;
+		}
+
+		if (got == 0) { // end of input
+			if (used > 0) {
+				chunk c = { buf, used, buf };
+				submit(ld, &c, 0);
+			} else {
+				free(buf);
+			}
+			return true;
+		}
+
+		used += got;
+		if (used < capacity) {
+			continue;
+		}
+
+		char *newline = memrchr(buf, '\n', used);
+		if (newline == NULL) {
+			char *bigger = realloc(buf, capacity * 2);
+			if (bigger == NULL) {
+				free(buf);
+				return false;
+			}
+			buf       = bigger;
+			capacity *= 2;
+			continue;
+		}
+
+		size_t  whole = (newline - buf) + 1;
+		char   *next  = malloc(capacity);
+		if (next == NULL) {
+			free(buf);
+			return false;
+		}
+		memcpy(next, buf + whole, used - whole);
+
+		chunk c = { buf, whole, buf };
+		submit(ld, &c, 0);
+
+		buf  = next;
+		used = used - whole;
+	}
+}
+
+/* hand every line of fd to `handle` using `threads` threads. regular
+ * files are mapped, anything else is read in large blocks. handle must
+ * be safe to call from several threads at once if threads > 1, eg:
+ * add_lines() on a BLOOM_FLAG_CONCURRENT filter. returns the number of
+ * lines, or -1 if the input couldn't be read.
+ */
+static int64_t load_lines(int fd, const size_t threads, line_handler handle, void *ctx) {
+	pthread_t   workers[MAX_THREADS];
+	loader      ld      = { .handle = handle, .ctx = ctx, .threads = (threads > 1) ? threads : 0 };
+	struct stat st;
+	void       *map     = MAP_FAILED;
+	bool        ok      = true;
+
+	pthread_mutex_init(&ld.lock, NULL);
+	pthread_cond_init(&ld.changed, NULL);
+	ld.started  = now();
+	ld.reported = ld.started;
+
+	for (size_t i = 0; i < ld.threads; i++) {
+		pthread_create(&workers[i], NULL, worker, &ld);
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	if (map != MAP_FAILED) {
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		submit_mapped(&ld, map, st.st_size);
+	} else {
+		ok = submit_stream(&ld, fd);
+	}
+
+	pthread_mutex_lock(&ld.lock);
+	ld.done = true;
+	pthread_cond_broadcast(&ld.changed);
+	pthread_mutex_unlock(&ld.lock);
+
+	for (size_t i = 0; i < ld.threads; i++) {
+		pthread_join(workers[i], NULL);
+	}
+
+	if (map != MAP_FAILED) {
+		munmap(map, st.st_size);
+	}
+	pthread_mutex_destroy(&ld.lock);
+	pthread_cond_destroy(&ld.changed);
+
+	return ok ? (int64_t)ld.elements : -1;
+}
+
 static int create(const char *outfile,
 				  const char *input_file,
 				  const char *name,
 				  uint64_t expected_elements,
-				  float accuracy) {
+				  float accuracy,
+				  size_t threads,
+				  int flags) {
 	bloomfilter bf;
-	FILE *fp = stdin;
+	int fd = STDIN_FILENO;
 	if (input_file != NULL) {
-		fp = fopen(input_file, "r");
-		if (!fp) {
+		fd = open(input_file, O_RDONLY);
+		if (fd == -1) {
 			fprintf(stderr,
 					"unable to open input file %s:%s \n",
 					input_file,
@@ -35,8 +325,13 @@ static int create(const char *outfile,
 		}
 	}
 
-	// initialize filter
-	bloom_error_t bf_err = bloom_init(&bf, expected_elements, accuracy);
+	// initialize filter. threads share one filter, setting bits
+	// atomically, rather than each filling a copy to merge afterwards:
+	// a filter sized for billions of elements is too large to copy.
+	if (threads > 1) {
+		flags |= BLOOM_FLAG_CONCURRENT;
+	}
+	bloom_error_t bf_err = bloom_init_flags(&bf, expected_elements, accuracy, flags);
 	if (bf_err != BF_SUCCESS) {
 		fprintf(stderr,
 				"error initializing filter: %s\n",
@@ -45,10 +340,13 @@ static int create(const char *outfile,
 	}
 
 	// read from input file or stdin
-	char buf[1024]; // TODO define this
-	while (fgets(buf, sizeof(buf), fp)) {
-		strip(buf);
-		bloom_add_string(&bf, buf);
+	double  started  = now();
+	int64_t elements = load_lines(fd, threads, add_lines, &bf);
+	double  elapsed  = now() - started;
+	if (elements < 0) {
+		fprintf(stderr, "error reading input: %s\n", strerror(errno));
+		bloom_destroy(&bf);
+		return EXIT_FAILURE;
 	}
 
 	// set name of filter
@@ -66,11 +364,25 @@ static int create(const char *outfile,
 		return EXIT_FAILURE;
 	}
 
-	// TODO report of number of elements added to filter and saturation
+	printf("added %lld elements in %.2f seconds (%.0f elements/sec, %zu thread%s)\n",
+		   (long long)elements,
+		   elapsed,
+		   elapsed > 0 ? elements / elapsed : 0.0,
+		   threads,
+		   threads == 1 ? "" : "s");
+	printf("saturation: %f%%\n", bloom_saturation(&bf));
+	if ((uint64_t)elements > expected_elements) {
+		fprintf(stderr,
+				"warning: %lld elements exceeds the expected %llu; "
+				"the false positive rate will be higher than %f\n",
+				(long long)elements,
+				(unsigned long long)expected_elements,
+				accuracy);
+	}
 
 	// cleanup
-	if (fp != stdin) {
-		fclose(fp);
+	if (fd != STDIN_FILENO) {
+		close(fd);
 	}
 
 	bloom_destroy(&bf);
@@ -78,9 +390,22 @@ static int create(const char *outfile,
 	return EXIT_SUCCESS;
 }
 
+/* map a filter for reading, so only the pages probed are read from disk.
+ * filters that can't be mapped, such as compressed ones, are loaded.
+ */
+static bloom_error_t open_filter(bloomfilter *bf, const char *path) {
+	bloom_error_t bf_err = bloom_map(bf, path, false);
+
+	if (bf_err == BF_SUCCESS || bf_err == BF_FOPEN) {
+		return bf_err;
+	}
+
+	return bloom_load(bf, path);
+}
+
 static int query(const char *query_file, const char *query_string) {
 	bloomfilter bf;
-	bloom_error_t bf_err = bloom_load(&bf, query_file);
+	bloom_error_t bf_err = open_filter(&bf, query_file);
 
 	if (bf_err != BF_SUCCESS) {
 		fprintf(stderr,
@@ -104,6 +429,135 @@ static int query(const char *query_file, const char *query_string) {
 	return result ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+// keys looked up per bloom_lookup_batch() call
+#define QUERY_BATCH 4096
+
+typedef enum {
+	PRINT_ALL = 0, // "hit\tkey" or "miss\tkey" for every key
+	PRINT_HITS,    // keys in the filter
+	PRINT_MISSES   // keys not in the filter, like grep -v
+} print_mode;
+
+typedef struct {
+	const bloomfilter *bf;
+	print_mode         mode;
+	uint64_t           selected;   // keys printed, or hits for PRINT_ALL
+	const void        *keys[QUERY_BATCH];
+	size_t             lens[QUERY_BATCH];
+	uint8_t            results[QUERY_BATCH / 8];
+	size_t             count;
+} query_ctx;
+
+static void query_flush(query_ctx *q) {
+	bloom_lookup_batch(q->bf, q->keys, q->lens, q->count, q->results);
+
+	for (size_t i = 0; i < q->count; i++) {
+		bool hit = BLOOM_BATCH_RESULT(q->results, i);
+
+		if (q->mode == PRINT_ALL) {
+			fputs(hit ? "hit\t" : "miss\t", stdout);
+		} else if (hit != (q->mode == PRINT_HITS)) {
+			continue;
+		}
+
+		fwrite(q->keys[i], 1, q->lens[i], stdout);
+		putchar('\n');
+		q->selected += (q->mode != PRINT_ALL || hit);
+	}
+
+	q->count = 0;
+}
+
+// look up every line of a chunk. keys point into the chunk, so the last
+// batch is flushed before returning.
+static uint64_t query_lines(void *ctx, const char *data, const size_t len) {
+	query_ctx  *q     = ctx;
+	const char *end   = data + len;
+	uint64_t    count = 0;
+
+	while (data < end) {
+		q->keys[q->count] = data;
+		q->lens[q->count] = next_line(data, end, &data);
+		count++;
+
+		if (++q->count == QUERY_BATCH) {
+			query_flush(q);
+		}
+	}
+
+	if (q->count > 0) {
+		query_flush(q);
+	}
+
+	return count;
+}
+
+/* look up every line of infile, or stdin, in one filter. exits like
+ * grep: success if any line was printed, or for PRINT_ALL if any key
+ * was in the filter.
+ */
+static int query_stream(const char *query_file, const char *infile, print_mode mode) {
+	static char  outbuf[1 << 20];
+	query_ctx   *q;
+	bloomfilter  bf;
+	int          fd = STDIN_FILENO;
+
+	bloom_error_t bf_err = open_filter(&bf, query_file);
+	if (bf_err != BF_SUCCESS) {
+		fprintf(stderr,
+				"unable to open filter %s: %s\n",
+				query_file,
+				bloom_strerror(bf_err));
+		return EXIT_FAILURE;
+	}
+
+	if (infile != NULL) {
+		fd = open(infile, O_RDONLY);
+		if (fd == -1) {
+			fprintf(stderr,
+					"unable to open file %s: %s\n",
+					infile,
+					strerror(errno));
+			bloom_destroy(&bf);
+			return EXIT_FAILURE;
+		}
+	}
+
+	q = calloc(1, sizeof(query_ctx));
+	if (q == NULL) {
+		fprintf(stderr, "out of memory\n");
+		bloom_destroy(&bf);
+		return EXIT_FAILURE;
+	}
+	q->bf   = &bf;
+	q->mode = mode;
+
+	setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+	int64_t keys = load_lines(fd, 1, query_lines, q);
+	fflush(stdout);
+
+	if (keys < 0) {
+		fprintf(stderr, "error reading input: %s\n", strerror(errno));
+	} else if (verbosity > 0) {
+		fprintf(stderr,
+				"%lld keys, %llu %s\n",
+				(long long)keys,
+				(unsigned long long)q->selected,
+				(mode == PRINT_MISSES) ? "misses" : "hits");
+	}
+
+	int status = (keys >= 0 && q->selected > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+	free(q);
+	bloom_destroy(&bf);
+
+	return status;
+}
+
 static int rename_filter(const char *rename_file, const char *new_name) {
 	bloomfilter bf;
 	bloom_error_t bf_err = bloom_load(&bf, rename_file);
@@ -130,6 +584,71 @@ static int rename_filter(const char *rename_file, const char *new_name) {
 
 }
 
+/* halve a filter `times` times in place, trading false positives for
+ * memory, and report what that costs.
+ */
+static int fold(const char *fold_file, const unsigned int times) {
+	bloomfilter bf;
+	bloom_error_t bf_err = bloom_load(&bf, fold_file);
+	if (bf_err != BF_SUCCESS) {
+		fprintf(stderr,
+				"unable to open filter %s: %s\n",
+				fold_file,
+				bloom_strerror(bf_err));
+		return EXIT_FAILURE;
+	}
+
+	size_t       size     = bf.size;
+	float        rate     = bloom_estimate_false_positive_rate(&bf);
+	unsigned int foldable = 0;
+
+	// each fold needs an even size of at least 16 bits
+	for (size_t s = size; s % 2 == 0 && s / 2 >= 8; s /= 2) {
+		foldable++;
+	}
+	if (times > foldable) {
+		fprintf(stderr,
+				"unable to fold %s %u times: a %zu bit filter can be halved %u time%s%s\n",
+				fold_file,
+				times,
+				size,
+				foldable,
+				foldable == 1 ? "" : "s",
+				(bf.flags & BLOOM_FLAG_POW2) ? "" : " (create it with -p to fold it freely)");
+		bloom_destroy(&bf);
+		return EXIT_FAILURE;
+	}
+
+	bf_err = bloom_fold(&bf, times);
+	if (bf_err != BF_SUCCESS) {
+		fprintf(stderr,
+				"unable to fold %s %u times: %s\n",
+				fold_file,
+				times,
+				bloom_strerror(bf_err));
+		bloom_destroy(&bf);
+		return EXIT_FAILURE;
+	}
+
+	bf_err = bloom_save(&bf, fold_file);
+	if (bf_err != BF_SUCCESS) {
+		fprintf(stderr,
+				"unable to save filter %s: %s\n",
+				fold_file,
+				bloom_strerror(bf_err));
+		bloom_destroy(&bf);
+		return EXIT_FAILURE;
+	}
+
+	printf("filter size (in bits):         %zu -> %zu\n", size, bf.size);
+	printf("estimated false positive rate: %f -> %f\n",
+		   rate,
+		   bloom_estimate_false_positive_rate(&bf));
+
+	bloom_destroy(&bf);
+	return EXIT_SUCCESS;
+}
+
 static int info(const char *path) {
 	bloomfilter bf;
 	bloom_error_t bf_err = bloom_load(&bf, path);
@@ -150,6 +669,9 @@ static int info(const char *path) {
 	printf("estimated false positive rate: %f%%\n",
 		   bloom_estimate_false_positive_rate(&bf));
 	printf("saturation:                    %f%%\n", bloom_saturation(&bf));
+	printf("bits set:                      %zu\n", bloom_saturation_count(&bf));
+	printf("runtime statistics:            %s\n",
+		   archbloom_stats_enabled() ? "enabled" : "disabled (build with ARCHBLOOM_STATS)");
 
 	bloom_destroy(&bf);
 	return EXIT_SUCCESS;
@@ -167,11 +689,7 @@ static int add(const char *filter_file, const char *element, const char *infile)
 	}
 
 	if (element == NULL && infile == NULL) { // stdin
-		char buf[1024];
-		while(fgets(buf, sizeof(buf), stdin)) {
-			strip(buf);
-			bloom_add_string(&bf, buf);
-		}
+		load_lines(STDIN_FILENO, 1, add_lines, &bf);
 
 		bloom_save(&bf, filter_file);
 		bloom_destroy(&bf);
@@ -180,9 +698,8 @@ static int add(const char *filter_file, const char *element, const char *infile)
 
 	if (infile != NULL) { // add elements from file
 		printf("adding elements from %s\n", infile);
-		char buf[1024];
-		FILE *fp = fopen(infile, "r");
-		if (!fp) {
+		int fd = open(infile, O_RDONLY);
+		if (fd == -1) {
 			fprintf(stderr,
 					"unable to open file %s: %s\n",
 					infile,
@@ -190,10 +707,8 @@ static int add(const char *filter_file, const char *element, const char *infile)
 			return EXIT_FAILURE;
 		}
 
-		while(fgets(buf, sizeof(buf), fp)) {
-			strip(buf);
-			bloom_add_string(&bf, buf);
-		}
+		load_lines(fd, 1, add_lines, &bf);
+		close(fd);
 
 		bloom_save(&bf, filter_file);
 		bloom_destroy(&bf);
@@ -360,7 +875,7 @@ static float intersection(const char *infile1, const char *infile2) {
 // TODO this is wrong. fix the output once usage is settled
 static void usage(const char *progname) {
 	fprintf(stderr, "usage: %s COMMAND [OPTIONS]\n\n", progname);
-	fprintf(stderr, "Commands: query|lookup, info\n");
+	fprintf(stderr, "Commands: query|lookup, info, fold\n");
 	exit(EXIT_FAILURE);
 }
 
@@ -386,12 +901,12 @@ int main(int argc, char *argv[]) {
 	}
 
 	// create command
-	// bloomtool create outfile expected [-i infile -n name -a accuracy]
+	// bloomtool create outfile expected [-i infile -n name -a accuracy -t threads -p -v]
 	else if (strcmp(command, "create") == 0) {
 		if (argc < 3) {
 			fprintf(stderr, "must provide a path to filter output file\n");
 			fprintf(stderr,
-					"ex: %s create file 1000 [-n name -i infile -a accuracy]\n",
+					"ex: %s create file 1000 [-n name -i infile -a accuracy -t threads -p -v]\n",
 					argv[0]);
 			return EXIT_FAILURE;
 		}
@@ -401,7 +916,7 @@ int main(int argc, char *argv[]) {
 		if (argc < 4) {
 			fprintf(stderr, "must provide expected number of elements\n");
 			fprintf(stderr,
-					"ex: %s create file 1000 [-n name -i infile -a accuracy]\n",
+					"ex: %s create file 1000 [-n name -i infile -a accuracy -t threads -p -v]\n",
 					argv[0]);
 			return EXIT_FAILURE;
 		}
@@ -410,11 +925,26 @@ int main(int argc, char *argv[]) {
 		float accuracy = 0.01; // default is 99.9% accuracy
 		char *input_file = NULL;
 		char *name = NULL;
-		while((opt = getopt(argc - 2, argv + 2, "n:i:a:")) != -1) {
+		size_t threads = 1;
+		int flags = 0;
+		while((opt = getopt(argc - 2, argv + 2, "n:i:a:t:pv")) != -1) {
 			switch (opt) {
 			case 'a':
 				accuracy = atof(optarg);
 				break;
+			case 't':
+				threads = atoi(optarg);
+				if (threads < 1 || threads > MAX_THREADS) {
+					fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'p': // power of two size, so the filter can be folded
+				flags |= BLOOM_FLAG_POW2;
+				break;
+			case 'v':
+				verbosity++;
+				break;
 			case 'i':
 				input_file = optarg;
 				break;
@@ -423,13 +953,13 @@ int main(int argc, char *argv[]) {
 				break;
 			default:
 				fprintf(stderr,
-						"usage: %s create 1000 [-n filtername -i inputfile -a accuracy]\n",
+						"usage: %s create 1000 [-n filtername -i inputfile -a accuracy -t threads -p -v]\n",
 						argv[0]);
 				return EXIT_FAILURE;
 			}
 		}
 
-		return create(outfile, input_file, name, expected_elements, accuracy);
+		return create(outfile, input_file, name, expected_elements, accuracy, threads, flags);
 	}
 
 	// add command -- from file or stdin or a single element
@@ -503,6 +1033,23 @@ int main(int argc, char *argv[]) {
 		return rename_filter(rename_file, new_name);
 	}
 
+	// fold command
+	// bloomtool fold filter [times]
+	else if (strcmp(command, "fold") == 0) {
+		if (argc < 3) {
+			fprintf(stderr, "must provide a path to a filter to fold\n");
+			fprintf(stderr,
+					"ex: %s fold /path/to/filter [times]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+		const char *fold_file = argv[2];
+
+		unsigned int times = (argc > 3) ? (unsigned int)atoi(argv[3]) : 1;
+
+		return fold(fold_file, times);
+	}
+
 	// merge command
 	// TODO option to set name of output merged filter
 	else if (strcmp(command, "merge") == 0) {
@@ -558,6 +1105,9 @@ int main(int argc, char *argv[]) {
 	}
 
 	// query|lookup command
+	// bloomtool lookup filter string [-v]
+	// bloomtool lookup filter [-i infile] [-H|-M] [-v]
+	// without a string, every line of infile or stdin is looked up.
 	else if (strcmp(command, "lookup") == 0 || strcmp(command, "query") == 0) {
 		if (argc < 3) {
 			fprintf(stderr, "must provide a file to query\n");
@@ -569,30 +1119,41 @@ int main(int argc, char *argv[]) {
 		}
 		const char *query_file = argv[2];
 
-		if (argc < 4) {
-			fprintf(stderr, "must provide a query string\n");
-			fprintf(stderr,
-					"ex: %s %s /path/to/filter string\n",
-					argv[0],
-					command);
-			return EXIT_FAILURE;
-		}
-		const char *query_string = argv[3];
-
-		while((opt = getopt(argc - 2, argv + 2, "v")) != -1) {
+		char *infile = NULL;
+		print_mode mode = PRINT_ALL;
+		while((opt = getopt(argc - 2, argv + 2, "vi:HM")) != -1) {
 			switch (opt) {
 			case 'v':
 				verbosity++;
 				break;
+			case 'i':
+				infile = optarg;
+				break;
+			case 'H':
+				mode = PRINT_HITS;
+				break;
+			case 'M':
+				mode = PRINT_MISSES;
+				break;
 			default:
 				fprintf(stderr,
-						"example usage: %s %s file string [-v]\n",
+						"example usage: %s %s file string [-v]\n"
+						"               %s %s file [-i infile] [-H|-M] [-v]\n"
+						"without a string, look up each line of infile or stdin and\n"
+						"print hits and misses, or with -H only hits, with -M only misses\n",
+						argv[0],
+						command,
 						argv[0],
 						command);
 				return EXIT_FAILURE;
 			}
 		}
 
+		const char *query_string = (optind < argc - 2) ? argv[2 + optind] : NULL;
+		if (query_string == NULL || infile != NULL) {
+			return query_stream(query_file, infile, mode);
+		}
+
 		return query(query_file, query_string);
 	}
 
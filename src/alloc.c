@@ -0,0 +1,359 @@
+/**
+ * @file alloc.c
+ * @brief Filter memory allocation implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains the allocator used for the large arrays behind
+ * every filter. Each array is preceded by a header, one cache line
+ * long, recording how it was allocated, so it can be freed or resized
+ * no matter how the allocator has been configured since.
+ *
+ * Ordinary arrays come from calloc(), which gets large blocks straight
+ * from mmap() and leaves pages untouched until they are written, just
+ * as filters always have. Huge page arrays are mapped directly.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "alloc.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define HUGE_2MB ((size_t)1 << 21)
+#define HUGE_1GB ((size_t)1 << 30)
+
+/**
+ * @brief How an array was allocated.
+ */
+typedef enum {
+	BLOCK_HEAP = 0,
+	BLOCK_TRANSPARENT,
+	BLOCK_HUGE,
+	BLOCK_HOOKED,
+} block_kind;
+
+/**
+ * @brief Header in front of every array.
+ *
+ * `base` and `length` are what was allocated or mapped, which starts
+ * at or before the header. `size` is the array the caller asked for.
+ */
+typedef struct {
+	void        *base;
+	size_t       length;
+	size_t       size;
+	block_kind   kind;
+	void       (*free)(void *, size_t, void *);
+	void        *ctx;
+} block_header;
+
+_Static_assert(sizeof(block_header) <= ARCHBLOOM_ALIGNMENT,
+               "block_header must fit in front of an aligned array");
+
+#define HEADER_SIZE ARCHBLOOM_ALIGNMENT
+
+static archbloom_allocator hooks;
+static archbloom_pages     pages = ARCHBLOOM_PAGES_DEFAULT;
+static size_t              stats[BLOCK_HOOKED + 1];
+
+/**
+ * @brief Helper function to find the header of an array.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline block_header *header_of(void *ptr) {
+	return (block_header *)((uint8_t *)ptr - HEADER_SIZE);
+}
+
+/**
+ * @brief Helper function to round `size` up to a multiple of `unit`,
+ * a power of two.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline size_t round_up(const size_t size, const size_t unit) {
+	return (size + unit - 1) & ~(unit - 1);
+}
+
+/**
+ * @brief Set the allocator hooks used for filter arrays.
+ *
+ * While hooks are set they allocate every array and the page settings
+ * are ignored. Arrays are zeroed after the hook returns them.
+ *
+ * @param allocator Hooks to use, copied. NULL, or hooks without both
+ *        functions, restore the default allocator.
+ */
+void archbloom_set_allocator(const archbloom_allocator *allocator) {
+	if (allocator == NULL || allocator->alloc == NULL || allocator->free == NULL) {
+		memset(&hooks, 0, sizeof(hooks));
+		return;
+	}
+
+	hooks = *allocator;
+}
+
+/**
+ * @brief Set the kind of pages filter arrays are placed on.
+ *
+ * Reserved huge pages must be set aside first, for example through
+ * /sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages or the
+ * `hugepages=` boot parameter. Transparent huge pages need
+ * /sys/kernel/mm/transparent_hugepage/enabled to be `madvise` or
+ * `always`.
+ *
+ * @param mode ARCHBLOOM_PAGES_* mode.
+ */
+void archbloom_set_pages(const archbloom_pages mode) {
+	pages = mode;
+}
+
+/**
+ * @brief Get the kind of pages filter arrays are placed on.
+ */
+archbloom_pages archbloom_get_pages(void) {
+	return pages;
+}
+
+/**
+ * @brief Get the bytes of filter arrays currently allocated.
+ *
+ * @param out Receives the counts.
+ */
+void archbloom_alloc_get_stats(archbloom_alloc_stats *out) {
+	out->heap        = __atomic_load_n(&stats[BLOCK_HEAP], __ATOMIC_RELAXED);
+	out->transparent = __atomic_load_n(&stats[BLOCK_TRANSPARENT], __ATOMIC_RELAXED);
+	out->huge        = __atomic_load_n(&stats[BLOCK_HUGE], __ATOMIC_RELAXED);
+	out->hooked      = __atomic_load_n(&stats[BLOCK_HOOKED], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Helper function to map reserved huge pages of `page` bytes.
+ *
+ * @return Start of the mapping, or NULL if there aren't enough free
+ *         huge pages of that size.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void *map_huge(const size_t length, const size_t page) {
+#ifdef MAP_HUGETLB
+	int   shift = __builtin_ctzll(page);
+	void *map   = mmap(NULL,
+	                   length,
+	                   PROT_READ | PROT_WRITE,
+	                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT),
+	                   -1,
+	                   0);
+
+	return (map == MAP_FAILED) ? NULL : map;
+#else
+	(void)length;
+	(void)page;
+	return NULL;
+#endif
+}
+
+/**
+ * @brief Helper function to map ordinary pages aligned to 2MB and ask
+ * for them to be backed by transparent huge pages.
+ *
+ * The mapping is made 2MB larger than needed and trimmed, so every 2MB
+ * of it can be a huge page.
+ *
+ * @return Start of the mapping, or NULL on failure.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void *map_transparent(const size_t length) {
+#ifdef MADV_HUGEPAGE
+	uint8_t  *map = mmap(NULL,
+	                     length + HUGE_2MB,
+	                     PROT_READ | PROT_WRITE,
+	                     MAP_PRIVATE | MAP_ANONYMOUS,
+	                     -1,
+	                     0);
+	uintptr_t start;
+	size_t    before;
+
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	start  = round_up((uintptr_t)map, HUGE_2MB);
+	before = start - (uintptr_t)map;
+
+	if (before > 0) {
+		munmap(map, before);
+	}
+	munmap((uint8_t *)start + length, HUGE_2MB - before);
+
+	// not fatal: the kernel may just not be configured for it
+	madvise((void *)start, length, MADV_HUGEPAGE);
+
+	return (void *)start;
+#else
+	(void)length;
+	return NULL;
+#endif
+}
+
+/**
+ * @brief Helper function to map `total` bytes on the pages asked for
+ * with `archbloom_set_pages()`, falling back as described there.
+ *
+ * @return Start of the mapping, or NULL if the array belongs on the
+ *         heap. `header` receives the mapping's length and kind.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void *map_pages(const size_t total, block_header *header) {
+	void *map;
+
+	if (pages >= ARCHBLOOM_PAGES_1GB && total >= HUGE_1GB) {
+		header->length = round_up(total, HUGE_1GB);
+		header->kind   = BLOCK_HUGE;
+		if ((map = map_huge(header->length, HUGE_1GB)) != NULL) {
+			return map;
+		}
+	}
+
+	if (pages >= ARCHBLOOM_PAGES_2MB && total >= HUGE_2MB) {
+		header->length = round_up(total, HUGE_2MB);
+		header->kind   = BLOCK_HUGE;
+		if ((map = map_huge(header->length, HUGE_2MB)) != NULL) {
+			return map;
+		}
+	}
+
+	if (pages >= ARCHBLOOM_PAGES_TRANSPARENT && total >= HUGE_2MB) {
+		header->length = round_up(total, HUGE_2MB);
+		header->kind   = BLOCK_TRANSPARENT;
+		if ((map = map_transparent(header->length)) != NULL) {
+			return map;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Allocate a zeroed filter array.
+ *
+ * The array is aligned to ARCHBLOOM_ALIGNMENT bytes and placed as set
+ * with `archbloom_set_allocator()` and `archbloom_set_pages()`.
+ *
+ * @param size Size of the array in bytes.
+ *
+ * @return Pointer to the array, or NULL if allocation fails. Free it
+ *         with `archbloom_free()`.
+ */
+void *archbloom_alloc(const size_t size) {
+	block_header  header = {0};
+	size_t        total  = size + HEADER_SIZE;
+	uint8_t      *data;
+
+	if (total < size) {
+		return NULL;
+	}
+
+	if (hooks.alloc != NULL) {
+		header.base = hooks.alloc(total, ARCHBLOOM_ALIGNMENT, hooks.ctx);
+		if (header.base == NULL) {
+			return NULL;
+		}
+		memset(header.base, 0, total);
+
+		header.length = total;
+		header.kind   = BLOCK_HOOKED;
+		header.free   = hooks.free;
+		header.ctx    = hooks.ctx;
+		data          = (uint8_t *)header.base + HEADER_SIZE;
+	} else if ((header.base = map_pages(total, &header)) != NULL) {
+		// anonymous mappings are page aligned and already zeroed
+		data = (uint8_t *)header.base + HEADER_SIZE;
+	} else {
+		// calloc() rather than aligned_alloc() and memset(), so large
+		// arrays stay lazily zeroed
+		header.length = total + ARCHBLOOM_ALIGNMENT;
+		header.kind   = BLOCK_HEAP;
+		header.base   = calloc(1, header.length);
+		if (header.base == NULL) {
+			return NULL;
+		}
+		data = (uint8_t *)round_up((uintptr_t)header.base + HEADER_SIZE, ARCHBLOOM_ALIGNMENT);
+	}
+
+	header.size = size;
+	memcpy(header_of(data), &header, sizeof(header));
+	__atomic_add_fetch(&stats[header.kind], header.length, __ATOMIC_RELAXED);
+
+	return data;
+}
+
+/**
+ * @brief Free a filter array allocated with `archbloom_alloc()`.
+ *
+ * @param ptr Pointer to the array. May be NULL.
+ */
+void archbloom_free(void *ptr) {
+	block_header header;
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	memcpy(&header, header_of(ptr), sizeof(header));
+	__atomic_sub_fetch(&stats[header.kind], header.length, __ATOMIC_RELAXED);
+
+	switch (header.kind) {
+	case BLOCK_HOOKED:
+		header.free(header.base, header.length, header.ctx);
+		break;
+	case BLOCK_TRANSPARENT:
+	case BLOCK_HUGE:
+		munmap(header.base, header.length);
+		break;
+	default:
+		free(header.base);
+		break;
+	}
+}
+
+/**
+ * @brief Resize a filter array allocated with `archbloom_alloc()`.
+ *
+ * The contents up to the smaller of the two sizes are kept and any
+ * growth is zeroed. The array is reallocated as currently set, so a
+ * resized array may move onto or off huge pages.
+ *
+ * @param ptr Pointer to the array. May be NULL.
+ * @param size New size of the array in bytes.
+ *
+ * @return Pointer to the resized array, or NULL if allocation fails, in
+ *         which case `ptr` is unchanged.
+ */
+void *archbloom_realloc(void *ptr, const size_t size) {
+	void   *resized;
+	size_t  old_size;
+
+	if (ptr == NULL) {
+		return archbloom_alloc(size);
+	}
+
+	resized = archbloom_alloc(size);
+	if (resized == NULL) {
+		return NULL;
+	}
+
+	old_size = header_of(ptr)->size;
+	memcpy(resized, ptr, (old_size < size) ? old_size : size);
+	archbloom_free(ptr);
+
+	return resized;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file alloc.h
+ * @brief Header file for filter memory allocation
+ * @author Daniel Roberson
+ *
+ * This file contains the function declarations and type definitions
+ * for controlling how archbloom allocates the large arrays behind its
+ * filters: bitmaps, counter maps, timestamp arrays and cuckoo buckets.
+ * Small bookkeeping allocations (names, locks, scratch space) always
+ * use the C library.
+ *
+ * Every array is zeroed and aligned to ARCHBLOOM_ALIGNMENT bytes, so
+ * the first word of a filter starts a cache line. Arrays may be placed
+ * on huge pages, which cuts the TLB misses of random lookups into
+ * filters much larger than the TLB covers, or allocated by the caller
+ * through allocator hooks, for example from a memory pool or a
+ * particular NUMA node.
+ *
+ * The settings are process wide and are read when an array is
+ * allocated. Change them before creating filters, not while other
+ * threads create or destroy them. An array is always freed the way it
+ * was allocated, whatever the settings are by then.
+ *
+ * @see alloc.c for the corresponding implementation.
+ */
+#ifndef ARCHBLOOM_ALLOC_H
+#define ARCHBLOOM_ALLOC_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @def ARCHBLOOM_ALIGNMENT
+ * @brief Alignment in bytes of every filter array: one cache line.
+ */
+#define ARCHBLOOM_ALIGNMENT 64
+
+/**
+ * @enum archbloom_pages
+ * @brief Kinds of pages to place filter arrays on.
+ *
+ * Huge pages are only used for arrays of at least one huge page, and
+ * each mode falls back to the next if its pages can't be had:
+ * ARCHBLOOM_PAGES_1GB to ARCHBLOOM_PAGES_2MB, ARCHBLOOM_PAGES_2MB to
+ * ARCHBLOOM_PAGES_TRANSPARENT, and ARCHBLOOM_PAGES_TRANSPARENT to
+ * ordinary pages.
+ */
+typedef enum {
+	ARCHBLOOM_PAGES_DEFAULT = 0, /**< Ordinary pages from the C library */
+	ARCHBLOOM_PAGES_TRANSPARENT, /**< Transparent huge pages, madvise(MADV_HUGEPAGE) */
+	ARCHBLOOM_PAGES_2MB,         /**< Reserved 2MB pages, mmap(MAP_HUGETLB) */
+	ARCHBLOOM_PAGES_1GB,         /**< Reserved 1GB pages, mmap(MAP_HUGETLB) */
+} archbloom_pages;
+
+/**
+ * @struct archbloom_allocator
+ * @brief Allocator hooks for filter arrays.
+ *
+ * @var archbloom_allocator::alloc
+ * Allocate `size` bytes aligned to at least `alignment` bytes, a power
+ * of two. Return NULL on failure. The memory needn't be zeroed.
+ *
+ * @var archbloom_allocator::free
+ * Free memory returned by `alloc`, given the size it was allocated
+ * with.
+ *
+ * @var archbloom_allocator::ctx
+ * Passed to both hooks.
+ */
+typedef struct {
+	void *(*alloc)(size_t size, size_t alignment, void *ctx); /**< Allocate memory */
+	void  (*free)(void *ptr, size_t size, void *ctx);         /**< Free memory */
+	void   *ctx;                                              /**< Hook context */
+} archbloom_allocator;
+
+/**
+ * @struct archbloom_alloc_stats
+ * @brief Bytes of filter arrays currently allocated, by where they
+ * live. Counts include the small header in front of every array.
+ */
+typedef struct {
+	size_t heap;        /**< Ordinary pages from the C library */
+	size_t transparent; /**< Pages advised to be transparent huge pages */
+	size_t huge;        /**< Reserved huge pages */
+	size_t hooked;      /**< Memory from allocator hooks */
+} archbloom_alloc_stats;
+
+/* function declarations
+ */
+void             archbloom_set_allocator(const archbloom_allocator *);
+void             archbloom_set_pages(const archbloom_pages);
+archbloom_pages  archbloom_get_pages(void);
+void             archbloom_alloc_get_stats(archbloom_alloc_stats *);
+
+void            *archbloom_alloc(const size_t);
+void            *archbloom_realloc(void *, const size_t);
+void             archbloom_free(void *);
+
+#endif /* ARCHBLOOM_ALLOC_H */
@@ -0,0 +1,674 @@
+/**
+ * @file bbloom.c
+ * @brief Blocked Bloom filter implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains functions for working with blocked Bloom filters,
+ * including initialization, destruction, insertion, querying, and
+ * saving and loading filters from disk.
+ *
+ * Each element is hashed once with the filter's hash strategy, by
+ * default MurmurHash3 x64 128. The first 64 bits of
+ * the hash select a 64 byte block, and the second 64 bits are split
+ * into two 32 bit values which are used with double hashing to choose
+ * `hashcount` bits within that block.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "bitops.h"
+#include "fastrange.h"
+#include "mapfile.h"
+#include "alloc.h"
+#include "bbloom.h"
+
+_Static_assert(ARCHBLOOM_ALIGNMENT % BBLOOM_BLOCK_SIZE == 0,
+               "filter arrays must be block aligned");
+
+_Static_assert(sizeof(bbloomfilter_file) % BBLOOM_BLOCK_SIZE == 0,
+               "bbloomfilter_file must keep the bitmap block aligned");
+
+// messages for bbloom_strerror(). See bbloom.h.
+const char *bbloom_errors[] = {
+	"Success",
+	"Out of memory",
+	"Unable to open file",
+	"Unable to read file",
+	"Unable to write to file",
+	"fstat() failure",
+	"Invalid file format",
+	"mmap() failure"
+};
+
+_Static_assert(sizeof(bbloom_errors) / sizeof(bbloom_errors[0]) == BBF_ERRORCOUNT,
+               "bbloom_errors must have a message for every bbloom_error_t");
+
+static const uint8_t bbloom_magic[8] = {'!', 'b', 'b', 'l', 'o', 'o', 'm', '!'};
+
+/**
+ * @brief Calculate the ideal size of a Bloom filter's bit array.
+ *
+ * @param expected Maximum expected number of elements to store in the filter.
+ * @param accuracy The desired rate of false positives (eg 0,01 for 99.99% accuracy).
+ *
+ * @return The optimal size of the filter based on given inputs.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static size_t ideal_size(const size_t expected, const float accuracy) {
+	return -(expected * log(accuracy) / pow(log(2.0), 2));
+}
+
+/**
+ * @brief Allocate a zeroed, block aligned bitmap.
+ *
+ * @param size Size of the bitmap in bytes. Must be a multiple of
+ *             BBLOOM_BLOCK_SIZE.
+ *
+ * @return Pointer to the bitmap, or NULL if allocation fails.
+ */
+static uint8_t *bitmap_alloc(const size_t size) {
+	return archbloom_alloc(size);
+}
+
+/**
+ * @brief Initialize a blocked Bloom filter.
+ *
+ * The filter is sized the same way as a classic Bloom filter, rounded
+ * up to a whole number of 64 byte blocks.
+ *
+ * @param bf       Pointer to a bbloomfilter structure.
+ * @param expected Expected number of elements the filter will contain.
+ * @param accuracy Margin of acceptable error. ex: 0.01 is "99.99%" accurate.
+ *
+ * @return BBF_SUCCESS on successful initialization.
+ * @return BBF_OUTOFMEMORY if memory allocation fails.
+ */
+bbloom_error_t bbloom_init(bbloomfilter *bf, const size_t expected, const float accuracy) {
+	size_t size = ideal_size(expected, accuracy);
+
+	bf->blocks      = (size + BBLOOM_BLOCK_BITS - 1) / BBLOOM_BLOCK_BITS;
+	if (bf->blocks == 0) {
+		bf->blocks = 1;
+	}
+	bf->size        = bf->blocks * BBLOOM_BLOCK_BITS;
+	bf->hashcount   = (size / expected) * log(2);
+	if (bf->hashcount == 0) {
+		bf->hashcount = 1;
+	}
+	bf->bitmap_size = bf->blocks * BBLOOM_BLOCK_SIZE;
+	bf->expected    = expected;
+	bf->accuracy    = accuracy;
+	bf->hash        = HASH_MMH3;
+	bf->map         = NULL;
+	bf->map_size    = 0;
+	snprintf(bf->name, sizeof(bf->name), "DEFAULT");
+	bf->bitmap      = bitmap_alloc(bf->bitmap_size);
+	if (bf->bitmap == NULL) {
+		return BBF_OUTOFMEMORY;
+	}
+
+	return BBF_SUCCESS;
+}
+
+/**
+ * @brief Free the memory allocated for a blocked Bloom filter, or
+ * unmap it if it was loaded with `bbloom_map()`.
+ *
+ * @param bf Pointer to the blocked Bloom filter to free.
+ */
+void bbloom_destroy(bbloomfilter *bf) {
+	if (bf->map) {
+		munmap(bf->map, bf->map_size);
+		bf->map    = NULL;
+		bf->bitmap = NULL;
+	}
+
+	if (bf->bitmap) {
+		archbloom_free(bf->bitmap);
+		bf->bitmap = NULL;
+	}
+}
+
+/**
+ * @brief Clear the contents of a blocked Bloom filter.
+ *
+ * @param bf Pointer to the blocked Bloom filter to clear.
+ */
+void bbloom_clear(bbloomfilter *bf) {
+	memset(bf->bitmap, 0, bf->bitmap_size);
+}
+
+/**
+ * @brief Calculate the number of bits set to 1 in a blocked Bloom filter.
+ *
+ * @param bf Blocked Bloom filter to count.
+ *
+ * @return The number of bits set to 1 in the provided filter.
+ */
+size_t bbloom_saturation_count(const bbloomfilter *bf) {
+	return bitops_popcount(bf->bitmap, bf->bitmap_size);
+}
+
+/**
+ * @brief Calculate the saturation of a blocked Bloom filter (the
+ * percentage of bits set).
+ *
+ * @param bf Blocked Bloom filter to calculate saturation for.
+ *
+ * @return The percentage of bits set in filter as a floating-point value.
+ */
+float bbloom_saturation(const bbloomfilter *bf) {
+	return (float)bbloom_saturation_count(bf) / bf->size * 100.0;
+}
+
+/**
+ * @brief Helper function to locate an element's block and in-block
+ * double hashing parameters.
+ *
+ * @param bf Blocked Bloom filter.
+ * @param element Pointer to the element.
+ * @param len Length of the element in bytes.
+ * @param start Pointer to store the first bit position within the block.
+ * @param step Pointer to store the (odd) step between bit positions.
+ *
+ * @return Pointer to the start of the element's block.
+ */
+static inline uint8_t *locate_block(const bbloomfilter *bf,
+                                    const void *element,
+                                    const size_t len,
+                                    uint32_t *start,
+                                    uint32_t *step) {
+	uint64_t hash[2];
+
+	hash_128(bf->hash, element, len, hash);
+
+	*start = (uint32_t)hash[1];
+	// an odd step visits every bit in the block before repeating
+	*step  = (uint32_t)(hash[1] >> 32) | 1;
+
+	return bf->bitmap + fastrange64(hash[0], bf->blocks) * BBLOOM_BLOCK_SIZE;
+}
+
+/**
+ * @brief Check if an element is likely present in a blocked Bloom filter.
+ *
+ * @param bf Blocked Bloom filter to perform look up against.
+ * @param element Pointer to the element to look up.
+ * @param len Length of the element in bytes.
+ *
+ * @return true if the element is probably in the filter.
+ * @return false if the element is definitely not in the filter.
+ */
+bool bbloom_lookup(const bbloomfilter *bf, const void *element, const size_t len) {
+	uint32_t  start, step, bit;
+	uint8_t  *block = locate_block(bf, element, len, &start, &step);
+
+	for (size_t i = 0; i < bf->hashcount; i++) {
+		bit = (start + i * step) % BBLOOM_BLOCK_BITS;
+
+		if ((block[bit / 8] & (0x01 << (bit % 8))) == 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Helper function for bbloom_lookup() to handle string elements.
+ *
+ * @param bf Blocked Bloom filter to perform look up against.
+ * @param element Pointer to the string element to look up.
+ *
+ * @return true if the string is likely in the filter.
+ * @return false if the element is definitely not in the filter.
+ */
+bool bbloom_lookup_string(const bbloomfilter *bf, const char *element) {
+	return bbloom_lookup(bf, element, strlen(element));
+}
+
+/**
+ * @brief Add or insert an element into a blocked Bloom filter.
+ *
+ * @param bf Blocked Bloom filter to add element to.
+ * @param element Pointer to element to add.
+ * @param len Length of element in bytes.
+ */
+void bbloom_add(bbloomfilter *bf, const void *element, const size_t len) {
+	uint32_t  start, step, bit;
+	uint8_t  *block = locate_block(bf, element, len, &start, &step);
+
+	for (size_t i = 0; i < bf->hashcount; i++) {
+		bit = (start + i * step) % BBLOOM_BLOCK_BITS;
+
+		block[bit / 8] |= (0x01 << (bit % 8));
+	}
+}
+
+/**
+ * @brief Helper function for `bbloom_add()` to handle string elements.
+ *
+ * @param bf Blocked Bloom filter to add a string element to.
+ * @param element Pointer to the string element to add to the filter.
+ */
+void bbloom_add_string(bbloomfilter *bf, const char *element) {
+	bbloom_add(bf, element, strlen(element));
+}
+
+/**
+ * @brief Check if an element exists in a blocked Bloom filter, adding
+ * it if it does not exist.
+ *
+ * @param bf Pointer to the blocked Bloom filter to perform look up or add.
+ * @param element Pointer to the element to look up or add.
+ * @param len Length of the element in bytes
+ *
+ * @return true if the element is already in the filter.
+ * @return false if the element was added to the filter
+ */
+bool bbloom_lookup_or_add(bbloomfilter *bf, const void *element, const size_t len) {
+	uint32_t  start, step, bit;
+	uint8_t  *block = locate_block(bf, element, len, &start, &step);
+	bool      found_all = true;
+
+	for (size_t i = 0; i < bf->hashcount; i++) {
+		bit = (start + i * step) % BBLOOM_BLOCK_BITS;
+
+		if ((block[bit / 8] & (0x01 << (bit % 8))) == 0) {
+			found_all = false;
+			block[bit / 8] |= (0x01 << (bit % 8));
+		}
+	}
+
+	return found_all;
+}
+
+/**
+ * @brief Helper function for bbloom_lookup_or_add() to handle string
+ * elements.
+ *
+ * @param bf Pointer to the blocked Bloom filter.
+ * @param element Pointer to the string element to check or add.
+ *
+ * @return true if the string was already in the filter.
+ * @return false if the string was newly added.
+ */
+bool bbloom_lookup_or_add_string(bbloomfilter *bf, const char *element) {
+	return bbloom_lookup_or_add(bf, element, strlen(element));
+}
+
+/**
+ * @brief Set the name of the blocked Bloom filter.
+ *
+ * @param bf Pointer to the blocked Bloom filter.
+ * @param name Pointer to a character string containing the new name.
+ *
+ * @return true if the name was successfully set.
+ * @return false if the provided name is too long.
+ */
+bool bbloom_set_name(bbloomfilter *bf, const char *name) {
+	if (strlen(name) > BBLOOM_MAX_NAME_LENGTH) {
+		return false;
+	}
+
+	snprintf(bf->name, BBLOOM_MAX_NAME_LENGTH + 1, "%.*s", BBLOOM_MAX_NAME_LENGTH, name);
+
+	return true;
+}
+
+/**
+ * @brief Select the hash strategy used by a blocked Bloom filter.
+ *
+ * Filters default to HASH_MMH3. The strategy is saved with the filter.
+ *
+ * @param bf Pointer to an empty blocked Bloom filter.
+ * @param strategy Hash strategy to use.
+ *
+ * @return true on success.
+ * @return false if the strategy is unknown, or elements have already
+ *         been added to the filter.
+ */
+bool bbloom_set_hash(bbloomfilter *bf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) ||
+		bitops_popcount(bf->bitmap, bf->bitmap_size) != 0) {
+		return false;
+	}
+
+	bf->hash = strategy;
+
+	return true;
+}
+
+/**
+ * @brief Retrieve the name of the blocked Bloom filter.
+ *
+ * @param bf Pointer to the blocked Bloom filter.
+ *
+ * @return A constant character pointer to the name of the filter.
+ */
+const char *bbloom_get_name(bbloomfilter *bf) {
+	return bf->name;
+}
+
+/**
+ * @brief Fill out a bbloomfilter_file header for a filter.
+ *
+ * @param bf Blocked Bloom filter to describe.
+ * @param bff Pointer to the header to fill out.
+ */
+static void make_header(const bbloomfilter *bf, bbloomfilter_file *bff) {
+	memset(bff, 0, sizeof(bbloomfilter_file));
+	memcpy(bff->magic, bbloom_magic, sizeof(bbloom_magic));
+
+	bff->size        = bf->size;
+	bff->hashcount   = bf->hashcount;
+	bff->bitmap_size = bf->bitmap_size;
+	bff->expected    = bf->expected;
+	bff->accuracy    = bf->accuracy;
+	bff->hash        = bf->hash;
+	snprintf((char *)bff->name, BBLOOM_MAX_NAME_LENGTH + 1, "%.*s", BBLOOM_MAX_NAME_LENGTH, bf->name);
+}
+
+/**
+ * @brief Populate a filter from a bbloomfilter_file header.
+ *
+ * @param bf Blocked Bloom filter to populate.
+ * @param bff Pointer to the header read from disk.
+ * @param file_size Size of the file the header was read from.
+ *
+ * @return BBF_SUCCESS if the header is sane.
+ * @return BBF_INVALIDFILE if the header is invalid.
+ */
+static bbloom_error_t read_header(bbloomfilter *bf, const bbloomfilter_file *bff, const size_t file_size) {
+	// basic sanity check. should fail if filter isn't valid
+	if (memcmp(bff->magic, bbloom_magic, sizeof(bbloom_magic)) != 0 ||
+		bff->size == 0 ||
+		bff->hashcount == 0 ||
+		bff->size % BBLOOM_BLOCK_BITS != 0 ||
+		bff->size / 8 != bff->bitmap_size ||
+		!hash_strategy_valid(bff->hash) ||
+		sizeof(bbloomfilter_file) + bff->bitmap_size != file_size) {
+		return BBF_INVALIDFILE;
+	}
+
+	bf->size        = bff->size;
+	bf->blocks      = bff->size / BBLOOM_BLOCK_BITS;
+	bf->hashcount   = bff->hashcount;
+	bf->bitmap_size = bff->bitmap_size;
+	bf->expected    = bff->expected;
+	bf->accuracy    = bff->accuracy;
+	bf->hash        = bff->hash;
+	bf->map         = NULL;
+	bf->map_size    = 0;
+	snprintf(bf->name, BBLOOM_MAX_NAME_LENGTH + 1, "%.*s", BBLOOM_MAX_NAME_LENGTH, (char *)bff->name);
+
+	return BBF_SUCCESS;
+}
+
+/**
+ * @brief Saves a blocked Bloom filter to disk.
+ *
+ * The file contains two sections:
+ *
+ * 1. The bbloomfilter_file structure.
+ * 2. The bitmap data.
+ *
+ * @param bf Blocked Bloom filter to save to disk.
+ * @param path File path where the filter will be saved.
+ *
+ * @return BBF_SUCCESS on success.
+ * @return BBF_FOPEN if unable to open the file.
+ * @return BBF_FWRITE if unable to write to the file.
+ */
+bbloom_error_t bbloom_save(const bbloomfilter *bf, const char *path) {
+	FILE              *fp;
+	bbloomfilter_file  bff;
+
+	make_header(bf, &bff);
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		return BBF_FOPEN;
+	}
+
+	if (fwrite(&bff, sizeof(bbloomfilter_file), 1, fp) != 1 ||
+		fwrite(bf->bitmap, bf->bitmap_size, 1, fp) != 1) {
+		fclose(fp);
+		return BBF_FWRITE;
+	}
+
+	fclose(fp);
+	return BBF_SUCCESS;
+}
+
+/**
+ * @brief Load a blocked Bloom filter from a file on disk.
+ *
+ * @param bf Pointer to the blocked Bloom filter object to initialize.
+ * @param path File path from which to load the filter.
+ *
+ * @return BBF_SUCCESS on success.
+ * @return BBF_FOPEN if unable to open the file.
+ * @return BBF_FREAD if unable to read the file.
+ * @return BBF_FSTAT if fstat() fails.
+ * @return BBF_INVALIDFILE if the file is invalid.
+ * @return BBF_OUTOFMEMORY if memory allocation fails.
+ */
+bbloom_error_t bbloom_load(bbloomfilter *bf, const char *path) {
+	FILE              *fp;
+	struct stat        sb;
+	bbloomfilter_file  bff;
+	bbloom_error_t     error;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL) {
+		return BBF_FOPEN;
+	}
+
+	if (fstat(fileno(fp), &sb) == -1) {
+		fclose(fp);
+		return BBF_FSTAT;
+	}
+
+	if (fread(&bff, sizeof(bbloomfilter_file), 1, fp) != 1) {
+		fclose(fp);
+		return BBF_FREAD;
+	}
+
+	error = read_header(bf, &bff, sb.st_size);
+	if (error != BBF_SUCCESS) {
+		fclose(fp);
+		return error;
+	}
+
+	bf->bitmap = bitmap_alloc(bf->bitmap_size);
+	if (bf->bitmap == NULL) {
+		fclose(fp);
+		return BBF_OUTOFMEMORY;
+	}
+
+	if (fread(bf->bitmap, bf->bitmap_size, 1, fp) != 1) {
+		fclose(fp);
+		archbloom_free(bf->bitmap);
+		bf->bitmap = NULL;
+		return BBF_FREAD;
+	}
+
+	fclose(fp);
+
+	return BBF_SUCCESS;
+}
+
+/**
+ * @brief Saves a blocked Bloom filter to a file descriptor.
+ *
+ * @param bf Blocked Bloom filter to save.
+ * @param fd File descriptor to write the filter to.
+ *
+ * @return BBF_SUCCESS on success.
+ * @return BBF_FWRITE if unable to write to the file descriptor.
+ *
+ * @note This does not open or close the file descriptor. As such, it
+ *       is the developer's responsibility to manage these.
+ */
+bbloom_error_t bbloom_save_fd(const bbloomfilter *bf, int fd) {
+	bbloomfilter_file bff;
+
+	make_header(bf, &bff);
+
+	if (write(fd, &bff, sizeof(bbloomfilter_file)) != sizeof(bbloomfilter_file)) {
+		return BBF_FWRITE;
+	}
+
+	if (write(fd, bf->bitmap, bf->bitmap_size) != (ssize_t)bf->bitmap_size) {
+		return BBF_FWRITE;
+	}
+
+	return BBF_SUCCESS;
+}
+
+/**
+ * @brief Load a blocked Bloom filter from a file descriptor.
+ *
+ * @param bf Pointer to the blocked Bloom filter object to initialize.
+ * @param fd File descriptor to read the filter from.
+ *
+ * @return BBF_SUCCESS on success.
+ * @return BBF_FREAD if unable to read from the file descriptor.
+ * @return BBF_FSTAT if fstat() fails.
+ * @return BBF_INVALIDFILE if the file is invalid.
+ * @return BBF_OUTOFMEMORY if memory allocation fails.
+ */
+bbloom_error_t bbloom_load_fd(bbloomfilter *bf, int fd) {
+	struct stat       sb;
+	bbloomfilter_file bff;
+	bbloom_error_t    error;
+
+	if (fstat(fd, &sb) == -1) {
+		return BBF_FSTAT;
+	}
+
+	if (read(fd, &bff, sizeof(bbloomfilter_file)) != sizeof(bbloomfilter_file)) {
+		return BBF_FREAD;
+	}
+
+	error = read_header(bf, &bff, sb.st_size);
+	if (error != BBF_SUCCESS) {
+		return error;
+	}
+
+	bf->bitmap = bitmap_alloc(bf->bitmap_size);
+	if (bf->bitmap == NULL) {
+		return BBF_OUTOFMEMORY;
+	}
+
+	if (read(fd, bf->bitmap, bf->bitmap_size) != (ssize_t)bf->bitmap_size) {
+		archbloom_free(bf->bitmap);
+		bf->bitmap = NULL;
+		return BBF_FREAD;
+	}
+
+	return BBF_SUCCESS;
+}
+
+/**
+ * @brief Map a blocked Bloom filter file descriptor into memory.
+ *
+ * See `bloom_map_fd()`. The header is 320 bytes, so blocks in the
+ * mapping stay 64 byte aligned.
+ *
+ * @param bf Pointer to the blocked Bloom filter object to initialize.
+ * @param fd File descriptor of a saved blocked Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return BBF_SUCCESS on success.
+ * @return BBF_FREAD if unable to read from the file descriptor.
+ * @return BBF_FSTAT if fstat() fails.
+ * @return BBF_INVALIDFILE if the file is invalid.
+ * @return BBF_MMAP if mmap() fails.
+ */
+bbloom_error_t bbloom_map_fd(bbloomfilter *bf, int fd, const bool writable) {
+	struct stat        sb;
+	bbloomfilter_file  bff;
+	bbloom_error_t     error;
+	void              *map;
+
+	if (fstat(fd, &sb) == -1) {
+		return BBF_FSTAT;
+	}
+
+	if (pread(fd, &bff, sizeof(bbloomfilter_file), 0) != sizeof(bbloomfilter_file)) {
+		return BBF_FREAD;
+	}
+
+	error = read_header(bf, &bff, sb.st_size);
+	if (error != BBF_SUCCESS) {
+		return error;
+	}
+
+	map = map_file(fd, sb.st_size, writable);
+	if (map == NULL) {
+		return BBF_MMAP;
+	}
+
+	bf->map      = map;
+	bf->map_size = sb.st_size;
+	bf->bitmap   = (uint8_t *)map + sizeof(bbloomfilter_file);
+
+	return BBF_SUCCESS;
+}
+
+/**
+ * @brief Map a blocked Bloom filter file into memory.
+ *
+ * This function is a convenience wrapper around `bbloom_map_fd()` that
+ * opens and closes the file.
+ *
+ * @param bf Pointer to the blocked Bloom filter object to initialize.
+ * @param path Path to a saved blocked Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return BBF_SUCCESS on success.
+ * @return BBF_FOPEN if unable to open the file.
+ * @return Any error returned by `bbloom_map_fd()`.
+ */
+bbloom_error_t bbloom_map(bbloomfilter *bf, const char *path, const bool writable) {
+	bbloom_error_t error;
+	int            fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
+		return BBF_FOPEN;
+	}
+
+	error = bbloom_map_fd(bf, fd, writable);
+	close(fd);
+
+	return error;
+}
+
+/**
+ * @brief Return a string containing the error message corresponding
+ * to an error code.
+ *
+ * @param error The error code returned by a blocked Bloom filter function.
+ *
+ * @return A pointer to a string containing the relevant error
+ * message, or "Unknown error" if the error code is out of range.
+ */
+const char *bbloom_strerror(bbloom_error_t error) {
+	if (error < 0 || error >= BBF_ERRORCOUNT) {
+		return "Unknown error";
+	}
+
+	return bbloom_errors[error];
+}
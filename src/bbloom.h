@@ -0,0 +1,160 @@
+/**
+ * @file bbloom.h
+ * @brief Header file for blocked Bloom filter implementation
+ * @author Daniel Roberson
+ *
+ * This file contains the function declarations, type definitions, and
+ * macros for working with blocked Bloom filters. A blocked Bloom filter
+ * is split into 64 byte blocks (the size of a cache line). One hash
+ * selects a block and all of an element's bits are set within that
+ * block, so a lookup costs at most a single cache miss rather than up
+ * to `hashcount` misses with a classic Bloom filter.
+ *
+ * The trade-off is a slightly higher false positive rate than a classic
+ * Bloom filter using the same amount of memory.
+ *
+ * @see bbloom.c for the corresponding implementation.
+ * @see bloom.h for the classic Bloom filter.
+ */
+#ifndef BBLOOM_H
+#define BBLOOM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+
+#define BBLOOM_MAX_NAME_LENGTH 255
+#define BBLOOM_BLOCK_SIZE      64                      /**< bytes per block */
+#define BBLOOM_BLOCK_BITS      (BBLOOM_BLOCK_SIZE * 8) /**< bits per block */
+
+/**
+ * @enum bbloom_error_t
+ * @brief Enum representing error status codes for blocked Bloom filter
+ * operations.
+ *
+ * Each error code maps to a corresponding error message in the
+ * `bbloom_errors[]` array.
+ */
+typedef enum {
+	BBF_SUCCESS = 0,
+	BBF_OUTOFMEMORY,
+	BBF_FOPEN,
+	BBF_FREAD,
+	BBF_FWRITE,
+	BBF_FSTAT,
+	BBF_INVALIDFILE,
+	BBF_MMAP,
+	// ERRORCOUNT is used as a counter. do not add anything below this line.
+	BBF_ERRORCOUNT
+} bbloom_error_t;
+
+/**
+ * @var bbloom_errors
+ * @brief Array of error messages that correspond to blocked Bloom
+ * filter error codes.
+ *
+ * @note The order of the messages must align with their corresponding
+ * error codes. Defined in bbloom.c, so other parts of the library can
+ * include this header.
+ */
+extern const char *bbloom_errors[];
+
+/**
+ * @struct bbloomfilter
+ * @brief Blocked Bloom filter data structure.
+ *
+ * @var bbloomfilter::size
+ * Size of the filter in bits. Always a multiple of BBLOOM_BLOCK_BITS.
+ *
+ * @var bbloomfilter::blocks
+ * Number of 64 byte blocks in the bitmap.
+ *
+ * @var bbloomfilter::hashcount
+ * Number of bits set within an element's block.
+ *
+ * @var bbloomfilter::bitmap_size
+ * Size of the bitmap in bytes.
+ *
+ * @var bbloomfilter::expected
+ * Expected number of elements the filter will hold.
+ *
+ * @var bbloomfilter::accuracy
+ * Desired margin of error (e.g., 0.01 represents 99.99% accuracy).
+ *
+ * @var bbloomfilter::hash
+ * Hash strategy used to hash elements. See `bbloom_set_hash()`.
+ *
+ * @var bbloomfilter::bitmap
+ * Pointer to the bitmap. Aligned to BBLOOM_BLOCK_SIZE.
+ *
+ * @var bbloomfilter::map
+ * Start of the file mapping if the filter was loaded with
+ * `bbloom_map()`, otherwise NULL.
+ *
+ * @var bbloomfilter::map_size
+ * Size of the file mapping in bytes.
+ */
+typedef struct {
+	size_t   size;              /**< Size of the filter in bits */
+	size_t   blocks;            /**< Number of blocks */
+	size_t   hashcount;         /**< Number of bits set per element */
+	size_t   bitmap_size;       /**< Size of the bitmap in bytes */
+	size_t   expected;          /**< Expected capacity of the filter */
+	float    accuracy;          /**< Desired margin of error */
+	hash_strategy hash;         /**< Hash strategy */
+	char     name[BBLOOM_MAX_NAME_LENGTH + 1];
+	uint8_t *bitmap;            /**< Pointer to the bitmap of the filter */
+	void    *map;               /**< File mapping from bbloom_map(), or NULL */
+	size_t   map_size;          /**< Size of the file mapping in bytes */
+} bbloomfilter;
+
+/**
+ * @struct bbloomfilter_file
+ * @brief Structure representing metadata for saving/loading a blocked
+ * Bloom filter.
+ *
+ * The structure is padded to 320 bytes so the bitmap following it in a
+ * file starts on a 64 byte boundary. `hash` is the hash strategy, which
+ * occupies what used to be padding, so older files read as HASH_MMH3.
+ */
+typedef struct {
+	uint8_t  magic[8];
+	uint8_t  name[BBLOOM_MAX_NAME_LENGTH + 1];
+	uint64_t size;
+	uint64_t hashcount;
+	uint64_t bitmap_size;
+	uint64_t expected;
+	float    accuracy;
+	uint32_t hash;
+	uint8_t  reserved[16];
+} bbloomfilter_file;
+
+/* function declarations
+ */
+bbloom_error_t  bbloom_init(bbloomfilter *, const size_t, const float);
+void            bbloom_destroy(bbloomfilter *);
+void            bbloom_clear(bbloomfilter *);
+const char     *bbloom_get_name(bbloomfilter *);
+bool            bbloom_set_name(bbloomfilter *, const char *);
+bool            bbloom_set_hash(bbloomfilter *, const hash_strategy);
+const char     *bbloom_strerror(const bbloom_error_t);
+bbloom_error_t  bbloom_save(const bbloomfilter *, const char *);
+bbloom_error_t  bbloom_load(bbloomfilter *, const char *);
+bbloom_error_t  bbloom_save_fd(const bbloomfilter *, int);
+bbloom_error_t  bbloom_load_fd(bbloomfilter *, int);
+bbloom_error_t  bbloom_map(bbloomfilter *, const char *, const bool);
+bbloom_error_t  bbloom_map_fd(bbloomfilter *, int, const bool);
+size_t          bbloom_saturation_count(const bbloomfilter *);
+float           bbloom_saturation(const bbloomfilter *);
+
+bool            bbloom_lookup(const bbloomfilter *, const void *, const size_t);
+bool            bbloom_lookup_string(const bbloomfilter *, const char *);
+bool            bbloom_lookup_or_add(bbloomfilter *, const void *, const size_t);
+bool            bbloom_lookup_or_add_string(bbloomfilter *, const char *);
+
+void            bbloom_add(bbloomfilter *, const void *, const size_t);
+void            bbloom_add_string(bbloomfilter *, const char *);
+
+#endif /* BBLOOM_H */
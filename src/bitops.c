@@ -0,0 +1,580 @@
+/* bitops.c -- bitmap population counts and bitwise combination.
+ *
+ * Every operation works on byte arrays of any length and alignment.
+ * The vector implementations handle whole vectors and hand the
+ * remaining tail to the scalar implementation.
+ *
+ * The x86-64 implementations are compiled with target attributes, so
+ * the library itself does not need to be built with -mavx2 and still
+ * runs on CPUs without it.
+ */
+#include <string.h>
+#include <pthread.h>
+
+#include "bitops.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+static const char *kernel_names[BITOPS_KERNELCOUNT] = {
+	"scalar",
+	"avx2",
+	"avx512",
+	"neon"
+};
+
+/* kernel_ops -- one implementation of every operation.
+ */
+typedef struct {
+	size_t (*popcount)(const uint8_t *, const size_t);
+	void   (*popcount_and_or)(const uint8_t *, const uint8_t *, const size_t, size_t *, size_t *);
+	void   (*or)(uint8_t *, const uint8_t *, const uint8_t *, const size_t);
+	void   (*and)(uint8_t *, const uint8_t *, const uint8_t *, const size_t);
+	size_t (*nonzero_bytes)(const uint8_t *, const size_t);
+	size_t (*nonzero_nibbles)(const uint8_t *, const size_t);
+} kernel_ops;
+
+/* scalar implementation
+ */
+static inline uint64_t load64(const uint8_t *p) {
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+
+	return w;
+}
+
+static inline void store64(uint8_t *p, const uint64_t w) {
+	memcpy(p, &w, sizeof(w));
+}
+
+// fold each byte onto its low bit. bit 0 of every byte is set if the byte is nonzero
+static inline uint64_t nonzero_bytes64(uint64_t w) {
+	w |= w >> 4;
+	w |= w >> 2;
+	w |= w >> 1;
+
+	return w & 0x0101010101010101ULL;
+}
+
+// as nonzero_bytes64(), for every nibble
+static inline uint64_t nonzero_nibbles64(uint64_t w) {
+	w |= w >> 2;
+	w |= w >> 1;
+
+	return w & 0x1111111111111111ULL;
+}
+
+static size_t scalar_popcount(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+	size_t i     = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		count += __builtin_popcountll(load64(buf + i));
+	}
+
+	for (; i < len; i++) {
+		count += __builtin_popcount(buf[i]);
+	}
+
+	return count;
+}
+
+static void scalar_popcount_and_or(const uint8_t *a, const uint8_t *b, const size_t len,
+                                   size_t *and_count, size_t *or_count) {
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		uint64_t wa = load64(a + i);
+		uint64_t wb = load64(b + i);
+
+		*and_count += __builtin_popcountll(wa & wb);
+		*or_count  += __builtin_popcountll(wa | wb);
+	}
+
+	for (; i < len; i++) {
+		*and_count += __builtin_popcount(a[i] & b[i]);
+		*or_count  += __builtin_popcount(a[i] | b[i]);
+	}
+}
+
+static void scalar_or(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		store64(dst + i, load64(a + i) | load64(b + i));
+	}
+
+	for (; i < len; i++) {
+		dst[i] = a[i] | b[i];
+	}
+}
+
+static void scalar_and(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		store64(dst + i, load64(a + i) & load64(b + i));
+	}
+
+	for (; i < len; i++) {
+		dst[i] = a[i] & b[i];
+	}
+}
+
+static size_t scalar_nonzero_bytes(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+	size_t i     = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		count += __builtin_popcountll(nonzero_bytes64(load64(buf + i)));
+	}
+
+	for (; i < len; i++) {
+		count += (buf[i] != 0);
+	}
+
+	return count;
+}
+
+static size_t scalar_nonzero_nibbles(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+	size_t i     = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		count += __builtin_popcountll(nonzero_nibbles64(load64(buf + i)));
+	}
+
+	for (; i < len; i++) {
+		count += ((buf[i] & 0x0f) != 0) + ((buf[i] & 0xf0) != 0);
+	}
+
+	return count;
+}
+
+/* AVX2 implementation. AVX2 has no vector popcount, so bytes are
+ * counted with a nibble lookup table and summed with vpsadbw.
+ * http://0x80.pl/articles/sse-popcount.html
+ */
+#if defined(__x86_64__)
+#define AVX2_TARGET __attribute__((target("avx2,popcnt")))
+
+AVX2_TARGET static inline __m256i avx2_popcount_epi8(const __m256i v) {
+	const __m256i lookup   = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+	                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i       lo       = _mm256_and_si256(v, low_mask);
+	__m256i       hi       = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+
+	return _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+	                       _mm256_shuffle_epi8(lookup, hi));
+}
+
+// popcount of each 64 bit lane
+AVX2_TARGET static inline __m256i avx2_popcount_epi64(const __m256i v) {
+	return _mm256_sad_epu8(avx2_popcount_epi8(v), _mm256_setzero_si256());
+}
+
+AVX2_TARGET static inline size_t avx2_sum_epi64(const __m256i v) {
+	return _mm256_extract_epi64(v, 0) + _mm256_extract_epi64(v, 1) +
+		_mm256_extract_epi64(v, 2) + _mm256_extract_epi64(v, 3);
+}
+
+AVX2_TARGET static size_t avx2_popcount(const uint8_t *buf, const size_t len) {
+	__m256i acc = _mm256_setzero_si256();
+	size_t  i   = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		acc = _mm256_add_epi64(acc, avx2_popcount_epi64(v));
+	}
+
+	return avx2_sum_epi64(acc) + scalar_popcount(buf + i, len - i);
+}
+
+AVX2_TARGET static void avx2_popcount_and_or(const uint8_t *a, const uint8_t *b, const size_t len,
+                                             size_t *and_count, size_t *or_count) {
+	__m256i and_acc = _mm256_setzero_si256();
+	__m256i or_acc  = _mm256_setzero_si256();
+	size_t  i       = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+
+		and_acc = _mm256_add_epi64(and_acc, avx2_popcount_epi64(_mm256_and_si256(va, vb)));
+		or_acc  = _mm256_add_epi64(or_acc, avx2_popcount_epi64(_mm256_or_si256(va, vb)));
+	}
+
+	*and_count += avx2_sum_epi64(and_acc);
+	*or_count  += avx2_sum_epi64(or_acc);
+	scalar_popcount_and_or(a + i, b + i, len - i, and_count, or_count);
+}
+
+AVX2_TARGET static void avx2_or(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(va, vb));
+	}
+
+	scalar_or(dst + i, a + i, b + i, len - i);
+}
+
+AVX2_TARGET static void avx2_and(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_and_si256(va, vb));
+	}
+
+	scalar_and(dst + i, a + i, b + i, len - i);
+}
+
+AVX2_TARGET static size_t avx2_nonzero_bytes(const uint8_t *buf, const size_t len) {
+	const __m256i zero  = _mm256_setzero_si256();
+	size_t        count = 0;
+	size_t        i     = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i  v     = _mm256_loadu_si256((const __m256i *)(buf + i));
+		uint32_t zeros = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+		count += 32 - __builtin_popcount(zeros);
+	}
+
+	return count + scalar_nonzero_bytes(buf + i, len - i);
+}
+
+AVX2_TARGET static size_t avx2_nonzero_nibbles(const uint8_t *buf, const size_t len) {
+	const __m256i mask = _mm256_set1_epi8(0x11);
+	__m256i       acc  = _mm256_setzero_si256();
+	size_t        i    = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+		v   = _mm256_or_si256(v, _mm256_srli_epi64(v, 2));
+		v   = _mm256_or_si256(v, _mm256_srli_epi64(v, 1));
+		acc = _mm256_add_epi64(acc, avx2_popcount_epi64(_mm256_and_si256(v, mask)));
+	}
+
+	return avx2_sum_epi64(acc) + scalar_nonzero_nibbles(buf + i, len - i);
+}
+
+/* AVX-512 implementation, using VPOPCNTQ.
+ */
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,avx512vpopcntdq,popcnt")))
+
+AVX512_TARGET static size_t avx512_popcount(const uint8_t *buf, const size_t len) {
+	__m512i acc = _mm512_setzero_si512();
+	size_t  i   = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_loadu_si512(buf + i)));
+	}
+
+	return _mm512_reduce_add_epi64(acc) + scalar_popcount(buf + i, len - i);
+}
+
+AVX512_TARGET static void avx512_popcount_and_or(const uint8_t *a, const uint8_t *b, const size_t len,
+                                                 size_t *and_count, size_t *or_count) {
+	__m512i and_acc = _mm512_setzero_si512();
+	__m512i or_acc  = _mm512_setzero_si512();
+	size_t  i       = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		__m512i va = _mm512_loadu_si512(a + i);
+		__m512i vb = _mm512_loadu_si512(b + i);
+
+		and_acc = _mm512_add_epi64(and_acc, _mm512_popcnt_epi64(_mm512_and_si512(va, vb)));
+		or_acc  = _mm512_add_epi64(or_acc, _mm512_popcnt_epi64(_mm512_or_si512(va, vb)));
+	}
+
+	*and_count += _mm512_reduce_add_epi64(and_acc);
+	*or_count  += _mm512_reduce_add_epi64(or_acc);
+	scalar_popcount_and_or(a + i, b + i, len - i, and_count, or_count);
+}
+
+AVX512_TARGET static void avx512_or(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		_mm512_storeu_si512(dst + i, _mm512_or_si512(_mm512_loadu_si512(a + i),
+		                                             _mm512_loadu_si512(b + i)));
+	}
+
+	scalar_or(dst + i, a + i, b + i, len - i);
+}
+
+AVX512_TARGET static void avx512_and(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		_mm512_storeu_si512(dst + i, _mm512_and_si512(_mm512_loadu_si512(a + i),
+		                                              _mm512_loadu_si512(b + i)));
+	}
+
+	scalar_and(dst + i, a + i, b + i, len - i);
+}
+
+AVX512_TARGET static size_t avx512_nonzero_bytes(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+	size_t i     = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		__m512i v = _mm512_loadu_si512(buf + i);
+		count += __builtin_popcountll(_mm512_test_epi8_mask(v, v));
+	}
+
+	return count + scalar_nonzero_bytes(buf + i, len - i);
+}
+
+AVX512_TARGET static size_t avx512_nonzero_nibbles(const uint8_t *buf, const size_t len) {
+	const __m512i mask = _mm512_set1_epi8(0x11);
+	__m512i       acc  = _mm512_setzero_si512();
+	size_t        i    = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		__m512i v = _mm512_loadu_si512(buf + i);
+		v   = _mm512_or_si512(v, _mm512_srli_epi64(v, 2));
+		v   = _mm512_or_si512(v, _mm512_srli_epi64(v, 1));
+		acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_and_si512(v, mask)));
+	}
+
+	return _mm512_reduce_add_epi64(acc) + scalar_nonzero_nibbles(buf + i, len - i);
+}
+#endif /* __x86_64__ */
+
+/* NEON implementation. NEON is part of the aarch64 baseline, so this
+ * doesn't need a runtime check.
+ */
+#if defined(__aarch64__)
+static size_t neon_popcount(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+	size_t i     = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		count += vaddlvq_u8(vcntq_u8(vld1q_u8(buf + i)));
+	}
+
+	return count + scalar_popcount(buf + i, len - i);
+}
+
+static void neon_popcount_and_or(const uint8_t *a, const uint8_t *b, const size_t len,
+                                 size_t *and_count, size_t *or_count) {
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t va = vld1q_u8(a + i);
+		uint8x16_t vb = vld1q_u8(b + i);
+
+		*and_count += vaddlvq_u8(vcntq_u8(vandq_u8(va, vb)));
+		*or_count  += vaddlvq_u8(vcntq_u8(vorrq_u8(va, vb)));
+	}
+
+	scalar_popcount_and_or(a + i, b + i, len - i, and_count, or_count);
+}
+
+static void neon_or(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		vst1q_u8(dst + i, vorrq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+	}
+
+	scalar_or(dst + i, a + i, b + i, len - i);
+}
+
+static void neon_and(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		vst1q_u8(dst + i, vandq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+	}
+
+	scalar_and(dst + i, a + i, b + i, len - i);
+}
+
+static size_t neon_nonzero_bytes(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+	size_t i     = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(buf + i);
+		count += vaddvq_u8(vshrq_n_u8(vtstq_u8(v, v), 7));
+	}
+
+	return count + scalar_nonzero_bytes(buf + i, len - i);
+}
+#endif /* __aarch64__ */
+
+static const kernel_ops kernels[BITOPS_KERNELCOUNT] = {
+	[BITOPS_SCALAR] = {
+		scalar_popcount,
+		scalar_popcount_and_or,
+		scalar_or,
+		scalar_and,
+		scalar_nonzero_bytes,
+		scalar_nonzero_nibbles
+	},
+#if defined(__x86_64__)
+	[BITOPS_AVX2] = {
+		avx2_popcount,
+		avx2_popcount_and_or,
+		avx2_or,
+		avx2_and,
+		avx2_nonzero_bytes,
+		avx2_nonzero_nibbles
+	},
+	[BITOPS_AVX512] = {
+		avx512_popcount,
+		avx512_popcount_and_or,
+		avx512_or,
+		avx512_and,
+		avx512_nonzero_bytes,
+		avx512_nonzero_nibbles
+	},
+#endif
+#if defined(__aarch64__)
+	[BITOPS_NEON] = {
+		neon_popcount,
+		neon_popcount_and_or,
+		neon_or,
+		neon_and,
+		neon_nonzero_bytes,
+		scalar_nonzero_nibbles
+	},
+#endif
+};
+
+/* runtime dispatch
+ */
+static const kernel_ops *current_ops;
+static bitops_kernel     current_kernel;
+static pthread_once_t    select_once = PTHREAD_ONCE_INIT;
+
+static bool kernel_supported(const bitops_kernel kernel) {
+	switch (kernel) {
+	case BITOPS_SCALAR:
+		return true;
+#if defined(__x86_64__)
+	case BITOPS_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+	case BITOPS_AVX512:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx512f") &&
+			__builtin_cpu_supports("avx512bw") &&
+			__builtin_cpu_supports("avx512vpopcntdq");
+#endif
+#if defined(__aarch64__)
+	case BITOPS_NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+static void select_kernel(void) {
+	bitops_kernel best = BITOPS_SCALAR;
+
+	for (int k = BITOPS_SCALAR; k < BITOPS_KERNELCOUNT; k++) {
+		if (kernel_supported(k)) {
+			best = k;
+		}
+	}
+
+	current_kernel = best;
+	__atomic_store_n(&current_ops, &kernels[best], __ATOMIC_RELEASE);
+}
+
+static inline const kernel_ops *ops(void) {
+	pthread_once(&select_once, select_kernel);
+
+	return __atomic_load_n(&current_ops, __ATOMIC_ACQUIRE);
+}
+
+/* bitops_popcount() -- number of bits set in `len` bytes of `buf`.
+ */
+size_t bitops_popcount(const uint8_t *buf, const size_t len) {
+	return ops()->popcount(buf, len);
+}
+
+/* bitops_popcount_and_or() -- number of bits set in `a & b` and in
+ * `a | b`, in a single pass. Results are added to `and_count` and
+ * `or_count`.
+ */
+void bitops_popcount_and_or(const uint8_t *a, const uint8_t *b, const size_t len,
+                            size_t *and_count, size_t *or_count) {
+	ops()->popcount_and_or(a, b, len, and_count, or_count);
+}
+
+/* bitops_or() -- dst = a | b. dst may be a or b.
+ */
+void bitops_or(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	ops()->or(dst, a, b, len);
+}
+
+/* bitops_and() -- dst = a & b. dst may be a or b.
+ */
+void bitops_and(uint8_t *dst, const uint8_t *a, const uint8_t *b, const size_t len) {
+	ops()->and(dst, a, b, len);
+}
+
+/* bitops_nonzero_bytes() -- number of nonzero bytes, ie: 8 bit
+ * counters that are in use.
+ */
+size_t bitops_nonzero_bytes(const uint8_t *buf, const size_t len) {
+	return ops()->nonzero_bytes(buf, len);
+}
+
+/* bitops_nonzero_nibbles() -- number of nonzero nibbles, ie: 4 bit
+ * counters that are in use.
+ */
+size_t bitops_nonzero_nibbles(const uint8_t *buf, const size_t len) {
+	return ops()->nonzero_nibbles(buf, len);
+}
+
+/* bitops_get_kernel() -- implementation currently in use.
+ */
+bitops_kernel bitops_get_kernel(void) {
+	ops();
+
+	return __atomic_load_n(&current_kernel, __ATOMIC_ACQUIRE);
+}
+
+/* bitops_set_kernel() -- force an implementation, for testing and
+ * benchmarking. Returns false, leaving the current one in place, if
+ * this CPU or build doesn't support it.
+ */
+bool bitops_set_kernel(const bitops_kernel kernel) {
+	if (kernel >= BITOPS_KERNELCOUNT || !kernel_supported(kernel)) {
+		return false;
+	}
+
+	ops();
+
+	__atomic_store_n(&current_kernel, kernel, __ATOMIC_RELEASE);
+	__atomic_store_n(&current_ops, &kernels[kernel], __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/* bitops_kernel_name() -- name of an implementation.
+ */
+const char *bitops_kernel_name(const bitops_kernel kernel) {
+	if (kernel >= BITOPS_KERNELCOUNT) {
+		return "unknown";
+	}
+
+	return kernel_names[kernel];
+}
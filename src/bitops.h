@@ -0,0 +1,46 @@
+/* bitops.h -- bitmap population counts and bitwise combination.
+ *
+ * Internal helpers shared by the filter implementations for
+ * saturation counts, merges and intersections. Each operation has a
+ * portable word at a time implementation, and AVX2, AVX-512 and NEON
+ * versions. The fastest one the CPU supports is picked at runtime the
+ * first time any of these are called.
+ *
+ * This header is not installed.
+ */
+#ifndef BITOPS_H
+#define BITOPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* bitops_kernel -- available implementations.
+ */
+typedef enum {
+	BITOPS_SCALAR = 0, /* 64 bits at a time with __builtin_popcountll() */
+	BITOPS_AVX2,       /* x86-64 with AVX2 */
+	BITOPS_AVX512,     /* x86-64 with AVX-512F, BW and VPOPCNTDQ */
+	BITOPS_NEON,       /* aarch64 */
+	// used as a counter. do not add anything below this line.
+	BITOPS_KERNELCOUNT
+} bitops_kernel;
+
+/* function declarations
+ */
+size_t        bitops_popcount(const uint8_t *, const size_t);
+void          bitops_popcount_and_or(const uint8_t *,
+                                     const uint8_t *,
+                                     const size_t,
+                                     size_t *,
+                                     size_t *);
+void          bitops_or(uint8_t *, const uint8_t *, const uint8_t *, const size_t);
+void          bitops_and(uint8_t *, const uint8_t *, const uint8_t *, const size_t);
+size_t        bitops_nonzero_bytes(const uint8_t *, const size_t);
+size_t        bitops_nonzero_nibbles(const uint8_t *, const size_t);
+
+bitops_kernel bitops_get_kernel(void);
+bool          bitops_set_kernel(const bitops_kernel);
+const char   *bitops_kernel_name(const bitops_kernel);
+
+#endif /* BITOPS_H */
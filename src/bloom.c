@@ -8,17 +8,49 @@
  * saving and loading filters from disk.
  */
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
-#include "mmh3.h"
+#include "hash.h"
+#include "bitops.h"
+#include "fastrange.h"
+#include "mapfile.h"
+#include "rice.h"
+#include "alloc.h"
 #include "bloom.h"
 
+_Static_assert(sizeof(bloomfilter_file) % 64 == 0,
+               "bloomfilter_file must keep the bitmap 64 byte aligned");
+_Static_assert(offsetof(bloomfilter_file, hash) == BLOOM_FILE_LEGACY_HEADER_SIZE,
+               "bloomfilter_file must stay compatible with legacy files");
+_Static_assert(sizeof(bloomfilter_delta) == 64,
+               "bloomfilter_delta must keep the blocks 64 byte aligned");
+
+// messages for bloom_strerror(). See bloom.h.
+const char *bloom_errors[] = {
+	"Success",
+	"Out of memory",
+	"Unable to open file",
+	"Unable to read file",
+	"Unable to write to file",
+	"fstat() failure",
+	"Invalid file format",
+	"mmap() failure",
+	"Filter does not track changes",
+	"Invalid parameter"
+};
+
+_Static_assert(sizeof(bloom_errors) / sizeof(bloom_errors[0]) == BF_ERRORCOUNT,
+               "bloom_errors must have a message for every bloom_error_t");
+
 /**
  * @brief Calculate the ideal size of a Bloom filter's bit array.
  *
@@ -38,6 +70,129 @@ static size_t ideal_size(const size_t expected, const float accuracy) {
 	return -(expected * log(accuracy) / pow(log(2.0), 2));
 }
 
+/**
+ * @brief Allocate a zeroed bitmap for a filter of `size` bits.
+ *
+ * The allocation is rounded up to a whole number of 64 bit words so
+ * BLOOM_FLAG_CONCURRENT filters can address the bitmap a word at a
+ * time. `bitmap_size` is not affected; the padding is never set. The
+ * bitmap starts on a cache line; see alloc.h.
+ *
+ * @param size Size of the filter in bits.
+ *
+ * @return Pointer to the bitmap, or NULL if allocation fails.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static uint8_t *bitmap_alloc(const size_t size) {
+	return archbloom_alloc(((size + 63) / 64) * sizeof(uint64_t));
+}
+
+/**
+ * @brief Helper function to get the number of BLOOM_DELTA_BLOCK_SIZE
+ * byte blocks in a Bloom filter's bitmap. The last may be partial.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline size_t block_count(const bloomfilter *bf) {
+	return (bf->bitmap_size + BLOOM_DELTA_BLOCK_SIZE - 1) / BLOOM_DELTA_BLOCK_SIZE;
+}
+
+/**
+ * @brief Helper function to get the number of 64 bit words in the
+ * dirty block map of a Bloom filter.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline size_t dirty_words(const bloomfilter *bf) {
+	return (block_count(bf) + 63) / 64;
+}
+
+/**
+ * @brief Allocate the dirty block map of a BLOOM_FLAG_TRACK_DIRTY
+ * filter, with every block clean. Other filters get NULL.
+ *
+ * @param bf Bloom filter, with its size and flags set.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bloom_error_t dirty_alloc(bloomfilter *bf) {
+	bf->dirty = NULL;
+
+	if ((bf->flags & BLOOM_FLAG_TRACK_DIRTY) == 0) {
+		return BF_SUCCESS;
+	}
+
+	bf->dirty = calloc(dirty_words(bf), sizeof(uint64_t));
+
+	return (bf->dirty == NULL) ? BF_OUTOFMEMORY : BF_SUCCESS;
+}
+
+/**
+ * @brief Helper function to check whether a Bloom filter counts its
+ * statistics with atomic adds.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline bool stats_concurrent(const bloomfilter *bf) {
+	return (bf->flags & BLOOM_FLAG_CONCURRENT) != 0;
+}
+
+/**
+ * @brief Helper function to allocate the runtime statistics of a
+ * Bloom filter. A filter whose statistics can't be allocated keeps
+ * none, so this never fails.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline void stats_alloc(bloomfilter *bf) {
+	bf->stats = archbloom_counters_alloc(stats_concurrent(bf));
+}
+
+/**
+ * @brief Helper function for the init functions. Initialize a Bloom
+ * filter of `size` bits using `hashcount` hashes per element.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bloom_error_t init_sized(bloomfilter *bf,
+								const size_t size,
+								const size_t hashcount,
+								const size_t expected,
+								const float accuracy,
+								const uint32_t flags) {
+	bf->size        = size;
+	bf->hashcount   = hashcount;
+	// round up, otherwise the last few bit positions land past the end
+	// of the bitmap when size isn't a multiple of 8.
+	bf->bitmap_size = (bf->size + 7) / 8;
+	bf->expected    = expected;
+	bf->accuracy    = accuracy;
+	bf->flags       = flags & BLOOM_FLAGS_ALL;
+	bf->hash        = HASH_MMH3;
+	bf->map         = NULL;
+	bf->map_size    = 0;
+	bf->stats       = NULL;
+	snprintf(bf->name, sizeof(bf->name), "DEFAULT");
+	bf->bitmap      = bitmap_alloc(bf->size);
+	if (bf->bitmap == NULL) {
+		return BF_OUTOFMEMORY;
+	}
+
+	if (dirty_alloc(bf) != BF_SUCCESS) {
+		archbloom_free(bf->bitmap);
+		bf->bitmap = NULL;
+		return BF_OUTOFMEMORY;
+	}
+
+	stats_alloc(bf);
+
+	return BF_SUCCESS;
+}
+
 /**
  * @brief Initialize a Bloom filter
  *
@@ -52,65 +207,149 @@ static size_t ideal_size(const size_t expected, const float accuracy) {
  * @return BF_OUTOFMEMORY if memory allocation fails.
  */
 bloom_error_t bloom_init(bloomfilter *bf, const size_t expected, const float accuracy) {
-	bf->size        = ideal_size(expected, accuracy);
-	bf->hashcount   = (bf->size / expected) * log(2);
-	bf->bitmap_size = bf->size / 8;
-	bf->expected    = expected;
-	bf->accuracy    = accuracy;
-	snprintf(bf->name, sizeof(bf->name), "DEFAULT");
-	bf->bitmap      = calloc(bf->bitmap_size, sizeof(uint8_t));
-	if (bf->bitmap == NULL) {
-		return BF_OUTOFMEMORY;
+	return bloom_init_flags(bf, expected, accuracy, 0);
+}
+
+/**
+ * @brief Initialize a Bloom filter with options.
+ *
+ * This function is `bloom_init()` with a set of BLOOM_FLAG_* options
+ * that control how hashes are mapped onto the filter:
+ *
+ * - 0: `hash % size`. This is what `bloom_init()` uses.
+ * - BLOOM_FLAG_FASTRANGE: multiply-shift reduction. Same size as the
+ *   default, but no division per probe.
+ * - BLOOM_FLAG_POW2: size is rounded up to a power of two and hashes
+ *   are masked. Cheapest per probe, at the cost of up to twice the
+ *   memory.
+ *
+ * BLOOM_FLAG_CONCURRENT may be combined with any of these to make the
+ * filter safe to add to and look up from multiple threads at once.
+ * BLOOM_FLAG_TRACK_DIRTY records which blocks change, for
+ * `bloom_save_delta_fd()`.
+ *
+ * The flags are saved with the filter, so filters load back with the
+ * same mapping.
+ *
+ * @param bf       Pointer to a bloomfilter structure.
+ * @param expected Expected number of elements the filter will contain.
+ * @param accuracy Margin of acceptable error. ex: 0.01 is "99.99%" accurate.
+ * @param flags    Bitwise OR of BLOOM_FLAG_* values. Unknown bits are ignored.
+ *
+ * @return BF_SUCCESS on successful initialization.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t bloom_init_flags(bloomfilter *bf, const size_t expected, const float accuracy, const uint32_t flags) {
+	size_t size = ideal_size(expected, accuracy);
+
+	if (flags & BLOOM_FLAG_POW2) {
+		size = round_pow2(size);
 	}
 
-	return BF_SUCCESS;
+	return init_sized(bf, size, (size / expected) * log(2), expected, accuracy, flags);
+}
+
+/**
+ * @brief Helper function for `bloom_init_compressible()`. Calculate
+ * the entropy, in bits, of a bit that is set with probability `p`.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static double entropy(const double p) {
+	if (p <= 0.0 || p >= 1.0) {
+		return 0.0;
+	}
+
+	return -(p * log2(p)) - ((1 - p) * log2(1 - p));
+}
+
+/**
+ * @brief Initialize a Bloom filter that is meant to be saved with
+ * `bloom_save_compressed()`.
+ *
+ * A Bloom filter sized by `bloom_init()` has half of its bits set
+ * when full, which doesn't compress. Broder & Mitzenmacher observe
+ * that a larger filter using fewer hash functions has the same false
+ * positive rate with fewer bits set, and compresses to less than the
+ * ideal filter. This chooses the number of hash functions that
+ * minimizes the compressed size at `expected` elements, without
+ * growing the bitmap beyond `max_growth` times the size `bloom_init()`
+ * would use. Lookups are cheaper too, as they compute fewer hashes.
+ *
+ * @param bf         Pointer to a bloomfilter structure.
+ * @param expected   Expected number of elements the filter will contain.
+ * @param accuracy   Margin of acceptable error. ex: 0.01 is "99.99%" accurate.
+ * @param max_growth Largest bitmap to allow, relative to `bloom_init()`.
+ *                   1.0 or less gives the same filter as `bloom_init()`.
+ *
+ * @return BF_SUCCESS on successful initialization.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t bloom_init_compressible(bloomfilter *bf, const size_t expected, const float accuracy, const float max_growth) {
+	size_t size      = ideal_size(expected, accuracy);
+	size_t hashcount = (size / expected) * log(2);
+	double limit     = (double)size * max_growth;
+	double best      = size * entropy(1 - exp(-(double)hashcount * expected / size));
+
+	// with k hashes, a fraction p = accuracy^(1/k) of the bits must be
+	// set. that takes m = -kn / ln(1 - p) bits, which compress to about
+	// m * H(p) bits.
+	for (size_t k = 1; k < hashcount; k++) {
+		double p = pow(accuracy, 1.0 / k);
+		double m = -(double)k * expected / log1p(-p);
+
+		if (m <= limit && m * entropy(p) < best) {
+			best      = m * entropy(p);
+			size      = m;
+			hashcount = k;
+		}
+	}
+
+	return init_sized(bf, size, hashcount, expected, accuracy, 0);
 }
 
 /**
  * @brief Free the memory allocated for a Bloom filter.
  *
- * This function frees memory associated with a the given Bloom filter.
+ * This function frees memory associated with a the given Bloom filter,
+ * or unmaps it if it was loaded with `bloom_map()`.
  *
  * @param bf Pointer to the Bloom filter to free.
  */
 void bloom_destroy(bloomfilter *bf) {
+	if (bf->map) {
+		munmap(bf->map, bf->map_size);
+		bf->map    = NULL;
+		bf->bitmap = NULL;
+	}
+
 	if (bf->bitmap) {
-		free(bf->bitmap);
+		archbloom_free(bf->bitmap);
 		bf->bitmap = NULL;
 	}
+
+	free(bf->dirty);
+	bf->dirty = NULL;
+
+	archbloom_counters_free(bf->stats);
+	bf->stats = NULL;
 }
 
 /**
  * @brief Clear the contents of a Bloom filter..
  *
  * This function empties the Bloom filter, setting all bits to zero.
+ * BLOOM_FLAG_TRACK_DIRTY filters are checkpointed as well: deltas only
+ * carry added bits, so a cleared filter has to be sent in full.
  *
  * @param bf Pointer to the Bloom filter to clear.
  */
 void bloom_clear(bloomfilter *bf) {
 	memset(bf->bitmap, 0, bf->bitmap_size);
+	archbloom_counters_store(bf->stats, stats_concurrent(bf), ARCHBLOOM_STAT_SET, 0);
+	bloom_checkpoint(bf);
 }
 
-// lookup table for bloom_saturation() and bloom_saturation_count()
-static const uint8_t bit_count_table[256] = {
-    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
-};
-
 /**
  * @brief Calculate the number of bits set to 1 in a Bloom filter.
  *
@@ -118,18 +357,62 @@ static const uint8_t bit_count_table[256] = {
  * filter. This calculation is useful for determining how full the
  * filter is.
  *
+ * Filters that keep runtime statistics count bits as they are set, so
+ * this takes constant time. Others, and filters mapped with
+ * `bloom_map()`, which other processes may be changing, count the
+ * whole bitmap.
+ *
  * @param bf Bloom filter to count.
  *
  * @return The number of bits set to 1 in the provided Bloom filter.
  */
 size_t bloom_saturation_count(const bloomfilter *bf) {
-	size_t count = 0;
+	if (bf->stats != NULL && bf->map == NULL) {
+		archbloom_stats stats;
 
-	for (size_t i = 0; i < bf->bitmap_size; i++) {
-		count += bit_count_table[bf->bitmap[i]];
+		archbloom_counters_read(bf->stats, stats_concurrent(bf), &stats);
+		return stats.set;
 	}
 
-	return count;
+	return bitops_popcount(bf->bitmap, bf->bitmap_size);
+}
+
+/**
+ * @brief Get the runtime statistics of a Bloom filter.
+ *
+ * On BLOOM_FLAG_CONCURRENT filters with other threads running, the
+ * figures are approximate. `set` is filled in whether or not the
+ * filter keeps statistics. See stats.h.
+ *
+ * @param bf Bloom filter.
+ * @param stats Set to the filter's statistics.
+ *
+ * @return true on success.
+ * @return false if the filter keeps no statistics: the library was
+ *         built without ARCHBLOOM_STATS. Only `set` is filled in.
+ */
+bool bloom_stats(const bloomfilter *bf, archbloom_stats *stats) {
+	archbloom_counters_read(bf->stats, stats_concurrent(bf), stats);
+	stats->set = bloom_saturation_count(bf);
+
+	return bf->stats != NULL;
+}
+
+/**
+ * @brief Recount the bits set in a Bloom filter.
+ *
+ * Filters that keep runtime statistics track the number of bits set
+ * as they add elements. Call this after changing `bitmap` other than
+ * through this library's functions, such as by reading it from a file
+ * directly. Other threads must not be adding to the filter.
+ *
+ * @param bf Bloom filter to recount.
+ */
+void bloom_recount(bloomfilter *bf) {
+	if (bf->stats != NULL) {
+		archbloom_counters_store(bf->stats, stats_concurrent(bf), ARCHBLOOM_STAT_SET,
+		                         bitops_popcount(bf->bitmap, bf->bitmap_size));
+	}
 }
 
 /**
@@ -182,13 +465,18 @@ bool bloom_clear_if_saturation_exceeds(bloomfilter *bf, float threshold) {
  * @brief Estimate the false positive rate of a Bloom filter.
  *
  * This function calculates the estimated false positive rate of the
- * given Bloom filter.
+ * given Bloom filter from how full it is: an element that is not in
+ * the set is a false positive when all `k` of its bits happen to be
+ * set, which for a filter with a fraction `s` of its bits set happens
+ * with probability `s ^ k`.
  *
  * where:
  * - `k` is the number of hash functions used (`bf->hashcount`),
- * - `n` is the number of elements inserted (determined by
- *    `bloom_saturation_count()` or other methods),
- * - `m` is the size of the bit array in the Bloom filter (`bf->size`).
+ * - `s` is the number of bits set (`bloom_saturation_count()`)
+ *    divided by the size of the filter in bits (`bf->size`).
+ *
+ * Unlike a formula based on the number of elements added, this holds
+ * for filters that were merged or folded.
  *
  * The false positive rate represents the likelihood that a query for
  * an element that is not in the set will incorrectly return true.
@@ -199,35 +487,202 @@ bool bloom_clear_if_saturation_exceeds(bloomfilter *bf, float threshold) {
  * number between 0 and 1.
  */
 float bloom_estimate_false_positive_rate(const bloomfilter *bf) {
-	/*
-	 * false positive rate formula: (1 - exp(-kn/m)) ^ k
-	 *
-	 * where:
-	 *     k = hash count
-	 *     n = number of elements
-	 *     m = size of filter
-	 */
-	size_t m = bf->size;
-	size_t n = bloom_saturation_count(bf);
-	size_t k = bf->hashcount;
+	double saturation = (double)bloom_saturation_count(bf) / bf->size;
+
+	return pow(saturation, bf->hashcount);
+}
+
+/**
+ * @brief Flags that change where an element's bits are. Filters must
+ * agree on these to be merged, intersected or compared.
+ */
+#define LAYOUT_FLAGS (BLOOM_FLAG_POW2 | BLOOM_FLAG_FASTRANGE)
+
+/**
+ * @brief Flags that only describe how a filter is used in this
+ * process. They are left out of saved files, so a filter filled by
+ * several threads saves the same file as one filled by a single thread.
+ */
+#define RUNTIME_FLAGS BLOOM_FLAG_CONCURRENT
+
+/**
+ * @brief Number of locks used by `bloom_lookup_or_add()` on
+ * BLOOM_FLAG_CONCURRENT filters. Elements are assigned a lock by hash,
+ * so unrelated elements rarely contend.
+ */
+#define LOCK_STRIPES 64
+
+/**
+ * @brief A lock padded to its own cache line, so neighbouring stripes
+ * don't share one.
+ */
+typedef union {
+	pthread_mutex_t mutex;
+	uint8_t         pad[64];
+} lock_stripe;
+
+#define STRIPE_INIT { .mutex = PTHREAD_MUTEX_INITIALIZER }
+#define STRIPES_4   STRIPE_INIT, STRIPE_INIT, STRIPE_INIT, STRIPE_INIT
+#define STRIPES_16  STRIPES_4, STRIPES_4, STRIPES_4, STRIPES_4
+
+// shared by every concurrent filter; see bloom_lookup_or_add()
+static lock_stripe lock_stripes[LOCK_STRIPES] = {
+	STRIPES_16, STRIPES_16, STRIPES_16, STRIPES_16
+};
+
+/**
+ * @brief Helper function to get the bit of a 64 bit word that holds
+ * bit `position` of a Bloom filter.
+ *
+ * The bitmap is saved a byte at a time, with bit `position` in byte
+ * `position / 8`. On big endian systems that byte is not the low
+ * byte of its word, so the shift is adjusted to keep the same layout.
+ */
+static inline uint64_t word_mask(const uint64_t position) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return 1ULL << ((7 - ((position / 8) % 8)) * 8 + (position % 8));
+#else
+	return 1ULL << (position % 64);
+#endif
+}
+
+/**
+ * @brief Helper function to test bit `position` of a Bloom filter.
+ *
+ * BLOOM_FLAG_CONCURRENT filters are read with atomic loads, so
+ * lookups are lock free and safe alongside concurrent additions.
+ *
+ * @param bf Bloom filter.
+ * @param position Bit position in the range [0, bf->size).
+ *
+ * @return true if the bit is set.
+ */
+static inline bool test_bit(const bloomfilter *bf, const uint64_t position) {
+	if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+		const uint64_t *words = (const uint64_t *)bf->bitmap;
+		return (__atomic_load_n(&words[position / 64], __ATOMIC_RELAXED) & word_mask(position)) != 0;
+	}
+
+	return (bf->bitmap[position / 8] & (0x01 << (position % 8))) != 0;
+}
+
+/**
+ * @brief Helper function to mark block `block` of a
+ * BLOOM_FLAG_TRACK_DIRTY filter as changed.
+ *
+ * On BLOOM_FLAG_CONCURRENT filters the mark is released after the
+ * bits it covers, so `bloom_save_delta_fd()` taking the mark also sees
+ * the bits.
+ */
+static inline void mark_block(bloomfilter *bf, const uint64_t block) {
+	uint64_t mask = word_mask(block); // as bytes, the map is a bitmap like the filter's
+
+	if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+		__atomic_fetch_or(&bf->dirty[block / 64], mask, __ATOMIC_RELEASE);
+		return;
+	}
+
+	bf->dirty[block / 64] |= mask;
+}
+
+/**
+ * @brief Helper function to set bit `position` of a Bloom filter.
+ *
+ * BLOOM_FLAG_CONCURRENT filters are set with an atomic fetch-or on the
+ * 64 bit word holding the bit. If the bit was clear, it is counted and,
+ * if the filter tracks dirty blocks, its block is marked.
+ *
+ * @param bf Bloom filter.
+ * @param position Bit position in the range [0, bf->size).
+ *
+ * @return true if the bit was already set.
+ */
+static inline bool set_bit(bloomfilter *bf, const uint64_t position) {
+	if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+		uint64_t *words = (uint64_t *)bf->bitmap;
+		uint64_t  mask  = word_mask(position);
+		bool      set   = (__atomic_fetch_or(&words[position / 64], mask, __ATOMIC_RELAXED) & mask) != 0;
+
+		if (!set) {
+			archbloom_count(bf->stats, true, ARCHBLOOM_STAT_SET, 1);
+			if (bf->dirty != NULL) {
+				mark_block(bf, position / (BLOOM_DELTA_BLOCK_SIZE * 8));
+			}
+		}
+
+		return set;
+	}
+
+	uint8_t mask = 0x01 << (position % 8);
+	bool    set  = (bf->bitmap[position / 8] & mask) != 0;
+
+	bf->bitmap[position / 8] |= mask;
+	if (!set) {
+		archbloom_count(bf->stats, false, ARCHBLOOM_STAT_SET, 1);
+		if (bf->dirty != NULL) {
+			mark_block(bf, position / (BLOOM_DELTA_BLOCK_SIZE * 8));
+		}
+	}
+
+	return set;
+}
+
+/**
+ * @brief Helper function to map a hash onto a bit position in a Bloom
+ * filter, according to the filter's BLOOM_FLAG_* options.
+ *
+ * @param bf Bloom filter.
+ * @param hash Hash of an element.
+ *
+ * @return Bit position in the range [0, bf->size).
+ */
+static inline uint64_t hash_position(const bloomfilter *bf, const uint64_t hash) {
+	if (bf->flags & BLOOM_FLAG_POW2) {
+		return hash & (bf->size - 1);
+	}
+
+	if (bf->flags & BLOOM_FLAG_FASTRANGE) {
+		return fastrange64(hash, bf->size);
+	}
+
+	return hash % bf->size;
+}
 
-	float exp_factor = exp(-(float)k * (float)n / (float)m);
-	float fp_rate = pow(1.0f - exp_factor, (float)k);
+/**
+ * @brief Helper function to test every bit position of a hashed
+ * element, without counting the lookup. Stops at the first bit that
+ * isn't set.
+ *
+ * @return true if every bit is set.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline bool test_bits(const bloomfilter *bf, const uint64_t *hash) {
+	for (size_t i = 0; i < bf->hashcount; i++) {
+		if (test_bit(bf, hash_position(bf, hash_probe(hash, i))) == false) {
+			return false;
+		}
+	}
 
-	return fp_rate;
+	return true;
 }
 
 /**
- * @brief Helper function to get byte and bit positions of elements in
- * a Bloom filter.
+ * @brief Helper function to set every bit position of a hashed
+ * element, without counting the addition.
+ *
+ * @return true if every bit was already set.
  *
- * @param result Position of element.
- * @param byte_position Pointer to store calculated byte position.
- * @param bit_position Pointer to store bit calculated bit position.
+ * @note This function is static and intended for internal use.
  */
-static inline void calculate_positions(uint64_t position, uint64_t *byte_position, uint8_t *bit_position) {
-	*byte_position = position / 8;
-	*bit_position = position % 8;
+static inline bool set_bits(bloomfilter *bf, const uint64_t *hash) {
+	bool present = true;
+
+	for (size_t i = 0; i < bf->hashcount; i++) {
+		present &= set_bit(bf, hash_position(bf, hash_probe(hash, i)));
+	}
+
+	return present;
 }
 
 /**
@@ -252,20 +707,20 @@ static inline void calculate_positions(uint64_t position, uint64_t *byte_positio
  */
 float bloom_estimate_intersection(const bloomfilter *bf1, const bloomfilter *bf2) {
 	if (bf1->size != bf2->size ||
-		bf1->hashcount != bf2->hashcount) {
+		bf1->hashcount != bf2->hashcount ||
+		bf1->hash != bf2->hash ||
+		((bf1->flags ^ bf2->flags) & LAYOUT_FLAGS)) {
 		return -1.0f; // error.
 	}
 
 	size_t intersection_count = 0;
 	size_t union_count        = 0;
 
-	for (size_t i = 0; i < bf1->bitmap_size; i++) {
-		uint8_t intersection_bits = bf1->bitmap[i] & bf2->bitmap[i];
-		uint8_t union_bits        = bf1->bitmap[i] | bf2->bitmap[i];
-
-		intersection_count += bit_count_table[intersection_bits];
-		union_count        += bit_count_table[union_bits];
-	}
+	bitops_popcount_and_or(bf1->bitmap,
+	                       bf2->bitmap,
+	                       bf1->bitmap_size,
+	                       &intersection_count,
+	                       &union_count);
 
 	if (union_count == 0) {
 		return 0.0f; // both filters empty
@@ -288,24 +743,11 @@ float bloom_estimate_intersection(const bloomfilter *bf1, const bloomfilter *bf2
  * @return false if the element is definitely not in the filter.
  */
 bool bloom_lookup(const bloomfilter *bf, const void *element, const size_t len) {
-	uint64_t hashes[bf->hashcount];
-	uint64_t result;
-	uint64_t byte_position;
-	uint8_t  bit_position;
+	uint64_t hash[2];
 
-	mmh3_64_make_hashes(element, len, bf->hashcount, hashes);
+	hash_128(bf->hash, element, len, hash);
 
-	for (size_t i = 0; i < bf->hashcount; i++) {
-		result = hashes[i] % bf->size;
-
-		calculate_positions(result, &byte_position, &bit_position);
-
-		if ((bf->bitmap[byte_position] & (0x01 << bit_position)) == 0) {
-			return false;
-		}
-	}
-
-	return true;
+	return bloom_lookup_hashed(bf, hash);
 }
 
 /**
@@ -334,21 +776,15 @@ bool bloom_lookup_string(const bloomfilter *bf, const char *element) {
  * @param len Length of element in bytes.
  */
 void bloom_add(bloomfilter *bf, const void *element, const size_t len) {
-	uint64_t  hashes[bf->hashcount];
-	uint64_t  result;
-	uint64_t  byte_position;
-	uint8_t   bit_position;
-	bool      all_bits_set = true;
+	uint64_t hash[2];
 
-	mmh3_64_make_hashes(element, len, bf->hashcount, hashes);
+	hash_128(bf->hash, element, len, hash);
 
 	for (size_t i = 0; i < bf->hashcount; i++) {
-		result = hashes[i] % bf->size;
-
-		calculate_positions(result, &byte_position, &bit_position);
-
-		bf->bitmap[byte_position] |= (0x01 << bit_position);
+		set_bit(bf, hash_position(bf, hash_probe(hash, i)));
 	}
+
+	archbloom_count(bf->stats, stats_concurrent(bf), ARCHBLOOM_STAT_ADDS, 1);
 }
 
 /**
@@ -365,51 +801,118 @@ void bloom_add_string(bloomfilter *bf, const char *element) {
 }
 
 /**
- * @brief Check if an element exists in a Bloom filter, adding it if
- * it does not exist.
+ * @brief Check an element that has already been hashed.
  *
- * @param bf Pointer to the Bloom filter to perform look up or add.
- * @param element Pointer to the element to look up or add.
- * @param len Length of the element in bytes
+ * For callers that check one element against several filters with the
+ * same hash strategy, such as the slices of a scalable Bloom filter:
+ * the element is hashed once and the positions in each filter come
+ * from that hash. Positions are generated one at a time, so a lookup
+ * stops at the first bit that isn't set without computing the rest.
  *
- * @return true if the element is already in the filter.
- * @return false if the element was added to the filter
+ * @param bf Bloom filter to perform look up against.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return true if the element is probably in the filter.
+ * @return false if the element is definitely not in the filter.
  */
-bool bloom_lookup_or_add(bloomfilter *bf, const void *element, const size_t len) {
-	uint64_t hashes[bf->hashcount];
-	size_t   result;
-	uint64_t byte_position;
-	uint8_t  bit_position;
-	bool     found_all = true;
-
-	mmh3_64_make_hashes(element, len, bf->hashcount, hashes);
+bool bloom_lookup_hashed(const bloomfilter *bf, const uint64_t *hash) {
+	bool found = test_bits(bf, hash);
 
-	for (size_t i = 0; i < bf->hashcount; i++) {
-		result = hashes[i] % bf->size;
-
-		calculate_positions(result, &byte_position, &bit_position);
+	archbloom_count(bf->stats, stats_concurrent(bf), ARCHBLOOM_STAT_LOOKUPS, 1);
+	archbloom_count(bf->stats, stats_concurrent(bf), ARCHBLOOM_STAT_HITS, found);
 
-		if ((bf->bitmap[byte_position] & (0x01 << bit_position)) == 0) {
-			found_all = false;
-			bf->bitmap[byte_position] |= (0x01 << bit_position);
-		}
-	}
+	return found;
+}
 
-	if (found_all == false) {
-		return false; // element has been added to filter
-	}
+/**
+ * @brief Add an element that has already been hashed. See
+ * `bloom_lookup_hashed()`.
+ *
+ * @param bf Bloom filter to add element to.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return true if every bit was already set: the element was probably
+ *         present.
+ * @return false if the element is new.
+ */
+bool bloom_add_hashed(bloomfilter *bf, const uint64_t *hash) {
+	archbloom_count(bf->stats, stats_concurrent(bf), ARCHBLOOM_STAT_ADDS, 1);
 
-	return true; // element was already in filter
+	return set_bits(bf, hash);
 }
 
 /**
- * @brief Helper function for bloom_lookup_or_add() to handle string elements.
+ * @brief Helper function for the lookup or add functions. Set every
+ * bit position of an element.
  *
- * This function is a convenience wrapper around
- * `bloom_lookup_or_add()` that makes it easier to work with string
- * elements.
+ * On BLOOM_FLAG_CONCURRENT filters, an element that is not already
+ * fully present is added while holding the lock its first position is
+ * striped to. Two threads adding the same element take the same lock,
+ * so exactly one of them sees it as new. The check before taking the
+ * lock keeps the common case of an element already being present lock
+ * free.
  *
- * @param bf Pointer to the Bloom filter to perform this operation against.
+ * @param bf Bloom filter.
+ * @param hash The element's `hash_128()`.
+ *
+ * @return true if every bit was already set.
+ * @return false if the element was added.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool lookup_or_add_hashed(bloomfilter *bf, const uint64_t *hash) {
+	bool found_all;
+
+	if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+		found_all = test_bits(bf, hash);
+		if (!found_all) {
+			pthread_mutex_t *lock = &lock_stripes[hash_position(bf, hash[0]) % LOCK_STRIPES].mutex;
+
+			pthread_mutex_lock(lock);
+			found_all = set_bits(bf, hash);
+			pthread_mutex_unlock(lock);
+		}
+	} else {
+		found_all = set_bits(bf, hash);
+	}
+
+	archbloom_count(bf->stats, stats_concurrent(bf), ARCHBLOOM_STAT_LOOKUPS, 1);
+	archbloom_count(bf->stats, stats_concurrent(bf), found_all ? ARCHBLOOM_STAT_HITS : ARCHBLOOM_STAT_ADDS, 1);
+
+	return found_all;
+}
+
+/**
+ * @brief Check if an element exists in a Bloom filter, adding it if
+ * it does not exist.
+ *
+ * On BLOOM_FLAG_CONCURRENT filters this is linearizable: when several
+ * threads add the same new element at once, exactly one of them gets
+ * false.
+ *
+ * @param bf Pointer to the Bloom filter to perform look up or add.
+ * @param element Pointer to the element to look up or add.
+ * @param len Length of the element in bytes
+ *
+ * @return true if the element is already in the filter.
+ * @return false if the element was added to the filter
+ */
+bool bloom_lookup_or_add(bloomfilter *bf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(bf->hash, element, len, hash);
+
+	return lookup_or_add_hashed(bf, hash);
+}
+
+/**
+ * @brief Helper function for bloom_lookup_or_add() to handle string elements.
+ *
+ * This function is a convenience wrapper around
+ * `bloom_lookup_or_add()` that makes it easier to work with string
+ * elements.
+ *
+ * @param bf Pointer to the Bloom filter to perform this operation against.
  * @param element Pointer to the string element to check or add.
  *
  * @return true if the string was already in the filter.
@@ -464,6 +967,147 @@ bool bloom_add_if_not_present_string(bloomfilter *bf, const char *element) {
 	return bloom_add_if_not_present(bf, element, strlen(element));
 }
 
+/**
+ * @brief Number of elements hashed and prefetched at a time by the
+ * batch functions.
+ *
+ * Large enough to keep many cache misses in flight, small enough that
+ * the prefetched lines are still resident when they are used.
+ */
+#define BATCH_CHUNK 16
+
+/**
+ * @brief Helper function for the batch functions. Hash a chunk of
+ * elements and prefetch the bytes that will be touched.
+ *
+ * Only the hashes are kept; positions are cheap to generate again when
+ * the bits are probed, and keeping them would need `hashcount` slots
+ * per element.
+ *
+ * @param bf Bloom filter.
+ * @param elements Array of pointers to elements.
+ * @param lens Array of element lengths in bytes.
+ * @param count Number of elements in this chunk.
+ * @param hashes Output array of `count` `hash_128()` pairs.
+ * @param write true if the positions will be written to.
+ */
+static void batch_hashes(const bloomfilter *bf,
+                         const void **elements,
+                         const size_t *lens,
+                         const size_t count,
+                         uint64_t hashes[][2],
+                         const bool write) {
+	for (size_t i = 0; i < count; i++) {
+		hash_128(bf->hash, elements[i], lens[i], hashes[i]);
+
+		for (size_t j = 0; j < bf->hashcount; j++) {
+			uint64_t position = hash_position(bf, hash_probe(hashes[i], j));
+
+			if (write) {
+				__builtin_prefetch(&bf->bitmap[position / 8], 1);
+			} else {
+				__builtin_prefetch(&bf->bitmap[position / 8], 0);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Helper function to set or clear bit `i` of a batch result bitmap.
+ */
+static inline void set_result(uint8_t *results, const size_t i, const bool value) {
+	if (value) {
+		results[i / 8] |= (0x01 << (i % 8));
+	} else {
+		results[i / 8] &= ~(0x01 << (i % 8));
+	}
+}
+
+/**
+ * @brief Add a batch of elements to a Bloom filter.
+ *
+ * This function hashes a chunk of elements up front and prefetches
+ * every byte it is about to modify before setting any bits. On
+ * filters larger than the CPU cache this overlaps the cache misses of
+ * many elements rather than waiting on each one in turn.
+ *
+ * @param bf Bloom filter to add elements to.
+ * @param elements Array of `count` pointers to elements.
+ * @param lens Array of `count` element lengths in bytes.
+ * @param count Number of elements to add.
+ */
+void bloom_add_batch(bloomfilter *bf, const void **elements, const size_t *lens, const size_t count) {
+	uint64_t hashes[BATCH_CHUNK][2];
+
+	for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+		size_t chunk = (count - start < BATCH_CHUNK) ? count - start : BATCH_CHUNK;
+
+		batch_hashes(bf, elements + start, lens + start, chunk, hashes, true);
+
+		for (size_t i = 0; i < chunk; i++) {
+			bloom_add_hashed(bf, hashes[i]);
+		}
+	}
+}
+
+/**
+ * @brief Look up a batch of elements in a Bloom filter.
+ *
+ * This function is the batch equivalent of `bloom_lookup()`. See
+ * `bloom_add_batch()` for details.
+ *
+ * @param bf Bloom filter to perform look ups against.
+ * @param elements Array of `count` pointers to elements.
+ * @param lens Array of `count` element lengths in bytes.
+ * @param count Number of elements to look up.
+ * @param results Bitmap of at least `(count + 7) / 8` bytes. Bit `i`
+ *        is set if element `i` is probably in the filter and cleared
+ *        if it is definitely not. Use BLOOM_BATCH_RESULT() to read it.
+ */
+void bloom_lookup_batch(const bloomfilter *bf, const void **elements, const size_t *lens, const size_t count, uint8_t *results) {
+	uint64_t hashes[BATCH_CHUNK][2];
+
+	for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+		size_t chunk = (count - start < BATCH_CHUNK) ? count - start : BATCH_CHUNK;
+
+		batch_hashes(bf, elements + start, lens + start, chunk, hashes, false);
+
+		for (size_t i = 0; i < chunk; i++) {
+			set_result(results, start + i, bloom_lookup_hashed(bf, hashes[i]));
+		}
+	}
+}
+
+/**
+ * @brief Look up a batch of elements in a Bloom filter, adding the
+ * ones that are not present.
+ *
+ * This function is the batch equivalent of `bloom_lookup_or_add()`.
+ * Elements are resolved in order, so a duplicate later in the same
+ * batch is reported as already present.
+ *
+ * @param bf Bloom filter to perform look ups and additions against.
+ * @param elements Array of `count` pointers to elements.
+ * @param lens Array of `count` element lengths in bytes.
+ * @param count Number of elements to process.
+ * @param results Bitmap of at least `(count + 7) / 8` bytes. Bit `i`
+ *        is set if element `i` was already in the filter and cleared
+ *        if it was added. Use BLOOM_BATCH_RESULT() to read it.
+ */
+void bloom_lookup_or_add_batch(bloomfilter *bf, const void **elements, const size_t *lens, const size_t count, uint8_t *results) {
+	uint64_t hashes[BATCH_CHUNK][2];
+
+	for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+		size_t chunk = (count - start < BATCH_CHUNK) ? count - start : BATCH_CHUNK;
+
+		batch_hashes(bf, elements + start, lens + start, chunk, hashes, true);
+
+		for (size_t i = 0; i < chunk; i++) {
+			set_result(results, start + i, lookup_or_add_hashed(bf, hashes[i]));
+		}
+	}
+}
+
 /**
  * @brief Set the name of the Bloom filter.
  *
@@ -490,6 +1134,31 @@ bool bloom_set_name(bloomfilter *bf, const char *name) {
 	return true;
 }
 
+/**
+ * @brief Select the hash strategy used by a Bloom filter.
+ *
+ * Filters default to HASH_MMH3. HASH_WYHASH and HASH_FIXED are
+ * considerably cheaper on short keys. The strategy is saved with the
+ * filter, and filters must use the same strategy to be merged or
+ * intersected.
+ *
+ * @param bf Pointer to an empty Bloom filter.
+ * @param strategy Hash strategy to use.
+ *
+ * @return true on success.
+ * @return false if the strategy is unknown, or elements have already
+ *         been added to the filter.
+ */
+bool bloom_set_hash(bloomfilter *bf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) || bloom_saturation_count(bf) != 0) {
+		return false;
+	}
+
+	bf->hash = strategy;
+
+	return true;
+}
+
 /**
  * @brief Retrieve the name of the Bloom filter.
  *
@@ -506,6 +1175,30 @@ const char *bloom_get_name(bloomfilter *bf) {
 	return bf->name;
 }
 
+/**
+ * @brief Helper function for the save functions. Fill in the file
+ * header describing a filter, with a raw bitmap.
+ *
+ * @param bf Bloom filter to describe.
+ * @param bff Pointer to the header to fill in.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void to_header(const bloomfilter *bf, bloomfilter_file *bff) {
+	memset(bff, 0, sizeof(bloomfilter_file));
+	memcpy(bff->magic, "!bloomf!", sizeof(bff->magic));
+
+	bff->size        = bf->size;
+	bff->hashcount   = bf->hashcount;
+	bff->bitmap_size = bf->bitmap_size;
+	bff->expected    = bf->expected;
+	bff->accuracy    = bf->accuracy;
+	bff->flags       = bf->flags & ~RUNTIME_FLAGS;
+	bff->hash        = bf->hash;
+	bff->encoding    = BLOOM_ENCODING_RAW;
+	snprintf((char *)bff->name, BLOOM_MAX_NAME_LENGTH + 1, "%.*s", BLOOM_MAX_NAME_LENGTH, bf->name);
+}
+
 /**
  * @brief Saves a Bloom filter to disk.
  *
@@ -524,24 +1217,9 @@ const char *bloom_get_name(bloomfilter *bf) {
  */
 bloom_error_t bloom_save(const bloomfilter *bf, const char *path) {
 	FILE             *fp;
-	bloomfilter_file  bff = {0};
+	bloomfilter_file  bff;
 
-	bff.magic[0] = '!';
-	bff.magic[1] = 'b';
-	bff.magic[2] = 'l';
-	bff.magic[3] = 'o';
-	bff.magic[4] = 'o';
-	bff.magic[5] = 'm';
-	bff.magic[6] = 'f';
-	bff.magic[7] = '!';
-
-	bff.size        = bf->size;
-	bff.hashcount   = bf->hashcount;
-	bff.bitmap_size = bf->bitmap_size;
-	bff.expected    = bf->expected;
-	bff.accuracy    = bf->accuracy;
-	strncpy((char *)bff.name, bf->name, BLOOM_MAX_NAME_LENGTH);
-	bff.name[BLOOM_MAX_NAME_LENGTH] = '\0';
+	to_header(bf, &bff);
 
 	fp = fopen(path, "wb");
 	if (fp == NULL) {
@@ -558,6 +1236,124 @@ bloom_error_t bloom_save(const bloomfilter *bf, const char *path) {
 	return BF_SUCCESS;
 }
 
+/**
+ * @brief Helper function for the load functions. Check that a file
+ * header describes a filter this library can use, and locate the
+ * bitmap within the file.
+ *
+ * @param bff Pointer to the header read from disk.
+ * @param file_size Size of the whole file in bytes.
+ *
+ * @return Offset of the bitmap within the file.
+ * @return 0 if the header is not usable.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static size_t bitmap_offset(const bloomfilter_file *bff, const uint64_t file_size) {
+	if (memcmp(bff->magic, "!bloomf!", sizeof(bff->magic)) != 0) {
+		return 0;
+	}
+
+	if (bff->size == 0 ||
+		(bff->size / 8 != bff->bitmap_size && (bff->size + 7) / 8 != bff->bitmap_size)) {
+		return 0;
+	}
+
+	if (bff->flags & ~BLOOM_FLAGS_ALL) {
+		return 0; // written by a newer version
+	}
+
+	if ((bff->flags & BLOOM_FLAG_POW2) && (bff->size & (bff->size - 1)) != 0) {
+		return 0;
+	}
+
+	if (file_size == BLOOM_FILE_LEGACY_HEADER_SIZE + bff->bitmap_size) {
+		return BLOOM_FILE_LEGACY_HEADER_SIZE;
+	}
+
+	// the size of an encoded bitmap is in the part of the header that
+	// hasn't been read yet. valid_encoding() checks it.
+	if (file_size >= sizeof(bloomfilter_file)) {
+		return sizeof(bloomfilter_file);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Helper function for the load functions. Once the whole header
+ * has been read, check the hash strategy and that the file holds
+ * exactly one bitmap in the encoding the header describes.
+ *
+ * @param bff Pointer to the header read from disk.
+ * @param offset Offset of the bitmap, from `bitmap_offset()`.
+ * @param file_size Size of the whole file in bytes.
+ *
+ * @return true if the header is usable, false if it is not.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool valid_encoding(const bloomfilter_file *bff, const size_t offset, const uint64_t file_size) {
+	if (!hash_strategy_valid(bff->hash)) {
+		return false; // written by a newer version
+	}
+
+	if (offset == BLOOM_FILE_LEGACY_HEADER_SIZE) {
+		return true; // no encoding fields; bitmap_offset() checked the size
+	}
+
+	switch (bff->encoding) {
+	case BLOOM_ENCODING_RAW:
+		return bff->encoded_size == 0 && file_size == offset + bff->bitmap_size;
+	case BLOOM_ENCODING_RICE:
+		return bff->encoded_size >= RICE_HEADER_SIZE && file_size == offset + bff->encoded_size;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Helper function for the load functions. Populate a Bloom
+ * filter's parameters from a file header. The bitmap is not touched.
+ *
+ * @param bf Pointer to the Bloom filter to populate.
+ * @param bff Pointer to the header read from disk.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void from_header(bloomfilter *bf, const bloomfilter_file *bff) {
+	bf->size        = bff->size;
+	bf->hashcount   = bff->hashcount;
+	bf->bitmap_size = bff->bitmap_size;
+	bf->expected    = bff->expected;
+	bf->accuracy    = bff->accuracy;
+	bf->flags       = bff->flags;
+	bf->hash        = bff->hash;
+	bf->map         = NULL;
+	bf->map_size    = 0;
+	bf->dirty       = NULL;
+	bf->stats       = NULL;
+	strncpy(bf->name, (char *)bff->name, BLOOM_MAX_NAME_LENGTH);
+	bf->name[BLOOM_MAX_NAME_LENGTH] = '\0';
+}
+
+/**
+ * @brief Helper function for the load functions. Decode a compressed
+ * bitmap into a filter's bitmap.
+ *
+ * @param bf Pointer to the Bloom filter, with its bitmap allocated.
+ * @param encoded The bitmap as stored in the file.
+ * @param size Size of `encoded` in bytes.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_INVALIDFILE if the bitmap is corrupt.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bloom_error_t decode_bitmap(bloomfilter *bf, const uint8_t *encoded, const size_t size) {
+	return rice_decode(encoded, size, bf->bitmap, bf->size) ? BF_SUCCESS : BF_INVALIDFILE;
+}
+
 /**
  * @brief Load a Bloom filter from a file on disk.
  *
@@ -577,7 +1373,8 @@ bloom_error_t bloom_save(const bloomfilter *bf, const char *path) {
 bloom_error_t bloom_load(bloomfilter *bf, const char *path) {
 	FILE             *fp;
 	struct stat       sb;
-	bloomfilter_file  bff;
+	bloomfilter_file  bff = {0};
+	size_t            offset;
 
 	fp = fopen(path, "rb");
 	if (fp == NULL) {
@@ -589,40 +1386,78 @@ bloom_error_t bloom_load(bloomfilter *bf, const char *path) {
 		return BF_FSTAT;
 	}
 
-	if (fread(&bff, sizeof(bloomfilter_file), 1, fp) != 1) {
+	// read the part of the header common to every version first
+	if (fread(&bff, BLOOM_FILE_LEGACY_HEADER_SIZE, 1, fp) != 1) {
 		fclose(fp);
 		return BF_FREAD;
 	}
 
-	bf->size        = bff.size;
-	bf->hashcount   = bff.hashcount;
-	bf->bitmap_size = bff.bitmap_size;
-	bf->expected    = bff.expected;
-	bf->accuracy    = bff.accuracy;
-	strncpy(bf->name, (char *)bff.name, BLOOM_MAX_NAME_LENGTH);
-	bf->name[BLOOM_MAX_NAME_LENGTH] = '\0';
-
 	// basic sanity check. should fail if filter isn't valid
-	if ((bf->size / 8) != bf->bitmap_size ||
-		sizeof(bloomfilter_file) + bf->bitmap_size != sb.st_size) {
+	offset = bitmap_offset(&bff, sb.st_size);
+	if (offset == 0) {
 		fclose(fp);
 		return BF_INVALIDFILE;
 	}
 
-	bf->bitmap = malloc(bf->bitmap_size);
+	if (offset > BLOOM_FILE_LEGACY_HEADER_SIZE &&
+		fread((uint8_t *)&bff + BLOOM_FILE_LEGACY_HEADER_SIZE, offset - BLOOM_FILE_LEGACY_HEADER_SIZE, 1, fp) != 1) {
+		fclose(fp);
+		return BF_FREAD;
+	}
+
+	if (!valid_encoding(&bff, offset, sb.st_size)) {
+		fclose(fp);
+		return BF_INVALIDFILE;
+	}
+
+	from_header(bf, &bff);
+
+	// older versions truncated the bitmap when size wasn't a multiple
+	// of 8. pad it with a zeroed byte so every position is addressable.
+	bf->bitmap_size = (bf->size + 7) / 8;
+	bf->bitmap = bitmap_alloc(bf->size);
 	if (bf->bitmap == NULL) {
 		fclose(fp);
 		return BF_OUTOFMEMORY;
 	}
 
-	if (fread(bf->bitmap, bf->bitmap_size, 1, fp) != 1) {
+	// everything loaded is the first checkpoint
+	if (dirty_alloc(bf) != BF_SUCCESS) {
 		fclose(fp);
-		free(bf->bitmap);
+		archbloom_free(bf->bitmap);
 		bf->bitmap = NULL;
+		return BF_OUTOFMEMORY;
+	}
+
+	stats_alloc(bf);
+
+	if (bff.encoding != BLOOM_ENCODING_RAW) {
+		bloom_error_t error = BF_OUTOFMEMORY;
+		uint8_t      *encoded = malloc(bff.encoded_size);
+
+		if (encoded != NULL) {
+			error = (fread(encoded, bff.encoded_size, 1, fp) != 1) ? BF_FREAD : decode_bitmap(bf, encoded, bff.encoded_size);
+			free(encoded);
+		}
+
+		fclose(fp);
+		if (error != BF_SUCCESS) {
+			bloom_destroy(bf);
+			return error;
+		}
+
+		bloom_recount(bf);
+		return BF_SUCCESS;
+	}
+
+	if (fread(bf->bitmap, bff.bitmap_size, 1, fp) != 1) {
+		fclose(fp);
+		bloom_destroy(bf);
 		return BF_FREAD;
 	}
 
 	fclose(fp);
+	bloom_recount(bf);
 
 	return BF_SUCCESS;
 }
@@ -646,25 +1481,9 @@ bloom_error_t bloom_load(bloomfilter *bf, const char *path) {
  *       is the developer's responsibility to manage these.
  */
 bloom_error_t bloom_save_fd(const bloomfilter *bf, int fd) {
-    bloomfilter_file bff = {0};
-
-    bff.magic[0] = '!';
-    bff.magic[1] = 'b';
-    bff.magic[2] = 'l';
-    bff.magic[3] = 'o';
-    bff.magic[4] = 'o';
-    bff.magic[5] = 'm';
-    bff.magic[6] = 'f';
-    bff.magic[7] = '!';
-
-    bff.size = bf->size;
-    bff.hashcount = bf->hashcount;
-    bff.bitmap_size = bf->bitmap_size;
-    bff.expected = bf->expected;
-    bff.accuracy = bf->accuracy;
-	strncpy((char *)bff.name, bf->name, BLOOM_MAX_NAME_LENGTH);
-	bff.name[BLOOM_MAX_NAME_LENGTH] = '\0';
+    bloomfilter_file bff;
 
+    to_header(bf, &bff);
 
     if (write(fd, &bff, sizeof(bloomfilter_file)) != sizeof(bloomfilter_file)) {
         return BF_FWRITE;
@@ -694,44 +1513,668 @@ bloom_error_t bloom_save_fd(const bloomfilter *bf, int fd) {
  */
 bloom_error_t bloom_load_fd(bloomfilter *bf, int fd) {
 	struct stat      sb;
-	bloomfilter_file bff;
+	bloomfilter_file bff = {0};
+	size_t           offset;
+	size_t           remaining;
 
 	if (fstat(fd, &sb) == -1) {
 		return BF_FSTAT;
 	}
 
-	if (read(fd, &bff, sizeof(bloomfilter_file)) != sizeof(bloomfilter_file)) {
+	if (read(fd, &bff, BLOOM_FILE_LEGACY_HEADER_SIZE) != BLOOM_FILE_LEGACY_HEADER_SIZE) {
         return BF_FREAD;
     }
 
-    bf->size = bff.size;
-    bf->hashcount = bff.hashcount;
-    bf->bitmap_size = bff.bitmap_size;
-    bf->expected = bff.expected;
-    bf->accuracy = bff.accuracy;
-	strncpy(bf->name, (char *)bff.name, BLOOM_MAX_NAME_LENGTH);
-	bf->name[BLOOM_MAX_NAME_LENGTH] = '\0';
-
     // Basic sanity check: verify if file structure is valid
-    if ((bf->size / 8) != bf->bitmap_size ||
-        sizeof(bloomfilter_file) + bf->bitmap_size != (size_t)sb.st_size) {
+    offset = bitmap_offset(&bff, sb.st_size);
+    if (offset == 0) {
         return BF_INVALIDFILE;
     }
 
-    bf->bitmap = malloc(bf->bitmap_size);
+    remaining = offset - BLOOM_FILE_LEGACY_HEADER_SIZE;
+    if (remaining > 0 && read(fd, (uint8_t *)&bff + BLOOM_FILE_LEGACY_HEADER_SIZE, remaining) != (ssize_t)remaining) {
+        return BF_FREAD;
+    }
+
+    if (!valid_encoding(&bff, offset, sb.st_size)) {
+        return BF_INVALIDFILE;
+    }
+
+    from_header(bf, &bff);
+
+    // see bloom_load()
+    bf->bitmap_size = (bf->size + 7) / 8;
+    bf->bitmap = bitmap_alloc(bf->size);
     if (bf->bitmap == NULL) {
         return BF_OUTOFMEMORY;
     }
 
-    if (read(fd, bf->bitmap, bf->bitmap_size) != (ssize_t)bf->bitmap_size) {
-        free(bf->bitmap);
+    if (dirty_alloc(bf) != BF_SUCCESS) {
+        archbloom_free(bf->bitmap);
         bf->bitmap = NULL;
+        return BF_OUTOFMEMORY;
+    }
+
+    stats_alloc(bf);
+
+    if (bff.encoding != BLOOM_ENCODING_RAW) {
+        bloom_error_t error = BF_OUTOFMEMORY;
+        uint8_t      *encoded = malloc(bff.encoded_size);
+
+        if (encoded != NULL) {
+            error = (read(fd, encoded, bff.encoded_size) != (ssize_t)bff.encoded_size) ? BF_FREAD : decode_bitmap(bf, encoded, bff.encoded_size);
+            free(encoded);
+        }
+
+        if (error != BF_SUCCESS) {
+            bloom_destroy(bf);
+            return error;
+        }
+
+        bloom_recount(bf);
+        return BF_SUCCESS;
+    }
+
+    if (read(fd, bf->bitmap, bff.bitmap_size) != (ssize_t)bff.bitmap_size) {
+        bloom_destroy(bf);
         return BF_FREAD;
     }
 
+    bloom_recount(bf);
+
     return BF_SUCCESS;
 }
 
+/**
+ * @brief Map a Bloom filter file descriptor into memory.
+ *
+ * This function validates the header of a saved Bloom filter and maps
+ * the file MAP_SHARED rather than copying the bitmap into private
+ * memory. Startup cost no longer depends on the size of the filter,
+ * and every process mapping the same file shares one copy in the page
+ * cache.
+ *
+ * If `writable` is false the mapping is read only, and the filter must
+ * only be used for lookups. If it is true, additions are written back
+ * to the file and are visible to every other process mapping it. The
+ * descriptor must have been opened for writing in that case.
+ *
+ * Release the mapping with `bloom_destroy()`. The descriptor may be
+ * closed as soon as this function returns.
+ *
+ * @param bf Pointer to the Bloom filter object to initialize.
+ * @param fd File descriptor of a saved Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FREAD if unable to read from the file descriptor.
+ * @return BF_FSTAT if fstat() fails.
+ * @return BF_INVALIDFILE if the file is invalid, is compressed, or is
+ *         a legacy file whose bitmap is too short to map. Load and
+ *         re-save those with `bloom_save()`.
+ * @return BF_MMAP if mmap() fails.
+ */
+bloom_error_t bloom_map_fd(bloomfilter *bf, int fd, const bool writable) {
+	struct stat       sb;
+	bloomfilter_file  bff = {0};
+	size_t            offset;
+	void             *map;
+
+	if (fstat(fd, &sb) == -1) {
+		return BF_FSTAT;
+	}
+
+	if (pread(fd, &bff, BLOOM_FILE_LEGACY_HEADER_SIZE, 0) != BLOOM_FILE_LEGACY_HEADER_SIZE) {
+		return BF_FREAD;
+	}
+
+	offset = bitmap_offset(&bff, sb.st_size);
+	if (offset == 0 || bff.bitmap_size != (bff.size + 7) / 8) {
+		return BF_INVALIDFILE;
+	}
+
+	// now read the whole header
+	if (pread(fd, &bff, offset, 0) != (ssize_t)offset) {
+		return BF_FREAD;
+	}
+
+	if (!valid_encoding(&bff, offset, sb.st_size) || bff.encoding != BLOOM_ENCODING_RAW) {
+		return BF_INVALIDFILE;
+	}
+
+	map = map_file(fd, sb.st_size, writable);
+	if (map == NULL) {
+		return BF_MMAP;
+	}
+
+	from_header(bf, &bff);
+	bf->map      = map;
+	bf->map_size = sb.st_size;
+	bf->bitmap   = (uint8_t *)map + offset;
+
+	if (dirty_alloc(bf) != BF_SUCCESS) {
+		bloom_destroy(bf);
+		return BF_OUTOFMEMORY;
+	}
+
+	// bits set are counted from the mapping; see bloom_saturation_count()
+	stats_alloc(bf);
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Map a Bloom filter file into memory.
+ *
+ * This function is a convenience wrapper around `bloom_map_fd()` that
+ * opens and closes the file.
+ *
+ * @param bf Pointer to the Bloom filter object to initialize.
+ * @param path Path to a saved Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FOPEN if unable to open the file.
+ * @return Any error returned by `bloom_map_fd()`.
+ */
+bloom_error_t bloom_map(bloomfilter *bf, const char *path, const bool writable) {
+	bloom_error_t error;
+	int           fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
+		return BF_FOPEN;
+	}
+
+	error = bloom_map_fd(bf, fd, writable);
+	close(fd);
+
+	return error;
+}
+
+/**
+ * @brief Calculate the size of a Bloom filter saved with
+ * `bloom_save_compressed()`.
+ *
+ * @param bf Bloom filter to measure.
+ *
+ * @return Size of the file in bytes, including the header.
+ */
+size_t bloom_compressed_size(const bloomfilter *bf) {
+	size_t encoded = rice_encoded_size(bf->bitmap, bf->size);
+
+	// see bloom_save_compressed_fd()
+	if (encoded + (sizeof(bloomfilter_file) - BLOOM_FILE_LEGACY_HEADER_SIZE) >= bf->bitmap_size) {
+		return sizeof(bloomfilter_file) + bf->bitmap_size;
+	}
+
+	return sizeof(bloomfilter_file) + encoded;
+}
+
+/**
+ * @brief Save a compressed Bloom filter to a file descriptor.
+ *
+ * The bitmap is stored as Golomb-Rice coded gaps between its set
+ * bits (BLOOM_ENCODING_RICE), which is much smaller than the bitmap
+ * for lightly loaded filters, and filters created with
+ * `bloom_init_compressible()`. When the encoding would not be smaller,
+ * the raw bitmap is written instead, so the result is never larger
+ * than `bloom_save_fd()` would write.
+ *
+ * `bloom_load()` and `bloom_load_fd()` read either. Compressed files
+ * can't be opened with `bloom_map()`.
+ *
+ * @param bf Bloom filter to save.
+ * @param fd File descriptor to write the Bloom filter to.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ * @return BF_FWRITE if unable to write to the file descriptor.
+ *
+ * @note This does not open or close the file descriptor. As such, it
+ *       is the developer's responsibility to manage these.
+ */
+bloom_error_t bloom_save_compressed_fd(const bloomfilter *bf, int fd) {
+	bloomfilter_file  bff;
+	uint8_t          *encoded;
+	size_t            size;
+	size_t            slack = sizeof(bloomfilter_file) - BLOOM_FILE_LEGACY_HEADER_SIZE;
+
+	/* A compressed file must not be the size of a legacy file, which
+	 * has a 16 byte shorter header and a raw bitmap. Anything that
+	 * close to the raw size isn't worth decoding anyway, so encoding
+	 * gives up at that point.
+	 */
+	if (bf->bitmap_size <= slack + 1) {
+		return bloom_save_fd(bf, fd);
+	}
+
+	encoded = malloc(bf->bitmap_size);
+	if (encoded == NULL) {
+		return BF_OUTOFMEMORY;
+	}
+
+	size = rice_encode(bf->bitmap, bf->size, encoded, bf->bitmap_size - slack - 1);
+	if (size == 0) {
+		free(encoded);
+		return bloom_save_fd(bf, fd);
+	}
+
+	to_header(bf, &bff);
+	bff.encoding     = BLOOM_ENCODING_RICE;
+	bff.encoded_size = size;
+
+	if (write(fd, &bff, sizeof(bloomfilter_file)) != sizeof(bloomfilter_file) ||
+		write(fd, encoded, size) != (ssize_t)size) {
+		free(encoded);
+		return BF_FWRITE;
+	}
+
+	free(encoded);
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Save a compressed Bloom filter to disk.
+ *
+ * This function is a convenience wrapper around
+ * `bloom_save_compressed_fd()` that creates or truncates the file.
+ *
+ * @param bf Bloom filter to save.
+ * @param path File path where the Bloom filter will be saved.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FOPEN if unable to open the file.
+ * @return Any error returned by `bloom_save_compressed_fd()`.
+ */
+bloom_error_t bloom_save_compressed(const bloomfilter *bf, const char *path) {
+	bloom_error_t error;
+	int           fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		return BF_FOPEN;
+	}
+
+	error = bloom_save_compressed_fd(bf, fd);
+	if (close(fd) == -1 && error == BF_SUCCESS) {
+		error = BF_FWRITE;
+	}
+
+	return error;
+}
+
+/**
+ * @brief Helper function to write all of a buffer to a file
+ * descriptor, which may be a pipe or socket that accepts less than
+ * asked for.
+ *
+ * @return true on success, false on error.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool write_all(int fd, const void *buf, size_t size) {
+	const uint8_t *p = buf;
+
+	while (size > 0) {
+		ssize_t n = write(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p    += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Helper function to read all of a buffer from a file
+ * descriptor. See `write_all()`.
+ *
+ * @return true on success, false on error or end of file.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool read_all(int fd, void *buf, size_t size) {
+	uint8_t *p = buf;
+
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n <= 0) {
+			return false;
+		}
+		p    += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Helper function to copy block `block` of a Bloom filter's
+ * bitmap, padding the last block with zeros.
+ *
+ * BLOOM_FLAG_CONCURRENT filters are read with atomic loads, as they
+ * may be added to meanwhile.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void copy_block(const bloomfilter *bf, const size_t block, uint8_t *out) {
+	size_t offset = block * BLOOM_DELTA_BLOCK_SIZE;
+	size_t bytes  = bf->bitmap_size - offset;
+
+	if (bytes > BLOOM_DELTA_BLOCK_SIZE) {
+		bytes = BLOOM_DELTA_BLOCK_SIZE;
+	}
+
+	memset(out, 0, BLOOM_DELTA_BLOCK_SIZE);
+
+	if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+		const uint64_t *words = (const uint64_t *)(bf->bitmap + offset);
+
+		// the bitmap is allocated in whole words; see bitmap_alloc()
+		for (size_t i = 0; i < (bytes + 7) / 8; i++) {
+			uint64_t word = __atomic_load_n(&words[i], __ATOMIC_RELAXED);
+			memcpy(out + (i * 8), &word, sizeof(word));
+		}
+		return;
+	}
+
+	memcpy(out, bf->bitmap + offset, bytes);
+}
+
+/**
+ * @brief Helper function to OR a block into block `block` of a Bloom
+ * filter's bitmap.
+ *
+ * @return true if the block gained any bits.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool or_block(bloomfilter *bf, const size_t block, const uint8_t *in) {
+	size_t   offset  = block * BLOOM_DELTA_BLOCK_SIZE;
+	size_t   bytes   = bf->bitmap_size - offset;
+	uint64_t changed = 0;
+
+	if (bytes > BLOOM_DELTA_BLOCK_SIZE) {
+		bytes = BLOOM_DELTA_BLOCK_SIZE;
+	}
+
+	if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+		uint64_t *words = (uint64_t *)(bf->bitmap + offset);
+
+		for (size_t i = 0; i < (bytes + 7) / 8; i++) {
+			uint64_t word;
+
+			memcpy(&word, in + (i * 8), sizeof(word));
+			if (word != 0) {
+				changed |= word & ~__atomic_fetch_or(&words[i], word, __ATOMIC_RELAXED);
+			}
+		}
+
+		return changed != 0;
+	}
+
+	for (size_t i = 0; i < bytes; i++) {
+		changed |= in[i] & ~bf->bitmap[offset + i];
+		bf->bitmap[offset + i] |= in[i];
+	}
+
+	return changed != 0;
+}
+
+/**
+ * @brief Write the blocks of a Bloom filter that changed since the
+ * last checkpoint, and make a new checkpoint.
+ *
+ * Only the BLOOM_DELTA_BLOCK_SIZE byte blocks that gained bits are
+ * written, along with a compressed map of which blocks they are, so
+ * the size of a delta depends on how much of the filter changed
+ * rather than the size of the filter. Apply it to a copy of the
+ * filter, or to a filter merging several, with
+ * `bloom_apply_delta_fd()`. The first delta covers changes since the
+ * filter was created or loaded; send a loaded filter in full with
+ * `bloom_save_fd()` first.
+ *
+ * BLOOM_FLAG_CONCURRENT filters may be added to while this runs.
+ * Bits that miss this delta are in the next one. If writing fails,
+ * the blocks stay marked and are written by the next call.
+ *
+ * @param bf Bloom filter created with BLOOM_FLAG_TRACK_DIRTY.
+ * @param fd File descriptor to write the delta to. Pipes and sockets
+ *        are fine.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_NOTTRACKED if the filter does not track dirty blocks.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ * @return BF_FWRITE if unable to write to the file descriptor.
+ *
+ * @note This does not open or close the file descriptor. As such, it
+ *       is the developer's responsibility to manage these.
+ */
+bloom_error_t bloom_save_delta_fd(bloomfilter *bf, int fd) {
+	bloomfilter_delta  header = {0};
+	size_t             words = dirty_words(bf);
+	size_t             count, map_size, n = 0;
+	uint64_t          *taken;
+	uint8_t           *delta, *data;
+	bloom_error_t      error = BF_SUCCESS;
+
+	if (bf->dirty == NULL) {
+		return BF_NOTTRACKED;
+	}
+
+	taken = calloc(words, sizeof(uint64_t));
+	if (taken == NULL) {
+		return BF_OUTOFMEMORY;
+	}
+
+	// take the marks first. bits added after a mark is taken mark
+	// their block again and go in the next delta.
+	for (size_t i = 0; i < words; i++) {
+		if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+			taken[i] = (__atomic_load_n(&bf->dirty[i], __ATOMIC_RELAXED) != 0) ?
+				__atomic_exchange_n(&bf->dirty[i], 0, __ATOMIC_ACQUIRE) : 0;
+		} else {
+			taken[i]     = bf->dirty[i];
+			bf->dirty[i] = 0;
+		}
+	}
+
+	count    = bitops_popcount((const uint8_t *)taken, words * sizeof(uint64_t));
+	map_size = rice_encoded_size((const uint8_t *)taken, block_count(bf));
+	delta    = malloc(sizeof(bloomfilter_delta) + map_size + (count * BLOOM_DELTA_BLOCK_SIZE));
+	if (delta == NULL) {
+		error = BF_OUTOFMEMORY;
+		goto restore;
+	}
+
+	memcpy(header.magic, "!bloomd!", sizeof(header.magic));
+	header.size       = bf->size;
+	header.hashcount  = bf->hashcount;
+	header.count      = count;
+	header.map_size   = map_size;
+	header.block_size = BLOOM_DELTA_BLOCK_SIZE;
+	header.flags      = bf->flags & LAYOUT_FLAGS;
+	header.hash       = bf->hash;
+	memcpy(delta, &header, sizeof(header));
+
+	rice_encode((const uint8_t *)taken, block_count(bf), delta + sizeof(header), map_size);
+
+	data = delta + sizeof(header) + map_size;
+	for (size_t block = 0; block < block_count(bf); block++) {
+		if (taken[block / 64] == 0) {
+			block |= 63;
+		} else if (taken[block / 64] & word_mask(block)) {
+			copy_block(bf, block, data + (n++ * BLOOM_DELTA_BLOCK_SIZE));
+		}
+	}
+
+	if (!write_all(fd, delta, sizeof(header) + map_size + (count * BLOOM_DELTA_BLOCK_SIZE))) {
+		error = BF_FWRITE;
+	}
+
+	free(delta);
+
+restore:
+	if (error != BF_SUCCESS) {
+		for (size_t i = 0; i < words; i++) {
+			if (taken[i] != 0) {
+				if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+					__atomic_fetch_or(&bf->dirty[i], taken[i], __ATOMIC_RELAXED);
+				} else {
+					bf->dirty[i] |= taken[i];
+				}
+			}
+		}
+	}
+
+	free(taken);
+
+	return error;
+}
+
+/**
+ * @brief Merge a delta written by `bloom_save_delta_fd()` into a Bloom
+ * filter.
+ *
+ * Blocks in the delta are ORed into the filter, so deltas from several
+ * filters can be applied to one that merges them, in any order, and
+ * applying a delta twice does no harm. The filter must have the same
+ * size, hashcount, hash strategy and layout flags as the one the delta
+ * came from. If it tracks dirty blocks itself, the blocks that gained
+ * bits are marked, so deltas can be passed along.
+ *
+ * The whole delta is read and checked before anything is applied.
+ *
+ * @param bf Bloom filter to apply the delta to.
+ * @param fd File descriptor to read the delta from. Pipes and sockets
+ *        are fine.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FREAD if unable to read from the file descriptor.
+ * @return BF_INVALIDFILE if the delta is corrupt or belongs to an
+ *         incompatible filter.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ *
+ * @note This does not open or close the file descriptor. As such, it
+ *       is the developer's responsibility to manage these.
+ */
+bloom_error_t bloom_apply_delta_fd(bloomfilter *bf, int fd) {
+	bloomfilter_delta     header;
+	size_t                words = dirty_words(bf);
+	size_t                payload_size, n = 0;
+	uint64_t             *map;
+	uint8_t              *payload, *data;
+	bloom_error_t         error = BF_SUCCESS;
+	static const uint8_t  zeros[sizeof(header.reserved)] = {0};
+
+	if (!read_all(fd, &header, sizeof(header))) {
+		return BF_FREAD;
+	}
+
+	// a map costs at most 50 bits per block in it plus one bit per block
+	if (memcmp(header.magic, "!bloomd!", sizeof(header.magic)) != 0 ||
+		header.size != bf->size ||
+		header.hashcount != bf->hashcount ||
+		header.block_size != BLOOM_DELTA_BLOCK_SIZE ||
+		header.flags != (bf->flags & LAYOUT_FLAGS) ||
+		header.hash != bf->hash ||
+		header.count > block_count(bf) ||
+		header.map_size < RICE_HEADER_SIZE ||
+		header.map_size > RICE_HEADER_SIZE + (((header.count * 50) + block_count(bf)) / 8) + 1 ||
+		memcmp(header.reserved, zeros, sizeof(zeros)) != 0) {
+		return BF_INVALIDFILE;
+	}
+
+	payload_size = header.map_size + (header.count * BLOOM_DELTA_BLOCK_SIZE);
+	payload      = malloc(payload_size);
+	// rice_decode() only writes the bytes of the map that are in use
+	map          = calloc(words, sizeof(uint64_t));
+	if (payload == NULL || map == NULL) {
+		free(payload);
+		free(map);
+		return BF_OUTOFMEMORY;
+	}
+
+	if (!read_all(fd, payload, payload_size)) {
+		error = BF_FREAD;
+	} else if (!rice_decode(payload, header.map_size, (uint8_t *)map, block_count(bf)) ||
+			   bitops_popcount((const uint8_t *)map, words * sizeof(uint64_t)) != header.count) {
+		error = BF_INVALIDFILE;
+	}
+
+	if (error == BF_SUCCESS) {
+		data = payload + header.map_size;
+		for (size_t block = 0; block < block_count(bf); block++) {
+			if (map[block / 64] == 0) {
+				block |= 63;
+			} else if ((map[block / 64] & word_mask(block)) &&
+					   or_block(bf, block, data + (n++ * BLOOM_DELTA_BLOCK_SIZE)) &&
+					   bf->dirty != NULL) {
+				mark_block(bf, block);
+			}
+		}
+	}
+
+	free(payload);
+	free(map);
+
+	if (error == BF_SUCCESS) {
+		bloom_recount(bf);
+	}
+
+	return error;
+}
+
+/**
+ * @brief Mark every block of a BLOOM_FLAG_TRACK_DIRTY filter as
+ * clean, for example after sending the whole filter with
+ * `bloom_save_fd()`. Does nothing to other filters.
+ *
+ * @param bf Bloom filter to checkpoint.
+ */
+void bloom_checkpoint(bloomfilter *bf) {
+	if (bf->dirty != NULL) {
+		memset(bf->dirty, 0, dirty_words(bf) * sizeof(uint64_t));
+	}
+}
+
+/**
+ * @brief Count the blocks of a Bloom filter changed since the last
+ * checkpoint.
+ *
+ * A delta costs a little over BLOOM_DELTA_BLOCK_SIZE bytes per block,
+ * which can be compared against `bitmap_size` to decide whether to
+ * send a delta or the whole filter.
+ *
+ * BLOOM_FLAG_CONCURRENT filters may be added to while this runs; their
+ * marks are read with atomic loads.
+ *
+ * @param bf Bloom filter to examine.
+ *
+ * @return Number of dirty blocks, or 0 if the filter does not track
+ *         them.
+ */
+size_t bloom_dirty_count(const bloomfilter *bf) {
+	size_t count = 0;
+
+	if (bf->dirty == NULL) {
+		return 0;
+	}
+
+	if (bf->flags & BLOOM_FLAG_CONCURRENT) {
+		for (size_t i = 0; i < dirty_words(bf); i++) {
+			count += __builtin_popcountll(__atomic_load_n(&bf->dirty[i], __ATOMIC_RELAXED));
+		}
+		return count;
+	}
+
+	return bitops_popcount((const uint8_t *)bf->dirty, dirty_words(bf) * sizeof(uint64_t));
+}
+
 /**
  * @brief Return a string containing the error message corresponding
  * to an error code.
@@ -752,6 +2195,137 @@ const char *bloom_strerror(bloom_error_t error) {
 	return bloom_errors[error];
 }
 
+/**
+ * @brief Helper function to OR each pair of adjacent bits of a byte
+ * into the low nibble.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint8_t squeeze_pairs(uint8_t x) {
+	x = (x | (x >> 1)) & 0x55;
+	x = (x | (x >> 1)) & 0x33;
+	x = (x | (x >> 2)) & 0x0f;
+
+	return x;
+}
+
+/**
+ * @brief Helper function to fold a Bloom filter's bitmap to half its
+ * size, in place.
+ *
+ * Modulo and BLOOM_FLAG_POW2 filters map a hash to `hash % size`; for
+ * an even size, `hash % (size / 2)` is that position with the top half
+ * folded onto the bottom, so bit `i` of the result is bit `i` OR bit
+ * `i + size / 2`. BLOOM_FLAG_FASTRANGE filters map a hash to
+ * `(hash * size) >> 64`, which for half the size is the position
+ * divided by two, so bit `i` of the result is bits `2i` and `2i + 1`
+ * ORed together.
+ *
+ * Bits past the new size are cleared, so the padding of the bitmap
+ * stays zero. The allocation isn't shrunk.
+ *
+ * @param bf Bloom filter with an even size.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void fold_bitmap(bloomfilter *bf) {
+	uint8_t *bitmap   = bf->bitmap;
+	size_t   old_size = bf->bitmap_size;
+	size_t   half     = bf->size / 2;
+	size_t   bytes    = (half + 7) / 8;
+
+	if (bf->flags & BLOOM_FLAG_FASTRANGE && !(bf->flags & BLOOM_FLAG_POW2)) {
+		for (size_t i = 0; i < bytes; i++) {
+			uint8_t low  = bitmap[2 * i];
+			uint8_t high = (2 * i + 1 < old_size) ? bitmap[2 * i + 1] : 0;
+
+			bitmap[i] = squeeze_pairs(low) | (squeeze_pairs(high) << 4);
+		}
+	} else if (half % 8 == 0) {
+		bitops_or(bitmap, bitmap, bitmap + half / 8, half / 8);
+	} else {
+		for (size_t i = 0; i < half; i++) {
+			if (bitmap[(i + half) / 8] & (0x01 << ((i + half) % 8))) {
+				bitmap[i / 8] |= 0x01 << (i % 8);
+			}
+		}
+	}
+
+	if (half % 8 != 0) {
+		bitmap[bytes - 1] &= (0x01 << (half % 8)) - 1;
+	}
+	memset(bitmap + bytes, 0, ((bf->size + 63) / 64) * sizeof(uint64_t) - bytes);
+
+	bf->size        = half;
+	bf->bitmap_size = bytes;
+}
+
+/**
+ * @brief Shrink a Bloom filter by folding it in half `times` times, in
+ * place.
+ *
+ * Folding a filter in half ORs together the bits every element could
+ * map to in a filter of half the size, so every element that was in
+ * the filter is still found, with no need for the original data. The
+ * false positive rate rises as the filter gets fuller; check it with
+ * `bloom_estimate_false_positive_rate()`. `expected` and `accuracy`
+ * still describe the filter as it was created.
+ *
+ * Works for every layout, but each fold needs an even size. Filters
+ * created with BLOOM_FLAG_POW2 can always be folded down to one byte;
+ * others may be odd sized from the start. The bitmap is reallocated
+ * to the smaller size. Dirty block tracking marks every block of the
+ * folded filter, since any of them may have changed.
+ *
+ * Halving is described in "Network Applications of Bloom Filters: A
+ * Survey" by Broder and Mitzenmacher:
+ * https://www.eecs.harvard.edu/~michaelm/postscripts/im2005b.pdf
+ *
+ * @param bf Bloom filter to fold.
+ * @param times Number of times to halve the filter.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_INVALIDPARAM if the size can't be halved `times` times,
+ *         or the filter is mapped with `bloom_map()`. The filter is
+ *         unchanged.
+ */
+bloom_error_t bloom_fold(bloomfilter *bf, const unsigned int times) {
+	size_t size = bf->size;
+
+	if (bf->map != NULL || times >= 64) {
+		return BF_INVALIDPARAM;
+	}
+
+	for (unsigned int i = 0; i < times; i++) {
+		if (size % 2 != 0 || size / 2 < 8) {
+			return BF_INVALIDPARAM;
+		}
+		size /= 2;
+	}
+
+	for (unsigned int i = 0; i < times; i++) {
+		fold_bitmap(bf);
+	}
+
+	// keep the larger allocation if the smaller can't be had; the
+	// filter is already folded.
+	uint8_t *bitmap = archbloom_realloc(bf->bitmap, ((bf->size + 63) / 64) * sizeof(uint64_t));
+	if (bitmap != NULL) {
+		bf->bitmap = bitmap;
+	}
+
+	if (bf->dirty != NULL) {
+		memset(bf->dirty, 0, dirty_words(bf) * sizeof(uint64_t));
+		for (size_t block = 0; block < block_count(bf); block++) {
+			mark_block(bf, block);
+		}
+	}
+
+	bloom_recount(bf);
+
+	return BF_SUCCESS;
+}
+
 /**
  * @brief Merge two Bloom filters into a result filter.
  *
@@ -759,6 +2333,9 @@ const char *bloom_strerror(bloom_error_t error) {
  * of their bitmaps. The two Bloom filters must have the same size,
  * hashcount, and accuracy to be merged.
  *
+ * The result does not track dirty blocks. To keep a filter merged with
+ * others that change, apply their deltas with `bloom_apply_delta_fd()`.
+ *
  * @param result A pointer to the Bloom filter to store the merged result.
  * @param bf1 A pointer to the first Bloom filter.
  * @param bf2 A pointer to the second Bloom filter.
@@ -772,7 +2349,9 @@ bloom_error_t bloom_merge(bloomfilter *result,
 						  const bloomfilter *bf2) {
     if (bf1->size != bf2->size ||
 		bf1->hashcount != bf2->hashcount ||
-		bf1->accuracy != bf2->accuracy) {
+		bf1->accuracy != bf2->accuracy ||
+		bf1->hash != bf2->hash ||
+		((bf1->flags ^ bf2->flags) & LAYOUT_FLAGS)) {
         return BF_INVALIDFILE;
     }
 
@@ -781,15 +2360,22 @@ bloom_error_t bloom_merge(bloomfilter *result,
     result->accuracy    = bf1->accuracy;
     result->bitmap_size = bf1->bitmap_size;
     result->expected    = bf1->expected;
-
-    result->bitmap = calloc(result->bitmap_size, sizeof(uint8_t));
+    result->flags       = bf1->flags & ~BLOOM_FLAG_TRACK_DIRTY;
+    result->hash        = bf1->hash;
+    result->map         = NULL;
+    result->map_size    = 0;
+    result->dirty       = NULL;
+    result->stats       = NULL;
+
+    result->bitmap = bitmap_alloc(result->size);
     if (result->bitmap == NULL) {
         return BF_OUTOFMEMORY;
     }
 
-    for (size_t i = 0; i < result->bitmap_size; i++) {
-        result->bitmap[i] = bf1->bitmap[i] | bf2->bitmap[i];
-    }
+    bitops_or(result->bitmap, bf1->bitmap, bf2->bitmap, result->bitmap_size);
+
+    stats_alloc(result);
+    bloom_recount(result);
 
     return BF_SUCCESS;
 }
@@ -814,7 +2400,9 @@ bloom_error_t bloom_intersect(bloomfilter *result,
                               const bloomfilter *bf2) {
     if (bf1->size != bf2->size ||
 		bf1->hashcount != bf2->hashcount ||
-		bf1->accuracy != bf2->accuracy) {
+		bf1->accuracy != bf2->accuracy ||
+		bf1->hash != bf2->hash ||
+		((bf1->flags ^ bf2->flags) & LAYOUT_FLAGS)) {
         return BF_INVALIDFILE;
     }
 
@@ -823,15 +2411,22 @@ bloom_error_t bloom_intersect(bloomfilter *result,
     result->accuracy    = bf1->accuracy;
     result->bitmap_size = bf1->bitmap_size;
     result->expected    = bf1->expected;
-
-    result->bitmap = calloc(result->bitmap_size, sizeof(uint8_t));
+    result->flags       = bf1->flags & ~BLOOM_FLAG_TRACK_DIRTY;
+    result->hash        = bf1->hash;
+    result->map         = NULL;
+    result->map_size    = 0;
+    result->dirty       = NULL;
+    result->stats       = NULL;
+
+    result->bitmap = bitmap_alloc(result->size);
     if (result->bitmap == NULL) {
         return BF_OUTOFMEMORY;
     }
 
-    for (size_t i = 0; i < result->bitmap_size; i++) {
-        result->bitmap[i] = bf1->bitmap[i] & bf2->bitmap[i];
-    }
+    bitops_and(result->bitmap, bf1->bitmap, bf2->bitmap, result->bitmap_size);
+
+    stats_alloc(result);
+    bloom_recount(result);
 
     return BF_SUCCESS;
 }
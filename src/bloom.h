@@ -20,8 +20,70 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "hash.h"
+#include "stats.h"
+
 #define BLOOM_MAX_NAME_LENGTH 255
 
+/**
+ * @def BLOOM_BATCH_RESULT
+ * @brief Read bit `i` of a result bitmap filled in by one of the
+ * batch functions, such as `bloom_lookup_batch()`.
+ */
+#define BLOOM_BATCH_RESULT(results, i) (((results)[(i) / 8] >> ((i) % 8)) & 0x01)
+
+/**
+ * @def BLOOM_FLAG_POW2
+ * @brief `bloom_init_flags()` flag: round the filter size up to a
+ * power of two and map hashes onto it with a mask rather than a 64 bit
+ * modulo. Uses more memory, but allows the filter to be halved.
+ * Takes precedence over BLOOM_FLAG_FASTRANGE.
+ */
+#define BLOOM_FLAG_POW2      0x01
+
+/**
+ * @def BLOOM_FLAG_FASTRANGE
+ * @brief `bloom_init_flags()` flag: map hashes onto the filter with a
+ * multiply and shift rather than a 64 bit modulo. Keeps the ideal
+ * filter size.
+ */
+#define BLOOM_FLAG_FASTRANGE 0x02
+
+/**
+ * @def BLOOM_FLAG_CONCURRENT
+ * @brief `bloom_init_flags()` flag: allow `bloom_add()`,
+ * `bloom_lookup()`, `bloom_lookup_or_add()` and their string and batch
+ * variants to be called on the same filter from multiple threads
+ * without external locking. Bits are set with atomic fetch-or on 64
+ * bit words. Other functions, such as `bloom_clear()`, still need the
+ * filter to themselves.
+ */
+#define BLOOM_FLAG_CONCURRENT 0x04
+
+/**
+ * @def BLOOM_FLAG_TRACK_DIRTY
+ * @brief `bloom_init_flags()` flag: remember which
+ * BLOOM_DELTA_BLOCK_SIZE byte blocks of the bitmap gained bits since
+ * the last checkpoint, so `bloom_save_delta_fd()` can send only those.
+ * Costs one bit of memory per block and a branch when a bit is newly
+ * set.
+ */
+#define BLOOM_FLAG_TRACK_DIRTY 0x08
+
+/**
+ * @def BLOOM_FLAGS_ALL
+ * @brief Every flag understood by this version of the library.
+ */
+#define BLOOM_FLAGS_ALL      (BLOOM_FLAG_POW2 | BLOOM_FLAG_FASTRANGE | BLOOM_FLAG_CONCURRENT | BLOOM_FLAG_TRACK_DIRTY)
+
+/**
+ * @def BLOOM_DELTA_BLOCK_SIZE
+ * @brief Size in bytes of the blocks BLOOM_FLAG_TRACK_DIRTY filters
+ * track and deltas carry. One 64 bit word: elements set bits far
+ * apart, so larger blocks mostly carry bits that didn't change.
+ */
+#define BLOOM_DELTA_BLOCK_SIZE 8
+
 /**
  * @enum bloom_error_t
  * @brief Enum representing error status codes for Bloom filter operations.
@@ -51,6 +113,16 @@
  * @var BF_INVALIDFILE
  * Error indicating that the file format is invalid.
  *
+ * @var BF_MMAP
+ * Error indicating failure of the mmap() system call.
+ *
+ * @var BF_NOTTRACKED
+ * Error indicating that a delta was requested from a filter created
+ * without BLOOM_FLAG_TRACK_DIRTY.
+ *
+ * @var BF_INVALIDPARAM
+ * Error indicating that a parameter is out of range.
+ *
  * @var BF_ERRORCOUNT
  * A counter used internally to track the number of error codes. No
  * new errors should be added below this line.
@@ -63,6 +135,9 @@ typedef enum {
 	BF_FWRITE,
 	BF_FSTAT,
 	BF_INVALIDFILE,
+	BF_MMAP,
+	BF_NOTTRACKED,
+	BF_INVALIDPARAM,
 	// ERRORCOUNT is used as a counter. do not add anything below this line.
 	BF_ERRORCOUNT
 } bloom_error_t;
@@ -76,17 +151,29 @@ typedef enum {
  * the array matches a specific error code.
  *
  * @note The order of the messages must align with their corresponding
- * error codes.
- */
-const char *bloom_errors[] = {
-	"Success",
-	"Out of memory",
-	"Unable to open file",
-	"Unable to read file",
-	"Unable to write to file",
-	"fstat() failure",
-	"Invalid file format"
-};
+ * error codes. Defined in bloom.c, so other parts of the library can
+ * include this header.
+ */
+extern const char *bloom_errors[];
+
+/**
+ * @enum bloom_encoding
+ * @brief How the bitmap of a saved Bloom filter is stored.
+ *
+ * @var BLOOM_ENCODING_RAW
+ * The bitmap as it is in memory. Written by `bloom_save()`; the only
+ * encoding `bloom_map()` accepts.
+ *
+ * @var BLOOM_ENCODING_RICE
+ * Golomb-Rice coded gaps between set bits. Written by
+ * `bloom_save_compressed()` when it is smaller than the bitmap.
+ */
+typedef enum {
+	BLOOM_ENCODING_RAW = 0,
+	BLOOM_ENCODING_RICE,
+	// used as a counter. do not add anything below this line.
+	BLOOM_ENCODINGCOUNT
+} bloom_encoding;
 
 /**
  * @struct bloomfilter
@@ -112,8 +199,30 @@ const char *bloom_errors[] = {
  * @var bloomfilter::accuracy
  * Desired margin of error (e.g., 0.01 represents 99.99% accuracy).
  *
+ * @var bloomfilter::flags
+ * BLOOM_FLAG_* options the filter was created with.
+ *
+ * @var bloomfilter::hash
+ * Hash strategy used to hash elements. See `bloom_set_hash()`.
+ *
  * @var bloomfilter::bitmap
  * Pointer to the bitmap used to represent the Bloom filter.
+ *
+ * @var bloomfilter::map
+ * Start of the file mapping if the filter was loaded with
+ * `bloom_map()`, otherwise NULL.
+ *
+ * @var bloomfilter::map_size
+ * Size of the file mapping in bytes.
+ *
+ * @var bloomfilter::dirty
+ * One bit per BLOOM_DELTA_BLOCK_SIZE byte block of the bitmap, set
+ * when the block gains a bit. Allocated for BLOOM_FLAG_TRACK_DIRTY
+ * filters, NULL otherwise.
+ *
+ * @var bloomfilter::stats
+ * Runtime statistics, including the number of bits set, or NULL if the
+ * library keeps none. See `bloom_stats()`.
  */
 typedef struct {
 	size_t   size;              /**< Size of the Bloom filter in bits */
@@ -121,8 +230,14 @@ typedef struct {
 	size_t   bitmap_size;       /**< Size of the bitmap in bytes */
 	size_t   expected;          /**< Expected capacity of the filter */
 	float    accuracy;          /**< Desired margin of error */
+	uint32_t flags;             /**< BLOOM_FLAG_* options */
+	hash_strategy hash;         /**< Hash strategy */
 	char     name[BLOOM_MAX_NAME_LENGTH + 1];
 	uint8_t *bitmap;            /**< Pointer to the bitmap of the filter */
+	void    *map;               /**< File mapping from bloom_map(), or NULL */
+	size_t   map_size;          /**< Size of the file mapping in bytes */
+	uint64_t *dirty;            /**< Blocks changed since the last checkpoint, or NULL */
+	archbloom_counters *stats;  /**< Runtime statistics, or NULL */
 } bloomfilter;
 
 
@@ -149,6 +264,24 @@ typedef struct {
  *
  * @var bloomfilter_file::accuracy
  * Desired false positive rate, where 0.01 represents 99% accuracy.
+ *
+ * @var bloomfilter_file::flags
+ * BLOOM_FLAG_* options. This occupies what used to be structure
+ * padding, so files written before it existed read as 0 (modulo).
+ *
+ * @var bloomfilter_file::hash
+ * Hash strategy. Files with a legacy header read as 0 (HASH_MMH3).
+ *
+ * @var bloomfilter_file::encoding
+ * How the bitmap is stored, a bloom_encoding. This and `encoded_size`
+ * pad the header to 320 bytes so the bitmap starts on a 64 byte
+ * boundary when the file is mapped with `bloom_map()`. Files written
+ * before this existed have a 304 byte header
+ * (BLOOM_FILE_LEGACY_HEADER_SIZE) and are still accepted.
+ *
+ * @var bloomfilter_file::encoded_size
+ * Size in bytes of the bitmap following the header when `encoding` is
+ * not BLOOM_ENCODING_RAW. Zero otherwise.
  */
 typedef struct {
 	uint8_t  magic[8];
@@ -158,20 +291,76 @@ typedef struct {
 	uint64_t bitmap_size;
 	uint64_t expected;
 	float    accuracy;
+	uint32_t flags;
+	uint32_t hash;
+	uint32_t encoding;
+	uint64_t encoded_size;
 } bloomfilter_file;
 
+/**
+ * @def BLOOM_FILE_LEGACY_HEADER_SIZE
+ * @brief Size of the header written by versions of this library
+ * before `bloomfilter_file::hash`, `bloomfilter_file::encoding` and
+ * `bloomfilter_file::encoded_size` were added. Files are now written
+ * with the full 320 byte `bloomfilter_file` header; headers of this
+ * size are still recognized on load.
+ */
+#define BLOOM_FILE_LEGACY_HEADER_SIZE 304
+
+/**
+ * @struct bloomfilter_delta
+ * @brief Header of a delta written by `bloom_save_delta_fd()`.
+ *
+ * The header is followed by `map_size` bytes of Golomb-Rice coded
+ * bitmap with one bit per block of the filter, set for the `count`
+ * blocks in the delta, then those blocks in ascending order,
+ * `block_size` bytes each. The last block of the bitmap is padded with
+ * zeros. `size`, `hashcount`, `flags` (only BLOOM_FLAG_POW2 and
+ * BLOOM_FLAG_FASTRANGE) and `hash` must match the filter the delta is
+ * applied to. `reserved` must be zero.
+ */
+typedef struct {
+	uint8_t  magic[8];
+	uint64_t size;
+	uint64_t hashcount;
+	uint64_t count;
+	uint64_t map_size;
+	uint32_t block_size;
+	uint32_t flags;
+	uint32_t hash;
+	uint8_t  reserved[12];
+} bloomfilter_delta;
+
 /* function declarations
  */
 bloom_error_t  bloom_init(bloomfilter *, const size_t, const float);
+bloom_error_t  bloom_init_flags(bloomfilter *,
+                                const size_t,
+                                const float,
+                                const uint32_t);
+bloom_error_t  bloom_init_compressible(bloomfilter *,
+                                       const size_t,
+                                       const float,
+                                       const float);
 void           bloom_destroy(bloomfilter *);
 void           bloom_clear(bloomfilter *);
 const char    *bloom_get_name(bloomfilter *);
 bool           bloom_set_name(bloomfilter *, const char *);
+bool           bloom_set_hash(bloomfilter *, const hash_strategy);
 const char    *bloom_strerror(const bloom_error_t);
 bloom_error_t  bloom_save(const bloomfilter *, const char *);
 bloom_error_t  bloom_load(bloomfilter *, const char *);
 bloom_error_t  bloom_save_fd(const bloomfilter *, int);
 bloom_error_t  bloom_load_fd(bloomfilter *, int);
+bloom_error_t  bloom_save_compressed(const bloomfilter *, const char *);
+bloom_error_t  bloom_save_compressed_fd(const bloomfilter *, int);
+size_t         bloom_compressed_size(const bloomfilter *);
+bloom_error_t  bloom_save_delta_fd(bloomfilter *, int);
+bloom_error_t  bloom_apply_delta_fd(bloomfilter *, int);
+void           bloom_checkpoint(bloomfilter *);
+size_t         bloom_dirty_count(const bloomfilter *);
+bloom_error_t  bloom_map(bloomfilter *, const char *, const bool);
+bloom_error_t  bloom_map_fd(bloomfilter *, int, const bool);
 bloom_error_t  bloom_merge(bloomfilter *,
                            const bloomfilter *,
                            const bloomfilter *);
@@ -181,10 +370,13 @@ bloom_error_t  bloom_intersect(bloomfilter *,
 float          bloom_estimate_intersection(const bloomfilter *,
                                            const bloomfilter *);
 size_t         bloom_saturation_count(const bloomfilter *);
+bool           bloom_stats(const bloomfilter *, archbloom_stats *);
+void           bloom_recount(bloomfilter *);
 float          bloom_saturation(const bloomfilter *);
 bool           bloom_clear_if_saturation_exceeds(bloomfilter *,
                                                  float threshold);
 float          bloom_estimate_false_positive_rate(const bloomfilter *);
+bloom_error_t  bloom_fold(bloomfilter *, const unsigned int);
 
 bool           bloom_lookup(const bloomfilter *, const void *, const size_t);
 bool           bloom_lookup_string(const bloomfilter *, const char *);
@@ -193,28 +385,26 @@ bool           bloom_lookup_or_add_string(bloomfilter *, const char *);
 
 void           bloom_add(bloomfilter *, const void *, const size_t);
 void           bloom_add_string(bloomfilter *, const char *);
+bool           bloom_lookup_hashed(const bloomfilter *, const uint64_t *);
+bool           bloom_add_hashed(bloomfilter *, const uint64_t *);
 bool           bloom_add_if_not_present(bloomfilter *,
                                         const void *,
                                         const size_t);
 bool           bloom_add_if_not_present_string(bloomfilter *, const char *);
 
-#endif /* BLOOM_H */
+void           bloom_add_batch(bloomfilter *,
+                               const void **,
+                               const size_t *,
+                               const size_t);
+void           bloom_lookup_batch(const bloomfilter *,
+                                  const void **,
+                                  const size_t *,
+                                  const size_t,
+                                  uint8_t *);
+void           bloom_lookup_or_add_batch(bloomfilter *,
+                                         const void **,
+                                         const size_t *,
+                                         const size_t,
+                                         uint8_t *);
 
-/* https://www.eecs.harvard.edu/~michaelm/postscripts/im2005b.pdf
- *
- * TODO: Another nice feature is that Bloom filters can easily be
- * halved in size, allowing an application to dynamically shrink a
- * Bloom filter. Suppose that the size of the filter is a power of
- * 2. To halve the size of the filter, just OR the first and second
- * halves together. When hashing to do a lookup, the highest order bit
- * can be masked.
- *
- * TODO: compressed bloom filters - by making the filters larger
- * initally, then using compression, the filters can take up even less
- * space than a "properly sized" Bloom filter - Broder & Mitzenmacher
- *
- * TODO: specify hash function. this currently uses mmh3 128 bit,
- * spliting the resulting hash into two 64 bit hashes, and using
- * double hashing for the remaining hashes. It may be useful to be
- * able to switch hash functions.
- */
+#endif /* BLOOM_H */
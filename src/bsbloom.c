@@ -0,0 +1,356 @@
+/**
+ * @file bsbloom.c
+ * @brief Bit-sliced Bloom filter set implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains functions for working with bit-sliced Bloom
+ * filter sets: building a set from classic Bloom filters of the same
+ * shape, adding elements to its members, and finding every member
+ * that contains an element.
+ *
+ * The positions of an element are those `bloom_lookup()` would probe
+ * in any of the member filters, so a set built from saved filters
+ * answers exactly as the filters would one at a time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "hash.h"
+#include "fastrange.h"
+#include "alloc.h"
+#include "bloom.h"
+#include "bsbloom.h"
+
+/**
+ * @brief Flags that change where an element's bits are. Every filter
+ * in a set must agree on these.
+ */
+#define LAYOUT_FLAGS (BLOOM_FLAG_POW2 | BLOOM_FLAG_FASTRANGE)
+
+/**
+ * @brief Rows are allocated on cache line boundaries, so a row of up
+ * to 512 filters is a single cache line.
+ */
+#define ROW_ALIGNMENT ARCHBLOOM_ALIGNMENT
+
+/**
+ * @brief Helper function to map a hash onto a row, the way
+ * `bloom_lookup()` maps it onto a bit of each member filter.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t hash_position(const bsbloomfilter *bs, const uint64_t hash) {
+	if (bs->flags & BLOOM_FLAG_POW2) {
+		return hash & (bs->size - 1);
+	}
+
+	if (bs->flags & BLOOM_FLAG_FASTRANGE) {
+		return fastrange64(hash, bs->size);
+	}
+
+	return hash % bs->size;
+}
+
+/**
+ * @brief Helper function to get row `position` of a set.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t *row_at(const bsbloomfilter *bs, const uint64_t position) {
+	return bs->rows + (position * bs->words);
+}
+
+/**
+ * @brief Helper function to lay the rows out again `words` words wide,
+ * making room for `words * 64` filters.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_OUTOFMEMORY if memory allocation fails. The set is
+ *         unchanged.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bloom_error_t widen(bsbloomfilter *bs, const size_t words) {
+	size_t    bytes = bs->size * words * sizeof(uint64_t);
+	uint64_t *rows  = archbloom_alloc(bytes);
+	void     *names = realloc(bs->names, words * 64 * sizeof(*bs->names));
+
+	if (names != NULL) {
+		bs->names = names;
+	}
+
+	if (rows == NULL || names == NULL) {
+		archbloom_free(rows);
+		return BF_OUTOFMEMORY;
+	}
+
+	// the first widen has no rows to copy
+	for (size_t p = 0; bs->words != 0 && p < bs->size; p++) {
+		memcpy(rows + (p * words), row_at(bs, p), bs->words * sizeof(uint64_t));
+	}
+
+	archbloom_free(bs->rows);
+	bs->rows  = rows;
+	bs->words = words;
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Initialize an empty bit-sliced Bloom filter set.
+ *
+ * The set takes its shape from `shape`: every filter added to it must
+ * have the same size, hash count, hash strategy and layout flags. Its
+ * contents aren't added; pass it to `bsbloom_add_filter()` for that.
+ *
+ * @param bs Pointer to the set to initialize.
+ * @param shape Any Bloom filter of the shape the set will hold.
+ *
+ * @return BF_SUCCESS on success.
+ */
+bloom_error_t bsbloom_init(bsbloomfilter *bs, const bloomfilter *shape) {
+	bs->rows      = NULL;
+	bs->words     = 0;
+	bs->count     = 0;
+	bs->size      = shape->size;
+	bs->hashcount = shape->hashcount;
+	bs->flags     = shape->flags & LAYOUT_FLAGS;
+	bs->hash      = shape->hash;
+	bs->names     = NULL;
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Free the memory of a bit-sliced Bloom filter set.
+ *
+ * @param bs Pointer to the set to destroy.
+ */
+void bsbloom_destroy(bsbloomfilter *bs) {
+	archbloom_free(bs->rows);
+	free(bs->names);
+	bs->rows  = NULL;
+	bs->names = NULL;
+	bs->words = 0;
+	bs->count = 0;
+}
+
+/**
+ * @brief Add a copy of a Bloom filter to a set.
+ *
+ * The filter is transposed into the set's rows and becomes member
+ * `bs->count - 1`, named after the filter's `name`. The filter itself
+ * isn't referenced afterwards and may be destroyed. Adding a filter
+ * after every 64th, 128th, 256th, ... filter lays the rows out again,
+ * which costs as much as copying the whole set.
+ *
+ * @param bs Pointer to the set.
+ * @param bf Filter to add.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_INVALIDFILE if the filter's shape differs from the set's.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t bsbloom_add_filter(bsbloomfilter *bs, const bloomfilter *bf) {
+	if (bf->size != bs->size ||
+		bf->hashcount != bs->hashcount ||
+		bf->hash != bs->hash ||
+		(bf->flags & LAYOUT_FLAGS) != bs->flags) {
+		return BF_INVALIDFILE;
+	}
+
+	if (bs->count == bs->words * 64) {
+		bloom_error_t error = widen(bs, (bs->words == 0) ? 1 : bs->words * 2);
+		if (error != BF_SUCCESS) {
+			return error;
+		}
+	}
+
+	size_t   index = bs->count;
+	uint64_t bit   = 1ULL << (index % 64);
+
+	for (size_t i = 0; i < bf->bitmap_size; i++) {
+		uint8_t byte = bf->bitmap[i];
+
+		while (byte != 0) {
+			uint64_t position = (i * 8) + __builtin_ctz(byte);
+
+			row_at(bs, position)[index / 64] |= bit;
+			byte &= byte - 1;
+		}
+	}
+
+	snprintf(bs->names[index], BLOOM_MAX_NAME_LENGTH + 1, "%.*s", BLOOM_MAX_NAME_LENGTH, bf->name);
+	bs->count++;
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Get the name of member `index` of a set.
+ *
+ * @return The name, or NULL if there is no such member.
+ */
+const char *bsbloom_name(const bsbloomfilter *bs, const size_t index) {
+	if (index >= bs->count) {
+		return NULL;
+	}
+
+	return bs->names[index];
+}
+
+/**
+ * @brief Get the number of 64 bit words a match bitmap passed to
+ * `bsbloom_lookup()` must hold. This grows as filters are added.
+ */
+size_t bsbloom_match_words(const bsbloomfilter *bs) {
+	return bs->words;
+}
+
+/**
+ * @brief Get the memory used by a set's rows and names, in bytes.
+ */
+size_t bsbloom_memory(const bsbloomfilter *bs) {
+	return (bs->size * bs->words * sizeof(uint64_t)) + (bs->words * 64 * sizeof(*bs->names));
+}
+
+/**
+ * @brief Add an element to member `index` of a set.
+ *
+ * @param bs Pointer to the set.
+ * @param index Member to add the element to. Must be less than
+ *        `bs->count`.
+ * @param element Pointer to the element to add.
+ * @param len Length of the element in bytes.
+ */
+void bsbloom_add(bsbloomfilter *bs, const size_t index, const void *element, const size_t len) {
+	uint64_t hash[2];
+	uint64_t bit = 1ULL << (index % 64);
+
+	hash_128(bs->hash, element, len, hash);
+
+	for (size_t i = 0; i < bs->hashcount; i++) {
+		row_at(bs, hash_position(bs, hash_probe(hash, i)))[index / 64] |= bit;
+	}
+}
+
+/**
+ * @brief Helper function for `bsbloom_add()` to handle string elements.
+ */
+void bsbloom_add_string(bsbloomfilter *bs, const size_t index, const char *element) {
+	bsbloom_add(bs, index, element, strlen(element));
+}
+
+/**
+ * @brief Find every member of a set that probably contains an element
+ * that has already been hashed.
+ *
+ * Every row the element probes is prefetched, then the rows are ANDed
+ * together, stopping as soon as no member is left.
+ *
+ * @param bs Pointer to the set.
+ * @param hash The element's `hash_128()`, with the set's strategy.
+ * @param matches Bitmap of `bsbloom_match_words()` words. Bit `i` is
+ *        set if member `i` probably contains the element and cleared
+ *        if it definitely doesn't. Read it with BSBLOOM_MATCH().
+ *
+ * @return Number of members that probably contain the element.
+ */
+size_t bsbloom_lookup_hashed(const bsbloomfilter *bs, const uint64_t *hash, uint64_t *matches) {
+	size_t count = 0;
+
+	if (bs->count == 0) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < bs->hashcount; i++) {
+		const uint64_t *row = row_at(bs, hash_position(bs, hash_probe(hash, i)));
+
+		for (size_t w = 0; w < bs->words; w += ROW_ALIGNMENT / sizeof(uint64_t)) {
+			__builtin_prefetch(row + w, 0);
+		}
+	}
+
+	memcpy(matches, row_at(bs, hash_position(bs, hash_probe(hash, 0))), bs->words * sizeof(uint64_t));
+
+	for (size_t i = 1; i < bs->hashcount; i++) {
+		const uint64_t *row = row_at(bs, hash_position(bs, hash_probe(hash, i)));
+		uint64_t        any = 0;
+
+		for (size_t w = 0; w < bs->words; w++) {
+			matches[w] &= row[w];
+			any        |= matches[w];
+		}
+
+		if (any == 0) {
+			return 0;
+		}
+	}
+
+	for (size_t w = 0; w < bs->words; w++) {
+		count += __builtin_popcountll(matches[w]);
+	}
+
+	return count;
+}
+
+/**
+ * @brief Find every member of a set that probably contains an element.
+ *
+ * The element is hashed once for the whole set. See
+ * `bsbloom_lookup_hashed()`.
+ *
+ * @param bs Pointer to the set.
+ * @param element Pointer to the element to look up.
+ * @param len Length of the element in bytes.
+ * @param matches Bitmap of `bsbloom_match_words()` words.
+ *
+ * @return Number of members that probably contain the element.
+ */
+size_t bsbloom_lookup(const bsbloomfilter *bs, const void *element, const size_t len, uint64_t *matches) {
+	uint64_t hash[2];
+
+	hash_128(bs->hash, element, len, hash);
+
+	return bsbloom_lookup_hashed(bs, hash, matches);
+}
+
+/**
+ * @brief Helper function for `bsbloom_lookup()` to handle string elements.
+ */
+size_t bsbloom_lookup_string(const bsbloomfilter *bs, const char *element, uint64_t *matches) {
+	return bsbloom_lookup(bs, element, strlen(element), matches);
+}
+
+/**
+ * @brief List the names of the members set in a match bitmap.
+ *
+ * @param bs Pointer to the set.
+ * @param matches Bitmap filled by `bsbloom_lookup()`.
+ * @param names Array of at least as many pointers as the lookup
+ *        returned. Receives the names of the matching members, in
+ *        member order. The names belong to the set.
+ *
+ * @return Number of names stored.
+ */
+size_t bsbloom_match_names(const bsbloomfilter *bs, const uint64_t *matches, const char **names) {
+	size_t count = 0;
+
+	for (size_t w = 0; w < bs->words; w++) {
+		uint64_t word = matches[w];
+
+		while (word != 0) {
+			size_t index = (w * 64) + __builtin_ctzll(word);
+
+			if (index < bs->count) {
+				names[count++] = bs->names[index];
+			}
+			word &= word - 1;
+		}
+	}
+
+	return count;
+}
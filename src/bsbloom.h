@@ -0,0 +1,104 @@
+/**
+ * @file bsbloom.h
+ * @brief Header file for bit-sliced Bloom filter sets
+ * @author Daniel Roberson
+ *
+ * This file contains the function declarations, type definitions, and
+ * macros for working with bit-sliced Bloom filter sets. A set holds
+ * many classic Bloom filters of the same shape (size, hash count, hash
+ * strategy and layout flags), such as one filter per threat feed, and
+ * answers which of them contain an element in one pass.
+ *
+ * The filters are stored transposed: row `p` holds bit `p` of every
+ * filter, one bit per filter. An element is hashed once, and each of
+ * its `hashcount` probes fetches one row, so a lookup against 512
+ * filters touches `hashcount` cache lines rather than 512 times that.
+ * ANDing the rows together leaves a bit set for every filter that
+ * probably contains the element.
+ *
+ * This is the layout of BitFunnel and BIGSI:
+ * https://danluu.com/bitfunnel-sigir.pdf
+ * https://www.nature.com/articles/s41587-018-0010-1
+ *
+ * @see bsbloom.c for the corresponding implementation.
+ * @see bloom.h for the classic Bloom filter and error codes.
+ */
+#ifndef BSBLOOM_H
+#define BSBLOOM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+#include "bloom.h"
+
+/**
+ * @def BSBLOOM_MATCH
+ * @brief Read entry `i` of a match bitmap filled by `bsbloom_lookup()`.
+ * Evaluates to 1 if filter `i` probably contains the element and 0 if
+ * it definitely doesn't.
+ */
+#define BSBLOOM_MATCH(matches, i) (((matches)[(i) / 64] >> ((i) % 64)) & 0x01)
+
+/**
+ * @struct bsbloomfilter
+ * @brief Bit-sliced Bloom filter set data structure.
+ *
+ * @var bsbloomfilter::rows
+ * `size` rows of `words` 64 bit words. Bit `i % 64` of word `i / 64`
+ * of row `p` is bit `p` of filter `i`.
+ *
+ * @var bsbloomfilter::words
+ * Width of a row in 64 bit words. Doubles whenever the set runs out of
+ * room, so `words * 64` filters fit before the rows are laid out
+ * again.
+ *
+ * @var bsbloomfilter::count
+ * Number of filters in the set.
+ *
+ * @var bsbloomfilter::size
+ * Size of each filter in bits.
+ *
+ * @var bsbloomfilter::hashcount
+ * Number of hashes per element.
+ *
+ * @var bsbloomfilter::flags
+ * Layout flags (BLOOM_FLAG_POW2, BLOOM_FLAG_FASTRANGE) every filter was
+ * created with.
+ *
+ * @var bsbloomfilter::hash
+ * Hash strategy every filter uses.
+ *
+ * @var bsbloomfilter::names
+ * Name of each filter, copied from the filter when it was added.
+ */
+typedef struct {
+	uint64_t       *rows;      /**< Transposed bitmaps */
+	size_t          words;     /**< Words per row */
+	size_t          count;     /**< Number of filters in the set */
+	size_t          size;      /**< Bits per filter */
+	size_t          hashcount; /**< Hashes per element */
+	uint32_t        flags;     /**< BLOOM_FLAG_* layout options */
+	hash_strategy   hash;      /**< Hash strategy */
+	char          (*names)[BLOOM_MAX_NAME_LENGTH + 1]; /**< Filter names */
+} bsbloomfilter;
+
+/* function declarations
+ */
+bloom_error_t  bsbloom_init(bsbloomfilter *, const bloomfilter *);
+void           bsbloom_destroy(bsbloomfilter *);
+bloom_error_t  bsbloom_add_filter(bsbloomfilter *, const bloomfilter *);
+const char    *bsbloom_name(const bsbloomfilter *, const size_t);
+size_t         bsbloom_match_words(const bsbloomfilter *);
+size_t         bsbloom_memory(const bsbloomfilter *);
+
+void           bsbloom_add(bsbloomfilter *, const size_t, const void *, const size_t);
+void           bsbloom_add_string(bsbloomfilter *, const size_t, const char *);
+
+size_t         bsbloom_lookup(const bsbloomfilter *, const void *, const size_t, uint64_t *);
+size_t         bsbloom_lookup_string(const bsbloomfilter *, const char *, uint64_t *);
+size_t         bsbloom_lookup_hashed(const bsbloomfilter *, const uint64_t *, uint64_t *);
+size_t         bsbloom_match_names(const bsbloomfilter *, const uint64_t *, const char **);
+
+#endif /* BSBLOOM_H */
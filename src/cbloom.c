@@ -10,17 +10,45 @@
  * elements, and saving/loading the filter to/from disk.
  */
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
 #include <stdio.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
-#include "mmh3.h"
+#include "hash.h"
+#include "bitops.h"
+#include "fastrange.h"
+#include "mapfile.h"
+#include "alloc.h"
 #include "cbloom.h"
 
+// messages for cbloom_strerror(). See cbloom.h.
+const char *cbloom_errors[] = {
+	"Success",
+	"Out of memory",
+	"Invalid counter size",
+	"Unable to open file",
+	"Unable to write to file",
+	"Unable to read file",
+	"fstat() failure",
+	"Invalid file format",
+	"mmap() failure",
+	"Invalid parameter"
+};
+
+_Static_assert(sizeof(cbloom_errors) / sizeof(cbloom_errors[0]) == CBF_ERRORCOUNT,
+               "cbloom_errors must have a message for every cbloom_error_t");
+
+_Static_assert(sizeof(cbloomfilter_file) % 64 == 0,
+               "cbloomfilter_file must keep the counters 64 byte aligned");
+_Static_assert(offsetof(cbloomfilter_file, hash) == CBLOOM_FILE_LEGACY_HEADER_SIZE,
+               "cbloomfilter_file must stay compatible with legacy files");
+
 /**
  * @brief Calculate the ideal size of a counting Bloom filter.
  *
@@ -47,6 +75,27 @@ static uint64_t ideal_size(const uint64_t expected, const float accuracy) {
 	return -(expected * log(accuracy) / pow(log(2.0), 2));
 }
 
+/**
+ * @brief Calculate the size in bytes of a counter map.
+ *
+ * @param csize Size of each counter.
+ * @param size Number of counters.
+ *
+ * @return Size of the counter map in bytes, or 0 if `csize` is invalid.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static uint64_t countermap_bytes(const counter_size csize, const uint64_t size) {
+	switch (csize) {
+	case COUNTER_4BIT:  return (size + 1) / 2;
+	case COUNTER_8BIT:  return size * sizeof(uint8_t);
+	case COUNTER_16BIT: return size * sizeof(uint16_t);
+	case COUNTER_32BIT: return size * sizeof(uint32_t);
+	case COUNTER_64BIT: return size * sizeof(uint64_t);
+	default:            return 0;
+	}
+}
+
 /**
  * @brief Initialize a counting Bloom filter.
  *
@@ -68,7 +117,40 @@ static uint64_t ideal_size(const uint64_t expected, const float accuracy) {
  * @return CBF_ERROR if an unspecified error occurs.
  */
 cbloom_error_t cbloom_init(cbloomfilter *cbf, const size_t expected, const float accuracy, counter_size csize) {
+	return cbloom_init_flags(cbf, expected, accuracy, csize, 0);
+}
+
+/**
+ * @brief Initialize a counting Bloom filter with options.
+ *
+ * This function is `cbloom_init()` with a set of CBLOOM_FLAG_* options
+ * controlling how hashes are mapped onto counters. See
+ * `bloom_init_flags()` for the tradeoffs. The flags are saved with the
+ * filter.
+ *
+ * @param cbf Pointer to the counting Bloom filter to initialize.
+ * @param expected Expected number of elements to store in the filter.
+ * @param accuracy Desired false positive rate (e.g., 0.01 for 99.99% accuracy).
+ * @param csize Size of the counter.
+ * @param flags Bitwise OR of CBLOOM_FLAG_* values. Unknown bits are ignored.
+ *
+ * @return CBF_SUCCESS on success.
+ * @return CBF_OUTOFMEMORY if memory allocation fails.
+ * @return CBF_INVALIDCOUNTERSIZE if the counter size is invalid.
+ */
+cbloom_error_t cbloom_init_flags(cbloomfilter *cbf, const size_t expected, const float accuracy, counter_size csize, const uint32_t flags) {
 	cbf->size      = ideal_size(expected, accuracy);
+	if (flags & CBLOOM_FLAG_POW2) {
+		cbf->size = round_pow2(cbf->size);
+	}
+	cbf->flags     = flags & CBLOOM_FLAGS_ALL;
+	cbf->hash      = HASH_MMH3;
+	cbf->map       = NULL;
+	cbf->map_size  = 0;
+	cbf->decay_cursor = 0;
+	cbf->decay_total  = 0;
+	cbf->decay_stamps = NULL;
+	cbf->stats        = NULL;
 	// add 0.5 to round up/down
 	cbf->hashcount = (uint64_t)((cbf->size / expected) * log(2) + 0.5);
 	cbf->csize     = csize;
@@ -76,31 +158,18 @@ cbloom_error_t cbloom_init(cbloomfilter *cbf, const size_t expected, const float
 	cbf->expected  = expected;
 	snprintf(cbf->name, sizeof(cbf->name), "DEFAULT");
 
-	switch (csize) {
-	case COUNTER_4BIT:
-		cbf->countermap_size = (cbf->size + 1) / 2;
-		break;
-	case COUNTER_8BIT:
-		cbf->countermap_size = cbf->size * sizeof(uint8_t);
-		break;
-	case COUNTER_16BIT:
-		cbf->countermap_size = cbf->size * sizeof(uint16_t);
-		break;
-	case COUNTER_32BIT:
-		cbf->countermap_size = cbf->size * sizeof(uint32_t);
-		break;
-	case COUNTER_64BIT:
-		cbf->countermap_size = cbf->size * sizeof(uint64_t);
-		break;
-	default: // invalid counter size
+	cbf->countermap_size = countermap_bytes(csize, cbf->size);
+	if (cbf->countermap_size == 0) { // invalid counter size
 		return CBF_INVALIDCOUNTERSIZE;
 	}
 
-	cbf->countermap = calloc(1, cbf->countermap_size);
+	cbf->countermap = archbloom_alloc(cbf->countermap_size);
 	if (cbf->countermap == NULL) {
 		return CBF_OUTOFMEMORY;
 	}
 
+	cbf->stats = archbloom_counters_alloc(cbf->flags & CBLOOM_FLAG_CONCURRENT);
+
 	return CBF_SUCCESS;
 }
 
@@ -110,14 +179,29 @@ cbloom_error_t cbloom_init(cbloomfilter *cbf, const size_t expected, const float
  * This function releases all resources and memory allocated for the
  * counting Bloom filter during its initialization. After calling this
  * function, the filter should not be used unless reinitialized.
+ * Filters loaded with `cbloom_map()` are unmapped.
  *
  * @param cbf Pointer to the counting Bloom filter to free.
  */
 void cbloom_destroy(cbloomfilter *cbf) {
+	if (cbf->map) {
+		munmap(cbf->map, cbf->map_size);
+		cbf->map        = NULL;
+		cbf->countermap = NULL;
+	}
+
 	if (cbf->countermap) {
-		free(cbf->countermap);
+		archbloom_free(cbf->countermap);
 		cbf->countermap = NULL;
 	}
+
+	if (cbf->decay_stamps) {
+		archbloom_free(cbf->decay_stamps);
+		cbf->decay_stamps = NULL;
+	}
+
+	archbloom_counters_free(cbf->stats);
+	cbf->stats = NULL;
 }
 
 /**
@@ -147,6 +231,31 @@ bool cbloom_set_name(cbloomfilter *cbf, const char *name) {
 	return true;
 }
 
+/**
+ * @brief Select the hash strategy used by a counting Bloom filter.
+ *
+ * Filters default to HASH_MMH3. HASH_WYHASH and HASH_FIXED are
+ * considerably cheaper on short keys. The strategy is saved with the
+ * filter.
+ *
+ * @param cbf Pointer to an empty counting Bloom filter.
+ * @param strategy Hash strategy to use.
+ *
+ * @return `true` on success.
+ * @return `false` if the strategy is unknown, or elements have already
+ *         been added to the filter.
+ */
+bool cbloom_set_hash(cbloomfilter *cbf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) ||
+		bitops_nonzero_bytes(cbf->countermap, cbf->countermap_size) != 0) {
+		return false;
+	}
+
+	cbf->hash = strategy;
+
+	return true;
+}
+
 /**
  * @brief Retrieve the name of the counting Bloom filter.
  *
@@ -164,78 +273,824 @@ const char *cbloom_get_name(cbloomfilter *cbf) {
 	return cbf->name;
 }
 
-/* get_counter, set_counter, inc_counter_amount, dec_counter_amount,
- *     inc_counter, dec_counter -- helper functions used to handle
- *     different sized counters.
+/**
+ * @brief Helper function to map a hash onto a counter index,
+ * according to the filter's CBLOOM_FLAG_* options.
+ *
+ * @param cbf Counting Bloom filter.
+ * @param hash Hash of an element.
+ *
+ * @return Counter index in the range [0, cbf->size).
+ */
+static inline uint64_t hash_position(const cbloomfilter *cbf, const uint64_t hash) {
+	if (cbf->flags & CBLOOM_FLAG_POW2) {
+		return hash & (cbf->size - 1);
+	}
+
+	if (cbf->flags & CBLOOM_FLAG_FASTRANGE) {
+		return fastrange64(hash, cbf->size);
+	}
+
+	return hash % cbf->size;
+}
+
+/* POSITION(i) -- counter position of probe i of `hash` in `cbf`.
+ */
+#define POSITION(i) hash_position(cbf, hash_probe(hash, (i)))
+
+/* Counter operations, one set per counter width. The width of a
+ * filter's counters is fixed when it is created, so rather than
+ * switching on cbf->csize for every counter touched, each function
+ * below looks up the set for its width once (see counter_ops()) and
+ * works on all of an element's counters, or sweeps every counter in
+ * the filter. The sweeps have no branches in their loop bodies so the
+ * compiler can vectorize them.
+ *
+ * Element operations take the element's hash_128() and generate each
+ * counter position as they reach it with hash_probe() and
+ * hash_position(), so a lookup stops at the first zero counter without
+ * computing the rest, and nothing is allocated per call. Increments
+ * saturate at the largest value a counter can hold and decrements stop
+ * at zero.
+ */
+typedef struct {
+	uint64_t (*min)(const cbloomfilter *cbf, const uint64_t *hash);
+	uint64_t (*max)(const cbloomfilter *cbf, const uint64_t *hash);
+	bool     (*lookup)(const cbloomfilter *cbf, const uint64_t *hash);
+	void     (*add)(cbloomfilter *cbf, const uint64_t *hash);
+	bool     (*lookup_or_add)(cbloomfilter *cbf, const uint64_t *hash);
+	void     (*remove)(cbloomfilter *cbf, const uint64_t *hash);
+	void     (*clear)(cbloomfilter *cbf, const uint64_t *hash);
+	void     (*linear_decay)(void *map, const size_t counters, const uint64_t amount);
+	void     (*exponential_decay)(void *map, const size_t counters, const float factor);
+	size_t   (*count_above)(const void *map, const size_t counters, const uint64_t threshold);
+	uint64_t (*sum)(const void *map, const size_t counters);
+	void     (*fold)(void *map, const size_t counters, const bool adjacent);
+} counter_ops_t;
+
+/* COUNTER_OPS(bits) -- define the counter operations for counters
+ *     stored in whole uint<bits>_t words.
+ */
+#define COUNTER_OPS(bits)                                                     \
+static uint64_t min_##bits(const cbloomfilter *cbf, const uint64_t *hash) {   \
+	const uint##bits##_t *counters = cbf->countermap;                         \
+	uint64_t              result   = UINT64_MAX;                              \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		uint64_t value = counters[POSITION(i)];                               \
+		result = (value < result) ? value : result;                           \
+	}                                                                         \
+	return result;                                                            \
+}                                                                             \
+                                                                              \
+static uint64_t max_##bits(const cbloomfilter *cbf, const uint64_t *hash) {   \
+	const uint##bits##_t *counters = cbf->countermap;                         \
+	uint64_t              result   = 0;                                       \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		uint64_t value = counters[POSITION(i)];                               \
+		result = (value > result) ? value : result;                           \
+	}                                                                         \
+	return result;                                                            \
+}                                                                             \
+                                                                              \
+static bool lookup_##bits(const cbloomfilter *cbf, const uint64_t *hash) {    \
+	const uint##bits##_t *counters = cbf->countermap;                         \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		if (counters[POSITION(i)] == 0) {                                     \
+			return false;                                                     \
+		}                                                                     \
+	}                                                                         \
+	return true;                                                              \
+}                                                                             \
+                                                                              \
+static void add_##bits(cbloomfilter *cbf, const uint64_t *hash) {             \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		uint64_t       position = POSITION(i);                                \
+		uint##bits##_t value    = counters[position];                         \
+		counters[position] = value + (value != UINT##bits##_MAX);             \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static bool lookup_or_add_##bits(cbloomfilter *cbf, const uint64_t *hash) {   \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	bool            present  = true;                                          \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		uint64_t       position = POSITION(i);                                \
+		uint##bits##_t value    = counters[position];                         \
+		present &= (value != 0);                                              \
+		counters[position] = value + (value != UINT##bits##_MAX);             \
+	}                                                                         \
+	return present;                                                           \
+}                                                                             \
+                                                                              \
+static void remove_##bits(cbloomfilter *cbf, const uint64_t *hash) {          \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	if (!lookup_##bits(cbf, hash)) {                                          \
+		return;                                                               \
+	}                                                                         \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		uint64_t       position = POSITION(i);                                \
+		uint##bits##_t value    = counters[position];                         \
+		counters[position] = value - (value != 0);                            \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static void clear_##bits(cbloomfilter *cbf, const uint64_t *hash) {           \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		counters[POSITION(i)] = 0;                                            \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static void linear_decay_##bits(void *map, const size_t size,                 \
+                                const uint64_t amount) {                      \
+	uint##bits##_t       *counters = map;                                     \
+	const uint##bits##_t  decay    = (amount > UINT##bits##_MAX) ?            \
+		UINT##bits##_MAX : amount;                                            \
+	for (size_t i = 0; i < size; i++) {                                       \
+		counters[i] = (counters[i] > decay) ? counters[i] - decay : 0;        \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static void exponential_decay_##bits(void *map, const size_t size,            \
+                                     const float factor) {                    \
+	uint##bits##_t *counters = map;                                           \
+	for (size_t i = 0; i < size; i++) {                                       \
+		float value = counters[i] * factor;                                   \
+		counters[i] = (value >= (float)UINT##bits##_MAX) ?                    \
+			UINT##bits##_MAX : (uint##bits##_t)value;                         \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static size_t count_above_##bits(const void *map, const size_t size,          \
+                                 const uint64_t threshold) {                  \
+	const uint##bits##_t *counters = map;                                     \
+	size_t                count    = 0;                                       \
+	if (threshold >= UINT##bits##_MAX) {                                      \
+		return 0;                                                             \
+	}                                                                         \
+	for (size_t i = 0; i < size; i++) {                                       \
+		count += (counters[i] > (uint##bits##_t)threshold);                   \
+	}                                                                         \
+	return count;                                                             \
+}                                                                             \
+                                                                              \
+static uint64_t sum_##bits(const void *map, const size_t size) {              \
+	const uint##bits##_t *counters = map;                                     \
+	uint64_t              total    = 0;                                       \
+	for (size_t i = 0; i < size; i++) {                                       \
+		total += counters[i];                                                 \
+	}                                                                         \
+	return total;                                                             \
+}                                                                             \
+                                                                              \
+static void fold_##bits(void *map, const size_t size, const bool adjacent) {  \
+	uint##bits##_t *counters = map;                                           \
+	for (size_t i = 0; i < size; i++) {                                       \
+		uint##bits##_t a = counters[adjacent ? 2 * i : i];                    \
+		uint##bits##_t b = counters[adjacent ? 2 * i + 1 : i + size];         \
+		counters[i] = (a > UINT##bits##_MAX - b) ? UINT##bits##_MAX : a + b;  \
+	}                                                                         \
+}
+
+COUNTER_OPS(8)
+COUNTER_OPS(16)
+COUNTER_OPS(32)
+COUNTER_OPS(64)
+
+/* 4 bit counters are packed two to a byte: even positions in the low
+ * nibble and odd positions in the high nibble. The sweeps work on both
+ * nibbles of a byte at once. The unused high nibble of an odd sized
+ * filter is always 0 and stays 0.
+ */
+static inline uint8_t get_4(const uint8_t *counters, const uint64_t position) {
+	uint8_t byte = counters[position / 2];
+	return (position % 2 == 0) ? (byte & 0x0f) : (byte >> 4);
+}
+
+static inline void set_4(uint8_t *counters, const uint64_t position, const uint8_t value) {
+	uint8_t *byte = &counters[position / 2];
+	if (position % 2 == 0) {
+		*byte = (*byte & 0xf0) | value; // lower nibble
+	} else {
+		*byte = (*byte & 0x0f) | (value << 4); // upper nibble
+	}
+}
+
+static uint64_t min_4(const cbloomfilter *cbf, const uint64_t *hash) {
+	uint64_t result = UINT64_MAX;
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t value = get_4(cbf->countermap, POSITION(i));
+		result = (value < result) ? value : result;
+	}
+
+	return result;
+}
+
+static uint64_t max_4(const cbloomfilter *cbf, const uint64_t *hash) {
+	uint64_t result = 0;
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t value = get_4(cbf->countermap, POSITION(i));
+		result = (value > result) ? value : result;
+	}
+
+	return result;
+}
+
+static bool lookup_4(const cbloomfilter *cbf, const uint64_t *hash) {
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		if (get_4(cbf->countermap, POSITION(i)) == 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void add_4(cbloomfilter *cbf, const uint64_t *hash) {
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t position = POSITION(i);
+		uint8_t  value    = get_4(cbf->countermap, position);
+		set_4(cbf->countermap, position, value + (value != 15)); // 4 bit max is 15
+	}
+}
+
+static bool lookup_or_add_4(cbloomfilter *cbf, const uint64_t *hash) {
+	bool present = true;
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t position = POSITION(i);
+		uint8_t  value    = get_4(cbf->countermap, position);
+		present &= (value != 0);
+		set_4(cbf->countermap, position, value + (value != 15));
+	}
+
+	return present;
+}
+
+static void remove_4(cbloomfilter *cbf, const uint64_t *hash) {
+	if (!lookup_4(cbf, hash)) {
+		return;
+	}
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t position = POSITION(i);
+		uint8_t  value    = get_4(cbf->countermap, position);
+		set_4(cbf->countermap, position, value - (value != 0));
+	}
+}
+
+static void clear_4(cbloomfilter *cbf, const uint64_t *hash) {
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		set_4(cbf->countermap, POSITION(i), 0);
+	}
+}
+
+static void linear_decay_4(void *map, const size_t size, const uint64_t amount) {
+	uint8_t       *bytes = map;
+	const uint8_t  decay = (amount > 15) ? 15 : amount;
+
+	for (size_t i = 0; i < (size + 1) / 2; i++) {
+		uint8_t low  = bytes[i] & 0x0f;
+		uint8_t high = bytes[i] >> 4;
+
+		low  = (low > decay)  ? low - decay  : 0;
+		high = (high > decay) ? high - decay : 0;
+		bytes[i] = low | (high << 4);
+	}
+}
+
+static void exponential_decay_4(void *map, const size_t size, const float factor) {
+	uint8_t *bytes = map;
+
+	for (size_t i = 0; i < (size + 1) / 2; i++) {
+		uint8_t low  = (uint8_t)((bytes[i] & 0x0f) * factor);
+		uint8_t high = (uint8_t)((bytes[i] >> 4) * factor);
+
+		bytes[i] = low | (high << 4);
+	}
+}
+
+static size_t count_above_4(const void *map, const size_t size, const uint64_t threshold) {
+	const uint8_t *bytes = map;
+	size_t         count = 0;
+
+	if (threshold >= 15) {
+		return 0;
+	}
+
+	for (size_t i = 0; i < (size + 1) / 2; i++) {
+		count += ((bytes[i] & 0x0f) > threshold) + ((bytes[i] >> 4) > threshold);
+	}
+
+	return count;
+}
+
+static uint64_t sum_4(const void *map, const size_t size) {
+	const uint8_t *bytes = map;
+	uint64_t       total = 0;
+
+	for (size_t i = 0; i < (size + 1) / 2; i++) {
+		total += (bytes[i] & 0x0f) + (bytes[i] >> 4);
+	}
+
+	return total;
+}
+
+/* an odd sized result leaves a stale counter in the unused high nibble
+ * of the last byte, which must be 0.
+ */
+static void fold_4(void *map, const size_t size, const bool adjacent) {
+	for (size_t i = 0; i < size; i++) {
+		uint8_t a = get_4(map, adjacent ? 2 * i : i);
+		uint8_t b = get_4(map, adjacent ? 2 * i + 1 : i + size);
+		set_4(map, i, (a + b > 15) ? 15 : a + b);
+	}
+
+	if (size % 2 != 0) {
+		set_4(map, size, 0);
+	}
+}
+
+/* Counter operations for CBLOOM_FLAG_CONCURRENT filters. Every update
+ * is a compare and swap loop, retried if another thread changed the
+ * counter in between, so saturation and the stop at zero hold no
+ * matter how updates interleave. Unchanged counters aren't written, so
+ * decaying a mostly empty filter doesn't fight writers for cache
+ * lines. 64 bit counters can't realistically saturate, so they are
+ * incremented with a single fetch and add. The read only sweeps and
+ * folding are shared with the plain operations.
+ */
+#define CONCURRENT_INCREMENT_8(counter)  concurrent_increment_8(counter)
+#define CONCURRENT_INCREMENT_16(counter) concurrent_increment_16(counter)
+#define CONCURRENT_INCREMENT_32(counter) concurrent_increment_32(counter)
+#define CONCURRENT_INCREMENT_64(counter) \
+	__atomic_fetch_add((counter), 1, __ATOMIC_RELAXED)
+
+#define CONCURRENT_COUNTER_OPS(bits)                                          \
+static inline uint##bits##_t concurrent_increment_##bits(uint##bits##_t *counter) { \
+	uint##bits##_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);        \
+	while (value != UINT##bits##_MAX &&                                       \
+	       !__atomic_compare_exchange_n(counter, &value, value + 1, true,     \
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {  \
+	}                                                                         \
+	return value;                                                             \
+}                                                                             \
+                                                                              \
+static inline void concurrent_decrement_##bits(uint##bits##_t *counter) {     \
+	uint##bits##_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);        \
+	while (value != 0 &&                                                      \
+	       !__atomic_compare_exchange_n(counter, &value, value - 1, true,     \
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {  \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static uint64_t concurrent_min_##bits(const cbloomfilter *cbf, const uint64_t *hash) { \
+	const uint##bits##_t *counters = cbf->countermap;                         \
+	uint64_t              result   = UINT64_MAX;                              \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		uint64_t value = __atomic_load_n(&counters[POSITION(i)], __ATOMIC_RELAXED); \
+		result = (value < result) ? value : result;                           \
+	}                                                                         \
+	return result;                                                            \
+}                                                                             \
+                                                                              \
+static uint64_t concurrent_max_##bits(const cbloomfilter *cbf, const uint64_t *hash) { \
+	const uint##bits##_t *counters = cbf->countermap;                         \
+	uint64_t              result   = 0;                                       \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		uint64_t value = __atomic_load_n(&counters[POSITION(i)], __ATOMIC_RELAXED); \
+		result = (value > result) ? value : result;                           \
+	}                                                                         \
+	return result;                                                            \
+}                                                                             \
+                                                                              \
+static bool concurrent_lookup_##bits(const cbloomfilter *cbf, const uint64_t *hash) { \
+	const uint##bits##_t *counters = cbf->countermap;                         \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		if (__atomic_load_n(&counters[POSITION(i)], __ATOMIC_RELAXED) == 0) { \
+			return false;                                                     \
+		}                                                                     \
+	}                                                                         \
+	return true;                                                              \
+}                                                                             \
+                                                                              \
+static void concurrent_add_##bits(cbloomfilter *cbf, const uint64_t *hash) {  \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		CONCURRENT_INCREMENT_##bits(&counters[POSITION(i)]);                  \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static bool concurrent_lookup_or_add_##bits(cbloomfilter *cbf, const uint64_t *hash) { \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	bool            present  = true;                                          \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		present &= (CONCURRENT_INCREMENT_##bits(&counters[POSITION(i)]) != 0); \
+	}                                                                         \
+	return present;                                                           \
+}                                                                             \
+                                                                              \
+static void concurrent_remove_##bits(cbloomfilter *cbf, const uint64_t *hash) { \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	if (!concurrent_lookup_##bits(cbf, hash)) {                               \
+		return;                                                               \
+	}                                                                         \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		concurrent_decrement_##bits(&counters[POSITION(i)]);                  \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static void concurrent_clear_##bits(cbloomfilter *cbf, const uint64_t *hash) { \
+	uint##bits##_t *counters = cbf->countermap;                               \
+	for (size_t i = 0; i < cbf->hashcount; i++) {                             \
+		__atomic_store_n(&counters[POSITION(i)], 0, __ATOMIC_RELAXED);        \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static void concurrent_linear_decay_##bits(void *map, const size_t size,      \
+                                           const uint64_t amount) {           \
+	uint##bits##_t       *counters = map;                                     \
+	const uint##bits##_t  decay    = (amount > UINT##bits##_MAX) ?            \
+		UINT##bits##_MAX : amount;                                            \
+	for (size_t i = 0; i < size; i++) {                                       \
+		uint##bits##_t value = __atomic_load_n(&counters[i], __ATOMIC_RELAXED); \
+		while (value != 0 &&                                                  \
+		       !__atomic_compare_exchange_n(&counters[i], &value,             \
+		                                    (value > decay) ? value - decay : 0, \
+		                                    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { \
+		}                                                                     \
+	}                                                                         \
+}                                                                             \
+                                                                              \
+static void concurrent_exponential_decay_##bits(void *map, const size_t size, \
+                                                const float factor) {         \
+	uint##bits##_t *counters = map;                                           \
+	for (size_t i = 0; i < size; i++) {                                       \
+		uint##bits##_t value = __atomic_load_n(&counters[i], __ATOMIC_RELAXED); \
+		while (value != 0) {                                                  \
+			float          decayed = value * factor;                          \
+			uint##bits##_t result  = (decayed >= (float)UINT##bits##_MAX) ?   \
+				UINT##bits##_MAX : (uint##bits##_t)decayed;                   \
+			if (result == value ||                                            \
+			    __atomic_compare_exchange_n(&counters[i], &value, result, true, \
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) { \
+				break;                                                        \
+			}                                                                 \
+		}                                                                     \
+	}                                                                         \
+}
+
+CONCURRENT_COUNTER_OPS(8)
+CONCURRENT_COUNTER_OPS(16)
+CONCURRENT_COUNTER_OPS(32)
+CONCURRENT_COUNTER_OPS(64)
+
+/* Concurrent 4 bit counters swap the whole byte holding them, so a
+ * thread updating one nibble never undoes a change to the other.
+ */
+static inline uint8_t load_4(const uint8_t *counters, const uint64_t position) {
+	uint8_t byte = __atomic_load_n(&counters[position / 2], __ATOMIC_RELAXED);
+	return (position % 2 == 0) ? (byte & 0x0f) : (byte >> 4);
+}
+
+/* update_4 -- add `delta`, 1 or -1, to the counter at `position`
+ *     unless it is already at `limit`. Returns its previous value.
+ */
+static inline uint8_t update_4(uint8_t *counters, const uint64_t position, const int delta, const uint8_t limit) {
+	uint8_t      *byte  = &counters[position / 2];
+	const int     shift = (position % 2) * 4;
+	uint8_t       old   = __atomic_load_n(byte, __ATOMIC_RELAXED);
+
+	while (((old >> shift) & 0x0f) != limit &&
+	       !__atomic_compare_exchange_n(byte, &old, (uint8_t)(old + delta * (1 << shift)), true,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	}
+
+	return (old >> shift) & 0x0f;
+}
+
+static uint64_t concurrent_min_4(const cbloomfilter *cbf, const uint64_t *hash) {
+	uint64_t result = UINT64_MAX;
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t value = load_4(cbf->countermap, POSITION(i));
+		result = (value < result) ? value : result;
+	}
+
+	return result;
+}
+
+static uint64_t concurrent_max_4(const cbloomfilter *cbf, const uint64_t *hash) {
+	uint64_t result = 0;
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t value = load_4(cbf->countermap, POSITION(i));
+		result = (value > result) ? value : result;
+	}
+
+	return result;
+}
+
+static bool concurrent_lookup_4(const cbloomfilter *cbf, const uint64_t *hash) {
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		if (load_4(cbf->countermap, POSITION(i)) == 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void concurrent_add_4(cbloomfilter *cbf, const uint64_t *hash) {
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		update_4(cbf->countermap, POSITION(i), 1, 15);
+	}
+}
+
+static bool concurrent_lookup_or_add_4(cbloomfilter *cbf, const uint64_t *hash) {
+	bool present = true;
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		present &= (update_4(cbf->countermap, POSITION(i), 1, 15) != 0);
+	}
+
+	return present;
+}
+
+static void concurrent_remove_4(cbloomfilter *cbf, const uint64_t *hash) {
+	if (!concurrent_lookup_4(cbf, hash)) {
+		return;
+	}
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		update_4(cbf->countermap, POSITION(i), -1, 0);
+	}
+}
+
+static void concurrent_clear_4(cbloomfilter *cbf, const uint64_t *hash) {
+	uint8_t *counters = cbf->countermap;
+
+	for (size_t i = 0; i < cbf->hashcount; i++) {
+		uint64_t position = POSITION(i);
+		uint8_t  keep     = (position % 2 == 0) ? 0xf0 : 0x0f;
+
+		__atomic_fetch_and(&counters[position / 2], keep, __ATOMIC_RELAXED);
+	}
+}
+
+static void concurrent_linear_decay_4(void *map, const size_t size, const uint64_t amount) {
+	uint8_t       *bytes = map;
+	const uint8_t  decay = (amount > 15) ? 15 : amount;
+
+	for (size_t i = 0; i < (size + 1) / 2; i++) {
+		uint8_t old = __atomic_load_n(&bytes[i], __ATOMIC_RELAXED);
+
+		while (old != 0) {
+			uint8_t low  = old & 0x0f;
+			uint8_t high = old >> 4;
+
+			low  = (low > decay)  ? low - decay  : 0;
+			high = (high > decay) ? high - decay : 0;
+			if (__atomic_compare_exchange_n(&bytes[i], &old, low | (high << 4), true,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+	}
+}
+
+static void concurrent_exponential_decay_4(void *map, const size_t size, const float factor) {
+	uint8_t *bytes = map;
+
+	for (size_t i = 0; i < (size + 1) / 2; i++) {
+		uint8_t old = __atomic_load_n(&bytes[i], __ATOMIC_RELAXED);
+
+		while (old != 0) {
+			uint8_t low  = (uint8_t)((old & 0x0f) * factor);
+			uint8_t high = (uint8_t)((old >> 4) * factor);
+			uint8_t byte = low | (high << 4);
+
+			if (byte == old ||
+			    __atomic_compare_exchange_n(&bytes[i], &old, byte, true,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+	}
+}
+
+#undef POSITION
+
+#define COUNTER_OPS_ENTRY(bits)	{						\
+		min_##bits, max_##bits, lookup_##bits, add_##bits,	\
+		lookup_or_add_##bits, remove_##bits, clear_##bits,	\
+		linear_decay_##bits, exponential_decay_##bits,		\
+		count_above_##bits, sum_##bits, fold_##bits		\
+	}
+
+#define CONCURRENT_COUNTER_OPS_ENTRY(bits) {					\
+		concurrent_min_##bits, concurrent_max_##bits,			\
+		concurrent_lookup_##bits, concurrent_add_##bits,		\
+		concurrent_lookup_or_add_##bits, concurrent_remove_##bits,	\
+		concurrent_clear_##bits, concurrent_linear_decay_##bits,	\
+		concurrent_exponential_decay_##bits,				\
+		count_above_##bits, sum_##bits, fold_##bits			\
+	}
+
+static const counter_ops_t counter_ops_table[] = {
+	[COUNTER_4BIT]  = COUNTER_OPS_ENTRY(4),
+	[COUNTER_8BIT]  = COUNTER_OPS_ENTRY(8),
+	[COUNTER_16BIT] = COUNTER_OPS_ENTRY(16),
+	[COUNTER_32BIT] = COUNTER_OPS_ENTRY(32),
+	[COUNTER_64BIT] = COUNTER_OPS_ENTRY(64),
+};
+
+static const counter_ops_t concurrent_counter_ops_table[] = {
+	[COUNTER_4BIT]  = CONCURRENT_COUNTER_OPS_ENTRY(4),
+	[COUNTER_8BIT]  = CONCURRENT_COUNTER_OPS_ENTRY(8),
+	[COUNTER_16BIT] = CONCURRENT_COUNTER_OPS_ENTRY(16),
+	[COUNTER_32BIT] = CONCURRENT_COUNTER_OPS_ENTRY(32),
+	[COUNTER_64BIT] = CONCURRENT_COUNTER_OPS_ENTRY(64),
+};
+
+/* counter_ops -- counter operations for a filter's counter width and
+ *     CBLOOM_FLAG_CONCURRENT. csize is validated when a filter is
+ *     created or loaded.
+ */
+static inline const counter_ops_t *counter_ops(const cbloomfilter *cbf) {
+	if (cbf->flags & CBLOOM_FLAG_CONCURRENT) {
+		return &concurrent_counter_ops_table[cbf->csize];
+	}
+
+	return &counter_ops_table[cbf->csize];
+}
+
+/* counter_address -- address of the byte(s) holding a counter. Used to
+ *     prefetch counters in the batch functions.
  */
-static inline uint64_t get_counter(const cbloomfilter *cbf, uint64_t position) {
+static inline const void *counter_address(const cbloomfilter *cbf, uint64_t position) {
 	switch (cbf->csize) {
-	case COUNTER_4BIT: {
-		uint8_t byte = ((uint8_t *)cbf->countermap)[position / 2];
-		return (position % 2 == 0) ? (byte & 0x0f) : (byte >> 4);
-	}
-	case COUNTER_8BIT:	return  ((uint8_t *)cbf->countermap)[position];
-	case COUNTER_16BIT:	return ((uint16_t *)cbf->countermap)[position];
-	case COUNTER_32BIT:	return ((uint32_t *)cbf->countermap)[position];
-	case COUNTER_64BIT:	return ((uint64_t *)cbf->countermap)[position];
+	case COUNTER_4BIT:  return  (uint8_t *)cbf->countermap + (position / 2);
+	case COUNTER_8BIT:  return  (uint8_t *)cbf->countermap + position;
+	case COUNTER_16BIT: return (uint16_t *)cbf->countermap + position;
+	case COUNTER_32BIT: return (uint32_t *)cbf->countermap + position;
+	case COUNTER_64BIT: return (uint64_t *)cbf->countermap + position;
 	default:
-		return 0; // shouldn't get here
+		return cbf->countermap; // shouldn't get here
 	}
 }
 
-static inline void set_counter(const cbloomfilter *cbf, uint64_t position, uint64_t value) {
-	switch (cbf->csize) {
-	case COUNTER_4BIT: {
-		uint8_t *byte = &((uint8_t *)cbf->countermap)[position / 2];
-		value = (value > 15) ? 15 : value; // 4 bit max is 15
-		if (position % 2 == 0) {
-			*byte = (*byte & 0xf0) | value; // lower nibble
-		} else {
-			*byte = (*byte & 0x0f) | (value << 4); // upper nibble
+/* block_counters -- counters in each CBLOOM_DECAY_BLOCK_SIZE block.
+ */
+static inline uint64_t block_counters(const cbloomfilter *cbf) {
+	if (cbf->csize == COUNTER_4BIT) {
+		return CBLOOM_DECAY_BLOCK_SIZE * 2;
+	}
+
+	return CBLOOM_DECAY_BLOCK_SIZE / countermap_bytes(cbf->csize, 1);
+}
+
+/* decay_blocks -- number of decay stamps a filter needs.
+ */
+static inline uint64_t decay_blocks(const cbloomfilter *cbf) {
+	return (cbf->size + block_counters(cbf) - 1) / block_counters(cbf);
+}
+
+/* settle_block -- apply the lazy linear decay a block of counters
+ *     hasn't seen yet. Concurrent filters claim the block by swapping
+ *     its stamp first, so each amount of decay is applied once; other
+ *     threads reading the block meanwhile see it slightly undecayed.
+ */
+static void settle_block(const cbloomfilter *cbf, const uint64_t block) {
+	uint64_t per_block = block_counters(cbf);
+	uint64_t first     = block * per_block;
+	uint64_t total, stamp;
+
+	if (cbf->flags & CBLOOM_FLAG_CONCURRENT) {
+		total = __atomic_load_n(&cbf->decay_total, __ATOMIC_RELAXED);
+		stamp = __atomic_load_n(&cbf->decay_stamps[block], __ATOMIC_RELAXED);
+		if (stamp == total ||
+			!__atomic_compare_exchange_n(&cbf->decay_stamps[block], &stamp, total, false,
+										 __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			return;
 		}
-		break;
+	} else {
+		total = cbf->decay_total;
+		stamp = cbf->decay_stamps[block];
+		if (stamp == total) {
+			return;
+		}
+		cbf->decay_stamps[block] = total;
 	}
-	case COUNTER_8BIT:
-		((uint8_t *)cbf->countermap)[position] =
-			(value > UINT8_MAX) ? UINT8_MAX : (uint8_t)value;
-		break;
-	case COUNTER_16BIT:
-		((uint16_t *)cbf->countermap)[position] =
-			(value > UINT16_MAX) ? UINT16_MAX : (uint16_t)value;
-		break;
-	case COUNTER_32BIT:
-		((uint32_t *)cbf->countermap)[position] =
-			(value > UINT32_MAX) ? UINT32_MAX : (uint32_t)value;
-		break;
-	case COUNTER_64BIT:
-		((uint64_t *)cbf->countermap)[position] = value; // size check unneeded
-		break;
-	default:
-		return; // shouldn't get here
+
+	counter_ops(cbf)->linear_decay((void *)((uint8_t *)cbf->countermap + block * CBLOOM_DECAY_BLOCK_SIZE),
+								   (cbf->size - first < per_block) ? cbf->size - first : per_block,
+								   total - stamp);
+}
+
+/* settle_range -- settle every block holding counters
+ *     [first, first + count).
+ */
+static void settle_range(const cbloomfilter *cbf, const uint64_t first, const uint64_t count) {
+	if (cbf->decay_stamps == NULL || count == 0) {
+		return;
+	}
+
+	for (uint64_t block = first / block_counters(cbf);
+		 block <= (first + count - 1) / block_counters(cbf);
+		 block++) {
+		settle_block(cbf, block);
 	}
 }
 
-static void inc_counter_amount(cbloomfilter *cbf, uint64_t position, uint64_t amount) {
-	uint64_t counter_value = get_counter(cbf, position);
-	set_counter(cbf, position, counter_value + amount);
+/* settle_all -- settle every block before sweeping all counters.
+ */
+static inline void settle_all(const cbloomfilter *cbf) {
+	settle_range(cbf, 0, cbf->size);
 }
 
-static void inc_counter(cbloomfilter *cbf, uint64_t position) {
-	inc_counter_amount(cbf, position, 1);
+/* element_ops -- counter_ops() for an operation on the element with
+ *     hash `hash`, after settling the blocks holding its counters.
+ */
+static inline const counter_ops_t *element_ops(const cbloomfilter *cbf, const uint64_t *hash) {
+	if (cbf->decay_stamps != NULL) {
+		for (uint64_t i = 0; i < cbf->hashcount; i++) {
+			settle_block(cbf, hash_position(cbf, hash_probe(hash, i)) / block_counters(cbf));
+		}
+	}
+
+	return counter_ops(cbf);
+}
+
+/* counter_max -- the largest value a counter of `cbf` holds.
+ */
+static inline uint64_t counter_max(const cbloomfilter *cbf) {
+	switch (cbf->csize) {
+	case COUNTER_4BIT:  return 15;
+	case COUNTER_8BIT:  return UINT8_MAX;
+	case COUNTER_16BIT: return UINT16_MAX;
+	case COUNTER_32BIT: return UINT32_MAX;
+	default:            return UINT64_MAX;
+	}
 }
 
-static void dec_counter_amount(cbloomfilter *cbf, uint64_t position, uint64_t amount) {
-	uint64_t counter_value = get_counter(cbf, position);
+/* count -- add `n` to statistic `stat` of `cbf`. See stats.h.
+ */
+static inline void count(const cbloomfilter *cbf, const archbloom_stat stat, const uint64_t n) {
+	archbloom_count(cbf->stats, cbf->flags & CBLOOM_FLAG_CONCURRENT, stat, n);
+}
 
-	if (counter_value <= amount) {
-		set_counter(cbf, position, 0);
-	} else {
-		set_counter(cbf, position, counter_value - amount);
+/* count_saturation -- count the increments an add of the element with
+ *     hash `hash` is about to lose: the add saturates if any of its
+ *     counters is already at its largest value. Only libraries keeping
+ *     statistics pay for the extra pass over the counters.
+ */
+static inline void count_saturation(const cbloomfilter *cbf, const counter_ops_t *ops, const uint64_t *hash) {
+#ifdef ARCHBLOOM_STATS
+	if (cbf->stats != NULL && ops->max(cbf, hash) == counter_max(cbf)) {
+		count(cbf, ARCHBLOOM_STAT_SATURATIONS, 1);
 	}
+#else
+	(void)cbf;
+	(void)ops;
+	(void)hash;
+#endif
+}
+
+/* lookup_element, add_element, lookup_or_add_element -- the element
+ *     operations behind the public functions, counting statistics.
+ */
+static inline bool lookup_element(const cbloomfilter *cbf, const uint64_t *hash) {
+	bool found = element_ops(cbf, hash)->lookup(cbf, hash);
+
+	count(cbf, ARCHBLOOM_STAT_LOOKUPS, 1);
+	count(cbf, ARCHBLOOM_STAT_HITS, found);
+
+	return found;
 }
 
-static void dec_counter(cbloomfilter *cbf, uint64_t position) {
-	dec_counter_amount(cbf, position, 1);
+static inline void add_element(cbloomfilter *cbf, const uint64_t *hash) {
+	const counter_ops_t *ops = element_ops(cbf, hash);
+
+	count_saturation(cbf, ops, hash);
+	ops->add(cbf, hash);
+	count(cbf, ARCHBLOOM_STAT_ADDS, 1);
+}
+
+static inline bool lookup_or_add_element(cbloomfilter *cbf, const uint64_t *hash) {
+	const counter_ops_t *ops = element_ops(cbf, hash);
+	bool                 found;
+
+	// the counters are incremented whether or not the element is found
+	count_saturation(cbf, ops, hash);
+	found = ops->lookup_or_add(cbf, hash);
+	count(cbf, ARCHBLOOM_STAT_LOOKUPS, 1);
+	count(cbf, found ? ARCHBLOOM_STAT_HITS : ARCHBLOOM_STAT_ADDS, 1);
+
+	return found;
 }
 
 /**
@@ -255,22 +1110,11 @@ static void dec_counter(cbloomfilter *cbf, uint64_t position) {
  * element in the filter.
  */
 size_t cbloom_count(const cbloomfilter *cbf, void *element, size_t len) {
-	uint64_t hashes[cbf->hashcount];
-	uint64_t position;
-	uint64_t count = UINT64_MAX;
+	uint64_t hash[2];
 
-	mmh3_64_make_hashes(element, len, cbf->hashcount, hashes);
+	hash_128(cbf->hash, element, len, hash);
 
-	for (int i = 0; i < cbf->hashcount; i++) {
-		position = hashes[i] % cbf->size;
-
-		uint64_t current_count = get_counter(cbf, position);
-		if (current_count < count) {
-			count = current_count;
-		}
-	}
-
-	return count;
+	return element_ops(cbf, hash)->min(cbf, hash);
 }
 
 /**
@@ -308,14 +1152,9 @@ size_t cbloom_count_string(const cbloomfilter *cbf, char *element) {
  *         the threshold.
  */
 size_t cbloom_count_elements_above_threshold(const cbloomfilter *cbf, uint64_t threshold) {
-    size_t count        = 0;
+    settle_all(cbf);
 
-    for (size_t i = 0; i < cbf->size; i++) {
-        uint64_t counter_value = get_counter(cbf, i);
-        if (counter_value > threshold) {
-            count++;
-        }
-    }
+    size_t count = counter_ops(cbf)->count_above(cbf->countermap, cbf->size, threshold);
 
     return count / cbf->hashcount;
 }
@@ -335,16 +1174,11 @@ size_t cbloom_count_elements_above_threshold(const cbloomfilter *cbf, uint64_t t
  *         counters are set, returns 0.0.
  */
 float cbloom_get_average_count(cbloomfilter *cbf) {
-    uint64_t total_count       = 0;
-    size_t   non_zero_counters = 0;
-
-    for (size_t i = 0; i < cbf->size; i++) {
-        uint64_t counter_value = get_counter(cbf, i);
-        if (counter_value > 0) {
-            total_count += counter_value;
-            non_zero_counters++;
-        }
-    }
+    settle_all(cbf);
+
+    const counter_ops_t *ops               = counter_ops(cbf);
+    uint64_t             total_count       = ops->sum(cbf->countermap, cbf->size);
+    size_t               non_zero_counters = ops->count_above(cbf->countermap, cbf->size, 0);
 
     if (non_zero_counters == 0) {
         return 0.0;
@@ -370,20 +1204,11 @@ float cbloom_get_average_count(cbloomfilter *cbf) {
  * @return `false` if the element is definitely not in the filter.
  */
 bool cbloom_lookup(const cbloomfilter *cbf, void *element, const size_t len) {
-	uint64_t hashes[cbf->hashcount];
-	uint64_t position;
-
-	mmh3_64_make_hashes(element, len, cbf->hashcount, hashes);
+	uint64_t hash[2];
 
-	for (int i = 0; i < cbf->hashcount; i++) {
-		position = hashes[i] % cbf->size;
+	hash_128(cbf->hash, element, len, hash);
 
-		if (get_counter(cbf, position) == 0) {
-			return false; // element is definitely not in the filter
-		}
-	}
-
-	return true;
+	return lookup_element(cbf, hash);
 }
 
 /**
@@ -401,46 +1226,183 @@ bool cbloom_lookup(const cbloomfilter *cbf, void *element, const size_t len) {
  * @return `true` if the string is likely in the filter.
  * @return `false` if the string is definitely not in the filter.
  */
-bool cbloom_lookup_string(const cbloomfilter *cbf, const char *element) {
-	return cbloom_lookup(cbf, (uint8_t *)element, strlen(element));
+bool cbloom_lookup_string(const cbloomfilter *cbf, const char *element) {
+	return cbloom_lookup(cbf, (uint8_t *)element, strlen(element));
+}
+
+/**
+ * @brief Add an element to the counting Bloom filter.
+ *
+ * This function inserts the specified element into the counting Bloom
+ * filter, updating the filter's counters to track the number of times
+ * the element has been added.
+ *
+ * @param cbf Counting Bloom filter to use.
+ * @param element Pointer to the element to add to the filter.
+ * @param len Length of the element in bytes.
+ */
+void cbloom_add(cbloomfilter *cbf, void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(cbf->hash, element, len, hash);
+
+	add_element(cbf, hash);
+}
+
+/**
+ * @brief Helper function for adding string elements to a counting
+ * Bloom filter.
+ *
+ * This function inserts the specified string into the counting Bloom
+ * filter, updating the filter's counters to track the number of times
+ * the string has been added.
+ *
+ * @param cbf Counting Bloom filter to use.
+ * @param element Pointer to the string to add to the filter.
+ */
+void cbloom_add_string(cbloomfilter *cbf, const char *element) {
+	cbloom_add(cbf, (uint8_t *)element, strlen(element));
+}
+
+/**
+ * @brief Count an element that has already been hashed.
+ *
+ * For callers that check one element against several filters with the
+ * same hash strategy: the element is hashed once with `hash_128()`
+ * and the counters in each filter come from that hash.
+ *
+ * @param cbf Counting Bloom filter to use.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return The approximate count of the element in the filter.
+ */
+size_t cbloom_count_hashed(const cbloomfilter *cbf, const uint64_t *hash) {
+	return element_ops(cbf, hash)->min(cbf, hash);
+}
+
+/**
+ * @brief Check an element that has already been hashed. See
+ * `cbloom_count_hashed()`.
+ *
+ * @param cbf Counting Bloom filter to use.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return `true` if the element is likely in the filter.
+ * @return `false` if the element is definitely not in the filter.
+ */
+bool cbloom_lookup_hashed(const cbloomfilter *cbf, const uint64_t *hash) {
+	return lookup_element(cbf, hash);
+}
+
+/**
+ * @brief Add an element that has already been hashed. See
+ * `cbloom_count_hashed()`.
+ *
+ * @param cbf Counting Bloom filter to use.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ */
+void cbloom_add_hashed(cbloomfilter *cbf, const uint64_t *hash) {
+	add_element(cbf, hash);
+}
+
+/**
+ * @brief Number of elements hashed and prefetched at a time by the
+ * batch functions.
+ */
+#define BATCH_CHUNK 16
+
+/**
+ * @brief Helper function for the batch functions. Hash a chunk of
+ * elements and prefetch the counters that will be touched.
+ *
+ * @param cbf Counting Bloom filter.
+ * @param elements Array of pointers to elements.
+ * @param lens Array of element lengths in bytes.
+ * @param count Number of elements in this chunk.
+ * @param hashes Output array of `count` `hash_128()` pairs.
+ * @param write true if the counters will be written to.
+ */
+static void batch_hashes(const cbloomfilter *cbf,
+                         const void **elements,
+                         const size_t *lens,
+                         const size_t count,
+                         uint64_t hashes[][2],
+                         const bool write) {
+	for (size_t i = 0; i < count; i++) {
+		hash_128(cbf->hash, elements[i], lens[i], hashes[i]);
+
+		for (size_t j = 0; j < cbf->hashcount; j++) {
+			uint64_t position = hash_position(cbf, hash_probe(hashes[i], j));
+
+			if (write) {
+				__builtin_prefetch(counter_address(cbf, position), 1);
+			} else {
+				__builtin_prefetch(counter_address(cbf, position), 0);
+			}
+		}
+	}
 }
 
 /**
- * @brief Add an element to the counting Bloom filter.
+ * @brief Add a batch of elements to a counting Bloom filter.
  *
- * This function inserts the specified element into the counting Bloom
- * filter, updating the filter's counters to track the number of times
- * the element has been added.
+ * This function hashes a chunk of elements up front and prefetches
+ * every counter it is about to modify before incrementing any of
+ * them. On filters larger than the CPU cache this overlaps the cache
+ * misses of many elements rather than waiting on each one in turn.
  *
- * @param cbf Counting Bloom filter to use.
- * @param element Pointer to the element to add to the filter.
- * @param len Length of the element in bytes.
+ * @param cbf Counting Bloom filter to add elements to.
+ * @param elements Array of `count` pointers to elements.
+ * @param lens Array of `count` element lengths in bytes.
+ * @param count Number of elements to add.
  */
-void cbloom_add(cbloomfilter *cbf, void *element, const size_t len) {
-	uint64_t hashes[cbf->hashcount];
-	uint64_t position;
+void cbloom_add_batch(cbloomfilter *cbf, const void **elements, const size_t *lens, const size_t count) {
+	uint64_t hashes[BATCH_CHUNK][2];
 
-	mmh3_64_make_hashes(element, len, cbf->hashcount, hashes);
+	for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+		size_t chunk = (count - start < BATCH_CHUNK) ? count - start : BATCH_CHUNK;
 
-	for (int i = 0; i < cbf->hashcount; i++) {
-		position = hashes[i] % cbf->size;
-		inc_counter(cbf, position);
+		batch_hashes(cbf, elements + start, lens + start, chunk, hashes, true);
+
+		for (size_t i = 0; i < chunk; i++) {
+			add_element(cbf, hashes[i]);
+		}
 	}
 }
 
 /**
- * @brief Helper function for adding string elements to a counting
- * Bloom filter.
- *
- * This function inserts the specified string into the counting Bloom
- * filter, updating the filter's counters to track the number of times
- * the string has been added.
- *
- * @param cbf Counting Bloom filter to use.
- * @param element Pointer to the string to add to the filter.
+ * @brief Look up a batch of elements in a counting Bloom filter.
+ *
+ * This function is the batch equivalent of `cbloom_lookup()`. See
+ * `cbloom_add_batch()` for details.
+ *
+ * @param cbf Counting Bloom filter to perform look ups against.
+ * @param elements Array of `count` pointers to elements.
+ * @param lens Array of `count` element lengths in bytes.
+ * @param count Number of elements to look up.
+ * @param results Bitmap of at least `(count + 7) / 8` bytes. Bit `i`
+ *        is set if element `i` is probably in the filter and cleared
+ *        if it is definitely not. Use CBLOOM_BATCH_RESULT() to read it.
  */
-void cbloom_add_string(cbloomfilter *cbf, const char *element) {
-	cbloom_add(cbf, (uint8_t *)element, strlen(element));
+void cbloom_lookup_batch(const cbloomfilter *cbf, const void **elements, const size_t *lens, const size_t count, uint8_t *results) {
+	uint64_t hashes[BATCH_CHUNK][2];
+
+	for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+		size_t chunk = (count - start < BATCH_CHUNK) ? count - start : BATCH_CHUNK;
+
+		batch_hashes(cbf, elements + start, lens + start, chunk, hashes, false);
+
+		for (size_t i = 0; i < chunk; i++) {
+			size_t n     = start + i;
+			bool   found = lookup_element(cbf, hashes[i]);
+
+			if (found) {
+				results[n / 8] |= (0x01 << (n % 8));
+			} else {
+				results[n / 8] &= ~(0x01 << (n % 8));
+			}
+		}
+	}
 }
 
 /**
@@ -491,7 +1453,7 @@ bool cbloom_add_if_not_present_string(cbloomfilter *cbf, const char *element) {
  * if not, add it.
  *
  * This function performs a combined lookup and addition for the
- * element. It calculates the hash positions once, checks each
+ * element. It hashes the element once, checks each
  * corresponding counter, and if any counter is zero, increments all
  * counters for the element, effectively adding it to the filter. This
  * prevents redundant hashing and improves performance.
@@ -504,23 +1466,11 @@ bool cbloom_add_if_not_present_string(cbloomfilter *cbf, const char *element) {
  * @return `false` if it was newly added.
  */
 bool cbloom_lookup_or_add(cbloomfilter *cbf, void *element, const size_t len) {
-    uint64_t hashes[cbf->hashcount];
-    bool is_present = true;
-
-    mmh3_64_make_hashes(element, len, cbf->hashcount, hashes);
-
-    for (size_t i = 0; i < cbf->hashcount; i++) {
-        uint64_t position = hashes[i] % cbf->size;
-        uint64_t counter_value = get_counter(cbf, position);
-
-        if (counter_value == 0) {
-            is_present = false;
-        }
+    uint64_t hash[2];
 
-		inc_counter(cbf, position);
-    }
+    hash_128(cbf->hash, element, len, hash);
 
-    return is_present;
+    return lookup_or_add_element(cbf, hash);
 }
 
 /**
@@ -554,25 +1504,12 @@ bool cbloom_lookup_or_add_string(cbloomfilter *cbf, const char *element) {
  * @param len Length of the element in bytes.
  */
 void cbloom_remove(cbloomfilter *cbf, void *element, const size_t len) {
-	uint64_t hashes[cbf->hashcount];
-	uint64_t positions[cbf->hashcount];
-
-	mmh3_64_make_hashes(element, len, cbf->hashcount, hashes);
+	uint64_t hash[2];
 
-	bool shouldremove = true;
-	for (size_t i = 0; i < cbf->hashcount; i++) {
-		positions[i] = hashes[i] % cbf->size;
-		if (get_counter(cbf, positions[i]) == 0) {
-			shouldremove = false;
-			break;
-		}
-	}
+	hash_128(cbf->hash, element, len, hash);
 
-	if (shouldremove) {
-		for (int i = 0; i < cbf->hashcount; i++) {
-			dec_counter(cbf, positions[i]);
-		}
-	}
+	// only decrements if every counter is nonzero
+	element_ops(cbf, hash)->remove(cbf, hash);
 }
 
 /**
@@ -596,26 +1533,16 @@ void cbloom_remove(cbloomfilter *cbf, void *element, const size_t len) {
  * TODO: test
  */
 bool cbloom_clear_if_count_above(cbloomfilter *cbf, const void *element, size_t len, size_t threshold) {
-    uint64_t hashes[cbf->hashcount];
-    bool     should_clear = false;
-
-    mmh3_64_make_hashes(element, len, cbf->hashcount, hashes);
+    const counter_ops_t *ops;
+    uint64_t             hash[2];
+    bool                 should_clear;
 
-    for (size_t i = 0; i < cbf->hashcount; i++) {
-        uint64_t position = hashes[i] % cbf->size;
-        uint64_t counter_value = get_counter(cbf, position);
-
-        if (counter_value > threshold) {
-            should_clear = true;
-            break;
-        }
-    }
+    hash_128(cbf->hash, element, len, hash);
 
+    ops          = element_ops(cbf, hash);
+    should_clear = ops->max(cbf, hash) > threshold;
     if (should_clear) {
-        for (size_t i = 0; i < cbf->hashcount; i++) {
-            uint64_t position = hashes[i] % cbf->size;
-            set_counter(cbf, position, 0);
-        }
+        ops->clear(cbf, hash);
     }
 
     return should_clear;
@@ -662,20 +1589,7 @@ bool cbloom_clear_if_count_above_string(cbloomfilter *cbf, const char *element,
  * TODO: test
  */
 void cbloom_apply_linear_decay(cbloomfilter *cbf, uint64_t decay_amount) {
-	for (size_t i = 0; i < cbf->size; i++) {
-		uint64_t counter_value = get_counter(cbf, i);
-		if (counter_value == 0) {
-			continue; // skip zeroed counters
-		}
-
-		if (counter_value <= decay_amount) {
-			counter_value = 0; // avoid underflows
-		} else {
-			counter_value -= decay_amount;
-		}
-
-		set_counter(cbf, i, counter_value);
-	}
+	counter_ops(cbf)->linear_decay(cbf->countermap, cbf->size, decay_amount);
 }
 
 /**
@@ -705,15 +1619,147 @@ void cbloom_apply_exponential_decay(cbloomfilter *cbf, float decay_factor) {
         return; // TODO error reporting?
     }
 
-	for (size_t i = 0; i < cbf->size; i++) {
-		uint64_t counter_value = get_counter(cbf, i);
-		if (counter_value == 0) {
-			continue; // skip zeroed counters
-		}
+	settle_all(cbf);
+	counter_ops(cbf)->exponential_decay(cbf->countermap, cbf->size, decay_factor);
+}
+
+/* decay_step -- decay the next `counters` counters from the decay
+ *     cursor, stopping at the end of the filter. Steps over 4 bit
+ *     counters are rounded up to whole bytes.
+ */
+static bool decay_step(cbloomfilter *cbf, size_t counters, const bool exponential,
+					   const uint64_t amount, const float factor) {
+	const counter_ops_t *ops   = counter_ops(cbf);
+	uint64_t             first = cbf->decay_cursor;
+	void                *start;
+
+	if (counters == 0) {
+		return false;
+	}
+
+	if (cbf->csize == COUNTER_4BIT) {
+		counters += counters % 2;
+	}
+
+	counters = (cbf->size - first < counters) ? cbf->size - first : counters;
+	start    = (void *)counter_address(cbf, first);
+
+	if (exponential) {
+		settle_range(cbf, first, counters);
+		ops->exponential_decay(start, counters, factor);
+	} else {
+		ops->linear_decay(start, counters, amount);
+	}
 
-		uint64_t decayed_value = (uint64_t)(counter_value * decay_factor);
+	cbf->decay_cursor = (first + counters == cbf->size) ? 0 : first + counters;
 
-		set_counter(cbf, i, decayed_value);
+	return cbf->decay_cursor == 0;
+}
+
+/**
+ * @brief Apply linear decay to the next `counters` counters of a
+ * counting Bloom filter.
+ *
+ * This function is `cbloom_apply_linear_decay()` spread over several
+ * calls: each call decays counters from where the last one stopped, so
+ * the cost of decaying a large filter can be paid a little at a time,
+ * for example after every batch of adds. Every counter is decayed by
+ * `decay_amount` once per pass over the filter.
+ *
+ * @param cbf Pointer to the counting Bloom filter.
+ * @param decay_amount The amount to decrease each counter by.
+ * @param counters Number of counters to decay in this call.
+ *
+ * @return `true` if this call finished a pass over the filter.
+ * @return `false` otherwise.
+ *
+ * @note Calls from several threads at once must be serialized by the
+ *       caller, even in CBLOOM_FLAG_CONCURRENT filters.
+ */
+bool cbloom_apply_linear_decay_step(cbloomfilter *cbf, uint64_t decay_amount, const size_t counters) {
+	return decay_step(cbf, counters, false, decay_amount, 0.0);
+}
+
+/**
+ * @brief Apply exponential decay to the next `counters` counters of a
+ * counting Bloom filter.
+ *
+ * This function is `cbloom_apply_exponential_decay()` spread over
+ * several calls. See `cbloom_apply_linear_decay_step()`.
+ *
+ * @param cbf Pointer to the counting Bloom filter.
+ * @param decay_factor The decay multiplier applied to each counter,
+ *        between 0.0 and 1.0. Steps with factors outside this range
+ *        do nothing.
+ * @param counters Number of counters to decay in this call.
+ *
+ * @return `true` if this call finished a pass over the filter.
+ * @return `false` otherwise.
+ */
+bool cbloom_apply_exponential_decay_step(cbloomfilter *cbf, float decay_factor, const size_t counters) {
+	if (decay_factor < 0.0 || decay_factor > 1.0) {
+		return false;
+	}
+
+	return decay_step(cbf, counters, true, 0, decay_factor);
+}
+
+/**
+ * @brief Allow linear decay to be applied lazily to a counting Bloom
+ * filter.
+ *
+ * This function gives every CBLOOM_DECAY_BLOCK_SIZE bytes of counters
+ * a stamp recording how much decay they have seen, so that
+ * `cbloom_apply_lazy_linear_decay()` costs the same regardless of the
+ * size of the filter. Decay is applied to a block the next time an
+ * element with a counter in it is counted, looked up, added or
+ * removed, and to the whole filter before it is saved, folded or its
+ * counters are summarized.
+ *
+ * @param cbf Pointer to the counting Bloom filter.
+ *
+ * @return CBF_SUCCESS on success, or if lazy decay is already enabled.
+ * @return CBF_OUTOFMEMORY if memory allocation fails.
+ */
+cbloom_error_t cbloom_enable_lazy_decay(cbloomfilter *cbf) {
+	if (cbf->decay_stamps != NULL) {
+		return CBF_SUCCESS;
+	}
+
+	cbf->decay_stamps = archbloom_alloc(decay_blocks(cbf) * sizeof(uint64_t));
+	if (cbf->decay_stamps == NULL) {
+		return CBF_OUTOFMEMORY;
+	}
+
+	for (uint64_t i = 0; i < decay_blocks(cbf); i++) {
+		cbf->decay_stamps[i] = cbf->decay_total;
+	}
+
+	return CBF_SUCCESS;
+}
+
+/**
+ * @brief Apply linear decay to all counters of a counting Bloom filter
+ * without touching them now.
+ *
+ * This function has the same effect as `cbloom_apply_linear_decay()`,
+ * but in filters set up with `cbloom_enable_lazy_decay()` it only
+ * records the decay; each block of counters catches up the next time
+ * it is used. Other filters are decayed immediately.
+ *
+ * @param cbf Pointer to the counting Bloom filter.
+ * @param decay_amount The amount to decrease each counter by.
+ */
+void cbloom_apply_lazy_linear_decay(cbloomfilter *cbf, uint64_t decay_amount) {
+	if (cbf->decay_stamps == NULL) {
+		cbloom_apply_linear_decay(cbf, decay_amount);
+		return;
+	}
+
+	if (cbf->flags & CBLOOM_FLAG_CONCURRENT) {
+		__atomic_fetch_add(&cbf->decay_total, decay_amount, __ATOMIC_RELAXED);
+	} else {
+		cbf->decay_total += decay_amount;
 	}
 }
 
@@ -745,15 +1791,19 @@ void cbloom_remove_string(cbloomfilter *cbf, const char *element) {
  * TODO: test
  */
 size_t cbloom_saturation_count(const cbloomfilter *cbf) {
-	size_t count = 0;
+	settle_all(cbf);
 
-	for (size_t i = 0; i < cbf->size; i++) {
-		if (get_counter(cbf, i) != 0) {
-			count++;
-		}
+	// the unused upper nibble of an odd sized 4 bit filter is always 0
+	switch (cbf->csize) {
+	case COUNTER_4BIT:
+		return bitops_nonzero_nibbles(cbf->countermap, countermap_bytes(cbf->csize, cbf->size));
+	case COUNTER_8BIT:
+		return bitops_nonzero_bytes(cbf->countermap, cbf->size);
+	default:
+		break;
 	}
 
-	return count;
+	return counter_ops(cbf)->count_above(cbf->countermap, cbf->size, 0);
 }
 
 /**
@@ -774,6 +1824,79 @@ float cbloom_saturation(const cbloomfilter *cbf) {
 	return (float)cbloom_saturation_count(cbf) / cbf->size * 100.0;
 }
 
+/**
+ * @brief Get the runtime statistics of a counting Bloom filter: adds,
+ * lookups, hits and saturations. See stats.h.
+ *
+ * @param cbf Counting Bloom filter.
+ * @param stats Set to the filter's statistics.
+ *
+ * @return true on success.
+ * @return false if the filter keeps no statistics: the library was
+ *         built without ARCHBLOOM_STATS. `stats` is zeroed.
+ */
+bool cbloom_stats(const cbloomfilter *cbf, archbloom_stats *stats) {
+	archbloom_counters_read(cbf->stats, cbf->flags & CBLOOM_FLAG_CONCURRENT, stats);
+
+	return cbf->stats != NULL;
+}
+
+/**
+ * @brief Shrink a counting Bloom filter by folding it in half `times`
+ * times, in place.
+ *
+ * Each fold adds together the two counters every element could map to
+ * in a filter of half the size, saturating at the largest value the
+ * counters hold, so counts never drop and every element is still
+ * found. As with `bloom_fold()`, modulo and CBLOOM_FLAG_POW2 filters
+ * add counter `i + size / 2` to counter `i`, and
+ * CBLOOM_FLAG_FASTRANGE filters add counters `2i` and `2i + 1`.
+ * Counters that saturated can't be decremented back exactly by
+ * `cbloom_remove()`.
+ *
+ * @param cbf Counting Bloom filter to fold.
+ * @param times Number of times to halve the filter.
+ *
+ * @return CBF_SUCCESS on success.
+ * @return CBF_INVALIDPARAM if the size can't be halved `times` times,
+ *         or the filter is mapped with `cbloom_map()`. The filter is
+ *         unchanged.
+ */
+cbloom_error_t cbloom_fold(cbloomfilter *cbf, const unsigned int times) {
+	uint64_t size     = cbf->size;
+	bool     adjacent = (cbf->flags & CBLOOM_FLAG_FASTRANGE) && !(cbf->flags & CBLOOM_FLAG_POW2);
+
+	if (cbf->map != NULL || times >= 64) {
+		return CBF_INVALIDPARAM;
+	}
+
+	for (unsigned int i = 0; i < times; i++) {
+		if (size % 2 != 0 || size / 2 < 2) {
+			return CBF_INVALIDPARAM;
+		}
+		size /= 2;
+	}
+
+	// folded counters share stamps, so every block must be up to date
+	settle_all(cbf);
+
+	for (unsigned int i = 0; i < times; i++) {
+		cbf->size /= 2;
+		counter_ops(cbf)->fold(cbf->countermap, cbf->size, adjacent);
+	}
+
+	cbf->countermap_size = countermap_bytes(cbf->csize, cbf->size);
+	cbf->decay_cursor    = 0;
+
+	// keep the larger allocation if shrinking it fails
+	void *countermap = archbloom_realloc(cbf->countermap, cbf->countermap_size);
+	if (countermap != NULL) {
+		cbf->countermap = countermap;
+	}
+
+	return CBF_SUCCESS;
+}
+
 /**
  * @brief Clear the contents of a counting Bloom filter.
  *
@@ -786,6 +1909,12 @@ float cbloom_saturation(const cbloomfilter *cbf) {
  */
 void cbloom_clear(cbloomfilter *cbf) {
 	memset(cbf->countermap, 0, cbf->countermap_size);
+
+	if (cbf->decay_stamps != NULL) {
+		for (uint64_t i = 0; i < decay_blocks(cbf); i++) {
+			cbf->decay_stamps[i] = cbf->decay_total;
+		}
+	}
 }
 
 /**
@@ -803,16 +1932,11 @@ void cbloom_clear(cbloomfilter *cbf) {
  * TODO: test
  */
 bool cbloom_clear_element(cbloomfilter *cbf, void *element, size_t len) {
-	uint64_t hashes[cbf->hashcount];
-	uint64_t position;
+	uint64_t hash[2];
 
-	mmh3_64_make_hashes(element, len, cbf->hashcount, hashes);
+	hash_128(cbf->hash, element, len, hash);
 
-	for (int i = 0; i < cbf->hashcount; i++) {
-		position = hashes[i] % cbf->size;
-
-		set_counter(cbf, position, 0);
-	}
+	element_ops(cbf, hash)->clear(cbf, hash);
 
 	return true;
 }
@@ -855,6 +1979,8 @@ cbloom_error_t cbloom_save(cbloomfilter *cbf, const char *path) {
 	FILE              *fp;
 	cbloomfilter_file  cbff = {0};
 
+	settle_all(cbf);
+
 	cbff.magic[0] = '!';
 	cbff.magic[1] = 'c';
 	cbff.magic[2] = 'b';
@@ -870,6 +1996,8 @@ cbloom_error_t cbloom_save(cbloomfilter *cbf, const char *path) {
 	cbff.expected        = cbf->expected;
 	cbff.accuracy        = cbf->accuracy;
 	cbff.countermap_size = cbf->countermap_size;
+	cbff.flags           = cbf->flags;
+	cbff.hash            = cbf->hash;
 	strncpy((char *)cbff.name, cbf->name, CBLOOM_MAX_NAME_LENGTH);
 	cbff.name[CBLOOM_MAX_NAME_LENGTH] = '\0';
 
@@ -906,6 +2034,8 @@ cbloom_error_t cbloom_save(cbloomfilter *cbf, const char *path) {
 cbloom_error_t cbloom_save_fd(cbloomfilter *cbf, int fd) {
 	cbloomfilter_file cbff = {0};
 
+	settle_all(cbf);
+
 	cbff.magic[0] = '!';
 	cbff.magic[1] = 'c';
 	cbff.magic[2] = 'b';
@@ -921,6 +2051,8 @@ cbloom_error_t cbloom_save_fd(cbloomfilter *cbf, int fd) {
 	cbff.expected        = cbf->expected;
 	cbff.accuracy        = cbf->accuracy;
 	cbff.countermap_size = cbf->countermap_size;
+	cbff.flags           = cbf->flags;
+	cbff.hash            = cbf->hash;
 	strncpy((char *)cbff.name, cbf->name, CBLOOM_MAX_NAME_LENGTH);
 	cbff.name[CBLOOM_MAX_NAME_LENGTH] = '\0';
 
@@ -935,6 +2067,73 @@ cbloom_error_t cbloom_save_fd(cbloomfilter *cbf, int fd) {
 	return CBF_SUCCESS;
 }
 
+/**
+ * @brief Helper function for the load functions. Check that a file
+ * header describes a filter this library can use, and locate the
+ * counters within the file.
+ *
+ * @param cbff Pointer to the header read from disk.
+ * @param file_size Size of the whole file in bytes.
+ *
+ * @return Offset of the counters within the file.
+ * @return 0 if the header is not usable.
+ */
+static size_t countermap_offset(const cbloomfilter_file *cbff, const uint64_t file_size) {
+	if (memcmp(cbff->magic, "!cbloom!", sizeof(cbff->magic)) != 0) {
+		return 0;
+	}
+
+	if (cbff->countermap_size == 0 ||
+		countermap_bytes(cbff->csize, cbff->size) != cbff->countermap_size) {
+		return 0;
+	}
+
+	if (cbff->flags & ~CBLOOM_FLAGS_ALL) {
+		return 0; // written by a newer version
+	}
+
+	if ((cbff->flags & CBLOOM_FLAG_POW2) && (cbff->size & (cbff->size - 1)) != 0) {
+		return 0;
+	}
+
+	if (file_size == sizeof(cbloomfilter_file) + cbff->countermap_size) {
+		return sizeof(cbloomfilter_file);
+	}
+
+	if (file_size == CBLOOM_FILE_LEGACY_HEADER_SIZE + cbff->countermap_size) {
+		return CBLOOM_FILE_LEGACY_HEADER_SIZE;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Helper function for the load functions. Populate a counting
+ * Bloom filter's parameters from a file header. The counters are not
+ * touched.
+ *
+ * @param cbf Pointer to the counting Bloom filter to populate.
+ * @param cbff Pointer to the header read from disk.
+ */
+static void from_header(cbloomfilter *cbf, const cbloomfilter_file *cbff) {
+	cbf->size            = cbff->size;
+	cbf->csize           = cbff->csize;
+	cbf->hashcount       = cbff->hashcount;
+	cbf->expected        = cbff->expected;
+	cbf->accuracy        = cbff->accuracy;
+	cbf->countermap_size = cbff->countermap_size;
+	cbf->flags           = cbff->flags;
+	cbf->hash            = cbff->hash;
+	cbf->map             = NULL;
+	cbf->map_size        = 0;
+	cbf->decay_cursor    = 0;
+	cbf->decay_total     = 0;
+	cbf->decay_stamps    = NULL;
+	cbf->stats           = NULL;
+	strncpy(cbf->name, (char *)cbff->name, CBLOOM_MAX_NAME_LENGTH);
+	cbf->name[CBLOOM_MAX_NAME_LENGTH] = '\0';
+}
+
 /**
  * @brief Load a counting Bloom filter from a file on disk.
  *
@@ -955,7 +2154,8 @@ cbloom_error_t cbloom_save_fd(cbloomfilter *cbf, int fd) {
 cbloom_error_t cbloom_load(cbloomfilter *cbf, const char *path) {
 	FILE              *fp;
 	struct stat        sb;
-	cbloomfilter_file  cbff;
+	cbloomfilter_file  cbff = {0};
+	size_t             offset;
 
 	fp = fopen(path, "rb");
 	if (fp == NULL) {
@@ -967,27 +2167,33 @@ cbloom_error_t cbloom_load(cbloomfilter *cbf, const char *path) {
 		return CBF_FSTAT;
 	}
 
-	if (fread(&cbff, sizeof(cbloomfilter_file), 1, fp) != 1) {
+	// read the part of the header common to every version first
+	if (fread(&cbff, CBLOOM_FILE_LEGACY_HEADER_SIZE, 1, fp) != 1) {
 		fclose(fp);
 		return CBF_FREAD;
 	}
 
-	cbf->size            = cbff.size;
-	cbf->csize           = cbff.csize;
-	cbf->hashcount       = cbff.hashcount;
-	cbf->expected        = cbff.expected;
-	cbf->accuracy        = cbff.accuracy;
-	cbf->countermap_size = cbff.countermap_size;
-	strncpy(cbf->name, (char *)cbff.name, CBLOOM_MAX_NAME_LENGTH);
-	cbf->name[CBLOOM_MAX_NAME_LENGTH] = '\0';
-
 	// basic sanity check. should fail if the file isn't valid
-	if (sizeof(cbloomfilter_file) + cbf->countermap_size != sb.st_size) {
+	offset = countermap_offset(&cbff, sb.st_size);
+	if (offset == 0) {
 		fclose(fp);
 		return CBF_INVALIDFILE;
 	}
 
-	cbf->countermap = malloc(cbf->countermap_size);
+	if (offset > CBLOOM_FILE_LEGACY_HEADER_SIZE &&
+		fread((uint8_t *)&cbff + CBLOOM_FILE_LEGACY_HEADER_SIZE, offset - CBLOOM_FILE_LEGACY_HEADER_SIZE, 1, fp) != 1) {
+		fclose(fp);
+		return CBF_FREAD;
+	}
+
+	if (!hash_strategy_valid(cbff.hash)) {
+		fclose(fp);
+		return CBF_INVALIDFILE; // written by a newer version
+	}
+
+	from_header(cbf, &cbff);
+
+	cbf->countermap = archbloom_alloc(cbf->countermap_size);
 	if (cbf->countermap == NULL) {
 		fclose(fp);
 		return CBF_OUTOFMEMORY;
@@ -995,11 +2201,13 @@ cbloom_error_t cbloom_load(cbloomfilter *cbf, const char *path) {
 
 	if (fread(cbf->countermap, cbf->countermap_size, 1, fp) != 1) {
 		fclose(fp);
-		free(cbf->countermap);
+		archbloom_free(cbf->countermap);
+		cbf->countermap = NULL;
 		return CBF_FREAD;
 	}
 
 	fclose(fp);
+	cbf->stats = archbloom_counters_alloc(cbf->flags & CBLOOM_FLAG_CONCURRENT);
 
 	return CBF_SUCCESS;
 }
@@ -1023,42 +2231,144 @@ cbloom_error_t cbloom_load(cbloomfilter *cbf, const char *path) {
  */
 cbloom_error_t cbloom_load_fd(cbloomfilter *cbf, int fd) {
 	struct stat sb;
-	cbloomfilter_file cbff;
+	cbloomfilter_file cbff = {0};
+	size_t offset;
+	size_t remaining;
 
 	if (fstat(fd, &sb) == -1) {
 		return CBF_FSTAT;
 	}
 
-	if (read(fd, &cbff, sizeof(cbloomfilter_file)) != sizeof(cbloomfilter_file)) {
+	if (read(fd, &cbff, CBLOOM_FILE_LEGACY_HEADER_SIZE) != CBLOOM_FILE_LEGACY_HEADER_SIZE) {
 		return CBF_FREAD;
 	}
 
-	cbf->size            = cbff.size;
-	cbf->csize           = cbff.csize;
-	cbf->hashcount       = cbff.hashcount;
-	cbf->expected        = cbff.expected;
-	cbf->accuracy        = cbff.accuracy;
-	cbf->countermap_size = cbff.countermap_size;
-	strncpy(cbf->name, (char *)cbff.name, CBLOOM_MAX_NAME_LENGTH);
-	cbf->name[CBLOOM_MAX_NAME_LENGTH] = '\0';
+	offset = countermap_offset(&cbff, sb.st_size);
+	if (offset == 0) {
+		return CBF_INVALIDFILE;
+	}
+
+	remaining = offset - CBLOOM_FILE_LEGACY_HEADER_SIZE;
+	if (remaining > 0 && read(fd, (uint8_t *)&cbff + CBLOOM_FILE_LEGACY_HEADER_SIZE, remaining) != (ssize_t)remaining) {
+		return CBF_FREAD;
+	}
 
-	if (sizeof(cbloomfilter_file) + cbf->countermap_size != sb.st_size) {
+	if (!hash_strategy_valid(cbff.hash)) {
 		return CBF_INVALIDFILE;
 	}
 
-	cbf->countermap = malloc(cbf->countermap_size);
+	from_header(cbf, &cbff);
+
+	cbf->countermap = archbloom_alloc(cbf->countermap_size);
 	if (cbf->countermap == NULL) {
 		return CBF_OUTOFMEMORY;
 	}
 
 	if (read(fd, cbf->countermap, cbf->countermap_size) != (ssize_t)cbf->countermap_size) {
-		free(cbf->countermap);
+		archbloom_free(cbf->countermap);
+		cbf->countermap = NULL;
+		return CBF_FREAD;
+	}
+
+	cbf->stats = archbloom_counters_alloc(cbf->flags & CBLOOM_FLAG_CONCURRENT);
+
+	return CBF_SUCCESS;
+}
+
+/**
+ * @brief Map a counting Bloom filter file descriptor into memory.
+ *
+ * This function validates the header of a saved counting Bloom filter
+ * and maps the file MAP_SHARED instead of copying the counters into
+ * private memory. See `bloom_map_fd()` for details.
+ *
+ * If `writable` is false the mapping is read only and the filter must
+ * only be used for lookups and counts. If it is true, changes are
+ * written back to the file; the descriptor must be open for writing.
+ *
+ * Release the mapping with `cbloom_destroy()`.
+ *
+ * @param cbf Pointer to the counting Bloom filter struct to populate.
+ * @param fd File descriptor of a saved counting Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return CBF_SUCCESS on success.
+ * @return CBF_FSTAT if the stat() system call failed on the file descriptor.
+ * @return CBF_FREAD if there was an error reading from the file descriptor.
+ * @return CBF_INVALIDFILE if the file format is invalid or unparseable.
+ * @return CBF_MMAP if mmap() failed.
+ */
+cbloom_error_t cbloom_map_fd(cbloomfilter *cbf, int fd, const bool writable) {
+	struct stat        sb;
+	cbloomfilter_file  cbff = {0};
+	size_t             offset;
+	void              *map;
+
+	if (fstat(fd, &sb) == -1) {
+		return CBF_FSTAT;
+	}
+
+	if (pread(fd, &cbff, CBLOOM_FILE_LEGACY_HEADER_SIZE, 0) != CBLOOM_FILE_LEGACY_HEADER_SIZE) {
+		return CBF_FREAD;
+	}
+
+	offset = countermap_offset(&cbff, sb.st_size);
+	if (offset == 0) {
+		return CBF_INVALIDFILE;
+	}
+
+	// now read the whole header
+	if (pread(fd, &cbff, offset, 0) != (ssize_t)offset) {
 		return CBF_FREAD;
 	}
 
+	if (!hash_strategy_valid(cbff.hash)) {
+		return CBF_INVALIDFILE;
+	}
+
+	map = map_file(fd, sb.st_size, writable);
+	if (map == NULL) {
+		return CBF_MMAP;
+	}
+
+	from_header(cbf, &cbff);
+	cbf->map        = map;
+	cbf->map_size   = sb.st_size;
+	cbf->countermap = (uint8_t *)map + offset;
+	cbf->stats      = archbloom_counters_alloc(cbf->flags & CBLOOM_FLAG_CONCURRENT);
+
 	return CBF_SUCCESS;
 }
 
+/**
+ * @brief Map a counting Bloom filter file into memory.
+ *
+ * This function is a convenience wrapper around `cbloom_map_fd()`
+ * that opens and closes the file.
+ *
+ * @param cbf Pointer to the counting Bloom filter struct to populate.
+ * @param path Path to a saved counting Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return CBF_SUCCESS on success.
+ * @return CBF_FOPEN if the file could not be opened.
+ * @return Any error returned by `cbloom_map_fd()`.
+ */
+cbloom_error_t cbloom_map(cbloomfilter *cbf, const char *path, const bool writable) {
+	cbloom_error_t error;
+	int            fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
+		return CBF_FOPEN;
+	}
+
+	error = cbloom_map_fd(cbf, fd, writable);
+	close(fd);
+
+	return error;
+}
+
 /**
  * @brief Return a string containing the error message corresponding
  * to an error code.
@@ -19,8 +19,59 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "hash.h"
+#include "stats.h"
+
 #define CBLOOM_MAX_NAME_LENGTH 255
 
+/**
+ * @def CBLOOM_BATCH_RESULT
+ * @brief Read bit `i` of a result bitmap filled in by
+ * `cbloom_lookup_batch()`.
+ */
+#define CBLOOM_BATCH_RESULT(results, i) (((results)[(i) / 8] >> ((i) % 8)) & 0x01)
+
+/**
+ * @def CBLOOM_FLAG_POW2
+ * @brief `cbloom_init_flags()` flag: round the number of counters up to
+ * a power of two and map hashes onto them with a mask. Takes precedence
+ * over CBLOOM_FLAG_FASTRANGE.
+ */
+#define CBLOOM_FLAG_POW2      0x01
+
+/**
+ * @def CBLOOM_FLAG_FASTRANGE
+ * @brief `cbloom_init_flags()` flag: map hashes onto the counters with a
+ * multiply and shift rather than a 64 bit modulo.
+ */
+#define CBLOOM_FLAG_FASTRANGE 0x02
+
+/**
+ * @def CBLOOM_FLAG_CONCURRENT
+ * @brief `cbloom_init_flags()` flag: allow elements to be added,
+ * removed, counted, looked up and cleared, and decay to be applied, on
+ * the same filter from multiple threads without external locking.
+ * Counters are updated with atomic compare and swap, on the byte
+ * holding them for 4 bit counters, so increments still saturate and
+ * decrements still stop at zero. Counts and saturation read while
+ * writers run may be slightly out of date. `cbloom_fold()`,
+ * `cbloom_clear()` and loading still need the filter to themselves.
+ */
+#define CBLOOM_FLAG_CONCURRENT 0x04
+
+/**
+ * @def CBLOOM_FLAGS_ALL
+ * @brief Every flag understood by this version of the library.
+ */
+#define CBLOOM_FLAGS_ALL      (CBLOOM_FLAG_POW2 | CBLOOM_FLAG_FASTRANGE | CBLOOM_FLAG_CONCURRENT)
+
+/**
+ * @def CBLOOM_DECAY_BLOCK_SIZE
+ * @brief Bytes of counters that share a decay stamp in filters using
+ * `cbloom_apply_lazy_linear_decay()`.
+ */
+#define CBLOOM_DECAY_BLOCK_SIZE 512
+
 /**
  * @brief Error status type used for mapping function return values to
  * error messages.
@@ -40,20 +91,18 @@ typedef enum {
 	CBF_FREAD,              /**< Failed to read from file. */
 	CBF_FSTAT,              /**< Failed to stat() the file descriptor. */
 	CBF_INVALIDFILE,        /**< Invalid or unparseable file format. */
+	CBF_MMAP,               /**< Failed to mmap() the file. */
+	CBF_INVALIDPARAM,       /**< A parameter is out of range. */
 	// dummy enum to use as a counter. do not add entries after CBF_ERRORCOUNT.
 	CBF_ERRORCOUNT          /**< Total number of error types. */
 } cbloom_error_t;
 
-const char *cbloom_errors[] = {
-	"Success",
-	"Out of memory",
-	"Invalid counter size",
-	"Unable to open file",
-	"Unable to write to file",
-	"Unable to read file",
-	"fstat() failure",
-	"Invalid file format"
-};
+/**
+ * @var cbloom_errors
+ * @brief Human-readable messages for `cbloom_error_t` codes. Use
+ * `cbloom_strerror()` rather than indexing it directly.
+ */
+extern const char *cbloom_errors[];
 
 /**
  * @brief Enum for selecting the size of counters in the counting Bloom filter.
@@ -114,10 +163,40 @@ typedef enum {
  * Smaller counters reduce memory usage but may overflow if elements
  * are added frequently.
  *
+ * @var cbloomfilter::flags
+ * CBLOOM_FLAG_* options the filter was created with.
+ *
+ * @var cbloomfilter::hash
+ * Hash strategy used to hash elements. See `cbloom_set_hash()`.
+ *
  * @var cbloomfilter::countermap
  * Pointer to the memory map containing counters for each element. Each
  * counter represents the count of hash mappings for an element in the
  * filter.
+ *
+ * @var cbloomfilter::map
+ * Start of the file mapping if the filter was loaded with
+ * `cbloom_map()`, otherwise NULL.
+ *
+ * @var cbloomfilter::map_size
+ * Size of the file mapping in bytes.
+ *
+ * @var cbloomfilter::decay_cursor
+ * Next counter decayed by `cbloom_apply_linear_decay_step()` and
+ * `cbloom_apply_exponential_decay_step()`.
+ *
+ * @var cbloomfilter::decay_total
+ * Total linear decay applied with `cbloom_apply_lazy_linear_decay()`.
+ *
+ * @var cbloomfilter::decay_stamps
+ * `decay_total` each block of CBLOOM_DECAY_BLOCK_SIZE bytes of
+ * counters was last decayed to, or NULL unless
+ * `cbloom_enable_lazy_decay()` was called. A block is brought up to
+ * date the next time one of its counters is read or written.
+ *
+ * @var cbloomfilter::stats
+ * Counters behind `cbloom_stats()`, or NULL if the library was built
+ * without ARCHBLOOM_STATS. See stats.h.
  */
 typedef struct {
 	uint64_t      size; /**< Size of the counting Bloom filter. */
@@ -127,7 +206,15 @@ typedef struct {
 	float         accuracy; /**< Desired false positive rate (e.g., 0.01 for 1% false positive rate). */
 	char          name[CBLOOM_MAX_NAME_LENGTH + 1]; /**< Null-terminated name of the filter. */
 	counter_size  csize;  /**< Size of the counter (8, 16, 32, or 64 bits). */
+	uint32_t      flags;  /**< CBLOOM_FLAG_* options. */
+	hash_strategy hash;   /**< Hash strategy. */
 	void         *countermap;  /**< Pointer to a map of element counters. */
+	void         *map;         /**< File mapping from cbloom_map(), or NULL. */
+	size_t        map_size;    /**< Size of the file mapping in bytes. */
+	uint64_t      decay_cursor; /**< Next counter the decay steps touch. */
+	uint64_t      decay_total;  /**< Lazy linear decay applied so far. */
+	uint64_t     *decay_stamps; /**< Decay each counter block has seen, or NULL. */
+	archbloom_counters *stats;  /**< Runtime statistics, or NULL. */
 } cbloomfilter;
 
 /**
@@ -169,6 +256,19 @@ typedef struct {
  * @var cbloomfilter_file::accuracy
  * Desired false positive rate for the filter, guiding the internal sizing and
  * configuration parameters.
+ *
+ * @var cbloomfilter_file::flags
+ * CBLOOM_FLAG_* options. This occupies what used to be structure
+ * padding, so files written before it existed read as 0 (modulo).
+ *
+ * @var cbloomfilter_file::hash
+ * Hash strategy. Files with a legacy header read as 0 (HASH_MMH3).
+ *
+ * @var cbloomfilter_file::reserved
+ * Pads the header to 320 bytes so the counters start on a 64 byte
+ * boundary when the file is mapped with `cbloom_map()`. Must be zero.
+ * Files written before this existed have a 312 byte header
+ * (CBLOOM_FILE_LEGACY_HEADER_SIZE) and are still accepted.
  */
 typedef struct {
 	uint8_t  magic[8];
@@ -179,18 +279,37 @@ typedef struct {
 	uint64_t countermap_size;
 	uint64_t expected;
 	float    accuracy;
+	uint32_t flags;
+	uint32_t hash;
+	uint8_t  reserved[4];
 } cbloomfilter_file;
 
+/**
+ * @def CBLOOM_FILE_LEGACY_HEADER_SIZE
+ * @brief Size of the header written by versions of this library
+ * before `cbloomfilter_file::hash` and `cbloomfilter_file::reserved`
+ * were added.
+ */
+#define CBLOOM_FILE_LEGACY_HEADER_SIZE 312
+
 /* function declarations
  */
 cbloom_error_t  cbloom_init(cbloomfilter *, const size_t, const float, counter_size);
+cbloom_error_t  cbloom_init_flags(cbloomfilter *,
+                                  const size_t,
+                                  const float,
+                                  counter_size,
+                                  const uint32_t);
 void            cbloom_destroy(cbloomfilter *);
 const char     *cbloom_get_name(cbloomfilter *);
 bool            cbloom_set_name(cbloomfilter *, const char *);
+bool            cbloom_set_hash(cbloomfilter *, const hash_strategy);
 cbloom_error_t  cbloom_save(cbloomfilter *, const char *);
 cbloom_error_t  cbloom_load(cbloomfilter *, const char *);
 cbloom_error_t  cbloom_save_fd(cbloomfilter *, int);
 cbloom_error_t  cbloom_load_fd(cbloomfilter *, int);
+cbloom_error_t  cbloom_map(cbloomfilter *, const char *, const bool);
+cbloom_error_t  cbloom_map_fd(cbloomfilter *, int, const bool);
 
 size_t          cbloom_count(const cbloomfilter *, void *, size_t);
 size_t          cbloom_count_string(const cbloomfilter *, char *);
@@ -198,6 +317,7 @@ float           cbloom_get_average_count(cbloomfilter *);
 size_t          cbloom_count_elements_above_threshold(const cbloomfilter *,
                                                       uint64_t);
 size_t          cbloom_saturation_count(const cbloomfilter *);
+bool            cbloom_stats(const cbloomfilter *, archbloom_stats *);
 float           cbloom_saturation(const cbloomfilter *);
 
 bool            cbloom_lookup(const cbloomfilter *, void *, const size_t);
@@ -207,6 +327,18 @@ bool            cbloom_lookup_or_add_string(cbloomfilter *, const char *);
 
 void            cbloom_add(cbloomfilter *, void *, const size_t);
 void            cbloom_add_string(cbloomfilter *, const char *);
+size_t          cbloom_count_hashed(const cbloomfilter *, const uint64_t *);
+bool            cbloom_lookup_hashed(const cbloomfilter *, const uint64_t *);
+void            cbloom_add_hashed(cbloomfilter *, const uint64_t *);
+void            cbloom_add_batch(cbloomfilter *,
+                                 const void **,
+                                 const size_t *,
+                                 const size_t);
+void            cbloom_lookup_batch(const cbloomfilter *,
+                                    const void **,
+                                    const size_t *,
+                                    const size_t,
+                                    uint8_t *);
 // TODO are these necessary?
 bool            cbloom_add_if_not_present(cbloomfilter *, void *, const size_t);
 bool            cbloom_add_if_not_present_string(cbloomfilter *, const char *);
@@ -223,8 +355,13 @@ bool            cbloom_clear_if_count_above(cbloomfilter *,
 bool            cbloom_clear_if_count_above_string(cbloomfilter *,
                                                    const char *,
                                                    size_t);
-void            cbloom_decay_linear(cbloomfilter *, size_t);
-void            cbloom_decay_exponential(cbloomfilter *, float);
+void            cbloom_apply_linear_decay(cbloomfilter *, uint64_t);
+void            cbloom_apply_exponential_decay(cbloomfilter *, float);
+bool            cbloom_apply_linear_decay_step(cbloomfilter *, uint64_t, const size_t);
+bool            cbloom_apply_exponential_decay_step(cbloomfilter *, float, const size_t);
+cbloom_error_t  cbloom_enable_lazy_decay(cbloomfilter *);
+void            cbloom_apply_lazy_linear_decay(cbloomfilter *, uint64_t);
+cbloom_error_t  cbloom_fold(cbloomfilter *, const unsigned int);
 
 //uint64_t *cbloom_histogram(const cbloomfilter *); // TODO
 
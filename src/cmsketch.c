@@ -0,0 +1,591 @@
+/**
+ * @file cmsketch.c
+ * @brief Count-min sketch and heavy hitter implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains functions for working with count-min sketches:
+ * initialization, destruction, adding elements and estimating their
+ * counts, and the heavy hitter tracker fed from them.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "cmsketch.h"
+#include "hash.h"
+#include "bitops.h"
+#include "fastrange.h"
+#include "alloc.h"
+
+// messages for cmsketch_strerror(). See cmsketch.h.
+const char *cmsketch_errors[] = {
+	"Success",
+	"Invalid parameter",
+	"Invalid counter size",
+	"Out of memory"
+};
+
+_Static_assert(sizeof(cmsketch_errors) / sizeof(cmsketch_errors[0]) == CMS_ERRORCOUNT,
+               "cmsketch_errors must have a message for every cmsketch_error_t");
+
+/**
+ * @brief Helper function to get the largest value a counter can hold.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t counter_max(const counter_size csize) {
+	switch (csize) {
+	case COUNTER_4BIT:  return 15;
+	case COUNTER_8BIT:  return UINT8_MAX;
+	case COUNTER_16BIT: return UINT16_MAX;
+	case COUNTER_32BIT: return UINT32_MAX;
+	default:            return UINT64_MAX;
+	}
+}
+
+/**
+ * @brief Helper function to read counter `i` of a sketch.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t get_counter(const cmsketch *cms, const uint64_t i) {
+	switch (cms->csize) {
+	case COUNTER_4BIT:  return (((uint8_t *)cms->counters)[i / 2] >> ((i % 2) * 4)) & 0x0f;
+	case COUNTER_8BIT:  return ((uint8_t *)cms->counters)[i];
+	case COUNTER_16BIT: return ((uint16_t *)cms->counters)[i];
+	case COUNTER_32BIT: return ((uint32_t *)cms->counters)[i];
+	default:            return ((uint64_t *)cms->counters)[i];
+	}
+}
+
+/**
+ * @brief Helper function to set counter `i` of a sketch. `value` must
+ * fit in the counter.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline void set_counter(cmsketch *cms, const uint64_t i, const uint64_t value) {
+	uint8_t *byte;
+
+	switch (cms->csize) {
+	case COUNTER_4BIT:
+		byte  = (uint8_t *)cms->counters + (i / 2);
+		*byte = (*byte & (0xf0 >> ((i % 2) * 4))) | (value << ((i % 2) * 4));
+		break;
+	case COUNTER_8BIT:  ((uint8_t *)cms->counters)[i]  = value; break;
+	case COUNTER_16BIT: ((uint16_t *)cms->counters)[i] = value; break;
+	case COUNTER_32BIT: ((uint32_t *)cms->counters)[i] = value; break;
+	default:            ((uint64_t *)cms->counters)[i] = value; break;
+	}
+}
+
+/**
+ * @brief Helper function to get the counter of row `row` for a hashed
+ * element.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t row_counter(const cmsketch *cms, const uint64_t *hash, const uint64_t row) {
+	return (row * cms->width) + fastrange64(hash_probe(hash, row), cms->width);
+}
+
+/**
+ * @brief Initialize a count-min sketch.
+ *
+ * @param cms Pointer to the sketch to initialize.
+ * @param epsilon Acceptable overcount, as a fraction of the total of
+ *        all counts added (e.g., 0.001).
+ * @param delta Probability of an estimate overcounting by more than
+ *        `epsilon` (e.g., 0.01).
+ * @param csize Size of each counter.
+ *
+ * @return CMS_SUCCESS on success.
+ * @return CMS_INVALIDPARAM if `epsilon` or `delta` is out of range.
+ * @return CMS_INVALIDCOUNTERSIZE if the counter size is invalid.
+ * @return CMS_OUTOFMEMORY if memory allocation fails.
+ */
+cmsketch_error_t cmsketch_init(cmsketch *cms, const float epsilon, const float delta, const counter_size csize) {
+	return cmsketch_init_flags(cms, epsilon, delta, csize, 0);
+}
+
+/**
+ * @brief Initialize a count-min sketch with options.
+ *
+ * This function is `cmsketch_init()` with a set of CMSKETCH_FLAG_*
+ * options. Sketches are `ceil(e / epsilon)` counters wide and
+ * `ceil(ln(1 / delta))` rows deep.
+ *
+ * @param flags Bitwise OR of CMSKETCH_FLAG_* values. Unknown bits are
+ *        ignored.
+ *
+ * @return See `cmsketch_init()`.
+ */
+cmsketch_error_t cmsketch_init_flags(cmsketch *cms, const float epsilon, const float delta, const counter_size csize, const uint32_t flags) {
+	if (!(epsilon > 0 && epsilon < 1) || !(delta > 0 && delta < 1)) {
+		return CMS_INVALIDPARAM;
+	}
+
+	return cmsketch_init_size(cms, ceil(M_E / epsilon), ceil(log(1.0 / delta)), csize, flags);
+}
+
+/**
+ * @brief Initialize a count-min sketch of a given shape.
+ *
+ * This function is `cmsketch_init_flags()` for callers that size the
+ * sketch themselves, for example to fit it in the same memory as
+ * another structure.
+ *
+ * @param cms Pointer to the sketch to initialize.
+ * @param width Counters per row.
+ * @param depth Number of rows.
+ * @param csize Size of each counter.
+ * @param flags Bitwise OR of CMSKETCH_FLAG_* values.
+ *
+ * @return CMS_SUCCESS on success.
+ * @return CMS_INVALIDPARAM if `width` or `depth` is 0.
+ * @return CMS_INVALIDCOUNTERSIZE if the counter size is invalid.
+ * @return CMS_OUTOFMEMORY if memory allocation fails.
+ */
+cmsketch_error_t cmsketch_init_size(cmsketch *cms, const uint64_t width, const uint64_t depth, const counter_size csize, const uint32_t flags) {
+	if (width == 0 || depth == 0) {
+		return CMS_INVALIDPARAM;
+	}
+
+	if (csize > COUNTER_64BIT) {
+		return CMS_INVALIDCOUNTERSIZE;
+	}
+
+	cms->width = width;
+	cms->depth = depth;
+	cms->csize = csize;
+	cms->flags = flags & CMSKETCH_FLAGS_ALL;
+	cms->hash  = HASH_MMH3;
+	cms->total = 0;
+
+	if (csize == COUNTER_4BIT) {
+		cms->size = (width * depth + 1) / 2;
+	} else {
+		cms->size = width * depth * (1 << (csize - 1));
+	}
+
+	cms->counters = archbloom_alloc(cms->size);
+	if (cms->counters == NULL) {
+		return CMS_OUTOFMEMORY;
+	}
+
+	return CMS_SUCCESS;
+}
+
+/**
+ * @brief Free the memory of a count-min sketch.
+ *
+ * @param cms Pointer to the sketch to destroy.
+ */
+void cmsketch_destroy(cmsketch *cms) {
+	archbloom_free(cms->counters);
+	cms->counters = NULL;
+}
+
+/**
+ * @brief Select the hash strategy used by a count-min sketch. See
+ * `bloom_set_hash()`.
+ *
+ * @return true on success.
+ * @return false if the strategy is unknown, or elements have already
+ *         been added to the sketch.
+ */
+bool cmsketch_set_hash(cmsketch *cms, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) || bitops_nonzero_bytes(cms->counters, cms->size) != 0) {
+		return false;
+	}
+
+	cms->hash = strategy;
+
+	return true;
+}
+
+/**
+ * @brief Reset every counter of a count-min sketch to zero.
+ *
+ * @param cms Pointer to the sketch to clear.
+ */
+void cmsketch_clear(cmsketch *cms) {
+	memset(cms->counters, 0, cms->size);
+	cms->total = 0;
+}
+
+/**
+ * @brief Add `count` occurrences of an element that has already been
+ * hashed.
+ *
+ * Without CMSKETCH_FLAG_CONSERVATIVE every counter of the element is
+ * incremented. With it, the element's estimate is raised by `count` and
+ * only counters below the new estimate are raised to it. Counters
+ * saturate at the largest value they hold.
+ *
+ * @param cms Pointer to the sketch.
+ * @param hash The element's `hash_128()`, with the sketch's strategy.
+ * @param count Number of occurrences to add.
+ *
+ * @return The element's estimated count after adding it.
+ */
+uint64_t cmsketch_add_hashed(cmsketch *cms, const uint64_t *hash, const uint64_t count) {
+	uint64_t limit    = counter_max(cms->csize);
+	uint64_t estimate = UINT64_MAX;
+
+	cms->total += count;
+
+	if (cms->flags & CMSKETCH_FLAG_CONSERVATIVE) {
+		uint64_t target = cmsketch_count_hashed(cms, hash);
+
+		target = (limit - target < count) ? limit : target + count;
+		for (uint64_t row = 0; row < cms->depth; row++) {
+			uint64_t i = row_counter(cms, hash, row);
+
+			if (get_counter(cms, i) < target) {
+				set_counter(cms, i, target);
+			}
+		}
+
+		return target;
+	}
+
+	for (uint64_t row = 0; row < cms->depth; row++) {
+		uint64_t i     = row_counter(cms, hash, row);
+		uint64_t value = get_counter(cms, i);
+
+		value = (limit - value < count) ? limit : value + count;
+		set_counter(cms, i, value);
+		estimate = (value < estimate) ? value : estimate;
+	}
+
+	return estimate;
+}
+
+/**
+ * @brief Add `count` occurrences of an element to a count-min sketch.
+ *
+ * @param cms Pointer to the sketch.
+ * @param element Pointer to the element to add.
+ * @param len Length of the element in bytes.
+ * @param count Number of occurrences to add.
+ *
+ * @return The element's estimated count after adding it.
+ */
+uint64_t cmsketch_add_count(cmsketch *cms, const void *element, const size_t len, const uint64_t count) {
+	uint64_t hash[2];
+
+	hash_128(cms->hash, element, len, hash);
+
+	return cmsketch_add_hashed(cms, hash, count);
+}
+
+/**
+ * @brief Add one occurrence of an element to a count-min sketch.
+ *
+ * @return The element's estimated count after adding it.
+ */
+uint64_t cmsketch_add(cmsketch *cms, const void *element, const size_t len) {
+	return cmsketch_add_count(cms, element, len, 1);
+}
+
+/**
+ * @brief Helper function for `cmsketch_add()` to handle string elements.
+ */
+uint64_t cmsketch_add_string(cmsketch *cms, const char *element) {
+	return cmsketch_add(cms, element, strlen(element));
+}
+
+/**
+ * @brief Estimate the count of an element that has already been
+ * hashed: the smallest of its counters.
+ *
+ * @param cms Pointer to the sketch.
+ * @param hash The element's `hash_128()`, with the sketch's strategy.
+ *
+ * @return The estimated count, which is never less than the number of
+ *         times the element was added unless its counters saturated.
+ */
+uint64_t cmsketch_count_hashed(const cmsketch *cms, const uint64_t *hash) {
+	uint64_t estimate = UINT64_MAX;
+
+	for (uint64_t row = 0; row < cms->depth && estimate != 0; row++) {
+		uint64_t value = get_counter(cms, row_counter(cms, hash, row));
+
+		estimate = (value < estimate) ? value : estimate;
+	}
+
+	return estimate;
+}
+
+/**
+ * @brief Estimate the count of an element in a count-min sketch. See
+ * `cmsketch_count_hashed()`.
+ *
+ * @param cms Pointer to the sketch.
+ * @param element Pointer to the element to count.
+ * @param len Length of the element in bytes.
+ *
+ * @return The estimated count.
+ */
+uint64_t cmsketch_count(const cmsketch *cms, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(cms->hash, element, len, hash);
+
+	return cmsketch_count_hashed(cms, hash);
+}
+
+/**
+ * @brief Helper function for `cmsketch_count()` to handle string elements.
+ */
+uint64_t cmsketch_count_string(const cmsketch *cms, const char *element) {
+	return cmsketch_count(cms, element, strlen(element));
+}
+
+/**
+ * @brief Initialize a heavy hitter tracker for a count-min sketch.
+ *
+ * Elements added through `cmsketch_topk_add()` are counted in `cms`,
+ * and the `k` with the highest estimates are kept along with a copy of
+ * each. Elements added to `cms` directly aren't tracked, but their
+ * counts still raise the estimates of the elements they collide with.
+ *
+ * @param topk Pointer to the tracker to initialize.
+ * @param cms Sketch to count elements in. It must outlive the tracker.
+ * @param k Number of elements to track.
+ *
+ * @return CMS_SUCCESS on success.
+ * @return CMS_INVALIDPARAM if `k` is 0.
+ * @return CMS_OUTOFMEMORY if memory allocation fails.
+ */
+cmsketch_error_t cmsketch_topk_init(cmsketch_topk *topk, cmsketch *cms, const size_t k) {
+	if (k == 0) {
+		return CMS_INVALIDPARAM;
+	}
+
+	topk->cms   = cms;
+	topk->k     = k;
+	topk->count = 0;
+	topk->heap  = calloc(k, sizeof(cmsketch_heavy_hitter));
+	if (topk->heap == NULL) {
+		return CMS_OUTOFMEMORY;
+	}
+
+	return CMS_SUCCESS;
+}
+
+/**
+ * @brief Forget every element tracked by a heavy hitter tracker. The
+ * sketch is left alone; see `cmsketch_clear()`.
+ *
+ * @param topk Pointer to the tracker to clear.
+ */
+void cmsketch_topk_clear(cmsketch_topk *topk) {
+	for (size_t i = 0; i < topk->count; i++) {
+		free(topk->heap[i].element);
+		topk->heap[i].element = NULL;
+	}
+
+	topk->count = 0;
+}
+
+/**
+ * @brief Free the memory of a heavy hitter tracker. The sketch is
+ * left alone.
+ *
+ * @param topk Pointer to the tracker to destroy.
+ */
+void cmsketch_topk_destroy(cmsketch_topk *topk) {
+	cmsketch_topk_clear(topk);
+	free(topk->heap);
+	topk->heap = NULL;
+}
+
+/**
+ * @brief Helper function to restore the heap order after the count of
+ * entry `i` grew.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void sift_down(cmsketch_topk *topk, size_t i) {
+	cmsketch_heavy_hitter entry = topk->heap[i];
+
+	for (;;) {
+		size_t child = (2 * i) + 1;
+
+		if (child >= topk->count) {
+			break;
+		}
+		if (child + 1 < topk->count && topk->heap[child + 1].count < topk->heap[child].count) {
+			child++;
+		}
+		if (entry.count <= topk->heap[child].count) {
+			break;
+		}
+
+		topk->heap[i] = topk->heap[child];
+		i             = child;
+	}
+
+	topk->heap[i] = entry;
+}
+
+/**
+ * @brief Helper function to move a new entry `i` up to its place in
+ * the heap.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void sift_up(cmsketch_topk *topk, size_t i) {
+	cmsketch_heavy_hitter entry = topk->heap[i];
+
+	while (i > 0 && topk->heap[(i - 1) / 2].count > entry.count) {
+		topk->heap[i] = topk->heap[(i - 1) / 2];
+		i             = (i - 1) / 2;
+	}
+
+	topk->heap[i] = entry;
+}
+
+/**
+ * @brief Helper function to record a new estimate for an element.
+ *
+ * Tracked counts never exceed the element's current estimate, which
+ * only grows, so an element whose estimate doesn't beat the smallest
+ * tracked count of a full tracker can't be in it. Only elements that
+ * do are looked for, with a scan of the tracked hashes. If copying an
+ * element fails it isn't tracked.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static void topk_update(cmsketch_topk *topk, const uint64_t *hash, const void *element, const size_t len, const uint64_t estimate) {
+	cmsketch_heavy_hitter *entry;
+	uint8_t               *copy;
+
+	if (topk->count == topk->k && estimate <= topk->heap[0].count) {
+		return;
+	}
+
+	for (size_t i = 0; i < topk->count; i++) {
+		entry = &topk->heap[i];
+		if (entry->hash[0] == hash[0] && entry->hash[1] == hash[1] &&
+			entry->len == len && memcmp(entry->element, element, len) == 0) {
+			entry->count = estimate;
+			sift_down(topk, i);
+			return;
+		}
+	}
+
+	copy = malloc(len ? len : 1);
+	if (copy == NULL) {
+		return;
+	}
+	memcpy(copy, element, len);
+
+	// a full tracker evicts its coldest element
+	entry = (topk->count < topk->k) ? &topk->heap[topk->count] : &topk->heap[0];
+	if (topk->count == topk->k) {
+		free(entry->element);
+	}
+
+	entry->count   = estimate;
+	entry->hash[0] = hash[0];
+	entry->hash[1] = hash[1];
+	entry->len     = len;
+	entry->element = copy;
+
+	if (topk->count < topk->k) {
+		sift_up(topk, topk->count++);
+	} else {
+		sift_down(topk, 0);
+	}
+}
+
+/**
+ * @brief Add `count` occurrences of an element to a tracker's sketch,
+ * and track it if it is now among the `k` hottest.
+ *
+ * @param topk Pointer to the tracker.
+ * @param element Pointer to the element to add.
+ * @param len Length of the element in bytes.
+ * @param count Number of occurrences to add.
+ *
+ * @return The element's estimated count after adding it.
+ */
+uint64_t cmsketch_topk_add_count(cmsketch_topk *topk, const void *element, const size_t len, const uint64_t count) {
+	uint64_t hash[2];
+	uint64_t estimate;
+
+	hash_128(topk->cms->hash, element, len, hash);
+
+	estimate = cmsketch_add_hashed(topk->cms, hash, count);
+	topk_update(topk, hash, element, len, estimate);
+
+	return estimate;
+}
+
+/**
+ * @brief Add one occurrence of an element to a tracker. See
+ * `cmsketch_topk_add_count()`.
+ */
+uint64_t cmsketch_topk_add(cmsketch_topk *topk, const void *element, const size_t len) {
+	return cmsketch_topk_add_count(topk, element, len, 1);
+}
+
+/**
+ * @brief Helper function for `cmsketch_topk_add()` to handle string
+ * elements.
+ */
+uint64_t cmsketch_topk_add_string(cmsketch_topk *topk, const char *element) {
+	return cmsketch_topk_add(topk, element, strlen(element));
+}
+
+/**
+ * @brief Helper function for `cmsketch_topk_list()` to sort entries
+ * by count, highest first.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static int compare_hitters(const void *a, const void *b) {
+	uint64_t count_a = ((const cmsketch_heavy_hitter *)a)->count;
+	uint64_t count_b = ((const cmsketch_heavy_hitter *)b)->count;
+
+	return (count_a < count_b) - (count_a > count_b);
+}
+
+/**
+ * @brief List the elements a heavy hitter tracker holds, hottest
+ * first.
+ *
+ * The entries are copied, but their `element` pointers still belong to
+ * the tracker and are only valid until it is next added to, cleared or
+ * destroyed.
+ *
+ * @param topk Pointer to the tracker.
+ * @param hitters Array with room for `topk->k` entries.
+ *
+ * @return Number of entries stored in `hitters`.
+ */
+size_t cmsketch_topk_list(const cmsketch_topk *topk, cmsketch_heavy_hitter *hitters) {
+	memcpy(hitters, topk->heap, topk->count * sizeof(cmsketch_heavy_hitter));
+	qsort(hitters, topk->count, sizeof(cmsketch_heavy_hitter), compare_hitters);
+
+	return topk->count;
+}
+
+/**
+ * @brief Get a human-readable message for a count-min sketch error
+ * code.
+ *
+ * @return The message, or "Unknown error" if the code is out of range.
+ */
+const char *cmsketch_strerror(const cmsketch_error_t error) {
+	if (error < 0 || error >= CMS_ERRORCOUNT) {
+		return "Unknown error";
+	}
+
+	return cmsketch_errors[error];
+}
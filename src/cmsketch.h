@@ -0,0 +1,158 @@
+/**
+ * @file cmsketch.h
+ * @brief Header file for count-min sketches and heavy hitter tracking
+ * @author Daniel Roberson
+ *
+ * This file contains the function declarations, type definitions, and
+ * macros for working with count-min sketches: frequency estimators
+ * that, like `cbloom_count()`, may overcount an element but never
+ * undercount it.
+ *
+ * A counting Bloom filter hashes every element onto `hashcount`
+ * counters in one shared array, so every counter is shared by the
+ * probes of all elements. A count-min sketch gives each hash its own
+ * row of `width` counters instead, and estimates an element's count
+ * as the smallest of its `depth` counters. With `width = e / epsilon`
+ * and `depth = ln(1 / delta)`, an estimate exceeds the true count by
+ * more than `epsilon` times the total of all counts with probability
+ * at most `delta`.
+ *
+ * Counters use the `counter_size` widths of counting Bloom filters and
+ * saturate at the largest value they hold.
+ *
+ * `cmsketch_topk` tracks the K elements with the highest estimates as
+ * they are added, so the hottest elements can be listed in O(K)
+ * without sweeping the sketch.
+ *
+ * @see cmsketch.c for the corresponding implementation.
+ * @see cbloom.h for counting Bloom filters.
+ */
+#ifndef CMSKETCH_H
+#define CMSKETCH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+#include "cbloom.h"
+
+/**
+ * @def CMSKETCH_FLAG_CONSERVATIVE
+ * @brief `cmsketch_init_flags()` flag: conservative update. Adding an
+ * element only raises those of its counters that are below its new
+ * estimate, rather than incrementing all of them. Estimates stay upper
+ * bounds and are much closer to the true counts for skewed data.
+ */
+#define CMSKETCH_FLAG_CONSERVATIVE 0x01
+
+/**
+ * @def CMSKETCH_FLAGS_ALL
+ * @brief Every flag understood by this version of the library.
+ */
+#define CMSKETCH_FLAGS_ALL         (CMSKETCH_FLAG_CONSERVATIVE)
+
+/**
+ * @brief Error handling return values for count-min sketch
+ * operations.
+ */
+typedef enum {
+	CMS_SUCCESS = 0,          /**< Operation completed successfully. */
+	CMS_INVALIDPARAM,         /**< Epsilon, delta, width, depth or K out of range. */
+	CMS_INVALIDCOUNTERSIZE,   /**< Unknown counter size. */
+	CMS_OUTOFMEMORY,          /**< Memory allocation failed. */
+	// Used for counting the number of statuses. Do not add statuses below this line.
+	CMS_ERRORCOUNT            /**< Total number of error statuses. */
+} cmsketch_error_t;
+
+/**
+ * @var cmsketch_errors
+ * @brief Human-readable messages for `cmsketch_error_t` codes. Use
+ * `cmsketch_strerror()` rather than indexing it directly.
+ */
+extern const char *cmsketch_errors[];
+
+/**
+ * @struct cmsketch
+ * @brief Count-min sketch data structure.
+ *
+ * @var cmsketch::counters
+ * `depth` rows of `width` counters. Row `r` holds the counters for
+ * probe `r` of each element's `hash_128()`.
+ */
+typedef struct {
+	uint64_t       width;    /**< Counters per row. */
+	uint64_t       depth;    /**< Number of rows. */
+	counter_size   csize;    /**< Size of each counter. */
+	uint32_t       flags;    /**< CMSKETCH_FLAG_* options. */
+	hash_strategy  hash;     /**< Hash strategy. See cmsketch_set_hash(). */
+	uint64_t       total;    /**< Sum of every count added. */
+	size_t         size;     /**< Size of the counters in bytes. */
+	void          *counters; /**< Pointer to the counters. */
+} cmsketch;
+
+/**
+ * @struct cmsketch_heavy_hitter
+ * @brief An element tracked by `cmsketch_topk`.
+ */
+typedef struct {
+	uint64_t  count;   /**< Estimated count when the element was last added. */
+	uint64_t  hash[2]; /**< The element's `hash_128()`. */
+	size_t    len;     /**< Length of the element in bytes. */
+	uint8_t  *element; /**< Copy of the element, owned by the tracker. */
+} cmsketch_heavy_hitter;
+
+/**
+ * @struct cmsketch_topk
+ * @brief Heavy hitter tracker: the `k` elements with the highest
+ * estimates seen by a count-min sketch.
+ *
+ * @var cmsketch_topk::heap
+ * Min-heap of tracked elements on `count`. An element can only enter
+ * once its estimate beats the smallest tracked count, so elements
+ * that aren't hot cost one comparison to check.
+ */
+typedef struct {
+	cmsketch              *cms;   /**< Sketch elements are counted in. */
+	size_t                 k;     /**< Most elements tracked. */
+	size_t                 count; /**< Elements tracked now. */
+	cmsketch_heavy_hitter *heap;  /**< `k` tracked elements. */
+} cmsketch_topk;
+
+/* function declarations
+ */
+cmsketch_error_t  cmsketch_init(cmsketch *, const float, const float, const counter_size);
+cmsketch_error_t  cmsketch_init_flags(cmsketch *,
+                                      const float,
+                                      const float,
+                                      const counter_size,
+                                      const uint32_t);
+cmsketch_error_t  cmsketch_init_size(cmsketch *,
+                                     const uint64_t,
+                                     const uint64_t,
+                                     const counter_size,
+                                     const uint32_t);
+void              cmsketch_destroy(cmsketch *);
+bool              cmsketch_set_hash(cmsketch *, const hash_strategy);
+void              cmsketch_clear(cmsketch *);
+
+uint64_t          cmsketch_add(cmsketch *, const void *, const size_t);
+uint64_t          cmsketch_add_string(cmsketch *, const char *);
+uint64_t          cmsketch_add_count(cmsketch *, const void *, const size_t, const uint64_t);
+uint64_t          cmsketch_add_hashed(cmsketch *, const uint64_t *, const uint64_t);
+
+uint64_t          cmsketch_count(const cmsketch *, const void *, const size_t);
+uint64_t          cmsketch_count_string(const cmsketch *, const char *);
+uint64_t          cmsketch_count_hashed(const cmsketch *, const uint64_t *);
+
+cmsketch_error_t  cmsketch_topk_init(cmsketch_topk *, cmsketch *, const size_t);
+void              cmsketch_topk_destroy(cmsketch_topk *);
+void              cmsketch_topk_clear(cmsketch_topk *);
+uint64_t          cmsketch_topk_add(cmsketch_topk *, const void *, const size_t);
+uint64_t          cmsketch_topk_add_string(cmsketch_topk *, const char *);
+uint64_t          cmsketch_topk_add_count(cmsketch_topk *, const void *, const size_t, const uint64_t);
+size_t            cmsketch_topk_list(const cmsketch_topk *, cmsketch_heavy_hitter *);
+
+const char       *cmsketch_strerror(const cmsketch_error_t);
+
+#endif /* CMSKETCH_H */
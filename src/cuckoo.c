@@ -9,11 +9,54 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "cuckoo.h"
-#include "mmh3.h"
+#include "hash.h"
+#include "fastrange.h"
+#include "mapfile.h"
+#include "alloc.h"
 
+_Static_assert(sizeof(cuckoofilter_file) == 64,
+               "cuckoofilter_file must match the legacy header layout");
+
+/* bucket_t -- a whole bucket. Fingerprint `i` is held in bits
+ * [i * fingerprint_size, (i + 1) * fingerprint_size), so a bucket is
+ * searched for a fingerprint with a few word operations (SWAR) rather
+ * than a loop over its slots.
+ */
+typedef unsigned __int128 bucket_t;
+
+/* CUCKOO_LOCK_STRIPES, CUCKOO_VERSIONS -- number of writer locks and
+ * reader version counters of a CUCKOO_FLAG_CONCURRENT filter. Buckets
+ * are assigned both by index. CUCKOO_VERSIONS is a multiple of
+ * CUCKOO_LOCK_STRIPES, so buckets sharing a version counter share a
+ * lock.
+ */
+#define CUCKOO_LOCK_STRIPES 64
+#define CUCKOO_VERSIONS     1024
+
+// a lock padded to its own cache line, so neighbouring stripes don't share one
+typedef union {
+	pthread_mutex_t mutex;
+	uint8_t         pad[64];
+} lock_stripe;
+
+/* cuckoo_sync -- writers hold `evicting` shared and the lock stripes
+ * of the buckets they change, or `evicting` exclusive to move
+ * fingerprints between buckets. Writers make a bucket's version odd
+ * while they change it. Readers take no locks; they retry a negative
+ * lookup if either bucket's version changed meanwhile.
+ */
+struct cuckoo_sync {
+	pthread_rwlock_t evicting;
+	lock_stripe      stripes[CUCKOO_LOCK_STRIPES];
+	uint32_t         versions[CUCKOO_VERSIONS];
+};
 
 // TODO: move to .c/.h so xorshift32 can be used elsewhere
 // TODO: xorshift64
@@ -38,112 +81,441 @@ static uint32_t xorshift32(uint32_t *state) {
 	return x;
 }
 
-bool cuckoo_init(cuckoofilter *cf, size_t num_buckets, size_t bucket_size,
-				 size_t max_kicks) {
+/* valid_geometry() -- buckets hold a power of two number of
+ * fingerprints, up to 8, and must be a whole number of bytes.
+ * Concurrent filters need buckets that can be read atomically.
+ */
+static bool valid_geometry(const size_t bucket_size, const size_t fingerprint_size, const uint32_t flags) {
+	if (bucket_size == 0 || bucket_size > 8 || (bucket_size & (bucket_size - 1)) != 0) {
+		return false;
+	}
+
+	if (fingerprint_size != 8 && fingerprint_size != 12 && fingerprint_size != 16) {
+		return false;
+	}
+
+	if ((bucket_size * fingerprint_size) % 8 != 0) {
+		return false;
+	}
+
+	return !((flags & CUCKOO_FLAG_CONCURRENT) && fingerprint_size == 12);
+}
+
+// bytes of bucket storage, padded so bucket_insertions stays aligned
+static inline size_t buckets_size(const size_t num_buckets, const size_t bucket_bytes) {
+	return ((num_buckets * bucket_bytes) + 7) & ~(size_t)7;
+}
+
+/* alloc_state() -- allocate the runtime statistics, the eviction
+ * scratch space and, for concurrent filters, the locks. A filter
+ * whose statistics can't be allocated keeps none.
+ */
+static bool alloc_state(cuckoofilter *cf) {
+	cf->stats     = archbloom_counters_alloc(cf->flags & CUCKOO_FLAG_CONCURRENT);
+	cf->kick_path = malloc((cf->max_kicks + 1) * sizeof(uint64_t));
+	if (cf->kick_path == NULL) {
+		return false;
+	}
+
+	if (cf->flags & CUCKOO_FLAG_CONCURRENT) {
+		cf->sync = calloc(1, sizeof(cuckoo_sync));
+		if (cf->sync == NULL) {
+			return false;
+		}
+
+		pthread_rwlock_init(&cf->sync->evicting, NULL);
+		for (size_t i = 0; i < CUCKOO_LOCK_STRIPES; i++) {
+			pthread_mutex_init(&cf->sync->stripes[i].mutex, NULL);
+		}
+	}
+
+	return true;
+}
+
+/* cuckoo_init_flags() -- initialize a cuckoo filter with
+ * `fingerprint_size` bit fingerprints (8, 12, or 16) and a set of
+ * CUCKOO_FLAG_* options. Smaller fingerprints take less memory at the
+ * cost of more false positives: about 2 * bucket_size / 2^bits.
+ * Returns false if the parameters are invalid or allocation fails.
+ */
+bool cuckoo_init_flags(cuckoofilter *cf, size_t num_buckets, size_t bucket_size,
+					   size_t max_kicks, size_t fingerprint_size, uint32_t flags) {
+	memset(cf, 0, sizeof(cuckoofilter));
+
+	if (num_buckets == 0 || (flags & ~(CUCKOO_FLAG_CONCURRENT | CUCKOO_FLAG_GROW)) ||
+		!valid_geometry(bucket_size, fingerprint_size, flags)) {
+		return false;
+	}
+
 	cf->num_buckets      = num_buckets;
 	cf->bucket_size      = bucket_size;
+	cf->fingerprint_size = fingerprint_size;
+	cf->bucket_bytes     = (bucket_size * fingerprint_size) / 8;
 	cf->max_kicks        = max_kicks;
 	cf->prng_state       = seed_xorshift32();
-	cf->total_insertions = 0;
-	cf->evictions        = 0;
+	cf->flags            = flags;
+	cf->hash             = HASH_MMH3;
 
-	cf->buckets          = (cuckoobucket *)calloc(num_buckets * bucket_size, sizeof(cuckoobucket));
-	if (cf->buckets == NULL) {
-		return false;
-	}
-
-	cf->bucket_insertions = calloc(num_buckets, sizeof(size_t));
-	if (cf->bucket_insertions == NULL) {
-		free(cf->buckets);
+	cf->buckets           = archbloom_alloc(buckets_size(num_buckets, cf->bucket_bytes));
+	cf->bucket_insertions = archbloom_alloc(num_buckets * sizeof(size_t));
+	if (cf->buckets == NULL || cf->bucket_insertions == NULL || !alloc_state(cf)) {
+		cuckoo_destroy(cf);
 		return false;
 	}
 
 	return true;
 }
 
+/* cuckoo_init() -- initialize a cuckoo filter with 16 bit fingerprints.
+ */
+bool cuckoo_init(cuckoofilter *cf, size_t num_buckets, size_t bucket_size,
+				 size_t max_kicks) {
+	return cuckoo_init_flags(cf, num_buckets, bucket_size, max_kicks, 16, 0);
+}
+
 void cuckoo_destroy(cuckoofilter *cf) {
+	if (cf->map) {
+		munmap(cf->map, cf->map_size);
+		cf->map               = NULL;
+		cf->buckets           = NULL;
+		cf->bucket_insertions = NULL;
+	}
+
 	if (cf->bucket_insertions) {
-		free(cf->bucket_insertions);
+		archbloom_free(cf->bucket_insertions);
 		cf->bucket_insertions = NULL;
 	}
 
 	if (cf->buckets) {
-		free(cf->buckets);
+		archbloom_free(cf->buckets);
 		cf->buckets = NULL;
 	}
-}
 
-static bool cuckoo_add_fingerprint(cuckoofilter cf, size_t bucket_index, size_t offset, uint16_t fingerprint) {
-	for (size_t b = 0; b < cf.bucket_size; b++) {
-		if (cf.buckets[offset + b].fingerprint == 0) {
-			cf.buckets[offset + b].fingerprint = fingerprint;
-			cf.bucket_insertions[bucket_index] += 1;
-			cf.total_insertions += 1;
-			return true;
+	if (cf->sync) {
+		pthread_rwlock_destroy(&cf->sync->evicting);
+		for (size_t i = 0; i < CUCKOO_LOCK_STRIPES; i++) {
+			pthread_mutex_destroy(&cf->sync->stripes[i].mutex);
 		}
+		free(cf->sync);
+		cf->sync = NULL;
 	}
 
-	return false;
+	free(cf->kick_path);
+	cf->kick_path = NULL;
+
+	archbloom_counters_free(cf->stats);
+	cf->stats = NULL;
+
+	if (cf->next) {
+		cuckoo_destroy(cf->next);
+		free(cf->next);
+		cf->next = NULL;
+	}
 }
 
-bool cuckoo_add(cuckoofilter cf, void *key, size_t len) {
-	uint32_t hash          = mmh3_32(key, len, 0);
-	uint16_t fingerprint   = (uint16_t)(hash & 0xffff); // lower 16 bits
-	size_t   i1            = hash % cf.num_buckets;
-	size_t   i2            = (i1 ^ (fingerprint >> 1)) % cf.num_buckets;
-	size_t   i1_offset     = i1 * cf.bucket_size;
-	size_t   i2_offset     = i2 * cf.bucket_size;
+/* cuckoo_set_hash() -- select the hash strategy used by an empty
+ * cuckoo filter. Defaults to HASH_MMH3. Returns false if the strategy
+ * is unknown or the filter already holds elements.
+ */
+bool cuckoo_set_hash(cuckoofilter *cf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy)) {
+		return false;
+	}
 
-	if (cuckoo_add_fingerprint(cf, i1, i1_offset, fingerprint) ||
-		cuckoo_add_fingerprint(cf, i2, i2_offset, fingerprint)) {
-		return true;
+	if (cf->total_insertions > 0 || cf->next != NULL) {
+		return false;
 	}
 
-	// Eviction
-	size_t index        = (xorshift32(&cf.prng_state) % 2) ? i1 : i2;
-	size_t index_offset = index * cf.bucket_size;
+	cf->hash = strategy;
+
+	return true;
+}
+
+/* load_bytes(), store_bytes() -- move the first `n` bytes of a word to
+ * and from memory, keeping the host's byte order. `n` is a constant
+ * wherever these are used, so the copies are inlined.
+ */
+static inline uint64_t load_bytes(const uint8_t *p, const size_t n) {
+	uint64_t word = 0;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	memcpy((uint8_t *)&word + sizeof(word) - n, p, n);
+#else
+	memcpy(&word, p, n);
+#endif
+
+	return word;
+}
+
+static inline void store_bytes(uint8_t *p, const uint64_t word, const size_t n) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	memcpy(p, (const uint8_t *)&word + sizeof(word) - n, n);
+#else
+	memcpy(p, &word, n);
+#endif
+}
 
-	for (size_t kick = 0; kick < cf.max_kicks; kick++) {
-		size_t b = xorshift32(&cf.prng_state) % cf.bucket_size;
-		uint32_t evicted = cf.buckets[index_offset + b].fingerprint;
-		cf.buckets[index_offset + b].fingerprint = fingerprint;
-		fingerprint = evicted;
+/* load_bucket(), store_bucket() -- read and write bucket `index`.
+ * Concurrent filters use atomic accesses, which their bucket sizes
+ * allow; a 16 byte bucket is two words, and writers only change one
+ * fingerprint, so one word, at a time.
+ */
+static inline bucket_t load_bucket(const cuckoofilter *cf, const size_t index) {
+	const uint8_t *p = cf->buckets + (index * cf->bucket_bytes);
 
-		if (cf.bucket_insertions[index] > 0) {
-			cf.bucket_insertions[index] -= 1;
+	if (cf->sync != NULL) {
+		switch (cf->bucket_bytes) {
+		case 1:  return __atomic_load_n(p, __ATOMIC_RELAXED);
+		case 2:  return __atomic_load_n((const uint16_t *)p, __ATOMIC_RELAXED);
+		case 4:  return __atomic_load_n((const uint32_t *)p, __ATOMIC_RELAXED);
+		case 8:  return __atomic_load_n((const uint64_t *)p, __ATOMIC_RELAXED);
+		default:
+			return ((bucket_t)__atomic_load_n((const uint64_t *)p + 1, __ATOMIC_RELAXED) << 64) |
+				__atomic_load_n((const uint64_t *)p, __ATOMIC_RELAXED);
 		}
+	}
 
-		// re-insert into new bucket
-		index = (index ^ fingerprint) % cf.num_buckets;
-		size_t new_index_offset = index * cf.bucket_size;
-		if (cuckoo_add_fingerprint(cf, index, new_index_offset, fingerprint)) {
-			return true;
+	switch (cf->bucket_bytes) {
+	case 1:  return p[0];
+	case 2:  return load_bytes(p, 2);
+	case 3:  return load_bytes(p, 3);
+	case 4:  return load_bytes(p, 4);
+	case 6:  return load_bytes(p, 6);
+	case 8:  return load_bytes(p, 8);
+	case 12: return ((bucket_t)load_bytes(p + 8, 4) << 64) | load_bytes(p, 8);
+	default: return ((bucket_t)load_bytes(p + 8, 8) << 64) | load_bytes(p, 8);
+	}
+}
+
+static inline void store_bucket(cuckoofilter *cf, const size_t index, const bucket_t bucket) {
+	uint8_t  *p  = cf->buckets + (index * cf->bucket_bytes);
+	uint64_t  lo = (uint64_t)bucket;
+	uint64_t  hi = (uint64_t)(bucket >> 64);
+
+	if (cf->sync != NULL) {
+		switch (cf->bucket_bytes) {
+		case 1:  __atomic_store_n(p, (uint8_t)lo, __ATOMIC_RELAXED); break;
+		case 2:  __atomic_store_n((uint16_t *)p, (uint16_t)lo, __ATOMIC_RELAXED); break;
+		case 4:  __atomic_store_n((uint32_t *)p, (uint32_t)lo, __ATOMIC_RELAXED); break;
+		case 8:  __atomic_store_n((uint64_t *)p, lo, __ATOMIC_RELAXED); break;
+		default:
+			__atomic_store_n((uint64_t *)p, lo, __ATOMIC_RELAXED);
+			__atomic_store_n((uint64_t *)p + 1, hi, __ATOMIC_RELAXED);
+			break;
 		}
+		return;
 	}
 
-	cf.evictions += 1;
-	return false; // max kicks reached; insertion failed.
+	switch (cf->bucket_bytes) {
+	case 1:  p[0] = (uint8_t)lo; break;
+	case 2:  store_bytes(p, lo, 2); break;
+	case 3:  store_bytes(p, lo, 3); break;
+	case 4:  store_bytes(p, lo, 4); break;
+	case 6:  store_bytes(p, lo, 6); break;
+	case 8:  store_bytes(p, lo, 8); break;
+	case 12: store_bytes(p, lo, 8); store_bytes(p + 8, hi, 4); break;
+	default: store_bytes(p, lo, 8); store_bytes(p + 8, hi, 8); break;
+	}
 }
 
-bool cuckoo_add_string(cuckoofilter cf, char *key) {
-	return cuckoo_add(cf, key, strlen(key));
+// the lowest bit of every fingerprint in a bucket
+static inline bucket_t lane_ones(const cuckoofilter *cf) {
+	bucket_t ones = 1;
+
+	for (size_t n = 1; n < cf->bucket_size; n *= 2) {
+		ones |= ones << (n * cf->fingerprint_size);
+	}
+
+	return ones;
+}
+
+/* find_fingerprint() -- slot of `bucket` holding `fingerprint`, or -1.
+ * Finds an empty slot with a fingerprint of 0.
+ *
+ * Every slot is XORed with the fingerprint at once, then the classic
+ * "has a zero byte" test, on fingerprint sized lanes, flags the slots
+ * that matched. A borrow can flag a slot above a match, but never
+ * below one, so the lowest flag is exact.
+ */
+static inline int find_fingerprint(const cuckoofilter *cf, const bucket_t bucket, const uint32_t fingerprint) {
+	bucket_t ones    = lane_ones(cf);
+	bucket_t x       = bucket ^ (ones * fingerprint);
+	bucket_t found   = (x - ones) & ~x & (ones << (cf->fingerprint_size - 1));
+	uint64_t low     = (uint64_t)found;
+
+	if (found == 0) {
+		return -1;
+	}
+
+	if (low != 0) {
+		return __builtin_ctzll(low) / cf->fingerprint_size;
+	}
+
+	return (64 + __builtin_ctzll((uint64_t)(found >> 64))) / cf->fingerprint_size;
+}
+
+static inline uint32_t get_fingerprint(const cuckoofilter *cf, const bucket_t bucket, const size_t slot) {
+	return (uint32_t)(bucket >> (slot * cf->fingerprint_size)) & ((1U << cf->fingerprint_size) - 1);
+}
+
+static inline bucket_t set_fingerprint(const cuckoofilter *cf, const bucket_t bucket, const size_t slot, const uint32_t fingerprint) {
+	bucket_t mask = (bucket_t)((1U << cf->fingerprint_size) - 1) << (slot * cf->fingerprint_size);
+
+	return (bucket & ~mask) | ((bucket_t)fingerprint << (slot * cf->fingerprint_size));
+}
+
+/* alt_index() -- the other bucket a fingerprint in bucket `index` may
+ * be in. (t - index) mod num_buckets is its own inverse for any number
+ * of buckets, so fingerprints can be moved back and forth without
+ * knowing which of their buckets they are in.
+ */
+static inline size_t alt_index(const cuckoofilter *cf, const size_t index, const uint32_t fingerprint) {
+	if (cf->flags & CUCKOO_FLAG_LEGACY_INDEX) {
+		return (index ^ (fingerprint >> 1)) % cf->num_buckets;
+	}
+
+	size_t t = fastrange64(fingerprint * 0x9e3779b97f4a7c15ULL, cf->num_buckets);
+
+	return (t >= index) ? t - index : t + cf->num_buckets - index;
+}
+
+/* hash_key() -- hash an element once for every filter in a chain.
+ * CUCKOO_FLAG_LEGACY_INDEX filters use a hash_32() in hash[0]. They
+ * can't grow, so they are never part of a chain.
+ */
+static inline void hash_key(const cuckoofilter *cf, const void *key, const size_t len, uint64_t *hash) {
+	if (cf->flags & CUCKOO_FLAG_LEGACY_INDEX) {
+		hash[0] = hash_32(cf->hash, key, len);
+		hash[1] = 0;
+		return;
+	}
+
+	hash_128(cf->hash, key, len, hash);
+}
+
+/* locate() -- fingerprint and buckets of a hashed element.
+ */
+static inline void locate(const cuckoofilter *cf, const uint64_t *hash,
+						  uint32_t *fingerprint, size_t *i1, size_t *i2) {
+	if (cf->flags & CUCKOO_FLAG_LEGACY_INDEX) {
+		*fingerprint = hash[0] & 0xffff; // lower 16 bits
+		*i1          = hash[0] % cf->num_buckets;
+	} else {
+		*fingerprint  = (uint32_t)(hash[1] >> (64 - cf->fingerprint_size));
+		*fingerprint += (*fingerprint == 0); // 0 is an empty slot
+		*i1           = fastrange64(hash[0], cf->num_buckets);
+	}
+
+	*i2 = alt_index(cf, *i1, *fingerprint);
+}
+
+// the filter chained after `cf`, which concurrent writers may be adding
+static inline cuckoofilter *next_filter(const cuckoofilter *cf) {
+	return __atomic_load_n(&cf->next, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t *version(const cuckoofilter *cf, const size_t index) {
+	return &cf->sync->versions[index % CUCKOO_VERSIONS];
+}
+
+/* write_slot() -- set slot `slot` of bucket `index`. Concurrent
+ * filters make the bucket's version odd for the duration, seqlock
+ * style.
+ */
+static void write_slot(cuckoofilter *cf, const size_t index, const size_t slot, const uint32_t fingerprint) {
+	bucket_t bucket = set_fingerprint(cf, load_bucket(cf, index), slot, fingerprint);
+
+	if (cf->sync == NULL) {
+		store_bucket(cf, index, bucket);
+		return;
+	}
+
+	uint32_t *v     = version(cf, index);
+	uint32_t  start = __atomic_load_n(v, __ATOMIC_RELAXED);
+
+	__atomic_store_n(v, start + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	store_bucket(cf, index, bucket);
+	__atomic_store_n(v, start + 2, __ATOMIC_RELEASE);
+}
+
+static inline void count_insertion(cuckoofilter *cf, const size_t index) {
+	cf->bucket_insertions[index] += 1;
+
+	if (cf->sync != NULL) {
+		__atomic_fetch_add(&cf->total_insertions, 1, __ATOMIC_RELAXED);
+	} else {
+		cf->total_insertions += 1;
+	}
+}
+
+static inline void count_removal(cuckoofilter *cf, const size_t index) {
+	if (cf->bucket_insertions[index] > 0) {
+		cf->bucket_insertions[index] -= 1;
+	}
+
+	if (cf->sync != NULL) {
+		__atomic_fetch_sub(&cf->total_insertions, 1, __ATOMIC_RELAXED);
+	} else if (cf->total_insertions > 0) {
+		cf->total_insertions -= 1;
+	}
 }
 
-bool cuckoo_lookup(cuckoofilter cf, void *key, size_t len) {
-	if (cf.buckets == NULL) { // filter not initialized
+/* lock_buckets(), unlock_buckets() -- take the stripes of two buckets
+ * of a concurrent filter, in order, so writers never deadlock.
+ */
+static void lock_buckets(cuckoofilter *cf, const size_t i1, const size_t i2) {
+	size_t s1 = i1 % CUCKOO_LOCK_STRIPES;
+	size_t s2 = i2 % CUCKOO_LOCK_STRIPES;
+
+	pthread_rwlock_rdlock(&cf->sync->evicting);
+	pthread_mutex_lock(&cf->sync->stripes[(s1 < s2) ? s1 : s2].mutex);
+	if (s1 != s2) {
+		pthread_mutex_lock(&cf->sync->stripes[(s1 < s2) ? s2 : s1].mutex);
+	}
+}
+
+static void unlock_buckets(cuckoofilter *cf, const size_t i1, const size_t i2) {
+	size_t s1 = i1 % CUCKOO_LOCK_STRIPES;
+	size_t s2 = i2 % CUCKOO_LOCK_STRIPES;
+
+	if (s1 != s2) {
+		pthread_mutex_unlock(&cf->sync->stripes[s2].mutex);
+	}
+	pthread_mutex_unlock(&cf->sync->stripes[s1].mutex);
+	pthread_rwlock_unlock(&cf->sync->evicting);
+}
+
+static bool cuckoo_add_fingerprint(cuckoofilter *cf, size_t bucket_index, uint32_t fingerprint) {
+	int slot = find_fingerprint(cf, load_bucket(cf, bucket_index), 0);
+
+	if (slot < 0) {
 		return false;
 	}
-	uint32_t hash        = mmh3_32(key, len, 0);
-	uint16_t fingerprint = (uint16_t)(hash & 0xffff);
-	size_t   i1          = hash % cf.num_buckets;
-	size_t   i2          = (i1 ^ (fingerprint >> 1)) % cf.num_buckets;
 
-	size_t   i1_offset   = i1 * cf.bucket_size;
-	size_t   i2_offset   = i2 * cf.bucket_size;
+	write_slot(cf, bucket_index, slot, fingerprint);
+	count_insertion(cf, bucket_index);
+
+	return true;
+}
+
+/* count_kicks() -- record an insertion that moved `moved`
+ * fingerprints. Called with evictions excluding other writers.
+ */
+static void count_kicks(cuckoofilter *cf, const size_t moved) {
+	size_t bucket = (63 - __builtin_clzll(moved));
 
-	for (size_t b = 0; b < cf.bucket_size; b++) {
-		if (cf.buckets[i1_offset + b].fingerprint == fingerprint ||
-			cf.buckets[i2_offset + b].fingerprint == fingerprint) {
+	cf->kicks += moved;
+	cf->kick_histogram[(bucket < CUCKOO_KICK_HISTOGRAM) ? bucket : CUCKOO_KICK_HISTOGRAM - 1] += 1;
+	if (moved > cf->longest_chain) {
+		cf->longest_chain = moved;
+	}
+}
+
+// true if slot `slot` of bucket `index` is one of the first `count` on the path
+static bool on_path(const uint64_t *path, const size_t count, const size_t index, const size_t slot) {
+	for (size_t i = 0; i < count; i++) {
+		if (path[i] == (index * 8) + slot) {
 			return true;
 		}
 	}
@@ -151,58 +523,355 @@ bool cuckoo_lookup(cuckoofilter cf, void *key, size_t len) {
 	return false;
 }
 
-bool cuckoo_lookup_string(cuckoofilter cf, char *key) {
-	return cuckoo_lookup(cf, key, strlen(key));
-}
+/* evict() -- make room for `fingerprint` in bucket i1 or i2 by moving
+ * other fingerprints to their alternate buckets.
+ *
+ * A random walk looks for a chain of fingerprints that ends at a
+ * bucket with a free slot, without changing anything. The chain is
+ * then moved last to first, so every fingerprint is in one of its
+ * buckets the whole time and concurrent lookups can't miss it, and
+ * an insertion that fails leaves the filter as it was. Path entries
+ * are bucket * 8 + slot.
+ */
+static bool evict(cuckoofilter *cf, const size_t i1, const size_t i2, const uint32_t fingerprint) {
+	uint64_t *path  = cf->kick_path;
+	size_t    index = (xorshift32(&cf->prng_state) % 2) ? i1 : i2;
 
-static bool cuckoo_remove_fingerprint(cuckoofilter cf, size_t bucket_index, size_t offset, uint16_t fingerprint) {
-	for (size_t b = 0; b < cf.bucket_size; b++) {
-		if (cf.buckets[offset + b].fingerprint == fingerprint) {
-			cf.buckets[offset + b].fingerprint = 0;
+	for (size_t kick = 0; kick < cf->max_kicks; kick++) {
+		bucket_t bucket = load_bucket(cf, index);
+		size_t   slot   = xorshift32(&cf->prng_state) % cf->bucket_size;
+		size_t   tries  = 0;
 
-			if (cf.bucket_insertions[bucket_index] > 0) {
-				cf.bucket_insertions[bucket_index] -= 1;
+		// a slot already on the path would be moved twice
+		while (on_path(path, kick, index, slot)) {
+			if (++tries == cf->bucket_size) {
+				return false;
 			}
+			slot = (slot + 1) % cf->bucket_size;
+		}
+
+		path[kick] = (index * 8) + slot;
+
+		uint32_t victim = get_fingerprint(cf, bucket, slot);
+		size_t   next   = alt_index(cf, index, victim);
 
-			if (cf.total_insertions > 0) {
-				cf.total_insertions -= 1;
+		if (cuckoo_add_fingerprint(cf, next, victim)) {
+			for (size_t k = kick; k > 0; k--) {
+				bucket_t from = load_bucket(cf, path[k - 1] / 8);
+				write_slot(cf, path[k] / 8, path[k] % 8, get_fingerprint(cf, from, path[k - 1] % 8));
 			}
+			// every bucket on the path lost and gained one, only `next` grew
+			write_slot(cf, path[0] / 8, path[0] % 8, fingerprint);
+			count_kicks(cf, kick + 1);
 
 			return true;
 		}
+
+		index = next;
 	}
 
 	return false;
 }
 
-bool cuckoo_remove(cuckoofilter cf, void *key, size_t len) {
-	uint32_t hash        = mmh3_32(key, len, 0);
-	uint16_t fingerprint = (uint16_t)(hash & 0xffff);
-	size_t   i1          = hash % cf.num_buckets;
-	size_t   i2          = (i1 ^ (fingerprint >> 1)) % cf.num_buckets;
+static bool add_hashed(cuckoofilter *cf, const uint64_t *hash) {
+	uint32_t fingerprint;
+	size_t   i1, i2;
+	bool     added;
 
-	size_t   i1_offset   = i1 * cf.bucket_size;
-	size_t   i2_offset   = i2 * cf.bucket_size;
+	locate(cf, hash, &fingerprint, &i1, &i2);
 
-	if (cuckoo_remove_fingerprint(cf, i1, i1_offset, fingerprint) ||
-		cuckoo_remove_fingerprint(cf, i2, i2_offset, fingerprint)) {
+	if (cf->sync == NULL) {
+		if (cuckoo_add_fingerprint(cf, i1, fingerprint) ||
+			cuckoo_add_fingerprint(cf, i2, fingerprint) ||
+			evict(cf, i1, i2, fingerprint)) {
+			return true;
+		}
+
+		cf->evictions += 1;
+		return false; // max kicks reached; insertion failed.
+	}
+
+	lock_buckets(cf, i1, i2);
+	added = cuckoo_add_fingerprint(cf, i1, fingerprint) || cuckoo_add_fingerprint(cf, i2, fingerprint);
+	unlock_buckets(cf, i1, i2);
+
+	if (added) {
 		return true;
 	}
 
-	return false; // probably not in cuckoo filter; remove failed.
+	// evictions move fingerprints anywhere, so they keep other writers out
+	pthread_rwlock_wrlock(&cf->sync->evicting);
+	added = cuckoo_add_fingerprint(cf, i1, fingerprint) ||
+		cuckoo_add_fingerprint(cf, i2, fingerprint) ||
+		evict(cf, i1, i2, fingerprint);
+	if (!added) {
+		cf->evictions += 1;
+	}
+	pthread_rwlock_unlock(&cf->sync->evicting);
+
+	return added;
+}
+
+/* grow() -- chain a filter with twice the buckets after `cf`, unless
+ * another writer already has.
+ */
+static bool grow(cuckoofilter *cf) {
+	cuckoofilter *next;
+	bool          grown = true;
+
+	if (cf->sync != NULL) {
+		pthread_rwlock_wrlock(&cf->sync->evicting);
+	}
+
+	if (cf->next == NULL) {
+		next  = malloc(sizeof(cuckoofilter));
+		grown = next != NULL &&
+			cuckoo_init_flags(next, cf->num_buckets * 2, cf->bucket_size, cf->max_kicks,
+							  cf->fingerprint_size, cf->flags);
+		if (grown) {
+			next->hash = cf->hash;
+			__atomic_store_n(&cf->next, next, __ATOMIC_RELEASE);
+		} else {
+			free(next);
+		}
+	}
+
+	if (cf->sync != NULL) {
+		pthread_rwlock_unlock(&cf->sync->evicting);
+	}
+
+	return grown;
+}
+
+bool cuckoo_add(cuckoofilter *cf, const void *key, const size_t len) {
+	uint64_t      hash[2];
+	cuckoofilter *next;
+
+	hash_key(cf, key, len, hash);
+
+	// new elements go to the newest, largest filter
+	while ((next = next_filter(cf)) != NULL) {
+		cf = next;
+	}
+
+	while (!add_hashed(cf, hash)) {
+		if (!(cf->flags & CUCKOO_FLAG_GROW) || !grow(cf)) {
+			return false;
+		}
+		cf = next_filter(cf);
+	}
+
+	return true;
 }
 
-bool cuckoo_remove_string(cuckoofilter cf, char *key) {
+bool cuckoo_add_string(cuckoofilter *cf, const char *key) {
+	return cuckoo_add(cf, key, strlen(key));
+}
+
+static inline bool lookup_buckets(const cuckoofilter *cf, const size_t i1, const size_t i2, const uint32_t fingerprint) {
+	return find_fingerprint(cf, load_bucket(cf, i1), fingerprint) >= 0 ||
+		find_fingerprint(cf, load_bucket(cf, i2), fingerprint) >= 0;
+}
+
+static bool lookup_hashed(const cuckoofilter *cf, const uint64_t *hash) {
+	uint32_t fingerprint;
+	size_t   i1, i2;
+
+	locate(cf, hash, &fingerprint, &i1, &i2);
+
+	if (cf->sync == NULL) {
+		return lookup_buckets(cf, i1, i2, fingerprint);
+	}
+
+	/* A fingerprint that was seen was really there. A miss only counts
+	 * if neither bucket changed while it was read, since an eviction
+	 * could have been moving the fingerprint between them.
+	 */
+	for (;;) {
+		uint32_t v1 = __atomic_load_n(version(cf, i1), __ATOMIC_ACQUIRE);
+		uint32_t v2 = __atomic_load_n(version(cf, i2), __ATOMIC_ACQUIRE);
+
+		if (((v1 | v2) & 1) == 0) {
+			if (lookup_buckets(cf, i1, i2, fingerprint)) {
+				return true;
+			}
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(version(cf, i1), __ATOMIC_RELAXED) == v1 &&
+				__atomic_load_n(version(cf, i2), __ATOMIC_RELAXED) == v2) {
+				return false;
+			}
+		}
+
+		sched_yield(); // a writer is part way through
+	}
+}
+
+bool cuckoo_lookup(const cuckoofilter *cf, const void *key, const size_t len) {
+	const cuckoofilter *head = cf;
+	uint64_t            hash[2];
+	bool                found = false;
+
+	if (cf->buckets == NULL) { // filter not initialized
+		return false;
+	}
+
+	hash_key(cf, key, len, hash);
+
+	for (; cf != NULL && !found; cf = next_filter(cf)) {
+		found = lookup_hashed(cf, hash);
+	}
+
+	// counted on the first filter of a chain, for the whole chain
+	archbloom_count(head->stats, head->flags & CUCKOO_FLAG_CONCURRENT, ARCHBLOOM_STAT_LOOKUPS, 1);
+	archbloom_count(head->stats, head->flags & CUCKOO_FLAG_CONCURRENT, ARCHBLOOM_STAT_HITS, found);
+
+	return found;
+}
+
+bool cuckoo_lookup_string(const cuckoofilter *cf, const char *key) {
+	return cuckoo_lookup(cf, key, strlen(key));
+}
+
+static bool cuckoo_remove_fingerprint(cuckoofilter *cf, size_t bucket_index, uint32_t fingerprint) {
+	int slot = find_fingerprint(cf, load_bucket(cf, bucket_index), fingerprint);
+
+	if (slot < 0) {
+		return false;
+	}
+
+	write_slot(cf, bucket_index, slot, 0);
+	count_removal(cf, bucket_index);
+
+	return true;
+}
+
+static bool remove_hashed(cuckoofilter *cf, const uint64_t *hash) {
+	uint32_t fingerprint;
+	size_t   i1, i2;
+	bool     removed;
+
+	locate(cf, hash, &fingerprint, &i1, &i2);
+
+	if (cf->sync != NULL) {
+		lock_buckets(cf, i1, i2);
+	}
+
+	removed = cuckoo_remove_fingerprint(cf, i1, fingerprint) ||
+		cuckoo_remove_fingerprint(cf, i2, fingerprint);
+
+	if (cf->sync != NULL) {
+		unlock_buckets(cf, i1, i2);
+	}
+
+	return removed;
+}
+
+/* cuckoo_remove() -- remove an element. In a CUCKOO_FLAG_GROW chain,
+ * the element must match in exactly one filter: a match in another
+ * is a different element's colliding fingerprint, and removing the
+ * wrong one would make that element disappear. Elements matching in
+ * several filters are left in place, and false is returned.
+ */
+bool cuckoo_remove(cuckoofilter *cf, const void *key, const size_t len) {
+	uint64_t      hash[2];
+	cuckoofilter *holder = NULL;
+
+	hash_key(cf, key, len, hash);
+
+	if (next_filter(cf) == NULL) {
+		return remove_hashed(cf, hash); // false: probably not in cuckoo filter
+	}
+
+	for (; cf != NULL; cf = next_filter(cf)) {
+		if (lookup_hashed(cf, hash)) {
+			if (holder != NULL) {
+				return false;
+			}
+			holder = cf;
+		}
+	}
+
+	return holder != NULL && remove_hashed(holder, hash);
+}
+
+bool cuckoo_remove_string(cuckoofilter *cf, const char *key) {
 	return cuckoo_remove(cf, key, strlen(key));
 }
 
-double cuckoo_load_factor(cuckoofilter cf) {
-	size_t capacity = cf.num_buckets * cf.bucket_size;
-	return ((double)cf.total_insertions / (double)capacity) * 100.0;
+double cuckoo_load_factor(const cuckoofilter *cf) {
+	size_t capacity   = 0;
+	size_t insertions = 0;
+
+	for (; cf != NULL; cf = next_filter(cf)) {
+		capacity   += cf->num_buckets * cf->bucket_size;
+		insertions += __atomic_load_n(&cf->total_insertions, __ATOMIC_RELAXED);
+	}
+
+	return ((double)insertions / (double)capacity) * 100.0;
+}
+
+/* cuckoo_get_stats() -- report insertion costs and bucket occupancy.
+ * Occupancy comes from bucket_insertions, so this walks every bucket.
+ * On a concurrent filter with writers running, the figures are
+ * approximate.
+ */
+void cuckoo_get_stats(const cuckoofilter *cf, cuckoo_stats *stats) {
+	archbloom_stats counted;
+
+	memset(stats, 0, sizeof(cuckoo_stats));
+	stats->load_factor = cuckoo_load_factor(cf);
+
+	archbloom_counters_read(cf->stats, cf->flags & CUCKOO_FLAG_CONCURRENT, &counted);
+	stats->lookups = counted.lookups;
+	stats->hits    = counted.hits;
+
+	for (; cf != NULL; cf = next_filter(cf)) {
+		stats->insertions += __atomic_load_n(&cf->total_insertions, __ATOMIC_RELAXED);
+		stats->failures   += cf->evictions;
+		stats->kicks      += cf->kicks;
+		if (cf->longest_chain > stats->longest_chain) {
+			stats->longest_chain = cf->longest_chain;
+		}
+
+		for (size_t i = 0; i < CUCKOO_KICK_HISTOGRAM; i++) {
+			stats->kick_histogram[i] += cf->kick_histogram[i];
+			stats->kicked            += cf->kick_histogram[i];
+		}
+
+		for (size_t i = 0; i < cf->num_buckets; i++) {
+			size_t held = cf->bucket_insertions[i];
+
+			stats->occupancy[(held < cf->bucket_size) ? held : cf->bucket_size] += 1;
+		}
+	}
 }
 
 
-bool cuckoo_save(cuckoofilter cf, const char *path) {
+// save one filter of a chain: header, buckets with their padding, bucket_insertions
+static bool save_filter(const cuckoofilter *cf, FILE *fp) {
+	cuckoofilter_file cff = {0};
+
+	memcpy(cff.magic, "!cuckoo!", sizeof(cff.magic));
+	cff.num_buckets      = cf->num_buckets;
+	cff.bucket_size      = cf->bucket_size;
+	cff.max_kicks        = cf->max_kicks;
+	cff.total_insertions = cf->total_insertions;
+	cff.fingerprint_size = cf->fingerprint_size;
+	cff.flags            = cf->flags;
+	cff.evictions        = cf->evictions;
+	cff.prng_state       = cf->prng_state;
+	cff.hash             = cf->hash;
+
+	// TODO this may cause issues on systems with different endianness.
+	//      this needs to be revisited at some point and tested on
+	//      different systems.
+	return fwrite(&cff, sizeof(cuckoofilter_file), 1, fp) == 1 &&
+		fwrite(cf->buckets, buckets_size(cf->num_buckets, cf->bucket_bytes), 1, fp) == 1 &&
+		fwrite(cf->bucket_insertions, sizeof(size_t), cf->num_buckets, fp) == cf->num_buckets;
+}
+
+bool cuckoo_save(const cuckoofilter *cf, const char *path) {
 	FILE *fp;
 
 	fp = fopen(path, "wb");
@@ -210,92 +879,250 @@ bool cuckoo_save(cuckoofilter cf, const char *path) {
 		return false;
 	}
 
-	// Write cuckoofilter struct as the file's header
-	// TODO this may cause issues on systems with different datatypes
-	//      endianness, or compilers that add padding to structs. this
-	//      needs to be revisited at some point and tested on different
-	//      systems. this should also be checked on other data strucures
-	//      _save and _load functions.
-	if (fwrite(&cf, sizeof(cuckoofilter), 1, fp) != 1) {
-		fclose(fp);
+	for (; cf != NULL; cf = next_filter(cf)) {
+		if (!save_filter(cf, fp)) {
+			fclose(fp);
+			return false;
+		}
+	}
+
+	fclose(fp);
+	return true;
+}
+
+// files written by older versions have no magic number
+static inline bool legacy_header(const cuckoofilter_file *cff) {
+	return memcmp(cff->magic, "!cuckoo!", sizeof(cff->magic)) != 0;
+}
+
+// files that store each fingerprint in a uint32_t
+static inline bool unpacked_header(const cuckoofilter_file *cff) {
+	return legacy_header(cff) || cff->fingerprint_size == 0;
+}
+
+/* filter_file_size() -- sanity check a file header and return the size
+ * of the filter it describes, header included, or 0 if it is invalid.
+ * Files without a magic number are from older versions and can only
+ * be checked against their size.
+ */
+static uint64_t filter_file_size(const cuckoofilter_file *cff) {
+	if (cff->num_buckets == 0 || cff->bucket_size == 0) {
+		return 0;
+	}
+
+	if (unpacked_header(cff)) {
+		// unpacked fingerprints are 16 bits, and are packed on load
+		if (!valid_geometry(cff->bucket_size, 16, 0)) {
+			return 0;
+		}
+
+		if (!legacy_header(cff) && (!hash_strategy_valid(cff->hash) || cff->flags != 0)) {
+			return 0;
+		}
+
+		return sizeof(cuckoofilter_file) +
+			(cff->num_buckets * cff->bucket_size * sizeof(uint32_t)) +
+			(cff->num_buckets * sizeof(size_t));
+	}
+
+	if (!hash_strategy_valid(cff->hash) || (cff->flags & ~CUCKOO_FLAGS_ALL) ||
+		((cff->flags & CUCKOO_FLAG_LEGACY_INDEX) && (cff->flags & CUCKOO_FLAG_GROW)) ||
+		!valid_geometry(cff->bucket_size, cff->fingerprint_size, cff->flags)) {
+		return 0;
+	}
+
+	return sizeof(cuckoofilter_file) +
+		buckets_size(cff->num_buckets, (cff->bucket_size * cff->fingerprint_size) / 8) +
+		(cff->num_buckets * sizeof(size_t));
+}
+
+/* from_header() -- populate a cuckoo filter's parameters from a file
+ * header. buckets and bucket_insertions are not touched.
+ */
+static void from_header(cuckoofilter *cf, const cuckoofilter_file *cff) {
+	memset(cf, 0, sizeof(cuckoofilter));
+
+	cf->num_buckets      = cff->num_buckets;
+	cf->bucket_size      = cff->bucket_size;
+	cf->max_kicks        = cff->max_kicks;
+	cf->total_insertions = cff->total_insertions;
+	cf->evictions        = cff->evictions;
+	cf->prng_state       = cff->prng_state;
+	cf->hash             = legacy_header(cff) ? HASH_MMH3 : cff->hash;
+
+	if (unpacked_header(cff)) {
+		cf->fingerprint_size = 16;
+		cf->flags            = CUCKOO_FLAG_LEGACY_INDEX;
+	} else {
+		cf->fingerprint_size = cff->fingerprint_size;
+		cf->flags            = cff->flags;
+	}
+
+	cf->bucket_bytes = (cf->bucket_size * cf->fingerprint_size) / 8;
+}
+
+/* read_unpacked() -- read buckets of uint32_t fingerprints, as written
+ * by older versions, into packed buckets.
+ */
+static bool read_unpacked(cuckoofilter *cf, FILE *fp) {
+	uint32_t slots[8];
+
+	for (size_t i = 0; i < cf->num_buckets; i++) {
+		bucket_t bucket = 0;
+
+		if (fread(slots, sizeof(uint32_t), cf->bucket_size, fp) != cf->bucket_size) {
+			return false;
+		}
+
+		for (size_t b = 0; b < cf->bucket_size; b++) {
+			if (slots[b] > 0xffff) {
+				return false;
+			}
+			bucket = set_fingerprint(cf, bucket, b, slots[b]);
+		}
+
+		store_bucket(cf, i, bucket);
+	}
+
+	return true;
+}
+
+/* load_filter() -- load one filter of a chain from `fp`, which has
+ * `*remaining` bytes left. Only CUCKOO_FLAG_GROW filters may be
+ * followed by another.
+ */
+static bool load_filter(cuckoofilter *cf, FILE *fp, uint64_t *remaining) {
+	cuckoofilter_file cff;
+	uint64_t          size;
+	bool              loaded;
+
+	// read file header
+	if (*remaining < sizeof(cuckoofilter_file) ||
+		fread(&cff, sizeof(cuckoofilter_file), 1, fp) != 1) {
 		return false;
 	}
 
-	// save buckets and bucket_insertions
-	if (fwrite(cf.buckets, sizeof(cuckoobucket), cf.num_buckets * cf.bucket_size, fp) != (cf.num_buckets * cf.bucket_size) ||
-		fwrite(cf.bucket_insertions, sizeof(size_t), cf.num_buckets, fp) != cf.num_buckets) {
-		fclose(fp);
+	// sanity checks
+	size = filter_file_size(&cff);
+	if (size == 0 || size > *remaining ||
+		(size < *remaining && (unpacked_header(&cff) || !(cff.flags & CUCKOO_FLAG_GROW)))) {
 		return false;
 	}
 
-	fclose(fp);
+	from_header(cf, &cff);
+
+	// re-populate bucket data
+	cf->buckets           = archbloom_alloc(buckets_size(cf->num_buckets, cf->bucket_bytes));
+	cf->bucket_insertions = archbloom_alloc(cf->num_buckets * sizeof(size_t));
+	if (cf->buckets == NULL || cf->bucket_insertions == NULL || !alloc_state(cf)) {
+		cuckoo_destroy(cf);
+		return false;
+	}
+
+	if (unpacked_header(&cff)) {
+		loaded = read_unpacked(cf, fp);
+	} else {
+		loaded = fread(cf->buckets, buckets_size(cf->num_buckets, cf->bucket_bytes), 1, fp) == 1;
+	}
+
+	if (!loaded || fread(cf->bucket_insertions, sizeof(size_t), cf->num_buckets, fp) != cf->num_buckets) {
+		cuckoo_destroy(cf);
+		return false;
+	}
+
+	*remaining -= size;
 	return true;
 }
 
 bool cuckoo_load(cuckoofilter *cf, const char *path) {
 	FILE        *fp;
 	struct stat  sb;
+	uint64_t     remaining;
 
 	fp = fopen(path, "rb");
 	if (fp == NULL) {
 		return false;
 	}
 
-	cuckoofilter cfb;
-	// read file header
-	if (fread(&cfb, sizeof(cuckoofilter), 1, fp) != 1) {
+	if (fstat(fileno(fp), &sb) != 0) {
 		fclose(fp);
 		return false;
 	}
 
-	cf->num_buckets      = cfb.num_buckets;
-	cf->bucket_size      = cfb.bucket_size;
-	cf->max_kicks        = cfb.max_kicks;
-	cf->total_insertions = cfb.total_insertions;
-	cf->evictions        = cfb.evictions;
-	cf->prng_state       = cfb.prng_state;
-
-	// sanity checks
-	if (fstat(fileno(fp), &sb) != 0) {
+	remaining = sb.st_size;
+	if (!load_filter(cf, fp, &remaining)) {
 		fclose(fp);
 		return false;
 	}
 
-	size_t expected_filesize =  sizeof(cuckoofilter) +
-		   (cf->num_buckets * cf->bucket_size * sizeof(cuckoobucket)) +
-		   (cf->num_buckets * sizeof(size_t));
-	if (expected_filesize != sb.st_size) {
-		fclose(fp);
+	// the rest of a CUCKOO_FLAG_GROW chain
+	for (cuckoofilter *tail = cf; remaining > 0; tail = tail->next) {
+		tail->next = calloc(1, sizeof(cuckoofilter));
+		if (tail->next == NULL || !load_filter(tail->next, fp, &remaining) ||
+			(tail->next->flags & CUCKOO_FLAG_LEGACY_INDEX) || tail->next->hash != cf->hash) {
+			if (tail->next != NULL) {
+				cuckoo_destroy(tail->next);
+			}
+			free(tail->next);
+			tail->next = NULL;
+			cuckoo_destroy(cf);
+			fclose(fp);
+			return false;
+		}
+	}
+
+	fclose(fp);
+	return true;
+}
+
+/* cuckoo_map() -- map a saved cuckoo filter MAP_SHARED instead of
+ * copying it into private memory, so startup is instant and every
+ * process mapping the file shares one copy in the page cache.
+ *
+ * With `writable` false the mapping is read only and the filter must
+ * only be used for lookups. With `writable` true, changes to buckets
+ * are written back to the file. Header counters such as
+ * total_insertions are not. Release the mapping with cuckoo_destroy().
+ *
+ * Files written before fingerprints were packed, and CUCKOO_FLAG_GROW
+ * filters saved after growing, can't be mapped. Load them with
+ * cuckoo_load() instead.
+ */
+bool cuckoo_map(cuckoofilter *cf, const char *path, const bool writable) {
+	struct stat        sb;
+	cuckoofilter_file  cff;
+	uint8_t           *map;
+	int                fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
 		return false;
 	}
 
-	// re-populate bucket data
-	cfb.buckets = (cuckoobucket *)calloc(cf->num_buckets * cf->bucket_size, sizeof(cuckoobucket));
-	if (cfb.buckets == NULL) {
-		fclose(fp);
+	if (fstat(fd, &sb) != 0 ||
+		pread(fd, &cff, sizeof(cuckoofilter_file), 0) != sizeof(cuckoofilter_file) ||
+		filter_file_size(&cff) != (uint64_t)sb.st_size ||
+		unpacked_header(&cff)) {
+		close(fd);
 		return false;
 	}
-	cf->buckets = cfb.buckets;
 
-	cfb.bucket_insertions = (size_t *)calloc(cf->num_buckets, sizeof(size_t));
-	if (cfb.bucket_insertions == NULL) {
-		free(cf->buckets);
-		cf->buckets = NULL;
-		fclose(fp);
+	map = map_file(fd, sb.st_size, writable);
+	close(fd);
+	if (map == NULL) {
 		return false;
 	}
-	cf->bucket_insertions = cfb.bucket_insertions;
 
-	if (fread(cf->buckets, sizeof(cuckoobucket), cf->num_buckets * cf->bucket_size, fp) != (cf->num_buckets * cf->bucket_size) ||
-		fread(cf->bucket_insertions, sizeof(size_t), cf->num_buckets, fp) != cf->num_buckets) {
-		free(cf->buckets);
-		cf->buckets = NULL;
-		free(cf->bucket_insertions);
-		cf->bucket_insertions = NULL;
-		fclose(fp);
+	from_header(cf, &cff);
+	cf->map               = map;
+	cf->map_size          = sb.st_size;
+	cf->buckets           = map + sizeof(cuckoofilter_file);
+	cf->bucket_insertions = (size_t *)(map + sizeof(cuckoofilter_file) + buckets_size(cf->num_buckets, cf->bucket_bytes));
+
+	if (!alloc_state(cf)) {
+		cuckoo_destroy(cf);
 		return false;
 	}
 
-	fclose(fp);
 	return true;
 }
@@ -7,37 +7,150 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-/* cuckoobucket -- typedef for cuckoo filter bucket
+#include "hash.h"
+#include "stats.h"
+
+/* CUCKOO_FLAG_CONCURRENT -- cuckoo_init_flags() flag: allow
+ * cuckoo_add(), cuckoo_lookup(), cuckoo_remove() and their string
+ * variants to be called on the same filter from multiple threads.
+ * Lookups never block: they check per bucket version counters and
+ * retry if an insert moved fingerprints underneath them. Writers take
+ * striped locks, and evictions take the filter for themselves.
+ * Requires 8 or 16 bit fingerprints.
  */
-typedef struct {
-	uint32_t fingerprint;
-} cuckoobucket;
+#define CUCKOO_FLAG_CONCURRENT   0x01
+
+/* CUCKOO_FLAG_LEGACY_INDEX -- set on filters loaded from files written
+ * before fingerprints were packed. These keep the fingerprint and
+ * bucket selection they were built with. Can't be passed to
+ * cuckoo_init_flags().
+ */
+#define CUCKOO_FLAG_LEGACY_INDEX 0x02
+
+/* CUCKOO_FLAG_GROW -- cuckoo_init_flags() flag: when an insertion
+ * runs out of kicks, chain a filter with twice the buckets after the
+ * full one and add new elements there instead of failing. Lookups and
+ * removals check every filter in the chain, hashing the element once.
+ * Saved filters keep their chain.
+ */
+#define CUCKOO_FLAG_GROW         0x04
+
+/* CUCKOO_FLAGS_ALL -- every flag understood by this version of the
+ * library.
+ */
+#define CUCKOO_FLAGS_ALL         (CUCKOO_FLAG_CONCURRENT | CUCKOO_FLAG_LEGACY_INDEX | CUCKOO_FLAG_GROW)
+
+/* CUCKOO_KICK_HISTOGRAM -- number of kick_histogram buckets. Bucket
+ * `i` counts insertions that moved between 2^i and 2^(i+1) - 1
+ * fingerprints; the last also counts anything longer.
+ */
+#define CUCKOO_KICK_HISTOGRAM 16
+
+/* cuckoo_sync -- locks and version counters of a
+ * CUCKOO_FLAG_CONCURRENT filter. See cuckoo.c.
+ */
+typedef struct cuckoo_sync cuckoo_sync;
 
 /* cuckoofilter -- cuckoo filter structure
+ *
+ * Buckets are `bucket_bytes` bytes each, holding `bucket_size`
+ * fingerprints of `fingerprint_size` bits packed together. A
+ * fingerprint of 0 is an empty slot. Counters are those of this
+ * filter only, not of filters chained after it.
  */
-typedef struct {
-	cuckoobucket *buckets;
+typedef struct cuckoofilter {
+	uint8_t      *buckets;
 	size_t        num_buckets;
-	size_t        bucket_size;       /* 2, 4, or 8 */
+	size_t        bucket_size;       /* 1, 2, 4, or 8 */
+	size_t        bucket_bytes;      /* bytes per bucket */
+	size_t        fingerprint_size;  /* 8, 12, or 16 bits */
 	size_t        max_kicks;
 	size_t        total_insertions;  /* insertion counter */
 	size_t       *bucket_insertions; /* insertion counters per bucket */
-	size_t        evictions;         /* eviction counter */
+	size_t        evictions;         /* failed insertions */
+	size_t        kicks;             /* fingerprints moved by insertions */
+	size_t        longest_chain;     /* most fingerprints moved by one insertion */
+	size_t        kick_histogram[CUCKOO_KICK_HISTOGRAM]; /* see cuckoo_stats */
 	uint32_t      prng_state;        /* xorshift state */
+	uint32_t      flags;             /* CUCKOO_FLAG_* options */
+	hash_strategy hash;              /* hash strategy, see cuckoo_set_hash() */
+	uint64_t     *kick_path;         /* max_kicks slots, scratch for evictions */
+	cuckoo_sync  *sync;              /* CUCKOO_FLAG_CONCURRENT state, or NULL */
+	void         *map;               /* file mapping from cuckoo_map(), or NULL */
+	size_t        map_size;          /* size of the file mapping in bytes */
+	struct cuckoofilter *next;       /* CUCKOO_FLAG_GROW: larger filter after this one, or NULL */
+	archbloom_counters  *stats;      /* lookups and hits, or NULL; see cuckoo_stats */
 } cuckoofilter;
 
+/* cuckoo_stats -- insertion cost and occupancy of a cuckoo filter, as
+ * reported by cuckoo_get_stats(). Use these to size num_buckets and
+ * max_kicks: a long tail in kick_histogram, or failures, mean the
+ * filter is too full for the insertion latency wanted.
+ *
+ * Kick counters start at zero when a filter is initialized, loaded or
+ * mapped; they aren't saved. Figures cover every filter in a
+ * CUCKOO_FLAG_GROW chain. Lookups and hits are only counted by
+ * libraries built with ARCHBLOOM_STATS (see stats.h), and are 0
+ * otherwise.
+ */
+typedef struct {
+	size_t insertions;      /* elements in the filter */
+	size_t failures;        /* insertions that ran out of kicks */
+	size_t kicked;          /* insertions that moved fingerprints */
+	size_t kicks;           /* fingerprints moved, in total */
+	size_t longest_chain;   /* most fingerprints moved by one insertion */
+	size_t kick_histogram[CUCKOO_KICK_HISTOGRAM]; /* insertions by kicks, log2 */
+	size_t occupancy[9];    /* buckets holding 0 through 8 fingerprints */
+	double load_factor;     /* percentage of slots in use */
+	size_t lookups;         /* elements looked up */
+	size_t hits;            /* lookups that found their element */
+} cuckoo_stats;
+
+/* cuckoofilter_file -- header of a saved cuckoo filter, followed by the
+ * buckets, zero padded to a multiple of 8 bytes, and the per bucket
+ * insertion counters.
+ *
+ * Older versions wrote the cuckoofilter structure itself, which has the
+ * same layout on 64 bit systems with pointers where `magic` and
+ * `fingerprint_size` are, and padding where `hash` is. Those files are
+ * still accepted and use HASH_MMH3. Both they and files with a
+ * `fingerprint_size` of 0 store each fingerprint in a uint32_t, and are
+ * packed into 16 bits with CUCKOO_FLAG_LEGACY_INDEX when loaded. The
+ * header is 64 bytes, so the buckets are cache line aligned in a
+ * cuckoo_map()ped file.
+ *
+ * A CUCKOO_FLAG_GROW filter that has grown is saved as each filter of
+ * its chain, header and all, one after the other.
+ */
+typedef struct {
+	uint8_t  magic[8];           /* "!cuckoo!" */
+	uint64_t num_buckets;
+	uint64_t bucket_size;
+	uint64_t max_kicks;
+	uint64_t total_insertions;
+	uint32_t fingerprint_size;   /* 0 in files with uint32_t fingerprints */
+	uint32_t flags;              /* CUCKOO_FLAG_* options */
+	uint64_t evictions;
+	uint32_t prng_state;
+	uint32_t hash;               /* only valid if magic is present */
+} cuckoofilter_file;
+
 /* function definitions
  */
 bool   cuckoo_init(cuckoofilter *, size_t, size_t, size_t);
+bool   cuckoo_init_flags(cuckoofilter *, size_t, size_t, size_t, size_t, uint32_t);
 void   cuckoo_destroy(cuckoofilter *);
-bool   cuckoo_add(cuckoofilter, void *, size_t);
-bool   cuckoo_add_string(cuckoofilter, char *);
-bool   cuckoo_lookup(cuckoofilter, void *, size_t);
-bool   cuckoo_lookup_string(cuckoofilter, char *);
-bool   cuckoo_remove(cuckoofilter, void *, size_t);
-bool   cuckoo_remove_string(cuckoofilter, char *);
-double cuckoo_load_factor(cuckoofilter);
-bool   cuckoo_save(cuckoofilter, const char *);
+bool   cuckoo_set_hash(cuckoofilter *, const hash_strategy);
+bool   cuckoo_add(cuckoofilter *, const void *, const size_t);
+bool   cuckoo_add_string(cuckoofilter *, const char *);
+bool   cuckoo_lookup(const cuckoofilter *, const void *, const size_t);
+bool   cuckoo_lookup_string(const cuckoofilter *, const char *);
+bool   cuckoo_remove(cuckoofilter *, const void *, const size_t);
+bool   cuckoo_remove_string(cuckoofilter *, const char *);
+double cuckoo_load_factor(const cuckoofilter *);
+void   cuckoo_get_stats(const cuckoofilter *, cuckoo_stats *);
+bool   cuckoo_save(const cuckoofilter *, const char *);
 bool   cuckoo_load(cuckoofilter *, const char *);
+bool   cuckoo_map(cuckoofilter *, const char *, const bool);
 
 #endif /* CUCKOO_H */
@@ -0,0 +1,31 @@
+/* fastrange.h -- map a 64 bit hash onto [0, size) without a divide.
+ *
+ * Internal helpers shared by the filter implementations. This header is
+ * not installed.
+ *
+ * fastrange64() is Daniel Lemire's multiply-shift reduction:
+ * https://lemire.me/blog/2016/06/27/a-fast-alternative-to-the-modulo-reduction/
+ * It uses the high bits of the hash, so it is as good as `hash % size`
+ * for well mixed hashes while costing one multiply instead of a 64 bit
+ * division.
+ */
+#ifndef FASTRANGE_H
+#define FASTRANGE_H
+
+#include <stdint.h>
+
+static inline uint64_t fastrange64(const uint64_t hash, const uint64_t size) {
+	return (uint64_t)(((__uint128_t)hash * size) >> 64);
+}
+
+/* round_pow2() -- round `n` up to the next power of two. Returns 1 for 0.
+ */
+static inline uint64_t round_pow2(uint64_t n) {
+	if (n <= 1) {
+		return 1;
+	}
+
+	return 1ULL << (64 - __builtin_clzll(n - 1));
+}
+
+#endif /* FASTRANGE_H */
@@ -1,33 +1,109 @@
 /* gaussiannb.c
  * TODO: save/load models
- * TODO: multi-threaded log calculations for gaussiannb_predict() ?
  */
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <stdbool.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "gaussiannb.h"
 
+// classes scored at once by the predict functions, bounding their stack use
+#define GNB_CLASS_BLOCK 64
+
+/* prepare_class() -- rebuild the prepared model of class `c` after its
+ * mean, variance, prior or weight changed.
+ */
+static void prepare_class(gaussiannb *gnb, size_t c) {
+	const gaussiannbclass *cls   = &gnb->classes[c];
+	size_t                 C     = gnb->num_classes;
+	double                 norm  = log(cls->prior * cls->weight + GNB_EPSILON);
+
+	for (size_t j = 0; j < gnb->num_features; j++) {
+		double var = cls->variance[j] + GNB_EPSILON;
+
+		norm                 += log(GNB_NORMALIZING_CONSTANT) - 0.5 * log(var);
+		gnb->means[j * C + c]  = cls->mean[j];
+		gnb->scales[j * C + c] = -0.5 / var;
+
+		if (gnb->flags & GNB_FLAG_FLOAT32) {
+			gnb->means_f[j * C + c]  = gnb->means[j * C + c];
+			gnb->scales_f[j * C + c] = gnb->scales[j * C + c];
+		}
+	}
+
+	gnb->log_norm[c] = norm;
+	if (gnb->flags & GNB_FLAG_FLOAT32) {
+		gnb->log_norm_f[c] = norm;
+	}
+}
+
 bool gaussiannb_init(gaussiannb *gnb, size_t num_classes, size_t num_features) {
+	return gaussiannb_init_flags(gnb, num_classes, num_features, 0);
+}
+
+/* gaussiannb_init_flags() -- gaussiannb_init() with GNB_FLAG_* options.
+ */
+bool gaussiannb_init_flags(gaussiannb *gnb, size_t num_classes, size_t num_features, uint32_t flags) {
+	size_t cells = num_classes * num_features;
+
+	memset(gnb, 0, sizeof(gaussiannb));
 	gnb->num_classes  = num_classes;
 	gnb->num_features = num_features;
 	gnb->num_samples  = 0;
+	gnb->flags        = flags & GNB_FLAGS_ALL;
 	gnb->classes      = calloc(num_classes, sizeof(gaussiannbclass));
+	gnb->log_norm     = calloc(num_classes + (2 * cells), sizeof(double));
 
-	if (gnb->classes == NULL) {
+	if (gnb->classes == NULL || gnb->log_norm == NULL) {
+		gaussiannb_destroy(gnb);
 		return false;
 	}
 
+	gnb->means  = gnb->log_norm + num_classes;
+	gnb->scales = gnb->means + cells;
+
+	if (gnb->flags & GNB_FLAG_FLOAT32) {
+		gnb->log_norm_f = calloc(num_classes + (2 * cells), sizeof(float));
+		if (gnb->log_norm_f == NULL) {
+			gaussiannb_destroy(gnb);
+			return false;
+		}
+
+		gnb->means_f  = gnb->log_norm_f + num_classes;
+		gnb->scales_f = gnb->means_f + cells;
+	}
+
+	if (num_classes > 0) {
+		double *means     = calloc(cells ? cells : 1, sizeof(double));
+		double *variances = calloc(cells ? cells : 1, sizeof(double));
+
+		gnb->classes[0].mean     = means;
+		gnb->classes[0].variance = variances;
+		if (means == NULL || variances == NULL) {
+			gaussiannb_destroy(gnb);
+			return false;
+		}
+
+		for (size_t c = 0; c < num_classes; c++) {
+			gnb->classes[c].mean     = means + (c * num_features);
+			gnb->classes[c].variance = variances + (c * num_features);
+		}
+	}
+
 	// initialize class weights to 1.0
 	for (size_t c = 0; c < num_classes; c++) {
 		gnb->classes[c].weight = 1.0;
+		prepare_class(gnb, c);
 	}
 
 	return true;
 }
 
 void gaussiannb_destroy(gaussiannb *gnb) {
-	if (gnb->num_classes > 0) {
+	if (gnb->classes && gnb->num_classes > 0) {
 		if (gnb->classes[0].mean) {
 			free(gnb->classes[0].mean);
 			gnb->classes[0].mean = NULL;
@@ -43,114 +119,300 @@ void gaussiannb_destroy(gaussiannb *gnb) {
 		free(gnb->classes);
 		gnb->classes = NULL;
 	}
+
+	free(gnb->log_norm);
+	free(gnb->log_norm_f);
+	gnb->log_norm   = NULL;
+	gnb->means      = NULL;
+	gnb->scales     = NULL;
+	gnb->log_norm_f = NULL;
+	gnb->means_f    = NULL;
+	gnb->scales_f   = NULL;
 }
 
-static void calculate_class_mean(gaussiannbclass *cls, double **X, int *y, size_t num_samples, size_t num_features, int class_label) {
-	size_t count = 0;
+/* train_job -- the rows [first, last) one thread accumulates, and its
+ * sums, per class and feature. The first pass counts and sums the
+ * values of each feature; the second, given the means, sums their
+ * squared deviations. NaN values are skipped and labels outside
+ * [0, num_classes) are ignored.
+ */
+typedef struct {
+	const gaussiannb  *gnb;
+	const double      *matrix;  // row-major samples, or NULL to use rows
+	double           **rows;    // one pointer per sample
+	const int         *y;
+	size_t             first;
+	size_t             last;
+	const double      *mean;    // class-major means in the second pass, NULL in the first
+	size_t            *counts;  // samples per class
+	size_t            *present; // non-NaN values per class and feature
+	double            *sums;    // sums, or squared deviations in the second pass
+} train_job;
+
+static void *train_rows(void *arg) {
+	train_job *job = arg;
+	size_t     F   = job->gnb->num_features;
+
+	for (size_t i = job->first; i < job->last; i++) {
+		const double *x     = job->matrix ? job->matrix + (i * F) : job->rows[i];
+		int           label = job->y[i];
+
+		if (label < 0 || (size_t)label >= job->gnb->num_classes) {
+			continue;
+		}
+
+		size_t  base = label * F;
+		double *sums = job->sums + base;
 
-	// calculate mean and variance of features
-	for (size_t si = 0; si < num_samples; si++) {
-		if (y[si] == class_label) {
-			count++;
-			for (size_t fi = 0; fi < num_features; fi++) {
-				if (isnan(X[si][fi])) {
-					X[si][fi] = cls->mean[fi];
+		if (job->mean == NULL) {
+			job->counts[label]++;
+			for (size_t j = 0; j < F; j++) {
+				if (!isnan(x[j])) {
+					job->present[base + j]++;
+					sums[j] += x[j];
+				}
+			}
+		} else {
+			for (size_t j = 0; j < F; j++) {
+				if (!isnan(x[j])) {
+					double diff = x[j] - job->mean[base + j];
+					sums[j] += diff * diff;
 				}
-				cls->mean[fi] += X[si][fi];
 			}
 		}
 	}
 
-	if (count > 0) {
-		for (size_t fi = 0; fi < num_features; fi++) {
-			cls->mean[fi] /= count;
+	return NULL;
+}
+
+/* run_jobs() -- run one job per thread, the first on the calling
+ * thread. A job whose thread can't be started runs on the calling
+ * thread too.
+ */
+static void run_jobs(train_job *jobs, size_t threads) {
+	pthread_t *tids    = calloc(threads, sizeof(pthread_t));
+	bool      *started = calloc(threads, sizeof(bool));
+
+	for (size_t t = 1; t < threads; t++) {
+		started[t] = tids && started && pthread_create(&tids[t], NULL, train_rows, &jobs[t]) == 0;
+		if (!started[t]) {
+			train_rows(&jobs[t]);
 		}
 	}
 
-	cls->count = count;
-}
+	train_rows(&jobs[0]);
 
-static void calculate_class_variance(gaussiannbclass *cls, double **X, int *y, size_t num_samples, size_t num_features, int class_label, size_t count) {
-	for (size_t si = 0; si < num_samples; si++) {
-		if (y[si] == class_label) {
-			for (size_t fi = 0; fi < num_features; fi++) {
-				double squared_deviation = (X[si][fi] - cls->mean[fi]) * (X[si][fi] - cls->mean[fi]);
-				cls->variance[fi] += squared_deviation;
-			}
+	for (size_t t = 1; t < threads; t++) {
+		if (started && started[t]) {
+			pthread_join(tids[t], NULL);
 		}
 	}
 
-	// regularize and normalize variance
-	for (size_t fi = 0; fi < num_features; fi++) {
-		cls->variance[fi] = (count == 0) ? GNB_EPSILON : (cls->variance[fi] / count) + GNB_ALPHA;
-	}
+	free(tids);
+	free(started);
 }
 
-void gaussiannb_train(gaussiannb *gnb, double **X, int *y, size_t num_samples) {
+/* train() -- fit every class to `num_samples` samples, read from either
+ * a row-major matrix or an array of row pointers, splitting the rows
+ * between up to `threads` threads. Each thread sums its own rows and
+ * the sums are added together in thread order.
+ */
+static bool train(gaussiannb *gnb, const double *matrix, double **rows, const int *y, size_t num_samples, size_t threads) {
+	size_t     C     = gnb->num_classes;
+	size_t     F     = gnb->num_features;
+	size_t     cells = C * F;
+	train_job *jobs;
+	size_t    *counts, *present;
+	double    *sums;
+
 	if (num_samples == 0) {
-		return;
+		return true;
 	}
 
-	size_t  bufsiz    = gnb->num_classes * gnb->num_features;
-	double *means     = calloc(bufsiz, sizeof(double));
-	double *variances = calloc(bufsiz, sizeof(double));
+	threads = (threads == 0) ? 1 : threads;
+	threads = (threads > num_samples) ? num_samples : threads;
+
+	jobs    = calloc(threads, sizeof(train_job));
+	counts  = calloc(threads * (C + 1), sizeof(size_t));
+	present = calloc(threads * (cells + 1), sizeof(size_t));
+	sums    = calloc(threads * (cells + 1), sizeof(double));
+	if (jobs == NULL || counts == NULL || present == NULL || sums == NULL) {
+		free(jobs);
+		free(counts);
+		free(present);
+		free(sums);
+		return false;
+	}
 
-	if (means == NULL || variances == NULL) {
-		if (means != NULL) { free(means); }
-		if (variances != NULL) { free(variances); }
-		return;
+	for (size_t t = 0; t < threads; t++) {
+		jobs[t] = (train_job){
+			.gnb     = gnb,
+			.matrix  = matrix,
+			.rows    = rows,
+			.y       = y,
+			.first   = num_samples * t / threads,
+			.last    = num_samples * (t + 1) / threads,
+			.counts  = counts + (t * C),
+			.present = present + (t * cells),
+			.sums    = sums + (t * cells),
+		};
+	}
+
+	// means
+	run_jobs(jobs, threads);
+	for (size_t t = 1; t < threads; t++) {
+		for (size_t c = 0; c < C; c++) {
+			counts[c] += jobs[t].counts[c];
+		}
+		for (size_t i = 0; i < cells; i++) {
+			present[i] += jobs[t].present[i];
+			sums[i]    += jobs[t].sums[i];
+		}
+	}
+
+	double *mean = gnb->classes[0].mean;
+	for (size_t i = 0; i < cells; i++) {
+		mean[i] = (present[i] > 0) ? sums[i] / present[i] : 0.0;
+	}
+
+	// squared deviations from them
+	memset(sums, 0, threads * cells * sizeof(double));
+	for (size_t t = 0; t < threads; t++) {
+		jobs[t].mean = mean;
+	}
+	run_jobs(jobs, threads);
+	for (size_t t = 1; t < threads; t++) {
+		for (size_t i = 0; i < cells; i++) {
+			sums[i] += jobs[t].sums[i];
+		}
 	}
 
 	gnb->num_samples += num_samples; // needed for online learning
 
-	for (size_t ci = 0; ci < gnb->num_classes; ci++) {
-		gnb->classes[ci].count    = 0;
-		gnb->classes[ci].mean     = means + (ci * gnb->num_features);
-		gnb->classes[ci].variance = variances + (ci * gnb->num_features);
-
-		calculate_class_mean(&gnb->classes[ci],
-							 X,
-							 y,
-							 num_samples,
-							 gnb->num_features,
-							 ci);
-
-		calculate_class_variance(&gnb->classes[ci],
-								 X,
-								 y,
-								 num_samples,
-								 gnb->num_features,
-								 ci,
-								 gnb->classes[ci].count);
+	for (size_t c = 0; c < C; c++) {
+		gaussiannbclass *cls = &gnb->classes[c];
+
+		// regularize and normalize variance
+		for (size_t j = 0; j < F; j++) {
+			size_t i = c * F + j;
+			cls->variance[j] = (present[i] == 0) ? GNB_EPSILON : (sums[i] / present[i]) + GNB_ALPHA;
+		}
 
 		// laplace smoothing using class weight
-		gnb->classes[ci].prior = (gnb->classes[ci].count + gnb->classes[ci].weight) / (num_samples + gnb->num_classes);
+		cls->count = counts[c];
+		cls->prior = (cls->count + cls->weight) / (num_samples + C);
+		prepare_class(gnb, c);
 	}
+
+	free(jobs);
+	free(counts);
+	free(present);
+	free(sums);
+
+	return true;
+}
+
+void gaussiannb_train(gaussiannb *gnb, double **X, int *y, size_t num_samples) {
+	train(gnb, NULL, X, y, num_samples, 1);
 }
 
+/* gaussiannb_train_matrix() -- gaussiannb_train() on `num_samples`
+ * samples stored row-major in `X`, `num_features` values each, with
+ * the rows split between `threads` threads (0 or 1 to use only the
+ * calling thread). NaN values are left out of the statistics of their
+ * feature. Returns false if memory allocation fails.
+ */
+bool gaussiannb_train_matrix(gaussiannb *gnb, const double *X, const int *y, size_t num_samples, size_t threads) {
+	return train(gnb, X, NULL, y, num_samples, threads);
+}
+
+/* PREDICT_ROWS(type, suffix) -- define predict_rows<suffix>(), which
+ * classifies `count` row-major samples of `type` against a prepared
+ * model of `type`. Classes are scored GNB_CLASS_BLOCK at a time so the
+ * scores stay on the stack; within a block each feature adds
+ * scale * (x - mean)^2 to every class's score, a loop with no branches
+ * that the compiler vectorizes across classes.
+ */
+#define PREDICT_ROWS(type, suffix)                                            \
+static void predict_rows##suffix(const gaussiannb *gnb,                       \
+                                 const type *log_norm,                        \
+                                 const type *means,                           \
+                                 const type *scales,                          \
+                                 const type *X,                               \
+                                 size_t count,                                \
+                                 int *predictions) {                          \
+	size_t C = gnb->num_classes;                                              \
+	size_t F = gnb->num_features;                                             \
+	type   scores[GNB_CLASS_BLOCK];                                           \
+                                                                              \
+	for (size_t i = 0; i < count; i++) {                                      \
+		const type *x              = X + (i * F);                             \
+		type        best_posterior = -INFINITY;                               \
+		int         best_class     = -1;                                      \
+                                                                              \
+		for (size_t first = 0; first < C; first += GNB_CLASS_BLOCK) {         \
+			size_t block = (C - first < GNB_CLASS_BLOCK) ? C - first : GNB_CLASS_BLOCK; \
+                                                                              \
+			memcpy(scores, log_norm + first, block * sizeof(type));           \
+			for (size_t j = 0; j < F; j++) {                                  \
+				const type *mean  = means + (j * C) + first;                  \
+				const type *scale = scales + (j * C) + first;                 \
+				type        value = x[j];                                     \
+                                                                              \
+				for (size_t c = 0; c < block; c++) {                          \
+					type diff  = value - mean[c];                             \
+					scores[c] += scale[c] * diff * diff;                      \
+				}                                                             \
+			}                                                                 \
+                                                                              \
+			for (size_t c = 0; c < block; c++) {                              \
+				if (scores[c] > best_posterior) {                             \
+					best_posterior = scores[c];                               \
+					best_class     = first + c;                               \
+				}                                                             \
+			}                                                                 \
+		}                                                                     \
+                                                                              \
+		predictions[i] = best_class;                                          \
+	}                                                                         \
+}
+
+PREDICT_ROWS(double, )
+PREDICT_ROWS(float, _float)
+
+#undef PREDICT_ROWS
+
 int gaussiannb_predict(gaussiannb *gnb, double *X) {
-	double best_posterior = -INFINITY;
-	int    best_class     = -1;
-
-	for (size_t c = 0; c < gnb->num_classes; c++) {
-		double log_prob = log(gnb->classes[c].prior * gnb->classes[c].weight + GNB_EPSILON);
-
-		// calculate log(probabilities) of features
-		for (size_t j = 0; j < gnb->num_features; j++) {
-			double mean = gnb->classes[c].mean[j];
-			double var  = gnb->classes[c].variance[j] + GNB_EPSILON;
-			double diff = X[j] - mean;
-			double prob = GNB_NORMALIZING_CONSTANT * exp(-(diff * diff) / (2 * var));
-			log_prob += log(prob);
-		}
+	int prediction;
 
-		if (log_prob > best_posterior) {
-			best_posterior = log_prob;
-			best_class = c;
-		}
+	gaussiannb_predict_batch(gnb, X, 1, &prediction);
+
+	return prediction;
+}
+
+/* gaussiannb_predict_batch() -- gaussiannb_predict() on `count`
+ * samples stored row-major in `X`, storing each sample's class, or -1
+ * if none could be chosen, in `predictions`. The model is only read,
+ * so batches can be predicted from several threads at once.
+ */
+void gaussiannb_predict_batch(const gaussiannb *gnb, const double *X, size_t count, int *predictions) {
+	predict_rows(gnb, gnb->log_norm, gnb->means, gnb->scales, X, count, predictions);
+}
+
+/* gaussiannb_predict_batch_float() -- gaussiannb_predict_batch() on
+ * float samples, using the float copy of the model kept by classifiers
+ * created with GNB_FLAG_FLOAT32. Twice as many classes fit in each
+ * vector, at the cost of precision in close calls. Returns false if
+ * the classifier has no float model.
+ */
+bool gaussiannb_predict_batch_float(const gaussiannb *gnb, const float *X, size_t count, int *predictions) {
+	if (!(gnb->flags & GNB_FLAG_FLOAT32)) {
+		return false;
 	}
 
-	return best_class;
+	predict_rows_float(gnb, gnb->log_norm_f, gnb->means_f, gnb->scales_f, X, count, predictions);
+
+	return true;
 }
 
 double gaussiannb_mahalanobis_distance(gaussiannb *gnb, double *X, size_t class_index) {
@@ -184,11 +446,13 @@ void gaussiannb_update(gaussiannb *gnb, double *X, int y, bool new) {
 
 	gnb->classes[y].count++;
 	gnb->classes[y].prior = (double)gnb->classes[y].count / gnb->num_samples;
+	prepare_class(gnb, y);
 }
 
 void gaussiannb_adjust_weight(gaussiannb *gnb, int ci, double weight) {
 	if (ci >= 0 && ci < gnb->num_classes) {
 		gnb->classes[ci].weight = weight;
+		prepare_class(gnb, ci);
 	}
 	// class_index out of range ...
 }
@@ -4,6 +4,7 @@
 #define GAUSSIANNB_H
 
 #include <math.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
@@ -11,6 +12,9 @@
 #define GNB_ALPHA                 1e-2 // for regularization
 #define GNB_NORMALIZING_CONSTANT (1 / sqrt(2 * M_PI)) // normalizing constant
 
+#define GNB_FLAG_FLOAT32          0x01 // keep a float copy of the model for gaussiannb_predict_batch_float()
+#define GNB_FLAGS_ALL            (GNB_FLAG_FLOAT32)
+
 /* structures
  */
 typedef struct {
@@ -21,21 +25,41 @@ typedef struct {
 	size_t  count;
 } gaussiannbclass;
 
+/* The model predictions are made from is prepared from the classes
+ * whenever they change. It is stored feature-major, one value per
+ * class for each feature, so the work per feature is a multiply and
+ * add across every class that the compiler can vectorize:
+ *
+ *   log_norm[c]          log(prior * weight) - log(sqrt(2 pi variance)) summed over features
+ *   means[f * C + c]     mean of feature f in class c
+ *   scales[f * C + c]    -1 / (2 * variance) of feature f in class c
+ */
 typedef struct {
 	size_t           num_classes;
 	size_t           num_features;
 	size_t           num_samples;
 	gaussiannbclass *classes;
+	uint32_t         flags;      // GNB_FLAG_* options
+	double          *log_norm;   // num_classes constant terms
+	double          *means;      // num_features * num_classes means
+	double          *scales;     // num_features * num_classes inverse variances, scaled by -1/2
+	float           *log_norm_f; // float copies of the model with GNB_FLAG_FLOAT32, otherwise NULL
+	float           *means_f;
+	float           *scales_f;
 } gaussiannb;
 
 /* function definitions
  * TODO: _update, _train, _adjust_weight, should return statuses
  */
 bool   gaussiannb_init(gaussiannb *, size_t, size_t);
+bool   gaussiannb_init_flags(gaussiannb *, size_t, size_t, uint32_t);
 void   gaussiannb_destroy(gaussiannb *);
 void   gaussiannb_train(gaussiannb *, double **, int *, size_t);
+bool   gaussiannb_train_matrix(gaussiannb *, const double *, const int *, size_t, size_t);
 void   gaussiannb_update(gaussiannb *, double *, int, bool);
 int    gaussiannb_predict(gaussiannb *, double *);
+void   gaussiannb_predict_batch(const gaussiannb *, const double *, size_t, int *);
+bool   gaussiannb_predict_batch_float(const gaussiannb *, const float *, size_t, int *);
 void   gaussiannb_adjust_weight(gaussiannb *, int, double);
 double gaussiannb_mahalanobis_distance(gaussiannb *, double *, size_t);
 
@@ -0,0 +1,248 @@
+/**
+ * @file hash.c
+ * @brief Hash strategies selectable per filter.
+ *
+ * Keys are read as little endian on every platform, so saved filters
+ * give the same answers wherever they are loaded.
+ */
+#include <string.h>
+
+#include "mmh3.h"
+#include "hash.h"
+
+static const char *hash_names[HASH_STRATEGYCOUNT] = {
+	"mmh3",
+	"wyhash",
+	"fixed"
+};
+
+static inline uint64_t read64(const uint8_t *p) {
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+
+	return v;
+}
+
+static inline uint64_t read32(const uint8_t *p) {
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+
+	return v;
+}
+
+/* wyhash final version 4, by Wang Yi. Public domain.
+ * https://github.com/wangyi-fudan/wyhash
+ */
+static const uint64_t wyp[4] = {
+	0x2d358dccaa6c78a5ULL,
+	0x8bb84b93962eacc9ULL,
+	0x4b33a62ed433d4a3ULL,
+	0x4d5a2da51de1aa47ULL
+};
+
+// 128 bit multiply, returning the low half in A and the high half in B
+static inline void wymum(uint64_t *A, uint64_t *B) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = *A;
+	r *= *B;
+	*A = (uint64_t)r;
+	*B = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *A >> 32, hb = *B >> 32, la = (uint32_t)*A, lb = (uint32_t)*B;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*A = lo;
+	*B = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t wymix(uint64_t A, uint64_t B) {
+	wymum(&A, &B);
+
+	return A ^ B;
+}
+
+static inline uint64_t wyr3(const uint8_t *p, const size_t k) {
+	return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
+}
+
+static uint64_t wyhash(const void *key, const size_t len, uint64_t seed) {
+	const uint8_t *p = key;
+	uint64_t       a, b;
+
+	seed ^= wymix(seed ^ wyp[0], wyp[1]);
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+			b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = wyr3(p, len);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+
+			do {
+				seed = wymix(read64(p) ^ wyp[1], read64(p + 8) ^ seed);
+				see1 = wymix(read64(p + 16) ^ wyp[2], read64(p + 24) ^ see1);
+				see2 = wymix(read64(p + 32) ^ wyp[3], read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+
+			seed ^= see1 ^ see2;
+		}
+
+		while (i > 16) {
+			seed = wymix(read64(p) ^ wyp[1], read64(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = read64(p + i - 16);
+		b = read64(p + i - 8);
+	}
+
+	a ^= wyp[1];
+	b ^= seed;
+	wymum(&a, &b);
+
+	return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+// MurmurHash3 finalizer. A bijection, so distinct inputs never collide.
+static inline uint64_t fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+/* second_hash() -- derive the double hashing step from the first
+ * hash. It is forced odd so every probe is distinct on power of two
+ * sized filters.
+ */
+static inline uint64_t second_hash(const uint64_t h1, const size_t len) {
+	return wymix(h1 ^ wyp[2], len ^ wyp[3]) | 1;
+}
+
+static void fixed_128(const uint8_t *p, const size_t len, uint64_t *out) {
+	switch (len) {
+	case 4:
+		out[0] = fmix64(read32(p) ^ wyp[0]);
+		break;
+	case 8:
+		out[0] = fmix64(read64(p) ^ wyp[1]);
+		break;
+	case 16:
+		out[0] = fmix64(fmix64(read64(p) ^ wyp[2]) ^ read64(p + 8));
+		break;
+	default:
+		out[0] = wyhash(p, len, 0);
+		break;
+	}
+
+	out[1] = second_hash(out[0], len);
+}
+
+/**
+ * @brief Hash an element into two 64 bit values.
+ *
+ * @param strategy Hash strategy to use.
+ * @param data Pointer to the element.
+ * @param len Length of the element in bytes.
+ * @param out Array of two 64 bit values to store the result in.
+ */
+void hash_128(const hash_strategy strategy, const void *data, const size_t len, uint64_t *out) {
+	switch (strategy) {
+	case HASH_WYHASH:
+		out[0] = wyhash(data, len, 0);
+		out[1] = second_hash(out[0], len);
+		break;
+	case HASH_FIXED:
+		fixed_128(data, len, out);
+		break;
+	case HASH_MMH3:
+	default:
+		mmh3_128(data, len, 0, out);
+		break;
+	}
+}
+
+/**
+ * @brief Generate `count` hashes of an element with double hashing.
+ *
+ * With HASH_MMH3 this produces the same hashes as
+ * `mmh3_64_make_hashes()`.
+ *
+ * @param strategy Hash strategy to use.
+ * @param data Pointer to the element.
+ * @param len Length of the element in bytes.
+ * @param count Number of hashes to generate.
+ * @param out Array of `count` 64 bit values to store the hashes in.
+ */
+void hash_make_hashes(const hash_strategy strategy, const void *data, const size_t len,
+                      const size_t count, uint64_t *out) {
+	uint64_t hash[2];
+
+	hash_128(strategy, data, len, hash);
+
+	for (size_t i = 0; i < count; i++) {
+		out[i] = hash_probe(hash, i);
+	}
+}
+
+/**
+ * @brief 32 bit hash of an element.
+ *
+ * With HASH_MMH3 this is `mmh3_32()` with a seed of 0.
+ *
+ * @param strategy Hash strategy to use.
+ * @param data Pointer to the element.
+ * @param len Length of the element in bytes.
+ *
+ * @return 32 bit hash of the element.
+ */
+uint32_t hash_32(const hash_strategy strategy, const void *data, const size_t len) {
+	uint64_t hash[2];
+
+	if (strategy == HASH_MMH3) {
+		return mmh3_32(data, len, 0);
+	}
+
+	hash_128(strategy, data, len, hash);
+
+	return (uint32_t)hash[0];
+}
+
+/**
+ * @brief Name of a hash strategy, eg: for display.
+ *
+ * @return Name of the strategy, or "unknown" if it is out of range.
+ */
+const char *hash_strategy_name(const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy)) {
+		return "unknown";
+	}
+
+	return hash_names[strategy];
+}
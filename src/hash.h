@@ -0,0 +1,74 @@
+/**
+ * @file hash.h
+ * @brief Hash strategies selectable per filter.
+ *
+ * Every filter derives its probe positions from a pair of 64 bit
+ * hashes of an element, using double hashing for the rest. The
+ * function that produces that pair is the filter's hash strategy. It
+ * is saved with the filter, so a filter always loads back with the
+ * same hash.
+ */
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @enum hash_strategy
+ * @brief Hash functions available to filters.
+ *
+ * @var HASH_MMH3
+ * MurmurHash3 x64 128. The default, and the hash used by files
+ * written before hash strategies existed.
+ *
+ * @var HASH_WYHASH
+ * wyhash (final version 4). Several times faster than MurmurHash3 on
+ * short keys such as addresses and host names.
+ *
+ * @var HASH_FIXED
+ * For fixed width integer keys. Keys of 4, 8 or 16 bytes (eg: IPv4
+ * addresses, 64 bit ids, IPv6 addresses) are mixed with a couple of
+ * multiplies. Keys of any other length use HASH_WYHASH.
+ */
+typedef enum {
+	HASH_MMH3 = 0,
+	HASH_WYHASH,
+	HASH_FIXED,
+	// used as a counter. do not add anything below this line.
+	HASH_STRATEGYCOUNT
+} hash_strategy;
+
+/* function declarations
+ */
+void        hash_128(const hash_strategy, const void *, const size_t, uint64_t *);
+void        hash_make_hashes(const hash_strategy,
+                             const void *,
+                             const size_t,
+                             const size_t,
+                             uint64_t *);
+uint32_t    hash_32(const hash_strategy, const void *, const size_t);
+const char *hash_strategy_name(const hash_strategy);
+
+/**
+ * @brief Check that a hash strategy, such as one read from a file, is
+ * known to this version of the library.
+ */
+static inline bool hash_strategy_valid(const uint32_t strategy) {
+	return strategy < HASH_STRATEGYCOUNT;
+}
+
+/**
+ * @brief Probe `i` of an element, derived from its `hash_128()` by
+ * double hashing.
+ *
+ * Filters generate probes one at a time with this rather than filling
+ * an array with `hash_make_hashes()`, so a lookup that misses on its
+ * first probe doesn't pay for the rest. Both give the same values.
+ */
+static inline uint64_t hash_probe(const uint64_t *hash, const size_t i) {
+	return hash[0] + i * hash[1];
+}
+
+#endif /* HASH_H */
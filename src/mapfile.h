@@ -0,0 +1,36 @@
+/* mapfile.h -- shared memory mapping of saved filters.
+ *
+ * Internal helper used by the *_map() functions. This header is not
+ * installed.
+ */
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+/* map_file() -- map `size` bytes of `fd` MAP_SHARED, so every process
+ * mapping the same file shares one page cache copy. Read only unless
+ * `writable` is set, in which case changes are written back to the
+ * file. Returns NULL on failure.
+ *
+ * Filter lookups touch pages at random, so readahead is disabled.
+ */
+static inline void *map_file(const int fd, const size_t size, const bool writable) {
+	void *map = mmap(NULL,
+	                 size,
+	                 writable ? PROT_READ | PROT_WRITE : PROT_READ,
+	                 MAP_SHARED,
+	                 fd,
+	                 0);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	madvise(map, size, MADV_RANDOM);
+
+	return map;
+}
+
+#endif /* MAPFILE_H */
@@ -309,7 +309,10 @@ void mmh3_64_make_hashes(const void *data, size_t len, size_t count, uint64_t *h
     uint64_t hash[2];
     mmh3_128(data, len, 0, hash);
 
+    // unsigned arithmetic already wraps modulo 2^64. this used to be
+    // reduced `% UINT64_MAX`, which only differs for UINT64_MAX itself
+    // and cost a 64 bit division per hash.
     for (size_t i = 0; i < count; i++) {
-        hash_output[i] = (hash[0] + i * hash[1]) % UINT64_MAX;
+        hash_output[i] = hash[0] + i * hash[1];
     }
 }
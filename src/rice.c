@@ -0,0 +1,347 @@
+/* rice.c -- Golomb-Rice coding of sparse bitmaps.
+ *
+ * Bit `i` of a bitmap is bit `i % 8` of byte `i / 8`, as in the
+ * filters. Bitmaps are scanned 64 bits at a time, so the cost of
+ * encoding is dominated by the set bits rather than the size of the
+ * bitmap.
+ */
+#include <string.h>
+#include <math.h>
+
+#include "rice.h"
+#include "bitops.h"
+
+// keeps a quotient bit, the remainder and up to 7 pending bits within 64 bits
+#define RICE_MAX_PARAMETER 48
+#define RICE_UNARY_CHUNK   56
+
+/* bit_iter -- walks the set bits of a bitmap in ascending order.
+ */
+typedef struct {
+	const uint8_t *bitmap;
+	size_t         bytes;
+	size_t         offset; // byte offset of `word`
+	uint64_t       word;   // bits at `offset` not visited yet
+} bit_iter;
+
+static inline uint64_t load_word(const uint8_t *bitmap, const size_t bytes, const size_t offset) {
+	uint64_t word = 0;
+
+	if (bytes - offset >= sizeof(word)) {
+		memcpy(&word, bitmap + offset, sizeof(word));
+	} else {
+		memcpy(&word, bitmap + offset, bytes - offset);
+	}
+
+	return word;
+}
+
+static inline void iter_init(bit_iter *it, const uint8_t *bitmap, const size_t bytes) {
+	it->bitmap = bitmap;
+	it->bytes  = bytes;
+	it->offset = 0;
+	it->word   = load_word(bitmap, bytes, 0);
+}
+
+static inline bool iter_next(bit_iter *it, uint64_t *position) {
+	while (it->word == 0) {
+		it->offset += sizeof(it->word);
+		if (it->offset >= it->bytes) {
+			return false;
+		}
+		it->word = load_word(it->bitmap, it->bytes, it->offset);
+	}
+
+	*position = (it->offset * 8) + __builtin_ctzll(it->word);
+	it->word &= it->word - 1;
+
+	return true;
+}
+
+/* bit_writer, bit_reader -- least significant bit first bit streams,
+ * moved to and from memory 64 bits at a time. `count` is the number of
+ * bits held in `bits`, always less than 64.
+ */
+typedef struct {
+	uint8_t  *out;
+	size_t    limit;
+	size_t    pos;
+	uint64_t  bits;
+	unsigned  count;
+	bool      overflow; // set instead of writing past `limit`
+} bit_writer;
+
+typedef struct {
+	const uint8_t *in;
+	size_t         size;
+	size_t         pos;
+	uint64_t       bits;
+	unsigned       count;
+} bit_reader;
+
+// count must be less than 64
+static inline void put_bits(bit_writer *w, const uint64_t value, const unsigned count) {
+	w->bits |= value << w->count;
+
+	if (w->count + count < 64) {
+		w->count += count;
+		return;
+	}
+
+	if (w->limit - w->pos < sizeof(w->bits)) {
+		w->overflow = true;
+	} else {
+		memcpy(w->out + w->pos, &w->bits, sizeof(w->bits));
+		w->pos += sizeof(w->bits);
+	}
+
+	w->bits  = (w->count > 0) ? value >> (64 - w->count) : 0;
+	w->count = w->count + count - 64;
+}
+
+static inline void flush_bits(bit_writer *w) {
+	size_t bytes = (w->count + 7) / 8;
+
+	if (w->overflow || w->limit - w->pos < bytes) {
+		w->overflow = true;
+		return;
+	}
+
+	memcpy(w->out + w->pos, &w->bits, bytes);
+	w->pos  += bytes;
+	w->bits  = 0;
+	w->count = 0;
+}
+
+static inline void put_gap(bit_writer *w, const uint64_t gap, const uint8_t parameter) {
+	uint64_t quotient  = gap >> parameter;
+	uint64_t remainder = gap & ((1ULL << parameter) - 1);
+
+	while (quotient >= RICE_UNARY_CHUNK) {
+		put_bits(w, 0, RICE_UNARY_CHUNK);
+		quotient -= RICE_UNARY_CHUNK;
+	}
+
+	if (quotient + 1 + parameter <= RICE_UNARY_CHUNK) {
+		put_bits(w, (remainder << (quotient + 1)) | (1ULL << quotient), quotient + 1 + parameter);
+	} else {
+		put_bits(w, 1ULL << quotient, quotient + 1);
+		put_bits(w, remainder, parameter);
+	}
+}
+
+/* refill() -- top up to at least 56 bits, or whatever is left of the
+ * input. Bits above `count` are kept zero, so an empty `bits` means no
+ * set bit has been read yet.
+ */
+static inline void refill(bit_reader *r) {
+	if (r->pos + sizeof(uint64_t) <= r->size) {
+		uint64_t word;
+		unsigned bytes = (63 - r->count) / 8;
+
+		memcpy(&word, r->in + r->pos, sizeof(word));
+		r->pos   += bytes;
+		r->count += bytes * 8;
+		r->bits  |= word << (r->count - (bytes * 8));
+		r->bits  &= (1ULL << r->count) - 1;
+		return;
+	}
+
+	while (r->count <= 55 && r->pos < r->size) {
+		r->bits  |= (uint64_t)r->in[r->pos++] << r->count;
+		r->count += 8;
+	}
+}
+
+// count must be less than 64
+static inline void consume(bit_reader *r, const unsigned count) {
+	r->bits  >>= count;
+	r->count  -= count;
+}
+
+/**
+ * @brief Helper function to choose the Rice parameter for a bitmap
+ * with `count` of its `bits` set.
+ *
+ * If bits are set independently, gaps are geometrically distributed
+ * and the best Golomb modulus is about log(phi - 1) / log(1 - p)
+ * (Gallager & van Voorhis). Its log2, rounded up, is the Rice
+ * parameter.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static uint8_t choose_parameter(const uint64_t count, const size_t bits) {
+	double p, modulus;
+
+	if (count == 0 || count >= bits) {
+		return 0;
+	}
+
+	p       = (double)count / bits;
+	modulus = log(0.6180339887498949) / log1p(-p);
+	if (modulus <= 1.0) {
+		return 0;
+	}
+
+	double parameter = ceil(log2(modulus));
+
+	return (parameter > RICE_MAX_PARAMETER) ? RICE_MAX_PARAMETER : (uint8_t)parameter;
+}
+
+/**
+ * @brief Calculate the size of the encoding of a bitmap.
+ *
+ * @param bitmap Bitmap to encode.
+ * @param bits Number of bits in the bitmap. Bits past this must be zero.
+ *
+ * @return Size of the encoding in bytes, including RICE_HEADER_SIZE.
+ */
+size_t rice_encoded_size(const uint8_t *bitmap, const size_t bits) {
+	size_t   bytes     = (bits + 7) / 8;
+	uint64_t count     = bitops_popcount(bitmap, bytes);
+	uint8_t  parameter = choose_parameter(count, bits);
+	uint64_t quotients = 0;
+	uint64_t position, next = 0;
+	bit_iter it;
+
+	iter_init(&it, bitmap, bytes);
+	while (iter_next(&it, &position)) {
+		quotients += (position - next) >> parameter;
+		next       = position + 1;
+	}
+
+	return RICE_HEADER_SIZE + ((quotients + (count * (parameter + 1)) + 7) / 8);
+}
+
+/**
+ * @brief Encode a bitmap.
+ *
+ * Encoding stops as soon as it would exceed `limit` bytes, so a dense
+ * bitmap costs little more than its population count to reject.
+ *
+ * @param bitmap Bitmap to encode.
+ * @param bits Number of bits in the bitmap. Bits past this must be zero.
+ * @param out Buffer of at least `limit` bytes.
+ * @param limit Largest encoding to write.
+ *
+ * @return Number of bytes written to `out`.
+ * @return 0 if the encoding is larger than `limit`.
+ */
+size_t rice_encode(const uint8_t *bitmap, const size_t bits, uint8_t *out, const size_t limit) {
+	size_t     bytes     = (bits + 7) / 8;
+	uint64_t   count     = bitops_popcount(bitmap, bytes);
+	uint8_t    parameter = choose_parameter(count, bits);
+	uint64_t   position, next = 0;
+	bit_iter   it;
+	bit_writer w = { out, limit, RICE_HEADER_SIZE, 0, 0, false };
+
+	if (limit < RICE_HEADER_SIZE) {
+		return 0;
+	}
+
+	memset(out, 0, RICE_HEADER_SIZE);
+	memcpy(out, &count, sizeof(count));
+	out[sizeof(count)] = parameter;
+
+	iter_init(&it, bitmap, bytes);
+	while (iter_next(&it, &position) && !w.overflow) {
+		put_gap(&w, position - next, parameter);
+		next = position + 1;
+	}
+
+	flush_bits(&w);
+
+	return w.overflow ? 0 : w.pos;
+}
+
+/**
+ * @brief Decode a bitmap encoded with `rice_encode()`.
+ *
+ * @param in Encoded bitmap.
+ * @param size Size of the encoding in bytes.
+ * @param bitmap Bitmap of at least `(bits + 7) / 8` bytes to decode into.
+ * @param bits Number of bits in the bitmap.
+ *
+ * @return true on success.
+ * @return false if the encoding is truncated, or describes bits
+ *         outside of the bitmap.
+ */
+bool rice_decode(const uint8_t *in, const size_t size, uint8_t *bitmap, const size_t bits) {
+	uint64_t   count, next = 0;
+	uint8_t    parameter;
+	bit_reader r;
+
+	if (size < RICE_HEADER_SIZE) {
+		return false;
+	}
+
+	memcpy(&count, in, sizeof(count));
+	parameter = in[sizeof(count)];
+	if (parameter > RICE_MAX_PARAMETER || count > bits) {
+		return false;
+	}
+
+	r = (bit_reader){ in + RICE_HEADER_SIZE, size - RICE_HEADER_SIZE, 0, 0, 0 };
+	memset(bitmap, 0, (bits + 7) / 8);
+
+	for (uint64_t i = 0; i < count; i++) {
+		uint64_t quotient = 0;
+
+		// most codes fit in one refill
+		refill(&r);
+		if (r.bits != 0) {
+			unsigned zeros = __builtin_ctzll(r.bits);
+
+			if (zeros + 1 + parameter <= r.count) {
+				uint64_t gap = ((uint64_t)zeros << parameter) |
+					((r.bits >> (zeros + 1)) & ((1ULL << parameter) - 1));
+				consume(&r, zeros + 1 + parameter);
+
+				if (gap >= bits - next) {
+					return false;
+				}
+
+				next += gap;
+				bitmap[next / 8] |= 1 << (next % 8);
+				next++;
+				continue;
+			}
+		}
+
+		for (;;) {
+			refill(&r);
+			if (r.count == 0 || quotient > (bits >> parameter)) {
+				return false;
+			}
+
+			if (r.bits == 0) {
+				quotient += r.count;
+				consume(&r, r.count);
+				continue;
+			}
+
+			unsigned zeros = __builtin_ctzll(r.bits);
+			quotient += zeros;
+			consume(&r, zeros + 1);
+			break;
+		}
+
+		refill(&r);
+		if (r.count < parameter || quotient > (bits >> parameter)) {
+			return false;
+		}
+
+		uint64_t gap = (quotient << parameter) | (r.bits & ((1ULL << parameter) - 1));
+		consume(&r, parameter);
+
+		if (gap >= bits - next) {
+			return false;
+		}
+
+		uint64_t position = next + gap;
+		bitmap[position / 8] |= 1 << (position % 8);
+		next = position + 1;
+	}
+
+	return true;
+}
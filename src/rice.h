@@ -0,0 +1,30 @@
+/* rice.h -- Golomb-Rice coding of sparse bitmaps.
+ *
+ * Internal helpers used to compress saved filters. A bitmap is stored
+ * as the gaps between its set bits, each coded as a unary quotient
+ * and a `parameter` bit remainder. For a bitmap with a fraction p of
+ * its bits set, this costs close to the entropy of p per bit, so a
+ * lightly loaded filter shrinks to a fraction of its size.
+ *
+ * An encoded bitmap starts with RICE_HEADER_SIZE bytes: the number of
+ * set bits as a uint64_t, the parameter, and zero padding. The coded
+ * gaps follow, least significant bit first.
+ *
+ * This header is not installed.
+ */
+#ifndef RICE_H
+#define RICE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RICE_HEADER_SIZE 16
+
+/* function declarations
+ */
+size_t rice_encoded_size(const uint8_t *, const size_t);
+size_t rice_encode(const uint8_t *, const size_t, uint8_t *, const size_t);
+bool   rice_decode(const uint8_t *, const size_t, uint8_t *, const size_t);
+
+#endif /* RICE_H */
@@ -0,0 +1,523 @@
+/**
+ * @file sbloom.c
+ * @brief Scalable Bloom filter implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains functions for working with scalable Bloom
+ * filters, including initialization, destruction, insertion, querying,
+ * and saving and loading filters from disk.
+ *
+ * Every slice uses the filter's hash strategy, so an element is hashed
+ * once and the same hash is checked against each slice with
+ * `bloom_lookup_hashed()`. Slices are checked newest first: the newest
+ * slice is the largest and holds most of the elements.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "hash.h"
+#include "bloom.h"
+#include "sbloom.h"
+
+_Static_assert(sizeof(sbloomfilter_file) == 64,
+               "sbloomfilter_file must be 64 bytes");
+_Static_assert(sizeof(sbloomfilter_slice_file) == 32,
+               "sbloomfilter_slice_file must be 32 bytes");
+
+/**
+ * @brief Flags slices may be created with. Concurrency and dirty
+ * tracking aren't supported across slices.
+ */
+#define SLICE_FLAGS (BLOOM_FLAG_POW2 | BLOOM_FLAG_FASTRANGE)
+
+/**
+ * @brief Helper function to compute the capacity and false positive
+ * rate of slice `index`.
+ *
+ * Slice `i` holds `expected * growth^i` elements at a false positive
+ * rate of `accuracy * (1 - tightening) * tightening^i`. Those rates
+ * sum to less than `accuracy`.
+ *
+ * @return false if the capacity doesn't fit in a size_t.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool slice_params(const sbloomfilter *sbf, const size_t index, size_t *expected, float *accuracy) {
+	size_t capacity = sbf->expected;
+
+	for (size_t i = 0; i < index; i++) {
+		if (capacity > SIZE_MAX / sbf->growth) {
+			return false;
+		}
+		capacity *= sbf->growth;
+	}
+
+	*expected = capacity;
+	*accuracy = sbf->accuracy * (1.0f - sbf->tightening) * powf(sbf->tightening, index);
+
+	return true;
+}
+
+/**
+ * @brief Helper function to append a slice to a scalable Bloom filter.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_OUTOFMEMORY if the slice can't be allocated, or the filter
+ *         already has SBLOOM_MAX_SLICES slices.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bloom_error_t add_slice(sbloomfilter *sbf) {
+	bloomfilter   *slices;
+	size_t         expected;
+	float          accuracy;
+	bloom_error_t  error;
+
+	if (sbf->count == SBLOOM_MAX_SLICES || !slice_params(sbf, sbf->count, &expected, &accuracy)) {
+		return BF_OUTOFMEMORY;
+	}
+
+	slices = realloc(sbf->slices, (sbf->count + 1) * sizeof(bloomfilter));
+	if (slices == NULL) {
+		return BF_OUTOFMEMORY;
+	}
+	sbf->slices = slices;
+
+	error = bloom_init_flags(&sbf->slices[sbf->count], expected, accuracy, sbf->flags);
+	if (error != BF_SUCCESS) {
+		return error;
+	}
+
+	sbf->slices[sbf->count].hash = sbf->hash;
+	sbf->count      += 1;
+	sbf->insertions  = 0;
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Initialize a scalable Bloom filter with the default growth
+ * factor and tightening ratio.
+ *
+ * @param sbf      Pointer to an sbloomfilter structure.
+ * @param expected Number of elements the first slice holds. The filter
+ *                 grows past this as needed.
+ * @param accuracy Bound on the false positive rate, ex: 0.01.
+ *
+ * @return BF_SUCCESS on successful initialization.
+ * @return BF_INVALIDPARAM if a parameter is out of range.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t sbloom_init(sbloomfilter *sbf, const size_t expected, const float accuracy) {
+	return sbloom_init_flags(sbf, expected, accuracy, SBLOOM_GROWTH, SBLOOM_TIGHTENING, 0);
+}
+
+/**
+ * @brief Initialize a scalable Bloom filter.
+ *
+ * A larger growth factor means fewer slices, so cheaper lookups, at
+ * the cost of more memory allocated ahead of need. A tightening ratio
+ * closer to 1 makes the first slices smaller but later ones larger;
+ * 0.8 to 0.9 uses the least memory overall with a growth factor of 2.
+ *
+ * @param sbf        Pointer to an sbloomfilter structure.
+ * @param expected   Number of elements the first slice holds.
+ * @param accuracy   Bound on the false positive rate, ex: 0.01.
+ * @param growth     Capacity ratio between successive slices, at least 1.
+ * @param tightening False positive rate ratio between successive
+ *                   slices, between 0 and 1.
+ * @param flags      BLOOM_FLAG_POW2 or BLOOM_FLAG_FASTRANGE, applied to
+ *                   every slice. Other bits are ignored.
+ *
+ * @return BF_SUCCESS on successful initialization.
+ * @return BF_INVALIDPARAM if a parameter is out of range.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t sbloom_init_flags(sbloomfilter *sbf,
+								const size_t expected,
+								const float accuracy,
+								const size_t growth,
+								const float tightening,
+								const uint32_t flags) {
+	memset(sbf, 0, sizeof(sbloomfilter));
+
+	if (expected == 0 || growth == 0 ||
+		!(accuracy > 0.0f && accuracy < 1.0f) ||
+		!(tightening > 0.0f && tightening < 1.0f)) {
+		return BF_INVALIDPARAM;
+	}
+
+	sbf->expected   = expected;
+	sbf->accuracy   = accuracy;
+	sbf->growth     = growth;
+	sbf->tightening = tightening;
+	sbf->flags      = flags & SLICE_FLAGS;
+	sbf->hash       = HASH_MMH3;
+
+	return add_slice(sbf);
+}
+
+/**
+ * @brief Free every slice of a scalable Bloom filter.
+ *
+ * @param sbf Pointer to the scalable Bloom filter to free.
+ */
+void sbloom_destroy(sbloomfilter *sbf) {
+	for (size_t i = 0; i < sbf->count; i++) {
+		bloom_destroy(&sbf->slices[i]);
+	}
+
+	free(sbf->slices);
+	sbf->slices = NULL;
+	sbf->count  = 0;
+}
+
+/**
+ * @brief Select the hash strategy used by an empty scalable Bloom
+ * filter. Defaults to HASH_MMH3.
+ *
+ * @return false if the strategy is unknown or the filter holds elements.
+ */
+bool sbloom_set_hash(sbloomfilter *sbf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) || sbf->total != 0) {
+		return false;
+	}
+
+	sbf->hash = strategy;
+	for (size_t i = 0; i < sbf->count; i++) {
+		sbf->slices[i].hash = strategy;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Total size in bytes of a scalable Bloom filter's bitmaps.
+ */
+size_t sbloom_memory(const sbloomfilter *sbf) {
+	size_t memory = 0;
+
+	for (size_t i = 0; i < sbf->count; i++) {
+		memory += sbf->slices[i].bitmap_size;
+	}
+
+	return memory;
+}
+
+/**
+ * @brief Estimate the false positive rate of a scalable Bloom filter
+ * from the number of elements in each slice.
+ *
+ * @return The estimated false positive rate, between 0 and 1. This
+ *         stays below the filter's `accuracy`.
+ */
+float sbloom_estimate_false_positive_rate(const sbloomfilter *sbf) {
+	double negative = 1.0;
+
+	for (size_t i = 0; i < sbf->count; i++) {
+		const bloomfilter *slice = &sbf->slices[i];
+		double             n     = (i == sbf->count - 1) ? sbf->insertions : slice->expected;
+		double             k     = slice->hashcount;
+
+		negative *= 1.0 - pow(1.0 - exp(-k * n / slice->size), k);
+	}
+
+	return 1.0 - negative;
+}
+
+/**
+ * @brief Helper function to check every slice for an element that has
+ * already been hashed, newest first.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool lookup_hashed(const sbloomfilter *sbf, const uint64_t *hash) {
+	for (size_t i = sbf->count; i > 0; i--) {
+		if (bloom_lookup_hashed(&sbf->slices[i - 1], hash)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Check if an element is likely present in a scalable Bloom
+ * filter.
+ *
+ * @param sbf Scalable Bloom filter to perform look up against.
+ * @param element Pointer to the element to look up.
+ * @param len Length of the element in bytes.
+ *
+ * @return true if the element is probably in the filter.
+ * @return false if the element is definitely not in the filter.
+ */
+bool sbloom_lookup(const sbloomfilter *sbf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(sbf->hash, element, len, hash);
+
+	return lookup_hashed(sbf, hash);
+}
+
+/**
+ * @brief Helper function for `sbloom_lookup()` to handle string elements.
+ */
+bool sbloom_lookup_string(const sbloomfilter *sbf, const char *element) {
+	return sbloom_lookup(sbf, element, strlen(element));
+}
+
+/**
+ * @brief Add an element to a scalable Bloom filter.
+ *
+ * Elements that are already present are not added again, so they
+ * don't use up a slice's capacity. When the newest slice is full, a
+ * new one is added first.
+ *
+ * @param sbf Scalable Bloom filter to add element to.
+ * @param element Pointer to element to add.
+ * @param len Length of element in bytes.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_OUTOFMEMORY if a new slice was needed but couldn't be
+ *         allocated. The element was not added.
+ */
+bloom_error_t sbloom_add(sbloomfilter *sbf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(sbf->hash, element, len, hash);
+
+	if (lookup_hashed(sbf, hash)) {
+		return BF_SUCCESS;
+	}
+
+	if (sbf->insertions >= sbf->slices[sbf->count - 1].expected) {
+		bloom_error_t error = add_slice(sbf);
+
+		if (error != BF_SUCCESS) {
+			return error;
+		}
+	}
+
+	bloom_add_hashed(&sbf->slices[sbf->count - 1], hash);
+	sbf->insertions += 1;
+	sbf->total      += 1;
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Helper function for `sbloom_add()` to handle string elements.
+ */
+bloom_error_t sbloom_add_string(sbloomfilter *sbf, const char *element) {
+	return sbloom_add(sbf, element, strlen(element));
+}
+
+/**
+ * @brief Helper functions for the save and load functions. Transfer
+ * all of a buffer, which a single read() or write() of a large bitmap
+ * may not.
+ *
+ * @note These functions are static and intended for internal use.
+ */
+static bool write_all(int fd, const void *buf, size_t size) {
+	const uint8_t *p = buf;
+
+	while (size > 0) {
+		ssize_t written = write(fd, p, size);
+
+		if (written <= 0) {
+			return false;
+		}
+		p    += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t size) {
+	uint8_t *p = buf;
+
+	while (size > 0) {
+		ssize_t got = read(fd, p, size);
+
+		if (got <= 0) {
+			return false;
+		}
+		p    += got;
+		size -= got;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Save a scalable Bloom filter to a file descriptor.
+ *
+ * @param sbf Scalable Bloom filter to save.
+ * @param fd File descriptor to write to.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FWRITE if unable to write to the file descriptor.
+ */
+bloom_error_t sbloom_save_fd(const sbloomfilter *sbf, int fd) {
+	sbloomfilter_file sff = {0};
+
+	memcpy(sff.magic, "!sbloom!", sizeof(sff.magic));
+	sff.count      = sbf->count;
+	sff.expected   = sbf->expected;
+	sff.growth     = sbf->growth;
+	sff.insertions = sbf->insertions;
+	sff.total      = sbf->total;
+	sff.accuracy   = sbf->accuracy;
+	sff.tightening = sbf->tightening;
+	sff.flags      = sbf->flags;
+	sff.hash       = sbf->hash;
+
+	if (!write_all(fd, &sff, sizeof(sff))) {
+		return BF_FWRITE;
+	}
+
+	for (size_t i = 0; i < sbf->count; i++) {
+		const bloomfilter       *slice = &sbf->slices[i];
+		sbloomfilter_slice_file  ssf   = {0};
+
+		ssf.expected  = slice->expected;
+		ssf.size      = slice->size;
+		ssf.hashcount = slice->hashcount;
+		ssf.accuracy  = slice->accuracy;
+
+		if (!write_all(fd, &ssf, sizeof(ssf)) ||
+			!write_all(fd, slice->bitmap, slice->bitmap_size)) {
+			return BF_FWRITE;
+		}
+	}
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Load a scalable Bloom filter from a file descriptor.
+ *
+ * Each slice is recreated from the filter's parameters and must match
+ * the size and hash count saved with it.
+ *
+ * @param sbf Pointer to the scalable Bloom filter to initialize.
+ * @param fd File descriptor to read from.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FREAD if unable to read from the file descriptor.
+ * @return BF_INVALIDFILE if the file is invalid.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t sbloom_load_fd(sbloomfilter *sbf, int fd) {
+	sbloomfilter_file sff;
+	bloom_error_t     error;
+
+	memset(sbf, 0, sizeof(sbloomfilter));
+
+	if (!read_all(fd, &sff, sizeof(sff))) {
+		return BF_FREAD;
+	}
+
+	if (memcmp(sff.magic, "!sbloom!", sizeof(sff.magic)) != 0 ||
+		sff.count == 0 || sff.count > SBLOOM_MAX_SLICES ||
+		sff.expected == 0 || sff.growth == 0 ||
+		!(sff.accuracy > 0.0f && sff.accuracy < 1.0f) ||
+		!(sff.tightening > 0.0f && sff.tightening < 1.0f) ||
+		(sff.flags & ~SLICE_FLAGS) || !hash_strategy_valid(sff.hash)) {
+		return BF_INVALIDFILE;
+	}
+
+	sbf->expected   = sff.expected;
+	sbf->accuracy   = sff.accuracy;
+	sbf->growth     = sff.growth;
+	sbf->tightening = sff.tightening;
+	sbf->flags      = sff.flags;
+	sbf->hash       = sff.hash;
+
+	for (size_t i = 0; i < sff.count; i++) {
+		sbloomfilter_slice_file  ssf;
+		bloomfilter             *slice;
+
+		if (!read_all(fd, &ssf, sizeof(ssf))) {
+			sbloom_destroy(sbf);
+			return BF_FREAD;
+		}
+
+		error = add_slice(sbf);
+		if (error != BF_SUCCESS) {
+			sbloom_destroy(sbf);
+			return error;
+		}
+
+		slice = &sbf->slices[i];
+		if (ssf.expected != slice->expected || ssf.size != slice->size ||
+			ssf.hashcount != slice->hashcount) {
+			sbloom_destroy(sbf);
+			return BF_INVALIDFILE;
+		}
+
+		if (!read_all(fd, slice->bitmap, slice->bitmap_size)) {
+			sbloom_destroy(sbf);
+			return BF_FREAD;
+		}
+		bloom_recount(slice);
+	}
+
+	sbf->insertions = sff.insertions;
+	sbf->total      = sff.total;
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Save a scalable Bloom filter to a file.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FOPEN if unable to open the file.
+ * @return BF_FWRITE if unable to write to the file.
+ */
+bloom_error_t sbloom_save(const sbloomfilter *sbf, const char *path) {
+	bloom_error_t error;
+	int           fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return BF_FOPEN;
+	}
+
+	error = sbloom_save_fd(sbf, fd);
+	close(fd);
+
+	return error;
+}
+
+/**
+ * @brief Load a scalable Bloom filter from a file.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FOPEN if unable to open the file.
+ * @return See `sbloom_load_fd()` for other errors.
+ */
+bloom_error_t sbloom_load(sbloomfilter *sbf, const char *path) {
+	bloom_error_t error;
+	int           fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return BF_FOPEN;
+	}
+
+	error = sbloom_load_fd(sbf, fd);
+	close(fd);
+
+	return error;
+}
@@ -0,0 +1,159 @@
+/**
+ * @file sbloom.h
+ * @brief Header file for scalable Bloom filter implementation
+ * @author Daniel Roberson
+ *
+ * This file contains the function declarations, type definitions, and
+ * macros for working with scalable Bloom filters. A scalable Bloom
+ * filter is a chain of classic Bloom filters ("slices"). When the
+ * newest slice holds as many elements as it was sized for, a larger
+ * slice with a lower false positive rate is added. The false positive
+ * rates of the slices form a geometric series, so the rate of the
+ * whole filter stays below the one it was created with no matter how
+ * many elements are added.
+ *
+ * "Scalable Bloom Filters" by Almeida, Baquero, Preguiça and Hutchison
+ * describes this technique:
+ * https://gsd.di.uminho.pt/members/cbm/ps/dbloom.pdf
+ *
+ * @see sbloom.c for the corresponding implementation.
+ * @see bloom.h for the classic Bloom filter and error codes.
+ */
+#ifndef SBLOOM_H
+#define SBLOOM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+#include "bloom.h"
+
+/**
+ * @def SBLOOM_GROWTH
+ * @brief Default factor by which each slice's capacity exceeds the
+ * previous slice's.
+ */
+#define SBLOOM_GROWTH     2
+
+/**
+ * @def SBLOOM_TIGHTENING
+ * @brief Default ratio between the false positive rates of successive
+ * slices.
+ */
+#define SBLOOM_TIGHTENING 0.85f
+
+/**
+ * @def SBLOOM_MAX_SLICES
+ * @brief Most slices a scalable Bloom filter may have. With the
+ * default growth factor the last slice's capacity is 2^63 times the
+ * first's, so this is never the limit in practice.
+ */
+#define SBLOOM_MAX_SLICES 64
+
+/**
+ * @struct sbloomfilter
+ * @brief Scalable Bloom filter data structure.
+ *
+ * @var sbloomfilter::slices
+ * Array of `count` Bloom filters. New elements are added to the last.
+ *
+ * @var sbloomfilter::count
+ * Number of slices.
+ *
+ * @var sbloomfilter::expected
+ * Capacity of the first slice.
+ *
+ * @var sbloomfilter::accuracy
+ * Bound on the false positive rate of the whole filter.
+ *
+ * @var sbloomfilter::growth
+ * Each slice holds `growth` times as many elements as the last.
+ *
+ * @var sbloomfilter::tightening
+ * Each slice's false positive rate is `tightening` times the last's.
+ *
+ * @var sbloomfilter::insertions
+ * Elements added to the newest slice.
+ *
+ * @var sbloomfilter::total
+ * Elements added to the whole filter.
+ *
+ * @var sbloomfilter::flags
+ * BLOOM_FLAG_* options every slice is created with.
+ *
+ * @var sbloomfilter::hash
+ * Hash strategy used by every slice. See `sbloom_set_hash()`.
+ */
+typedef struct {
+	bloomfilter  *slices;       /**< Slices, the newest last */
+	size_t        count;        /**< Number of slices */
+	size_t        expected;     /**< Capacity of the first slice */
+	float         accuracy;     /**< Bound on the false positive rate */
+	size_t        growth;       /**< Capacity ratio between slices */
+	float         tightening;   /**< False positive rate ratio between slices */
+	size_t        insertions;   /**< Elements in the newest slice */
+	size_t        total;        /**< Elements in the filter */
+	uint32_t      flags;        /**< BLOOM_FLAG_* options of the slices */
+	hash_strategy hash;         /**< Hash strategy */
+} sbloomfilter;
+
+/**
+ * @struct sbloomfilter_file
+ * @brief Header of a saved scalable Bloom filter.
+ *
+ * Followed by `count` slices, each an sbloomfilter_slice_file and the
+ * slice's bitmap.
+ */
+typedef struct {
+	uint8_t  magic[8];       /**< "!sbloom!" */
+	uint64_t count;
+	uint64_t expected;
+	uint64_t growth;
+	uint64_t insertions;
+	uint64_t total;
+	float    accuracy;
+	float    tightening;
+	uint32_t flags;
+	uint32_t hash;
+} sbloomfilter_file;
+
+/**
+ * @struct sbloomfilter_slice_file
+ * @brief Header of one slice of a saved scalable Bloom filter. `size`
+ * and `hashcount` must match what the slice's capacity and false
+ * positive rate produce.
+ */
+typedef struct {
+	uint64_t expected;
+	uint64_t size;
+	uint64_t hashcount;
+	float    accuracy;
+	uint32_t reserved;
+} sbloomfilter_slice_file;
+
+/* function declarations
+ */
+bloom_error_t  sbloom_init(sbloomfilter *, const size_t, const float);
+bloom_error_t  sbloom_init_flags(sbloomfilter *,
+                                 const size_t,
+                                 const float,
+                                 const size_t,
+                                 const float,
+                                 const uint32_t);
+void           sbloom_destroy(sbloomfilter *);
+bool           sbloom_set_hash(sbloomfilter *, const hash_strategy);
+size_t         sbloom_memory(const sbloomfilter *);
+float          sbloom_estimate_false_positive_rate(const sbloomfilter *);
+bloom_error_t  sbloom_save(const sbloomfilter *, const char *);
+bloom_error_t  sbloom_load(sbloomfilter *, const char *);
+bloom_error_t  sbloom_save_fd(const sbloomfilter *, int);
+bloom_error_t  sbloom_load_fd(sbloomfilter *, int);
+
+bool           sbloom_lookup(const sbloomfilter *, const void *, const size_t);
+bool           sbloom_lookup_string(const sbloomfilter *, const char *);
+
+bloom_error_t  sbloom_add(sbloomfilter *, const void *, const size_t);
+bloom_error_t  sbloom_add_string(sbloomfilter *, const char *);
+
+#endif /* SBLOOM_H */
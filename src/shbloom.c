@@ -0,0 +1,730 @@
+/**
+ * @file shbloom.c
+ * @brief Sharded Bloom filter implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains functions for working with sharded Bloom
+ * filters, including initialization, destruction, insertion, querying,
+ * merging, and saving and loading filters from disk.
+ *
+ * An element is hashed once. `hash[1]` picks the shard and both halves
+ * index it with `bloom_lookup_hashed()` and `bloom_add_hashed()`.
+ * `hash[0]` alone places an element's first bit, so using it for the
+ * shard too would crowd every element of a shard into one region.
+ *
+ * Shard bitmaps are bound to their NUMA node with mbind() after they
+ * are allocated and before they are first written, so the kernel
+ * places every page of a large bitmap on that node when it is touched.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#ifdef ARCHBLOOM_HAVE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+#include "hash.h"
+#include "bitops.h"
+#include "fastrange.h"
+#include "bloom.h"
+#include "shbloom.h"
+
+_Static_assert(sizeof(shbloomfilter_file) == 64,
+               "shbloomfilter_file must be 64 bytes");
+
+/**
+ * @brief Flags shards may be created with. Dirty tracking isn't
+ * supported across shards.
+ */
+#define SHARD_FLAGS (BLOOM_FLAG_POW2 | BLOOM_FLAG_FASTRANGE | BLOOM_FLAG_CONCURRENT)
+
+/**
+ * @brief Flags that change where an element's bits are. Filters must
+ * agree on these to be merged.
+ */
+#define LAYOUT_FLAGS (BLOOM_FLAG_POW2 | BLOOM_FLAG_FASTRANGE)
+
+/**
+ * @struct shbloom_lock
+ * @brief Lock of one shard of a SHBLOOM_FLAG_LOCKED filter, padded to
+ * a cache line so threads locking neighbouring shards don't contend.
+ */
+struct shbloom_lock {
+	_Alignas(64) pthread_rwlock_t lock;
+};
+
+/**
+ * @brief Helper functions to lock and unlock shard `i` of a
+ * SHBLOOM_FLAG_LOCKED filter. They do nothing for other filters.
+ *
+ * @note These functions are static and intended for internal use.
+ */
+static inline void read_lock(const shbloomfilter *sf, const size_t i) {
+	if (sf->locks != NULL) {
+		pthread_rwlock_rdlock(&sf->locks[i].lock);
+	}
+}
+
+static inline void write_lock(const shbloomfilter *sf, const size_t i) {
+	if (sf->locks != NULL) {
+		pthread_rwlock_wrlock(&sf->locks[i].lock);
+	}
+}
+
+static inline void unlock(const shbloomfilter *sf, const size_t i) {
+	if (sf->locks != NULL) {
+		pthread_rwlock_unlock(&sf->locks[i].lock);
+	}
+}
+
+/**
+ * @brief Get the number of NUMA nodes shards can be placed on.
+ *
+ * @return The number of nodes, or 0 if the library was built without
+ *         libnuma or the system doesn't support NUMA.
+ */
+int shbloom_numa_nodes(void) {
+#ifdef ARCHBLOOM_HAVE_NUMA
+	if (numa_available() != -1) {
+		return numa_max_node() + 1;
+	}
+#endif
+	return 0;
+}
+
+/**
+ * @brief Helper function to bind the whole pages of a bitmap to a NUMA
+ * node, moving any already in memory. The partial pages at either end
+ * may be shared with other allocations and are left alone.
+ *
+ * @return true if the bitmap is bound to `node`.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool place_bitmap(uint8_t *bitmap, const size_t size, const int node) {
+#ifdef ARCHBLOOM_HAVE_NUMA
+	uintptr_t       page  = sysconf(_SC_PAGESIZE);
+	uintptr_t       start = ((uintptr_t)bitmap + page - 1) & ~(page - 1);
+	uintptr_t       end   = ((uintptr_t)bitmap + size) & ~(page - 1);
+	struct bitmask *mask;
+	long            result;
+
+	if (end <= start) {
+		return true; // smaller than a page: nothing to move
+	}
+
+	mask = numa_allocate_nodemask();
+	if (mask == NULL) {
+		return false;
+	}
+	numa_bitmask_setbit(mask, node);
+
+	result = mbind((void *)start, end - start, MPOL_BIND, mask->maskp, mask->size + 1, MPOL_MF_MOVE);
+	numa_free_nodemask(mask);
+
+	return result == 0;
+#else
+	(void)bitmap;
+	(void)size;
+	(void)node;
+	return false;
+#endif
+}
+
+/**
+ * @brief Initialize a sharded Bloom filter. Shards are spread over the
+ * system's NUMA nodes in turn, if it has more than one.
+ *
+ * @param sf       Pointer to an shbloomfilter structure.
+ * @param expected Expected number of elements in the whole filter.
+ * @param accuracy Desired false positive rate, ex: 0.01.
+ * @param shards   Number of shards, 1 to SHBLOOM_MAX_SHARDS.
+ *
+ * @return BF_SUCCESS on successful initialization.
+ * @return BF_INVALIDPARAM if a parameter is out of range.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t shbloom_init(shbloomfilter *sf, const size_t expected, const float accuracy, const size_t shards) {
+	return shbloom_init_flags(sf, expected, accuracy, shards, 0, NULL);
+}
+
+/**
+ * @brief Initialize a sharded Bloom filter.
+ *
+ * Each shard is sized for its share of `expected` at `accuracy`, so
+ * the whole filter has about the false positive rate of one classic
+ * filter of the same capacity.
+ *
+ * @param sf       Pointer to an shbloomfilter structure.
+ * @param expected Expected number of elements in the whole filter.
+ * @param accuracy Desired false positive rate, ex: 0.01.
+ * @param shards   Number of shards, 1 to SHBLOOM_MAX_SHARDS.
+ * @param flags    BLOOM_FLAG_POW2, BLOOM_FLAG_FASTRANGE or
+ *                 BLOOM_FLAG_CONCURRENT, applied to every shard, and
+ *                 SHBLOOM_FLAG_LOCKED. Other bits are ignored.
+ * @param nodes    NUMA node of each shard, or SHBLOOM_NODE_ANY. NULL
+ *                 spreads shards over the nodes in turn. Ignored if
+ *                 NUMA isn't available.
+ *
+ * @return BF_SUCCESS on successful initialization.
+ * @return BF_INVALIDPARAM if a parameter is out of range.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t shbloom_init_flags(shbloomfilter *sf,
+								 const size_t expected,
+								 const float accuracy,
+								 const size_t shards,
+								 const uint32_t flags,
+								 const int *nodes) {
+	int           numa_nodes = shbloom_numa_nodes();
+	bloom_error_t error;
+
+	memset(sf, 0, sizeof(shbloomfilter));
+
+	if (expected == 0 || shards == 0 || shards > SHBLOOM_MAX_SHARDS ||
+		!(accuracy > 0.0f && accuracy < 1.0f)) {
+		return BF_INVALIDPARAM;
+	}
+
+	for (size_t i = 0; nodes != NULL && numa_nodes > 0 && i < shards; i++) {
+		if (nodes[i] != SHBLOOM_NODE_ANY && (nodes[i] < 0 || nodes[i] >= numa_nodes)) {
+			return BF_INVALIDPARAM;
+		}
+	}
+
+	sf->expected = expected;
+	sf->accuracy = accuracy;
+	sf->flags    = flags & (SHARD_FLAGS | SHBLOOM_FLAG_LOCKED);
+	sf->hash     = HASH_MMH3;
+	sf->shards   = calloc(shards, sizeof(bloomfilter));
+	sf->nodes    = malloc(shards * sizeof(int));
+	if (sf->shards == NULL || sf->nodes == NULL) {
+		shbloom_destroy(sf);
+		return BF_OUTOFMEMORY;
+	}
+
+	for (; sf->count < shards; sf->count++) {
+		bloomfilter *shard = &sf->shards[sf->count];
+		int          node  = SHBLOOM_NODE_ANY;
+
+		error = bloom_init_flags(shard, (expected + shards - 1) / shards, accuracy, sf->flags & SHARD_FLAGS);
+		if (error != BF_SUCCESS) {
+			shbloom_destroy(sf);
+			return error;
+		}
+
+		if (numa_nodes > 1 || (numa_nodes > 0 && nodes != NULL)) {
+			node = (nodes != NULL) ? nodes[sf->count] : (int)(sf->count % numa_nodes);
+		}
+
+		if (node != SHBLOOM_NODE_ANY && !place_bitmap(shard->bitmap, shard->bitmap_size, node)) {
+			node = SHBLOOM_NODE_ANY;
+		}
+		sf->nodes[sf->count] = node;
+	}
+
+	if (sf->flags & SHBLOOM_FLAG_LOCKED) {
+		sf->locks = aligned_alloc(_Alignof(struct shbloom_lock), shards * sizeof(struct shbloom_lock));
+		if (sf->locks == NULL) {
+			shbloom_destroy(sf);
+			return BF_OUTOFMEMORY;
+		}
+
+		for (size_t i = 0; i < shards; i++) {
+			pthread_rwlock_init(&sf->locks[i].lock, NULL);
+		}
+	}
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Free every shard of a sharded Bloom filter.
+ *
+ * @param sf Pointer to the sharded Bloom filter to free.
+ */
+void shbloom_destroy(shbloomfilter *sf) {
+	for (size_t i = 0; i < sf->count; i++) {
+		bloom_destroy(&sf->shards[i]);
+		if (sf->locks != NULL) {
+			pthread_rwlock_destroy(&sf->locks[i].lock);
+		}
+	}
+
+	free(sf->shards);
+	free(sf->nodes);
+	free(sf->locks);
+	sf->shards = NULL;
+	sf->nodes  = NULL;
+	sf->locks  = NULL;
+	sf->count  = 0;
+}
+
+/**
+ * @brief Clear every shard of a sharded Bloom filter. Shards stay on
+ * their NUMA nodes.
+ */
+void shbloom_clear(shbloomfilter *sf) {
+	for (size_t i = 0; i < sf->count; i++) {
+		write_lock(sf, i);
+		bloom_clear(&sf->shards[i]);
+		unlock(sf, i);
+	}
+}
+
+/**
+ * @brief Select the hash strategy used by an empty sharded Bloom
+ * filter. Defaults to HASH_MMH3.
+ *
+ * @return false if the strategy is unknown or the filter holds elements.
+ */
+bool shbloom_set_hash(shbloomfilter *sf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) || shbloom_saturation_count(sf) != 0) {
+		return false;
+	}
+
+	sf->hash = strategy;
+	for (size_t i = 0; i < sf->count; i++) {
+		sf->shards[i].hash = strategy;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Helper function to get the shard an element that has already
+ * been hashed belongs to.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline size_t shard_of(const shbloomfilter *sf, const uint64_t *hash) {
+	return fastrange64(hash[1], sf->count);
+}
+
+/**
+ * @brief Get the shard an element belongs to, so it can be handed to a
+ * thread running on that shard's NUMA node.
+ *
+ * @return Index of the shard, less than `sf->count`.
+ */
+size_t shbloom_shard(const shbloomfilter *sf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(sf->hash, element, len, hash);
+
+	return shard_of(sf, hash);
+}
+
+/**
+ * @brief Get the NUMA node shard `shard` is bound to.
+ *
+ * @return The node, or SHBLOOM_NODE_ANY if the shard isn't bound.
+ */
+int shbloom_shard_node(const shbloomfilter *sf, const size_t shard) {
+	return (shard < sf->count) ? sf->nodes[shard] : SHBLOOM_NODE_ANY;
+}
+
+/**
+ * @brief Restrict the calling thread to the CPUs of the NUMA node
+ * shard `shard` is bound to.
+ *
+ * @return false if the shard isn't bound to a node or the thread
+ *         couldn't be moved.
+ */
+bool shbloom_bind_thread(const shbloomfilter *sf, const size_t shard) {
+	int node = shbloom_shard_node(sf, shard);
+
+	if (node == SHBLOOM_NODE_ANY) {
+		return false;
+	}
+
+#ifdef ARCHBLOOM_HAVE_NUMA
+	return numa_run_on_node(node) == 0;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @brief Total size in bytes of a sharded Bloom filter's bitmaps.
+ */
+size_t shbloom_memory(const shbloomfilter *sf) {
+	size_t memory = 0;
+
+	for (size_t i = 0; i < sf->count; i++) {
+		memory += sf->shards[i].bitmap_size;
+	}
+
+	return memory;
+}
+
+/**
+ * @brief Count the bits set in every shard of a sharded Bloom filter.
+ */
+size_t shbloom_saturation_count(const shbloomfilter *sf) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < sf->count; i++) {
+		read_lock(sf, i);
+		count += bloom_saturation_count(&sf->shards[i]);
+		unlock(sf, i);
+	}
+
+	return count;
+}
+
+/**
+ * @brief Get the runtime statistics of a sharded Bloom filter, added
+ * up over all of its shards. See `bloom_stats()`.
+ *
+ * @return false if the filter keeps no statistics. Only `set` is
+ *         filled in.
+ */
+bool shbloom_stats(const shbloomfilter *sf, archbloom_stats *stats) {
+	bool kept = sf->count > 0;
+
+	memset(stats, 0, sizeof(archbloom_stats));
+
+	for (size_t i = 0; i < sf->count; i++) {
+		archbloom_stats shard;
+
+		read_lock(sf, i);
+		kept &= bloom_stats(&sf->shards[i], &shard);
+		unlock(sf, i);
+
+		stats->adds    += shard.adds;
+		stats->lookups += shard.lookups;
+		stats->hits    += shard.hits;
+		stats->set     += shard.set;
+	}
+
+	return kept;
+}
+
+/**
+ * @brief Calculate the percentage of bits set in a sharded Bloom
+ * filter, over all of its shards.
+ */
+float shbloom_saturation(const shbloomfilter *sf) {
+	return (float)shbloom_saturation_count(sf) / (shbloom_memory(sf) * 8) * 100.0;
+}
+
+/**
+ * @brief Estimate the false positive rate of a sharded Bloom filter.
+ *
+ * An element absent from the filter is checked against one shard,
+ * each equally likely, so this is the mean of the shards' rates. A
+ * shard's rate is the chance that all `hashcount` of an absent
+ * element's bits are set: its saturation to the power `hashcount`.
+ *
+ * @return The estimated false positive rate, between 0 and 1.
+ */
+float shbloom_estimate_false_positive_rate(const shbloomfilter *sf) {
+	double rate = 0.0;
+
+	for (size_t i = 0; i < sf->count; i++) {
+		const bloomfilter *shard = &sf->shards[i];
+		size_t             set;
+
+		read_lock(sf, i);
+		set = bloom_saturation_count(shard);
+		unlock(sf, i);
+
+		rate += pow((double)set / shard->size, shard->hashcount);
+	}
+
+	return rate / sf->count;
+}
+
+/**
+ * @brief Merge two sharded Bloom filters into a new one.
+ *
+ * The two filters must have the same number and size of shards, hash
+ * strategy and layout flags. The result has the options of `sf1` and
+ * its shards are placed on the same NUMA nodes.
+ *
+ * @param result Pointer to an uninitialized shbloomfilter.
+ * @param sf1 First filter.
+ * @param sf2 Second filter.
+ *
+ * @return BF_SUCCESS on successful merge.
+ * @return BF_INVALIDFILE if the two filters are not compatible.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t shbloom_merge(shbloomfilter *result,
+							const shbloomfilter *sf1,
+							const shbloomfilter *sf2) {
+	bloom_error_t error;
+
+	if (sf1->count != sf2->count ||
+		sf1->expected != sf2->expected ||
+		sf1->accuracy != sf2->accuracy ||
+		sf1->hash != sf2->hash ||
+		((sf1->flags ^ sf2->flags) & LAYOUT_FLAGS)) {
+		return BF_INVALIDFILE;
+	}
+
+	error = shbloom_init_flags(result, sf1->expected, sf1->accuracy, sf1->count, sf1->flags, sf1->nodes);
+	if (error != BF_SUCCESS) {
+		return error;
+	}
+	shbloom_set_hash(result, sf1->hash);
+
+	for (size_t i = 0; i < sf1->count; i++) {
+		read_lock(sf1, i);
+		read_lock(sf2, i);
+		bitops_or(result->shards[i].bitmap,
+				  sf1->shards[i].bitmap,
+				  sf2->shards[i].bitmap,
+				  result->shards[i].bitmap_size);
+		unlock(sf2, i);
+		unlock(sf1, i);
+		bloom_recount(&result->shards[i]);
+	}
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Check if an element is likely present in a sharded Bloom
+ * filter.
+ *
+ * @param sf Sharded Bloom filter to perform look up against.
+ * @param element Pointer to the element to look up.
+ * @param len Length of the element in bytes.
+ *
+ * @return true if the element is probably in the filter.
+ * @return false if the element is definitely not in the filter.
+ */
+bool shbloom_lookup(const shbloomfilter *sf, const void *element, const size_t len) {
+	uint64_t hash[2];
+	size_t   shard;
+	bool     found;
+
+	hash_128(sf->hash, element, len, hash);
+	shard = shard_of(sf, hash);
+
+	read_lock(sf, shard);
+	found = bloom_lookup_hashed(&sf->shards[shard], hash);
+	unlock(sf, shard);
+
+	return found;
+}
+
+/**
+ * @brief Helper function for `shbloom_lookup()` to handle string elements.
+ */
+bool shbloom_lookup_string(const shbloomfilter *sf, const char *element) {
+	return shbloom_lookup(sf, element, strlen(element));
+}
+
+/**
+ * @brief Add an element to a sharded Bloom filter.
+ *
+ * @param sf Sharded Bloom filter to add element to.
+ * @param element Pointer to element to add.
+ * @param len Length of element in bytes.
+ */
+void shbloom_add(shbloomfilter *sf, const void *element, const size_t len) {
+	uint64_t hash[2];
+	size_t   shard;
+
+	hash_128(sf->hash, element, len, hash);
+	shard = shard_of(sf, hash);
+
+	write_lock(sf, shard);
+	bloom_add_hashed(&sf->shards[shard], hash);
+	unlock(sf, shard);
+}
+
+/**
+ * @brief Helper function for `shbloom_add()` to handle string elements.
+ */
+void shbloom_add_string(shbloomfilter *sf, const char *element) {
+	shbloom_add(sf, element, strlen(element));
+}
+
+/**
+ * @brief Helper functions for the save and load functions. Transfer
+ * all of a buffer, which a single read() or write() of a large bitmap
+ * may not.
+ *
+ * @note These functions are static and intended for internal use.
+ */
+static bool write_all(int fd, const void *buf, size_t size) {
+	const uint8_t *p = buf;
+
+	while (size > 0) {
+		ssize_t written = write(fd, p, size);
+
+		if (written <= 0) {
+			return false;
+		}
+		p    += written;
+		size -= written;
+	}
+
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t size) {
+	uint8_t *p = buf;
+
+	while (size > 0) {
+		ssize_t got = read(fd, p, size);
+
+		if (got <= 0) {
+			return false;
+		}
+		p    += got;
+		size -= got;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Save a sharded Bloom filter to a file descriptor as one
+ * logical filter.
+ *
+ * @param sf Sharded Bloom filter to save.
+ * @param fd File descriptor to write to.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FWRITE if unable to write to the file descriptor.
+ */
+bloom_error_t shbloom_save_fd(const shbloomfilter *sf, int fd) {
+	shbloomfilter_file sff = {0};
+
+	memcpy(sff.magic, "!shbloom", sizeof(sff.magic));
+	sff.count       = sf->count;
+	sff.expected    = sf->expected;
+	sff.size        = sf->shards[0].size;
+	sff.hashcount   = sf->shards[0].hashcount;
+	sff.bitmap_size = sf->shards[0].bitmap_size;
+	sff.accuracy    = sf->accuracy;
+	sff.flags       = sf->flags;
+	sff.hash        = sf->hash;
+
+	if (!write_all(fd, &sff, sizeof(sff))) {
+		return BF_FWRITE;
+	}
+
+	for (size_t i = 0; i < sf->count; i++) {
+		bool written;
+
+		read_lock(sf, i);
+		written = write_all(fd, sf->shards[i].bitmap, sf->shards[i].bitmap_size);
+		unlock(sf, i);
+
+		if (!written) {
+			return BF_FWRITE;
+		}
+	}
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Load a sharded Bloom filter from a file descriptor. Shards
+ * are spread over this system's NUMA nodes as `shbloom_init()` does.
+ *
+ * @param sf Pointer to the sharded Bloom filter to initialize.
+ * @param fd File descriptor to read from.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FREAD if unable to read from the file descriptor.
+ * @return BF_INVALIDFILE if the file is invalid.
+ * @return BF_OUTOFMEMORY if memory allocation fails.
+ */
+bloom_error_t shbloom_load_fd(shbloomfilter *sf, int fd) {
+	shbloomfilter_file sff;
+	bloom_error_t      error;
+
+	memset(sf, 0, sizeof(shbloomfilter));
+
+	if (!read_all(fd, &sff, sizeof(sff))) {
+		return BF_FREAD;
+	}
+
+	if (memcmp(sff.magic, "!shbloom", sizeof(sff.magic)) != 0 ||
+		(sff.flags & ~(SHARD_FLAGS | SHBLOOM_FLAG_LOCKED)) ||
+		!hash_strategy_valid(sff.hash)) {
+		return BF_INVALIDFILE;
+	}
+
+	error = shbloom_init_flags(sf, sff.expected, sff.accuracy, sff.count, sff.flags, NULL);
+	if (error != BF_SUCCESS) {
+		return (error == BF_INVALIDPARAM) ? BF_INVALIDFILE : error;
+	}
+	shbloom_set_hash(sf, sff.hash);
+
+	if (sff.size != sf->shards[0].size ||
+		sff.hashcount != sf->shards[0].hashcount ||
+		sff.bitmap_size != sf->shards[0].bitmap_size) {
+		shbloom_destroy(sf);
+		return BF_INVALIDFILE;
+	}
+
+	for (size_t i = 0; i < sf->count; i++) {
+		if (!read_all(fd, sf->shards[i].bitmap, sf->shards[i].bitmap_size)) {
+			shbloom_destroy(sf);
+			return BF_FREAD;
+		}
+		bloom_recount(&sf->shards[i]);
+	}
+
+	return BF_SUCCESS;
+}
+
+/**
+ * @brief Save a sharded Bloom filter to a file.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FOPEN if unable to open the file.
+ * @return BF_FWRITE if unable to write to the file.
+ */
+bloom_error_t shbloom_save(const shbloomfilter *sf, const char *path) {
+	bloom_error_t error;
+	int           fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		return BF_FOPEN;
+	}
+
+	error = shbloom_save_fd(sf, fd);
+	close(fd);
+
+	return error;
+}
+
+/**
+ * @brief Load a sharded Bloom filter from a file.
+ *
+ * @return BF_SUCCESS on success.
+ * @return BF_FOPEN if unable to open the file.
+ * @return See `shbloom_load_fd()` for other errors.
+ */
+bloom_error_t shbloom_load(shbloomfilter *sf, const char *path) {
+	bloom_error_t error;
+	int           fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return BF_FOPEN;
+	}
+
+	error = shbloom_load_fd(sf, fd);
+	close(fd);
+
+	return error;
+}
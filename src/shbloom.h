@@ -0,0 +1,154 @@
+/**
+ * @file shbloom.h
+ * @brief Header file for sharded Bloom filter implementation
+ * @author Daniel Roberson
+ *
+ * This file contains the function declarations, type definitions, and
+ * macros for working with sharded Bloom filters. A sharded Bloom
+ * filter splits one logical filter into a number of classic Bloom
+ * filters ("shards"), selected by the top bits of an element's hash. Every probe for an element lands in the same shard,
+ * so each shard can live on its own NUMA node, be served by threads
+ * pinned to that node, or be locked independently of the others.
+ *
+ * NUMA placement requires libnuma at build time. Without it, or on a
+ * machine with a single node, shards are allocated normally and
+ * `shbloom_shard_node()` reports -1.
+ *
+ * @see shbloom.c for the corresponding implementation.
+ * @see bloom.h for the classic Bloom filter and error codes.
+ */
+#ifndef SHBLOOM_H
+#define SHBLOOM_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+#include "bloom.h"
+
+/**
+ * @def SHBLOOM_MAX_SHARDS
+ * @brief Most shards a sharded Bloom filter may have.
+ */
+#define SHBLOOM_MAX_SHARDS 1024
+
+/**
+ * @def SHBLOOM_FLAG_LOCKED
+ * @brief `shbloom_init_flags()` flag: give every shard a reader-writer
+ * lock. Lookups take the shard's read lock and every other operation
+ * its write lock, so any function may be called from multiple threads,
+ * including `shbloom_clear()` and `shbloom_merge()`, and threads
+ * working on different shards never wait on each other.
+ *
+ * For adds and lookups alone, BLOOM_FLAG_CONCURRENT shards are
+ * cheaper: they take no locks at all.
+ */
+#define SHBLOOM_FLAG_LOCKED 0x10000
+
+/**
+ * @def SHBLOOM_NODE_ANY
+ * @brief Entry of the `nodes` array passed to `shbloom_init_flags()`
+ * for a shard that may be allocated on any NUMA node.
+ */
+#define SHBLOOM_NODE_ANY (-1)
+
+/**
+ * @struct shbloomfilter
+ * @brief Sharded Bloom filter data structure.
+ *
+ * @var shbloomfilter::shards
+ * Array of `count` Bloom filters of identical size.
+ *
+ * @var shbloomfilter::count
+ * Number of shards. An element belongs to shard
+ * `fastrange64(hash[1], count)`, which for a power of two is the top
+ * bits of the hash.
+ *
+ * @var shbloomfilter::expected
+ * Expected number of elements in the whole filter.
+ *
+ * @var shbloomfilter::accuracy
+ * Desired false positive rate of the whole filter.
+ *
+ * @var shbloomfilter::flags
+ * BLOOM_FLAG_* options of the shards and SHBLOOM_FLAG_* options.
+ *
+ * @var shbloomfilter::hash
+ * Hash strategy used by every shard. See `shbloom_set_hash()`.
+ *
+ * @var shbloomfilter::nodes
+ * NUMA node each shard's bitmap is bound to, or SHBLOOM_NODE_ANY.
+ *
+ * @var shbloomfilter::locks
+ * One lock per shard for SHBLOOM_FLAG_LOCKED filters, otherwise NULL.
+ */
+typedef struct {
+	bloomfilter         *shards;    /**< Shards, indexed by top hash bits */
+	size_t               count;     /**< Number of shards */
+	size_t               expected;  /**< Expected capacity of the filter */
+	float                accuracy;  /**< Desired margin of error */
+	uint32_t             flags;     /**< BLOOM_FLAG_* and SHBLOOM_FLAG_* options */
+	hash_strategy        hash;      /**< Hash strategy */
+	int                 *nodes;     /**< NUMA node of each shard */
+	struct shbloom_lock *locks;     /**< Shard locks, or NULL */
+} shbloomfilter;
+
+/**
+ * @struct shbloomfilter_file
+ * @brief Header of a saved sharded Bloom filter.
+ *
+ * Followed by the bitmap of each shard in order, `bitmap_size` bytes
+ * each. `size` and `hashcount` describe one shard and must match what
+ * `expected`, `accuracy`, `count` and `flags` produce. NUMA placement
+ * isn't saved; it belongs to the machine loading the filter.
+ */
+typedef struct {
+	uint8_t  magic[8];       /**< "!shbloom" */
+	uint64_t count;
+	uint64_t expected;
+	uint64_t size;
+	uint64_t hashcount;
+	uint64_t bitmap_size;
+	float    accuracy;
+	uint32_t flags;
+	uint32_t hash;
+	uint8_t  reserved[4];
+} shbloomfilter_file;
+
+/* function declarations
+ */
+bloom_error_t  shbloom_init(shbloomfilter *, const size_t, const float, const size_t);
+bloom_error_t  shbloom_init_flags(shbloomfilter *,
+                                  const size_t,
+                                  const float,
+                                  const size_t,
+                                  const uint32_t,
+                                  const int *);
+void           shbloom_destroy(shbloomfilter *);
+void           shbloom_clear(shbloomfilter *);
+bool           shbloom_set_hash(shbloomfilter *, const hash_strategy);
+int            shbloom_numa_nodes(void);
+size_t         shbloom_shard(const shbloomfilter *, const void *, const size_t);
+int            shbloom_shard_node(const shbloomfilter *, const size_t);
+bool           shbloom_bind_thread(const shbloomfilter *, const size_t);
+size_t         shbloom_memory(const shbloomfilter *);
+bloom_error_t  shbloom_save(const shbloomfilter *, const char *);
+bloom_error_t  shbloom_load(shbloomfilter *, const char *);
+bloom_error_t  shbloom_save_fd(const shbloomfilter *, int);
+bloom_error_t  shbloom_load_fd(shbloomfilter *, int);
+bloom_error_t  shbloom_merge(shbloomfilter *,
+                             const shbloomfilter *,
+                             const shbloomfilter *);
+size_t         shbloom_saturation_count(const shbloomfilter *);
+bool           shbloom_stats(const shbloomfilter *, archbloom_stats *);
+float          shbloom_saturation(const shbloomfilter *);
+float          shbloom_estimate_false_positive_rate(const shbloomfilter *);
+
+bool           shbloom_lookup(const shbloomfilter *, const void *, const size_t);
+bool           shbloom_lookup_string(const shbloomfilter *, const char *);
+
+void           shbloom_add(shbloomfilter *, const void *, const size_t);
+void           shbloom_add_string(shbloomfilter *, const char *);
+
+#endif /* SHBLOOM_H */
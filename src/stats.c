@@ -0,0 +1,137 @@
+/**
+ * @file stats.c
+ * @brief Runtime statistics implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains the functions that allocate, read and reset the
+ * counters behind the filters' `*_stats()` functions. Counting itself
+ * is `archbloom_count()`, inline in stats.h, so filters built without
+ * ARCHBLOOM_STATS don't pay for a call.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "stats.h"
+
+_Static_assert(sizeof(archbloom_stats) == ARCHBLOOM_STAT_COUNT * sizeof(uint64_t),
+               "archbloom_stats must have a field for every archbloom_stat");
+_Static_assert(sizeof(archbloom_counters) == 64,
+               "archbloom_counters must fill exactly one cache line");
+
+/**
+ * @brief Check whether this library keeps runtime statistics.
+ *
+ * @return true if the library was built with ARCHBLOOM_STATS.
+ * @return false if every `*_stats()` function reports nothing.
+ */
+bool archbloom_stats_enabled(void) {
+#ifdef ARCHBLOOM_STATS
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @brief Helper function to get the number of copies of the counters
+ * a filter keeps.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline size_t stripes(const bool concurrent) {
+	return concurrent ? ARCHBLOOM_STATS_STRIPES : 1;
+}
+
+/**
+ * @brief Allocate zeroed counters for a filter.
+ *
+ * Filters treat statistics as optional: if this fails they keep none,
+ * and their `*_stats()` functions return false.
+ *
+ * @param concurrent true if the filter is used by several threads.
+ *
+ * @return Pointer to the counters, to be released with
+ *         `archbloom_counters_free()`.
+ * @return NULL if the library was built without ARCHBLOOM_STATS, or
+ *         memory allocation fails.
+ */
+archbloom_counters *archbloom_counters_alloc(const bool concurrent) {
+#ifdef ARCHBLOOM_STATS
+	size_t              size     = stripes(concurrent) * sizeof(archbloom_counters);
+	archbloom_counters *counters = aligned_alloc(_Alignof(archbloom_counters), size);
+
+	if (counters != NULL) {
+		memset(counters, 0, size);
+	}
+
+	return counters;
+#else
+	(void)concurrent;
+	return NULL;
+#endif
+}
+
+/**
+ * @brief Free counters allocated with `archbloom_counters_alloc()`.
+ *
+ * @param counters Counters to free, or NULL.
+ */
+void archbloom_counters_free(archbloom_counters *counters) {
+	free(counters);
+}
+
+/**
+ * @brief Add up every copy of a filter's counters.
+ *
+ * @param counters The filter's counters, or NULL.
+ * @param concurrent true if the filter is used by several threads.
+ * @param stats Set to the totals, or zeroed if `counters` is NULL.
+ */
+void archbloom_counters_read(const archbloom_counters *counters, const bool concurrent, archbloom_stats *stats) {
+	uint64_t totals[ARCHBLOOM_STAT_COUNT] = {0};
+
+	for (size_t s = 0; counters != NULL && s < stripes(concurrent); s++) {
+		for (size_t i = 0; i < ARCHBLOOM_STAT_COUNT; i++) {
+			totals[i] += __atomic_load_n(&counters[s].count[i], __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(stats, totals, sizeof(archbloom_stats));
+}
+
+/**
+ * @brief Set counter `stat` to `value`, for filters that recount what
+ * it tracks after changing in bulk, such as a Bloom filter being
+ * merged or loaded.
+ *
+ * Other threads must not be counting `stat` at the same time.
+ *
+ * @param counters The filter's counters, or NULL.
+ * @param concurrent true if the filter is used by several threads.
+ * @param stat Counter to set.
+ * @param value Its new total.
+ */
+void archbloom_counters_store(archbloom_counters *counters, const bool concurrent,
+                              const archbloom_stat stat, const uint64_t value) {
+	if (counters == NULL) {
+		return;
+	}
+
+	for (size_t s = 0; s < stripes(concurrent); s++) {
+		counters[s].count[stat] = (s == 0) ? value : 0;
+	}
+}
+
+/**
+ * @brief Assign a calling thread the next copy of the counters, round
+ * robin.
+ *
+ * @return A copy in the range [0, ARCHBLOOM_STATS_STRIPES).
+ */
+size_t archbloom_counters_next_stripe(void) {
+	static size_t next;
+
+	return __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % ARCHBLOOM_STATS_STRIPES;
+}
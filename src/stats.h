@@ -0,0 +1,154 @@
+/**
+ * @file stats.h
+ * @brief Header file for runtime statistics of filters
+ * @author Daniel Roberson
+ *
+ * This file contains the type definitions and function declarations
+ * for the counters filters keep of their own use: elements added and
+ * looked up, lookups that hit, counters that saturated, expired
+ * entries swept away, and for Bloom filters the number of bits set,
+ * which makes `bloom_saturation()` and
+ * `bloom_estimate_false_positive_rate()` constant time.
+ *
+ * The counters are only kept by libraries built with ARCHBLOOM_STATS
+ * (`cmake -DARCHBLOOM_STATS=ON`), so they cost nothing otherwise.
+ * `archbloom_stats_enabled()` tells which kind of library is loaded.
+ *
+ * Filters made for use by several threads at once keep
+ * ARCHBLOOM_STATS_STRIPES copies of the counters, each on its own
+ * cache line, and each thread updates one with relaxed atomic adds, so
+ * threads counting don't contend with each other. Reading the counters
+ * adds up the copies; while other threads are updating them the
+ * figures are approximate. Other filters count with plain adds, so
+ * threads sharing one, even only for lookups, may lose counts.
+ * Counters start at zero when a filter is initialized, loaded or
+ * mapped; they aren't saved.
+ *
+ * @see stats.c for the corresponding implementation.
+ */
+#ifndef ARCHBLOOM_STATS_H
+#define ARCHBLOOM_STATS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @def ARCHBLOOM_STATS_STRIPES
+ * @brief Copies of the counters kept by filters used concurrently.
+ * Threads beyond this many share copies.
+ */
+#define ARCHBLOOM_STATS_STRIPES 16
+
+/**
+ * @enum archbloom_stat
+ * @brief Index of each counter, in the order of `archbloom_stats`.
+ */
+typedef enum {
+	ARCHBLOOM_STAT_ADDS = 0,    /**< Elements added. */
+	ARCHBLOOM_STAT_LOOKUPS,     /**< Elements looked up. */
+	ARCHBLOOM_STAT_HITS,        /**< Lookups that found their element. */
+	ARCHBLOOM_STAT_SET,         /**< Bits set in a Bloom filter. */
+	ARCHBLOOM_STAT_SATURATIONS, /**< Adds that found a counter saturated. */
+	ARCHBLOOM_STAT_REAPS,       /**< Expired entries cleared by sweeps. */
+	// Used for counting the number of statistics. Do not add any below this line.
+	ARCHBLOOM_STAT_COUNT
+} archbloom_stat;
+
+/**
+ * @struct archbloom_stats
+ * @brief Runtime statistics of a filter, as reported by its
+ * `*_stats()` function. Counters a kind of filter doesn't keep are 0.
+ *
+ * @var archbloom_stats::adds
+ * Elements added, including by lookup-or-add functions that didn't
+ * find their element.
+ *
+ * @var archbloom_stats::lookups
+ * Elements looked up, including by lookup-or-add functions.
+ *
+ * @var archbloom_stats::hits
+ * Lookups that found their element. `hits / lookups` is the hit rate,
+ * false positives included.
+ *
+ * @var archbloom_stats::set
+ * Bits set in a Bloom filter. Unlike the other counters, this holds
+ * for loaded filters too.
+ *
+ * @var archbloom_stats::saturations
+ * Adds to a counting filter that found at least one of their counters
+ * already at its largest value, so its increment was lost. Once these
+ * appear, counts and removals are no longer exact: use wider counters.
+ *
+ * @var archbloom_stats::reaps
+ * Expired timestamps or entries cleared by the expiry sweeps.
+ */
+typedef struct {
+	uint64_t adds;
+	uint64_t lookups;
+	uint64_t hits;
+	uint64_t set;
+	uint64_t saturations;
+	uint64_t reaps;
+} archbloom_stats;
+
+/**
+ * @struct archbloom_counters
+ * @brief One copy of a filter's counters, alone on its cache line.
+ * Filters point to 1, or ARCHBLOOM_STATS_STRIPES for concurrent
+ * filters, or NULL if they keep no statistics.
+ */
+typedef struct archbloom_counters {
+	_Alignas(64) uint64_t count[ARCHBLOOM_STAT_COUNT];
+} archbloom_counters;
+
+/* function declarations
+ */
+bool                archbloom_stats_enabled(void);
+
+/* used by the filters
+ */
+archbloom_counters *archbloom_counters_alloc(const bool);
+void                archbloom_counters_free(archbloom_counters *);
+void                archbloom_counters_read(const archbloom_counters *, const bool, archbloom_stats *);
+void                archbloom_counters_store(archbloom_counters *, const bool, const archbloom_stat, const uint64_t);
+size_t              archbloom_counters_next_stripe(void);
+
+/**
+ * @brief Add `n` to counter `stat`.
+ *
+ * Compiles to nothing in libraries built without ARCHBLOOM_STATS.
+ *
+ * @param counters The filter's counters, or NULL.
+ * @param concurrent true if the filter is used by several threads.
+ * @param stat Counter to add to.
+ * @param n Amount to add.
+ */
+static inline void archbloom_count(archbloom_counters *counters, const bool concurrent,
+                                   const archbloom_stat stat, const uint64_t n) {
+#ifdef ARCHBLOOM_STATS
+	static __thread size_t stripe; // 1 + this thread's copy, 0 until its first count
+
+	if (counters == NULL) {
+		return;
+	}
+
+	if (!concurrent) {
+		counters->count[stat] += n;
+		return;
+	}
+
+	if (stripe == 0) {
+		stripe = archbloom_counters_next_stripe() + 1;
+	}
+
+	__atomic_fetch_add(&counters[stripe - 1].count[stat], n, __ATOMIC_RELAXED);
+#else
+	(void)counters;
+	(void)concurrent;
+	(void)stat;
+	(void)n;
+#endif
+}
+
+#endif /* ARCHBLOOM_STATS_H */
@@ -0,0 +1,510 @@
+/**
+ * @file swbloom.c
+ * @brief Sliding window Bloom filter implementation.
+ * @author Daniel Roberson
+ *
+ * This file contains functions for working with sliding window Bloom
+ * filters: initialization, destruction, insertion, querying and
+ * expiry.
+ *
+ * Generations are rotated lazily. Every function works out the current
+ * epoch from the clock, lookups skip bitmaps that have left the
+ * window, and the first insertion of each epoch clears the bitmap it
+ * reuses. A filter left alone for a long time costs nothing until it
+ * is used again.
+ */
+#include <time.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "swbloom.h"
+#include "hash.h"
+#include "bitops.h"
+#include "fastrange.h"
+#include "alloc.h"
+
+// messages for swbloom_strerror(). See swbloom.h.
+const char *swbloom_errors[] = {
+	"Success",
+	"Invalid timeout value",
+	"Invalid number of generations",
+	"Invalid parameter",
+	"Out of memory"
+};
+
+_Static_assert(sizeof(swbloom_errors) / sizeof(swbloom_errors[0]) == SWBF_ERRORCOUNT,
+               "swbloom_errors must have a message for every swbloom_error_t");
+
+/**
+ * @brief Helper function to get the current monotonic time in seconds,
+ * the clock `tdbloom` uses.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static time_t get_monotonic_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+/**
+ * @brief Helper function to get the number of bitmaps a filter keeps:
+ * the window and the last retired generation.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline size_t slots(const swbloom *swbf) {
+	return swbf->generations + 1;
+}
+
+/**
+ * @brief Helper function to get the current epoch.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t current_epoch(const swbloom *swbf) {
+	time_t now = get_monotonic_time();
+
+	if (now < swbf->start_time) {
+		return 0;
+	}
+
+	return (uint64_t)(now - swbf->start_time) / swbf->period;
+}
+
+/**
+ * @brief Helper function to check whether bitmap `slot` is in the
+ * window at `epoch`.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline bool in_window(const swbloom *swbf, const size_t slot, const uint64_t epoch) {
+	return swbf->epochs[slot] != SWBLOOM_EPOCH_NONE && epoch - swbf->epochs[slot] < swbf->generations;
+}
+
+/**
+ * @brief Helper function to get bitmap `slot`.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t *slot_bitmap(const swbloom *swbf, const size_t slot) {
+	return swbf->bitmap + (slot * swbf->words);
+}
+
+/**
+ * @brief Helper function to map a hash onto a bit of a generation,
+ * according to the filter's SWBLOOM_FLAG_* options.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline uint64_t hash_position(const swbloom *swbf, const uint64_t hash) {
+	if (swbf->flags & SWBLOOM_FLAG_POW2) {
+		return hash & (swbf->size - 1);
+	}
+
+	if (swbf->flags & SWBLOOM_FLAG_FASTRANGE) {
+		return fastrange64(hash, swbf->size);
+	}
+
+	return hash % swbf->size;
+}
+
+/**
+ * @brief Helper function to list the bitmaps in the window at `epoch`,
+ * or if `window` is false every bitmap holding anything. Newest first,
+ * so lookups of recently added elements stop early.
+ *
+ * @return Number of bitmaps stored in `bitmaps`.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static size_t list_bitmaps(const swbloom *swbf, const uint64_t epoch, const bool window, const uint64_t **bitmaps) {
+	size_t count = 0;
+
+	for (size_t age = 0; age < slots(swbf); age++) {
+		size_t slot = (epoch + slots(swbf) - age) % slots(swbf);
+
+		if (swbf->epochs[slot] != SWBLOOM_EPOCH_NONE && (!window || in_window(swbf, slot, epoch))) {
+			bitmaps[count++] = slot_bitmap(swbf, slot);
+		}
+	}
+
+	return count;
+}
+
+/**
+ * @brief Helper function to check whether every bit of a hashed
+ * element is set in at least one of `count` bitmaps.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool lookup_in(const swbloom *swbf, const uint64_t *hash, const uint64_t **bitmaps, const size_t count) {
+	for (size_t i = 0; i < swbf->hashcount; i++) {
+		uint64_t position = hash_position(swbf, hash_probe(hash, i));
+		uint64_t mask     = 1ULL << (position % 64);
+		bool     found    = false;
+
+		for (size_t b = 0; b < count && !found; b++) {
+			found = (bitmaps[b][position / 64] & mask) != 0;
+		}
+
+		if (!found) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Initialize a sliding window Bloom filter.
+ *
+ * @param swbf Pointer to the filter to initialize.
+ * @param expected Expected number of distinct elements added in any
+ *        `timeout` seconds.
+ * @param accuracy Acceptable false positive rate (e.g., 0.01 for 1%).
+ * @param timeout Seconds an element must stay in the filter.
+ * @param generations Number of generations the window is split into.
+ *        More generations expire elements closer to `timeout` but cost
+ *        more memory and make lookups slower. 4 to 8 is typical.
+ *
+ * @return SWBF_SUCCESS on success.
+ * @return SWBF_INVALIDTIMEOUT if `timeout` is 0.
+ * @return SWBF_INVALIDGENERATIONS if `generations` is out of range.
+ * @return SWBF_INVALIDPARAM if `expected` or `accuracy` is out of range.
+ * @return SWBF_OUTOFMEMORY if memory allocation fails.
+ */
+swbloom_error_t swbloom_init(swbloom *swbf, const size_t expected, const float accuracy, const size_t timeout, const size_t generations) {
+	return swbloom_init_flags(swbf, expected, accuracy, timeout, generations, 0);
+}
+
+/**
+ * @brief Initialize a sliding window Bloom filter with options.
+ *
+ * This function is `swbloom_init()` with a set of SWBLOOM_FLAG_*
+ * options controlling how hashes are mapped onto bits. See
+ * `bloom_init_flags()` for the tradeoffs.
+ *
+ * Each generation is sized so the whole window, which can hold up to
+ * `generations / (generations - 1)` times `expected` elements just
+ * before a rotation, stays within `accuracy`.
+ *
+ * @param flags Bitwise OR of SWBLOOM_FLAG_* values. Unknown bits are
+ *        ignored.
+ *
+ * @return See `swbloom_init()`.
+ */
+swbloom_error_t swbloom_init_flags(swbloom *swbf, const size_t expected, const float accuracy, const size_t timeout, const size_t generations, const uint32_t flags) {
+	double window;
+
+	if (timeout == 0) {
+		return SWBF_INVALIDTIMEOUT;
+	}
+
+	if (generations < 2 || generations > SWBLOOM_MAX_GENERATIONS) {
+		return SWBF_INVALIDGENERATIONS;
+	}
+
+	if (expected == 0 || !(accuracy > 0 && accuracy < 1)) {
+		return SWBF_INVALIDPARAM;
+	}
+
+	window = (double)expected * generations / (generations - 1);
+
+	swbf->size        = ceil(-(window * log(accuracy) / pow(log(2.0), 2)));
+	if (flags & SWBLOOM_FLAG_POW2) {
+		swbf->size = round_pow2(swbf->size);
+	}
+	swbf->words       = (swbf->size + 63) / 64;
+	swbf->hashcount   = round(((double)swbf->size / window) * log(2));
+	if (swbf->hashcount == 0) {
+		swbf->hashcount = 1;
+	}
+	swbf->expected    = expected;
+	swbf->accuracy    = accuracy;
+	swbf->timeout     = timeout;
+	swbf->generations = generations;
+	swbf->period      = (timeout + generations - 2) / (generations - 1);
+	swbf->start_time  = get_monotonic_time();
+	swbf->flags       = flags & SWBLOOM_FLAGS_ALL;
+	swbf->hash        = HASH_MMH3;
+
+	for (size_t i = 0; i < SWBLOOM_MAX_GENERATIONS + 1; i++) {
+		swbf->epochs[i] = SWBLOOM_EPOCH_NONE;
+	}
+	swbf->epochs[0] = 0;
+
+	swbf->bitmap = archbloom_alloc(slots(swbf) * swbf->words * sizeof(uint64_t));
+	if (swbf->bitmap == NULL) {
+		return SWBF_OUTOFMEMORY;
+	}
+
+	return SWBF_SUCCESS;
+}
+
+/**
+ * @brief Free the memory of a sliding window Bloom filter.
+ *
+ * @param swbf Pointer to the filter to destroy.
+ */
+void swbloom_destroy(swbloom *swbf) {
+	archbloom_free(swbf->bitmap);
+	swbf->bitmap = NULL;
+}
+
+/**
+ * @brief Select the hash strategy used by a sliding window Bloom
+ * filter. See `tdbloom_set_hash()`.
+ *
+ * @return true on success.
+ * @return false if the strategy is unknown, or elements have already
+ *         been added to the filter.
+ */
+bool swbloom_set_hash(swbloom *swbf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) ||
+		bitops_nonzero_bytes((uint8_t *)swbf->bitmap, slots(swbf) * swbf->words * sizeof(uint64_t)) != 0) {
+		return false;
+	}
+
+	swbf->hash = strategy;
+
+	return true;
+}
+
+/**
+ * @brief Remove every element from a sliding window Bloom filter and
+ * restart its window at the current time.
+ *
+ * @param swbf Pointer to the filter to clear.
+ */
+void swbloom_clear(swbloom *swbf) {
+	memset(swbf->bitmap, 0, slots(swbf) * swbf->words * sizeof(uint64_t));
+
+	for (size_t i = 0; i < slots(swbf); i++) {
+		swbf->epochs[i] = SWBLOOM_EPOCH_NONE;
+	}
+	swbf->epochs[0]  = 0;
+	swbf->start_time = get_monotonic_time();
+}
+
+/**
+ * @brief Clear every generation that has left the window, including
+ * the last retired one.
+ *
+ * Expired elements are never seen by lookups, so this is only needed
+ * to forget them entirely: `swbloom_has_expired()` can't report them
+ * afterwards. It touches at most two generations in normal use.
+ *
+ * @param swbf Pointer to the filter.
+ *
+ * @return Number of generations cleared.
+ */
+size_t swbloom_clear_expired(swbloom *swbf) {
+	uint64_t epoch   = current_epoch(swbf);
+	size_t   cleared = 0;
+
+	for (size_t slot = 0; slot < slots(swbf); slot++) {
+		if (swbf->epochs[slot] != SWBLOOM_EPOCH_NONE && !in_window(swbf, slot, epoch)) {
+			memset(slot_bitmap(swbf, slot), 0, swbf->words * sizeof(uint64_t));
+			swbf->epochs[slot] = SWBLOOM_EPOCH_NONE;
+			cleared++;
+		}
+	}
+
+	return cleared;
+}
+
+/**
+ * @brief Get the memory used by a filter's bitmaps, in bytes.
+ */
+size_t swbloom_memory(const swbloom *swbf) {
+	return slots(swbf) * swbf->words * sizeof(uint64_t);
+}
+
+/**
+ * @brief Count the bits set in any generation of the window: the
+ * saturation a lookup sees.
+ *
+ * @param swbf Pointer to the filter.
+ *
+ * @return Number of bits set.
+ */
+size_t swbloom_saturation_count(const swbloom *swbf) {
+	const uint64_t *bitmaps[SWBLOOM_MAX_GENERATIONS + 1];
+	size_t          count = list_bitmaps(swbf, current_epoch(swbf), true, bitmaps);
+	size_t          set   = 0;
+
+	for (size_t w = 0; w < swbf->words; w++) {
+		uint64_t word = 0;
+
+		for (size_t b = 0; b < count; b++) {
+			word |= bitmaps[b][w];
+		}
+		set += __builtin_popcountll(word);
+	}
+
+	return set;
+}
+
+/**
+ * @brief Get the percentage of the window's bits that are set.
+ */
+float swbloom_saturation(const swbloom *swbf) {
+	return (float)swbloom_saturation_count(swbf) / swbf->size * 100;
+}
+
+/**
+ * @brief Add an element that has already been hashed.
+ *
+ * The first insertion of each period clears the bitmap that becomes
+ * the newest generation. See `tdbloom_add_hashed()`.
+ *
+ * @param swbf Pointer to the filter.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ */
+void swbloom_add_hashed(swbloom *swbf, const uint64_t *hash) {
+	uint64_t  epoch = current_epoch(swbf);
+	size_t    slot  = epoch % slots(swbf);
+	uint64_t *bitmap;
+
+	if (swbf->epochs[slot] != epoch) {
+		memset(slot_bitmap(swbf, slot), 0, swbf->words * sizeof(uint64_t));
+		swbf->epochs[slot] = epoch;
+	}
+
+	bitmap = slot_bitmap(swbf, slot);
+	for (size_t i = 0; i < swbf->hashcount; i++) {
+		uint64_t position = hash_position(swbf, hash_probe(hash, i));
+
+		bitmap[position / 64] |= 1ULL << (position % 64);
+	}
+}
+
+/**
+ * @brief Add an element to a sliding window Bloom filter.
+ *
+ * @param swbf Pointer to the filter.
+ * @param element Pointer to the element to add.
+ * @param len Length of the element in bytes.
+ */
+void swbloom_add(swbloom *swbf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(swbf->hash, element, len, hash);
+
+	swbloom_add_hashed(swbf, hash);
+}
+
+/**
+ * @brief Helper function for `swbloom_add()` to handle string elements.
+ */
+void swbloom_add_string(swbloom *swbf, const char *element) {
+	swbloom_add(swbf, element, strlen(element));
+}
+
+/**
+ * @brief Check an element that has already been hashed. See
+ * `swbloom_add_hashed()`.
+ *
+ * @param swbf Pointer to the filter.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return true if the element was likely added within the window.
+ * @return false if it definitely wasn't.
+ */
+bool swbloom_lookup_hashed(const swbloom *swbf, const uint64_t *hash) {
+	const uint64_t *bitmaps[SWBLOOM_MAX_GENERATIONS + 1];
+	size_t          count = list_bitmaps(swbf, current_epoch(swbf), true, bitmaps);
+
+	return lookup_in(swbf, hash, bitmaps, count);
+}
+
+/**
+ * @brief Check if an element was added to a sliding window Bloom
+ * filter within the window.
+ *
+ * Each probe ORs the window's generations, so a lookup reads up to
+ * `generations` cache lines per hash, fewer for elements added
+ * recently.
+ *
+ * @param swbf Pointer to the filter.
+ * @param element Pointer to the element to look up.
+ * @param len Length of the element in bytes.
+ *
+ * @return true if the element was likely added within the window.
+ * @return false if it definitely wasn't.
+ */
+bool swbloom_lookup(const swbloom *swbf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(swbf->hash, element, len, hash);
+
+	return swbloom_lookup_hashed(swbf, hash);
+}
+
+/**
+ * @brief Helper function for `swbloom_lookup()` to handle string elements.
+ */
+bool swbloom_lookup_string(const swbloom *swbf, const char *element) {
+	return swbloom_lookup(swbf, element, strlen(element));
+}
+
+/**
+ * @brief Check if an element has expired from a sliding window Bloom
+ * filter.
+ *
+ * An element has expired if it isn't in the window but is in a
+ * generation that has left it. Only the last retired generation is
+ * kept, so elements that expired more than a period ago, or before
+ * `swbloom_clear_expired()`, are reported as never added.
+ *
+ * @param swbf Pointer to the filter.
+ * @param element Pointer to the element to check.
+ * @param len Length of the element in bytes.
+ *
+ * @return true if the element has likely expired.
+ * @return false if it is still in the window or was never added.
+ */
+bool swbloom_has_expired(const swbloom *swbf, const void *element, const size_t len) {
+	const uint64_t *bitmaps[SWBLOOM_MAX_GENERATIONS + 1];
+	uint64_t        epoch = current_epoch(swbf);
+	uint64_t        hash[2];
+	size_t          count;
+
+	hash_128(swbf->hash, element, len, hash);
+
+	count = list_bitmaps(swbf, epoch, true, bitmaps);
+	if (lookup_in(swbf, hash, bitmaps, count)) {
+		return false;
+	}
+
+	count = list_bitmaps(swbf, epoch, false, bitmaps);
+	return lookup_in(swbf, hash, bitmaps, count);
+}
+
+/**
+ * @brief Helper function for `swbloom_has_expired()` to handle string
+ * elements.
+ */
+bool swbloom_has_expired_string(const swbloom *swbf, const char *element) {
+	return swbloom_has_expired(swbf, element, strlen(element));
+}
+
+/**
+ * @brief Get a human-readable message for a sliding window Bloom
+ * filter error code.
+ *
+ * @return The message, or "Unknown error" if the code is out of range.
+ */
+const char *swbloom_strerror(const swbloom_error_t error) {
+	if (error < 0 || error >= SWBF_ERRORCOUNT) {
+		return "Unknown error";
+	}
+
+	return swbloom_errors[error];
+}
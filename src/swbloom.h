@@ -0,0 +1,153 @@
+/**
+ * @file swbloom.h
+ * @brief Header file for sliding window Bloom filters
+ * @author Daniel Roberson
+ *
+ * This file contains the function declarations, type definitions, and
+ * macros for working with sliding window Bloom filters: filters that
+ * answer "was this element seen in the last `timeout` seconds?" like
+ * a time-decaying Bloom filter, but with a bit per position instead of
+ * a timestamp.
+ *
+ * The window is split into `generations` plain bitmaps, each covering
+ * `period` seconds. Elements are added to the newest generation,
+ * lookups OR the generations together, and when a period passes the
+ * oldest generation is retired and the one before it is cleared with
+ * a single memset() and reused as the newest. Nothing is swept, and
+ * an element stays visible for at least `timeout` and less than
+ * `timeout + period` seconds.
+ *
+ * One generation more than the window is kept: the last retired one,
+ * which lets `swbloom_has_expired()` tell elements that expired
+ * recently from ones that were never added.
+ *
+ * @see swbloom.c for the corresponding implementation.
+ * @see tdbloom.h for a filter that expires elements to the second.
+ */
+#ifndef SWBLOOM_H
+#define SWBLOOM_H
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hash.h"
+
+/**
+ * @def SWBLOOM_MAX_GENERATIONS
+ * @brief Largest number of generations a window can be split into.
+ */
+#define SWBLOOM_MAX_GENERATIONS 64
+
+/**
+ * @def SWBLOOM_FLAG_POW2
+ * @brief `swbloom_init_flags()` flag: round the size of each
+ * generation up to a power of two and map hashes onto it with a mask.
+ * Takes precedence over SWBLOOM_FLAG_FASTRANGE.
+ */
+#define SWBLOOM_FLAG_POW2      0x01
+
+/**
+ * @def SWBLOOM_FLAG_FASTRANGE
+ * @brief `swbloom_init_flags()` flag: map hashes onto each generation
+ * with a multiply and shift rather than a 64 bit modulo.
+ */
+#define SWBLOOM_FLAG_FASTRANGE 0x02
+
+/**
+ * @def SWBLOOM_FLAGS_ALL
+ * @brief Every flag understood by this version of the library.
+ */
+#define SWBLOOM_FLAGS_ALL      (SWBLOOM_FLAG_POW2 | SWBLOOM_FLAG_FASTRANGE)
+
+/**
+ * @brief Error handling return values for sliding window Bloom filter
+ * operations.
+ */
+typedef enum {
+	SWBF_SUCCESS = 0,          /**< Operation completed successfully. */
+	SWBF_INVALIDTIMEOUT,       /**< Timeout is zero. */
+	SWBF_INVALIDGENERATIONS,   /**< Generations outside [2, SWBLOOM_MAX_GENERATIONS]. */
+	SWBF_INVALIDPARAM,         /**< Expected elements or accuracy out of range. */
+	SWBF_OUTOFMEMORY,          /**< Memory allocation failed. */
+	// Used for counting the number of statuses. Do not add statuses below this line.
+	SWBF_ERRORCOUNT            /**< Total number of error statuses. */
+} swbloom_error_t;
+
+/**
+ * @var swbloom_errors
+ * @brief Human-readable messages for `swbloom_error_t` codes. Use
+ * `swbloom_strerror()` rather than indexing it directly.
+ */
+extern const char *swbloom_errors[];
+
+/**
+ * @struct swbloom
+ * @brief Sliding window Bloom filter data structure.
+ *
+ * @var swbloom::epochs
+ * Epoch each generation's bitmap was last cleared for, or
+ * SWBLOOM_EPOCH_NONE. Epoch `e` covers seconds
+ * `[start_time + e * period, start_time + (e + 1) * period)` and lives
+ * in bitmap `e % (generations + 1)`. A bitmap is in the window while
+ * its epoch is less than `generations` behind the current one.
+ */
+typedef struct {
+	size_t         size;        /**< Bits per generation. */
+	size_t         words;       /**< 64 bit words per generation. */
+	size_t         hashcount;   /**< Number of hashes per element. */
+	size_t         expected;    /**< Expected elements per window. */
+	float          accuracy;    /**< Desired false positive rate. */
+	size_t         timeout;     /**< Seconds an element is guaranteed to stay. */
+	size_t         generations; /**< Generations in the window. */
+	size_t         period;      /**< Seconds covered by each generation. */
+	time_t         start_time;  /**< Start of epoch 0. */
+	uint32_t       flags;       /**< SWBLOOM_FLAG_* options. */
+	hash_strategy  hash;        /**< Hash strategy. See swbloom_set_hash(). */
+	uint64_t       epochs[SWBLOOM_MAX_GENERATIONS + 1]; /**< Epoch of each bitmap. */
+	uint64_t      *bitmap;      /**< `generations + 1` bitmaps of `words` words. */
+} swbloom;
+
+/**
+ * @def SWBLOOM_EPOCH_NONE
+ * @brief `swbloom::epochs` value of a bitmap holding nothing.
+ */
+#define SWBLOOM_EPOCH_NONE UINT64_MAX
+
+/* function declarations
+ */
+swbloom_error_t  swbloom_init(swbloom *,
+                              const size_t,
+                              const float,
+                              const size_t,
+                              const size_t);
+swbloom_error_t  swbloom_init_flags(swbloom *,
+                                    const size_t,
+                                    const float,
+                                    const size_t,
+                                    const size_t,
+                                    const uint32_t);
+void             swbloom_destroy(swbloom *);
+bool             swbloom_set_hash(swbloom *, const hash_strategy);
+
+void             swbloom_clear(swbloom *);
+size_t           swbloom_clear_expired(swbloom *);
+size_t           swbloom_memory(const swbloom *);
+size_t           swbloom_saturation_count(const swbloom *);
+float            swbloom_saturation(const swbloom *);
+
+void             swbloom_add(swbloom *, const void *, const size_t);
+void             swbloom_add_string(swbloom *, const char *);
+void             swbloom_add_hashed(swbloom *, const uint64_t *);
+
+bool             swbloom_lookup(const swbloom *, const void *, const size_t);
+bool             swbloom_lookup_string(const swbloom *, const char *);
+bool             swbloom_lookup_hashed(const swbloom *, const uint64_t *);
+
+bool             swbloom_has_expired(const swbloom *, const void *, const size_t);
+bool             swbloom_has_expired_string(const swbloom *, const char *);
+
+const char      *swbloom_strerror(const swbloom_error_t);
+
+#endif /* SWBLOOM_H */
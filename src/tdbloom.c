@@ -19,10 +19,35 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <limits.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 #include "tdbloom.h"
-#include "mmh3.h"
+#include "hash.h"
+#include "bitops.h"
+#include "fastrange.h"
+#include "mapfile.h"
+#include "alloc.h"
+
+_Static_assert(sizeof(tdbloom_file) % 64 == 0,
+               "tdbloom_file must keep the timestamps 64 byte aligned");
+
+// messages for tdbloom_strerror(). See tdbloom.h.
+const char *tdbloom_errors[] = {
+	"Success",                 /**< TDBF_SUCCESS: Successfull operation. */
+	"Invalid timeout value",   /**< TDBF_INVALIDTIMEOUT: Timeout value is invalid or out of range. */
+	"Out of memory",           /**< TDBF_OUTOFMEMORY: Memory allocation failed. */
+	"Unable to open file",     /**< TDBF_FOPEN: Failed to open file. */
+	"Unable to read file",     /**< TDBF_FREAD: Failed to read from file. */
+	"Unable to write to file", /**< TDBF_FWRITE: Failed to write to file. */
+	"fstat() error",           /**< TDBF_FSTAT: Failed to stat() the file descriptor. */
+	"Invalid file format",     /**< TDBF_INVALIDFILE: File format is invalid or unparseable. */
+	"Invalid counter size",    /**< TDBF_INVALIDCOUNTERSIZE: Counter size is invalid. */
+	"mmap() failure"           /**< TDBF_MMAP: Failed to mmap() the file. */
+};
+
+_Static_assert(sizeof(tdbloom_errors) / sizeof(tdbloom_errors[0]) == TDBF_ERRORCOUNT,
+               "tdbloom_errors must have a message for every tdbloom_error_t");
 
 /**
  * @brief Calculate the ideal size of a Bloom filter's bit array.
@@ -80,7 +105,39 @@ static time_t get_monotonic_time() {
  * @return TDBF_OUTOFMEMORY if memory allocation fails.
  */
 tdbloom_error_t tdbloom_init(tdbloom *tdbf, const size_t expected, const float accuracy, const size_t timeout) {
+	return tdbloom_init_flags(tdbf, expected, accuracy, timeout, 0);
+}
+
+/**
+ * @brief Initializes a time-decaying Bloom filter with options.
+ *
+ * This function is `tdbloom_init()` with a set of TDBLOOM_FLAG_*
+ * options controlling how hashes are mapped onto timestamps. See
+ * `bloom_init_flags()` for the tradeoffs. The flags are saved with the
+ * filter.
+ *
+ * @param tdbf Pointer to a time-decaying Bloom filter structure to initialize.
+ * @param expected Maximum expected number of elements to store in the filter.
+ * @param accuracy Acceptable false positive rate (e.g., 0.01 for 99.99% accuracy).
+ * @param timeout Number of seconds an element remains valid before expiring.
+ * @param flags Bitwise OR of TDBLOOM_FLAG_* values. Unknown bits are ignored.
+ *
+ * @return TDBF_SUCCESS on success.
+ * @return TDBF_INVALIDTIMEOUT if the value of `timeout` is invalid.
+ * @return TDBF_OUTOFMEMORY if memory allocation fails.
+ */
+tdbloom_error_t tdbloom_init_flags(tdbloom *tdbf, const size_t expected, const float accuracy, const size_t timeout, const uint32_t flags) {
 	tdbf->size       = ideal_size(expected, accuracy);
+	if (flags & TDBLOOM_FLAG_POW2) {
+		tdbf->size = round_pow2(tdbf->size);
+	}
+	tdbf->flags      = flags & TDBLOOM_FLAGS_ALL;
+	tdbf->hash       = HASH_MMH3;
+	tdbf->map        = NULL;
+	tdbf->map_size   = 0;
+	tdbf->sweep_cursor = 0;
+	tdbf->sweep_step   = 0;
+	tdbf->stats      = NULL;
 	tdbf->hashcount  = (tdbf->size / expected) * log(2);
 	tdbf->timeout    = timeout;
 	tdbf->expected   = expected;
@@ -101,13 +158,14 @@ tdbloom_error_t tdbloom_init(tdbloom *tdbf, const size_t expected, const float a
 	else { return TDBF_INVALIDCOUNTERSIZE; }
 	tdbf->bytes = bytes;
 
-	tdbf->filter = calloc(tdbf->size, bytes);
+	tdbf->filter = archbloom_alloc(tdbf->size * bytes);
 	if (tdbf->filter == NULL) {
 		return TDBF_OUTOFMEMORY;
 	}
 
 	// calculate filter size
 	tdbf->filter_size = tdbf->size * tdbf->bytes;
+	tdbf->stats       = archbloom_counters_alloc(false);
 
 	return TDBF_SUCCESS;
 }
@@ -116,15 +174,25 @@ tdbloom_error_t tdbloom_init(tdbloom *tdbf, const size_t expected, const float a
  * @brief Destroys a time-decaying Bloom filter and free associated resources.
  *
  * This function uninitializes a time-decaying Bloom filter, releasing
- * any memory that was allocated for it.
+ * any memory that was allocated for it, or unmapping it if it was
+ * loaded with `tdbloom_map()`.
  *
  * @param tdbf Pointer to a time-decaying Bloom filter to destroy.
  */
 void tdbloom_destroy(tdbloom *tdbf) {
+	if (tdbf->map) {
+		munmap(tdbf->map, tdbf->map_size);
+		tdbf->map    = NULL;
+		tdbf->filter = NULL;
+	}
+
 	if (tdbf->filter) {
-		free(tdbf->filter);
+		archbloom_free(tdbf->filter);
 		tdbf->filter = NULL;
 	}
+
+	archbloom_counters_free(tdbf->stats);
+	tdbf->stats = NULL;
 }
 
 /**
@@ -162,6 +230,172 @@ void tdbloom_reset_start_time(tdbloom *tdbf) {
 	tdbf->start_time = get_monotonic_time();
 }
 
+/**
+ * @brief Helper function for the expiry sweeps: the timestamp an
+ * element added now would be given.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ *
+ * @return Current timestamp in the range [1, max_time].
+ */
+static inline uint64_t current_timestamp(const tdbloom *tdbf) {
+	time_t now = get_monotonic_time();
+
+	return ((now - tdbf->start_time) % tdbf->max_time + tdbf->max_time) % tdbf->max_time + 1;
+}
+
+/**
+ * @brief Totals gathered by an expiry sweep.
+ */
+typedef struct {
+	size_t expired; /**< Set timestamps older than the timeout. */
+	size_t live;    /**< Set timestamps within the timeout. */
+} sweep_totals;
+
+/* TDBLOOM_SWEEP(bits) -- define sweep_<bits>(), which counts and
+ *     optionally clears expired uint<bits>_t timestamps.
+ *
+ * Timestamps wrap around at max_time, the largest value of the type,
+ * so the age of a timestamp is (ts - value) modulo max_time. Computed
+ * in the timestamp's own type, ts - value wraps modulo max_time + 1
+ * instead, which is one too many whenever value > ts. Subtracting the
+ * comparison corrects it without a division, and every step of the
+ * loop is branch free so the compiler can vectorize it.
+ */
+#define TDBLOOM_SWEEP(bits)                                                   \
+static sweep_totals sweep_##bits(void *filter, const size_t size,            \
+                                 const uint64_t now, const uint64_t timeout,  \
+                                 const bool clear) {                          \
+	uint##bits##_t      *timestamps = filter;                                 \
+	const uint##bits##_t ts         = now;                                    \
+	const uint##bits##_t limit      = timeout;                                \
+	size_t               expired    = 0;                                      \
+	size_t               set        = 0;                                      \
+                                                                              \
+	if (timeout >= UINT##bits##_MAX) {                                        \
+		/* ages never exceed max_time - 1, so nothing can expire */           \
+		for (size_t i = 0; i < size; i++) {                                   \
+			set += (timestamps[i] != 0);                                      \
+		}                                                                     \
+		return (sweep_totals){ .expired = 0, .live = set };                   \
+	}                                                                         \
+                                                                              \
+	if (clear) {                                                              \
+		for (size_t i = 0; i < size; i++) {                                   \
+			uint##bits##_t value = timestamps[i];                             \
+			uint##bits##_t age   = (uint##bits##_t)(ts - value) - (value > ts); \
+			bool           old   = (value != 0) & (age > limit);              \
+			set          += (value != 0);                                     \
+			expired      += old;                                              \
+			timestamps[i] = old ? 0 : value;                                  \
+		}                                                                     \
+	} else {                                                                  \
+		for (size_t i = 0; i < size; i++) {                                   \
+			uint##bits##_t value = timestamps[i];                             \
+			uint##bits##_t age   = (uint##bits##_t)(ts - value) - (value > ts); \
+			set     += (value != 0);                                          \
+			expired += (value != 0) & (age > limit);                          \
+		}                                                                     \
+	}                                                                         \
+                                                                              \
+	return (sweep_totals){ .expired = expired, .live = set - expired };       \
+}
+
+TDBLOOM_SWEEP(8)
+TDBLOOM_SWEEP(16)
+TDBLOOM_SWEEP(32)
+TDBLOOM_SWEEP(64)
+
+/**
+ * @brief Helper function to sweep `count` timestamps starting at
+ * `first`, counting expired and live timestamps and optionally
+ * clearing the expired ones.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param first Index of the first timestamp to sweep.
+ * @param count Number of timestamps to sweep.
+ * @param clear true to clear expired timestamps.
+ *
+ * @return Totals for the sweep.
+ */
+static sweep_totals sweep_range(const tdbloom *tdbf, const size_t first, const size_t count, const bool clear) {
+	uint64_t      ts     = current_timestamp(tdbf);
+	uint8_t      *filter = (uint8_t *)tdbf->filter + (first * tdbf->bytes);
+	sweep_totals  totals;
+
+	switch (tdbf->bytes) {
+	case 1:  totals = sweep_8(filter, count, ts, tdbf->timeout, clear); break;
+	case 2:  totals = sweep_16(filter, count, ts, tdbf->timeout, clear); break;
+	case 4:  totals = sweep_32(filter, count, ts, tdbf->timeout, clear); break;
+	case 8:  totals = sweep_64(filter, count, ts, tdbf->timeout, clear); break;
+	default: return (sweep_totals){ 0 }; // shouldn't get here
+	}
+
+	if (clear) {
+		archbloom_count(tdbf->stats, false, ARCHBLOOM_STAT_REAPS, totals.expired);
+	}
+
+	return totals;
+}
+
+/**
+ * @brief Helper function to sweep every timestamp in a filter once.
+ * See `sweep_range()`.
+ */
+static sweep_totals sweep(const tdbloom *tdbf, const bool clear) {
+	return sweep_range(tdbf, 0, tdbf->size, clear);
+}
+
+/**
+ * @brief Removes expired data from the next part of a time-decaying
+ * Bloom filter.
+ *
+ * `tdbloom_clear_expired()` sweeps every timestamp at once, which
+ * stalls the caller for as long as it takes to read the whole filter.
+ * This function sweeps `entries` timestamps starting where the last
+ * call stopped, wrapping around at the end, so regular calls spread
+ * the same work evenly. Expired elements are never found by lookups
+ * whether or not they have been swept; sweeping only frees their
+ * timestamps for reuse and keeps saturation accurate.
+ *
+ * @param tdbf Pointer to the time-decaying Bloom filter.
+ * @param entries Number of timestamps to sweep. Sweeping `size`
+ *        timestamps is a whole pass.
+ *
+ * @return The number of expired timestamps cleared.
+ */
+size_t tdbloom_clear_expired_step(tdbloom *tdbf, const size_t entries) {
+	size_t remaining = (entries < tdbf->size) ? entries : tdbf->size;
+	size_t expired   = 0;
+
+	while (remaining > 0) {
+		size_t count = tdbf->size - tdbf->sweep_cursor;
+
+		count = (count < remaining) ? count : remaining;
+		expired += sweep_range(tdbf, tdbf->sweep_cursor, count, true).expired;
+
+		tdbf->sweep_cursor = (tdbf->sweep_cursor + count) % tdbf->size;
+		remaining -= count;
+	}
+
+	return expired;
+}
+
+/**
+ * @brief Sweep part of a time-decaying Bloom filter on every add.
+ *
+ * With a sweep step set, each add runs `tdbloom_clear_expired_step()`
+ * over `entries` timestamps after writing its own, so a filter that
+ * sees `timeout` seconds of adds is swept at least once as long as
+ * `entries * adds >= size`. Batch adds sweep `entries` per element.
+ *
+ * @param tdbf Pointer to the time-decaying Bloom filter.
+ * @param entries Timestamps swept by each add, or 0 to disable.
+ */
+void tdbloom_set_sweep_step(tdbloom *tdbf, const size_t entries) {
+	tdbf->sweep_step = entries;
+}
+
 /**
  * @brief Removes expired data from a time-decaying Bloom filter.
  *
@@ -173,37 +407,34 @@ void tdbloom_reset_start_time(tdbloom *tdbf) {
  * expired data from.
  *
  * @return The number of expired items removed from the filter.
- *
- * TODO: test
  */
 size_t tdbloom_clear_expired(tdbloom *tdbf) {
-	time_t now    = get_monotonic_time();
-	size_t ts     = ((now - tdbf->start_time + tdbf->max_time) % tdbf->max_time) + 1;
-	size_t reaped = 0;
-
-	for (size_t i = 0; i < tdbf->size; i++) {
-		uint64_t value;
-		switch (tdbf->bytes) {
-		case 1: value = ((uint8_t *)tdbf->filter)[i];  break;
-		case 2: value = ((uint16_t *)tdbf->filter)[i]; break;
-		case 4: value = ((uint32_t *)tdbf->filter)[i]; break;
-		case 8: value = ((uint64_t *)tdbf->filter)[i]; break;
-		}
+	return sweep(tdbf, true).expired;
+}
 
-		// set to 0 if expired
-		if (value != 0 && ((ts - value + tdbf->max_time) % tdbf->max_time) > tdbf->timeout) {
-			switch (tdbf->bytes) {
-			case 1: ((uint8_t *)tdbf->filter)[i] = 0;  break;
-			case 2: ((uint16_t *)tdbf->filter)[i] = 0; break;
-			case 4: ((uint32_t *)tdbf->filter)[i] = 0; break;
-			case 8: ((uint64_t *)tdbf->filter)[i] = 0; break;
-			}
+/**
+ * @brief Removes expired data from a time-decaying Bloom filter and
+ * calculates its saturation in the same pass.
+ *
+ * This is `tdbloom_clear_expired()` and `tdbloom_saturation()`
+ * combined, for periodic maintenance of large filters: the timestamps
+ * are read once rather than twice.
+ *
+ * @param tdbf Pointer to the time-decaying Bloom filter to clear
+ * expired data from.
+ * @param saturation Set to the percentage of timestamps that are set
+ *        and unexpired. May be NULL.
+ *
+ * @return The number of expired items removed from the filter.
+ */
+size_t tdbloom_clear_expired_saturation(tdbloom *tdbf, float *saturation) {
+	sweep_totals totals = sweep(tdbf, true);
 
-			reaped++;
-		}
+	if (saturation != NULL) {
+		*saturation = (float)totals.live / tdbf->size * 100;
 	}
 
-	return reaped;
+	return totals.expired;
 }
 
 /**
@@ -217,62 +448,153 @@ size_t tdbloom_clear_expired(tdbloom *tdbf) {
  * @return The number of expired items in the filter.
  */
 size_t tdbloom_count_expired(const tdbloom *tdbf) {
-	time_t now = get_monotonic_time();
-	size_t ts = ((now - tdbf->start_time + tdbf->max_time) % tdbf->max_time) + 1;
-	size_t expired = 0;
-
-	for (size_t i = 0; i < tdbf->size; i++) {
-		uint64_t value;
-		switch (tdbf->bytes) {
-		case 1: value = ((uint8_t *)tdbf->filter)[i];  break;
-		case 2: value = ((uint16_t *)tdbf->filter)[i]; break;
-		case 4: value = ((uint32_t *)tdbf->filter)[i]; break;
-		case 8: value = ((uint64_t *)tdbf->filter)[i]; break;
-		}
-
-		// set to 0 if expired
-		if (value != 0 && ((ts - value + tdbf->max_time) % tdbf->max_time) > tdbf->timeout) {
-			expired++;
-		}
-	}
+	return sweep(tdbf, false).expired;
+}
 
-	return expired;
+/**
+ * @brief Counts the number of set, unexpired timestamps in a
+ * time-decaying Bloom filter.
+ *
+ * @param tdbf Time-decaying Bloom filter to count.
+ *
+ * @return The number of unexpired timestamps in the filter.
+ */
+size_t tdbloom_saturation_count(const tdbloom *tdbf) {
+	return sweep(tdbf, false).live;
 }
 
 /**
  * @brief Calculates the saturation of a time-decaying Bloom filter.
  *
  * This function computes the saturation of the time-decaying Bloom
- * filter, expressed as the percentage of bits that are set,
- * indicating how full the filter is.
+ * filter, expressed as the percentage of timestamps that are set and
+ * unexpired, indicating how full the filter is.
  *
  * @param tdbf Time-decaying Bloom filter to calculate saturation of.
  *
  * @return The percentage of saturation in the filter.
- *
- * TODO: test this
  */
 float tdbloom_saturation(const tdbloom *tdbf) {
-	size_t irrelevant = 0;
-	time_t now = get_monotonic_time();
-	size_t ts = ((now - tdbf->start_time + tdbf->max_time) % tdbf->max_time) + 1;
-
-	for (size_t i = 0; i < tdbf->size; i++) {
-		size_t value;
-		switch(tdbf->bytes) {
-		case 1: value = ((uint8_t *)tdbf->filter)[i]; break;
-		case 2: value = ((uint16_t *)tdbf->filter)[i]; break;
-		case 4: value = ((uint32_t *)tdbf->filter)[i]; break;
-		case 8: value = ((uint64_t *)tdbf->filter)[i]; break;
-		}
+	return (float)tdbloom_saturation_count(tdbf) / tdbf->size * 100;
+}
+
+/**
+ * @brief Get the runtime statistics of a time-decaying Bloom filter:
+ * adds, lookups, hits and the expired timestamps cleared by
+ * `tdbloom_clear_expired()` and the sweep steps. See stats.h.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param stats Set to the filter's statistics.
+ *
+ * @return true on success.
+ * @return false if the filter keeps no statistics: the library was
+ *         built without ARCHBLOOM_STATS. `stats` is zeroed.
+ */
+bool tdbloom_stats(const tdbloom *tdbf, archbloom_stats *stats) {
+	archbloom_counters_read(tdbf->stats, false, stats);
+
+	return tdbf->stats != NULL;
+}
+
+/**
+ * @brief Helper function to map a hash onto a timestamp index,
+ * according to the filter's TDBLOOM_FLAG_* options.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param hash Hash of an element.
+ *
+ * @return Timestamp index in the range [0, tdbf->size).
+ */
+static inline uint64_t hash_position(const tdbloom *tdbf, const uint64_t hash) {
+	if (tdbf->flags & TDBLOOM_FLAG_POW2) {
+		return hash & (tdbf->size - 1);
+	}
+
+	if (tdbf->flags & TDBLOOM_FLAG_FASTRANGE) {
+		return fastrange64(hash, tdbf->size);
+	}
+
+	return hash % tdbf->size;
+}
 
-		if (value == 0 || ((ts - value + tdbf->max_time) % tdbf->max_time) > tdbf->timeout) {
-			irrelevant++;
+/**
+ * @brief Helper function to read the timestamp in a slot.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param position Slot index.
+ *
+ * @return Timestamp of the slot, or 0 if it was never set.
+ */
+static inline size_t read_slot(const tdbloom *tdbf, const uint64_t position) {
+	switch (tdbf->bytes) {
+	case 1:  return ((uint8_t *)tdbf->filter)[position];
+	case 2:  return ((uint16_t *)tdbf->filter)[position];
+	case 4:  return ((uint32_t *)tdbf->filter)[position];
+	default: return ((uint64_t *)tdbf->filter)[position];
+	}
+}
+
+/**
+ * @brief Helper function to write a timestamp to a slot.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param position Slot index.
+ * @param ts Timestamp to store.
+ */
+static inline void write_slot(tdbloom *tdbf, const uint64_t position, const size_t ts) {
+	switch (tdbf->bytes) {
+	case 1:  ((uint8_t *)tdbf->filter)[position]  = ts; break;
+	case 2:  ((uint16_t *)tdbf->filter)[position] = ts; break;
+	case 4:  ((uint32_t *)tdbf->filter)[position] = ts; break;
+	default: ((uint64_t *)tdbf->filter)[position] = ts; break;
+	}
+}
+
+/**
+ * @brief Helper function to stamp every slot of a hashed element with
+ * `ts`.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param hash The element's `hash_128()`.
+ * @param ts Timestamp to store.
+ */
+static void add_hashed_at(tdbloom *tdbf, const uint64_t *hash, const size_t ts) {
+	archbloom_count(tdbf->stats, false, ARCHBLOOM_STAT_ADDS, 1);
+
+	for (size_t i = 0; i < tdbf->hashcount; i++) {
+		write_slot(tdbf, hash_position(tdbf, hash_probe(hash, i)), ts);
+	}
+}
+
+/**
+ * @brief Helper function to check whether every slot of a hashed
+ * element holds a timestamp within the timeout of `ts`. Stops at the
+ * first slot that doesn't.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param hash The element's `hash_128()`.
+ * @param ts Current timestamp.
+ */
+static bool lookup_hashed_at(const tdbloom *tdbf, const uint64_t *hash, const size_t ts) {
+	for (size_t i = 0; i < tdbf->hashcount; i++) {
+		size_t value = read_slot(tdbf, hash_position(tdbf, hash_probe(hash, i)));
+
+		if (value == 0 ||
+			((ts - value + tdbf->max_time) % tdbf->max_time) > tdbf->timeout) {
+			return false;
 		}
 	}
 
-	float saturation = 1.0 - ((float)irrelevant / tdbf->size);
-	return saturation * 100;
+	return true;
+}
+
+/**
+ * @brief Helper function to count `lookups` lookups, of which `hits`
+ * found their element.
+ */
+static inline void count_lookups(const tdbloom *tdbf, const size_t lookups, const size_t hits) {
+	archbloom_count(tdbf->stats, false, ARCHBLOOM_STAT_LOOKUPS, lookups);
+	archbloom_count(tdbf->stats, false, ARCHBLOOM_STAT_HITS, hits);
 }
 
 /**
@@ -287,22 +609,11 @@ float tdbloom_saturation(const tdbloom *tdbf) {
  * @param len Length of the element in bytes.
  */
 void tdbloom_add(tdbloom *tf, const void *element, const size_t len) {
-	uint64_t    result;
-	uint64_t    hashes[tf->hashcount];
-	time_t      now = get_monotonic_time();
-	size_t      ts = ((now - tf->start_time) % tf->max_time + tf->max_time) % tf->max_time + 1;
-
-	mmh3_64_make_hashes(element, len, tf->hashcount, hashes);
-
-	for (int i = 0; i < tf->hashcount; i++) {
-		result = hashes[i] % tf->size;
-		switch(tf->bytes) {
-		case 1:	((uint8_t *)tf->filter)[result]  = ts; break;
-		case 2:	((uint16_t *)tf->filter)[result] = ts; break;
-		case 4:	((uint32_t *)tf->filter)[result] = ts; break;
-		case 8: ((uint64_t *)tf->filter)[result] = ts; break;
-		}
-	}
+	uint64_t hash[2];
+
+	hash_128(tf->hash, element, len, hash);
+
+	tdbloom_add_hashed(tf, hash);
 }
 
 /**
@@ -334,33 +645,11 @@ void tdbloom_add_string(tdbloom *tdbf, const char *element) {
  * @return false if it is definitely not in the filter or has expired.
  */
 bool tdbloom_lookup(const tdbloom *tdbf, const void *element, const size_t len) {
-	uint64_t    result;
-	uint64_t    hashes[tdbf->hashcount];
-	time_t      now = get_monotonic_time();
-	size_t      ts = ((now - tdbf->start_time) % tdbf->max_time + tdbf->max_time) % tdbf->max_time + 1;
-
-	if ((now - tdbf->start_time) > tdbf->max_time) { return false; }
-
-	mmh3_64_make_hashes(element, len, tdbf->hashcount, hashes);
-
-	for (int i = 0; i < tdbf->hashcount; i++) {
-		result = hashes[i] % tdbf->size;
-
-		size_t value;
-		switch(tdbf->bytes) {
-		case 1:	value = ((uint8_t *)tdbf->filter)[result];  break;
-		case 2:	value = ((uint16_t *)tdbf->filter)[result]; break;
-		case 4:	value = ((uint32_t *)tdbf->filter)[result]; break;
-		case 8:	value = ((uint64_t *)tdbf->filter)[result]; break;
-		}
+	uint64_t hash[2];
 
-		if (value == 0 ||
-			((ts - value + tdbf->max_time) % tdbf->max_time) > tdbf->timeout) {
-			return false;
-		}
-	}
+	hash_128(tdbf->hash, element, len, hash);
 
-	return true;
+	return tdbloom_lookup_hashed(tdbf, hash);
 }
 
 /**
@@ -380,6 +669,170 @@ bool tdbloom_lookup_string(const tdbloom *tdbf, const char *element) {
 	return tdbloom_lookup(tdbf, (uint8_t *)element, strlen(element));
 }
 
+/**
+ * @brief Add an element that has already been hashed.
+ *
+ * For callers that check one element against several filters with the
+ * same hash strategy: the element is hashed once with `hash_128()`
+ * and the slots in each filter come from that hash.
+ *
+ * @param tdbf Time-decaying Bloom filter to add the element to.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ */
+void tdbloom_add_hashed(tdbloom *tdbf, const uint64_t *hash) {
+	add_hashed_at(tdbf, hash, current_timestamp(tdbf));
+
+	if (tdbf->sweep_step != 0) {
+		tdbloom_clear_expired_step(tdbf, tdbf->sweep_step);
+	}
+}
+
+/**
+ * @brief Check an element that has already been hashed. See
+ * `tdbloom_add_hashed()`.
+ *
+ * @param tdbf Time-decaying Bloom filter to perform the lookup against.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return true if the element is likely in the filter and valid
+ * @return false if it is definitely not in the filter or has expired.
+ */
+bool tdbloom_lookup_hashed(const tdbloom *tdbf, const uint64_t *hash) {
+	time_t now = get_monotonic_time();
+	size_t ts  = ((now - tdbf->start_time) % tdbf->max_time + tdbf->max_time) % tdbf->max_time + 1;
+
+	bool   found;
+
+	if ((now - tdbf->start_time) > tdbf->max_time) {
+		count_lookups(tdbf, 1, 0);
+		return false;
+	}
+
+	found = lookup_hashed_at(tdbf, hash, ts);
+	count_lookups(tdbf, 1, found);
+
+	return found;
+}
+
+/**
+ * @brief Number of elements hashed and prefetched at a time by the
+ * batch functions.
+ */
+#define BATCH_CHUNK 16
+
+/**
+ * @brief Helper function for the batch functions. Hash a chunk of
+ * elements and prefetch the timestamps that will be touched.
+ *
+ * @param tdbf Time-decaying Bloom filter.
+ * @param elements Array of pointers to elements.
+ * @param lens Array of element lengths in bytes.
+ * @param count Number of elements in this chunk.
+ * @param hashes Output array of `count` `hash_128()` pairs.
+ * @param write true if the slots will be written to.
+ */
+static void batch_hashes(const tdbloom *tdbf,
+                         const void **elements,
+                         const size_t *lens,
+                         const size_t count,
+                         uint64_t hashes[][2],
+                         const bool write) {
+	for (size_t i = 0; i < count; i++) {
+		hash_128(tdbf->hash, elements[i], lens[i], hashes[i]);
+
+		for (size_t j = 0; j < tdbf->hashcount; j++) {
+			uint64_t       position = hash_position(tdbf, hash_probe(hashes[i], j));
+			const uint8_t *slot     = (uint8_t *)tdbf->filter + (position * tdbf->bytes);
+			if (write) {
+				__builtin_prefetch(slot, 1);
+			} else {
+				__builtin_prefetch(slot, 0);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Add a batch of elements to a time-decaying Bloom filter.
+ *
+ * This function hashes a chunk of elements up front and prefetches
+ * every slot it is about to modify before writing any timestamps. On
+ * filters larger than the CPU cache this overlaps the cache misses of
+ * many elements rather than waiting on each one in turn. All elements
+ * in the batch receive the same timestamp.
+ *
+ * @param tdbf Time-decaying Bloom filter to add elements to.
+ * @param elements Array of `count` pointers to elements.
+ * @param lens Array of `count` element lengths in bytes.
+ * @param count Number of elements to add.
+ */
+void tdbloom_add_batch(tdbloom *tdbf, const void **elements, const size_t *lens, const size_t count) {
+	uint64_t hashes[BATCH_CHUNK][2];
+	size_t   ts = current_timestamp(tdbf);
+
+	for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+		size_t chunk = (count - start < BATCH_CHUNK) ? count - start : BATCH_CHUNK;
+
+		batch_hashes(tdbf, elements + start, lens + start, chunk, hashes, true);
+
+		for (size_t i = 0; i < chunk; i++) {
+			add_hashed_at(tdbf, hashes[i], ts);
+		}
+	}
+
+	if (tdbf->sweep_step != 0) {
+		tdbloom_clear_expired_step(tdbf, tdbf->sweep_step * count);
+	}
+}
+
+/**
+ * @brief Look up a batch of elements in a time-decaying Bloom filter.
+ *
+ * This function is the batch equivalent of `tdbloom_lookup()`. See
+ * `tdbloom_add_batch()` for details.
+ *
+ * @param tdbf Time-decaying Bloom filter to perform look ups against.
+ * @param elements Array of `count` pointers to elements.
+ * @param lens Array of `count` element lengths in bytes.
+ * @param count Number of elements to look up.
+ * @param results Bitmap of at least `(count + 7) / 8` bytes. Bit `i`
+ *        is set if element `i` is likely in the filter and valid, and
+ *        cleared otherwise. Use TDBLOOM_BATCH_RESULT() to read it.
+ */
+void tdbloom_lookup_batch(const tdbloom *tdbf, const void **elements, const size_t *lens, const size_t count, uint8_t *results) {
+	uint64_t hashes[BATCH_CHUNK][2];
+	time_t   now = get_monotonic_time();
+	size_t   ts  = ((now - tdbf->start_time) % tdbf->max_time + tdbf->max_time) % tdbf->max_time + 1;
+
+	size_t   hits = 0;
+
+	if ((now - tdbf->start_time) > tdbf->max_time) {
+		memset(results, 0, (count + 7) / 8);
+		count_lookups(tdbf, count, 0);
+		return;
+	}
+
+	for (size_t start = 0; start < count; start += BATCH_CHUNK) {
+		size_t chunk = (count - start < BATCH_CHUNK) ? count - start : BATCH_CHUNK;
+
+		batch_hashes(tdbf, elements + start, lens + start, chunk, hashes, false);
+
+		for (size_t i = 0; i < chunk; i++) {
+			size_t n     = start + i;
+			bool   found = lookup_hashed_at(tdbf, hashes[i], ts);
+
+			hits += found;
+			if (found) {
+				results[n / 8] |= (0x01 << (n % 8));
+			} else {
+				results[n / 8] &= ~(0x01 << (n % 8));
+			}
+		}
+	}
+
+	count_lookups(tdbf, count, hits);
+}
+
 /**
  * @brief Check if an element has expired in a time-decaying Bloom filter.
  *
@@ -397,23 +850,13 @@ bool tdbloom_lookup_string(const tdbloom *tdbf, const char *element) {
  * TODO: test
  */
 bool tdbloom_has_expired(const tdbloom *tdbf, const void *element, size_t len) {
-	uint64_t result;
-	uint64_t hashes[tdbf->hashcount];
-	time_t   now = get_monotonic_time();
-	size_t   ts  = ((now - tdbf->start_time) % tdbf->max_time + tdbf->max_time) % tdbf->max_time + 1;
+	uint64_t hash[2];
+	size_t   ts = current_timestamp(tdbf);
 
-	mmh3_64_make_hashes(element, len, tdbf->hashcount, hashes);
+	hash_128(tdbf->hash, element, len, hash);
 
 	for (size_t i = 0; i < tdbf->hashcount; i++) {
-		result = hashes[i] % tdbf->size;
-
-		size_t value;
-		switch (tdbf->bytes) {
-		case 1: value = ((uint8_t *)tdbf->filter)[result];  break;
-		case 2: value = ((uint16_t *)tdbf->filter)[result]; break;
-		case 4: value = ((uint32_t *)tdbf->filter)[result]; break;
-		case 8: value = ((uint64_t *)tdbf->filter)[result]; break;
-		}
+		size_t value = read_slot(tdbf, hash_position(tdbf, hash_probe(hash, i)));
 
 		if (value != 0 && ((ts - value + tdbf->max_time) % tdbf->max_time) > tdbf->timeout) {
 			return true; // element has expired
@@ -500,6 +943,31 @@ bool tdbloom_set_name(tdbloom *tdbf, const char *name) {
 	return true;
 }
 
+/**
+ * @brief Select the hash strategy used by a time-decaying Bloom filter.
+ *
+ * Filters default to HASH_MMH3. HASH_WYHASH and HASH_FIXED are
+ * considerably cheaper on short keys. The strategy is saved with the
+ * filter.
+ *
+ * @param tdbf Pointer to an empty time-decaying Bloom filter.
+ * @param strategy Hash strategy to use.
+ *
+ * @return true on success.
+ * @return false if the strategy is unknown, or elements have already
+ *         been added to the filter.
+ */
+bool tdbloom_set_hash(tdbloom *tdbf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) ||
+		bitops_nonzero_bytes(tdbf->filter, tdbf->filter_size) != 0) {
+		return false;
+	}
+
+	tdbf->hash = strategy;
+
+	return true;
+}
+
 // TODO document
 const char *tdbloom_get_name(const tdbloom *tdbf) {
 	return tdbf->name;
@@ -545,8 +1013,11 @@ tdbloom_error_t tdbloom_save(tdbloom *tdbf, const char *path) {
 	tdbff.accuracy        = tdbf->accuracy;
 	tdbff.bytes           = tdbf->bytes;
 	tdbff.start_time      = tdbf->start_time;
-	strncpy((char *)tdbff.name, tdbf->name, TDBLOOM_MAX_NAME_LENGTH);
-	tdbff.name[TDBLOOM_MAX_NAME_LENGTH] = '\0';
+	tdbff.max_time        = tdbf->max_time;
+	tdbff.timeout         = tdbf->timeout;
+	tdbff.flags           = tdbf->flags;
+	tdbff.hash            = tdbf->hash;
+	snprintf((char *)tdbff.name, TDBLOOM_MAX_NAME_LENGTH + 1, "%.*s", TDBLOOM_MAX_NAME_LENGTH, tdbf->name);
 
 	fp = fopen(path, "wb");
 	if (fp == NULL) {
@@ -554,7 +1025,7 @@ tdbloom_error_t tdbloom_save(tdbloom *tdbf, const char *path) {
 	}
 
 	if (fwrite(&tdbff, sizeof(tdbloom_file), 1, fp) != 1 ||
-		fwrite(tdbf->filter, tdbf->filter_size, 1, fp)) {
+		fwrite(tdbf->filter, tdbf->filter_size, 1, fp) != 1) {
 		fclose(fp);
 		return TDBF_FWRITE;
 	}
@@ -584,8 +1055,11 @@ tdbloom_error_t tdbloom_save_fd(tdbloom *tdbf, int fd) {
     tdbff.accuracy    = tdbf->accuracy;
     tdbff.bytes       = tdbf->bytes;
     tdbff.start_time  = tdbf->start_time;
-    strncpy((char *)tdbff.name, tdbf->name, TDBLOOM_MAX_NAME_LENGTH);
-    tdbff.name[TDBLOOM_MAX_NAME_LENGTH] = '\0';
+    tdbff.max_time    = tdbf->max_time;
+    tdbff.timeout     = tdbf->timeout;
+    tdbff.flags       = tdbf->flags;
+    tdbff.hash        = tdbf->hash;
+    snprintf((char *)tdbff.name, TDBLOOM_MAX_NAME_LENGTH + 1, "%.*s", TDBLOOM_MAX_NAME_LENGTH, tdbf->name);
 
     if (write(fd, &tdbff, sizeof(tdbloom_file)) != sizeof(tdbloom_file)) {
         return TDBF_FWRITE;
@@ -598,6 +1072,40 @@ tdbloom_error_t tdbloom_save_fd(tdbloom *tdbf, int fd) {
     return TDBF_SUCCESS;
 }
 
+/**
+ * @brief Helper function for the load functions. Check that a file
+ * header describes a filter this library can use.
+ *
+ * @param tdbff Pointer to the header read from disk.
+ *
+ * @return true if the header is usable, false if it is not.
+ */
+static bool valid_header(const tdbloom_file *tdbff) {
+	if (memcmp(tdbff->magic, "!tdbloo!", sizeof(tdbff->magic)) != 0) {
+		return false;
+	}
+
+	if ((tdbff->bytes != 1 && tdbff->bytes != 2 && tdbff->bytes != 4 && tdbff->bytes != 8) ||
+		tdbff->filter_size != tdbff->size * tdbff->bytes ||
+		tdbff->max_time == 0) {
+		return false;
+	}
+
+	if (tdbff->flags & ~TDBLOOM_FLAGS_ALL) {
+		return false; // written by a newer version
+	}
+
+	if ((tdbff->flags & TDBLOOM_FLAG_POW2) && (tdbff->size & (tdbff->size - 1)) != 0) {
+		return false;
+	}
+
+	if (!hash_strategy_valid(tdbff->hash)) {
+		return false;
+	}
+
+	return true;
+}
+
 /**
  * @brief Load a time-decaying Bloom filter from a file on disk.
  *
@@ -644,30 +1152,39 @@ tdbloom_error_t tdbloom_load(tdbloom *tdbf, const char *path) {
 	tdbf->start_time  = tdbff.start_time;
 	tdbf->bytes       = tdbff.bytes;
 	tdbf->accuracy    = tdbff.accuracy;
+	tdbf->timeout     = tdbff.timeout;
+	tdbf->flags       = tdbff.flags;
+	tdbf->hash        = tdbff.hash;
+	tdbf->map         = NULL;
+	tdbf->map_size    = 0;
+	tdbf->sweep_cursor = 0;
+	tdbf->sweep_step   = 0;
+	tdbf->stats        = NULL;
 	strncpy(tdbf->name, (char *)tdbff.name, TDBLOOM_MAX_NAME_LENGTH);
 	tdbf->name[TDBLOOM_MAX_NAME_LENGTH] = '\0';
 
 	// basic sanity checks. should fail if file is not a filter
-	if (tdbf->filter_size != (tdbf->size * tdbf->bytes) ||
-		(sizeof(tdbloom) + tdbf->filter_size) != sb.st_size) {
+	if (!valid_header(&tdbff) ||
+		(sizeof(tdbloom_file) + tdbf->filter_size) != sb.st_size) {
 		fclose(fp);
 		return TDBF_INVALIDFILE;
 	}
 
-	tdbf->filter = malloc(tdbf->filter_size);
+	tdbf->filter = archbloom_alloc(tdbf->filter_size);
 	if (tdbf->filter == NULL) {
 		fclose(fp);
 		return TDBF_OUTOFMEMORY;
 	}
 
 	if (fread(tdbf->filter, tdbf->filter_size, 1, fp) != 1) {
-		free(tdbf->filter);
+		archbloom_free(tdbf->filter);
 		tdbf->filter = NULL;
 		fclose(fp);
 		return TDBF_FREAD;
 	}
 
 	fclose(fp);
+	tdbf->stats = archbloom_counters_alloc(false);
 
 	return TDBF_SUCCESS;
 }
@@ -692,26 +1209,136 @@ tdbloom_error_t tdbloom_load_fd(tdbloom *tdbf, int fd) {
     tdbf->accuracy    = tdbff.accuracy;
     tdbf->bytes       = tdbff.bytes;
     tdbf->start_time  = tdbff.start_time;
+    tdbf->max_time    = tdbff.max_time;
+    tdbf->timeout     = tdbff.timeout;
+    tdbf->flags       = tdbff.flags;
+    tdbf->hash        = tdbff.hash;
+    tdbf->map         = NULL;
+    tdbf->map_size    = 0;
+    tdbf->sweep_cursor = 0;
+    tdbf->sweep_step   = 0;
+    tdbf->stats        = NULL;
     strncpy(tdbf->name, (char *)tdbff.name, TDBLOOM_MAX_NAME_LENGTH);
     tdbf->name[TDBLOOM_MAX_NAME_LENGTH] = '\0';
 
-    if (sizeof(tdbloom_file) + tdbf->filter_size != sb.st_size) {
+    if (!valid_header(&tdbff) ||
+        sizeof(tdbloom_file) + tdbf->filter_size != sb.st_size) {
         return TDBF_INVALIDFILE;
     }
 
-    tdbf->filter = malloc(tdbf->filter_size);
+    tdbf->filter = archbloom_alloc(tdbf->filter_size);
     if (tdbf->filter == NULL) {
         return TDBF_OUTOFMEMORY;
     }
 
     if (read(fd, tdbf->filter, tdbf->filter_size) != (ssize_t)tdbf->filter_size) {
-        free(tdbf->filter);
+        archbloom_free(tdbf->filter);
         return TDBF_FREAD;
     }
 
+    tdbf->stats = archbloom_counters_alloc(false);
+
     return TDBF_SUCCESS;
 }
 
+/**
+ * @brief Map a time-decaying Bloom filter file descriptor into memory.
+ *
+ * This function validates the header of a saved time-decaying Bloom
+ * filter and maps the file MAP_SHARED instead of copying the
+ * timestamps into private memory. See `bloom_map_fd()` for details.
+ *
+ * If `writable` is false the mapping is read only and the filter must
+ * only be used for lookups. If it is true, additions are written back
+ * to the file; the descriptor must be open for writing.
+ *
+ * Release the mapping with `tdbloom_destroy()`.
+ *
+ * @param tdbf Pointer to the `tdbloom` struct to initialize.
+ * @param fd File descriptor of a saved time-decaying Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return TDBF_SUCCESS on success.
+ * @return TDBF_FREAD if there was an error reading from the file descriptor.
+ * @return TDBF_FSTAT if the fstat() system call fails.
+ * @return TDBF_INVALIDFILE if the file format is incorrect.
+ * @return TDBF_MMAP if the mmap() system call fails.
+ */
+tdbloom_error_t tdbloom_map_fd(tdbloom *tdbf, int fd, const bool writable) {
+	struct stat   sb;
+	tdbloom_file  tdbff;
+	void         *map;
+
+	if (fstat(fd, &sb) == -1) {
+		return TDBF_FSTAT;
+	}
+
+	if (pread(fd, &tdbff, sizeof(tdbloom_file), 0) != sizeof(tdbloom_file)) {
+		return TDBF_FREAD;
+	}
+
+	if (!valid_header(&tdbff) ||
+		sizeof(tdbloom_file) + tdbff.filter_size != sb.st_size) {
+		return TDBF_INVALIDFILE;
+	}
+
+	map = map_file(fd, sb.st_size, writable);
+	if (map == NULL) {
+		return TDBF_MMAP;
+	}
+
+	tdbf->size        = tdbff.size;
+	tdbf->filter_size = tdbff.filter_size;
+	tdbf->hashcount   = tdbff.hashcount;
+	tdbf->expected    = tdbff.expected;
+	tdbf->max_time    = tdbff.max_time;
+	tdbf->start_time  = tdbff.start_time;
+	tdbf->bytes       = tdbff.bytes;
+	tdbf->accuracy    = tdbff.accuracy;
+	tdbf->timeout     = tdbff.timeout;
+	tdbf->flags       = tdbff.flags;
+	tdbf->hash        = tdbff.hash;
+	tdbf->map         = map;
+	tdbf->map_size    = sb.st_size;
+	tdbf->sweep_cursor = 0;
+	tdbf->sweep_step   = 0;
+	tdbf->stats        = archbloom_counters_alloc(false);
+	tdbf->filter      = (uint8_t *)map + sizeof(tdbloom_file);
+	strncpy(tdbf->name, (char *)tdbff.name, TDBLOOM_MAX_NAME_LENGTH);
+	tdbf->name[TDBLOOM_MAX_NAME_LENGTH] = '\0';
+
+	return TDBF_SUCCESS;
+}
+
+/**
+ * @brief Map a time-decaying Bloom filter file into memory.
+ *
+ * This function is a convenience wrapper around `tdbloom_map_fd()`
+ * that opens and closes the file.
+ *
+ * @param tdbf Pointer to the `tdbloom` struct to initialize.
+ * @param path Path to a saved time-decaying Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return TDBF_SUCCESS on success.
+ * @return TDBF_FOPEN if the file could not be opened.
+ * @return Any error returned by `tdbloom_map_fd()`.
+ */
+tdbloom_error_t tdbloom_map(tdbloom *tdbf, const char *path, const bool writable) {
+	tdbloom_error_t error;
+	int             fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
+		return TDBF_FOPEN;
+	}
+
+	error = tdbloom_map_fd(tdbf, fd, writable);
+	close(fd);
+
+	return error;
+}
+
 /**
  * @brief Return a string containing the error message for a given error code.
  *
@@ -17,8 +17,39 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "hash.h"
+#include "stats.h"
+
 #define TDBLOOM_MAX_NAME_LENGTH 255
 
+/**
+ * @def TDBLOOM_BATCH_RESULT
+ * @brief Read bit `i` of a result bitmap filled in by
+ * `tdbloom_lookup_batch()`.
+ */
+#define TDBLOOM_BATCH_RESULT(results, i) (((results)[(i) / 8] >> ((i) % 8)) & 0x01)
+
+/**
+ * @def TDBLOOM_FLAG_POW2
+ * @brief `tdbloom_init_flags()` flag: round the number of timestamps up
+ * to a power of two and map hashes onto them with a mask. Takes
+ * precedence over TDBLOOM_FLAG_FASTRANGE.
+ */
+#define TDBLOOM_FLAG_POW2      0x01
+
+/**
+ * @def TDBLOOM_FLAG_FASTRANGE
+ * @brief `tdbloom_init_flags()` flag: map hashes onto the timestamps
+ * with a multiply and shift rather than a 64 bit modulo.
+ */
+#define TDBLOOM_FLAG_FASTRANGE 0x02
+
+/**
+ * @def TDBLOOM_FLAGS_ALL
+ * @brief Every flag understood by this version of the library.
+ */
+#define TDBLOOM_FLAGS_ALL      (TDBLOOM_FLAG_POW2 | TDBLOOM_FLAG_FASTRANGE)
+
 /**
  * @brief Error handling return values for time-decaying Bloom filter
  * operations.
@@ -39,6 +70,7 @@ typedef enum {
 	TDBF_FSTAT,               /**< Failed to stat() the file descriptor. */
 	TDBF_INVALIDFILE,         /**< Invalid or unparseable file format. */
 	TDBF_INVALIDCOUNTERSIZE,  /**< Invalid counter size. */
+	TDBF_MMAP,                /**< Failed to mmap() the file. */
 	// Used for counting the number of statuses. Do not add statuses below this line.
 	TDBF_ERRORCOUNT           /**< Total number of error statuses. */
 } tdbloom_error_t;
@@ -50,21 +82,21 @@ typedef enum {
  * This array contains the string representations of error messages
  * that map to the error codes defined in `tdbloom_error_t`. These
  * messages provide a human-readable explanation of the error status
- * returned by time-decaying Bloom filter functions.
+ * returned by time-decaying Bloom filter functions. Defined in
+ * tdbloom.c, so other parts of the library can include this header.
+ */
+extern const char *tdbloom_errors[];
+
+/**
+ * @brief Structure representing metadata for saving/loading a
+ * time-decaying Bloom filter.
+ *
+ * Mirrors the fields of `tdbloom` needed to reconstruct the filter.
+ * The timestamp array follows this header on disk. The header is
+ * padded to 384 bytes so the timestamps start on a 64 byte boundary
+ * when mapped with `tdbloom_map()`. `flags` holds the TDBLOOM_FLAG_*
+ * options and `hash` the hash strategy; `reserved` must be zero.
  */
-const char *tdbloom_errors[] = {
-	"Success",                 /**< TDBF_SUCCESS: Successfull operation. */
-	"Invalid timeout value",   /**< TDBF_INVALIDTIMEOUT: Timeout value is invalid or out of range. */
-	"Out of memory",           /**< TDBF_OUTOFMEMORY: Memory allocation failed. */
-	"Unable to open file",     /**< TDBF_FOPEN: Failed to open file. */
-	"Unable to read file",     /**< TDBF_FREAD: Failed to read from file. */
-	"Unable to write to file", /**< TDBF_FWRITE: Failed to write to file. */
-	"fstat() error",           /**< TDBF_FSTAT: Failed to stat() the file descriptor. */
-	"Invalid file format",     /**< TDBF_INVALIDFILE: File format is invalid or unparseable. */
-	"Invalid counter size"     /**< TDBF_INVALIDCOUNTERSIZE: Counter size is invalid. */
-};
-
-// TODO document
 typedef struct {
 	uint8_t  magic[8];
 	uint8_t  name[TDBLOOM_MAX_NAME_LENGTH + 1];
@@ -74,8 +106,12 @@ typedef struct {
 	uint64_t expected;
 	uint64_t max_time;
 	uint64_t start_time;
+	uint64_t timeout;
 	int      bytes;
 	float    accuracy;
+	uint32_t flags;
+	uint32_t hash;
+	uint8_t  reserved[48];
 } tdbloom_file;
 
 /**
@@ -97,8 +133,15 @@ typedef struct {
 	float   accuracy;      /**< Desired false positive rate (e.g., 0.01 for 99.99% accuracy). */
 	size_t  max_time;      /**< Maximum possible timestamp value in the filter. */
 	int     bytes;         /**< Size of each timestamp in bytes. */
+	uint32_t flags;        /**< TDBLOOM_FLAG_* options. */
+	hash_strategy hash;    /**< Hash strategy. See tdbloom_set_hash(). */
 	char    name[TDBLOOM_MAX_NAME_LENGTH + 1];
 	void   *filter;        /**< Pointer to the array of time_t elements representing timestamps. */
+	void   *map;           /**< File mapping from tdbloom_map(), or NULL. */
+	size_t  map_size;      /**< Size of the file mapping in bytes. */
+	size_t  sweep_cursor;  /**< Next timestamp `tdbloom_clear_expired_step()` checks. */
+	size_t  sweep_step;    /**< Timestamps swept by each add. See tdbloom_set_sweep_step(). */
+	archbloom_counters *stats; /**< Runtime statistics for tdbloom_stats(), or NULL. */
 } tdbloom;
 
 /* function definitions
@@ -107,14 +150,24 @@ tdbloom_error_t  tdbloom_init(tdbloom *,
                               const size_t,
                               const float,
                               const size_t);
+tdbloom_error_t  tdbloom_init_flags(tdbloom *,
+                                    const size_t,
+                                    const float,
+                                    const size_t,
+                                    const uint32_t);
 void             tdbloom_destroy(tdbloom *);
 bool             tdbloom_set_name(tdbloom *, const char *);
+bool             tdbloom_set_hash(tdbloom *, const hash_strategy);
 const char      *tdbloom_get_name(const tdbloom *);
 
 void             tdbloom_clear(tdbloom *);
 size_t           tdbloom_clear_expired(tdbloom *);
+size_t           tdbloom_clear_expired_saturation(tdbloom *, float *);
+size_t           tdbloom_clear_expired_step(tdbloom *, const size_t);
+void             tdbloom_set_sweep_step(tdbloom *, const size_t);
 size_t           tdbloom_count_expired(const tdbloom *);
-size_t tdbloom_saturation_count(const tdbloom *); // TODO
+size_t           tdbloom_saturation_count(const tdbloom *);
+bool             tdbloom_stats(const tdbloom *, archbloom_stats *);
 
 void             tdbloom_reset_start_time(tdbloom *);
 void tdbloom_adjust_timeout(tdbloom *, size_t new_timeout); // TODO
@@ -126,6 +179,17 @@ void             tdbloom_add_string(tdbloom *, const char *);
 
 bool             tdbloom_lookup(const tdbloom *, const void *, const size_t);
 bool             tdbloom_lookup_string(const tdbloom *, const char *);
+void             tdbloom_add_hashed(tdbloom *, const uint64_t *);
+bool             tdbloom_lookup_hashed(const tdbloom *, const uint64_t *);
+void             tdbloom_add_batch(tdbloom *,
+                                   const void **,
+                                   const size_t *,
+                                   const size_t);
+void             tdbloom_lookup_batch(const tdbloom *,
+                                      const void **,
+                                      const size_t *,
+                                      const size_t,
+                                      uint8_t *);
 bool tdbloom_lookup_or_add(tdbloom *, const void *, const size_t); // TODO
 bool tdbloom_lookup_or_add_string(tdbloom *, const char *); // TODO
 
@@ -139,6 +203,8 @@ tdbloom_error_t  tdbloom_save(tdbloom *, const char *);
 tdbloom_error_t  tdbloom_load(tdbloom *, const char *);
 tdbloom_error_t  tdbloom_save_fd(tdbloom *, int);
 tdbloom_error_t  tdbloom_load_fd(tdbloom *, int);
+tdbloom_error_t  tdbloom_map(tdbloom *, const char *, const bool);
+tdbloom_error_t  tdbloom_map_fd(tdbloom *, int, const bool);
 
 const char      *tdbloom_strerror(tdbloom_error_t);
 
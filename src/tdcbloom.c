@@ -13,10 +13,37 @@
 #include <stdio.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
 #include "tdcbloom.h"
-#include "mmh3.h"
+#include "hash.h"
+#include "bitops.h"
+#include "mapfile.h"
+#include "alloc.h"
+
+_Static_assert(sizeof(tdcbloom_file) % 64 == 0,
+               "tdcbloom_file must keep the entries 64 byte aligned");
+
+// messages for tdcbloom_strerror(). See tdcbloom.h.
+const char *tdcbloom_errors[] = {
+	"Success",
+	"Out of memory",
+	"Invalid counter size",
+	"Invalid timer size",
+	"Invalid number of expected elements",
+	"Invalid accuracy parameter",
+	"Unable to open file",
+	"Unable to read file",
+	"Unable to write to file",
+	"fstat() error",
+	"Invalid file format",
+	"mmap() failure"
+};
+
+_Static_assert(sizeof(tdcbloom_errors) / sizeof(tdcbloom_errors[0]) == TDCBF_ERRORCOUNT,
+               "tdcbloom_errors must have a message for every tdcbloom_error_t");
 
 /**
  * @brief Calculate the ideal size of a Bloom filter's bit array.
@@ -60,6 +87,85 @@ static time_t get_monotonic_time() {
 	return ts.tv_sec;
 }
 
+/**
+ * @brief Helper function to set the counter and timer widths of a
+ * filter, and the sizes derived from them.
+ *
+ * @param tdcbf Pointer to the tdcbloom structure.
+ * @param countersize Size of the counters.
+ * @param timersize Size of the timers.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_INVALIDCOUNTERSIZE or TDCBF_INVALIDTIMERSIZE if a
+ * width is not one of the enumerated values.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static tdcbloom_error_t set_widths(tdcbloom *tdcbf, counter_size countersize, timer_size timersize) {
+	tdcbf->counter_size = countersize;
+	tdcbf->timer_size   = timersize;
+
+	switch (countersize) {
+	case COUNTER_8BIT:  tdcbf->counter_size_bytes = sizeof(uint8_t);  break;
+	case COUNTER_16BIT: tdcbf->counter_size_bytes = sizeof(uint16_t); break;
+	case COUNTER_32BIT: tdcbf->counter_size_bytes = sizeof(uint32_t); break;
+	case COUNTER_64BIT: tdcbf->counter_size_bytes = sizeof(uint64_t); break;
+	default: return TDCBF_INVALIDCOUNTERSIZE;
+	}
+
+	switch (timersize) {
+	case TIMER_8BIT:  tdcbf->timer_size_bytes = sizeof(uint8_t);  break;
+	case TIMER_16BIT: tdcbf->timer_size_bytes = sizeof(uint16_t); break;
+	case TIMER_32BIT: tdcbf->timer_size_bytes = sizeof(uint32_t); break;
+	case TIMER_64BIT: tdcbf->timer_size_bytes = sizeof(uint64_t); break;
+	default: return TDCBF_INVALIDTIMERSIZE;
+	}
+
+	tdcbf->entry_size = tdcbf->counter_size_bytes + tdcbf->timer_size_bytes;
+
+	tdcbf->max_time = \
+		(timersize == TIMER_8BIT)  ? UINT8_MAX  :
+		(timersize == TIMER_16BIT) ? UINT16_MAX :
+		(timersize == TIMER_32BIT) ? UINT32_MAX : UINT64_MAX;
+
+	return TDCBF_SUCCESS;
+}
+
+/* counters_size(), layout_size(), set_layout() -- entries are addressed
+ * as a base and a stride, so the element functions work the same on
+ * either layout. With TDCBLOOM_FLAG_SOA the counter array is padded to
+ * a multiple of 64 bytes so the timestamps start on a fresh cache
+ * line. The same layout is used in memory and on disk.
+ */
+static size_t counters_size(const tdcbloom *tdcbf) {
+	size_t size = tdcbf->size * tdcbf->counter_size_bytes;
+
+	return (tdcbf->flags & TDCBLOOM_FLAG_SOA) ? (size + 63) & ~(size_t)63 : size;
+}
+
+static size_t layout_size(const tdcbloom *tdcbf) {
+	if (tdcbf->flags & TDCBLOOM_FLAG_SOA) {
+		return counters_size(tdcbf) + (tdcbf->size * tdcbf->timer_size_bytes);
+	}
+
+	return tdcbf->size * tdcbf->entry_size;
+}
+
+static void set_layout(tdcbloom *tdcbf, void *entrymap) {
+	tdcbf->entrymap = entrymap;
+	tdcbf->counters = (uint8_t *)entrymap;
+
+	if (tdcbf->flags & TDCBLOOM_FLAG_SOA) {
+		tdcbf->counter_stride = tdcbf->counter_size_bytes;
+		tdcbf->timers         = tdcbf->counters + counters_size(tdcbf);
+		tdcbf->timer_stride   = tdcbf->timer_size_bytes;
+	} else {
+		tdcbf->counter_stride = tdcbf->entry_size;
+		tdcbf->timers         = tdcbf->counters + tdcbf->counter_size_bytes;
+		tdcbf->timer_stride   = tdcbf->entry_size;
+	}
+}
+
 /**
  * @brief Initializes a time-decaying counting Bloom filter.
  *
@@ -79,6 +185,31 @@ tdcbloom_error_t tdcbloom_init(tdcbloom *tdcbf,
 							   const size_t timeout,
 							   counter_size countersize,
 							   timer_size timersize) {
+	return tdcbloom_init_flags(tdcbf, expected, accuracy, timeout, countersize, timersize, 0);
+}
+
+/**
+ * @brief Initializes a time-decaying counting Bloom filter with
+ * TDCBLOOM_FLAG_* options.
+ *
+ * @param tdcbf Pointer to the tdcbloom structure to initialize.
+ * @param expected Maximum expected number of elements to store.
+ * @param accuracy Desired false positive rate (e.g., 0.01 for 99.99% accuracy).
+ * @param timeout Number of seconds an element remains valid before expiring.
+ * @param countersize Size of the counter (e.g., COUNTER_8BIT, COUNTER_16BIT, etc.).
+ * @param timersize Size of the timer (e.g., TIME_8BIT, TIME_16BIT, etc.).
+ * @param flags TDCBLOOM_FLAG_* options. Unknown flags are ignored.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_OUTOFMEMORY if out of memory.
+ */
+tdcbloom_error_t tdcbloom_init_flags(tdcbloom *tdcbf,
+									 const size_t expected,
+									 const float accuracy,
+									 const size_t timeout,
+									 counter_size countersize,
+									 timer_size timersize,
+									 const uint32_t flags) {
 	if (expected == 0) {
 		return TDCBF_INVALIDEXPECTED;
 	}
@@ -89,54 +220,61 @@ tdcbloom_error_t tdcbloom_init(tdcbloom *tdcbf,
 
 	tdcbf->size          = ideal_size(expected, accuracy);
 	tdcbf->hashcount     = (tdcbf->size / expected) * log(2);
+	tdcbf->hash          = HASH_MMH3;
 	tdcbf->timeout       = timeout;
 	tdcbf->start_time    = get_monotonic_time();
-	tdcbf->counter_size  = countersize;
-	tdcbf->timer_size    = timersize;
-
-	switch (countersize) {
-	case COUNTER_8BIT:  tdcbf->counter_size_bytes = sizeof(uint8_t);  break;
-	case COUNTER_16BIT: tdcbf->counter_size_bytes = sizeof(uint16_t); break;
-	case COUNTER_32BIT: tdcbf->counter_size_bytes = sizeof(uint32_t); break;
-	case COUNTER_64BIT: tdcbf->counter_size_bytes = sizeof(uint64_t); break;
-	default: return TDCBF_INVALIDCOUNTERSIZE;
+	tdcbf->expected      = expected;
+	tdcbf->accuracy      = accuracy;
+	tdcbf->flags         = flags & TDCBLOOM_FLAGS_ALL;
+	if (tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) {
+		tdcbf->flags |= TDCBLOOM_FLAG_SOA; // atomics need aligned values
 	}
-
-	switch (timersize) {
-	case TIMER_8BIT:  tdcbf->timer_size_bytes = sizeof(uint8_t);  break;
-	case TIMER_16BIT: tdcbf->timer_size_bytes = sizeof(uint16_t); break;
-	case TIMER_32BIT: tdcbf->timer_size_bytes = sizeof(uint32_t); break;
-	case TIMER_64BIT: tdcbf->timer_size_bytes = sizeof(uint64_t); break;
-	default: return TDCBF_INVALIDTIMERSIZE;
+	tdcbf->map           = NULL;
+	tdcbf->map_size      = 0;
+	tdcbf->sweep_cursor  = 0;
+	tdcbf->sweep_step    = 0;
+	tdcbf->stats         = NULL;
+	memset(tdcbf->name, 0, sizeof(tdcbf->name));
+
+	tdcbloom_error_t error = set_widths(tdcbf, countersize, timersize);
+	if (error != TDCBF_SUCCESS) {
+		return error;
 	}
 
-	tdcbf->entry_size = tdcbf->counter_size_bytes + tdcbf->timer_size_bytes;
-
-	tdcbf->max_time = \
-		(timersize == TIMER_8BIT)  ? UINT8_MAX  :
-		(timersize == TIMER_16BIT) ? UINT16_MAX :
-		(timersize == TIMER_32BIT) ? UINT32_MAX : UINT64_MAX;
-
-	tdcbf->entrymap = calloc(tdcbf->size, tdcbf->entry_size);
+	tdcbf->entrymap_size = layout_size(tdcbf);
+	tdcbf->entrymap      = archbloom_alloc(tdcbf->entrymap_size);
 	if (tdcbf->entrymap == NULL) {
 		return TDCBF_OUTOFMEMORY;
 	}
 
+	set_layout(tdcbf, tdcbf->entrymap);
+	tdcbf->stats = archbloom_counters_alloc(tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT);
+
 	return TDCBF_SUCCESS;
 }
 
 /**
  * @brief Destroy a time-decaying counting Bloom filter.
  *
- * Frees any memory allocated by the tdcbloom filter.
+ * Frees any memory allocated by the tdcbloom filter, or unmaps it if
+ * it was opened with `tdcbloom_map()`.
  *
  * @param tdcbf Pointer to the tdcbloom structure to destroy.
  */
 void tdcbloom_destroy(tdcbloom *tdcbf) {
+	if (tdcbf->map) {
+		munmap(tdcbf->map, tdcbf->map_size);
+		tdcbf->map      = NULL;
+		tdcbf->entrymap = NULL;
+	}
+
 	if (tdcbf->entrymap) {
-		free(tdcbf->entrymap);
+		archbloom_free(tdcbf->entrymap);
 		tdcbf->entrymap = NULL;
 	}
+
+	archbloom_counters_free(tdcbf->stats);
+	tdcbf->stats = NULL;
 }
 
 /**
@@ -152,52 +290,399 @@ void tdcbloom_destroy(tdcbloom *tdcbf) {
  * TODO: test
  */
 void tdcbloom_clear(tdcbloom *tdcbf) {
-	memset(tdcbf->entrymap, 0, tdcbf->size * tdcbf->entry_size);
+	memset(tdcbf->entrymap, 0, tdcbf->entrymap_size);
 	tdcbf->start_time = get_monotonic_time();
 }
 
-// helper function to read timer
-static inline uint64_t read_timer(void *timestamp, timer_size tsize) {
+/**
+ * @brief Select the hash strategy used by a time-decaying counting
+ * Bloom filter.
+ *
+ * Filters default to HASH_MMH3. HASH_WYHASH and HASH_FIXED are
+ * considerably cheaper on short keys.
+ *
+ * @param tdcbf Pointer to an empty time-decaying counting Bloom filter.
+ * @param strategy Hash strategy to use.
+ *
+ * @return true on success.
+ * @return false if the strategy is unknown, or elements have already
+ *         been added to the filter.
+ */
+bool tdcbloom_set_hash(tdcbloom *tdcbf, const hash_strategy strategy) {
+	if (!hash_strategy_valid(strategy) ||
+		bitops_nonzero_bytes((const uint8_t *)tdcbf->entrymap, tdcbf->entrymap_size) != 0) {
+		return false;
+	}
+
+	tdcbf->hash = strategy;
+
+	return true;
+}
+
+/* read_timer, write_timer, read_counter, write_counter -- helper
+ *     functions used to handle different sized counters and
+ *     timestamps. Interleaved entries such as an 8 bit counter followed
+ *     by a 16 bit timestamp leave values unaligned, so they are accessed
+ *     with memcpy().
+ */
+static inline uint64_t read_timer(const void *timestamp, timer_size tsize) {
+	uint8_t  v8;
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
 	switch (tsize) {
-	case TIMER_8BIT:  return *(uint8_t *)timestamp;
-	case TIMER_16BIT: return *(uint16_t *)timestamp;
-	case TIMER_32BIT: return *(uint32_t *)timestamp;
-	case TIMER_64BIT: return *(uint64_t *)timestamp;
+	case TIMER_8BIT:  memcpy(&v8, timestamp, sizeof(v8));   return v8;
+	case TIMER_16BIT: memcpy(&v16, timestamp, sizeof(v16)); return v16;
+	case TIMER_32BIT: memcpy(&v32, timestamp, sizeof(v32)); return v32;
+	case TIMER_64BIT: memcpy(&v64, timestamp, sizeof(v64)); return v64;
 	}
 	return 0; // Default return if size is not handled
 }
 
-// helper function to write timer
 static inline void write_timer(void *timestamp, timer_size tsize, uint64_t value) {
+	uint8_t  v8  = value;
+	uint16_t v16 = value;
+	uint32_t v32 = value;
+
 	switch (tsize) {
-	case TIMER_8BIT:  *(uint8_t *)timestamp = value; break;
-	case TIMER_16BIT: *(uint16_t *)timestamp = value; break;
-	case TIMER_32BIT: *(uint32_t *)timestamp = value; break;
-	case TIMER_64BIT: *(uint64_t *)timestamp = value; break;
+	case TIMER_8BIT:  memcpy(timestamp, &v8, sizeof(v8));   break;
+	case TIMER_16BIT: memcpy(timestamp, &v16, sizeof(v16)); break;
+	case TIMER_32BIT: memcpy(timestamp, &v32, sizeof(v32)); break;
+	case TIMER_64BIT: memcpy(timestamp, &value, sizeof(value)); break;
 	}
 }
 
-// helper function to read counter
-static inline uint64_t read_counter(void *counter, counter_size csize) {
-	switch (csize) {
-	case COUNTER_8BIT:  return *(uint8_t *)counter;
-	case COUNTER_16BIT: return *(uint16_t *)counter;
-	case COUNTER_32BIT: return *(uint32_t *)counter;
-	case COUNTER_64BIT: return *(uint64_t *)counter;
+static inline uint64_t read_counter(const void *counter, counter_size csize) {
+	return read_timer(counter, (timer_size)csize); // same widths
+}
+
+static inline void write_counter(void *counter, counter_size csize, uint64_t value) {
+	write_timer(counter, (timer_size)csize, value);
+}
+
+// counter_at, timer_at -- address of the counter and timestamp of an entry
+static inline uint8_t *counter_at(const tdcbloom *tdcbf, const uint64_t position) {
+	return tdcbf->counters + (position * tdcbf->counter_stride);
+}
+
+static inline uint8_t *timer_at(const tdcbloom *tdcbf, const uint64_t position) {
+	return tdcbf->timers + (position * tdcbf->timer_stride);
+}
+
+/* load_value, store_value, swap_value -- atomic counterparts of
+ *     read_timer() and write_timer() for TDCBLOOM_FLAG_CONCURRENT
+ *     filters, which are always TDCBLOOM_FLAG_SOA so every value is
+ *     naturally aligned. swap_value() is a compare and swap, returning
+ *     false if the value wasn't `expected`.
+ */
+static inline uint64_t load_value(const void *value, timer_size size) {
+	switch (size) {
+	case TIMER_8BIT:  return __atomic_load_n((const uint8_t *)value, __ATOMIC_RELAXED);
+	case TIMER_16BIT: return __atomic_load_n((const uint16_t *)value, __ATOMIC_RELAXED);
+	case TIMER_32BIT: return __atomic_load_n((const uint32_t *)value, __ATOMIC_RELAXED);
+	case TIMER_64BIT: return __atomic_load_n((const uint64_t *)value, __ATOMIC_RELAXED);
 	}
 	return 0;
 }
 
-// helper function to write counter
-static inline void write_counter(void *counter, counter_size csize, uint64_t value) {
-	switch (csize) {
-	case COUNTER_8BIT:  *(uint8_t *)counter = value; break;
-	case COUNTER_16BIT: *(uint16_t *)counter = value; break;
-	case COUNTER_32BIT: *(uint32_t *)counter = value; break;
-	case COUNTER_64BIT: *(uint64_t *)counter = value; break;
+static inline void store_value(void *value, timer_size size, uint64_t desired) {
+	switch (size) {
+	case TIMER_8BIT:  __atomic_store_n((uint8_t *)value, desired, __ATOMIC_RELAXED);  break;
+	case TIMER_16BIT: __atomic_store_n((uint16_t *)value, desired, __ATOMIC_RELAXED); break;
+	case TIMER_32BIT: __atomic_store_n((uint32_t *)value, desired, __ATOMIC_RELAXED); break;
+	case TIMER_64BIT: __atomic_store_n((uint64_t *)value, desired, __ATOMIC_RELAXED); break;
+	}
+}
+
+#define SWAP_VALUE(type, value, expected, desired) __extension__ ({         \
+	type old = (expected);                                                  \
+	__atomic_compare_exchange_n((type *)(value), &old, (type)(desired),     \
+	                            false, __ATOMIC_RELAXED, __ATOMIC_RELAXED); \
+})
+
+static inline bool swap_value(void *value, timer_size size, uint64_t expected, uint64_t desired) {
+	switch (size) {
+	case TIMER_8BIT:  return SWAP_VALUE(uint8_t, value, expected, desired);
+	case TIMER_16BIT: return SWAP_VALUE(uint16_t, value, expected, desired);
+	case TIMER_32BIT: return SWAP_VALUE(uint32_t, value, expected, desired);
+	case TIMER_64BIT: return SWAP_VALUE(uint64_t, value, expected, desired);
+	}
+	return false;
+}
+
+/* get_counter, get_timer, put_timer -- read and write the counter and
+ *     timestamp of an entry, atomically for TDCBLOOM_FLAG_CONCURRENT
+ *     filters.
+ */
+static inline uint64_t get_counter(const tdcbloom *tdcbf, const uint64_t position) {
+	if (tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) {
+		return load_value(counter_at(tdcbf, position), (timer_size)tdcbf->counter_size);
+	}
+
+	return read_counter(counter_at(tdcbf, position), tdcbf->counter_size);
+}
+
+static inline uint64_t get_timer(const tdcbloom *tdcbf, const uint64_t position) {
+	if (tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) {
+		return load_value(timer_at(tdcbf, position), tdcbf->timer_size);
+	}
+
+	return read_timer(timer_at(tdcbf, position), tdcbf->timer_size);
+}
+
+static inline void put_timer(const tdcbloom *tdcbf, const uint64_t position, const uint64_t value) {
+	if (tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) {
+		store_value(timer_at(tdcbf, position), tdcbf->timer_size, value);
+	} else {
+		write_timer(timer_at(tdcbf, position), tdcbf->timer_size, value);
+	}
+}
+
+/* clear_entry -- zero the counter and timestamp of an entry whose
+ *     timestamp was read as `timestamp`. Returns false if the entry
+ *     has been refreshed since, and was left alone.
+ *
+ * Concurrent writers set an entry's timestamp before incrementing its
+ * counter. If the timestamp still holds the expired value when it is
+ * swapped for 0, no writer has reached this entry since the sweep read
+ * it; one that arrives now stores a fresh timestamp over the 0, and its
+ * increment either lands after the counter is zeroed or makes zeroing
+ * the counter fail, so an element being added is never lost.
+ */
+static inline bool clear_entry(const tdcbloom *tdcbf, const uint64_t position, const uint64_t timestamp) {
+	if (tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) {
+		void     *counter = counter_at(tdcbf, position);
+		uint64_t  count   = load_value(counter, (timer_size)tdcbf->counter_size);
+
+		if (!swap_value(timer_at(tdcbf, position), tdcbf->timer_size, timestamp, 0)) {
+			return false;
+		}
+		swap_value(counter, (timer_size)tdcbf->counter_size, count, 0);
+
+		return true;
+	}
+
+	memset(counter_at(tdcbf, position), 0, tdcbf->counter_size_bytes);
+	memset(timer_at(tdcbf, position), 0, tdcbf->timer_size_bytes);
+
+	return true;
+}
+
+/**
+ * @brief What an expiry sweep does with the entries it finds.
+ */
+typedef enum {
+	SWEEP_COUNT,        /**< Count expired entries. */
+	SWEEP_CLEAR,        /**< Count and clear expired entries. */
+	SWEEP_CLEAR_COUNTED /**< Count and clear expired entries with a nonzero counter. */
+} sweep_mode;
+
+/**
+ * @brief Number of timestamps a contiguous sweep checks before looking
+ * at any counters.
+ */
+#define SWEEP_BLOCK 256
+
+/* TDCBLOOM_SWEEP(bits) -- define sweep_<bits>(), the expiry sweep for
+ *     uint<bits>_t timestamps.
+ *
+ * Timestamps are stored modulo max_time, so the age of a timestamp is
+ * (now - value) modulo max_time. Computed in the timestamp's own type,
+ * now - value wraps modulo max_time + 1 instead, which is one too many
+ * whenever value > now; subtracting the comparison corrects it.
+ * Unset timestamps are given an age of 0 rather than branched on,
+ * since they are common and unpredictable.
+ *
+ * With TDCBLOOM_FLAG_SOA the timestamps are contiguous. They are
+ * checked SWEEP_BLOCK at a time by a branch free loop the compiler
+ * vectorizes, and only blocks containing expired entries are revisited
+ * to clear them, so a sweep that finds little to do never reads the
+ * counters. Interleaved entries, and the entries of
+ * TDCBLOOM_FLAG_CONCURRENT filters, whose timestamps other threads may
+ * be storing to, are swept one at a time with get_timer(). Concurrent
+ * entries that look expired are checked again against the clock, since
+ * other threads may have set them since `now` was read.
+ */
+#define TDCBLOOM_SWEEP(bits)                                                  \
+static inline uint##bits##_t timer_age_##bits(const uint##bits##_t ts,       \
+                                              const uint##bits##_t value) {   \
+	uint##bits##_t age = (uint##bits##_t)(ts - value) - (value > ts);         \
+	return age & (uint##bits##_t)-(value != 0);                               \
+}                                                                             \
+                                                                              \
+static size_t sweep_##bits(const tdcbloom *tdcbf, const uint64_t now,        \
+                           const uint64_t limit, const sweep_mode mode,       \
+                           const size_t first, const size_t last) {           \
+	const uint##bits##_t ts      = now % tdcbf->max_time;                     \
+	const uint##bits##_t max_age = limit;                                     \
+	size_t               expired = 0;                                         \
+                                                                              \
+	if (limit >= UINT##bits##_MAX) {                                          \
+		return 0; /* ages never exceed max_time - 1 */                        \
+	}                                                                         \
+                                                                              \
+	for (size_t start = first; start < last; start += SWEEP_BLOCK) {          \
+		size_t end = (last - start < SWEEP_BLOCK) ?                           \
+			last : start + SWEEP_BLOCK;                                       \
+                                                                              \
+		if (tdcbf->timer_stride == sizeof(uint##bits##_t) &&                  \
+			!(tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT)) {                     \
+			const uint##bits##_t *timers = (const uint##bits##_t *)tdcbf->timers; \
+			size_t                found  = 0;                                 \
+                                                                              \
+			for (size_t i = start; i < end; i++) {                            \
+				found += (timer_age_##bits(ts, timers[i]) > max_age);         \
+			}                                                                 \
+                                                                              \
+			if (found == 0) {                                                 \
+				continue;                                                     \
+			}                                                                 \
+			if (mode == SWEEP_COUNT) {                                        \
+				expired += found;                                             \
+				continue;                                                     \
+			}                                                                 \
+		}                                                                     \
+                                                                              \
+		for (size_t i = start; i < end; i++) {                                \
+			uint##bits##_t value = get_timer(tdcbf, i);                       \
+                                                                              \
+			if (timer_age_##bits(ts, value) <= max_age) {                     \
+				continue;                                                     \
+			}                                                                 \
+			if ((tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) &&                  \
+				timer_age_##bits(get_monotonic_time() % tdcbf->max_time, value) <= max_age) { \
+				continue; /* set by another thread since now was read */      \
+			}                                                                 \
+			if (mode == SWEEP_CLEAR_COUNTED && get_counter(tdcbf, i) == 0) {  \
+				continue;                                                     \
+			}                                                                 \
+			if (mode != SWEEP_COUNT && !clear_entry(tdcbf, i, value)) {       \
+				continue;                                                     \
+			}                                                                 \
+			expired++;                                                        \
+		}                                                                     \
+	}                                                                         \
+                                                                              \
+	return expired;                                                           \
+}
+
+TDCBLOOM_SWEEP(8)
+TDCBLOOM_SWEEP(16)
+TDCBLOOM_SWEEP(32)
+TDCBLOOM_SWEEP(64)
+
+/**
+ * @brief Helper function to sweep entries [first, last) of a filter for
+ * entries older than `limit` seconds.
+ *
+ * @param tdcbf Time-decaying counting Bloom filter.
+ * @param limit Entries older than this many seconds have expired.
+ * @param mode What to do with expired entries.
+ * @param first First entry to sweep.
+ * @param last One past the last entry to sweep.
+ *
+ * @return The number of expired entries found.
+ */
+static size_t sweep_range(const tdcbloom *tdcbf, const uint64_t limit, const sweep_mode mode,
+                          const size_t first, const size_t last) {
+	uint64_t now     = get_monotonic_time();
+	size_t   expired = 0;
+
+	switch (tdcbf->timer_size) {
+	case TIMER_8BIT:  expired = sweep_8(tdcbf, now, limit, mode, first, last);  break;
+	case TIMER_16BIT: expired = sweep_16(tdcbf, now, limit, mode, first, last); break;
+	case TIMER_32BIT: expired = sweep_32(tdcbf, now, limit, mode, first, last); break;
+	case TIMER_64BIT: expired = sweep_64(tdcbf, now, limit, mode, first, last); break;
+	}
+
+	if (mode != SWEEP_COUNT) {
+		archbloom_count(tdcbf->stats, tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT, ARCHBLOOM_STAT_REAPS, expired);
+	}
+
+	return expired;
+}
+
+/**
+ * @brief Helper function to sweep every entry of a filter. See
+ * `sweep_range()`.
+ */
+static size_t sweep(const tdcbloom *tdcbf, const uint64_t limit, const sweep_mode mode) {
+	return sweep_range(tdcbf, limit, mode, 0, tdcbf->size);
+}
+
+/**
+ * @brief Helper function to sweep the next `entries` entries of a
+ * filter, starting where the last step stopped and wrapping around at
+ * the end. TDCBLOOM_FLAG_CONCURRENT filters claim their entries with
+ * an atomic add, so steps on several threads sweep different entries.
+ *
+ * @param tdcbf Time-decaying counting Bloom filter.
+ * @param limit Entries older than this many seconds have expired.
+ * @param mode What to do with expired entries.
+ * @param entries Number of entries to sweep.
+ *
+ * @return The number of expired entries found.
+ */
+static size_t sweep_step(tdcbloom *tdcbf, const uint64_t limit, const sweep_mode mode, const size_t entries) {
+	size_t remaining = (entries < tdcbf->size) ? entries : tdcbf->size;
+	size_t expired   = 0;
+	size_t first;
+
+	if (tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) {
+		first = __atomic_fetch_add(&tdcbf->sweep_cursor, remaining, __ATOMIC_RELAXED) % tdcbf->size;
+	} else {
+		first = tdcbf->sweep_cursor % tdcbf->size;
+		tdcbf->sweep_cursor += remaining;
+	}
+
+	while (remaining > 0) {
+		size_t count = tdcbf->size - first;
+
+		count = (count < remaining) ? count : remaining;
+		expired += sweep_range(tdcbf, limit, mode, first, first + count);
+
+		first      = 0;
+		remaining -= count;
 	}
+
+	return expired;
+}
+
+/* TDCBLOOM_COUNTER_SUM(bits, total_type) -- define counter_sum_<bits>(),
+ *     which totals every uint<bits>_t counter and counts the nonzero
+ *     ones. Contiguous counters (TDCBLOOM_FLAG_SOA) are summed by a loop
+ *     the compiler vectorizes.
+ */
+#define TDCBLOOM_COUNTER_SUM(bits, total_type)                                \
+static double counter_sum_##bits(const tdcbloom *tdcbf, size_t *nonzero) {    \
+	total_type total = 0;                                                     \
+	size_t     count = 0;                                                     \
+                                                                              \
+	if (tdcbf->counter_stride == sizeof(uint##bits##_t)) {                    \
+		const uint##bits##_t *counters = (const uint##bits##_t *)tdcbf->counters; \
+		for (size_t i = 0; i < tdcbf->size; i++) {                            \
+			total += counters[i];                                             \
+			count += (counters[i] != 0);                                      \
+		}                                                                     \
+	} else {                                                                  \
+		for (size_t i = 0; i < tdcbf->size; i++) {                            \
+			uint##bits##_t value;                                             \
+			memcpy(&value, counter_at(tdcbf, i), sizeof(value));              \
+			total += value;                                                   \
+			count += (value != 0);                                            \
+		}                                                                     \
+	}                                                                         \
+                                                                              \
+	*nonzero = count;                                                         \
+	return (double)total;                                                     \
 }
 
+TDCBLOOM_COUNTER_SUM(8, uint64_t)
+TDCBLOOM_COUNTER_SUM(16, uint64_t)
+TDCBLOOM_COUNTER_SUM(32, uint64_t)
+TDCBLOOM_COUNTER_SUM(64, double)   // a 64 bit total could overflow
+
 /**
  * @brief Remove expired entries from a time-decaying counting Bloom
  * filter and return the number of removed entries.
@@ -212,24 +697,7 @@ static inline void write_counter(void *counter, counter_size csize, uint64_t val
  * TODO: test
  */
 size_t tdcbloom_clear_expired(tdcbloom *tdcbf) {
-	time_t now           = get_monotonic_time();
-	size_t expired_count = 0;
-
-	for (size_t i = 0; i < tdcbf->size; i++) {
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (i * tdcbf->entry_size);
-		void *counter = entry;
-		void *timestamp = entry + (tdcbf->entry_size - tdcbf->timer_size_bytes);
-		uint64_t entry_ts = read_timer(timestamp, tdcbf->timer_size);
-
-		// Check if the entry has expired
-		if (entry_ts != 0 && (now - entry_ts) > tdcbf->timeout) {
-			memset(counter, 0, tdcbf->counter_size_bytes);
-			memset(timestamp, 0, tdcbf->timer_size_bytes);
-			expired_count++;
-		}
-	}
-
-	return expired_count;
+	return sweep(tdcbf, tdcbf->timeout, SWEEP_CLEAR);
 }
 
 /**
@@ -246,22 +714,7 @@ size_t tdcbloom_clear_expired(tdcbloom *tdcbf) {
  * TODO: Test
  */
 size_t tdcbloom_count_expired(tdcbloom *tdcbf) {
-	time_t now           = get_monotonic_time();
-	size_t expired_count = 0;
-
-	for (size_t i = 0; i < tdcbf->size; i++) {
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (i * tdcbf->entry_size);
-		void *counter = entry;
-		void *timestamp = entry + (tdcbf->entry_size - tdcbf->timer_size_bytes);
-		uint64_t entry_ts = read_timer(timestamp, tdcbf->timer_size);
-
-		// Check if the entry has expired
-		if (entry_ts != 0 && (now - entry_ts) > tdcbf->timeout) {
-			expired_count++;
-		}
-	}
-
-	return expired_count;
+	return sweep(tdcbf, tdcbf->timeout, SWEEP_COUNT);
 }
 
 /**
@@ -301,22 +754,9 @@ void tdcbloom_reset_start_time(tdcbloom *tdcbf) {
  * TODO: test
  */
 void  tdcbloom_adjust_timeout(tdcbloom *tdcbf, size_t new_timeout) {
-	time_t now = get_monotonic_time();
 	tdcbf->timeout = new_timeout;
 
-	for (size_t i = 0; i < tdcbf->size; i++) {
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (i * tdcbf->entry_size);
-		void *timestamp_ptr = entry + tdcbf->counter_size_bytes;
-		uint64_t timestamp = read_timer(timestamp_ptr, tdcbf->timer_size);
-
-		if (timestamp != 0) { // adjust timeout to account for new timeout
-			time_t elapsed_time = (now - timestamp + tdcbf->max_time) % tdcbf->max_time;
-
-			if (elapsed_time > new_timeout) { // clear expired entries
-				memset(entry, 0, tdcbf->entry_size);
-			}
-		}
-	}
+	sweep(tdcbf, new_timeout, SWEEP_CLEAR); // clear expired entries
 }
 
 /**
@@ -356,59 +796,9 @@ size_t tdcbloom_saturation_count(const tdcbloom *tdcbf) {
 	size_t count = 0;
 
 	for (size_t i = 0; i < tdcbf->size; i++) {
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (i * tdcbf->entry_size);
-		void *counter = entry;
-		void *timestamp = entry + (tdcbf->entry_size - tdcbf->timer_size_bytes);
-		bool is_non_zero = false;
-
-		switch (tdcbf->counter_size) {
-		case COUNTER_8BIT:
-			if (*(uint8_t *)counter != 0) {
-				is_non_zero = true;
-			}
-			break;
-		case COUNTER_16BIT:
-			if (*(uint16_t *)counter != 0) {
-				is_non_zero = true;
-			}
-			break;
-		case COUNTER_32BIT:
-			if (*(uint32_t *)counter != 0) {
-				is_non_zero = true;
-			}
-			break;
-		case COUNTER_64BIT:
-			if (*(uint64_t *)counter != 0) {
-				is_non_zero = true;
-			}
-			break;
-		}
-
-		if (is_non_zero == false) { // count is zero. check timestamps.
-			switch (tdcbf->timer_size) {
-			case TIMER_8BIT:
-				if (*(uint8_t *)timestamp  != 0) {
-					count++;
-				}
-				break;
-			case TIMER_16BIT:
-				if (*(uint16_t *)timestamp != 0) {
-					count++;
-				}
-				break;
-			case TIMER_32BIT:
-				if (*(uint32_t *)timestamp != 0) {
-					count++;
-				}
-				break;
-			case TIMER_64BIT:
-				if (*(uint64_t *)timestamp != 0) {
-					count++;
-				}
-				break;
-			}
-		} else {
-			count++; // counter is non-zero.
+		if (read_counter(counter_at(tdcbf, i), tdcbf->counter_size) != 0 ||
+			read_timer(timer_at(tdcbf, i), tdcbf->timer_size) != 0) {
+			count++;
 		}
 	}
 
@@ -416,87 +806,129 @@ size_t tdcbloom_saturation_count(const tdcbloom *tdcbf) {
 }
 
 /**
- * @brief Increment the counter at the given pointer, with bounds checking.
+ * @brief Get the runtime statistics of a time-decaying counting Bloom
+ * filter: adds, lookups, hits, adds that found a counter saturated,
+ * and the expired entries cleared by the expiry sweeps. See stats.h.
  *
- * @param counter Pointer to the counter to increment.
- * @param csize Size of the counter (COUNTER_8BIT, COUNTER_16BIT, etc.).
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param stats Set to the filter's statistics.
+ *
+ * @return true on success.
+ * @return false if the filter keeps no statistics: the library was
+ *         built without ARCHBLOOM_STATS. `stats` is zeroed.
+ */
+bool tdcbloom_stats(const tdcbloom *tdcbf, archbloom_stats *stats) {
+	archbloom_counters_read(tdcbf->stats, tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT, stats);
+
+	return tdcbf->stats != NULL;
+}
+
+/**
+ * @brief Helper function to add `n` to statistic `stat`. See stats.h.
  *
  * @note This function is static and intended for internal use.
  */
-static inline void increment_counter(void *counter, counter_size csize) {
-	switch (csize) {
-	case COUNTER_8BIT:
-		if (*(uint8_t *)counter < UINT8_MAX) {
-			(*(uint8_t *)counter)++;
-		}
-		break;
-	case COUNTER_16BIT:
-		if (*(uint16_t *)counter < UINT16_MAX) {
-			(*(uint16_t *)counter)++;
-		}
-		break;
-	case COUNTER_32BIT:
-		if (*(uint32_t *)counter < UINT32_MAX) {
-			(*(uint32_t *)counter)++;
-		}
-		break;
-	case COUNTER_64BIT:
-		if (*(uint64_t *)counter < UINT64_MAX) {
-			(*(uint64_t *)counter)++;
+static inline void count_stat(const tdcbloom *tdcbf, const archbloom_stat stat, const uint64_t n) {
+	archbloom_count(tdcbf->stats, tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT, stat, n);
+}
+
+/**
+ * @brief Increment the counter of an entry, with bounds checking.
+ *
+ * TDCBLOOM_FLAG_CONCURRENT filters retry a compare and swap until it
+ * succeeds or the counter is saturated. 64 bit counters can't
+ * realistically saturate, so they are incremented with a single fetch
+ * and add.
+ *
+ * @param tdcbf Time-decaying counting Bloom filter.
+ * @param position Entry to increment.
+ *
+ * @return true if the counter was saturated and the increment lost.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline bool increment_counter(const tdcbloom *tdcbf, const uint64_t position) {
+	void         *counter = counter_at(tdcbf, position);
+	counter_size  csize   = tdcbf->counter_size;
+	uint64_t      value;
+	uint64_t      max     =
+		(csize == COUNTER_8BIT)  ? UINT8_MAX  :
+		(csize == COUNTER_16BIT) ? UINT16_MAX :
+		(csize == COUNTER_32BIT) ? UINT32_MAX : UINT64_MAX;
+
+	if (!(tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT)) {
+		value = read_counter(counter, csize);
+		if (value < max) {
+			write_counter(counter, csize, value + 1);
 		}
-		break;
+		return value == max;
 	}
+
+	if (csize == COUNTER_64BIT) {
+		__atomic_fetch_add((uint64_t *)counter, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	do {
+		value = load_value(counter, (timer_size)csize);
+	} while (value < max && !swap_value(counter, (timer_size)csize, value, value + 1));
+
+	return value == max;
 }
 
 /**
- * @brief Decrement the counter at the given pointer, with bounds checking.
+ * @brief Decrement the counter of an entry, with bounds checking.
  *
- * @param counter Pointer to the counter to decrement.
- * @param csize Size of the counter (COUNTER_8BIT, COUNTER_16BIT, etc.).
+ * @param tdcbf Time-decaying counting Bloom filter.
+ * @param position Entry to decrement.
  *
  * @note This function is static and intended for internal use.
  */
-static inline void decrement_counter(void *counter, counter_size csize) {
-	switch (csize) {
-	case COUNTER_8BIT:
-		if (*(uint8_t *)counter > 0) {
-			(*(uint8_t *)counter)--;
-		}
-		break;
-	case COUNTER_16BIT:
-		if (*(uint16_t *)counter > 0) {
-			(*(uint16_t *)counter)--;
-		}
-		break;
-	case COUNTER_32BIT:
-		if (*(uint32_t *)counter > 0) {
-			(*(uint32_t *)counter)--;
+static inline void decrement_counter(const tdcbloom *tdcbf, const uint64_t position) {
+	void         *counter = counter_at(tdcbf, position);
+	counter_size  csize   = tdcbf->counter_size;
+	uint64_t      value;
+
+	if (!(tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT)) {
+		value = read_counter(counter, csize);
+		if (value > 0) {
+			write_counter(counter, csize, value - 1);
 		}
-		break;
-	case COUNTER_64BIT:
-		if (*(uint64_t *)counter > 0) {
-			(*(uint64_t *)counter)--;
-		}
-		break;
+		return;
 	}
+
+	do {
+		value = load_value(counter, (timer_size)csize);
+	} while (value > 0 && !swap_value(counter, (timer_size)csize, value, value - 1));
 }
 
-// set_timestamp() - helper function to set a timestamp
-static inline void set_timestamp(void *timestamp, timer_size tsize, time_t ts) {
-	switch (tsize) {
-	case TIMER_8BIT:
-		(*(uint8_t *)timestamp) = (uint8_t)(ts % UINT8_MAX);
-		break;
-	case TIMER_16BIT:
-		(*(uint16_t *)timestamp) = (uint16_t)(ts % UINT16_MAX);
-		break;
-	case TIMER_32BIT:
-		(*(uint32_t *)timestamp) = (uint32_t)(ts % UINT32_MAX);
-		break;
-	case TIMER_64BIT:
-		(*(uint64_t *)timestamp) = (uint64_t)(ts % UINT64_MAX);
-		break;
+/**
+ * @brief Check whether a timestamp read after `now` is older than the
+ * filter's timeout.
+ *
+ * In a TDCBLOOM_FLAG_CONCURRENT filter another thread may have set the
+ * timestamp after `now` was read, which makes a fresh entry look
+ * max_time - 1 seconds old, so apparently expired entries are checked
+ * again against the clock.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static inline bool entry_expired(const tdcbloom *tdcbf, const uint64_t now, const uint64_t timestamp) {
+	if ((now - timestamp + tdcbf->max_time) % tdcbf->max_time <= tdcbf->timeout) {
+		return false;
+	}
+
+	if (tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT) {
+		uint64_t later = get_monotonic_time();
+		return (later - timestamp + tdcbf->max_time) % tdcbf->max_time > tdcbf->timeout;
 	}
+
+	return true;
+}
+
+// set_timestamp() - helper function to set the timestamp of an entry
+static inline void set_timestamp(const tdcbloom *tdcbf, const uint64_t position, time_t ts) {
+	put_timer(tdcbf, position, (uint64_t)ts % tdcbf->max_time);
 }
 
 /**
@@ -505,7 +937,7 @@ static inline void set_timestamp(void *timestamp, timer_size tsize, time_t ts) {
  *
  * This function calculates the average count of all non-zero entries
  * in the time-decaying counting Bloom filter. It iterates over all
- * entries and updates the average incrementally to avoid overflow.
+ * entries.
  *
  * @param tdcbf The time-decaying counting Bloom filter.
  *
@@ -514,19 +946,16 @@ static inline void set_timestamp(void *timestamp, timer_size tsize, time_t ts) {
  */
 float tdcbloom_get_average_count(const tdcbloom *tdcbf) {
 	size_t non_zero_entries = 0;
-	double average_count    = 0.0;
+	double total_count      = 0.0;
 
-	for (size_t i = 0; i < tdcbf->size; i++) {
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (i * tdcbf->entry_size);
-		uint64_t count = read_counter(entry, tdcbf->counter_size);
-
-		if (count > 0) {
-			non_zero_entries++;
-			average_count += (double)(count - average_count) / non_zero_entries;
-		}
+	switch (tdcbf->counter_size) {
+	case COUNTER_8BIT:  total_count = counter_sum_8(tdcbf, &non_zero_entries);  break;
+	case COUNTER_16BIT: total_count = counter_sum_16(tdcbf, &non_zero_entries); break;
+	case COUNTER_32BIT: total_count = counter_sum_32(tdcbf, &non_zero_entries); break;
+	case COUNTER_64BIT: total_count = counter_sum_64(tdcbf, &non_zero_entries); break;
 	}
 
-	return (non_zero_entries == 0) ? 0.0 : (float)average_count;
+	return (non_zero_entries == 0) ? 0.0 : (float)(total_count / non_zero_entries);
 }
 
 /**
@@ -541,18 +970,40 @@ float tdcbloom_get_average_count(const tdcbloom *tdcbf) {
  * @param len Length of the element in bytes.
  */
 void tdcbloom_add(tdcbloom *tdcbf, const void *element, const size_t len) {
-	uint64_t position;
-	time_t   now = get_monotonic_time();
-	uint64_t hashes[tdcbf->hashcount];
+	uint64_t hash[2];
+
+	hash_128(tdcbf->hash, element, len, hash);
+
+	tdcbloom_add_hashed(tdcbf, hash);
+}
 
-	mmh3_64_make_hashes(element, len, tdcbf->hashcount, hashes);
+/**
+ * @brief Add an element that has already been hashed.
+ *
+ * For callers that check one element against several filters with the
+ * same hash strategy: the element is hashed once with `hash_128()`
+ * and the counters in each filter come from that hash.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ */
+void tdcbloom_add_hashed(tdcbloom *tdcbf, const uint64_t *hash) {
+	uint64_t position;
+	time_t   now       = get_monotonic_time();
+	bool     saturated = false;
 
 	for (size_t i = 0; i < tdcbf->hashcount; i++) {
-		position = hashes[i] % tdcbf->size;
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (position * tdcbf->entry_size);
-		increment_counter(entry, tdcbf->counter_size);
-		void *timestamp_base = entry + tdcbf->counter_size_bytes;
-		set_timestamp(timestamp_base, tdcbf->timer_size, now);
+		position = hash_probe(hash, i) % tdcbf->size;
+		// timestamp first: see clear_entry()
+		set_timestamp(tdcbf, position, now);
+		saturated |= increment_counter(tdcbf, position);
+	}
+
+	count_stat(tdcbf, ARCHBLOOM_STAT_ADDS, 1);
+	count_stat(tdcbf, ARCHBLOOM_STAT_SATURATIONS, saturated);
+
+	if (tdcbf->sweep_step != 0) {
+		tdcbloom_clear_expired_step(tdcbf, tdcbf->sweep_step);
 	}
 }
 
@@ -582,26 +1033,35 @@ void tdcbloom_add_string(tdcbloom *tdcbf, const char *element) {
  * @return false if the element is definitely not in the filter or has expired.
  */
 bool tdcbloom_lookup(const tdcbloom *tdcbf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(tdcbf->hash, element, len, hash);
+
+	return tdcbloom_lookup_hashed(tdcbf, hash);
+}
+
+/**
+ * @brief Helper function for `tdcbloom_lookup_hashed()`. Checks the
+ * element without counting the lookup.
+ *
+ * @note This function is static and intended for internal use.
+ */
+static bool lookup_hashed(const tdcbloom *tdcbf, const uint64_t *hash) {
 	uint64_t position;
 	time_t now = get_monotonic_time();
-	uint64_t hashes[tdcbf->hashcount];
-
-	mmh3_64_make_hashes(element, len, tdcbf->hashcount, hashes);
 
 	for (size_t i = 0; i < tdcbf->hashcount; i++) {
-		position = hashes[i] % tdcbf->size;
+		position = hash_probe(hash, i) % tdcbf->size;
 
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (position * tdcbf->entry_size);
-		uint64_t counter = read_counter(entry, tdcbf->counter_size);
+		uint64_t counter = get_counter(tdcbf, position);
 
 		if (counter == 0) {
 			return false; // definitely not in the filter
 		}
 
-		void *timestamp_ptr = entry + tdcbf->counter_size_bytes;
-		uint64_t timestamp = read_timer(timestamp_ptr, tdcbf->timer_size);
+		uint64_t timestamp = get_timer(tdcbf, position);
 
-		if (((now - timestamp + tdcbf->max_time) % tdcbf->max_time) > tdcbf->timeout) {
+		if (entry_expired(tdcbf, now, timestamp)) {
 			return false; // timed out
 		}
 	}
@@ -609,6 +1069,25 @@ bool tdcbloom_lookup(const tdcbloom *tdcbf, const void *element, const size_t le
 	return true; // element likely exists and isn't expired
 }
 
+/**
+ * @brief Lookup an element that has already been hashed. See
+ * `tdcbloom_add_hashed()`.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return true if the element is likely in the filter and has not expired.
+ * @return false if the element is definitely not in the filter or has expired.
+ */
+bool tdcbloom_lookup_hashed(const tdcbloom *tdcbf, const uint64_t *hash) {
+	bool found = lookup_hashed(tdcbf, hash);
+
+	count_stat(tdcbf, ARCHBLOOM_STAT_LOOKUPS, 1);
+	count_stat(tdcbf, ARCHBLOOM_STAT_HITS, found);
+
+	return found;
+}
+
 /**
  * @brief Lookup a string element in the time-decaying counting Bloom filter.
  *
@@ -641,25 +1120,23 @@ bool tdcbloom_lookup_string(const tdcbloom *tdcbf, const char *element) {
  */
 bool tdcbloom_has_expired(const tdcbloom *tdcbf, const void *element, size_t len) {
 	uint64_t result;
-	uint64_t hashes[tdcbf->hashcount];
+	uint64_t hash[2];
 	time_t now = get_monotonic_time();
 
-	mmh3_64_make_hashes(element, len, tdcbf->hashcount, hashes);
+	hash_128(tdcbf->hash, element, len, hash);
 
 	for (size_t i = 0; i < tdcbf->hashcount; i++) {
-		result = hashes[i] % tdcbf->size;
+		result = hash_probe(hash, i) % tdcbf->size;
 
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (result * tdcbf->entry_size);
-		uint64_t counter = read_counter(entry, tdcbf->counter_size);
+		uint64_t counter = get_counter(tdcbf, result);
 
 		if (counter == 0) {
 			return false; // Element is not in the filter
 		}
 
-		void *timestamp_ptr = entry + tdcbf->counter_size_bytes;
-		uint64_t timestamp = read_timer(timestamp_ptr, tdcbf->timer_size);
+		uint64_t timestamp = get_timer(tdcbf, result);
 
-		if ((now - timestamp + tdcbf->max_time) % tdcbf->max_time > tdcbf->timeout) {
+		if (entry_expired(tdcbf, now, timestamp)) {
 			return true; // Element has expired
 		}
 	}
@@ -735,14 +1212,13 @@ bool tdcbloom_reset_if_expired_string(tdcbloom *tdcbf, const char *element) {
  */
 void tdcbloom_remove(tdcbloom *tdcbf, const void *element, const size_t len) {
 	uint64_t position;
-	uint64_t hashes[tdcbf->hashcount];
+	uint64_t hash[2];
 
-	mmh3_64_make_hashes(element, len, tdcbf->hashcount, hashes);
+	hash_128(tdcbf->hash, element, len, hash);
 
 	for (size_t i = 0; i < tdcbf->hashcount; i++) {
-		position = hashes[i] % tdcbf->size;
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (position * tdcbf->entry_size);
-		decrement_counter(entry, tdcbf->counter_size);
+		position = hash_probe(hash, i) % tdcbf->size;
+		decrement_counter(tdcbf, position);
 	}
 }
 
@@ -773,27 +1249,39 @@ void tdcbloom_remove_string(tdcbloom *tdcbf, const char *element) {
  * @return The approximate count of the element in the filter.
  */
 size_t tdcbloom_count(const tdcbloom *tdcbf, const void *element, const size_t len) {
+	uint64_t hash[2];
+
+	hash_128(tdcbf->hash, element, len, hash);
+
+	return tdcbloom_count_hashed(tdcbf, hash);
+}
+
+/**
+ * @brief Count an element that has already been hashed. See
+ * `tdcbloom_add_hashed()`.
+ *
+ * @param tdcbf The time-decaying counting Bloom filter.
+ * @param hash The element's `hash_128()`, with the filter's strategy.
+ *
+ * @return The approximate count of the element in the filter.
+ */
+size_t tdcbloom_count_hashed(const tdcbloom *tdcbf, const uint64_t *hash) {
 	uint64_t position;
 	size_t   total_count = SIZE_MAX;
 	time_t   now = get_monotonic_time();
-	uint64_t hashes[tdcbf->hashcount];
-
-	mmh3_64_make_hashes(element, len, tdcbf->hashcount, hashes);
 
 	for (size_t i = 0; i < tdcbf->hashcount; i++) {
-		position = hashes[i] % tdcbf->size;
+		position = hash_probe(hash, i) % tdcbf->size;
 
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (position * tdcbf->entry_size);
-		uint64_t counter = read_counter(entry, tdcbf->counter_size);
+		uint64_t counter = get_counter(tdcbf, position);
 
 		if (counter == 0) {
 			return 0;  // element is definitely not in set
 		}
 
-		void *timestamp_ptr = entry + tdcbf->counter_size_bytes;
-		uint64_t timestamp = read_timer(timestamp_ptr, tdcbf->timer_size);
+		uint64_t timestamp = get_timer(tdcbf, position);
 
-		if ((now - timestamp) % tdcbf->max_time > tdcbf->timeout) {
+		if (entry_expired(tdcbf, now, timestamp)) {
 			return 0;  // element has expired
 		}
 
@@ -842,23 +1330,20 @@ size_t tdcbloom_count_string(const tdcbloom *tdcbf, const char *element) {
  */
 bool tdcbloom_age_element(tdcbloom *tdcbf, const void *element, size_t len, size_t age_amount) {
 	uint64_t result;
-	uint64_t hashes[tdcbf->hashcount];
-	time_t now = get_monotonic_time();
+	uint64_t hash[2];
 
-	mmh3_64_make_hashes(element, len, tdcbf->hashcount, hashes);
+	hash_128(tdcbf->hash, element, len, hash);
 
 	for (size_t i = 0; i < tdcbf->hashcount; i++) {
-		result = hashes[i] % tdcbf->size;
+		result = hash_probe(hash, i) % tdcbf->size;
 
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (result * tdcbf->entry_size);
-		uint64_t counter = read_counter(entry, tdcbf->counter_size);
+		uint64_t counter = get_counter(tdcbf, result);
 
 		if (counter == 0) {
 			return false; // element definitely not in the filter
 		}
 
-		void *timestamp_ptr = entry + tdcbf->counter_size_bytes;
-		uint64_t timestamp = read_timer(timestamp_ptr, tdcbf->timer_size);
+		uint64_t timestamp = get_timer(tdcbf, result);
 
 		if (timestamp > age_amount) {
 			timestamp -= age_amount;
@@ -866,7 +1351,7 @@ bool tdcbloom_age_element(tdcbloom *tdcbf, const void *element, size_t len, size
 			timestamp = 0; // expired. reset timer
 		}
 
-		write_timer(timestamp_ptr, tdcbf->timer_size, timestamp);
+		put_timer(tdcbf, result, timestamp);
 	}
 
 	return true; // element was found and aged successfully
@@ -891,46 +1376,435 @@ bool tdcbloom_age_element(tdcbloom *tdcbf, const void *element, size_t len, size
  * TODO test
  */
 size_t tdcbloom_age_and_remove(tdcbloom *tdcbf, size_t max_age) {
-	time_t now = get_monotonic_time();
-	size_t removed_count = 0;
+	return sweep(tdcbf, max_age, SWEEP_CLEAR_COUNTED);
+}
 
-	for (size_t i = 0; i < tdcbf->size; i++) {
-		uint8_t *entry = (uint8_t *)tdcbf->entrymap + (i * tdcbf->entry_size);
-		uint64_t counter = read_counter(entry, tdcbf->counter_size);
+/**
+ * @brief Remove expired entries from the next part of a time-decaying
+ * counting Bloom filter.
+ *
+ * `tdcbloom_clear_expired()` sweeps every entry at once, which stalls
+ * the caller for as long as it takes to read the whole filter. This
+ * function sweeps `entries` entries starting where the last step
+ * stopped, wrapping around at the end, so regular calls spread the same
+ * work evenly. Expired elements are never found by lookups whether or
+ * not they have been swept; sweeping frees their entries for reuse.
+ *
+ * `tdcbloom_age_and_remove_step()` shares the same position, and
+ * TDCBLOOM_FLAG_CONCURRENT filters may be stepped from several threads
+ * at once.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param entries Number of entries to sweep. Sweeping `size` entries
+ *        is a whole pass.
+ *
+ * @return The number of expired entries removed.
+ */
+size_t tdcbloom_clear_expired_step(tdcbloom *tdcbf, const size_t entries) {
+	return sweep_step(tdcbf, tdcbf->timeout, SWEEP_CLEAR, entries);
+}
 
-		if (counter == 0) {
-			continue; // skip if counter is zero
-		}
+/**
+ * @brief `tdcbloom_age_and_remove()` on the next part of a filter. See
+ * `tdcbloom_clear_expired_step()`.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param max_age Entries older than this many seconds are removed.
+ * @param entries Number of entries to sweep.
+ *
+ * @return The number of elements removed from the filter.
+ */
+size_t tdcbloom_age_and_remove_step(tdcbloom *tdcbf, const size_t max_age, const size_t entries) {
+	return sweep_step(tdcbf, max_age, SWEEP_CLEAR_COUNTED, entries);
+}
+
+/**
+ * @brief Sweep part of a time-decaying counting Bloom filter on every
+ * add.
+ *
+ * With a sweep step set, each add runs `tdcbloom_clear_expired_step()`
+ * over `entries` entries after updating its own, so maintenance is
+ * paid for a little at a time by the writers rather than all at once.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param entries Entries swept by each add, or 0 to disable.
+ */
+void tdcbloom_set_sweep_step(tdcbloom *tdcbf, const size_t entries) {
+	tdcbf->sweep_step = entries;
+}
+
+/**
+ * @brief Set the name of a time-decaying counting Bloom filter. The
+ * name is saved with the filter.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param name Name of at most TDCBLOOM_MAX_NAME_LENGTH characters.
+ *
+ * @return true on success.
+ * @return false if the name is too long.
+ */
+bool tdcbloom_set_name(tdcbloom *tdcbf, const char *name) {
+	if (strlen(name) > TDCBLOOM_MAX_NAME_LENGTH) {
+		return false;
+	}
+
+	strncpy(tdcbf->name, name, TDCBLOOM_MAX_NAME_LENGTH);
+	tdcbf->name[TDCBLOOM_MAX_NAME_LENGTH] = '\0';
+
+	return true;
+}
+
+/**
+ * @brief Get the name of a time-decaying counting Bloom filter.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ *
+ * @return The filter's name.
+ */
+const char *tdcbloom_get_name(const tdcbloom *tdcbf) {
+	return tdcbf->name;
+}
+
+/**
+ * @brief Helper function for the save functions. Fill in the file
+ * header describing a filter.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param tdcbff Pointer to the header to fill in.
+ */
+static void make_header(const tdcbloom *tdcbf, tdcbloom_file *tdcbff) {
+	memset(tdcbff, 0, sizeof(tdcbloom_file));
+	memcpy(tdcbff->magic, "!tdcblo!", sizeof(tdcbff->magic));
+
+	tdcbff->size          = tdcbf->size;
+	tdcbff->entrymap_size = tdcbf->entrymap_size;
+	tdcbff->hashcount     = tdcbf->hashcount;
+	tdcbff->expected      = tdcbf->expected;
+	tdcbff->max_time      = tdcbf->max_time;
+	tdcbff->start_time    = tdcbf->start_time;
+	tdcbff->timeout       = tdcbf->timeout;
+	tdcbff->counter_size  = tdcbf->counter_size;
+	tdcbff->timer_size    = tdcbf->timer_size;
+	tdcbff->accuracy      = tdcbf->accuracy;
+	tdcbff->flags         = tdcbf->flags;
+	tdcbff->hash          = tdcbf->hash;
+	snprintf((char *)tdcbff->name, TDCBLOOM_MAX_NAME_LENGTH + 1, "%.*s", TDCBLOOM_MAX_NAME_LENGTH, tdcbf->name);
+}
+
+/**
+ * @brief Helper function for the load functions. Check that a file
+ * header describes a filter this library can use, and fill in a
+ * filter from it. The entry map is not touched.
+ *
+ * @param tdcbff Pointer to the header read from disk.
+ * @param file_size Size of the file holding the filter.
+ * @param tdcbf Pointer to the `tdcbloom` struct to fill in.
+ *
+ * @return true if the header is usable, false if it is not.
+ */
+static bool read_header(const tdcbloom_file *tdcbff, const off_t file_size, tdcbloom *tdcbf) {
+	tdcbloom loaded = {0};
+
+	if (memcmp(tdcbff->magic, "!tdcblo!", sizeof(tdcbff->magic)) != 0) {
+		return false;
+	}
+
+	if (tdcbff->flags & ~TDCBLOOM_FLAGS_ALL) {
+		return false; // written by a newer version
+	}
+
+	if ((tdcbff->flags & TDCBLOOM_FLAG_CONCURRENT) && !(tdcbff->flags & TDCBLOOM_FLAG_SOA)) {
+		return false;
+	}
+
+	if (!hash_strategy_valid(tdcbff->hash) ||
+		tdcbff->size == 0 ||
+		tdcbff->hashcount == 0) {
+		return false;
+	}
 
-		void *timestamp_ptr = entry + tdcbf->counter_size_bytes;
-		uint64_t timestamp = read_timer(timestamp_ptr, tdcbf->timer_size);
-		time_t element_age = (now >= timestamp) ? (now - timestamp) : (now + (tdcbf->max_time - timestamp));
+	loaded.size       = tdcbff->size;
+	loaded.hashcount  = tdcbff->hashcount;
+	loaded.expected   = tdcbff->expected;
+	loaded.accuracy   = tdcbff->accuracy;
+	loaded.start_time = tdcbff->start_time;
+	loaded.timeout    = tdcbff->timeout;
+	loaded.flags      = tdcbff->flags;
+	loaded.hash       = tdcbff->hash;
+
+	if (set_widths(&loaded, tdcbff->counter_size, tdcbff->timer_size) != TDCBF_SUCCESS ||
+		loaded.max_time != tdcbff->max_time) {
+		return false;
+	}
+
+	// the file must hold exactly one entry map, and computing its size must not overflow
+	if (loaded.size > (SIZE_MAX - 64) / loaded.entry_size) {
+		return false;
+	}
+
+	loaded.entrymap_size = layout_size(&loaded);
+	if (loaded.entrymap_size != tdcbff->entrymap_size ||
+		sizeof(tdcbloom_file) + loaded.entrymap_size != (uint64_t)file_size) {
+		return false;
+	}
+
+	snprintf(loaded.name, TDCBLOOM_MAX_NAME_LENGTH + 1, "%.*s", TDCBLOOM_MAX_NAME_LENGTH, (char *)tdcbff->name);
+
+	*tdcbf = loaded;
 
-		if (element_age > max_age) {
-			// Clear the counter and the timestamp to "remove" the element
-			memset(entry, 0, tdcbf->counter_size_bytes);
-			memset(timestamp_ptr, 0, tdcbf->timer_size_bytes);
-			removed_count++;
+	return true;
+}
+
+/**
+ * @brief Save a time-decaying counting Bloom filter to a file
+ * descriptor.
+ *
+ * A `tdcbloom_file` header is written, followed by the entry map as it
+ * is laid out in memory, in a single write. Both layouts are
+ * supported; TDCBLOOM_FLAG_SOA is saved with the filter.
+ *
+ * Timestamps are seconds of CLOCK_MONOTONIC, which restarts when the
+ * system boots. A filter saved before a reboot loads with unrelated
+ * ages.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param fd File descriptor, opened for writing, to save the filter to.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_FWRITE if there was an error writing to the file.
+ */
+tdcbloom_error_t tdcbloom_save_fd(const tdcbloom *tdcbf, int fd) {
+	tdcbloom_file  tdcbff;
+	const uint8_t *entries   = (const uint8_t *)tdcbf->entrymap;
+	size_t         remaining = tdcbf->entrymap_size;
+
+	make_header(tdcbf, &tdcbff);
+
+	if (write(fd, &tdcbff, sizeof(tdcbloom_file)) != sizeof(tdcbloom_file)) {
+		return TDCBF_FWRITE;
+	}
+
+	// write() may stop short of large requests; continue where it left off
+	while (remaining > 0) {
+		ssize_t written = write(fd, entries, remaining);
+		if (written <= 0) {
+			return TDCBF_FWRITE;
 		}
+
+		entries   += written;
+		remaining -= written;
 	}
 
-	return removed_count;
+	return TDCBF_SUCCESS;
 }
 
 /**
- * TODO: implement tdcbloom_save()
+ * @brief Save a time-decaying counting Bloom filter to a file.
+ *
+ * This function is a convenience wrapper around `tdcbloom_save_fd()`
+ * that creates or truncates the file. See `tdcbloom_save_fd()` for
+ * the format.
+ *
+ * @param tdcbf Pointer to the time-decaying counting Bloom filter.
+ * @param path Path of the file to save the filter to.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_FOPEN if the file could not be opened.
+ * @return TDCBF_FWRITE if there was an error writing to the file.
  */
 tdcbloom_error_t tdcbloom_save(const tdcbloom *tdcbf, const char *path) {
+	tdcbloom_error_t error;
+	int              fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1) {
+		return TDCBF_FOPEN;
+	}
+
+	error = tdcbloom_save_fd(tdcbf, fd);
+	if (close(fd) == -1 && error == TDCBF_SUCCESS) {
+		error = TDCBF_FWRITE;
+	}
+
+	return error;
+}
+
+/**
+ * @brief Load a time-decaying counting Bloom filter from a file
+ * descriptor.
+ *
+ * The descriptor must be positioned at the start of a filter saved
+ * with `tdcbloom_save()` or `tdcbloom_save_fd()`, and the filter must
+ * run to the end of the file. The entry map is read into private
+ * memory with a single read.
+ *
+ * @param tdcbf Pointer to the `tdcbloom` struct to initialize.
+ * @param fd File descriptor to load the filter from.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_FSTAT if the fstat() system call fails.
+ * @return TDCBF_FREAD if there was an error reading from the file.
+ * @return TDCBF_INVALIDFILE if the file format is incorrect.
+ * @return TDCBF_OUTOFMEMORY if memory allocation fails.
+ */
+tdcbloom_error_t tdcbloom_load_fd(tdcbloom *tdcbf, int fd) {
+	struct stat    sb;
+	tdcbloom_file  tdcbff;
+	uint8_t       *entries;
+	size_t         remaining;
+
+	if (fstat(fd, &sb) == -1) {
+		return TDCBF_FSTAT;
+	}
+
+	if (read(fd, &tdcbff, sizeof(tdcbloom_file)) != sizeof(tdcbloom_file)) {
+		return TDCBF_FREAD;
+	}
+
+	if (!read_header(&tdcbff, sb.st_size, tdcbf)) {
+		return TDCBF_INVALIDFILE;
+	}
+
+	tdcbf->entrymap = archbloom_alloc(tdcbf->entrymap_size);
+	if (tdcbf->entrymap == NULL) {
+		return TDCBF_OUTOFMEMORY;
+	}
+
+	entries   = (uint8_t *)tdcbf->entrymap;
+	remaining = tdcbf->entrymap_size;
+	while (remaining > 0) {
+		ssize_t got = read(fd, entries, remaining);
+		if (got <= 0) {
+			archbloom_free(tdcbf->entrymap);
+			tdcbf->entrymap = NULL;
+			return TDCBF_FREAD;
+		}
+
+		entries   += got;
+		remaining -= got;
+	}
+
+	set_layout(tdcbf, tdcbf->entrymap);
+	tdcbf->stats = archbloom_counters_alloc(tdcbf->flags & TDCBLOOM_FLAG_CONCURRENT);
+
 	return TDCBF_SUCCESS;
 }
 
 /**
- * TODO: implement tdcbloom_load()
+ * @brief Load a time-decaying counting Bloom filter from a file.
+ *
+ * This function is a convenience wrapper around `tdcbloom_load_fd()`
+ * that opens and closes the file.
+ *
+ * @param tdcbf Pointer to the `tdcbloom` struct to initialize.
+ * @param path Path to a saved time-decaying counting Bloom filter.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_FOPEN if the file could not be opened.
+ * @return Any error returned by `tdcbloom_load_fd()`.
  */
 tdcbloom_error_t tdcbloom_load(tdcbloom *tdcbf, const char *path) {
+	tdcbloom_error_t error;
+	int              fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return TDCBF_FOPEN;
+	}
+
+	error = tdcbloom_load_fd(tdcbf, fd);
+	close(fd);
+
+	return error;
+}
+
+/**
+ * @brief Map a time-decaying counting Bloom filter file descriptor
+ * into memory.
+ *
+ * This function validates the header of a saved time-decaying,
+ * counting Bloom filter and maps the file MAP_SHARED instead of
+ * copying the entries into private memory. See `bloom_map_fd()` for
+ * details.
+ *
+ * If `writable` is false the mapping is read only and the filter must
+ * only be used for lookups and counts. If it is true, changes are
+ * written back to the file; the descriptor must be open for writing.
+ *
+ * Release the mapping with `tdcbloom_destroy()`.
+ *
+ * @param tdcbf Pointer to the `tdcbloom` struct to initialize.
+ * @param fd File descriptor of a saved time-decaying counting Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_FREAD if there was an error reading from the file descriptor.
+ * @return TDCBF_FSTAT if the fstat() system call fails.
+ * @return TDCBF_INVALIDFILE if the file format is incorrect.
+ * @return TDCBF_MMAP if the mmap() system call fails.
+ */
+tdcbloom_error_t tdcbloom_map_fd(tdcbloom *tdcbf, int fd, const bool writable) {
+	struct stat    sb;
+	tdcbloom_file  tdcbff;
+	tdcbloom       mapped;
+	void          *map;
+
+	if (fstat(fd, &sb) == -1) {
+		return TDCBF_FSTAT;
+	}
+
+	if (pread(fd, &tdcbff, sizeof(tdcbloom_file), 0) != sizeof(tdcbloom_file)) {
+		return TDCBF_FREAD;
+	}
+
+	if (!read_header(&tdcbff, sb.st_size, &mapped)) {
+		return TDCBF_INVALIDFILE;
+	}
+
+	map = map_file(fd, sb.st_size, writable);
+	if (map == NULL) {
+		return TDCBF_MMAP;
+	}
+
+	mapped.map      = map;
+	mapped.map_size = sb.st_size;
+	mapped.stats    = archbloom_counters_alloc(mapped.flags & TDCBLOOM_FLAG_CONCURRENT);
+	set_layout(&mapped, (uint8_t *)map + sizeof(tdcbloom_file));
+
+	*tdcbf = mapped;
+
 	return TDCBF_SUCCESS;
 }
 
+/**
+ * @brief Map a time-decaying counting Bloom filter file into memory.
+ *
+ * This function is a convenience wrapper around `tdcbloom_map_fd()`
+ * that opens and closes the file.
+ *
+ * @param tdcbf Pointer to the `tdcbloom` struct to initialize.
+ * @param path Path to a saved time-decaying counting Bloom filter.
+ * @param writable true to allow modifying the filter through the mapping.
+ *
+ * @return TDCBF_SUCCESS on success.
+ * @return TDCBF_FOPEN if the file could not be opened.
+ * @return Any error returned by `tdcbloom_map_fd()`.
+ */
+tdcbloom_error_t tdcbloom_map(tdcbloom *tdcbf, const char *path, const bool writable) {
+	tdcbloom_error_t error;
+	int              fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd == -1) {
+		return TDCBF_FOPEN;
+	}
+
+	error = tdcbloom_map_fd(tdcbf, fd, writable);
+	close(fd);
+
+	return error;
+}
+
 /**
  * @brief Return a string containing the error message for a given error code.
  *
@@ -19,6 +19,41 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "hash.h"
+#include "stats.h"
+
+#define TDCBLOOM_MAX_NAME_LENGTH 255
+
+/**
+ * @def TDCBLOOM_FLAG_SOA
+ * @brief `tdcbloom_init_flags()` flag: store the counters and the
+ * timestamps in two separate arrays rather than interleaved. Sweeps
+ * over the timestamps, such as `tdcbloom_clear_expired()`, then only
+ * read timestamps and can be vectorized, at the cost of touching two
+ * cache lines per hash on add and lookup.
+ */
+#define TDCBLOOM_FLAG_SOA  0x01
+
+/**
+ * @def TDCBLOOM_FLAG_CONCURRENT
+ * @brief `tdcbloom_init_flags()` flag: allow elements to be added,
+ * removed, counted and looked up, and expired entries to be swept, on
+ * the same filter from multiple threads without external locking.
+ * Counters are updated with atomic compare and swap so they still
+ * saturate and stop at zero, and sweeps only clear an entry if its
+ * timestamp hasn't been refreshed since they read it. Implies
+ * TDCBLOOM_FLAG_SOA, which keeps every value naturally aligned.
+ * `tdcbloom_clear()`, `tdcbloom_adjust_timeout()` and loading still
+ * need the filter to themselves.
+ */
+#define TDCBLOOM_FLAG_CONCURRENT 0x02
+
+/**
+ * @def TDCBLOOM_FLAGS_ALL
+ * @brief Every flag understood by this version of the library.
+ */
+#define TDCBLOOM_FLAGS_ALL (TDCBLOOM_FLAG_SOA | TDCBLOOM_FLAG_CONCURRENT)
+
 /**
  * @brief tdcbloom_error_t
  */
@@ -29,21 +64,21 @@ typedef enum {
 	TDCBF_INVALIDTIMERSIZE,
 	TDCBF_INVALIDEXPECTED,
 	TDCBF_INVALIDACCURACY,
+	TDCBF_FOPEN,
+	TDCBF_FREAD,
+	TDCBF_FWRITE,
+	TDCBF_FSTAT,
+	TDCBF_INVALIDFILE,
+	TDCBF_MMAP,
 	// counter
 	TDCBF_ERRORCOUNT
 } tdcbloom_error_t;
 
 /**
- * @brief tdcbloom_errors - Human-readable error messages.
+ * @brief tdcbloom_errors - Human-readable error messages. Defined in
+ * tdcbloom.c, so other parts of the library can include this header.
  */
-const char *tdcbloom_errors[] = {
-	"Success",
-	"Out of memory",
-	"Invalid counter size",
-	"Invalid timer size",
-	"Invalid number of expected elements",
-	"Invalid accuracy parameter"
-};
+extern const char *tdcbloom_errors[];
 
 /**
  * @brief counter_size bit size of counter items
@@ -73,6 +108,36 @@ typedef struct {
 	void *timestamp;
 } tdcbloom_entry;
 
+/**
+ * @brief tdcbloom_file - on-disk header of a saved time-decaying,
+ * counting Bloom filter.
+ *
+ * The entry map follows this header on disk exactly as it is laid out
+ * in memory, so it is written and read in one piece and can be mapped
+ * with `tdcbloom_map()`. The header is padded to 384 bytes so the
+ * entries start on a 64 byte boundary. `counter_size` and `timer_size`
+ * hold the counter_size and timer_size values, `flags` the
+ * TDCBLOOM_FLAG_* options and `hash` the hash strategy; `reserved`
+ * must be zero.
+ */
+typedef struct {
+	uint8_t  magic[8];
+	uint8_t  name[TDCBLOOM_MAX_NAME_LENGTH + 1];
+	uint64_t size;
+	uint64_t entrymap_size;
+	uint64_t hashcount;
+	uint64_t expected;
+	uint64_t max_time;
+	uint64_t start_time;
+	uint64_t timeout;
+	uint32_t counter_size;
+	uint32_t timer_size;
+	float    accuracy;
+	uint32_t flags;
+	uint32_t hash;
+	uint8_t  reserved[44];
+} tdcbloom_file;
+
 /**
  * @brief tdcbloom - Time-decaying, counting Bloom filter structure.
  */
@@ -82,12 +147,27 @@ typedef struct {
 	size_t          timeout;
 	size_t          max_time;
 	uint64_t        hashcount;
+	hash_strategy   hash; // see tdcbloom_set_hash()
 	counter_size    counter_size;
 	int             counter_size_bytes;
 	timer_size      timer_size;
 	int             timer_size_bytes;
 	size_t          entry_size; // entry size = counter size + timer size
 	tdcbloom_entry *entrymap;
+	uint32_t        flags;          // TDCBLOOM_FLAG_* options
+	size_t          entrymap_size;  // bytes allocated at entrymap
+	uint8_t        *counters;       // counter of entry 0
+	size_t          counter_stride; // bytes between counters
+	uint8_t        *timers;         // timestamp of entry 0
+	size_t          timer_stride;   // bytes between timestamps
+	size_t          expected;
+	float           accuracy;
+	char            name[TDCBLOOM_MAX_NAME_LENGTH + 1];
+	void           *map;            // file mapping from tdcbloom_map(), or NULL
+	size_t          map_size;       // size of the file mapping in bytes
+	size_t          sweep_cursor;   // entries swept by the *_step() functions; the next starts at sweep_cursor % size
+	size_t          sweep_step;     // entries swept by each add, see tdcbloom_set_sweep_step()
+	archbloom_counters *stats;      // runtime statistics, see tdcbloom_stats(), or NULL
 } tdcbloom;
 
 /* function definitions
@@ -98,25 +178,44 @@ tdcbloom_error_t  tdcbloom_init(tdcbloom *,
                                 const size_t,
                                 counter_size,
                                 timer_size);
+tdcbloom_error_t  tdcbloom_init_flags(tdcbloom *,
+                                      const size_t,
+                                      const float,
+                                      const size_t,
+                                      counter_size,
+                                      timer_size,
+                                      const uint32_t);
 void              tdcbloom_destroy(tdcbloom *);
 void              tdcbloom_clear(tdcbloom *);
+bool              tdcbloom_set_hash(tdcbloom *, const hash_strategy);
 size_t            tdcbloom_count(const tdcbloom *, const void *, const size_t);
 size_t            tdcbloom_count_string(const tdcbloom *, const char *);
+size_t            tdcbloom_count_hashed(const tdcbloom *, const uint64_t *);
 size_t            tdcbloom_clear_expired(tdcbloom *);
 size_t            tdcbloom_count_expired(tdcbloom *);
 void              tdcbloom_reset_start_time(tdcbloom *);
 float             tdcbloom_saturation(const tdcbloom *);
 size_t            tdcbloom_saturation_count(const tdcbloom *);
+bool              tdcbloom_stats(const tdcbloom *, archbloom_stats *);
 
 void              tdcbloom_add(tdcbloom *, const void *, const size_t);
 void              tdcbloom_add_string(tdcbloom *, const char *);
 bool              tdcbloom_lookup(const tdcbloom *, const void *, const size_t);
 bool              tdcbloom_lookup_string(const tdcbloom *, const char *);
+void              tdcbloom_add_hashed(tdcbloom *, const uint64_t *);
+bool              tdcbloom_lookup_hashed(const tdcbloom *, const uint64_t *);
 void              tdcbloom_remove(tdcbloom *, const void *, const size_t);
 void              tdcbloom_remove_string(tdcbloom *, const char *);
 
+bool              tdcbloom_set_name(tdcbloom *, const char *);
+const char       *tdcbloom_get_name(const tdcbloom *);
+
 tdcbloom_error_t  tdcbloom_save(const tdcbloom *, const char *);
+tdcbloom_error_t  tdcbloom_save_fd(const tdcbloom *, int);
 tdcbloom_error_t  tdcbloom_load(tdcbloom *, const char *);
+tdcbloom_error_t  tdcbloom_load_fd(tdcbloom *, int);
+tdcbloom_error_t  tdcbloom_map(tdcbloom *, const char *, const bool);
+tdcbloom_error_t  tdcbloom_map_fd(tdcbloom *, int, const bool);
 const char       *tdcbloom_strerror(tdcbloom_error_t);
 
 
@@ -128,5 +227,8 @@ bool              tdcbloom_age_element(tdcbloom *, const void *, size_t, size_t)
 void              tdcbloom_adjust_timeout(tdcbloom *, size_t);
 float             tdcbloom_get_average_count(const tdcbloom *);
 size_t            tdcbloom_age_and_remove(tdcbloom *, size_t);
+size_t            tdcbloom_clear_expired_step(tdcbloom *, const size_t);
+size_t            tdcbloom_age_and_remove_step(tdcbloom *, const size_t, const size_t);
+void              tdcbloom_set_sweep_step(tdcbloom *, const size_t);
 
 #endif /* TDCBLOOM_H */
@@ -0,0 +1,208 @@
+/* test_alloc_basic.c -- filter array allocation.
+ *
+ * Checks that every filter's array starts on a cache line, that arrays
+ * go through allocator hooks and are freed by them even after the hooks
+ * are replaced, and that filters placed on huge pages work whether or
+ * not the pages can be had. Prints where large arrays ended up.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "bloom.h"
+#include "bbloom.h"
+#include "cbloom.h"
+#include "tdbloom.h"
+#include "cuckoo.h"
+
+static size_t hook_allocs;
+static size_t hook_frees;
+static size_t hook_bytes;
+
+static void *counting_alloc(size_t size, size_t alignment, void *ctx) {
+	(void)ctx;
+
+	hook_allocs++;
+	hook_bytes += size;
+
+	return aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+static void counting_free(void *ptr, size_t size, void *ctx) {
+	(void)ctx;
+
+	hook_frees++;
+	hook_bytes -= size;
+	free(ptr);
+}
+
+static bool aligned(const void *ptr) {
+	return ((uintptr_t)ptr % ARCHBLOOM_ALIGNMENT) == 0;
+}
+
+// every structure's array is cache line aligned
+static bool test_alignment(void) {
+	bloomfilter   bf;
+	bbloomfilter  bbf;
+	cbloomfilter  cbf;
+	tdbloom       tdbf;
+	cuckoofilter  cf;
+	bool          result;
+
+	bloom_init(&bf, 1000, 0.01);
+	bbloom_init(&bbf, 1000, 0.01);
+	cbloom_init(&cbf, 1000, 0.01, COUNTER_8BIT);
+	tdbloom_init(&tdbf, 1000, 0.01, 60);
+	cuckoo_init(&cf, 1024, 4, 500);
+
+	result = aligned(bf.bitmap) && aligned(bbf.bitmap) && aligned(cbf.countermap) &&
+	         aligned(tdbf.filter) && aligned(cf.buckets) && aligned(cf.bucket_insertions);
+
+	bloom_destroy(&bf);
+	bbloom_destroy(&bbf);
+	cbloom_destroy(&cbf);
+	tdbloom_destroy(&tdbf);
+	cuckoo_destroy(&cf);
+
+	if (!result) {
+		fprintf(stderr, "FAILURE: a filter array isn't %d byte aligned\n", ARCHBLOOM_ALIGNMENT);
+	}
+
+	return result;
+}
+
+static bool test_hooks(void) {
+	archbloom_allocator   counting = { counting_alloc, counting_free, NULL };
+	archbloom_alloc_stats stats;
+	bloomfilter           bf;
+	cbloomfilter          cbf;
+
+	archbloom_set_allocator(&counting);
+	bloom_init(&bf, 1002, 0.01); // 9604 bits, which folds
+	cbloom_init(&cbf, 100, 0.01, COUNTER_4BIT);
+	archbloom_alloc_get_stats(&stats);
+
+	if (hook_allocs != 2 || stats.hooked != hook_bytes || !aligned(bf.bitmap) || !aligned(cbf.countermap)) {
+		fprintf(stderr, "FAILURE: %zu hooked allocations, %zu bytes\n", hook_allocs, stats.hooked);
+		return false;
+	}
+
+	bloom_add_string(&bf, "hooked");
+	cbloom_add_string(&cbf, "hooked");
+	if (!bloom_lookup_string(&bf, "hooked") || !cbloom_lookup_string(&cbf, "hooked")) {
+		fprintf(stderr, "FAILURE: filters in hooked memory lost an element\n");
+		return false;
+	}
+
+	// folding moves the array; the old one goes back to the hook
+	if (bloom_fold(&bf, 1) != BF_SUCCESS || hook_allocs != 3 || hook_frees != 1 ||
+		!bloom_lookup_string(&bf, "hooked")) {
+		fprintf(stderr, "FAILURE: bloom_fold() in hooked memory\n");
+		return false;
+	}
+
+	// arrays are freed the way they were allocated
+	archbloom_set_allocator(NULL);
+	bloom_destroy(&bf);
+	cbloom_destroy(&cbf);
+
+	archbloom_alloc_get_stats(&stats);
+	if (hook_frees != 3 || hook_bytes != 0 || stats.hooked != 0) {
+		fprintf(stderr, "FAILURE: %zu of %zu hooked allocations freed\n", hook_frees, hook_allocs);
+		return false;
+	}
+
+	bloom_init(&bf, 1000, 0.01);
+	bloom_destroy(&bf);
+	if (hook_allocs != 3) {
+		fprintf(stderr, "FAILURE: hooks still used after being reset\n");
+		return false;
+	}
+
+	return true;
+}
+
+static bool test_realloc(void) {
+	uint8_t *array = archbloom_alloc(100);
+
+	memset(array, 0xaa, 100);
+	array = archbloom_realloc(array, 100000);
+	if (array == NULL || !aligned(array) || array[99] != 0xaa || array[100] != 0 || array[99999] != 0) {
+		fprintf(stderr, "FAILURE: archbloom_realloc()\n");
+		return false;
+	}
+	archbloom_free(array);
+	archbloom_free(NULL);
+
+	return true;
+}
+
+static bool test_pages(const archbloom_pages mode) {
+	const char           *names[] = { "default", "transparent", "2MB", "1GB" };
+	archbloom_alloc_stats before, after;
+	bloomfilter           bf;
+	char                  key[32];
+
+	archbloom_set_pages(mode);
+	archbloom_alloc_get_stats(&before);
+
+	// about 12MB: several huge pages
+	if (bloom_init(&bf, 10000000, 0.01) != BF_SUCCESS || archbloom_get_pages() != mode) {
+		fprintf(stderr, "FAILURE: bloom_init() on %s pages\n", names[mode]);
+		return false;
+	}
+
+	archbloom_alloc_get_stats(&after);
+	printf("%s pages: %zu bytes on ordinary pages, %zu transparent, %zu reserved huge pages\n",
+		   names[mode],
+		   after.heap - before.heap,
+		   after.transparent - before.transparent,
+		   after.huge - before.huge);
+
+	if (!aligned(bf.bitmap) ||
+		(mode == ARCHBLOOM_PAGES_DEFAULT && after.heap == before.heap) ||
+		(mode != ARCHBLOOM_PAGES_DEFAULT && after.heap != before.heap)) {
+		fprintf(stderr, "FAILURE: bitmap misplaced on %s pages\n", names[mode]);
+		return false;
+	}
+
+	for (size_t i = 0; i < 100000; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		bloom_add_string(&bf, key);
+	}
+	for (size_t i = 0; i < 100000; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		if (!bloom_lookup_string(&bf, key)) {
+			fprintf(stderr, "FAILURE: \"%s\" missing on %s pages\n", key, names[mode]);
+			return false;
+		}
+	}
+
+	bloom_destroy(&bf);
+	archbloom_set_pages(ARCHBLOOM_PAGES_DEFAULT);
+
+	archbloom_alloc_get_stats(&after);
+	if (after.heap != before.heap || after.transparent != before.transparent || after.huge != before.huge) {
+		fprintf(stderr, "FAILURE: bitmap on %s pages not freed\n", names[mode]);
+		return false;
+	}
+
+	return true;
+}
+
+int main() {
+	printf("testing filter allocation\n");
+
+	if (!test_alignment() || !test_hooks() || !test_realloc()) {
+		return EXIT_FAILURE;
+	}
+
+	for (archbloom_pages mode = ARCHBLOOM_PAGES_DEFAULT; mode <= ARCHBLOOM_PAGES_1GB; mode++) {
+		if (!test_pages(mode)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+/* test_bbloom_basic.c -- tests for blocked bloom filters
+ *
+ * Also prints a false positive rate vs. memory comparison against the
+ * classic bloom filter.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "bbloom.h"
+#include "bloom.h"
+
+/* compare measured false positive rates of classic and blocked filters
+ * built with the same parameters.
+ */
+static int compare_fpr(size_t expected, float accuracy) {
+	bloomfilter  bf;
+	bbloomfilter bbf;
+	char         buf[64];
+	size_t       bf_fp = 0, bbf_fp = 0;
+	size_t       queries = expected * 10;
+
+	if (bloom_init(&bf, expected, accuracy) != BF_SUCCESS ||
+		bbloom_init(&bbf, expected, accuracy) != BBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: unable to initialize filters\n");
+		return -1;
+	}
+
+	for (size_t i = 0; i < expected; i++) {
+		snprintf(buf, sizeof(buf), "member-%zu", i);
+		bloom_add_string(&bf, buf);
+		bbloom_add_string(&bbf, buf);
+	}
+
+	for (size_t i = 0; i < expected; i++) {
+		snprintf(buf, sizeof(buf), "member-%zu", i);
+		if (bbloom_lookup_string(&bbf, buf) != true) {
+			fprintf(stderr, "FAILURE: false negative for %s\n", buf);
+			return -1;
+		}
+	}
+
+	for (size_t i = 0; i < queries; i++) {
+		snprintf(buf, sizeof(buf), "nonmember-%zu", i);
+		bf_fp  += bloom_lookup_string(&bf, buf);
+		bbf_fp += bbloom_lookup_string(&bbf, buf);
+	}
+
+	float bf_rate  = (float)bf_fp / queries;
+	float bbf_rate = (float)bbf_fp / queries;
+
+	printf("%10zu %8.4f | classic %10zu bytes k=%2zu fpr %.5f | blocked %10zu bytes k=%2zu fpr %.5f\n",
+		   expected, accuracy,
+		   bf.bitmap_size, bf.hashcount, bf_rate,
+		   bbf.bitmap_size, bbf.hashcount, bbf_rate);
+
+	// blocked filters pay for locality with a somewhat higher false
+	// positive rate; make sure it stays in the same ballpark.
+	if (bbf_rate > accuracy * 5) {
+		fprintf(stderr, "FAILURE: blocked fpr %f too far above target %f\n",
+				bbf_rate, accuracy);
+		return -1;
+	}
+
+	bloom_destroy(&bf);
+	bbloom_destroy(&bbf);
+
+	return 0;
+}
+
+int main() {
+	bbloomfilter bbf;
+	bool         result;
+
+	puts("Initializing blocked filter with 1000 expected elements and 99.99% accuracy\n");
+	if (bbloom_init(&bbf, 1000, 0.01) != BBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bbloom_init()\n");
+		return EXIT_FAILURE;
+	}
+	printf("size: %zu\n", bbf.size);
+	printf("blocks: %zu\n", bbf.blocks);
+	printf("hashcount: %zu\n", bbf.hashcount);
+	printf("bitmap size: %zu\n", bbf.bitmap_size);
+
+	if (((uintptr_t)bbf.bitmap % BBLOOM_BLOCK_SIZE) != 0) {
+		fprintf(stderr, "FAILURE: bitmap is not block aligned\n");
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(bbloom_strerror(BBF_SUCCESS), "Success") != 0 ||
+		strcmp(bbloom_strerror(1000000), "Unknown error") != 0) {
+		fprintf(stderr, "FAILURE: bbloom_strerror()\n");
+		return EXIT_FAILURE;
+	}
+
+	bbloom_add(&bbf, "asdf", strlen("asdf"));
+	bbloom_add_string(&bbf, "foo");
+	bbloom_add_string(&bbf, "bar");
+
+	if (bbloom_lookup_string(&bbf, "foo") != true ||
+		bbloom_lookup_string(&bbf, "bar") != true ||
+		bbloom_lookup_string(&bbf, "asdf") != true) {
+		fprintf(stderr, "FAILURE: added elements should be in filter\n");
+		return EXIT_FAILURE;
+	}
+
+	if (bbloom_lookup_string(&bbf, "baz") != false) {
+		fprintf(stderr, "FAILURE: \"baz\" should NOT be in filter\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("testing bbloom_lookup_or_add()\n");
+	result = bbloom_lookup_or_add_string(&bbf, "asdf");
+	if (result != true) {
+		fprintf(stderr, "FAILURE: \"asdf\" should be in filter\n");
+		return EXIT_FAILURE;
+	}
+
+	result = bbloom_lookup_or_add_string(&bbf, "asdfasdf");
+	if (result != false || bbloom_lookup_string(&bbf, "asdfasdf") != true) {
+		fprintf(stderr, "FAILURE: \"asdfasdf\" should have been added\n");
+		return EXIT_FAILURE;
+	}
+
+	// saturation: one element sets at most hashcount bits
+	bbloom_clear(&bbf);
+	bbloom_add_string(&bbf, "saturation");
+	size_t saturation = bbloom_saturation_count(&bbf);
+	printf("saturation after one record added: %zu. hashcount %zu\n",
+		   saturation, bbf.hashcount);
+	if (saturation != bbf.hashcount) {
+		fprintf(stderr, "FAILURE: saturation should equal hashcount\n");
+		return EXIT_FAILURE;
+	}
+
+	// save/load round trip
+	char tmp_file_name[] = "/tmp/bbloom.XXXXXX";
+	int fd = mkstemp(tmp_file_name);
+	if (fd == -1) {
+		fprintf(stderr, "FAILURE: unable to create tmp file: %s -- %s\n",
+				tmp_file_name,
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+	bbloom_set_name(&bbf, "blocked");
+	printf("attempting to save filter to %s\n", tmp_file_name);
+	if (bbloom_save_fd(&bbf, fd) != BBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bbloom_save_fd()\n");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	bbloomfilter loaded;
+	bbloom_error_t error = bbloom_load(&loaded, tmp_file_name);
+	if (error != BBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bbloom_load(): %s\n", bbloom_strerror(error));
+		return EXIT_FAILURE;
+	}
+
+	if (loaded.size != bbf.size ||
+		loaded.hashcount != bbf.hashcount ||
+		strcmp(bbloom_get_name(&loaded), "blocked") != 0 ||
+		memcmp(loaded.bitmap, bbf.bitmap, bbf.bitmap_size) != 0 ||
+		bbloom_lookup_string(&loaded, "saturation") != true) {
+		fprintf(stderr, "FAILURE: loaded filter does not match saved filter\n");
+		return EXIT_FAILURE;
+	}
+
+	bbloom_destroy(&loaded);
+
+	error = bbloom_map(&loaded, tmp_file_name, false);
+	if (error != BBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bbloom_map(): %s\n", bbloom_strerror(error));
+		return EXIT_FAILURE;
+	}
+
+	if (((uintptr_t)loaded.bitmap % 64) != 0 ||
+		memcmp(loaded.bitmap, bbf.bitmap, bbf.bitmap_size) != 0 ||
+		bbloom_lookup_string(&loaded, "saturation") != true) {
+		fprintf(stderr, "FAILURE: mapped filter does not match saved filter\n");
+		return EXIT_FAILURE;
+	}
+
+	bbloom_destroy(&loaded);
+	bbloom_destroy(&bbf);
+	remove(tmp_file_name);
+
+	// a file that isn't a blocked bloom filter should be rejected
+	char bad_file_name[] = "/tmp/bbloom-bad.XXXXXX";
+	fd = mkstemp(bad_file_name);
+	if (fd == -1 || write(fd, "!bloomf!", 8) != 8) {
+		fprintf(stderr, "FAILURE: unable to create tmp file\n");
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	error = bbloom_load(&loaded, bad_file_name);
+	remove(bad_file_name);
+	if (error == BBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bbloom_load() accepted an invalid file\n");
+		return EXIT_FAILURE;
+	}
+
+	// false positive rate vs. memory, classic vs. blocked
+	printf("\n  expected accuracy | classic vs. blocked\n");
+	size_t sizes[]      = {1000, 10000, 100000};
+	float  accuracies[] = {0.1, 0.01, 0.001};
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (size_t j = 0; j < sizeof(accuracies) / sizeof(accuracies[0]); j++) {
+			if (compare_fpr(sizes[i], accuracies[j]) != 0) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/* test_bitops_basic.c -- check every bitops implementation supported
+ * by this CPU against a byte at a time reference, then print their
+ * throughput.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitops.h"
+
+#define BUFFER_SIZE 4096
+
+static size_t ref_popcount(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		for (int b = 0; b < 8; b++) {
+			count += (buf[i] >> b) & 1;
+		}
+	}
+
+	return count;
+}
+
+static size_t ref_nonzero_bytes(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		count += (buf[i] != 0);
+	}
+
+	return count;
+}
+
+static size_t ref_nonzero_nibbles(const uint8_t *buf, const size_t len) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		count += ((buf[i] & 0x0f) != 0) + ((buf[i] >> 4) != 0);
+	}
+
+	return count;
+}
+
+// fill a buffer with sparse and dense stretches, so counters are both zero and not
+static void fill(uint8_t *buf, const size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = ((i / 64) % 2) ? (uint8_t)rand() : ((rand() % 4 == 0) ? (uint8_t)(1 << (rand() % 8)) : 0);
+	}
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+int main() {
+	uint8_t a[BUFFER_SIZE + 1], b[BUFFER_SIZE + 1];
+	uint8_t dst[BUFFER_SIZE + 1], expected[BUFFER_SIZE + 1];
+
+	srand(1);
+	fill(a, sizeof(a));
+	fill(b, sizeof(b));
+
+	printf("default implementation: %s\n", bitops_kernel_name(bitops_get_kernel()));
+
+	for (int k = 0; k < BITOPS_KERNELCOUNT; k++) {
+		if (bitops_set_kernel(k) == false) {
+			printf("%s: not supported\n", bitops_kernel_name(k));
+			continue;
+		}
+
+		printf("testing %s\n", bitops_kernel_name(k));
+
+		// every length up to a few vectors, aligned and not
+		for (size_t offset = 0; offset < 2; offset++) {
+			for (size_t len = 0; len <= 300; len++) {
+				const uint8_t *pa = a + offset;
+				const uint8_t *pb = b + offset;
+
+				if (bitops_popcount(pa, len) != ref_popcount(pa, len)) {
+					fprintf(stderr, "FAILURE: %s bitops_popcount() len %zu\n", bitops_kernel_name(k), len);
+					return EXIT_FAILURE;
+				}
+
+				if (bitops_nonzero_bytes(pa, len) != ref_nonzero_bytes(pa, len) ||
+					bitops_nonzero_nibbles(pa, len) != ref_nonzero_nibbles(pa, len)) {
+					fprintf(stderr, "FAILURE: %s bitops_nonzero_*() len %zu\n", bitops_kernel_name(k), len);
+					return EXIT_FAILURE;
+				}
+
+				size_t and_count = 0, or_count = 0;
+				bitops_popcount_and_or(pa, pb, len, &and_count, &or_count);
+
+				for (size_t i = 0; i < len; i++) {
+					expected[i] = pa[i] & pb[i];
+				}
+				bitops_and(dst, pa, pb, len);
+				if (memcmp(dst, expected, len) != 0 || and_count != ref_popcount(expected, len)) {
+					fprintf(stderr, "FAILURE: %s bitops_and() len %zu\n", bitops_kernel_name(k), len);
+					return EXIT_FAILURE;
+				}
+
+				for (size_t i = 0; i < len; i++) {
+					expected[i] = pa[i] | pb[i];
+				}
+				bitops_or(dst, pa, pb, len);
+				if (memcmp(dst, expected, len) != 0 || or_count != ref_popcount(expected, len)) {
+					fprintf(stderr, "FAILURE: %s bitops_or() len %zu\n", bitops_kernel_name(k), len);
+					return EXIT_FAILURE;
+				}
+			}
+		}
+
+		// throughput
+		size_t iterations = 20000;
+		size_t total      = 0;
+		double start      = now();
+
+		for (size_t i = 0; i < iterations; i++) {
+			total += bitops_popcount(a, BUFFER_SIZE);
+			a[i % BUFFER_SIZE] ^= (uint8_t)total; // keep the compiler honest
+		}
+
+		double elapsed = now() - start;
+		printf("%s: bitops_popcount() %.2f GB/s\n",
+			   bitops_kernel_name(k),
+			   (iterations * (double)BUFFER_SIZE) / elapsed / 1e9);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
@@ -10,6 +11,73 @@
 #include "bloom.h"
 
 
+/* check_compressed() -- save `count` elements of a filter with
+ * bloom_save_compressed() and load them back. Returns the size of the
+ * file, or 0 on failure.
+ */
+static size_t check_compressed(bloomfilter *bf, const size_t count) {
+	bloomfilter loaded, mapped;
+	char        path[] = "/tmp/bloom-compressed.XXXXXX";
+	char        key[32];
+	struct stat sb;
+	int         fd;
+
+	for (size_t i = 0; i < count; i++) {
+		snprintf(key, sizeof(key), "compressed-%zu", i);
+		bloom_add_string(bf, key);
+	}
+
+	fd = mkstemp(path);
+	if (fd == -1 || bloom_save_compressed_fd(bf, fd) != BF_SUCCESS || fstat(fd, &sb) == -1) {
+		fprintf(stderr, "FAILURE: bloom_save_compressed_fd()\n");
+		return 0;
+	}
+	close(fd);
+
+	if ((size_t)sb.st_size != bloom_compressed_size(bf)) {
+		fprintf(stderr, "FAILURE: bloom_compressed_size() %zu, file is %zu bytes\n",
+				bloom_compressed_size(bf), (size_t)sb.st_size);
+		return 0;
+	}
+
+	if (bloom_load(&loaded, path) != BF_SUCCESS ||
+		loaded.size != bf->size ||
+		loaded.hashcount != bf->hashcount ||
+		memcmp(loaded.bitmap, bf->bitmap, bf->bitmap_size) != 0) {
+		fprintf(stderr, "FAILURE: bloom_load() of a compressed filter\n");
+		return 0;
+	}
+	bloom_destroy(&loaded);
+
+	fd = open(path, O_RDONLY);
+	if (bloom_load_fd(&loaded, fd) != BF_SUCCESS ||
+		memcmp(loaded.bitmap, bf->bitmap, bf->bitmap_size) != 0) {
+		fprintf(stderr, "FAILURE: bloom_load_fd() of a compressed filter\n");
+		return 0;
+	}
+	close(fd);
+	bloom_destroy(&loaded);
+
+	// compressed files can't be mapped, raw ones can
+	bool raw = (size_t)sb.st_size == sizeof(bloomfilter_file) + bf->bitmap_size;
+	if ((bloom_map(&mapped, path, false) == BF_SUCCESS) != raw) {
+		fprintf(stderr, "FAILURE: bloom_map() of a compressed filter\n");
+		return 0;
+	}
+	if (raw) {
+		bloom_destroy(&mapped);
+	}
+
+	if (truncate(path, sb.st_size - 1) != 0 || bloom_load(&loaded, path) != BF_INVALIDFILE) {
+		fprintf(stderr, "FAILURE: truncated compressed filter should not load\n");
+		return 0;
+	}
+
+	remove(path);
+
+	return sb.st_size;
+}
+
 int main() {
 	bloomfilter bf;
 
@@ -146,6 +214,45 @@ int main() {
 		return EXIT_FAILURE;
 	}
 
+	// map the saved filter instead of loading it
+	printf("attempting to map %s read only\n", tmp_file_name);
+	bloomfilter mapped;
+	bloom_error_t map_error = bloom_map(&mapped, tmp_file_name, false);
+	if (map_error != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_map(): %s\n", bloom_strerror(map_error));
+		return EXIT_FAILURE;
+	}
+
+	if (((uintptr_t)mapped.bitmap % 64) != 0 ||
+		mapped.size != newbloom.size ||
+		memcmp(mapped.bitmap, newbloom.bitmap, newbloom.bitmap_size) != 0 ||
+		bloom_lookup_string(&mapped, "foo") != true ||
+		bloom_lookup_string(&mapped, "baz") != false) {
+		fprintf(stderr, "FAILURE: mapped filter does not match saved filter\n");
+		return EXIT_FAILURE;
+	}
+	bloom_destroy(&mapped);
+	if (mapped.map != NULL || mapped.bitmap != NULL) {
+		fprintf(stderr, "FAILURE: bloom_destroy() did not unmap the filter\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("attempting to map %s writable\n", tmp_file_name);
+	map_error = bloom_map(&mapped, tmp_file_name, true);
+	if (map_error != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_map(): %s\n", bloom_strerror(map_error));
+		return EXIT_FAILURE;
+	}
+	bloom_add_string(&mapped, "baz");
+	bloom_destroy(&mapped);
+
+	map_error = bloom_map(&mapped, tmp_file_name, false);
+	if (map_error != BF_SUCCESS || bloom_lookup_string(&mapped, "baz") != true) {
+		fprintf(stderr, "FAILURE: \"baz\" should be in re-mapped filter\n");
+		return EXIT_FAILURE;
+	}
+	bloom_destroy(&mapped);
+
 	// Load from file
 	printf("attempting to load a file with bad permissions\n");
 	bloomfilter bad_permissions;
@@ -344,6 +451,256 @@ int main() {
 		return EXIT_FAILURE;
 	}
 
+	// batch functions
+	printf("testing bloom_add_batch(), bloom_lookup_batch()\n");
+	bloomfilter batch;
+	char        batch_keys[100][16];
+	const void *batch_elements[100];
+	size_t      batch_lens[100];
+	uint8_t     batch_results[(100 + 7) / 8];
+
+	bloom_init(&batch, 1000, 0.01);
+	for (size_t i = 0; i < 100; i++) {
+		snprintf(batch_keys[i], sizeof(batch_keys[i]), "batch-%zu", i);
+		batch_elements[i] = batch_keys[i];
+		batch_lens[i]     = strlen(batch_keys[i]);
+	}
+
+	bloom_add_batch(&batch, batch_elements, batch_lens, 50);
+	bloom_lookup_batch(&batch, batch_elements, batch_lens, 100, batch_results);
+	for (size_t i = 0; i < 100; i++) {
+		if (BLOOM_BATCH_RESULT(batch_results, i) != bloom_lookup_string(&batch, batch_keys[i]) ||
+			(i < 50 && BLOOM_BATCH_RESULT(batch_results, i) != 1)) {
+			fprintf(stderr, "FAILURE: bloom_lookup_batch() result %zu is wrong\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// duplicates within a batch are reported as present after the first
+	printf("testing bloom_lookup_or_add_batch()\n");
+	bloom_clear(&batch);
+	batch_elements[1] = batch_elements[0];
+	batch_lens[1]     = batch_lens[0];
+	bloom_lookup_or_add_batch(&batch, batch_elements, batch_lens, 100, batch_results);
+	if (BLOOM_BATCH_RESULT(batch_results, 0) != 0 ||
+		BLOOM_BATCH_RESULT(batch_results, 1) != 1) {
+		fprintf(stderr, "FAILURE: bloom_lookup_or_add_batch() duplicate handling\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 2; i < 100; i++) {
+		if (bloom_lookup_string(&batch, batch_keys[i]) != true) {
+			fprintf(stderr, "FAILURE: \"%s\" should be in filter\n", batch_keys[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	bloom_destroy(&batch);
+
+	// hash to position mappings, each with a different hash strategy
+	uint32_t  mapping_flags[] = {BLOOM_FLAG_POW2, BLOOM_FLAG_FASTRANGE};
+	char      key[32];
+
+	for (size_t m = 0; m < sizeof(mapping_flags) / sizeof(mapping_flags[0]); m++) {
+		bloomfilter mapped, mapped_loaded;
+		size_t      false_positives = 0;
+
+		printf("testing bloom_init_flags() with flags 0x%02x\n", mapping_flags[m]);
+		if (bloom_init_flags(&mapped, 1000, 0.01, mapping_flags[m]) != BF_SUCCESS) {
+			fprintf(stderr, "FAILURE: bloom_init_flags()\n");
+			return EXIT_FAILURE;
+		}
+
+		if ((mapped.flags & BLOOM_FLAG_POW2) && (mapped.size & (mapped.size - 1)) != 0) {
+			fprintf(stderr, "FAILURE: size %zu is not a power of two\n", mapped.size);
+			return EXIT_FAILURE;
+		}
+
+		hash_strategy strategy = (hash_strategy)((m + 1) % HASH_STRATEGYCOUNT);
+		if (mapped.hash != HASH_MMH3 ||
+			bloom_set_hash(&mapped, HASH_STRATEGYCOUNT) != false ||
+			bloom_set_hash(&mapped, strategy) != true) {
+			fprintf(stderr, "FAILURE: bloom_set_hash(%s)\n", hash_strategy_name(strategy));
+			return EXIT_FAILURE;
+		}
+
+		for (size_t i = 0; i < 1000; i++) {
+			snprintf(key, sizeof(key), "mapped-%zu", i);
+			bloom_add_string(&mapped, key);
+		}
+
+		for (size_t i = 0; i < 1000; i++) {
+			snprintf(key, sizeof(key), "mapped-%zu", i);
+			if (bloom_lookup_string(&mapped, key) != true) {
+				fprintf(stderr, "FAILURE: \"%s\" should be in filter\n", key);
+				return EXIT_FAILURE;
+			}
+		}
+
+		for (size_t i = 0; i < 10000; i++) {
+			snprintf(key, sizeof(key), "unmapped-%zu", i);
+			false_positives += bloom_lookup_string(&mapped, key);
+		}
+		printf("size: %zu, hash: %s, false positive rate: %f\n",
+			   mapped.size, hash_strategy_name(mapped.hash), false_positives / 10000.0);
+		if (false_positives > 10000 * 0.01 * 3) {
+			fprintf(stderr, "FAILURE: false positive rate too high\n");
+			return EXIT_FAILURE;
+		}
+
+		if (bloom_set_hash(&mapped, HASH_MMH3) != false) {
+			fprintf(stderr, "FAILURE: bloom_set_hash() should fail on a filter with elements\n");
+			return EXIT_FAILURE;
+		}
+
+		// flags and hash must survive a save and load
+		char mapped_file_name[] = "/tmp/bloom-mapped.XXXXXX";
+		int  mapped_fd          = mkstemp(mapped_file_name);
+		if (mapped_fd == -1 || bloom_save_fd(&mapped, mapped_fd) != BF_SUCCESS) {
+			fprintf(stderr, "FAILURE: unable to save filter to %s\n", mapped_file_name);
+			return EXIT_FAILURE;
+		}
+		close(mapped_fd);
+
+		if (bloom_load(&mapped_loaded, mapped_file_name) != BF_SUCCESS ||
+			mapped_loaded.flags != mapping_flags[m] ||
+			mapped_loaded.hash != strategy) {
+			fprintf(stderr, "FAILURE: bloom_load() did not restore flags\n");
+			return EXIT_FAILURE;
+		}
+
+		bloomfilter file_mapped;
+		if (bloom_map(&file_mapped, mapped_file_name, false) != BF_SUCCESS ||
+			file_mapped.hash != strategy ||
+			bloom_lookup_string(&file_mapped, "mapped-0") != true) {
+			fprintf(stderr, "FAILURE: bloom_map() did not restore the hash strategy\n");
+			return EXIT_FAILURE;
+		}
+		bloom_destroy(&file_mapped);
+		remove(mapped_file_name);
+
+		// filters with different hashes can't be combined
+		bloomfilter other, combined;
+		bloom_init_flags(&other, 1000, 0.01, mapping_flags[m]);
+		if (bloom_merge(&combined, &mapped, &other) != BF_INVALIDFILE ||
+			bloom_estimate_intersection(&mapped, &other) != -1.0f) {
+			fprintf(stderr, "FAILURE: combined filters with different hash strategies\n");
+			return EXIT_FAILURE;
+		}
+		bloom_destroy(&other);
+
+		for (size_t i = 0; i < 1000; i++) {
+			snprintf(key, sizeof(key), "mapped-%zu", i);
+			if (bloom_lookup_string(&mapped_loaded, key) != true) {
+				fprintf(stderr, "FAILURE: \"%s\" should be in loaded filter\n", key);
+				return EXIT_FAILURE;
+			}
+		}
+
+		bloom_destroy(&mapped);
+		bloom_destroy(&mapped_loaded);
+	}
+
+	// compressed filters
+	printf("testing bloom_save_compressed(), bloom_init_compressible()\n");
+	bloomfilter sparse, full, compressible;
+	size_t      raw_size = 0;
+
+	bloom_init(&sparse, 10000, 0.01);
+	size_t sparse_size = check_compressed(&sparse, 200);
+	raw_size = sizeof(bloomfilter_file) + sparse.bitmap_size;
+	printf("2%% loaded filter: %zu bytes compressed, %zu raw\n", sparse_size, raw_size);
+	if (sparse_size == 0 || sparse_size > raw_size / 4) {
+		fprintf(stderr, "FAILURE: sparse filter compressed to %zu bytes\n", sparse_size);
+		return EXIT_FAILURE;
+	}
+
+	// a full filter has half of its bits set and is saved raw
+	bloom_init(&full, 10000, 0.01);
+	if (check_compressed(&full, 10000) != raw_size) {
+		fprintf(stderr, "FAILURE: full filter should be saved raw\n");
+		return EXIT_FAILURE;
+	}
+
+	bloom_init_compressible(&compressible, 10000, 0.01, 4.0);
+	size_t compressible_size = check_compressed(&compressible, 10000);
+	size_t false_positives   = 0;
+	for (size_t i = 0; i < 100000; i++) {
+		char key[32];
+		snprintf(key, sizeof(key), "absent-%zu", i);
+		false_positives += bloom_lookup_string(&compressible, key);
+	}
+	printf("compressible filter: %zu bits, %zu hashes, %zu bytes compressed, false positive rate %f\n",
+		   compressible.size, compressible.hashcount, compressible_size, false_positives / 100000.0);
+	if (compressible_size == 0 ||
+		compressible_size >= raw_size ||
+		compressible.size <= full.size ||
+		compressible.size > full.size * 4 ||
+		compressible.hashcount >= full.hashcount ||
+		false_positives > 100000 * 0.01 * 1.5) {
+		fprintf(stderr, "FAILURE: bloom_init_compressible() filter is no better than bloom_init()\n");
+		return EXIT_FAILURE;
+	}
+
+	bloom_destroy(&sparse);
+	bloom_destroy(&full);
+	bloom_destroy(&compressible);
+
+	// bloom_fold() for each hash mapping
+	printf("testing bloom_fold()\n");
+	uint32_t fold_flags[] = {0, BLOOM_FLAG_POW2, BLOOM_FLAG_FASTRANGE};
+	for (size_t f = 0; f < sizeof(fold_flags) / sizeof(fold_flags[0]); f++) {
+		bloomfilter folded, folded_loaded;
+		char        key[32];
+
+		// 9604 bits halves twice to 2401
+		bloom_init_flags(&folded, 1002, 0.01, fold_flags[f]);
+		for (size_t i = 0; i < 500; i++) {
+			snprintf(key, sizeof(key), "fold-%zu", i);
+			bloom_add_string(&folded, key);
+		}
+
+		size_t unfolded_size = folded.size;
+		float  unfolded_rate = bloom_estimate_false_positive_rate(&folded);
+		if (bloom_fold(&folded, 2) != BF_SUCCESS ||
+			folded.size != unfolded_size / 4 ||
+			folded.bitmap_size != (folded.size + 7) / 8) {
+			fprintf(stderr, "FAILURE: bloom_fold() with flags 0x%02x\n", fold_flags[f]);
+			return EXIT_FAILURE;
+		}
+		printf("folded %zu bits to %zu, estimated false positive rate %f -> %f\n",
+			   unfolded_size, folded.size, unfolded_rate, bloom_estimate_false_positive_rate(&folded));
+
+		for (size_t i = 0; i < 500; i++) {
+			snprintf(key, sizeof(key), "fold-%zu", i);
+			if (!bloom_lookup_string(&folded, key)) {
+				fprintf(stderr, "FAILURE: \"%s\" should be in the folded filter\n", key);
+				return EXIT_FAILURE;
+			}
+		}
+
+		if (bloom_estimate_false_positive_rate(&folded) <= unfolded_rate) {
+			fprintf(stderr, "FAILURE: folding should raise the false positive rate\n");
+			return EXIT_FAILURE;
+		}
+
+		if (fold_flags[f] == 0 && bloom_fold(&folded, 1) != BF_INVALIDPARAM) {
+			fprintf(stderr, "FAILURE: bloom_fold() halved an odd sized filter\n");
+			return EXIT_FAILURE;
+		}
+
+		if (bloom_save(&folded, tmp_file_name) != BF_SUCCESS ||
+			bloom_load(&folded_loaded, tmp_file_name) != BF_SUCCESS ||
+			folded_loaded.size != folded.size ||
+			folded_loaded.flags != folded.flags ||
+			bloom_saturation_count(&folded_loaded) != bloom_saturation_count(&folded) ||
+			!bloom_lookup_string(&folded_loaded, "fold-499")) {
+			fprintf(stderr, "FAILURE: folded filter did not save and load\n");
+			return EXIT_FAILURE;
+		}
+
+		bloom_destroy(&folded);
+		bloom_destroy(&folded_loaded);
+	}
+
 	// Cleanup
 	bloom_destroy(&newbloom);
 	remove(tmp_file_name);
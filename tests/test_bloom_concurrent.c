@@ -0,0 +1,174 @@
+/* test_bloom_concurrent.c -- BLOOM_FLAG_CONCURRENT filters shared
+ * between threads.
+ *
+ * Checks that concurrent bloom_lookup_or_add() reports each new
+ * element as new exactly once, then prints add throughput of a
+ * concurrent filter versus a plain filter wrapped in a mutex.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "bloom.h"
+
+#define KEY_COUNT   100000
+#define MAX_THREADS 8
+
+static char     keys[KEY_COUNT][16];
+static uint32_t new_counts[KEY_COUNT];
+
+static pthread_mutex_t filter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	bloomfilter *bf;
+	size_t       thread;
+	size_t       threads;
+} worker_args;
+
+// every thread offers every key, starting at a different point
+static void *lookup_or_add_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		size_t key = (i + (args->thread * KEY_COUNT / args->threads)) % KEY_COUNT;
+
+		if (bloom_lookup_or_add_string(args->bf, keys[key]) == false) {
+			__atomic_fetch_add(&new_counts[key], 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	return NULL;
+}
+
+// each thread adds its share of the keys
+static void *add_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = args->thread; i < KEY_COUNT; i += args->threads) {
+		bloom_add_string(args->bf, keys[i]);
+	}
+
+	return NULL;
+}
+
+static void *locked_add_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = args->thread; i < KEY_COUNT; i += args->threads) {
+		pthread_mutex_lock(&filter_lock);
+		bloom_add_string(args->bf, keys[i]);
+		pthread_mutex_unlock(&filter_lock);
+	}
+
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// run `worker` on `threads` threads against `bf`, returning elapsed seconds
+static double run_threads(bloomfilter *bf, void *(*worker)(void *), const size_t threads) {
+	pthread_t   tids[MAX_THREADS];
+	worker_args args[MAX_THREADS];
+	double      start = now();
+
+	for (size_t t = 0; t < threads; t++) {
+		args[t] = (worker_args){ .bf = bf, .thread = t, .threads = threads };
+		if (pthread_create(&tids[t], NULL, worker, &args[t]) != 0) {
+			fprintf(stderr, "FAILURE: pthread_create()\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (size_t t = 0; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+
+	return now() - start;
+}
+
+int main() {
+	bloomfilter bf, serial;
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "key-%zu", i);
+	}
+
+	// bloom_lookup_or_add() from many threads
+	printf("testing bloom_lookup_or_add() from %d threads\n", MAX_THREADS);
+	if (bloom_init_flags(&bf, KEY_COUNT, 0.01, BLOOM_FLAG_CONCURRENT) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_init_flags()\n");
+		return EXIT_FAILURE;
+	}
+
+	run_threads(&bf, lookup_or_add_worker, MAX_THREADS);
+
+	size_t added = 0;
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		if (new_counts[i] > 1) {
+			fprintf(stderr, "FAILURE: \"%s\" was added %u times\n", keys[i], new_counts[i]);
+			return EXIT_FAILURE;
+		}
+
+		if (bloom_lookup_string(&bf, keys[i]) != true) {
+			fprintf(stderr, "FAILURE: \"%s\" should be in filter\n", keys[i]);
+			return EXIT_FAILURE;
+		}
+
+		added += new_counts[i];
+	}
+
+	// keys reported as present on first sight are false positives
+	printf("%zu of %d keys reported as new\n", added, KEY_COUNT);
+	if (added < KEY_COUNT * 0.95) {
+		fprintf(stderr, "FAILURE: too few keys reported as new\n");
+		return EXIT_FAILURE;
+	}
+
+	// a concurrent filter has the same layout as a plain one
+	if (bloom_init(&serial, KEY_COUNT, 0.01) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_init()\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		bloom_add_string(&serial, keys[i]);
+	}
+
+	if (memcmp(serial.bitmap, bf.bitmap, bf.bitmap_size) != 0) {
+		fprintf(stderr, "FAILURE: concurrent and serial bitmaps differ\n");
+		return EXIT_FAILURE;
+	}
+
+	bloom_destroy(&serial);
+	bloom_destroy(&bf);
+
+	// throughput
+	printf("\nthreads | concurrent adds/sec | mutex adds/sec\n");
+	for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		double concurrent_time, locked_time;
+
+		bloom_init_flags(&bf, KEY_COUNT, 0.01, BLOOM_FLAG_CONCURRENT);
+		concurrent_time = run_threads(&bf, add_worker, threads);
+		bloom_destroy(&bf);
+
+		bloom_init(&bf, KEY_COUNT, 0.01);
+		locked_time = run_threads(&bf, locked_add_worker, threads);
+		bloom_destroy(&bf);
+
+		printf("%7zu | %19.0f | %14.0f\n",
+			   threads,
+			   KEY_COUNT / concurrent_time,
+			   KEY_COUNT / locked_time);
+	}
+
+	return EXIT_SUCCESS;
+}
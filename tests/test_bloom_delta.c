@@ -0,0 +1,241 @@
+/* test_bloom_delta.c -- BLOOM_FLAG_TRACK_DIRTY filters and deltas.
+ *
+ * Checks that deltas bring a copy of a filter, and a filter merging
+ * several, up to date, that they only grow with the number of changed
+ * blocks, and that incompatible or truncated deltas are rejected.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bloom.h"
+
+#define EXPECTED 1000000
+#define ACCURACY 0.01
+
+static void add_keys(bloomfilter *bf, const char *prefix, const size_t first, const size_t count) {
+	char key[32];
+
+	for (size_t i = first; i < first + count; i++) {
+		snprintf(key, sizeof(key), "%s%zu", prefix, i);
+		bloom_add_string(bf, key);
+	}
+}
+
+/* delta() -- save a delta of `from` and apply it to `to`. Returns the
+ * size of the delta in bytes, or 0 on failure.
+ */
+static size_t delta(bloomfilter *from, bloomfilter *to) {
+	FILE   *fp = tmpfile();
+	int     fd = fileno(fp);
+	size_t  dirty = bloom_dirty_count(from);
+	bool    exact = (from->flags & BLOOM_FLAG_CONCURRENT) == 0;
+	off_t   size;
+
+	if (bloom_save_delta_fd(from, fd) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_save_delta_fd()\n");
+		fclose(fp);
+		return 0;
+	}
+
+	// the blocks, plus a map of where they go that costs a few bits
+	// each. concurrent filters may have been added to meanwhile.
+	size = lseek(fd, 0, SEEK_CUR);
+	if (exact &&
+		(size < (off_t)(sizeof(bloomfilter_delta) + (dirty * BLOOM_DELTA_BLOCK_SIZE)) ||
+		 size > (off_t)(sizeof(bloomfilter_delta) + 64 + (dirty * (BLOOM_DELTA_BLOCK_SIZE + 8))))) {
+		fprintf(stderr, "FAILURE: %zu dirty blocks in a %ld byte delta\n", dirty, (long)size);
+		fclose(fp);
+		return 0;
+	}
+
+	if (exact && bloom_dirty_count(from) != 0) {
+		fprintf(stderr, "FAILURE: saving a delta did not checkpoint\n");
+		fclose(fp);
+		return 0;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	if (bloom_apply_delta_fd(to, fd) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_apply_delta_fd()\n");
+		fclose(fp);
+		return 0;
+	}
+
+	fclose(fp);
+
+	return size;
+}
+
+static void *add_worker(void *arg) {
+	add_keys(arg, "thread", 0, EXPECTED / 4);
+
+	return NULL;
+}
+
+static bool same_bitmap(const bloomfilter *a, const bloomfilter *b) {
+	return a->bitmap_size == b->bitmap_size && memcmp(a->bitmap, b->bitmap, a->bitmap_size) == 0;
+}
+
+int main() {
+	bloomfilter source, replica, other, aggregate, merged, small;
+	size_t      size;
+
+	printf("testing bloom_save_delta_fd(), bloom_apply_delta_fd()\n");
+
+	if (bloom_init_flags(&source, EXPECTED, ACCURACY, BLOOM_FLAG_TRACK_DIRTY) != BF_SUCCESS ||
+		bloom_init(&replica, EXPECTED, ACCURACY) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_init_flags()\n");
+		return EXIT_FAILURE;
+	}
+
+	// a filter that isn't tracked has no delta
+	if (bloom_save_delta_fd(&replica, STDOUT_FILENO) != BF_NOTTRACKED) {
+		fprintf(stderr, "FAILURE: saved a delta of an untracked filter\n");
+		return EXIT_FAILURE;
+	}
+
+	// the first delta covers everything since the filter was created
+	add_keys(&source, "key", 0, EXPECTED / 2);
+	if (delta(&source, &replica) == 0 || !same_bitmap(&source, &replica)) {
+		fprintf(stderr, "FAILURE: replica differs after the first delta\n");
+		return EXIT_FAILURE;
+	}
+
+	// elements already present change nothing
+	add_keys(&source, "key", 0, 1000);
+	if (bloom_dirty_count(&source) != 0) {
+		fprintf(stderr, "FAILURE: %zu blocks dirty after adding nothing new\n",
+				bloom_dirty_count(&source));
+		return EXIT_FAILURE;
+	}
+
+	// a little churn costs a little
+	add_keys(&source, "new", 0, 1000);
+	if (bloom_dirty_count(&source) > 1000 * source.hashcount) {
+		fprintf(stderr, "FAILURE: 1000 elements dirtied %zu blocks\n", bloom_dirty_count(&source));
+		return EXIT_FAILURE;
+	}
+
+	size = delta(&source, &replica);
+	printf("1000 new elements: %zu byte delta, %zu byte bitmap\n", size, source.bitmap_size);
+	if (size == 0 || size > source.bitmap_size / 10 || !same_bitmap(&source, &replica)) {
+		fprintf(stderr, "FAILURE: replica differs after a small delta\n");
+		return EXIT_FAILURE;
+	}
+
+	// an aggregate applying deltas from two filters matches bloom_merge()
+	if (bloom_init_flags(&other, EXPECTED, ACCURACY, BLOOM_FLAG_TRACK_DIRTY) != BF_SUCCESS ||
+		bloom_init_flags(&aggregate, EXPECTED, ACCURACY, BLOOM_FLAG_TRACK_DIRTY) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: bloom_init_flags()\n");
+		return EXIT_FAILURE;
+	}
+
+	add_keys(&other, "other", 0, 5000);
+	add_keys(&source, "more", 0, 5000);
+	bloom_merge(&merged, &source, &other);
+
+	// the aggregate starts as the replica: the source as of its last delta
+	memcpy(aggregate.bitmap, replica.bitmap, replica.bitmap_size);
+	bloom_checkpoint(&aggregate);
+
+	if (delta(&other, &aggregate) == 0 || delta(&source, &aggregate) == 0 ||
+		!same_bitmap(&aggregate, &merged)) {
+		fprintf(stderr, "FAILURE: aggregate differs from bloom_merge()\n");
+		return EXIT_FAILURE;
+	}
+
+	// the aggregate passes on what it gained
+	if (bloom_dirty_count(&aggregate) == 0) {
+		fprintf(stderr, "FAILURE: applying deltas did not mark the aggregate\n");
+		return EXIT_FAILURE;
+	}
+
+	// deltas only apply to filters of the same shape
+	FILE *fp = tmpfile();
+	int   fd = fileno(fp);
+
+	bloom_init(&small, EXPECTED / 2, ACCURACY);
+	add_keys(&source, "last", 0, 10);
+	bloom_save_delta_fd(&source, fd);
+	size = lseek(fd, 0, SEEK_CUR);
+
+	lseek(fd, 0, SEEK_SET);
+	if (bloom_apply_delta_fd(&small, fd) != BF_INVALIDFILE) {
+		fprintf(stderr, "FAILURE: applied a delta to a filter of a different size\n");
+		return EXIT_FAILURE;
+	}
+
+	// truncated deltas are rejected without changing the filter
+	uint8_t *before = malloc(replica.bitmap_size);
+
+	memcpy(before, replica.bitmap, replica.bitmap_size);
+	if (ftruncate(fd, size - 1) != 0) {
+		fprintf(stderr, "FAILURE: ftruncate()\n");
+		return EXIT_FAILURE;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	if (bloom_apply_delta_fd(&replica, fd) != BF_FREAD ||
+		memcmp(before, replica.bitmap, replica.bitmap_size) != 0) {
+		fprintf(stderr, "FAILURE: applied a truncated delta\n");
+		return EXIT_FAILURE;
+	}
+
+	free(before);
+	fclose(fp);
+
+	// loaded filters keep tracking, starting clean
+	fp = tmpfile();
+	fd = fileno(fp);
+	bloom_destroy(&small);
+	if (bloom_save_fd(&source, fd) != BF_SUCCESS ||
+		lseek(fd, 0, SEEK_SET) != 0 ||
+		bloom_load_fd(&small, fd) != BF_SUCCESS ||
+		small.dirty == NULL || bloom_dirty_count(&small) != 0) {
+		fprintf(stderr, "FAILURE: loaded filter does not track dirty blocks\n");
+		return EXIT_FAILURE;
+	}
+	fclose(fp);
+
+	add_keys(&small, "loaded", 0, 100);
+	if (bloom_dirty_count(&small) == 0) {
+		fprintf(stderr, "FAILURE: loaded filter did not mark a change\n");
+		return EXIT_FAILURE;
+	}
+
+	// deltas of a concurrent filter taken while it is added to lose nothing
+	bloomfilter shared, copy;
+	pthread_t   thread;
+
+	bloom_init_flags(&shared, EXPECTED, ACCURACY, BLOOM_FLAG_CONCURRENT | BLOOM_FLAG_TRACK_DIRTY);
+	bloom_init_flags(&copy, EXPECTED, ACCURACY, BLOOM_FLAG_CONCURRENT);
+	pthread_create(&thread, NULL, add_worker, &shared);
+
+	for (size_t i = 0; i < 20; i++) {
+		if (delta(&shared, &copy) == 0) {
+			return EXIT_FAILURE;
+		}
+		usleep(1000);
+	}
+
+	pthread_join(thread, NULL);
+	if (delta(&shared, &copy) == 0 || !same_bitmap(&shared, &copy)) {
+		fprintf(stderr, "FAILURE: concurrent filter lost bits between deltas\n");
+		return EXIT_FAILURE;
+	}
+
+	bloom_destroy(&shared);
+	bloom_destroy(&copy);
+	bloom_destroy(&source);
+	bloom_destroy(&replica);
+	bloom_destroy(&other);
+	bloom_destroy(&aggregate);
+	bloom_destroy(&merged);
+	bloom_destroy(&small);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/* test_bsbloom_basic.c -- bit-sliced Bloom filter sets.
+ *
+ * Builds a set from 200 named filters for each layout and checks that
+ * it answers exactly as the filters do one at a time, then prints the
+ * cost of a lookup against the whole set both ways.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bloom.h"
+#include "bsbloom.h"
+
+#define FILTERS  200
+#define ELEMENTS 1000
+#define LOOKUPS  20000
+
+static bloomfilter filters[FILTERS];
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool test_layout(const uint32_t flags) {
+	bsbloomfilter bs;
+	bloomfilter   other;
+	char          key[32];
+	uint64_t      matches[(FILTERS + 63) / 64 * 2];
+	const char   *names[FILTERS];
+
+	printf("testing bsbloom with flags 0x%02x\n", flags);
+
+	for (size_t f = 0; f < FILTERS; f++) {
+		char name[32];
+
+		bloom_init_flags(&filters[f], ELEMENTS, 0.01, flags);
+		snprintf(name, sizeof(name), "feed-%zu", f);
+		bloom_set_name(&filters[f], name);
+
+		for (size_t i = 0; i < ELEMENTS / 2; i++) {
+			snprintf(key, sizeof(key), "%zu-%zu", f, i);
+			bloom_add_string(&filters[f], key);
+		}
+
+		if (f % 3 == 0) {
+			bloom_add_string(&filters[f], "common");
+		}
+	}
+
+	bsbloom_init(&bs, &filters[0]);
+	for (size_t f = 0; f < FILTERS; f++) {
+		if (bsbloom_add_filter(&bs, &filters[f]) != BF_SUCCESS) {
+			fprintf(stderr, "FAILURE: bsbloom_add_filter() %zu\n", f);
+			return false;
+		}
+	}
+
+	if (bs.count != FILTERS || bsbloom_match_words(&bs) * 64 < FILTERS ||
+		strcmp(bsbloom_name(&bs, 7), "feed-7") != 0 || bsbloom_name(&bs, FILTERS) != NULL) {
+		fprintf(stderr, "FAILURE: set holds %zu filters\n", bs.count);
+		return false;
+	}
+
+	// filters of another shape don't fit
+	bloom_init_flags(&other, ELEMENTS * 2, 0.01, flags);
+	if (bsbloom_add_filter(&bs, &other) != BF_INVALIDFILE) {
+		fprintf(stderr, "FAILURE: added a filter of a different shape\n");
+		return false;
+	}
+	bloom_destroy(&other);
+
+	// every member answers as its filter does, false positives included
+	for (size_t i = 0; i < 2000; i++) {
+		snprintf(key, sizeof(key), "%zu-%zu", i % FILTERS, i % (ELEMENTS / 2 + 50));
+
+		size_t found    = bsbloom_lookup_string(&bs, key, matches);
+		size_t expected = 0;
+
+		for (size_t f = 0; f < FILTERS; f++) {
+			bool in_filter = bloom_lookup_string(&filters[f], key);
+
+			if (BSBLOOM_MATCH(matches, f) != in_filter) {
+				fprintf(stderr, "FAILURE: \"%s\" in filter %zu: %d, in set: %d\n",
+						key, f, in_filter, (int)BSBLOOM_MATCH(matches, f));
+				return false;
+			}
+			expected += in_filter;
+		}
+
+		if (found != expected) {
+			fprintf(stderr, "FAILURE: \"%s\" is in %zu filters, set found %zu\n", key, expected, found);
+			return false;
+		}
+	}
+
+	size_t found = bsbloom_lookup_string(&bs, "common", matches);
+	if (found < (FILTERS + 2) / 3 ||
+		bsbloom_match_names(&bs, matches, names) != found ||
+		strcmp(names[0], "feed-0") != 0 || strcmp(names[1], "feed-3") != 0) {
+		fprintf(stderr, "FAILURE: \"common\" found in %zu filters\n", found);
+		return false;
+	}
+
+	// adding to one member, and its filter to keep them alike
+	bsbloom_add_string(&bs, FILTERS - 1, "added");
+	bloom_add_string(&filters[FILTERS - 1], "added");
+	if (bsbloom_lookup_string(&bs, "added", matches) == 0 || !BSBLOOM_MATCH(matches, FILTERS - 1)) {
+		fprintf(stderr, "FAILURE: bsbloom_add()\n");
+		return false;
+	}
+
+	// the same work as separate filters and as a set
+	double   start = now();
+	size_t   hits  = 0;
+	for (size_t i = 0; i < LOOKUPS; i++) {
+		snprintf(key, sizeof(key), "%zu-%zu", i % FILTERS, i);
+		for (size_t f = 0; f < FILTERS; f++) {
+			hits += bloom_lookup_string(&filters[f], key);
+		}
+	}
+	double separate = now() - start;
+
+	start = now();
+	size_t set_hits = 0;
+	for (size_t i = 0; i < LOOKUPS; i++) {
+		snprintf(key, sizeof(key), "%zu-%zu", i % FILTERS, i);
+		set_hits += bsbloom_lookup_string(&bs, key, matches);
+	}
+	double set = now() - start;
+
+	printf("%d filters, %zu bytes: %.0f ns per key separately, %.0f ns as a set\n",
+		   FILTERS, bsbloom_memory(&bs), separate * 1e9 / LOOKUPS, set * 1e9 / LOOKUPS);
+
+	if (hits != set_hits) {
+		fprintf(stderr, "FAILURE: %zu hits separately, %zu as a set\n", hits, set_hits);
+		return false;
+	}
+
+	bsbloom_destroy(&bs);
+	for (size_t f = 0; f < FILTERS; f++) {
+		bloom_destroy(&filters[f]);
+	}
+
+	return true;
+}
+
+int main() {
+	uint32_t flags[] = {0, BLOOM_FLAG_POW2, BLOOM_FLAG_FASTRANGE};
+
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		if (!test_layout(flags[i])) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
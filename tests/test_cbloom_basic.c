@@ -4,8 +4,11 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
+#include <string.h>
 
+#include "hash.h"
 #include "cbloom.h"
 
 int main() {
@@ -278,6 +281,316 @@ int main() {
 
 	cbloom_destroy(&cbf64);
 
+	// batch functions
+	printf("testing cbloom_add_batch(), cbloom_lookup_batch()\n");
+	counter_size batch_sizes[] = {COUNTER_4BIT, COUNTER_8BIT, COUNTER_16BIT,
+	                              COUNTER_32BIT, COUNTER_64BIT};
+	char         batch_keys[64][16];
+	const void  *batch_elements[64];
+	size_t       batch_lens[64];
+	uint8_t      batch_results[64 / 8];
+
+	for (size_t i = 0; i < 64; i++) {
+		snprintf(batch_keys[i], sizeof(batch_keys[i]), "batch-%zu", i);
+		batch_elements[i] = batch_keys[i];
+		batch_lens[i]     = strlen(batch_keys[i]);
+	}
+
+	for (size_t s = 0; s < sizeof(batch_sizes) / sizeof(batch_sizes[0]); s++) {
+		cbloomfilter batch;
+		cbloom_init(&batch, 1000, 0.01, batch_sizes[s]);
+
+		cbloom_add_batch(&batch, batch_elements, batch_lens, 32);
+		cbloom_add_batch(&batch, batch_elements, batch_lens, 1);
+		cbloom_lookup_batch(&batch, batch_elements, batch_lens, 64, batch_results);
+		for (size_t i = 0; i < 64; i++) {
+			if (CBLOOM_BATCH_RESULT(batch_results, i) != cbloom_lookup_string(&batch, batch_keys[i]) ||
+				(i < 32 && CBLOOM_BATCH_RESULT(batch_results, i) != 1)) {
+				fprintf(stderr, "FAILURE: cbloom_lookup_batch() result %zu is wrong\n", i);
+				return EXIT_FAILURE;
+			}
+		}
+
+		if (cbloom_count_string(&batch, batch_keys[0]) != 2) {
+			fprintf(stderr, "FAILURE: cbloom_add_batch() count should be 2\n");
+			return EXIT_FAILURE;
+		}
+
+		cbloom_destroy(&batch);
+	}
+
+	// hash to position mappings
+	uint32_t mapping_flags[] = {CBLOOM_FLAG_POW2, CBLOOM_FLAG_FASTRANGE};
+	char     key[32];
+
+	for (size_t m = 0; m < sizeof(mapping_flags) / sizeof(mapping_flags[0]); m++) {
+		cbloomfilter mapped, mapped_loaded;
+
+		printf("testing cbloom_init_flags() with flags 0x%02x\n", mapping_flags[m]);
+		if (cbloom_init_flags(&mapped, 1000, 0.01, COUNTER_8BIT, mapping_flags[m]) != CBF_SUCCESS) {
+			fprintf(stderr, "FAILURE: cbloom_init_flags()\n");
+			return EXIT_FAILURE;
+		}
+
+		if ((mapped.flags & CBLOOM_FLAG_POW2) && (mapped.size & (mapped.size - 1)) != 0) {
+			fprintf(stderr, "FAILURE: size %lu is not a power of two\n", mapped.size);
+			return EXIT_FAILURE;
+		}
+
+		hash_strategy strategy = (hash_strategy)((m + 1) % HASH_STRATEGYCOUNT);
+		if (cbloom_set_hash(&mapped, strategy) != true) {
+			fprintf(stderr, "FAILURE: cbloom_set_hash(%s)\n", hash_strategy_name(strategy));
+			return EXIT_FAILURE;
+		}
+
+		for (size_t i = 0; i < 1000; i++) {
+			snprintf(key, sizeof(key), "mapped-%zu", i);
+			cbloom_add_string(&mapped, key);
+		}
+		cbloom_add_string(&mapped, "mapped-0");
+
+		if (cbloom_count_string(&mapped, "mapped-0") < 2) {
+			fprintf(stderr, "FAILURE: \"mapped-0\" count should be at least 2\n");
+			return EXIT_FAILURE;
+		}
+
+		if (cbloom_set_hash(&mapped, HASH_MMH3) != false) {
+			fprintf(stderr, "FAILURE: cbloom_set_hash() should fail on a filter with elements\n");
+			return EXIT_FAILURE;
+		}
+
+		if (cbloom_save(&mapped, "/tmp/cbloom-mapped") != CBF_SUCCESS ||
+			cbloom_load(&mapped_loaded, "/tmp/cbloom-mapped") != CBF_SUCCESS ||
+			mapped_loaded.flags != mapping_flags[m] ||
+			mapped_loaded.hash != strategy) {
+			fprintf(stderr, "FAILURE: cbloom_load() did not restore flags\n");
+			return EXIT_FAILURE;
+		}
+
+		cbloomfilter file_mapped;
+		cbloom_error_t map_error = cbloom_map(&file_mapped, "/tmp/cbloom-mapped", false);
+		if (map_error != CBF_SUCCESS ||
+			((uintptr_t)file_mapped.countermap % 64) != 0 ||
+			file_mapped.flags != mapping_flags[m] ||
+			file_mapped.hash != strategy ||
+			cbloom_count_string(&file_mapped, "mapped-0") != cbloom_count_string(&mapped, "mapped-0")) {
+			fprintf(stderr, "FAILURE: cbloom_map(): %s\n", cbloom_strerror(map_error));
+			return EXIT_FAILURE;
+		}
+		cbloom_destroy(&file_mapped);
+		remove("/tmp/cbloom-mapped");
+
+		for (size_t i = 0; i < 1000; i++) {
+			snprintf(key, sizeof(key), "mapped-%zu", i);
+			if (cbloom_lookup_string(&mapped_loaded, key) != true) {
+				fprintf(stderr, "FAILURE: \"%s\" should be in loaded filter\n", key);
+				return EXIT_FAILURE;
+			}
+		}
+
+		cbloom_destroy(&mapped);
+		cbloom_destroy(&mapped_loaded);
+	}
+
+	// every counter width has its own counter operations
+	printf("testing counter operations for each counter width\n");
+	counter_size widths[]     = { COUNTER_4BIT, COUNTER_8BIT, COUNTER_16BIT, COUNTER_32BIT, COUNTER_64BIT };
+	uint64_t     width_max[]  = { 15, UINT8_MAX, UINT16_MAX, UINT32_MAX, UINT64_MAX };
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		cbloomfilter width;
+
+		if (cbloom_init(&width, 101, 0.01, widths[w]) != CBF_SUCCESS) {
+			fprintf(stderr, "FAILURE: cbloom_init() width %zu\n", w);
+			return EXIT_FAILURE;
+		}
+
+		for (int i = 0; i < 10; i++) {
+			cbloom_add_string(&width, "decay");
+		}
+		cbloom_add_string(&width, "once");
+
+		if (cbloom_count_string(&width, "decay") != 10 ||
+			cbloom_saturation_count(&width) != cbloom_count_elements_above_threshold(&width, 0) * width.hashcount ||
+			cbloom_count_elements_above_threshold(&width, 1) != 1) {
+			fprintf(stderr, "FAILURE: count width %zu: %zu\n", w, cbloom_count_string(&width, "decay"));
+			return EXIT_FAILURE;
+		}
+
+		cbloom_apply_linear_decay(&width, 3);
+		if (cbloom_count_string(&width, "decay") != 7 || cbloom_lookup_string(&width, "once")) {
+			fprintf(stderr, "FAILURE: linear decay width %zu: %zu\n", w, cbloom_count_string(&width, "decay"));
+			return EXIT_FAILURE;
+		}
+
+		cbloom_apply_exponential_decay(&width, 0.5);
+		if (cbloom_count_string(&width, "decay") != 3) {
+			fprintf(stderr, "FAILURE: exponential decay width %zu: %zu\n", w, cbloom_count_string(&width, "decay"));
+			return EXIT_FAILURE;
+		}
+
+		cbloom_remove_string(&width, "decay");
+		cbloom_remove_string(&width, "missing");
+		if (cbloom_count_string(&width, "decay") != 2 || cbloom_saturation_count(&width) == 0) {
+			fprintf(stderr, "FAILURE: remove width %zu\n", w);
+			return EXIT_FAILURE;
+		}
+
+		if (cbloom_clear_if_count_above_string(&width, "decay", 2) ||
+			!cbloom_clear_if_count_above_string(&width, "decay", 1) ||
+			cbloom_lookup_string(&width, "decay")) {
+			fprintf(stderr, "FAILURE: cbloom_clear_if_count_above() width %zu\n", w);
+			return EXIT_FAILURE;
+		}
+
+		// counters saturate rather than wrap
+		if (widths[w] <= COUNTER_8BIT) {
+			for (uint64_t i = 0; i <= width_max[w]; i++) {
+				cbloom_add_string(&width, "saturate");
+			}
+
+			if (cbloom_count_string(&width, "saturate") != width_max[w]) {
+				fprintf(stderr, "FAILURE: saturate width %zu: %zu\n", w, cbloom_count_string(&width, "saturate"));
+				return EXIT_FAILURE;
+			}
+		}
+
+		cbloom_apply_linear_decay(&width, UINT64_MAX);
+		if (cbloom_saturation_count(&width) != 0) {
+			fprintf(stderr, "FAILURE: full linear decay width %zu\n", w);
+			return EXIT_FAILURE;
+		}
+
+		cbloom_destroy(&width);
+	}
+
+	// one hash checked against several filters
+	printf("testing cbloom_lookup_hashed()\n");
+	cbloomfilter first, second;
+	uint64_t     hash[2];
+
+	cbloom_init(&first, 1000, 0.01, COUNTER_8BIT);
+	cbloom_init(&second, 5000, 0.001, COUNTER_4BIT);
+	hash_128(first.hash, "hashed", strlen("hashed"), hash);
+	cbloom_add_hashed(&first, hash);
+	cbloom_add_hashed(&first, hash);
+	cbloom_add_string(&second, "hashed");
+
+	if (!cbloom_lookup_hashed(&first, hash) || cbloom_count_hashed(&first, hash) != 2 ||
+		!cbloom_lookup_hashed(&second, hash) || cbloom_count_hashed(&second, hash) != 1 ||
+		cbloom_count_string(&first, "hashed") != 2) {
+		fprintf(stderr, "FAILURE: hashed lookups disagree with cbloom_lookup()\n");
+		return EXIT_FAILURE;
+	}
+	cbloom_destroy(&first);
+	cbloom_destroy(&second);
+
+	// cbloom_fold() for each counter width and hash mapping
+	printf("testing cbloom_fold()\n");
+	uint32_t fold_flags[] = {0, CBLOOM_FLAG_POW2, CBLOOM_FLAG_FASTRANGE};
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		for (size_t f = 0; f < sizeof(fold_flags) / sizeof(fold_flags[0]); f++) {
+			cbloomfilter folded;
+			char         key[32];
+
+			// 958 counters halve once to 479
+			cbloom_init_flags(&folded, 100, 0.01, widths[w], fold_flags[f]);
+			for (size_t i = 0; i < 50; i++) {
+				snprintf(key, sizeof(key), "fold-%zu", i);
+				cbloom_add_string(&folded, key);
+			}
+			for (int i = 0; i < 10; i++) {
+				cbloom_add_string(&folded, "counted");
+			}
+
+			size_t unfolded_size = folded.size;
+			if (cbloom_fold(&folded, 1) != CBF_SUCCESS || folded.size != unfolded_size / 2) {
+				fprintf(stderr, "FAILURE: cbloom_fold() width %zu flags 0x%02x\n", w, fold_flags[f]);
+				return EXIT_FAILURE;
+			}
+
+			for (size_t i = 0; i < 50; i++) {
+				snprintf(key, sizeof(key), "fold-%zu", i);
+				if (!cbloom_lookup_string(&folded, key)) {
+					fprintf(stderr, "FAILURE: \"%s\" should be in the folded filter\n", key);
+					return EXIT_FAILURE;
+				}
+			}
+
+			// counts can only grow, up to the largest counter value
+			size_t counted = cbloom_count_string(&folded, "counted");
+			if (counted < 10 || counted > width_max[w]) {
+				fprintf(stderr, "FAILURE: folded count width %zu: %zu\n", w, counted);
+				return EXIT_FAILURE;
+			}
+
+			if ((fold_flags[f] & CBLOOM_FLAG_POW2) == 0 && cbloom_fold(&folded, 1) != CBF_INVALIDPARAM) {
+				fprintf(stderr, "FAILURE: cbloom_fold() halved an odd sized filter\n");
+				return EXIT_FAILURE;
+			}
+
+			cbloom_destroy(&folded);
+		}
+	}
+
+	// stepped and lazy decay end where decaying every counter at once does
+	printf("testing incremental and lazy decay\n");
+	for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		cbloomfilter whole, stepped, lazy;
+		char         key[32];
+
+		cbloom_init(&whole, 5000, 0.01, widths[w]);
+		cbloom_init(&stepped, 5000, 0.01, widths[w]);
+		cbloom_init(&lazy, 5000, 0.01, widths[w]);
+		if (cbloom_enable_lazy_decay(&lazy) != CBF_SUCCESS) {
+			fprintf(stderr, "FAILURE: cbloom_enable_lazy_decay()\n");
+			return EXIT_FAILURE;
+		}
+
+		for (size_t round = 0; round < 3; round++) {
+			for (size_t i = 0; i < 5000; i++) {
+				snprintf(key, sizeof(key), "decay-%zu", i % (1000 * (round + 1)));
+				cbloom_add_string(&whole, key);
+				cbloom_add_string(&stepped, key);
+				cbloom_add_string(&lazy, key);
+			}
+
+			cbloom_apply_linear_decay(&whole, 2);
+			cbloom_apply_lazy_linear_decay(&lazy, 2);
+			// 4 bit steps are rounded up to whole bytes
+			size_t step  = (widths[w] == COUNTER_4BIT) ? 1002 : 1001;
+			size_t steps = 1;
+			while (!cbloom_apply_linear_decay_step(&stepped, 2, 1001)) {
+				steps++;
+			}
+			if (steps != (whole.size + step - 1) / step) {
+				fprintf(stderr, "FAILURE: %zu linear decay steps over %zu counters\n", steps, (size_t)whole.size);
+				return EXIT_FAILURE;
+			}
+
+			if (cbloom_count_string(&lazy, "decay-0") != cbloom_count_string(&whole, "decay-0")) {
+				fprintf(stderr, "FAILURE: lazy decay not applied on read width %zu\n", w);
+				return EXIT_FAILURE;
+			}
+		}
+
+		cbloom_apply_exponential_decay(&whole, 0.5);
+		cbloom_apply_exponential_decay(&lazy, 0.5);
+		while (!cbloom_apply_exponential_decay_step(&stepped, 0.5, 4096));
+
+		// saving settles every block of the lazy filter
+		cbloom_save(&lazy, "/tmp/cbloom-lazy");
+		if (memcmp(whole.countermap, stepped.countermap, whole.countermap_size) != 0 ||
+			memcmp(whole.countermap, lazy.countermap, whole.countermap_size) != 0) {
+			fprintf(stderr, "FAILURE: decayed counters differ width %zu\n", w);
+			return EXIT_FAILURE;
+		}
+
+		cbloom_destroy(&whole);
+		cbloom_destroy(&stepped);
+		cbloom_destroy(&lazy);
+	}
+	remove("/tmp/cbloom-lazy");
+
 	// cleanup
 	// TODO: make random tmp files instead of hard-coded.
 	remove("/tmp/cbloom");
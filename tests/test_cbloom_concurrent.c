@@ -0,0 +1,232 @@
+/* test_cbloom_concurrent.c -- CBLOOM_FLAG_CONCURRENT filters shared
+ * between threads.
+ *
+ * Checks that counters updated from many threads at once match a
+ * filter built by a single thread, that removing every element from
+ * many threads empties the filter, and that decay applied while
+ * elements are being added never loses an increment. Then prints add
+ * throughput of a concurrent filter versus a plain filter wrapped in a
+ * mutex.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cbloom.h"
+
+#define KEY_COUNT   20000
+#define MAX_THREADS 8
+#define DECAYS      50
+
+static char keys[KEY_COUNT][16];
+
+static pthread_mutex_t filter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	cbloomfilter *cbf;
+	size_t        thread;
+	size_t        threads;
+} worker_args;
+
+// every thread adds every key, starting at a different point
+static void *add_all_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		cbloom_add_string(args->cbf, keys[(i + (args->thread * KEY_COUNT / args->threads)) % KEY_COUNT]);
+	}
+
+	return NULL;
+}
+
+static void *remove_all_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		cbloom_remove_string(args->cbf, keys[(i + (args->thread * KEY_COUNT / args->threads)) % KEY_COUNT]);
+	}
+
+	return NULL;
+}
+
+// thread 0 decays the filter while the others add every key
+static void *decay_worker(void *arg) {
+	worker_args *args = arg;
+
+	if (args->thread != 0) {
+		return add_all_worker(arg);
+	}
+
+	for (size_t i = 0; i < DECAYS; i++) {
+		cbloom_apply_linear_decay(args->cbf, 1);
+	}
+
+	return NULL;
+}
+
+// each thread adds its share of the keys
+static void *add_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = args->thread; i < KEY_COUNT; i += args->threads) {
+		cbloom_add_string(args->cbf, keys[i]);
+	}
+
+	return NULL;
+}
+
+static void *locked_add_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = args->thread; i < KEY_COUNT; i += args->threads) {
+		pthread_mutex_lock(&filter_lock);
+		cbloom_add_string(args->cbf, keys[i]);
+		pthread_mutex_unlock(&filter_lock);
+	}
+
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// run `worker` on `threads` threads against `cbf`, returning elapsed seconds
+static double run_threads(cbloomfilter *cbf, void *(*worker)(void *), const size_t threads) {
+	pthread_t   tids[MAX_THREADS];
+	worker_args args[MAX_THREADS];
+	double      start = now();
+
+	for (size_t t = 0; t < threads; t++) {
+		args[t] = (worker_args){ .cbf = cbf, .thread = t, .threads = threads };
+		if (pthread_create(&tids[t], NULL, worker, &args[t]) != 0) {
+			fprintf(stderr, "FAILURE: pthread_create()\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (size_t t = 0; t < threads; t++) {
+		pthread_join(tids[t], NULL);
+	}
+
+	return now() - start;
+}
+
+static bool test_counters(const counter_size csize, const char *name) {
+	cbloomfilter cbf, serial;
+
+	printf("testing %s counters from %d threads\n", name, MAX_THREADS);
+
+	if (cbloom_init_flags(&cbf, KEY_COUNT, 0.01, csize, CBLOOM_FLAG_CONCURRENT) != CBF_SUCCESS ||
+		cbloom_init(&serial, KEY_COUNT, 0.01, csize) != CBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: cbloom_init_flags()\n");
+		return false;
+	}
+
+	// saturating increments give the same counters in any order
+	run_threads(&cbf, add_all_worker, MAX_THREADS);
+	for (size_t t = 0; t < MAX_THREADS; t++) {
+		for (size_t i = 0; i < KEY_COUNT; i++) {
+			cbloom_add_string(&serial, keys[i]);
+		}
+	}
+
+	if (memcmp(cbf.countermap, serial.countermap, cbf.countermap_size) != 0) {
+		fprintf(stderr, "FAILURE: concurrent and serial %s counters differ\n", name);
+		return false;
+	}
+
+	// 4 bit counters saturate, so removals can't undo every add
+	run_threads(&cbf, remove_all_worker, MAX_THREADS);
+	if (csize != COUNTER_4BIT && cbloom_saturation_count(&cbf) != 0) {
+		fprintf(stderr, "FAILURE: %zu %s counters left after removing every key\n",
+				cbloom_saturation_count(&cbf), name);
+		return false;
+	}
+
+	cbloom_destroy(&cbf);
+	cbloom_destroy(&serial);
+
+	return true;
+}
+
+// decayed counters end between the serial count less every decay and the serial count
+static bool test_decay(void) {
+	cbloomfilter  cbf, serial;
+	uint16_t     *counters, *expected;
+
+	printf("testing linear decay alongside %d threads\n", MAX_THREADS - 1);
+
+	cbloom_init_flags(&cbf, KEY_COUNT, 0.01, COUNTER_16BIT, CBLOOM_FLAG_CONCURRENT);
+	cbloom_init(&serial, KEY_COUNT, 0.01, COUNTER_16BIT);
+
+	run_threads(&cbf, decay_worker, MAX_THREADS);
+	for (size_t t = 1; t < MAX_THREADS; t++) {
+		for (size_t i = 0; i < KEY_COUNT; i++) {
+			cbloom_add_string(&serial, keys[i]);
+		}
+	}
+
+	counters = cbf.countermap;
+	expected = serial.countermap;
+	for (size_t i = 0; i < cbf.size; i++) {
+		if (counters[i] > expected[i] || counters[i] + DECAYS < expected[i]) {
+			fprintf(stderr, "FAILURE: counter %zu is %u, expected %u less up to %d\n",
+					i, counters[i], expected[i], DECAYS);
+			return false;
+		}
+	}
+
+	cbloom_destroy(&cbf);
+	cbloom_destroy(&serial);
+
+	return true;
+}
+
+int main() {
+	counter_size  sizes[] = { COUNTER_4BIT, COUNTER_8BIT, COUNTER_16BIT, COUNTER_32BIT, COUNTER_64BIT };
+	const char   *names[] = { "4 bit", "8 bit", "16 bit", "32 bit", "64 bit" };
+	cbloomfilter  cbf;
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "key-%zu", i);
+	}
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (!test_counters(sizes[i], names[i])) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!test_decay()) {
+		return EXIT_FAILURE;
+	}
+
+	// throughput
+	printf("\nthreads | concurrent adds/sec | mutex adds/sec\n");
+	for (size_t threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		double concurrent_time, locked_time;
+
+		cbloom_init_flags(&cbf, KEY_COUNT, 0.01, COUNTER_8BIT, CBLOOM_FLAG_CONCURRENT);
+		concurrent_time = run_threads(&cbf, add_worker, threads);
+		cbloom_destroy(&cbf);
+
+		cbloom_init(&cbf, KEY_COUNT, 0.01, COUNTER_8BIT);
+		locked_time = run_threads(&cbf, locked_add_worker, threads);
+		cbloom_destroy(&cbf);
+
+		printf("%7zu | %19.0f | %14.0f\n",
+			   threads,
+			   KEY_COUNT / concurrent_time,
+			   KEY_COUNT / locked_time);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,177 @@
+/* test_cmsketch_basic.c -- count-min sketches and heavy hitters.
+ *
+ * Feeds a skewed stream of keys into sketches with and without
+ * conservative update and a counting Bloom filter of the same memory,
+ * checking that no count is underestimated and printing the error of
+ * each. Then checks that the heavy hitter tracker finds the hottest
+ * keys in order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmsketch.h"
+#include "cbloom.h"
+
+#define KEYS     1000
+#define HOTTEST  10000
+#define TOP      10
+
+static char     keys[KEYS][16];
+static uint64_t counts[KEYS];
+
+// key i is seen HOTTEST / (i + 1) times, interleaved like a real stream
+static void feed(cmsketch *cms, cmsketch_topk *topk, cbloomfilter *cbf) {
+	for (uint64_t round = 0; round < HOTTEST; round++) {
+		for (size_t i = 0; i < KEYS && counts[i] > round; i++) {
+			if (cms != NULL) {
+				cmsketch_add_string(cms, keys[i]);
+			}
+			if (topk != NULL) {
+				cmsketch_topk_add_string(topk, keys[i]);
+			}
+			if (cbf != NULL) {
+				cbloom_add_string(cbf, keys[i]);
+			}
+		}
+	}
+}
+
+// total overcount of a sketch, or false if any key was undercounted
+static bool overcount(const cmsketch *cms, const cbloomfilter *cbf, uint64_t *error) {
+	*error = 0;
+
+	for (size_t i = 0; i < KEYS; i++) {
+		uint64_t estimate = (cms != NULL) ? cmsketch_count_string(cms, keys[i]) : cbloom_count_string(cbf, keys[i]);
+
+		if (estimate < counts[i]) {
+			fprintf(stderr, "FAILURE: \"%s\" counted %llu times, added %llu\n",
+					keys[i], (unsigned long long)estimate, (unsigned long long)counts[i]);
+			return false;
+		}
+		*error += estimate - counts[i];
+	}
+
+	return true;
+}
+
+int main() {
+	cmsketch              plain, conservative, small;
+	cbloomfilter          cbf;
+	cmsketch_topk         topk;
+	cmsketch_heavy_hitter hitters[TOP];
+	uint64_t              total = 0, plain_error, conservative_error, cbloom_error;
+
+	for (size_t i = 0; i < KEYS; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "key-%zu", i);
+		counts[i] = HOTTEST / (i + 1);
+		total    += counts[i];
+	}
+
+	if (cmsketch_init(&plain, 0, 0.01, COUNTER_32BIT) != CMS_INVALIDPARAM ||
+		cmsketch_init(&plain, 0.01, 1, COUNTER_32BIT) != CMS_INVALIDPARAM ||
+		cmsketch_init(&plain, 0.01, 0.01, COUNTER_64BIT + 1) != CMS_INVALIDCOUNTERSIZE ||
+		cmsketch_init_size(&plain, 0, 4, COUNTER_32BIT, 0) != CMS_INVALIDPARAM ||
+		strcmp(cmsketch_strerror(CMS_INVALIDCOUNTERSIZE), "Invalid counter size") != 0) {
+		fprintf(stderr, "FAILURE: cmsketch_init() accepted invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	// a counting Bloom filter, and sketches of about the same memory
+	cbloom_init(&cbf, KEYS, 0.01, COUNTER_32BIT);
+	cmsketch_init_size(&plain, cbf.size / 5, 5, COUNTER_32BIT, 0);
+	cmsketch_init_size(&conservative, cbf.size / 5, 5, COUNTER_32BIT, CMSKETCH_FLAG_CONSERVATIVE);
+	printf("%llu byte sketches, %llu byte counting Bloom filter, %llu adds\n",
+		   (unsigned long long)plain.size, (unsigned long long)cbf.countermap_size, (unsigned long long)total);
+
+	feed(&plain, NULL, &cbf);
+	feed(&conservative, NULL, NULL);
+
+	if (plain.total != total || conservative.total != total ||
+		!overcount(&plain, NULL, &plain_error) ||
+		!overcount(&conservative, NULL, &conservative_error) ||
+		!overcount(NULL, &cbf, &cbloom_error)) {
+		return EXIT_FAILURE;
+	}
+
+	printf("total overcount: cbloom %llu, count-min %llu, conservative count-min %llu\n",
+		   (unsigned long long)cbloom_error, (unsigned long long)plain_error,
+		   (unsigned long long)conservative_error);
+	if (conservative_error > plain_error || plain_error > cbloom_error) {
+		fprintf(stderr, "FAILURE: sketch estimates worse than expected\n");
+		return EXIT_FAILURE;
+	}
+
+	// no more than delta of the keys overcount by more than epsilon * total
+	size_t   outliers = 0;
+	cmsketch bounded;
+	cmsketch_init(&bounded, 0.001, 0.01, COUNTER_32BIT);
+	feed(&bounded, NULL, NULL);
+	for (size_t i = 0; i < KEYS; i++) {
+		outliers += cmsketch_count_string(&bounded, keys[i]) - counts[i] > 0.001 * total;
+	}
+	printf("%llu x %llu sketch: %zu keys over the error bound\n",
+		   (unsigned long long)bounded.width, (unsigned long long)bounded.depth, outliers);
+	if (bounded.width != 2719 || bounded.depth != 5 || outliers > KEYS * 0.01) {
+		fprintf(stderr, "FAILURE: %zu keys over the error bound\n", outliers);
+		return EXIT_FAILURE;
+	}
+	cmsketch_destroy(&bounded);
+
+	// counters saturate
+	cmsketch_init_size(&small, 64, 4, COUNTER_4BIT, CMSKETCH_FLAG_CONSERVATIVE);
+	if (cmsketch_add_count(&small, "x", 1, 10) != 10 ||
+		cmsketch_add_count(&small, "x", 1, 10) != 15 ||
+		cmsketch_count(&small, "x", 1) != 15 ||
+		cmsketch_count_string(&small, "y") > 15) {
+		fprintf(stderr, "FAILURE: 4 bit counters didn't saturate\n");
+		return EXIT_FAILURE;
+	}
+	if (cmsketch_set_hash(&small, HASH_WYHASH)) {
+		fprintf(stderr, "FAILURE: cmsketch_set_hash() on a non-empty sketch\n");
+		return EXIT_FAILURE;
+	}
+	cmsketch_clear(&small);
+	if (small.total != 0 || cmsketch_count(&small, "x", 1) != 0 || !cmsketch_set_hash(&small, HASH_WYHASH)) {
+		fprintf(stderr, "FAILURE: cmsketch_clear()\n");
+		return EXIT_FAILURE;
+	}
+	cmsketch_destroy(&small);
+
+	// heavy hitters
+	printf("testing cmsketch_topk\n");
+	cmsketch_clear(&conservative);
+	if (cmsketch_topk_init(&topk, &conservative, 0) != CMS_INVALIDPARAM ||
+		cmsketch_topk_init(&topk, &conservative, TOP) != CMS_SUCCESS) {
+		fprintf(stderr, "FAILURE: cmsketch_topk_init()\n");
+		return EXIT_FAILURE;
+	}
+
+	feed(NULL, &topk, NULL);
+	if (cmsketch_topk_list(&topk, hitters) != TOP) {
+		fprintf(stderr, "FAILURE: %zu heavy hitters\n", topk.count);
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < TOP; i++) {
+		printf("\t%.*s: %llu\n", (int)hitters[i].len, hitters[i].element, (unsigned long long)hitters[i].count);
+		if (hitters[i].len != strlen(keys[i]) || memcmp(hitters[i].element, keys[i], hitters[i].len) != 0 ||
+			hitters[i].count < counts[i]) {
+			fprintf(stderr, "FAILURE: heavy hitter %zu should be \"%s\"\n", i, keys[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	cmsketch_topk_clear(&topk);
+	if (topk.count != 0 || cmsketch_topk_list(&topk, hitters) != 0) {
+		fprintf(stderr, "FAILURE: cmsketch_topk_clear()\n");
+		return EXIT_FAILURE;
+	}
+
+	cmsketch_topk_destroy(&topk);
+	cmsketch_destroy(&plain);
+	cmsketch_destroy(&conservative);
+	cbloom_destroy(&cbf);
+
+	return EXIT_SUCCESS;
+}
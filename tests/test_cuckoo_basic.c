@@ -4,6 +4,255 @@
 
 #include "cuckoo.h"
 
+/* test_geometry() -- fill a filter of `fingerprint_size` bit
+ * fingerprints, `bucket_size` to a bucket, until an insertion fails,
+ * and check that it loses nothing, through save, load and map too.
+ */
+static bool test_geometry(const size_t fingerprint_size, const size_t bucket_size) {
+	cuckoofilter cf, loaded, mapped;
+	size_t       capacity = 20000;
+	size_t       added, false_positives = 0;
+	char         key[32];
+	double       min_load;
+
+	// one slot buckets fill to about half, fewer with 8 bit fingerprints
+	// since those only have 255 alternate buckets
+	if (bucket_size == 1) {
+		min_load = (fingerprint_size == 8) ? 0.2 : 0.4;
+	} else {
+		min_load = (bucket_size == 2) ? 0.7 : 0.9;
+	}
+
+	if (!cuckoo_init_flags(&cf, capacity / bucket_size, bucket_size, 500, fingerprint_size, 0)) {
+		fprintf(stderr, "FATAL: cuckoo_init_flags() fp%zu b%zu\n", fingerprint_size, bucket_size);
+		return false;
+	}
+
+	for (added = 0; added < capacity; added++) {
+		snprintf(key, sizeof(key), "geometry%zu", added);
+		if (!cuckoo_add_string(&cf, key)) {
+			break;
+		}
+	}
+
+	// counters and occupancy agree with what was added
+	cuckoo_stats stats;
+	size_t       buckets = 0, held = 0;
+
+	cuckoo_get_stats(&cf, &stats);
+	for (size_t i = 0; i <= bucket_size; i++) {
+		buckets += stats.occupancy[i];
+		held    += i * stats.occupancy[i];
+	}
+
+	if (stats.insertions != added || held != added || buckets != cf.num_buckets ||
+		stats.failures != (added < capacity) || stats.kicked == 0 ||
+		stats.kicks < stats.kicked || stats.longest_chain > cf.max_kicks) {
+		fprintf(stderr, "FATAL: fp%zu b%zu stats don't match the filter\n", fingerprint_size, bucket_size);
+		return false;
+	}
+
+	if (fingerprint_size == 16 && bucket_size == 4) {
+		printf("kicks per insertion, %zu of %zu insertions kicked:\n", stats.kicked, added);
+		for (size_t i = 0; i < CUCKOO_KICK_HISTOGRAM; i++) {
+			if (stats.kick_histogram[i] != 0) {
+				printf("  %zu-%zu: %zu\n", (size_t)1 << i, ((size_t)2 << i) - 1, stats.kick_histogram[i]);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < 10000; i++) {
+		snprintf(key, sizeof(key), "absent%zu", i);
+		false_positives += cuckoo_lookup_string(&cf, key);
+	}
+
+	printf("fp%zu b%zu: %.1f%% full, %.3f%% false positives\n", fingerprint_size, bucket_size,
+		   100.0 * added / capacity, 100.0 * false_positives / 10000);
+
+	if (added < capacity * min_load) {
+		fprintf(stderr, "FATAL: fp%zu b%zu filled to %zu of %zu\n",
+				fingerprint_size, bucket_size, added, capacity);
+		return false;
+	}
+
+	// about 2 * bucket_size / 2^fingerprint_size, with some slack
+	if (false_positives > 10000 * 4.0 * bucket_size / (1 << fingerprint_size) + 10) {
+		fprintf(stderr, "FATAL: fp%zu b%zu has %zu false positives\n",
+				fingerprint_size, bucket_size, false_positives);
+		return false;
+	}
+
+	if (!cuckoo_save(&cf, "/tmp/cuckoo_geometry") ||
+		!cuckoo_load(&loaded, "/tmp/cuckoo_geometry") ||
+		!cuckoo_map(&mapped, "/tmp/cuckoo_geometry", false) ||
+		loaded.fingerprint_size != fingerprint_size || mapped.bucket_size != bucket_size) {
+		fprintf(stderr, "FATAL: fp%zu b%zu did not save and load\n", fingerprint_size, bucket_size);
+		return false;
+	}
+
+	for (size_t i = 0; i < added; i++) {
+		snprintf(key, sizeof(key), "geometry%zu", i);
+		if (!cuckoo_lookup_string(&cf, key) ||
+			!cuckoo_lookup_string(&loaded, key) ||
+			!cuckoo_lookup_string(&mapped, key)) {
+			fprintf(stderr, "FATAL: fp%zu b%zu lost \"%s\"\n", fingerprint_size, bucket_size, key);
+			return false;
+		}
+	}
+
+	cuckoo_destroy(&mapped);
+	cuckoo_destroy(&loaded);
+	cuckoo_destroy(&cf);
+	remove("/tmp/cuckoo_geometry");
+
+	return true;
+}
+
+/* test_legacy_file() -- files from before fingerprints were packed
+ * hold a uint32_t per slot, and index buckets with hash_32().
+ */
+static bool test_legacy_file() {
+	cuckoofilter_file  cff = {0};
+	uint32_t           slots[100 * 4] = {0};
+	size_t             insertions[100] = {0};
+	uint32_t           hash = hash_32(HASH_MMH3, "legacy", strlen("legacy"));
+	cuckoofilter       cf;
+	FILE              *fp;
+
+	memcpy(cff.magic, "!cuckoo!", sizeof(cff.magic));
+	cff.num_buckets      = 100;
+	cff.bucket_size      = 4;
+	cff.max_kicks        = 500;
+	cff.total_insertions = 1;
+
+	slots[(hash % 100) * 4] = hash & 0xffff;
+	insertions[hash % 100]  = 1;
+
+	fp = fopen("/tmp/cuckoo_legacy", "wb");
+	fwrite(&cff, sizeof(cff), 1, fp);
+	fwrite(slots, sizeof(slots), 1, fp);
+	fwrite(insertions, sizeof(insertions), 1, fp);
+	fclose(fp);
+
+	if (!cuckoo_load(&cf, "/tmp/cuckoo_legacy") ||
+		!(cf.flags & CUCKOO_FLAG_LEGACY_INDEX) || cf.fingerprint_size != 16 ||
+		!cuckoo_lookup_string(&cf, "legacy") || cuckoo_lookup_string(&cf, "modern")) {
+		fprintf(stderr, "FATAL: legacy cuckoo filter did not load\n");
+		return false;
+	}
+
+	if (!cuckoo_add_string(&cf, "modern") || !cuckoo_lookup_string(&cf, "modern")) {
+		fprintf(stderr, "FATAL: could not add to a legacy cuckoo filter\n");
+		return false;
+	}
+	cuckoo_destroy(&cf);
+
+	// unpacked files must be loaded, not mapped
+	if (cuckoo_map(&cf, "/tmp/cuckoo_legacy", false)) {
+		fprintf(stderr, "FATAL: mapped a legacy cuckoo filter\n");
+		return false;
+	}
+
+	// slots that don't fit in 16 bits are corrupt
+	slots[0] = 0x10000;
+	fp = fopen("/tmp/cuckoo_legacy", "wb");
+	fwrite(&cff, sizeof(cff), 1, fp);
+	fwrite(slots, sizeof(slots), 1, fp);
+	fwrite(insertions, sizeof(insertions), 1, fp);
+	fclose(fp);
+
+	if (cuckoo_load(&cf, "/tmp/cuckoo_legacy")) {
+		fprintf(stderr, "FATAL: loaded a corrupt legacy cuckoo filter\n");
+		return false;
+	}
+	remove("/tmp/cuckoo_legacy");
+
+	return true;
+}
+
+/* test_grow() -- a CUCKOO_FLAG_GROW filter takes 50 times what it
+ * was sized for, and keeps its chain through save and load.
+ */
+static bool test_grow() {
+	cuckoofilter  cf, loaded, mapped;
+	cuckoo_stats  stats;
+	size_t        chain = 0, false_positives = 0;
+	char          key[32];
+
+	if (!cuckoo_init_flags(&cf, 256, 4, 500, 16, CUCKOO_FLAG_GROW)) {
+		fprintf(stderr, "FATAL: cuckoo_init_flags() CUCKOO_FLAG_GROW\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < 50000; i++) {
+		snprintf(key, sizeof(key), "grow%zu", i);
+		if (!cuckoo_add_string(&cf, key)) {
+			fprintf(stderr, "FATAL: growing filter refused \"%s\"\n", key);
+			return false;
+		}
+	}
+
+	for (cuckoofilter *f = &cf; f != NULL; f = f->next) {
+		chain++;
+	}
+
+	for (size_t i = 0; i < 10000; i++) {
+		snprintf(key, sizeof(key), "absent%zu", i);
+		false_positives += cuckoo_lookup_string(&cf, key);
+	}
+
+	cuckoo_get_stats(&cf, &stats);
+	printf("grew to %zu filters, %.1f%% full, %.3f%% false positives\n",
+		   chain, stats.load_factor, 100.0 * false_positives / 10000);
+
+	// 1024 slots doubling: 1024 * (2^6 - 1) holds about 64000
+	if (chain < 6 || chain > 7 || stats.insertions != 50000 || stats.load_factor < 50.0) {
+		fprintf(stderr, "FATAL: %zu filters holding %zu\n", chain, stats.insertions);
+		return false;
+	}
+
+	// elements are removed from whichever filter holds them, unless a
+	// colliding fingerprint makes that ambiguous
+	size_t removed = 0;
+
+	for (size_t i = 0; i < 50000; i += 2) {
+		snprintf(key, sizeof(key), "grow%zu", i);
+		removed += cuckoo_remove_string(&cf, key);
+	}
+
+	if (removed < 24900) {
+		fprintf(stderr, "FATAL: only removed %zu of 25000\n", removed);
+		return false;
+	}
+
+	if (!cuckoo_save(&cf, "/tmp/cuckoo_grow") ||
+		!cuckoo_load(&loaded, "/tmp/cuckoo_grow") ||
+		loaded.next == NULL) {
+		fprintf(stderr, "FATAL: grown filter did not save and load\n");
+		return false;
+	}
+
+	for (size_t i = 1; i < 50000; i += 2) {
+		snprintf(key, sizeof(key), "grow%zu", i);
+		if (!cuckoo_lookup_string(&cf, key) || !cuckoo_lookup_string(&loaded, key)) {
+			fprintf(stderr, "FATAL: \"%s\" missing after removals\n", key);
+			return false;
+		}
+	}
+
+	// a chain is several files' worth of filters, which can't be mapped
+	if (cuckoo_map(&mapped, "/tmp/cuckoo_grow", false)) {
+		fprintf(stderr, "FATAL: mapped a grown filter\n");
+		return false;
+	}
+
+	cuckoo_destroy(&loaded);
+	cuckoo_destroy(&cf);
+	remove("/tmp/cuckoo_grow");
+
+	return true;
+}
+
 int main() {
 	cuckoofilter cf;
 
@@ -11,25 +260,25 @@ int main() {
 	cuckoo_init(&cf, 1000, 4, 500);
 
 	// add elements to filter
-	cuckoo_add(cf, "foo", strlen("foo"));
-	cuckoo_add(cf, "bar", strlen("bar"));
+	cuckoo_add(&cf, "foo", strlen("foo"));
+	cuckoo_add(&cf, "bar", strlen("bar"));
 
 	bool result;
-	result = cuckoo_lookup(cf, "foo", strlen("foo"));
+	result = cuckoo_lookup(&cf, "foo", strlen("foo"));
 	printf("cuckoo foo lookup: %d\n", result);
 	if (result != true) {
 		fprintf(stderr, "FATAL: \"foo\" should be in filter\n");
 		return EXIT_FAILURE;
 	}
 
-	result = cuckoo_lookup(cf, "bar", strlen("bar"));
+	result = cuckoo_lookup(&cf, "bar", strlen("bar"));
 	printf("cuckoo bar lookup: %d\n", result);
 	if (result != true) {
 		fprintf(stderr, "FATAL: \"foo\" should be in filter\n");
 		return EXIT_FAILURE;
 	}
 
-	result = cuckoo_lookup(cf, "baz", strlen("baz"));
+	result = cuckoo_lookup(&cf, "baz", strlen("baz"));
 	printf("cuckoo baz lookup: %d\n", result);
 	if (result != false) {
 		fprintf(stderr, "FATAL: \"baz\" should be in filter\n");
@@ -37,8 +286,8 @@ int main() {
 	}
 
 	// test removal
-	cuckoo_remove(cf, "foo", strlen("foo"));
-	result = cuckoo_lookup(cf, "foo", strlen("foo"));
+	cuckoo_remove(&cf, "foo", strlen("foo"));
+	result = cuckoo_lookup(&cf, "foo", strlen("foo"));
 	printf("cuckoo foo lookup: %d\n", result);
 	if (result != false) {
 		fprintf(stderr, "FATAL: \"foo\" should NOT be in filter\n");
@@ -47,11 +296,11 @@ int main() {
 
 	// test file save/load
 	printf("testing saving/loading\n");
-	cuckoo_add_string(cf, "beep");
-	cuckoo_add_string(cf, "boop");
+	cuckoo_add_string(&cf, "beep");
+	cuckoo_add_string(&cf, "boop");
 
 	printf("saving old filter to /tmp/cuckoo\n");
-	cuckoo_save(cf, "/tmp/cuckoo");
+	cuckoo_save(&cf, "/tmp/cuckoo");
 
 	cuckoofilter newcf;
 
@@ -61,29 +310,120 @@ int main() {
 		fprintf(stderr, "failed to load /tmp/cuckoo\n");
 		return EXIT_FAILURE;
 	}
-	cuckoo_save(newcf, "/tmp/cuckoo_newcf");
+	cuckoo_save(&newcf, "/tmp/cuckoo_newcf");
 
-	result = cuckoo_lookup_string(newcf, "beep");
+	result = cuckoo_lookup_string(&newcf, "beep");
 	printf("beep: %d\n", result);
 	if (result != true) {
 		fprintf(stderr, "FATAL: \"beep\" should be in filter\n");
 		return EXIT_FAILURE;
 	}
 
-	result = cuckoo_lookup(newcf, "boop", strlen("boop"));
+	result = cuckoo_lookup(&newcf, "boop", strlen("boop"));
 	printf("boop: %d\n", result);
 	if (result != true) {
 		fprintf(stderr, "FATAL: \"boop\" should be in filter\n");
 		return EXIT_FAILURE;
 	}
 
-	result = cuckoo_lookup_string(newcf, "doot");
+	result = cuckoo_lookup_string(&newcf, "doot");
 	printf("doot: %d\n", result);
 	if (result != false) {
 		fprintf(stderr, "FATAL: \"doot\" should be in filter\n");
 		return EXIT_FAILURE;
 	}
 
+	// map the saved filter instead of loading it
+	cuckoofilter mapcf;
+
+	printf("mapping /tmp/cuckoo into mapcf\n");
+	result = cuckoo_map(&mapcf, "/tmp/cuckoo", false);
+	if (result != true ||
+		mapcf.num_buckets != newcf.num_buckets ||
+		cuckoo_lookup_string(&mapcf, "beep") != true ||
+		cuckoo_lookup_string(&mapcf, "doot") != false) {
+		fprintf(stderr, "FATAL: mapped filter does not match saved filter\n");
+		return EXIT_FAILURE;
+	}
+	cuckoo_destroy(&mapcf);
+
+	// the hash strategy is saved with the filter
+	cuckoofilter hashcf;
+
+	printf("testing cuckoo_set_hash()\n");
+	cuckoo_init(&hashcf, 1000, 4, 500);
+	if (cuckoo_set_hash(&hashcf, HASH_FIXED) != true) {
+		fprintf(stderr, "FATAL: cuckoo_set_hash() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	uint64_t ids[100];
+	for (uint64_t i = 0; i < 100; i++) {
+		ids[i] = i;
+		cuckoo_add(&hashcf, &ids[i], sizeof(ids[i]));
+	}
+
+	if (cuckoo_set_hash(&hashcf, HASH_MMH3) != false) {
+		fprintf(stderr, "FATAL: cuckoo_set_hash() should fail on a filter with elements\n");
+		return EXIT_FAILURE;
+	}
+
+	cuckoo_save(&hashcf, "/tmp/cuckoo_hash");
+	cuckoo_destroy(&hashcf);
+
+	if (cuckoo_load(&hashcf, "/tmp/cuckoo_hash") != true || hashcf.hash != HASH_FIXED) {
+		fprintf(stderr, "FATAL: cuckoo_load() did not restore the hash strategy\n");
+		return EXIT_FAILURE;
+	}
+
+	for (uint64_t i = 0; i < 100; i++) {
+		if (cuckoo_lookup(&hashcf, &ids[i], sizeof(ids[i])) != true) {
+			fprintf(stderr, "FATAL: %llu should be in the loaded filter\n", (unsigned long long)i);
+			return EXIT_FAILURE;
+		}
+	}
+	cuckoo_destroy(&hashcf);
+	remove("/tmp/cuckoo_hash");
+
+	// packed fingerprints
+	printf("testing fingerprint and bucket sizes\n");
+	const size_t fingerprint_sizes[] = { 8, 12, 16 };
+	const size_t bucket_sizes[]      = { 1, 2, 4, 8 };
+
+	for (size_t f = 0; f < 3; f++) {
+		for (size_t b = 0; b < 4; b++) {
+			// a bucket of one 12 bit fingerprint isn't a whole number of bytes
+			if (fingerprint_sizes[f] == 12 && bucket_sizes[b] == 1) {
+				if (cuckoo_init_flags(&hashcf, 1000, 1, 500, 12, 0) != false) {
+					fprintf(stderr, "FATAL: cuckoo_init_flags() accepted fp12 b1\n");
+					return EXIT_FAILURE;
+				}
+				continue;
+			}
+
+			if (!test_geometry(fingerprint_sizes[f], bucket_sizes[b])) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	if (cuckoo_init_flags(&hashcf, 1000, 4, 500, 12, CUCKOO_FLAG_CONCURRENT) != false ||
+		cuckoo_init_flags(&hashcf, 1000, 4, 500, 16, CUCKOO_FLAG_LEGACY_INDEX) != false ||
+		cuckoo_init_flags(&hashcf, 1000, 3, 500, 16, 0) != false) {
+		fprintf(stderr, "FATAL: cuckoo_init_flags() accepted invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("testing CUCKOO_FLAG_GROW\n");
+	if (!test_grow()) {
+		return EXIT_FAILURE;
+	}
+
+	printf("testing legacy files\n");
+	if (!test_legacy_file()) {
+		return EXIT_FAILURE;
+	}
+
 	remove("/tmp/cuckoo");
 	remove("/tmp/cuckoo_newcf");
 
@@ -0,0 +1,199 @@
+/* test_cuckoo_concurrent.c -- CUCKOO_FLAG_CONCURRENT filters shared
+ * between threads.
+ *
+ * Writers fill a filter to a high load factor, so many insertions
+ * evict, while readers check that every element a writer has finished
+ * adding is found, then prints lookup throughput against a plain
+ * filter. Repeats with CUCKOO_FLAG_GROW and a filter too small to hold
+ * everything, so writers grow it while readers walk the chain.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "cuckoo.h"
+
+#define WRITERS     2
+#define READERS     2
+#define PER_WRITER  45000
+#define BUCKET_SIZE 4
+#define NUM_BUCKETS ((WRITERS * PER_WRITER) / BUCKET_SIZE * 10 / 9)
+
+static cuckoofilter filter;
+static size_t       progress[WRITERS]; // elements each writer has added
+static size_t       failures;
+static bool         writing = true;
+
+static void make_key(char *key, const size_t size, const size_t writer, const size_t i) {
+	snprintf(key, size, "w%zu-%zu", writer, i);
+}
+
+static void *writer(void *arg) {
+	size_t id = (size_t)arg;
+	char   key[32];
+
+	for (size_t i = 0; i < PER_WRITER; i++) {
+		make_key(key, sizeof(key), id, i);
+		if (!cuckoo_add_string(&filter, key)) {
+			__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		__atomic_store_n(&progress[id], i + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+// look up random elements the writers have already added
+static void *reader(void *arg) {
+	uint32_t state = (uint32_t)(uintptr_t)arg * 2654435761U + 1;
+	size_t   checked = 0;
+	char     key[32];
+
+	while (__atomic_load_n(&writing, __ATOMIC_ACQUIRE) || checked < 100000) {
+		size_t id   = checked % WRITERS;
+		size_t done = __atomic_load_n(&progress[id], __ATOMIC_ACQUIRE);
+
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+
+		if (done > 0) {
+			make_key(key, sizeof(key), id, state % done);
+			if (!cuckoo_lookup_string(&filter, key)) {
+				fprintf(stderr, "FAILURE: \"%s\" missing while writers run\n", key);
+				__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+				return NULL;
+			}
+		}
+		checked++;
+	}
+
+	return NULL;
+}
+
+static double lookup_rate(const cuckoofilter *cf) {
+	struct timespec start, end;
+	char            key[32];
+	size_t          found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t i = 0; i < PER_WRITER; i++) {
+		make_key(key, sizeof(key), 0, i);
+		found += cuckoo_lookup_string(cf, key);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (found != PER_WRITER) {
+		return 0;
+	}
+
+	return PER_WRITER / ((end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9));
+}
+
+// run the writers and readers over a new filter, then check it holds everything
+static bool run(const size_t num_buckets, const uint32_t flags) {
+	pthread_t writers[WRITERS], readers[READERS];
+	char      key[32];
+
+	if (!cuckoo_init_flags(&filter, num_buckets, BUCKET_SIZE, 500, 16, flags)) {
+		fprintf(stderr, "FAILURE: cuckoo_init_flags()\n");
+		return false;
+	}
+
+	memset(progress, 0, sizeof(progress));
+	failures = 0;
+	writing  = true;
+
+	for (size_t i = 0; i < READERS; i++) {
+		pthread_create(&readers[i], NULL, reader, (void *)i);
+	}
+	for (size_t i = 0; i < WRITERS; i++) {
+		pthread_create(&writers[i], NULL, writer, (void *)i);
+	}
+
+	for (size_t i = 0; i < WRITERS; i++) {
+		pthread_join(writers[i], NULL);
+	}
+	__atomic_store_n(&writing, false, __ATOMIC_RELEASE);
+	for (size_t i = 0; i < READERS; i++) {
+		pthread_join(readers[i], NULL);
+	}
+
+	if (failures != 0) {
+		fprintf(stderr, "FAILURE: %zu failures with writers running\n", failures);
+		return false;
+	}
+
+	// everything is there afterwards, too
+	for (size_t id = 0; id < WRITERS; id++) {
+		for (size_t i = 0; i < PER_WRITER; i++) {
+			make_key(key, sizeof(key), id, i);
+			if (!cuckoo_lookup_string(&filter, key)) {
+				fprintf(stderr, "FAILURE: \"%s\" missing\n", key);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+int main() {
+	cuckoofilter plain;
+	char         key[32];
+
+	printf("testing concurrent cuckoo filter\n");
+
+	if (!run(NUM_BUCKETS, CUCKOO_FLAG_CONCURRENT)) {
+		return EXIT_FAILURE;
+	}
+
+	// counters are kept across threads
+	cuckoo_stats stats;
+
+	cuckoo_get_stats(&filter, &stats);
+	printf("%zu insertions, %zu kicked, longest chain %zu\n",
+		   stats.insertions, stats.kicked, stats.longest_chain);
+	if (stats.insertions != WRITERS * PER_WRITER || stats.occupancy[0] == NUM_BUCKETS) {
+		fprintf(stderr, "FAILURE: %zu insertions counted\n", stats.insertions);
+		return EXIT_FAILURE;
+	}
+
+	// what the version checks cost a lookup
+	cuckoo_init(&plain, NUM_BUCKETS, BUCKET_SIZE, 500);
+	for (size_t i = 0; i < PER_WRITER; i++) {
+		make_key(key, sizeof(key), 0, i);
+		cuckoo_add_string(&plain, key);
+	}
+
+	printf("lookups/sec: plain %.0f, concurrent %.0f\n", lookup_rate(&plain), lookup_rate(&filter));
+
+	cuckoo_destroy(&plain);
+	cuckoo_destroy(&filter);
+
+	// writers racing to grow a filter that starts far too small
+	printf("testing concurrent growth\n");
+
+	if (!run(NUM_BUCKETS / 16, CUCKOO_FLAG_CONCURRENT | CUCKOO_FLAG_GROW)) {
+		return EXIT_FAILURE;
+	}
+
+	size_t chain = 0;
+	for (const cuckoofilter *cf = &filter; cf != NULL; cf = cf->next) {
+		chain++;
+	}
+
+	cuckoo_get_stats(&filter, &stats);
+	printf("grew to %zu filters, %zu insertions\n", chain, stats.insertions);
+	if (chain < 2 || stats.insertions != WRITERS * PER_WRITER) {
+		fprintf(stderr, "FAILURE: %zu filters, %zu insertions\n", chain, stats.insertions);
+		return EXIT_FAILURE;
+	}
+	cuckoo_destroy(&filter);
+
+	return EXIT_SUCCESS;
+}
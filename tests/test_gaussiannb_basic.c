@@ -64,8 +64,100 @@ int main() {
 	printf("distance from class2 to class2 sample: %f\n",
 		   gaussiannb_mahalanobis_distance(&gnb, class2, 2));
 
+	// batches predict the same classes as single samples
+	double batch[] = { 2.5, 3.5, 4.0, 4.0, 6.0, 6.5, 1.0, NAN };
+	int    predictions[4];
+	gaussiannb_predict_batch(&gnb, batch, 4, predictions);
+	for (size_t i = 0; i < 4; i++) {
+		if (predictions[i] != gaussiannb_predict(&gnb, batch + (i * 2))) {
+			fprintf(stderr, "FAILURE: batch prediction %zu differs\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	if (predictions[0] != 0 || predictions[1] != 1 || predictions[2] != 2 || predictions[3] != -1) {
+		fprintf(stderr, "FAILURE: batch predictions %d %d %d %d\n",
+				predictions[0], predictions[1], predictions[2], predictions[3]);
+		return EXIT_FAILURE;
+	}
+
+	if (gaussiannb_predict_batch_float(&gnb, (float[]) { 2.5, 3.5 }, 1, predictions)) {
+		fprintf(stderr, "FAILURE: float predictions without GNB_FLAG_FLOAT32\n");
+		return EXIT_FAILURE;
+	}
 
 	gaussiannb_destroy(&gnb);
 
+	// a larger data set trained from a matrix, on one thread and on several
+	enum { SAMPLES = 3000, CLASSES = 5, FEATURES = 8 };
+	static double matrix[SAMPLES * FEATURES];
+	static float  matrix_f[SAMPLES * FEATURES];
+	static double *rows[SAMPLES];
+	static int    labels[SAMPLES], single[SAMPLES], threaded[SAMPLES], floats[SAMPLES];
+	gaussiannb    by_rows, by_matrix, by_threads;
+
+	srand(1);
+	for (size_t i = 0; i < SAMPLES; i++) {
+		labels[i] = rand() % CLASSES;
+		rows[i]   = matrix + (i * FEATURES);
+		for (size_t j = 0; j < FEATURES; j++) {
+			rows[i][j]                  = labels[i] * (j + 1) + ((double)rand() / RAND_MAX) * 4.0;
+			matrix_f[i * FEATURES + j] = rows[i][j];
+		}
+	}
+
+	if (!gaussiannb_init(&by_rows, CLASSES, FEATURES) ||
+		!gaussiannb_init(&by_matrix, CLASSES, FEATURES) ||
+		!gaussiannb_init_flags(&by_threads, CLASSES, FEATURES, GNB_FLAG_FLOAT32)) {
+		fprintf(stderr, "FATAL: gaussiannb_init()\n");
+		return EXIT_FAILURE;
+	}
+
+	gaussiannb_train(&by_rows, rows, labels, SAMPLES);
+	if (!gaussiannb_train_matrix(&by_matrix, matrix, labels, SAMPLES, 1) ||
+		!gaussiannb_train_matrix(&by_threads, matrix, labels, SAMPLES, 4)) {
+		fprintf(stderr, "FAILURE: gaussiannb_train_matrix()\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t c = 0; c < CLASSES; c++) {
+		for (size_t j = 0; j < FEATURES; j++) {
+			if (by_rows.classes[c].mean[j] != by_matrix.classes[c].mean[j] ||
+				by_rows.classes[c].variance[j] != by_matrix.classes[c].variance[j] ||
+				fabs(by_matrix.classes[c].mean[j] - by_threads.classes[c].mean[j]) > 1e-9 ||
+				fabs(by_matrix.classes[c].variance[j] - by_threads.classes[c].variance[j]) > 1e-9) {
+				fprintf(stderr, "FAILURE: class %zu feature %zu trained differently\n", c, j);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	gaussiannb_predict_batch(&by_matrix, matrix, SAMPLES, single);
+	gaussiannb_predict_batch(&by_threads, matrix, SAMPLES, threaded);
+	if (!gaussiannb_predict_batch_float(&by_threads, matrix_f, SAMPLES, floats)) {
+		fprintf(stderr, "FAILURE: gaussiannb_predict_batch_float()\n");
+		return EXIT_FAILURE;
+	}
+
+	size_t correct = 0, float_differences = 0;
+	for (size_t i = 0; i < SAMPLES; i++) {
+		if (single[i] != threaded[i]) {
+			fprintf(stderr, "FAILURE: sample %zu predicted differently after threaded training\n", i);
+			return EXIT_FAILURE;
+		}
+		correct           += single[i] == labels[i];
+		float_differences += floats[i] != single[i];
+	}
+
+	printf("%zu of %d training samples predicted correctly, %zu differ in float\n",
+		   correct, SAMPLES, float_differences);
+	if (correct < SAMPLES * 0.9 || float_differences > SAMPLES * 0.001) {
+		fprintf(stderr, "FAILURE: batch predictions inaccurate\n");
+		return EXIT_FAILURE;
+	}
+
+	gaussiannb_destroy(&by_rows);
+	gaussiannb_destroy(&by_matrix);
+	gaussiannb_destroy(&by_threads);
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,157 @@
+/* test_hash_basic.c -- check every hash strategy for consistency and
+ * distribution, then print the cost per key at a few key sizes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "mmh3.h"
+#include "hash.h"
+
+#define BUCKETS    1024
+#define ITERATIONS (BUCKETS * 100)
+#define HASHCOUNT  7
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* chi_squared() -- bucket sequential keys of `len` bytes by their
+ * first hash and return the chi-squared statistic. Sequential keys are
+ * the worst case for the fixed width strategy. With BUCKETS - 1
+ * degrees of freedom a good hash lands near 1023.
+ */
+static double chi_squared(const hash_strategy strategy, const size_t len) {
+	static size_t bucket[BUCKETS];
+	uint8_t       key[64] = {0};
+	uint64_t      hash[2];
+	double        expected = (double)ITERATIONS / BUCKETS;
+	double        total    = 0;
+
+	memset(bucket, 0, sizeof(bucket));
+
+	for (uint64_t i = 0; i < ITERATIONS; i++) {
+		memcpy(key, &i, len < sizeof(i) ? len : sizeof(i));
+		hash_128(strategy, key, len, hash);
+		bucket[hash[0] % BUCKETS]++;
+	}
+
+	for (size_t i = 0; i < BUCKETS; i++) {
+		total += (bucket[i] - expected) * (bucket[i] - expected) / expected;
+	}
+
+	return total;
+}
+
+int main() {
+	uint8_t  key[256];
+	uint64_t expected[HASHCOUNT], actual[HASHCOUNT];
+	uint64_t hash[2];
+	size_t   sizes[] = { 4, 8, 16, 32, 40, 64 };
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(key); i++) {
+		key[i] = (uint8_t)rand();
+	}
+
+	if (hash_strategy_valid(HASH_STRATEGYCOUNT) ||
+		strcmp(hash_strategy_name(HASH_STRATEGYCOUNT), "unknown") != 0) {
+		fprintf(stderr, "FAILURE: HASH_STRATEGYCOUNT is not a valid strategy\n");
+		return EXIT_FAILURE;
+	}
+
+	// HASH_MMH3 must give the same answers as before strategies existed
+	for (size_t len = 0; len <= sizeof(key); len++) {
+		mmh3_64_make_hashes(key, len, HASHCOUNT, expected);
+		hash_make_hashes(HASH_MMH3, key, len, HASHCOUNT, actual);
+		if (memcmp(expected, actual, sizeof(expected)) != 0 ||
+			hash_32(HASH_MMH3, key, len) != mmh3_32(key, len, 0)) {
+			fprintf(stderr, "FAILURE: HASH_MMH3 differs from mmh3 with length %zu\n", len);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (int s = 0; s < HASH_STRATEGYCOUNT; s++) {
+		printf("testing %s\n", hash_strategy_name(s));
+
+		for (size_t len = 0; len <= sizeof(key); len++) {
+			hash_128(s, key, len, hash);
+			hash_make_hashes(s, key, len, HASHCOUNT, actual);
+
+			if (actual[0] != hash[0] || actual[1] != hash[0] + hash[1]) {
+				fprintf(stderr, "FAILURE: %s hash_make_hashes() length %zu\n", hash_strategy_name(s), len);
+				return EXIT_FAILURE;
+			}
+
+			// filters probe with hash_probe() and must see the same positions
+			for (size_t i = 0; i < HASHCOUNT; i++) {
+				if (hash_probe(hash, i) != actual[i]) {
+					fprintf(stderr, "FAILURE: %s hash_probe(%zu) length %zu\n", hash_strategy_name(s), i, len);
+					return EXIT_FAILURE;
+				}
+			}
+
+			// double hashing only probes distinct positions on pow2 filters if the step is odd
+			if (s != HASH_MMH3 && (hash[1] & 1) == 0) {
+				fprintf(stderr, "FAILURE: %s even second hash, length %zu\n", hash_strategy_name(s), len);
+				return EXIT_FAILURE;
+			}
+
+			// every byte should matter
+			if (len > 0) {
+				uint64_t flipped[2];
+
+				key[len - 1] ^= 0x01;
+				hash_128(s, key, len, flipped);
+				key[len - 1] ^= 0x01;
+
+				if (flipped[0] == hash[0]) {
+					fprintf(stderr, "FAILURE: %s ignores the last byte, length %zu\n", hash_strategy_name(s), len);
+					return EXIT_FAILURE;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			double chi = chi_squared(s, sizes[i]);
+			printf("%s: %zu byte sequential keys chi-squared %.0f (%d buckets)\n",
+				   hash_strategy_name(s), sizes[i], chi, BUCKETS);
+
+			if (chi > BUCKETS * 1.3) {
+				fprintf(stderr, "FAILURE: %s is poorly distributed with %zu byte keys\n",
+						hash_strategy_name(s), sizes[i]);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	// cost per key, as used by the filters
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (int s = 0; s < HASH_STRATEGYCOUNT; s++) {
+			size_t   iterations = 2000000;
+			uint64_t sink       = 0;
+			double   start      = now();
+
+			for (size_t n = 0; n < iterations; n++) {
+				memcpy(key, &n, sizeof(n));
+				hash_make_hashes(s, key, sizes[i], HASHCOUNT, actual);
+				sink += actual[HASHCOUNT - 1];
+			}
+
+			double elapsed = now() - start;
+			printf("%-6s %2zu byte keys: %6.2f ns/key (%llx)\n",
+				   hash_strategy_name(s),
+				   sizes[i],
+				   elapsed * 1e9 / iterations,
+				   (unsigned long long)(sink & 0xf));
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/* test_rice_basic.c -- round trip bitmaps of various sizes and
+ * densities through the Golomb-Rice coder, and check corrupt input is
+ * rejected.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rice.h"
+
+/* round_trip() -- set each of `bits` bits with probability `density`,
+ * encode, decode and compare. Returns the encoded size, or 0 on
+ * failure.
+ */
+static size_t round_trip(const size_t bits, const double density) {
+	size_t   bytes   = (bits + 7) / 8;
+	uint8_t *bitmap  = calloc(1, bytes + 1);
+	uint8_t *decoded = calloc(1, bytes + 1);
+	uint8_t *encoded;
+	size_t   size, written;
+
+	for (size_t i = 0; i < bits; i++) {
+		if (rand() < density * RAND_MAX) {
+			bitmap[i / 8] |= 1 << (i % 8);
+		}
+	}
+
+	size    = rice_encoded_size(bitmap, bits);
+	encoded = malloc(size);
+
+	// one byte short of the encoding must be refused
+	if (rice_encode(bitmap, bits, encoded, size - 1) != 0) {
+		fprintf(stderr, "FAILURE: %zu bits at density %f: encoded past the limit\n",
+				bits, density);
+		size = 0;
+	}
+
+	written = rice_encode(bitmap, bits, encoded, size);
+
+	if (size == 0 || written != size ||
+		!rice_decode(encoded, size, decoded, bits) ||
+		memcmp(bitmap, decoded, bytes) != 0) {
+		fprintf(stderr, "FAILURE: %zu bits at density %f: encoded %zu of %zu bytes\n",
+				bits, density, written, size);
+		size = 0;
+	}
+
+	// truncated encodings must not decode
+	if (size > RICE_HEADER_SIZE && rice_decode(encoded, size - 1, decoded, bits)) {
+		fprintf(stderr, "FAILURE: truncated encoding of %zu bits decoded\n", bits);
+		size = 0;
+	}
+
+	free(bitmap);
+	free(decoded);
+	free(encoded);
+
+	return size;
+}
+
+int main() {
+	size_t sizes[]     = { 1, 7, 8, 63, 64, 65, 1000, 100003 };
+	double densities[] = { 0.0, 0.001, 0.01, 0.05, 0.2, 0.5, 0.9, 1.0 };
+
+	srand(1);
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++) {
+			if (round_trip(sizes[s], densities[d]) == 0) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	// sparse bitmaps should shrink close to their entropy
+	size_t bits = 1000000;
+	size_t size = round_trip(bits, 0.01);
+	printf("%zu bits at 1%% density: %zu bytes, raw %zu bytes\n", bits, size, bits / 8);
+	if (size == 0 || size > (bits / 8) / 10) {
+		fprintf(stderr, "FAILURE: sparse bitmap encoded to %zu bytes\n", size);
+		return EXIT_FAILURE;
+	}
+
+	// a set bit past the end of the bitmap must be rejected
+	uint8_t bitmap[2] = { 0x00, 0x80 };
+	uint8_t encoded[32];
+	size = rice_encode(bitmap, 16, encoded, sizeof(encoded));
+	if (rice_decode(encoded, size, bitmap, 15)) {
+		fprintf(stderr, "FAILURE: decoded a bit outside of the bitmap\n");
+		return EXIT_FAILURE;
+	}
+
+	if (rice_decode(encoded, RICE_HEADER_SIZE - 1, bitmap, 16)) {
+		fprintf(stderr, "FAILURE: decoded a truncated header\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+/* test_sbloom_basic.c -- scalable Bloom filters.
+ *
+ * Grows a filter to 100 times its initial capacity and checks that it
+ * loses nothing, keeps its false positive rate under the bound, and
+ * saves and loads. Prints the memory used against a classic filter
+ * sized for the final count.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bloom.h"
+#include "sbloom.h"
+
+#define INITIAL  1000
+#define ELEMENTS 100000
+#define ACCURACY 0.01
+
+static double false_positive_rate(const sbloomfilter *sbf) {
+	size_t false_positives = 0;
+	char   key[32];
+
+	for (size_t i = 0; i < 100000; i++) {
+		snprintf(key, sizeof(key), "absent%zu", i);
+		false_positives += sbloom_lookup_string(sbf, key);
+	}
+
+	return false_positives / 100000.0;
+}
+
+int main() {
+	sbloomfilter sbf, loaded;
+	bloomfilter  classic;
+	char         key[32];
+	double       rate;
+
+	printf("testing scalable bloom filter\n");
+
+	if (sbloom_init(&sbf, 0, ACCURACY) != BF_INVALIDPARAM ||
+		sbloom_init_flags(&sbf, INITIAL, ACCURACY, 2, 1.0f, 0) != BF_INVALIDPARAM) {
+		fprintf(stderr, "FAILURE: sbloom_init() accepted invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (sbloom_init(&sbf, INITIAL, ACCURACY) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: sbloom_init()\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		if (sbloom_add_string(&sbf, key) != BF_SUCCESS) {
+			fprintf(stderr, "FAILURE: sbloom_add_string()\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// 1000 + 2000 + ... + 64000 holds 127000
+	if (sbf.count != 7) {
+		fprintf(stderr, "FAILURE: %zu slices for %d elements\n", sbf.count, ELEMENTS);
+		return EXIT_FAILURE;
+	}
+
+	// elements already present don't use up capacity
+	size_t total = sbf.total;
+	for (size_t i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		sbloom_add_string(&sbf, key);
+	}
+
+	if (sbf.total != total) {
+		fprintf(stderr, "FAILURE: re-adding elements counted them again\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		if (!sbloom_lookup_string(&sbf, key)) {
+			fprintf(stderr, "FAILURE: \"%s\" should be in the filter\n", key);
+			return EXIT_FAILURE;
+		}
+	}
+
+	rate = false_positive_rate(&sbf);
+	bloom_init(&classic, ELEMENTS, ACCURACY);
+	printf("%zu slices, %zu bytes (classic filter: %zu bytes), %.3f%% false positives, %.3f%% estimated\n",
+		   sbf.count, sbloom_memory(&sbf), classic.bitmap_size, rate * 100,
+		   sbloom_estimate_false_positive_rate(&sbf) * 100);
+	bloom_destroy(&classic);
+
+	if (rate > ACCURACY || sbloom_estimate_false_positive_rate(&sbf) > ACCURACY) {
+		fprintf(stderr, "FAILURE: false positive rate %f exceeds %f\n", rate, ACCURACY);
+		return EXIT_FAILURE;
+	}
+
+	// save and load
+	if (sbloom_save(&sbf, "/tmp/sbloom") != BF_SUCCESS ||
+		sbloom_load(&loaded, "/tmp/sbloom") != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: sbloom_save() / sbloom_load()\n");
+		return EXIT_FAILURE;
+	}
+
+	if (loaded.count != sbf.count || loaded.total != sbf.total ||
+		false_positive_rate(&loaded) != rate) {
+		fprintf(stderr, "FAILURE: loaded filter differs\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		if (!sbloom_lookup_string(&loaded, key)) {
+			fprintf(stderr, "FAILURE: \"%s\" should be in the loaded filter\n", key);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// the loaded filter keeps growing
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "more%zu", i);
+		sbloom_add_string(&loaded, key);
+	}
+
+	if (loaded.count != 8 || !sbloom_lookup_string(&loaded, "more0") ||
+		!sbloom_lookup_string(&loaded, "key0")) {
+		fprintf(stderr, "FAILURE: loaded filter did not grow\n");
+		return EXIT_FAILURE;
+	}
+
+	// a file that isn't a scalable Bloom filter
+	bloom_init(&classic, INITIAL, ACCURACY);
+	bloom_save(&classic, "/tmp/sbloom");
+	bloom_destroy(&classic);
+	sbloom_destroy(&loaded);
+	if (sbloom_load(&loaded, "/tmp/sbloom") != BF_INVALIDFILE) {
+		fprintf(stderr, "FAILURE: loaded a classic filter as a scalable one\n");
+		return EXIT_FAILURE;
+	}
+	remove("/tmp/sbloom");
+
+	// the hash strategy can only change while the filter is empty
+	if (sbloom_set_hash(&sbf, HASH_WYHASH) != false) {
+		fprintf(stderr, "FAILURE: sbloom_set_hash() on a filter with elements\n");
+		return EXIT_FAILURE;
+	}
+	sbloom_destroy(&sbf);
+
+	sbloom_init(&sbf, INITIAL, ACCURACY);
+	if (sbloom_set_hash(&sbf, HASH_WYHASH) != true ||
+		sbloom_add_string(&sbf, "wyhash") != BF_SUCCESS ||
+		!sbloom_lookup_string(&sbf, "wyhash")) {
+		fprintf(stderr, "FAILURE: sbloom_set_hash()\n");
+		return EXIT_FAILURE;
+	}
+	sbloom_destroy(&sbf);
+
+	return EXIT_SUCCESS;
+}
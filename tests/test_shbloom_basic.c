@@ -0,0 +1,193 @@
+/* test_shbloom_basic.c -- sharded Bloom filters.
+ *
+ * Fills a sharded filter, checks elements spread evenly over shards,
+ * that it loses nothing and keeps about the false positive rate of a
+ * classic filter, then merges, saves and loads it and shares a
+ * SHBLOOM_FLAG_LOCKED filter between threads. Prints where shards were
+ * placed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bloom.h"
+#include "shbloom.h"
+
+#define ELEMENTS 100000
+#define ACCURACY 0.01
+#define SHARDS   8
+#define THREADS  4
+
+static shbloomfilter shared;
+
+static double false_positive_rate(const shbloomfilter *sf) {
+	size_t false_positives = 0;
+	char   key[32];
+
+	for (size_t i = 0; i < 100000; i++) {
+		snprintf(key, sizeof(key), "absent%zu", i);
+		false_positives += shbloom_lookup_string(sf, key);
+	}
+
+	return false_positives / 100000.0;
+}
+
+// each thread adds its own elements and checks them
+static void *worker(void *arg) {
+	size_t id = (size_t)arg;
+	char   key[32];
+
+	for (size_t i = 0; i < ELEMENTS / THREADS; i++) {
+		snprintf(key, sizeof(key), "t%zu-%zu", id, i);
+		shbloom_add_string(&shared, key);
+		if (!shbloom_lookup_string(&shared, key)) {
+			return (void *)1;
+		}
+	}
+
+	return NULL;
+}
+
+int main() {
+	shbloomfilter sf, other, merged, loaded;
+	size_t        per_shard[SHARDS] = {0};
+	char          key[32];
+	double        rate;
+
+	printf("testing sharded bloom filter\n");
+
+	if (shbloom_init(&sf, ELEMENTS, ACCURACY, 0) != BF_INVALIDPARAM ||
+		shbloom_init(&sf, ELEMENTS, ACCURACY, SHBLOOM_MAX_SHARDS + 1) != BF_INVALIDPARAM ||
+		shbloom_init(&sf, 0, ACCURACY, SHARDS) != BF_INVALIDPARAM) {
+		fprintf(stderr, "FAILURE: shbloom_init() accepted invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	if (shbloom_init(&sf, ELEMENTS, ACCURACY, SHARDS) != BF_SUCCESS ||
+		shbloom_init(&other, ELEMENTS, ACCURACY, SHARDS) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: shbloom_init()\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%d NUMA nodes, shards on:", shbloom_numa_nodes());
+	for (size_t i = 0; i < SHARDS; i++) {
+		printf(" %d", shbloom_shard_node(&sf, i));
+	}
+	printf("\n");
+
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		shbloom_add_string(&sf, key);
+		per_shard[shbloom_shard(&sf, key, strlen(key))]++;
+	}
+
+	for (size_t i = 0; i < SHARDS; i++) {
+		if (per_shard[i] < ELEMENTS / SHARDS * 0.95 || per_shard[i] > ELEMENTS / SHARDS * 1.05) {
+			fprintf(stderr, "FAILURE: shard %zu holds %zu elements\n", i, per_shard[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "key%zu", i);
+		if (!shbloom_lookup_string(&sf, key)) {
+			fprintf(stderr, "FAILURE: \"%s\" should be in the filter\n", key);
+			return EXIT_FAILURE;
+		}
+	}
+
+	rate = false_positive_rate(&sf);
+	printf("%zu bytes in %d shards, %.3f%% full, %.3f%% false positives, %.3f%% estimated\n",
+		   shbloom_memory(&sf), SHARDS, shbloom_saturation(&sf), rate * 100,
+		   shbloom_estimate_false_positive_rate(&sf) * 100);
+
+	if (rate > ACCURACY * 1.2 || shbloom_estimate_false_positive_rate(&sf) > ACCURACY * 1.2) {
+		fprintf(stderr, "FAILURE: false positive rate %f exceeds %f\n", rate, ACCURACY);
+		return EXIT_FAILURE;
+	}
+
+	// merge with a filter holding other elements
+	for (size_t i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "other%zu", i);
+		shbloom_add_string(&other, key);
+	}
+
+	if (shbloom_merge(&merged, &sf, &other) != BF_SUCCESS ||
+		!shbloom_lookup_string(&merged, "key0") ||
+		!shbloom_lookup_string(&merged, "other999") ||
+		shbloom_saturation_count(&merged) < shbloom_saturation_count(&sf)) {
+		fprintf(stderr, "FAILURE: shbloom_merge()\n");
+		return EXIT_FAILURE;
+	}
+	shbloom_destroy(&merged);
+	shbloom_destroy(&other);
+
+	shbloom_init(&other, ELEMENTS, ACCURACY, SHARDS / 2);
+	if (shbloom_merge(&merged, &sf, &other) != BF_INVALIDFILE) {
+		fprintf(stderr, "FAILURE: merged filters with different shard counts\n");
+		return EXIT_FAILURE;
+	}
+	shbloom_destroy(&other);
+
+	// save and load as one logical filter
+	if (shbloom_save(&sf, "/tmp/shbloom") != BF_SUCCESS ||
+		shbloom_load(&loaded, "/tmp/shbloom") != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: shbloom_save() / shbloom_load()\n");
+		return EXIT_FAILURE;
+	}
+
+	if (loaded.count != sf.count ||
+		shbloom_saturation_count(&loaded) != shbloom_saturation_count(&sf) ||
+		false_positive_rate(&loaded) != rate ||
+		!shbloom_lookup_string(&loaded, "key99999")) {
+		fprintf(stderr, "FAILURE: loaded filter differs\n");
+		return EXIT_FAILURE;
+	}
+	shbloom_destroy(&loaded);
+
+	// a file that isn't a sharded Bloom filter
+	bloomfilter classic;
+
+	bloom_init(&classic, 1000, ACCURACY);
+	bloom_save(&classic, "/tmp/shbloom");
+	bloom_destroy(&classic);
+	if (shbloom_load(&loaded, "/tmp/shbloom") != BF_INVALIDFILE) {
+		fprintf(stderr, "FAILURE: loaded a classic filter as a sharded one\n");
+		return EXIT_FAILURE;
+	}
+	remove("/tmp/shbloom");
+
+	shbloom_clear(&sf);
+	if (shbloom_saturation_count(&sf) != 0 || shbloom_lookup_string(&sf, "key0")) {
+		fprintf(stderr, "FAILURE: shbloom_clear()\n");
+		return EXIT_FAILURE;
+	}
+	shbloom_destroy(&sf);
+
+	// threads sharing a locked filter
+	if (shbloom_init_flags(&shared, ELEMENTS, ACCURACY, SHARDS, SHBLOOM_FLAG_LOCKED, NULL) != BF_SUCCESS) {
+		fprintf(stderr, "FAILURE: shbloom_init_flags()\n");
+		return EXIT_FAILURE;
+	}
+
+	pthread_t threads[THREADS];
+	void     *result;
+	bool      failed = false;
+
+	for (size_t i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	}
+	for (size_t i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], &result);
+		failed |= (result != NULL);
+	}
+
+	if (failed || !shbloom_lookup_string(&shared, "t3-0")) {
+		fprintf(stderr, "FAILURE: elements missing from a locked filter\n");
+		return EXIT_FAILURE;
+	}
+	shbloom_destroy(&shared);
+
+	return EXIT_SUCCESS;
+}
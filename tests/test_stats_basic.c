@@ -0,0 +1,294 @@
+/* test_stats_basic.c -- runtime statistics.
+ *
+ * Built with ARCHBLOOM_STATS whatever the library was configured
+ * with. Checks the adds, lookups and hits counted by each kind of
+ * filter, that the bits set tracked by Bloom filters always match the
+ * bitmap, through clearing, folding, merging, loading and concurrent
+ * adds, and the saturations and expiry sweeps counted by counting and
+ * time-decaying filters.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bloom.h"
+#include "shbloom.h"
+#include "cbloom.h"
+#include "tdbloom.h"
+#include "cuckoo.h"
+
+#define ELEMENTS 1000
+#define THREADS  4
+
+// bits set in a Bloom filter, counted the slow way
+static size_t popcount(const bloomfilter *bf) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < bf->bitmap_size; i++) {
+		count += __builtin_popcount(bf->bitmap[i]);
+	}
+
+	return count;
+}
+
+// the tracked bits set of `bf` match its bitmap
+static bool check_set(const bloomfilter *bf, const char *after) {
+	archbloom_stats stats;
+
+	if (!bloom_stats(bf, &stats) || stats.set != popcount(bf) ||
+		bloom_saturation_count(bf) != popcount(bf)) {
+		fprintf(stderr, "FAILURE: %zu bits set after %s, tracked %llu\n",
+				popcount(bf), after, (unsigned long long)stats.set);
+		return false;
+	}
+
+	return true;
+}
+
+static void add_range(bloomfilter *bf, const char *prefix, const size_t first, const size_t count) {
+	char key[32];
+
+	for (size_t i = first; i < first + count; i++) {
+		snprintf(key, sizeof(key), "%s-%zu", prefix, i);
+		bloom_add_string(bf, key);
+	}
+}
+
+struct adder {
+	bloomfilter *bf;
+	size_t       first;
+};
+
+static void *add_thread(void *arg) {
+	struct adder *adder = arg;
+
+	add_range(adder->bf, "concurrent", adder->first, ELEMENTS);
+
+	return NULL;
+}
+
+static bool check_bloom(void) {
+	bloomfilter     bf, other, merged;
+	archbloom_stats stats;
+	char            path[] = "/tmp/bloom-stats.XXXXXX";
+	char            key[32];
+	size_t          hits = 0;
+	int             fd;
+
+	printf("testing bloom_stats()\n");
+	bloom_init(&bf, ELEMENTS, 0.01);
+	add_range(&bf, "element", 0, ELEMENTS / 2);
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "element-%zu", i);
+		hits += bloom_lookup_string(&bf, key);
+	}
+
+	if (!bloom_stats(&bf, &stats) || stats.adds != ELEMENTS / 2 || stats.lookups != ELEMENTS ||
+		stats.hits != hits || hits < ELEMENTS / 2 || !check_set(&bf, "adding")) {
+		fprintf(stderr, "FAILURE: %llu adds, %llu lookups, %llu hits\n",
+				(unsigned long long)stats.adds, (unsigned long long)stats.lookups,
+				(unsigned long long)stats.hits);
+		return false;
+	}
+
+	// a lookup or add is a lookup, then a hit or an add
+	if (bloom_lookup_or_add_string(&bf, "element-0") != true ||
+		bloom_lookup_or_add_string(&bf, "new") != false ||
+		!bloom_stats(&bf, &stats) || stats.adds != ELEMENTS / 2 + 1 ||
+		stats.lookups != ELEMENTS + 2 || stats.hits != hits + 1 ||
+		!check_set(&bf, "bloom_lookup_or_add()")) {
+		fprintf(stderr, "FAILURE: bloom_lookup_or_add() statistics\n");
+		return false;
+	}
+
+	bloom_clear(&bf);
+	if (!check_set(&bf, "bloom_clear()") || bloom_saturation_count(&bf) != 0) {
+		return false;
+	}
+
+	// bitmaps changed in bulk are recounted
+	add_range(&bf, "element", 0, ELEMENTS);
+	bloom_init(&other, ELEMENTS, 0.01);
+	add_range(&other, "other", 0, ELEMENTS);
+	if (bloom_merge(&merged, &bf, &other) != BF_SUCCESS || !check_set(&merged, "bloom_merge()")) {
+		return false;
+	}
+	bloom_destroy(&merged);
+	if (bloom_intersect(&merged, &bf, &other) != BF_SUCCESS || !check_set(&merged, "bloom_intersect()")) {
+		return false;
+	}
+	bloom_destroy(&merged);
+	bloom_destroy(&other);
+
+	fd = mkstemp(path);
+	if (fd == -1 || bloom_save(&bf, path) != BF_SUCCESS || bloom_load(&other, path) != BF_SUCCESS ||
+		!check_set(&other, "bloom_load()") || !bloom_stats(&other, &stats) || stats.adds != 0) {
+		fprintf(stderr, "FAILURE: statistics of a loaded filter\n");
+		return false;
+	}
+	close(fd);
+	unlink(path);
+	bloom_destroy(&other);
+
+	bloom_destroy(&bf);
+	bloom_init_flags(&bf, ELEMENTS * 8, 0.01, BLOOM_FLAG_POW2);
+	add_range(&bf, "element", 0, ELEMENTS);
+	if (bloom_fold(&bf, 2) != BF_SUCCESS || !check_set(&bf, "bloom_fold()")) {
+		return false;
+	}
+	bloom_destroy(&bf);
+
+	// threads count on their own copies of the counters
+	pthread_t    threads[THREADS];
+	struct adder adders[THREADS];
+
+	bloom_init_flags(&bf, ELEMENTS * THREADS, 0.01, BLOOM_FLAG_CONCURRENT);
+	for (size_t i = 0; i < THREADS; i++) {
+		adders[i] = (struct adder){ .bf = &bf, .first = i * ELEMENTS };
+		pthread_create(&threads[i], NULL, add_thread, &adders[i]);
+	}
+	for (size_t i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	if (!bloom_stats(&bf, &stats) || stats.adds != ELEMENTS * THREADS ||
+		!check_set(&bf, "concurrent adds")) {
+		fprintf(stderr, "FAILURE: %llu concurrent adds counted\n", (unsigned long long)stats.adds);
+		return false;
+	}
+	bloom_destroy(&bf);
+
+	return true;
+}
+
+static bool check_shbloom(void) {
+	shbloomfilter   sf;
+	archbloom_stats stats;
+	size_t          set = 0;
+	char            key[32];
+
+	printf("testing shbloom_stats()\n");
+	shbloom_init(&sf, ELEMENTS, 0.01, 4);
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "element-%zu", i);
+		shbloom_add_string(&sf, key);
+		shbloom_lookup_string(&sf, key);
+	}
+	for (size_t i = 0; i < sf.count; i++) {
+		set += popcount(&sf.shards[i]);
+	}
+
+	if (!shbloom_stats(&sf, &stats) || stats.adds != ELEMENTS || stats.lookups != ELEMENTS ||
+		stats.hits != ELEMENTS || stats.set != set || shbloom_saturation_count(&sf) != set) {
+		fprintf(stderr, "FAILURE: shbloom_stats() %llu adds, %llu bits set\n",
+				(unsigned long long)stats.adds, (unsigned long long)stats.set);
+		return false;
+	}
+	shbloom_destroy(&sf);
+
+	return true;
+}
+
+static bool check_cbloom(void) {
+	cbloomfilter    cbf;
+	archbloom_stats stats;
+
+	printf("testing cbloom_stats()\n");
+	cbloom_init(&cbf, ELEMENTS, 0.01, COUNTER_4BIT);
+
+	// the 16th add of an element finds its counters at 15
+	for (size_t i = 0; i < 20; i++) {
+		cbloom_add_string(&cbf, "saturated");
+	}
+	cbloom_lookup_string(&cbf, "saturated");
+	cbloom_lookup_string(&cbf, "absent");
+	cbloom_lookup_or_add_string(&cbf, "added");
+
+	if (!cbloom_stats(&cbf, &stats) || stats.adds != 21 || stats.saturations != 5 ||
+		stats.lookups != 3 || stats.hits != 1 || stats.set != 0) {
+		fprintf(stderr, "FAILURE: cbloom_stats() %llu adds, %llu saturations, %llu lookups, %llu hits\n",
+				(unsigned long long)stats.adds, (unsigned long long)stats.saturations,
+				(unsigned long long)stats.lookups, (unsigned long long)stats.hits);
+		return false;
+	}
+	cbloom_destroy(&cbf);
+
+	return true;
+}
+
+static bool check_tdbloom(void) {
+	tdbloom         tdbf;
+	archbloom_stats stats;
+	size_t          cleared;
+
+	printf("testing tdbloom_stats()\n");
+	tdbloom_init(&tdbf, ELEMENTS, 0.01, 10);
+	for (size_t i = 0; i < 10; i++) {
+		tdbloom_add_string(&tdbf, "expires");
+	}
+	tdbloom_lookup_string(&tdbf, "expires");
+
+	// everything was added more than the timeout ago
+	tdbf.start_time -= 20;
+	tdbloom_lookup_string(&tdbf, "expires");
+	if (tdbloom_count_expired(&tdbf) != tdbf.hashcount || !tdbloom_stats(&tdbf, &stats) || stats.reaps != 0) {
+		fprintf(stderr, "FAILURE: counting expired timestamps counted as reaped\n");
+		return false;
+	}
+
+	cleared = tdbloom_clear_expired(&tdbf);
+	if (!tdbloom_stats(&tdbf, &stats) || cleared != tdbf.hashcount || stats.reaps != cleared ||
+		stats.adds != 10 || stats.lookups != 2 || stats.hits != 1) {
+		fprintf(stderr, "FAILURE: tdbloom_stats() %llu reaps, %llu adds, %llu lookups, %llu hits\n",
+				(unsigned long long)stats.reaps, (unsigned long long)stats.adds,
+				(unsigned long long)stats.lookups, (unsigned long long)stats.hits);
+		return false;
+	}
+	tdbloom_destroy(&tdbf);
+
+	return true;
+}
+
+static bool check_cuckoo(void) {
+	cuckoofilter cf;
+	cuckoo_stats stats;
+	char         key[32];
+	size_t       hits = 0;
+
+	printf("testing cuckoo_get_stats() lookups\n");
+	cuckoo_init(&cf, ELEMENTS, 4, 500);
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "element-%zu", i);
+		cuckoo_add_string(&cf, key);
+	}
+	for (size_t i = 0; i < ELEMENTS * 2; i++) {
+		snprintf(key, sizeof(key), "element-%zu", i);
+		hits += cuckoo_lookup_string(&cf, key);
+	}
+
+	cuckoo_get_stats(&cf, &stats);
+	if (stats.lookups != ELEMENTS * 2 || stats.hits != hits || hits < ELEMENTS) {
+		fprintf(stderr, "FAILURE: cuckoo_get_stats() %zu lookups, %zu hits\n", stats.lookups, stats.hits);
+		return false;
+	}
+	cuckoo_destroy(&cf);
+
+	return true;
+}
+
+int main() {
+	if (!archbloom_stats_enabled()) {
+		fprintf(stderr, "FAILURE: built without ARCHBLOOM_STATS\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!check_bloom() || !check_shbloom() || !check_cbloom() ||
+		!check_tdbloom() || !check_cuckoo()) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
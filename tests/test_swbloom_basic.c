@@ -0,0 +1,168 @@
+/* test_swbloom_basic.c -- sliding window Bloom filters.
+ *
+ * Moves a filter's window by shifting its start time back a period at
+ * a time, checking that elements stay for the timeout, expire after
+ * it, are reported as expired for one more period and are then
+ * forgotten. Prints the memory used next to a time-decaying filter of
+ * the same capacity.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "swbloom.h"
+#include "tdbloom.h"
+
+#define ELEMENTS    10000
+#define ACCURACY    0.01
+#define TIMEOUT     60
+#define GENERATIONS 4
+
+// elements "<prefix><i>" found, or reported expired
+static size_t count_found(const swbloom *swbf, const char *prefix, const bool expired) {
+	size_t found = 0;
+	char   key[32];
+
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "%s%zu", prefix, i);
+		found += expired ? swbloom_has_expired_string(swbf, key) : swbloom_lookup_string(swbf, key);
+	}
+
+	return found;
+}
+
+static void add_all(swbloom *swbf, const char *prefix) {
+	char key[32];
+
+	for (size_t i = 0; i < ELEMENTS; i++) {
+		snprintf(key, sizeof(key), "%s%zu", prefix, i);
+		swbloom_add_string(swbf, key);
+	}
+}
+
+// move the filter's clock `periods` periods forward
+static void advance(swbloom *swbf, const size_t periods) {
+	swbf->start_time -= periods * swbf->period;
+}
+
+static bool test_window(const uint32_t flags) {
+	swbloom swbf;
+	size_t  found, absent;
+
+	printf("testing swbloom with flags 0x%02x\n", flags);
+
+	if (swbloom_init_flags(&swbf, ELEMENTS, ACCURACY, TIMEOUT, GENERATIONS, flags) != SWBF_SUCCESS ||
+		swbf.period != TIMEOUT / (GENERATIONS - 1)) {
+		fprintf(stderr, "FAILURE: swbloom_init_flags()\n");
+		return false;
+	}
+
+	// epoch 0: "a" elements, which must still be there at epoch 3
+	add_all(&swbf, "a");
+	absent = count_found(&swbf, "absent", false);
+	if (count_found(&swbf, "a", false) != ELEMENTS || absent > ELEMENTS * ACCURACY * 1.5) {
+		fprintf(stderr, "FAILURE: %zu false positives\n", absent);
+		return false;
+	}
+	printf("%zu bytes, %zu hashes, %.3f%% full, %zu false positives in %d\n",
+		   swbloom_memory(&swbf), swbf.hashcount, swbloom_saturation(&swbf), absent, ELEMENTS);
+
+	advance(&swbf, 1);
+	add_all(&swbf, "b");
+	advance(&swbf, 2);
+	if (count_found(&swbf, "a", false) != ELEMENTS || count_found(&swbf, "b", false) != ELEMENTS ||
+		count_found(&swbf, "a", true) != 0) {
+		fprintf(stderr, "FAILURE: elements left the window early\n");
+		return false;
+	}
+
+	// epoch 4: "a" has left the window but is reported expired
+	advance(&swbf, 1);
+	found = count_found(&swbf, "a", false);
+	if (found > ELEMENTS * ACCURACY * 1.5 ||
+		count_found(&swbf, "a", true) < ELEMENTS - found ||
+		count_found(&swbf, "b", false) != ELEMENTS ||
+		count_found(&swbf, "absent", true) > ELEMENTS / 10) {
+		fprintf(stderr, "FAILURE: %zu expired elements still found\n", found);
+		return false;
+	}
+
+	// epoch 5: adding reuses the bitmap "a" was in
+	advance(&swbf, 1);
+	swbloom_add_string(&swbf, "c");
+	if (count_found(&swbf, "a", true) > ELEMENTS * ACCURACY * 3 ||
+		count_found(&swbf, "b", false) > ELEMENTS * ACCURACY * 1.5 ||
+		count_found(&swbf, "b", true) < ELEMENTS * 0.99 ||
+		!swbloom_lookup_string(&swbf, "c")) {
+		fprintf(stderr, "FAILURE: generation not rotated\n");
+		return false;
+	}
+
+	if (swbloom_clear_expired(&swbf) != 1 || count_found(&swbf, "b", true) != 0) {
+		fprintf(stderr, "FAILURE: swbloom_clear_expired()\n");
+		return false;
+	}
+
+	// a filter left alone for longer than the window
+	advance(&swbf, 100);
+	if (swbloom_lookup_string(&swbf, "c") || swbloom_saturation_count(&swbf) != 0) {
+		fprintf(stderr, "FAILURE: elements outlived a long pause\n");
+		return false;
+	}
+	swbloom_add_string(&swbf, "d");
+	if (!swbloom_lookup_string(&swbf, "d") || swbloom_has_expired_string(&swbf, "d")) {
+		fprintf(stderr, "FAILURE: add after a long pause\n");
+		return false;
+	}
+
+	swbloom_clear(&swbf);
+	if (swbloom_saturation_count(&swbf) != 0 || swbloom_has_expired_string(&swbf, "c") ||
+		!swbloom_set_hash(&swbf, HASH_WYHASH)) {
+		fprintf(stderr, "FAILURE: swbloom_clear()\n");
+		return false;
+	}
+	swbloom_add_string(&swbf, "e");
+	if (!swbloom_lookup_string(&swbf, "e") || swbloom_set_hash(&swbf, HASH_MMH3)) {
+		fprintf(stderr, "FAILURE: swbloom_set_hash()\n");
+		return false;
+	}
+
+	swbloom_destroy(&swbf);
+
+	return true;
+}
+
+int main() {
+	uint32_t flags[] = {0, SWBLOOM_FLAG_POW2, SWBLOOM_FLAG_FASTRANGE};
+	swbloom  swbf;
+	tdbloom  tdbf;
+
+	if (swbloom_init(&swbf, ELEMENTS, ACCURACY, 0, GENERATIONS) != SWBF_INVALIDTIMEOUT ||
+		swbloom_init(&swbf, ELEMENTS, ACCURACY, TIMEOUT, 1) != SWBF_INVALIDGENERATIONS ||
+		swbloom_init(&swbf, ELEMENTS, ACCURACY, TIMEOUT, SWBLOOM_MAX_GENERATIONS + 1) != SWBF_INVALIDGENERATIONS ||
+		swbloom_init(&swbf, 0, ACCURACY, TIMEOUT, GENERATIONS) != SWBF_INVALIDPARAM ||
+		strcmp(swbloom_strerror(SWBF_INVALIDGENERATIONS), "Invalid number of generations") != 0) {
+		fprintf(stderr, "FAILURE: swbloom_init() accepted invalid parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		if (!test_window(flags[i])) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	// an hour window of a million elements, as each filter stores it
+	swbloom_init(&swbf, 1000000, ACCURACY, 3600, GENERATIONS);
+	tdbloom_init(&tdbf, 1000000, ACCURACY, 3600);
+	printf("1000000 elements for 3600 seconds: %zu bytes in %d generations, %zu bytes of timestamps\n",
+		   swbloom_memory(&swbf), GENERATIONS, tdbf.filter_size);
+	if (swbloom_memory(&swbf) >= tdbf.filter_size) {
+		fprintf(stderr, "FAILURE: sliding window filter larger than a time-decaying one\n");
+		return EXIT_FAILURE;
+	}
+	swbloom_destroy(&swbf);
+	tdbloom_destroy(&tdbf);
+
+	return EXIT_SUCCESS;
+}
@@ -2,11 +2,121 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
+#include "hash.h"
 #include "tdbloom.h"
 
+static time_t now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+/* pin() -- move the start time of a filter so its current timestamp
+ * is `ts`. Called before every sweep, so a slow test can't drift.
+ */
+static void pin(tdbloom *tdbf, const uint64_t ts) {
+	tdbf->start_time = now() - (ts - 1);
+}
+
+// a timestamp `value` has expired when the filter's timestamp is `ts`
+static bool expired_at(const tdbloom *tdbf, const size_t timeout, const uint64_t ts, const uint64_t value) {
+	uint64_t age = (ts >= value) ? ts - value : ts - value + tdbf->max_time;
+
+	return value != 0 && age > timeout;
+}
+
+/* check_sweep() -- fill a filter with random timestamps, pin its start
+ * time so the current timestamp is `ts`, and check the expiry sweeps
+ * against a straightforward reference.
+ */
+static bool check_sweep(const size_t timeout, const uint64_t ts) {
+	tdbloom tdbf;
+	size_t   expired = 0, live = 0, expired_first = 0;
+	size_t   counted, stepped = 0, remaining, saturated, swept, left, still_live, cleared;
+	float    saturation;
+
+	if (tdbloom_init(&tdbf, 10000, 0.01, timeout) != TDBF_SUCCESS) {
+		return false;
+	}
+
+	// the timestamp a second later, should the clock tick between
+	// pinning the start time and a sweep reading it
+	const uint64_t next = ts % tdbf.max_time + 1;
+
+	for (size_t i = 0; i < tdbf.size; i++) {
+		uint64_t value = (uint64_t)rand() << 32 | rand();
+		if (tdbf.max_time != UINT64_MAX) {
+			value %= (uint64_t)tdbf.max_time + 1;
+		}
+
+		// leave out timestamps that expire on that tick
+		if (i % 4 == 0 || expired_at(&tdbf, timeout, ts, value) != expired_at(&tdbf, timeout, next, value)) {
+			value = 0;
+		}
+
+		switch (tdbf.bytes) {
+		case 1: ((uint8_t *)tdbf.filter)[i]  = value; break;
+		case 2: ((uint16_t *)tdbf.filter)[i] = value; break;
+		case 4: ((uint32_t *)tdbf.filter)[i] = value; break;
+		case 8: ((uint64_t *)tdbf.filter)[i] = value; break;
+		}
+
+		if (expired_at(&tdbf, timeout, ts, value)) {
+			expired++;
+			expired_first += (i < tdbf.size / 2);
+		} else if (value != 0) {
+			live++;
+		}
+	}
+
+	// sweep the first half a step at a time, then the rest at once
+	pin(&tdbf, ts);
+	counted = tdbloom_count_expired(&tdbf);
+	for (size_t i = 0; i < tdbf.size / 2; i += 1000) {
+		pin(&tdbf, ts);
+		stepped += tdbloom_clear_expired_step(&tdbf, (tdbf.size / 2 - i < 1000) ? tdbf.size / 2 - i : 1000);
+	}
+
+	pin(&tdbf, ts);
+	remaining = tdbloom_count_expired(&tdbf);
+	pin(&tdbf, ts);
+	saturated = tdbloom_saturation_count(&tdbf);
+	pin(&tdbf, ts);
+	swept = tdbloom_clear_expired_saturation(&tdbf, &saturation);
+	pin(&tdbf, ts);
+	left = tdbloom_count_expired(&tdbf);
+	pin(&tdbf, ts);
+	still_live = tdbloom_saturation_count(&tdbf);
+	pin(&tdbf, ts);
+	cleared = tdbloom_clear_expired(&tdbf);
+
+	if (counted != expired ||
+		stepped != expired_first ||
+		remaining != expired - expired_first ||
+		saturated != live ||
+		swept != expired - expired_first ||
+		saturation != (float)live / tdbf.size * 100 ||
+		left != 0 ||
+		still_live != live ||
+		cleared != 0) {
+		fprintf(stderr, "FAILURE: %d byte sweep at %llu: expected %zu expired, %zu live. got %zu, %zu\n",
+				tdbf.bytes, (unsigned long long)ts, expired, live, counted, saturated);
+		tdbloom_destroy(&tdbf);
+		return false;
+	}
+
+	tdbloom_destroy(&tdbf);
+
+	return true;
+}
+
 int main() {
 	tdbloom tf;
 
@@ -95,6 +205,141 @@ int main() {
 		return EXIT_FAILURE;
 	}
 
+	// batch functions
+	printf("testing tdbloom_add_batch(), tdbloom_lookup_batch()\n");
+	tdbloom     batch;
+	char        batch_keys[64][16];
+	const void *batch_elements[64];
+	size_t      batch_lens[64];
+	uint8_t     batch_results[64 / 8];
+
+	for (size_t i = 0; i < 64; i++) {
+		snprintf(batch_keys[i], sizeof(batch_keys[i]), "batch-%zu", i);
+		batch_elements[i] = batch_keys[i];
+		batch_lens[i]     = strlen(batch_keys[i]);
+	}
+
+	tdbloom_init(&batch, 1000, 0.01, 60);
+	tdbloom_add_batch(&batch, batch_elements, batch_lens, 32);
+	tdbloom_lookup_batch(&batch, batch_elements, batch_lens, 64, batch_results);
+	for (size_t i = 0; i < 64; i++) {
+		if (TDBLOOM_BATCH_RESULT(batch_results, i) != tdbloom_lookup_string(&batch, batch_keys[i]) ||
+			(i < 32 && TDBLOOM_BATCH_RESULT(batch_results, i) != 1)) {
+			fprintf(stderr, "FAILURE: tdbloom_lookup_batch() result %zu is wrong\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	uint64_t hash[2];
+	hash_128(batch.hash, batch_keys[0], batch_lens[0], hash);
+	if (!tdbloom_lookup_hashed(&batch, hash)) {
+		fprintf(stderr, "FAILURE: tdbloom_lookup_hashed()\n");
+		return EXIT_FAILURE;
+	}
+
+	batch.start_time -= 61;
+	tdbloom_lookup_batch(&batch, batch_elements, batch_lens, 32, batch_results);
+	for (size_t i = 0; i < 32; i++) {
+		if (TDBLOOM_BATCH_RESULT(batch_results, i) != 0) {
+			fprintf(stderr, "FAILURE: \"%s\" should have expired\n", batch_keys[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	tdbloom_destroy(&batch);
+
+	// hash to position mappings and hash strategies, and save/load round trips
+	uint32_t mapping_flags[] = {0, TDBLOOM_FLAG_POW2, TDBLOOM_FLAG_FASTRANGE};
+
+	for (size_t m = 0; m < sizeof(mapping_flags) / sizeof(mapping_flags[0]); m++) {
+		tdbloom mapped, mapped_loaded;
+
+		printf("testing tdbloom_init_flags() with flags 0x%02x\n", mapping_flags[m]);
+		if (tdbloom_init_flags(&mapped, 1000, 0.01, 60, mapping_flags[m]) != TDBF_SUCCESS) {
+			fprintf(stderr, "FAILURE: tdbloom_init_flags()\n");
+			return EXIT_FAILURE;
+		}
+
+		if ((mapped.flags & TDBLOOM_FLAG_POW2) && (mapped.size & (mapped.size - 1)) != 0) {
+			fprintf(stderr, "FAILURE: size %zu is not a power of two\n", mapped.size);
+			return EXIT_FAILURE;
+		}
+
+		hash_strategy strategy = (hash_strategy)((m + 1) % HASH_STRATEGYCOUNT);
+		if (tdbloom_set_hash(&mapped, strategy) != true) {
+			fprintf(stderr, "FAILURE: tdbloom_set_hash(%s)\n", hash_strategy_name(strategy));
+			return EXIT_FAILURE;
+		}
+
+		tdbloom_add_batch(&mapped, batch_elements, batch_lens, 64);
+
+		char mapped_file_name[] = "/tmp/tdbloom-mapped.XXXXXX";
+		int  mapped_fd          = mkstemp(mapped_file_name);
+		if (mapped_fd == -1) {
+			fprintf(stderr, "FAILURE: unable to create tmp file\n");
+			return EXIT_FAILURE;
+		}
+		close(mapped_fd);
+
+		tdbloom_error_t error = tdbloom_save(&mapped, mapped_file_name);
+		if (error != TDBF_SUCCESS) {
+			fprintf(stderr, "FAILURE: tdbloom_save(): %s\n", tdbloom_strerror(error));
+			return EXIT_FAILURE;
+		}
+
+		error = tdbloom_load(&mapped_loaded, mapped_file_name);
+		if (error != TDBF_SUCCESS) {
+			fprintf(stderr, "FAILURE: tdbloom_load(): %s\n", tdbloom_strerror(error));
+			return EXIT_FAILURE;
+		}
+
+		tdbloom file_mapped;
+		error = tdbloom_map(&file_mapped, mapped_file_name, false);
+		remove(mapped_file_name);
+		if (error != TDBF_SUCCESS) {
+			fprintf(stderr, "FAILURE: tdbloom_map(): %s\n", tdbloom_strerror(error));
+			return EXIT_FAILURE;
+		}
+
+		if (((uintptr_t)file_mapped.filter % 64) != 0 ||
+			file_mapped.flags != mapping_flags[m] ||
+			file_mapped.hash != strategy ||
+			tdbloom_lookup_string(&file_mapped, batch_keys[0]) != true) {
+			fprintf(stderr, "FAILURE: mapped filter does not match saved filter\n");
+			return EXIT_FAILURE;
+		}
+		tdbloom_destroy(&file_mapped);
+
+		if (mapped_loaded.flags != mapping_flags[m] ||
+			mapped_loaded.hash != strategy ||
+			mapped_loaded.timeout != mapped.timeout ||
+			mapped_loaded.max_time != mapped.max_time) {
+			fprintf(stderr, "FAILURE: tdbloom_load() did not restore the filter settings\n");
+			return EXIT_FAILURE;
+		}
+
+		for (size_t i = 0; i < 64; i++) {
+			if (tdbloom_lookup_string(&mapped_loaded, batch_keys[i]) != true) {
+				fprintf(stderr, "FAILURE: \"%s\" should be in loaded filter\n", batch_keys[i]);
+				return EXIT_FAILURE;
+			}
+		}
+
+		tdbloom_destroy(&mapped);
+		tdbloom_destroy(&mapped_loaded);
+	}
+
+	// expiry sweeps, including timestamps that have wrapped around
+	printf("testing tdbloom_clear_expired(), tdbloom_count_expired(), tdbloom_saturation_count()\n");
+	size_t   sweep_timeouts[] = { 10, 200, 1000, 100000, (size_t)UINT32_MAX + 1 };
+	uint64_t sweep_times[]    = { 1, 5, 150, 254, 255 };
+	for (size_t t = 0; t < sizeof(sweep_timeouts) / sizeof(sweep_timeouts[0]); t++) {
+		for (size_t n = 0; n < sizeof(sweep_times) / sizeof(sweep_times[0]); n++) {
+			if (!check_sweep(sweep_timeouts[t], sweep_times[n])) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
 	// Cleanup
 	tdbloom_destroy(&tf);
 	tdbloom_destroy(&tf2);
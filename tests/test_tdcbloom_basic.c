@@ -1,9 +1,267 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "hash.h"
 #include "tdcbloom.h"
 
+static time_t now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+// set_entry() -- write a counter and timestamp directly, for either layout
+static void set_entry(tdcbloom *tdcbf, size_t i, uint64_t counter, uint64_t timestamp) {
+	// little endian: the low bytes of a uint64_t are the narrower value
+	memcpy(tdcbf->counters + (i * tdcbf->counter_stride), &counter, tdcbf->counter_size_bytes);
+	memcpy(tdcbf->timers + (i * tdcbf->timer_stride), &timestamp, tdcbf->timer_size_bytes);
+}
+
+/* clear_expired_stepped() -- tdcbloom_clear_expired() a step at a
+ * time, wrapping past the end of the filter on the last step.
+ */
+static size_t clear_expired_stepped(tdcbloom *tdcbf) {
+	size_t expired = 0;
+
+	for (size_t i = 0; i < tdcbf->size; i += 999) {
+		expired += tdcbloom_clear_expired_step(tdcbf, 999);
+	}
+
+	return expired;
+}
+
+/**
+ * @brief Seconds a check_layouts() run may take before the clock moves
+ * far enough to change which entries have expired.
+ */
+#define CLOCK_SLACK 10
+
+// the age of `timestamp` when the clock reads `clock` seconds
+static uint64_t age_at(const tdcbloom *tdcbf, const uint64_t clock, const uint64_t timestamp) {
+	uint64_t ts = clock % tdcbf->max_time;
+
+	return (ts >= timestamp) ? ts - timestamp : ts - timestamp + tdcbf->max_time;
+}
+
+/* steady() -- `timestamp` stays expired, or stays live, for
+ * CLOCK_SLACK seconds after `clock`.
+ */
+static bool steady(const tdcbloom *tdcbf, const uint64_t clock, const uint64_t timestamp) {
+	bool expired = age_at(tdcbf, clock, timestamp) > tdcbf->timeout;
+
+	for (uint64_t later = clock + 1; later <= clock + CLOCK_SLACK; later++) {
+		if ((age_at(tdcbf, later, timestamp) > tdcbf->timeout) != expired) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* check_layouts() -- fill an interleaved and a TDCBLOOM_FLAG_SOA filter
+ * with the same random entries and check the sweeps agree with each
+ * other and with a straightforward reference. Timestamps are absolute,
+ * so entries that would expire while the sweeps run are left out
+ * rather than relying on the clock standing still.
+ */
+static bool check_layouts(counter_size csize, timer_size tsize) {
+	tdcbloom aos, soa;
+	size_t   expired = 0, saturated = 0;
+
+	if (tdcbloom_init(&aos, 5000, 0.01, 100, csize, tsize) != TDCBF_SUCCESS ||
+		tdcbloom_init_flags(&soa, 5000, 0.01, 100, csize, tsize, TDCBLOOM_FLAG_SOA) != TDCBF_SUCCESS) {
+		return false;
+	}
+
+	if (soa.flags != TDCBLOOM_FLAG_SOA || ((uintptr_t)soa.timers - (uintptr_t)soa.counters) % 64 != 0) {
+		return false;
+	}
+
+	srand(csize * 4 + tsize);
+
+	uint64_t clock = (uint64_t)now();
+	uint64_t ts    = clock % aos.max_time;
+	for (size_t i = 0; i < aos.size; i++) {
+		uint64_t counter   = (i % 3 == 0) ? 0 : (uint64_t)rand() % 200 + 1;
+		uint64_t timestamp = ((uint64_t)rand() << 31 | rand()) % aos.max_time;
+
+		// mostly recent entries, like a real filter
+		if (i % 5 != 0 || !steady(&aos, clock, timestamp)) {
+			timestamp = (ts >= 50) ? ts - 50 : ts;
+		}
+
+		set_entry(&aos, i, counter, timestamp);
+		set_entry(&soa, i, counter, timestamp);
+
+		if (timestamp != 0 && age_at(&aos, clock, timestamp) > aos.timeout) {
+			expired++;
+		}
+		if (timestamp != 0 || counter != 0) {
+			saturated++;
+		}
+	}
+
+	if (tdcbloom_count_expired(&aos) != expired ||
+		tdcbloom_count_expired(&soa) != expired ||
+		tdcbloom_saturation_count(&aos) != saturated ||
+		tdcbloom_saturation_count(&soa) != saturated ||
+		tdcbloom_get_average_count(&aos) != tdcbloom_get_average_count(&soa) ||
+		tdcbloom_clear_expired(&soa) != expired ||
+		clear_expired_stepped(&aos) != expired ||
+		tdcbloom_count_expired(&soa) != 0 ||
+		tdcbloom_saturation_count(&soa) != saturated - expired) {
+		fprintf(stderr, "FAILURE: counter size %d, timer size %d: expected %zu expired\n",
+				csize, tsize, expired);
+		return false;
+	}
+
+	for (size_t i = 0; i < aos.size; i++) {
+		if (memcmp(aos.counters + (i * aos.counter_stride), soa.counters + (i * soa.counter_stride), aos.counter_size_bytes) != 0 ||
+			memcmp(aos.timers + (i * aos.timer_stride), soa.timers + (i * soa.timer_stride), aos.timer_size_bytes) != 0) {
+			fprintf(stderr, "FAILURE: counter size %d, timer size %d: layouts differ at %zu\n", csize, tsize, i);
+			return false;
+		}
+	}
+
+	tdcbloom_add_string(&soa, "soa");
+	tdcbloom_add_string(&soa, "soa");
+	if (tdcbloom_count_string(&soa, "soa") < 2 || tdcbloom_lookup_string(&soa, "soa") != true) {
+		fprintf(stderr, "FAILURE: counter size %d, timer size %d: lookup with TDCBLOOM_FLAG_SOA\n", csize, tsize);
+		return false;
+	}
+
+	uint64_t hash[2];
+	hash_128(soa.hash, "soa", strlen("soa"), hash);
+	if (tdcbloom_count_hashed(&soa, hash) != tdcbloom_count_string(&soa, "soa") ||
+		tdcbloom_lookup_hashed(&soa, hash) != true) {
+		fprintf(stderr, "FAILURE: counter size %d, timer size %d: hashed lookup\n", csize, tsize);
+		return false;
+	}
+
+	// only libraries built with ARCHBLOOM_STATS keep statistics
+	archbloom_stats stats;
+	if (tdcbloom_stats(&soa, &stats) &&
+		(stats.reaps != expired || stats.adds != 2 || stats.lookups != 2 || stats.hits != 2 ||
+		 !tdcbloom_stats(&aos, &stats) || stats.reaps != expired)) {
+		fprintf(stderr, "FAILURE: counter size %d, timer size %d: tdcbloom_stats()\n", csize, tsize);
+		return false;
+	}
+
+	tdcbloom_destroy(&aos);
+	tdcbloom_destroy(&soa);
+
+	return true;
+}
+
+/* check_save() -- save a filter, then load it and map it back and
+ * check the copies match. Changes made through a writable mapping must
+ * reach the file, and a truncated file must be rejected.
+ */
+static bool check_save(const uint32_t flags) {
+	tdcbloom         saved, loaded, mapped;
+	tdcbloom_error_t error;
+	char             path[] = "/tmp/tdcbloom-save.XXXXXX";
+	char             key[32];
+	int              fd;
+
+	if (tdcbloom_init_flags(&saved, 1000, 0.01, 300, COUNTER_16BIT, TIMER_32BIT, flags) != TDCBF_SUCCESS ||
+		tdcbloom_set_hash(&saved, HASH_WYHASH) != true ||
+		tdcbloom_set_name(&saved, "save test") != true) {
+		fprintf(stderr, "FAILURE: unable to create filter to save\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "key-%zu", i);
+		for (size_t n = 0; n <= i % 3; n++) {
+			tdcbloom_add_string(&saved, key);
+		}
+	}
+
+	fd = mkstemp(path);
+	if (fd == -1) {
+		fprintf(stderr, "FAILURE: unable to create tmp file\n");
+		return false;
+	}
+	close(fd);
+
+	error = tdcbloom_save(&saved, path);
+	if (error != TDCBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: tdcbloom_save(): %s\n", tdcbloom_strerror(error));
+		return false;
+	}
+
+	error = tdcbloom_load(&loaded, path);
+	if (error != TDCBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: tdcbloom_load(): %s\n", tdcbloom_strerror(error));
+		return false;
+	}
+
+	error = tdcbloom_map(&mapped, path, false);
+	if (error != TDCBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: tdcbloom_map(): %s\n", tdcbloom_strerror(error));
+		return false;
+	}
+
+	if (loaded.flags != flags || mapped.flags != flags ||
+		loaded.hash != HASH_WYHASH || mapped.hash != HASH_WYHASH ||
+		loaded.timeout != saved.timeout || loaded.start_time != saved.start_time ||
+		loaded.counter_size != COUNTER_16BIT || loaded.timer_size != TIMER_32BIT ||
+		strcmp(tdcbloom_get_name(&loaded), "save test") != 0 ||
+		strcmp(tdcbloom_get_name(&mapped), "save test") != 0 ||
+		memcmp(loaded.entrymap, saved.entrymap, saved.entrymap_size) != 0 ||
+		memcmp(mapped.entrymap, saved.entrymap, saved.entrymap_size) != 0 ||
+		((uintptr_t)mapped.entrymap % 64) != 0 ||
+		((flags & TDCBLOOM_FLAG_SOA) && ((uintptr_t)mapped.timers % 64) != 0)) {
+		fprintf(stderr, "FAILURE: 0x%02x loaded filter does not match saved filter\n", flags);
+		return false;
+	}
+
+	for (size_t i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "key-%zu", i);
+		if (tdcbloom_count_string(&loaded, key) < i % 3 + 1 ||
+			tdcbloom_count_string(&mapped, key) != tdcbloom_count_string(&saved, key)) {
+			fprintf(stderr, "FAILURE: 0x%02x count of \"%s\" changed\n", flags, key);
+			return false;
+		}
+	}
+	tdcbloom_destroy(&mapped);
+	tdcbloom_destroy(&loaded);
+
+	error = tdcbloom_map(&mapped, path, true);
+	if (error != TDCBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: tdcbloom_map() writable: %s\n", tdcbloom_strerror(error));
+		return false;
+	}
+	tdcbloom_add_string(&mapped, "mapped");
+	tdcbloom_destroy(&mapped);
+
+	if (tdcbloom_load(&loaded, path) != TDCBF_SUCCESS ||
+		tdcbloom_count_string(&loaded, "mapped") != 1) {
+		fprintf(stderr, "FAILURE: 0x%02x change through mapping was not saved\n", flags);
+		return false;
+	}
+	tdcbloom_destroy(&loaded);
+
+	if (truncate(path, sizeof(tdcbloom_file) + saved.entrymap_size - 1) != 0 ||
+		tdcbloom_load(&loaded, path) != TDCBF_INVALIDFILE ||
+		tdcbloom_map(&mapped, path, false) != TDCBF_INVALIDFILE) {
+		fprintf(stderr, "FAILURE: 0x%02x truncated file should not load\n", flags);
+		return false;
+	}
+
+	remove(path);
+	tdcbloom_destroy(&saved);
+
+	return true;
+}
+
 void tdcbloom_print_entries(const tdcbloom *tdcbf) {
     size_t entry_size = 0;
 
@@ -138,7 +396,41 @@ int main() {
 	printf("\thashcount: %d\n", tdcbf.hashcount);
 	printf("\tcounter_size: %d\n", tdcbf.counter_size);
 	printf("\ttimer_size: %d\n", tdcbf.timer_size);
+
+	if (tdcbloom_set_hash(&tdcbf, HASH_WYHASH) != true) {
+		fprintf(stderr, "FAILURE: tdcbloom_set_hash()\n");
+		return EXIT_FAILURE;
+	}
+
+	tdcbloom_add_string(&tdcbf, "wyhash");
+	tdcbloom_add_string(&tdcbf, "wyhash");
+	if (tdcbloom_count_string(&tdcbf, "wyhash") != 2 ||
+		tdcbloom_lookup_string(&tdcbf, "mmh3") != false) {
+		fprintf(stderr, "FAILURE: tdcbloom with HASH_WYHASH\n");
+		return EXIT_FAILURE;
+	}
+
+	if (tdcbloom_set_hash(&tdcbf, HASH_MMH3) != false) {
+		fprintf(stderr, "FAILURE: tdcbloom_set_hash() should fail on a filter with elements\n");
+		return EXIT_FAILURE;
+	}
 	tdcbloom_destroy(&tdcbf);
 
+	// interleaved and separate counter and timestamp arrays
+	printf("testing TDCBLOOM_FLAG_SOA\n");
+	for (counter_size c = COUNTER_8BIT; c <= COUNTER_64BIT; c++) {
+		for (timer_size t = TIMER_8BIT; t <= TIMER_64BIT; t++) {
+			if (!check_layouts(c, t)) {
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	// save, load and map
+	printf("testing tdcbloom_save(), tdcbloom_load(), tdcbloom_map()\n");
+	if (!check_save(0) || !check_save(TDCBLOOM_FLAG_SOA)) {
+		return EXIT_FAILURE;
+	}
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,196 @@
+/* test_tdcbloom_concurrent.c -- TDCBLOOM_FLAG_CONCURRENT filters
+ * shared between threads.
+ *
+ * Checks that counters updated from many threads at once match a
+ * filter built by a single thread, and that sweeping expired entries
+ * while new elements are being added never loses one of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tdcbloom.h"
+
+#define KEY_COUNT   20000
+#define MAX_THREADS 8
+#define TIMEOUT     60
+
+static char keys[KEY_COUNT][16];
+static char old_keys[KEY_COUNT][16];
+
+typedef struct {
+	tdcbloom *tdcbf;
+	size_t    thread;
+} worker_args;
+
+// every thread adds every key, starting at a different point
+static void *add_all_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		tdcbloom_add_string(args->tdcbf, keys[(i + (args->thread * KEY_COUNT / MAX_THREADS)) % KEY_COUNT]);
+	}
+
+	return NULL;
+}
+
+static void *remove_all_worker(void *arg) {
+	worker_args *args = arg;
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		tdcbloom_remove_string(args->tdcbf, keys[(i + (args->thread * KEY_COUNT / MAX_THREADS)) % KEY_COUNT]);
+	}
+
+	return NULL;
+}
+
+// thread 0 sweeps expired entries while the others add every key
+static void *sweep_worker(void *arg) {
+	worker_args *args = arg;
+
+	if (args->thread != 0) {
+		return add_all_worker(arg);
+	}
+
+	for (size_t i = 0; i < 20; i++) {
+		tdcbloom_clear_expired(args->tdcbf);
+	}
+
+	return NULL;
+}
+
+static void run_threads(tdcbloom *tdcbf, void *(*worker)(void *)) {
+	pthread_t   tids[MAX_THREADS];
+	worker_args args[MAX_THREADS];
+
+	for (size_t t = 0; t < MAX_THREADS; t++) {
+		args[t] = (worker_args){ .tdcbf = tdcbf, .thread = t };
+		if (pthread_create(&tids[t], NULL, worker, &args[t]) != 0) {
+			fprintf(stderr, "FAILURE: pthread_create()\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (size_t t = 0; t < MAX_THREADS; t++) {
+		pthread_join(tids[t], NULL);
+	}
+}
+
+static bool test_counters(const counter_size csize, const char *name) {
+	tdcbloom tdcbf, serial;
+
+	printf("testing %s counters from %d threads\n", name, MAX_THREADS);
+
+	if (tdcbloom_init_flags(&tdcbf, KEY_COUNT, 0.01, TIMEOUT, csize, TIMER_16BIT,
+							TDCBLOOM_FLAG_CONCURRENT) != TDCBF_SUCCESS ||
+		!(tdcbf.flags & TDCBLOOM_FLAG_SOA) ||
+		tdcbloom_init_flags(&serial, KEY_COUNT, 0.01, TIMEOUT, csize, TIMER_16BIT,
+							TDCBLOOM_FLAG_SOA) != TDCBF_SUCCESS) {
+		fprintf(stderr, "FAILURE: tdcbloom_init_flags()\n");
+		return false;
+	}
+
+	run_threads(&tdcbf, add_all_worker);
+	for (size_t t = 0; t < MAX_THREADS; t++) {
+		for (size_t i = 0; i < KEY_COUNT; i++) {
+			tdcbloom_add_string(&serial, keys[i]);
+		}
+	}
+
+	if (memcmp(tdcbf.counters, serial.counters, tdcbf.size * tdcbf.counter_size_bytes) != 0) {
+		fprintf(stderr, "FAILURE: concurrent and serial %s counters differ\n", name);
+		return false;
+	}
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		if (tdcbloom_count_string(&tdcbf, keys[i]) < MAX_THREADS) {
+			fprintf(stderr, "FAILURE: \"%s\" counted %zu times\n", keys[i], tdcbloom_count_string(&tdcbf, keys[i]));
+			return false;
+		}
+	}
+
+	run_threads(&tdcbf, remove_all_worker);
+	if (tdcbloom_get_average_count(&tdcbf) != 0.0) {
+		fprintf(stderr, "FAILURE: %s counters left after removing every key\n", name);
+		return false;
+	}
+
+	tdcbloom_destroy(&tdcbf);
+	tdcbloom_destroy(&serial);
+
+	return true;
+}
+
+static bool test_sweep(void) {
+	tdcbloom tdcbf;
+	size_t   swept, found = 0;
+
+	printf("testing expiry sweeps alongside %d threads\n", MAX_THREADS - 1);
+
+	tdcbloom_init_flags(&tdcbf, KEY_COUNT * 2, 0.01, TIMEOUT, COUNTER_16BIT, TIMER_32BIT,
+						TDCBLOOM_FLAG_CONCURRENT);
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		tdcbloom_add_string(&tdcbf, old_keys[i]);
+	}
+
+	// old keys were added twice the timeout ago. new entries can't
+	// expire while the sweeps run
+	uint32_t *timers = (uint32_t *)tdcbf.timers;
+	for (size_t i = 0; i < tdcbf.size; i++) {
+		if (timers[i] != 0) {
+			timers[i] = (timers[i] + tdcbf.max_time - TIMEOUT * 2) % tdcbf.max_time;
+			timers[i] = (timers[i] == 0) ? tdcbf.max_time - 1 : timers[i];
+		}
+	}
+
+	run_threads(&tdcbf, sweep_worker);
+	swept = tdcbloom_clear_expired(&tdcbf);
+	if (tdcbloom_count_expired(&tdcbf) != 0) {
+		fprintf(stderr, "FAILURE: expired entries left after sweeping\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		if (tdcbloom_count_string(&tdcbf, keys[i]) < MAX_THREADS - 1) {
+			fprintf(stderr, "FAILURE: \"%s\" lost while sweeping\n", keys[i]);
+			return false;
+		}
+		found += tdcbloom_lookup_string(&tdcbf, old_keys[i]);
+	}
+
+	// old keys survive only where new keys refreshed all of their entries
+	printf("%zu entries left for the last sweep, %zu old keys still found\n", swept, found);
+	if (found > KEY_COUNT / 10) {
+		fprintf(stderr, "FAILURE: %zu old keys weren't swept\n", found);
+		return false;
+	}
+
+	tdcbloom_destroy(&tdcbf);
+
+	return true;
+}
+
+int main() {
+	counter_size  sizes[] = { COUNTER_8BIT, COUNTER_16BIT, COUNTER_32BIT, COUNTER_64BIT };
+	const char   *names[] = { "8 bit", "16 bit", "32 bit", "64 bit" };
+
+	for (size_t i = 0; i < KEY_COUNT; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "key-%zu", i);
+		snprintf(old_keys[i], sizeof(old_keys[i]), "old-%zu", i);
+	}
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (!test_counters(sizes[i], names[i])) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!test_sweep()) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}